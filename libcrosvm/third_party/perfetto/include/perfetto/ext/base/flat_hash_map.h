@@ -143,6 +143,7 @@ class FlatHashMap {
     values_ = std::move(other.values_);
     capacity_ = other.capacity_;
     size_ = other.size_;
+    num_tombstones_ = other.num_tombstones_;
     max_probe_length_ = other.max_probe_length_;
     load_limit_ = other.load_limit_;
     load_limit_percent_ = other.load_limit_percent_;
@@ -170,7 +171,8 @@ class FlatHashMap {
     //  - Finds an insertion slot and proceeds because the load is < limit.
     // The second iteration is only hit in the unlikely case of this insertion
     // bringing the table beyond the target |load_limit_| (or the edge case
-    // of the HT being full, if |load_limit_pct_| = 100).
+    // of the HT being full, if |load_limit_pct_| = 100). Tombstones count
+    // towards the limit, as they lengthen the probe chains just like entries.
     // We cannot simply pre-grow the table before insertion, because we must
     // guarantee that calling Insert() with a key that already exists doesn't
     // invalidate iterators.
@@ -215,9 +217,11 @@ class FlatHashMap {
 
       // If we got to this point the key does not exist (otherwise we would have
       // hit the the return above) and we are going to insert a new entry.
-      // Before doing so, ensure we stay under the target load limit.
-      if (PERFETTO_UNLIKELY(size_ >= load_limit_)) {
-        MaybeGrowAndRehash(/*grow=*/true);
+      // Before doing so, ensure we stay under the target load limit. If most
+      // of the used slots are tombstones (e.g., a map with lots of churn), just
+      // rehash to clear them, without growing.
+      if (PERFETTO_UNLIKELY(size_ + num_tombstones_ >= load_limit_)) {
+        MaybeGrowAndRehash(/*grow=*/size_ * 2 >= load_limit_);
         continue;
       }
       PERFETTO_DCHECK(insertion_slot != kSlotNotFound);
@@ -228,6 +232,8 @@ class FlatHashMap {
 
     // We found a free slot (or a tombstone). Proceed with the insertion.
     Value* value_idx = &values_[insertion_slot];
+    if (!AppendOnly && tags_[insertion_slot] == kTombstone)
+      num_tombstones_--;
     new (&keys_[insertion_slot]) Key(std::move(key));
     new (value_idx) Value(std::move(value));
     tags_[insertion_slot] = tag;
@@ -314,6 +320,7 @@ class FlatHashMap {
     keys_[idx].~Key();
     values_[idx].~Value();
     size_--;
+    num_tombstones_++;
   }
 
   PERFETTO_NO_INLINE void MaybeGrowAndRehash(bool grow) {
@@ -358,6 +365,7 @@ class FlatHashMap {
     capacity_ = n;
     max_probe_length_ = 0;
     size_ = 0;
+    num_tombstones_ = 0;
     load_limit_ = n * static_cast<size_t>(load_limit_percent_) / 100;
     load_limit_ = std::min(load_limit_, n);
 
@@ -377,6 +385,7 @@ class FlatHashMap {
 
   size_t capacity_ = 0;
   size_t size_ = 0;
+  size_t num_tombstones_ = 0;  // Always 0 if AppendOnly.
   size_t max_probe_length_ = 0;
   size_t load_limit_ = 0;  // Updated every time |capacity_| changes.
   int load_limit_percent_ =
@@ -32,6 +32,7 @@
 namespace perfetto {
 namespace base {
 
+class HttpServer;
 class HttpServerConnection;
 
 struct HttpRequest {
@@ -105,6 +106,18 @@ class HttpServerConnection {
     SendResponse(http_code, headers, content, true);
   }
 
+  // Can be called within OnHttpRequest() to send the response after it has
+  // returned (e.g. once the response has been computed on another thread).
+  // The response must still be sent on the task runner thread. Requests
+  // received in the meantime on the same connection are not dispatched until
+  // EndDeferredResponse() is called, so that responses are sent in order.
+  void DeferResponse();
+
+  // Marks the deferred response as fully sent and dispatches the requests
+  // received in the meantime, if any. Must not be called within
+  // OnHttpRequest().
+  void EndDeferredResponse();
+
   // The metods below are only valid for websocket connections.
 
   // Upgrade an existing connection to a websocket. This can be called only in
@@ -131,8 +144,10 @@ class HttpServerConnection {
   std::unique_ptr<UnixSocket> sock;
   PagedMemory rxbuf;
   size_t rxbuf_used = 0;
+  HttpServer* server_ = nullptr;
   bool is_websocket_ = false;
   bool headers_sent_ = false;
+  bool response_deferred_ = false;
   size_t content_len_headers_ = 0;
   size_t content_len_actual_ = 0;
 
@@ -162,6 +177,9 @@ class HttpServer : public UnixSocket::EventListener {
   void AddAllowedOrigin(const std::string&);
 
  private:
+  friend class HttpServerConnection;
+
+  void ProcessReceivedData(HttpServerConnection*);
   size_t ParseOneHttpRequest(HttpServerConnection*);
   size_t ParseOneWebsocketFrame(HttpServerConnection*);
   void HandleCorsPreflightRequest(const HttpRequest&);
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_EXT_BASE_THREAD_POOL_H_
+#define INCLUDE_PERFETTO_EXT_BASE_THREAD_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "perfetto/base/export.h"
+
+namespace perfetto {
+namespace base {
+
+// A fixed-size pool of worker threads executing tasks in FIFO order.
+//
+// Unlike ThreadTaskRunner, there is no affinity between a task and a thread:
+// tasks can run concurrently and complete in any order. This makes the pool
+// suitable for fanning out independent, CPU-bound pieces of work (e.g. sorting
+// several buffers) and joining on the result.
+//
+// A pool created with zero threads (or any pool on platforms without thread
+// support, e.g. WASM) runs tasks synchronously on the calling thread. This
+// allows callers to unconditionally use the pool and have the parallelism be
+// controlled by configuration.
+//
+// All methods can be called from any thread. Tasks which are still queued
+// when the pool is destroyed are run before the worker threads are joined.
+class PERFETTO_EXPORT_COMPONENT ThreadPool {
+ public:
+  explicit ThreadPool(uint32_t num_threads, const std::string& name = "");
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Queues |task| to be run on one of the worker threads.
+  void PostTask(std::function<void()> task);
+
+  // Invokes |fn(i)| for each i in [0, count), spreading the invocations across
+  // the worker threads and the calling thread. Returns only once all the
+  // invocations have completed. |fn| must be safe to call concurrently for
+  // different values of i.
+  void RunParallel(size_t count, const std::function<void(size_t)>& fn);
+
+  uint32_t num_threads() const {
+    return static_cast<uint32_t>(threads_.size());
+  }
+
+ private:
+  void RunWorker(uint32_t index);
+
+  std::string name_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;  // Guarded by |mutex_|.
+  bool quit_ = false;                        // Guarded by |mutex_|.
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_EXT_BASE_THREAD_POOL_H_
@@ -132,6 +132,29 @@ struct PERFETTO_EXPORT_COMPONENT Config {
   // When set to true, trace processor will be augmented with a bunch of helpful
   // features for local development such as extra SQL fuctions.
   bool enable_dev_features = false;
+
+  // The maximum number of bytes of trace packets which trace processor holds
+  // in memory while waiting for them to be sorted. Once the limit is hit, the
+  // payload of any further packet is written to a temporary file and read
+  // back when the packet is extracted from the sorter. The sort keys of all
+  // packets (and their interning state) are always kept in memory.
+  //
+  // This is mostly useful with |SortingMode::kForceFullSort| (or ring-buffer
+  // traces) where all packets are kept until the end of the trace, allowing
+  // traces larger than the available memory to be imported.
+  //
+  // Setting this to 0 (the default) disables the limit. This option has no
+  // effect on Windows and WASM builds.
+  uint64_t sorting_memory_limit_bytes = 0;
+
+  // The number of worker threads trace processor can use to parallelize
+  // queries. Currently this allows the rows of large tables to be split into
+  // chunks which are filtered concurrently when a query has constraints which
+  // need to scan every row (e.g. "dur > 1000000" on the sched table).
+  //
+  // Setting this to 0 (the default) runs queries entirely on the calling
+  // thread. This option has no effect in WASM builds.
+  uint32_t query_threads = 0;
 };
 
 // Represents a dynamically typed value returned by SQL.
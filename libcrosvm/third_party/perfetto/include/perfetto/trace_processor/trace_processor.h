@@ -111,6 +111,14 @@ class PERFETTO_EXPORT_COMPONENT TraceProcessor : public TraceProcessorStorage {
   // by the ingestion process. Returns the number of table/views deleted.
   virtual size_t RestoreInitialTables() = 0;
 
+  // Writes a snapshot of the contents of the trace tables to the file at
+  // |path|. The trace must have been fully loaded (i.e. NotifyEndOfFile()
+  // must have been called). The snapshot can be passed back to a new instance
+  // of trace processor in place of the original trace to skip parsing it
+  // again. Snapshots can only be loaded by the same version of trace
+  // processor which wrote them.
+  virtual base::Status SaveSnapshot(const std::string& path) = 0;
+
   // Sets/returns the name of the currently loaded trace or an empty string if
   // no trace is fully loaded yet. This has no effect on the Trace Processor
   // functionality and is used for UI purposes only.
@@ -48,6 +48,7 @@ class TraceProcessorConfig:
   ingest_ftrace_in_raw: bool
   enable_dev_features: bool
   resolver_registry: Optional[ResolverRegistry]
+  columnar_query_results: bool
 
   def __init__(self,
                bin_path: Optional[str] = None,
@@ -55,13 +56,15 @@ class TraceProcessorConfig:
                verbose: bool = False,
                ingest_ftrace_in_raw: bool = False,
                enable_dev_features=False,
-               resolver_registry: Optional[ResolverRegistry] = None):
+               resolver_registry: Optional[ResolverRegistry] = None,
+               columnar_query_results: bool = False):
     self.bin_path = bin_path
     self.unique_port = unique_port
     self.verbose = verbose
     self.ingest_ftrace_in_raw = ingest_ftrace_in_raw
     self.enable_dev_features = enable_dev_features
     self.resolver_registry = resolver_registry
+    self.columnar_query_results = columnar_query_results
 
 
 class TraceProcessor:
@@ -104,6 +107,13 @@ class TraceProcessor:
       # contents into lists based on the type of the batch
       batch_index = 0
       while True:
+        if batches[batch_index].DESCRIPTOR.name == 'ColumnsBatch':
+          self.__extend_from_columns_batch(batches[batch_index])
+          if batches[batch_index].is_last_batch:
+            break
+          batch_index += 1
+          continue
+
         # It's possible on some occasions that there are non UTF-8 characters
         # in the string_cells field. If this is the case, string_cells is
         # a bytestring which needs to be decoded (but passing ignore so that
@@ -153,6 +163,42 @@ class TraceProcessor:
                                       " is not a multiple of column count " +
                                       str(len(self.__column_names)))
 
+    # Appends the cells of a QueryResult.ColumnsBatch (see
+    # QueryArgs.COLUMNS_BATCH) in the same row-major order as a CellsBatch.
+    def __extend_from_columns_batch(self, batch):
+      # See the comment about non UTF-8 characters above.
+      string_dict = batch.string_dict
+      try:
+        string_dict = string_dict.decode('utf-8', 'ignore')
+      except AttributeError:
+        pass
+      strings = string_dict.split('\0')[:-1]
+
+      columns = batch.columns
+      # For each column, the index of the next cell of each type and the value
+      # of the last CELL_VARINT cell, which the next one is a delta from.
+      next_cells = [[0] * 6 for _ in columns]
+      last_varints = [0] * len(columns)
+      data_lists = self.__data_lists
+      for row in range(batch.num_rows):
+        for col_index, col in enumerate(columns):
+          cell_type = col.cells[row] if col.cells else col.cell_type
+          self.__cells.append(cell_type)
+          index = next_cells[col_index][cell_type]
+          next_cells[col_index][cell_type] += 1
+          if cell_type == TraceProcessor.QUERY_CELL_VARINT_FIELD_ID:
+            # Deltas are computed with 64-bit wrap-around arithmetic.
+            value = last_varints[col_index] + col.varint_deltas[index]
+            value = (value + 2**63) % 2**64 - 2**63
+            last_varints[col_index] = value
+            data_lists[cell_type].append(value)
+          elif cell_type == TraceProcessor.QUERY_CELL_FLOAT64_FIELD_ID:
+            data_lists[cell_type].append(col.float64_cells[index])
+          elif cell_type == TraceProcessor.QUERY_CELL_STRING_FIELD_ID:
+            data_lists[cell_type].append(strings[col.string_ids[index]])
+          elif cell_type == TraceProcessor.QUERY_CELL_BLOB_FIELD_ID:
+            data_lists[cell_type].append(col.blob_cells[index])
+
     # To use the query result as a populated Pandas dataframe, this
     # function must be called directly after calling query inside
     # TraceProcesor.
@@ -279,12 +325,15 @@ class TraceProcessor:
       can also be converted to a pandas dataframe by calling the
       as_pandas_dataframe() function after calling query.
     """
-    response = self.http.execute_query(sql)
+    response = self.http.execute_query(
+        sql, columnar=self.config.columnar_query_results)
     if response.error:
       raise TraceProcessorException(response.error)
 
-    return TraceProcessor.QueryResultIterator(response.column_names,
-                                              response.batch)
+    # Older trace processor binaries ignore the requested result format and
+    # always return CellsBatch.
+    return TraceProcessor.QueryResultIterator(
+        response.column_names, response.columns_batch or response.batch)
 
   def metric(self, metrics: List[str]):
     """Returns the metrics data corresponding to the passed in trace metric.
@@ -61,3 +61,5 @@ class ProtoFactory:
         'perfetto.protos.DisableAndReadMetatraceResult')
     self.CellsBatch = create_message_factory(
         'perfetto.protos.QueryResult.CellsBatch')
+    self.ColumnsBatch = create_message_factory(
+        'perfetto.protos.QueryResult.ColumnsBatch')
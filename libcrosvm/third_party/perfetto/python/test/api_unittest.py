@@ -165,6 +165,41 @@ class TestQueryResultIterator(unittest.TestCase):
       for row in qr_iterator:
         pass
 
+  def test_columns_batches(self):
+    # Column foo_ts has a single type, so it's stored once in |cell_type|, and
+    # its deltas restart from 0 in each batch.
+    first = PROTO_FACTORY.ColumnsBatch()
+    first.num_rows = 3
+    first.string_dict = "bar1\0bar2\0"
+    ts = first.columns.add()
+    ts.cell_type = TestQueryResultIterator.CELL_VARINT
+    ts.varint_deltas.extend([100, 50, -20])
+    name = first.columns.add()
+    name.cells.extend([
+        TestQueryResultIterator.CELL_STRING,
+        TestQueryResultIterator.CELL_NULL,
+        TestQueryResultIterator.CELL_STRING,
+    ])
+    name.string_ids.extend([1, 1])
+
+    second = PROTO_FACTORY.ColumnsBatch()
+    second.num_rows = 1
+    second.string_dict = "bar3\0"
+    ts = second.columns.add()
+    ts.cell_type = TestQueryResultIterator.CELL_VARINT
+    ts.varint_deltas.extend([-(2**63)])
+    name = second.columns.add()
+    name.cell_type = TestQueryResultIterator.CELL_STRING
+    name.string_ids.extend([0])
+    second.is_last_batch = True
+
+    qr_iterator = TraceProcessor.QueryResultIterator(['foo_ts', 'foo_name'],
+                                                     [first, second])
+
+    rows = [(row.foo_ts, row.foo_name) for row in qr_iterator]
+    self.assertEqual(rows, [(100, 'bar2'), (150, None), (130, 'bar2'),
+                            (-(2**63), 'bar3')])
+
   def test_incorrect_columns_batch(self):
     batch = PROTO_FACTORY.CellsBatch()
     batch.cells.extend([
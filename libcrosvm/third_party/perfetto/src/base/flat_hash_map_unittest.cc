@@ -191,6 +191,31 @@ TYPED_TEST(FlatHashMapTest, FillWithTombstones) {
   }
 }
 
+// A map with lots of churn (e.g. entries keyed by address which are inserted
+// and erased all the time) must not fill up with tombstones, otherwise every
+// lookup ends up scanning the whole table.
+TYPED_TEST(FlatHashMapTest, ChurnClearsTombstones) {
+  using Probe = typename TestFixture::Probe;
+  struct TestMap : public FlatHashMap<int, int, base::Hash<int>, Probe> {
+    size_t max_probe_length() const { return this->max_probe_length_; }
+  };
+  TestMap fmap;
+
+  const int kNumLive = 100;
+  const int kNumInserts = 100000;
+  for (int i = 0; i < kNumInserts; i++) {
+    ASSERT_TRUE(fmap.Insert(i, i).second);
+    if (i >= kNumLive) {
+      ASSERT_TRUE(fmap.Erase(i - kNumLive));
+    }
+  }
+  ASSERT_EQ(fmap.size(), static_cast<size_t>(kNumLive));
+  for (int i = kNumInserts - kNumLive; i < kNumInserts; i++)
+    ASSERT_NE(fmap.Find(i), nullptr);
+  EXPECT_EQ(fmap.capacity(), 1024u);
+  EXPECT_LT(fmap.max_probe_length(), fmap.capacity() / 4);
+}
+
 TYPED_TEST(FlatHashMapTest, Collisions) {
   FlatHashMap<int, int, CollidingHasher, typename TestFixture::Probe> fmap(
       /*initial_capacity=*/0, /*load_limit_pct=*/100);
@@ -82,6 +82,7 @@ void HttpServer::OnNewIncomingConnection(
     std::unique_ptr<UnixSocket> sock) {
   PERFETTO_LOG("[HTTP] New connection");
   clients_.emplace_back(std::move(sock));
+  clients_.back().server_ = this;
 }
 
 void HttpServer::OnConnect(UnixSocket*, bool) {}
@@ -117,10 +118,19 @@ void HttpServer::OnDataAvailable(UnixSocket* sock) {
     if (rsize == 0 || conn->rxbuf_avail() == 0)
       break;
   }
+  ProcessReceivedData(conn);
+}
+
+void HttpServer::ProcessReceivedData(HttpServerConnection* conn) {
+  char* rxbuf = reinterpret_cast<char*>(conn->rxbuf.Get());
 
   // At this point |rxbuf| can contain a partial HTTP request, a full one or
   // more (in case of HTTP Keepalive pipelining).
   for (;;) {
+    // The next request will be dispatched by EndDeferredResponse().
+    if (conn->response_deferred_)
+      break;
+
     size_t bytes_consumed;
 
     if (conn->is_websocket()) {
@@ -237,12 +247,14 @@ size_t HttpServer::ParseOneHttpRequest(HttpServerConnection* conn) {
     req_handler_->OnHttpRequest(http_req);
   }
 
-  // The handler is expected to send a response. If not, bail with a HTTP 500.
-  if (!conn->headers_sent_)
+  // The handler is expected to send (or defer) a response. If not, bail with a
+  // HTTP 500.
+  if (!conn->headers_sent_ && !conn->response_deferred_)
     conn->SendResponseAndClose("500 Internal Server Error");
 
   // Allow chaining multiple responses in the same HTTP-Keepalive connection.
-  conn->headers_sent_ = false;
+  if (!conn->response_deferred_)
+    conn->headers_sent_ = false;
 
   return headers_size + body_size;
 }
@@ -510,6 +522,20 @@ void HttpServerConnection::SendResponseBody(const void* data, size_t len) {
   sock->Send(data, len);
 }
 
+void HttpServerConnection::DeferResponse() {
+  PERFETTO_CHECK(!headers_sent_);
+  PERFETTO_CHECK(!is_websocket_);
+  response_deferred_ = true;
+}
+
+void HttpServerConnection::EndDeferredResponse() {
+  PERFETTO_CHECK(response_deferred_);
+  response_deferred_ = false;
+  headers_sent_ = false;
+  if (sock->is_connected())
+    server_->ProcessReceivedData(this);
+}
+
 void HttpServerConnection::Close() {
   sock->Shutdown(/*notify=*/true);
 }
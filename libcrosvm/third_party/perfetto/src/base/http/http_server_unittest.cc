@@ -18,6 +18,7 @@
 
 #include <initializer_list>
 #include <string>
+#include <vector>
 
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/unix_socket.h"
@@ -29,6 +30,7 @@ namespace base {
 namespace {
 
 using testing::_;
+using testing::ElementsAre;
 using testing::Invoke;
 using testing::InvokeWithoutArgs;
 using testing::NiceMock;
@@ -218,6 +220,46 @@ TEST_F(HttpServerTest, POST_Keepalive) {
   EXPECT_EQ(cli.RecvAndWaitConnClose(), expected_response);
 }
 
+// Send two requests within the same keepalive connection and reply to each of
+// them asynchronously. The second request must be dispatched only after the
+// response to the first one has been sent.
+TEST_F(HttpServerTest, POST_DeferredResponse) {
+  HttpCli cli(&task_runner_);
+  std::vector<std::string> events;
+  EXPECT_CALL(handler_, OnHttpConnectionClosed(_)).Times(1);
+  EXPECT_CALL(handler_, OnHttpRequest(_))
+      .Times(2)
+      .WillRepeatedly(Invoke([&](const HttpRequest& req) {
+        std::string uri = req.uri.ToStdString();
+        events.push_back("request " + uri);
+        HttpServerConnection* conn = req.conn;
+        conn->DeferResponse();
+        task_runner_.PostTask([&events, conn, uri] {
+          events.push_back("response " + uri);
+          conn->SendResponse("200 OK", {}, StringView(uri));
+          conn->EndDeferredResponse();
+          if (uri == "/1")
+            conn->Close();
+        });
+      }));
+
+  cli.SendHttpReq({"POST /0 HTTP/1.1", "Connection: keep-alive"}, "body0");
+  cli.SendHttpReq({"POST /1 HTTP/1.1", "Connection: keep-alive"}, "body1");
+
+  std::string expected_response;
+  for (int i = 0; i < 2; i++) {
+    expected_response +=
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Length: 2\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n/" +
+        std::to_string(i);
+  }
+  EXPECT_EQ(cli.RecvAndWaitConnClose(), expected_response);
+  EXPECT_THAT(events, ElementsAre("request /0", "response /0", "request /1",
+                                  "response /1"));
+}
+
 TEST_F(HttpServerTest, Websocket) {
   srv_.AddAllowedOrigin("http://foo.com");
   srv_.AddAllowedOrigin("http://websocket.com");
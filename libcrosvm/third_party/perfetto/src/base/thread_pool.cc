@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/ext/base/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/thread_utils.h"
+
+namespace perfetto {
+namespace base {
+
+ThreadPool::ThreadPool(uint32_t num_threads, const std::string& name)
+    : name_(name) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  // No threads on WASM: PostTask() will run tasks inline.
+  base::ignore_result(num_threads);
+#else
+  threads_.reserve(num_threads);
+  for (uint32_t i = 0; i < num_threads; ++i)
+    threads_.emplace_back(&ThreadPool::RunWorker, this, i);
+#endif
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& thread : threads_)
+    thread.join();
+  PERFETTO_DCHECK(tasks_.empty());
+}
+
+void ThreadPool::PostTask(std::function<void()> task) {
+  if (threads_.empty()) {
+    task();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    PERFETTO_DCHECK(!quit_);
+    tasks_.emplace_back(std::move(task));
+  }
+  cv_.notify_one();
+}
+
+void ThreadPool::RunParallel(size_t count,
+                             const std::function<void(size_t)>& fn) {
+  if (count == 0)
+    return;
+  if (threads_.empty() || count == 1) {
+    for (size_t i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+
+  // The state is shared with the helper tasks posted below. Helpers can be
+  // scheduled after all the work has been claimed (and this function has
+  // returned), so they must not reference anything on this stack frame other
+  // than through |state|.
+  struct State {
+    explicit State(const std::function<void(size_t)>& f, size_t c)
+        : fn(f), count(c) {}
+
+    // Claims and runs indices until none are left.
+    void Drain() {
+      size_t done = 0;
+      for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+        fn(i);
+        ++done;
+      }
+      if (done == 0)
+        return;
+      std::lock_guard<std::mutex> lock(mutex);
+      completed += done;
+      if (completed == count)
+        cv.notify_all();
+    }
+
+    const std::function<void(size_t)>& fn;
+    const size_t count;
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t completed = 0;  // Guarded by |mutex|.
+  };
+  auto state = std::make_shared<State>(fn, count);
+
+  size_t num_helpers = std::min(count - 1, threads_.size());
+  for (size_t i = 0; i < num_helpers; ++i)
+    PostTask([state] { state->Drain(); });
+
+  // The calling thread helps out rather than just blocking.
+  state->Drain();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [&state] { return state->completed == state->count; });
+}
+
+void ThreadPool::RunWorker(uint32_t index) {
+  if (!name_.empty())
+    MaybeSetThreadName(name_ + "." + std::to_string(index));
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return quit_ || !tasks_.empty(); });
+      if (tasks_.empty())
+        return;  // |quit_| must be true.
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+}  // namespace base
+}  // namespace perfetto
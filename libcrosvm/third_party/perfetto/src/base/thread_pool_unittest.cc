@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/ext/base/thread_pool.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "perfetto/ext/base/waitable_event.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+TEST(ThreadPoolTest, ZeroThreadsRunsInline) {
+  ThreadPool pool(0);
+  EXPECT_EQ(pool.num_threads(), 0u);
+  std::thread::id task_thread;
+  pool.PostTask([&task_thread] { task_thread = std::this_thread::get_id(); });
+  EXPECT_EQ(task_thread, std::this_thread::get_id());
+}
+
+TEST(ThreadPoolTest, PostTaskRunsOnWorker) {
+  std::thread::id task_thread;
+  WaitableEvent done;
+  ThreadPool pool(2);
+  EXPECT_EQ(pool.num_threads(), 2u);
+  pool.PostTask([&] {
+    task_thread = std::this_thread::get_id();
+    done.Notify();
+  });
+  done.Wait();
+  EXPECT_NE(task_thread, std::this_thread::get_id());
+}
+
+TEST(ThreadPoolTest, DestructorRunsPendingTasks) {
+  std::atomic<uint32_t> runs{0};
+  {
+    ThreadPool pool(1);
+    for (uint32_t i = 0; i < 100; ++i)
+      pool.PostTask([&runs] { runs++; });
+  }
+  EXPECT_EQ(runs, 100u);
+}
+
+TEST(ThreadPoolTest, RunParallelVisitsEachIndexOnce) {
+  ThreadPool pool(4);
+  std::vector<std::atomic<uint32_t>> visits(1000);
+  pool.RunParallel(visits.size(), [&visits](size_t i) { visits[i]++; });
+  for (const auto& v : visits)
+    ASSERT_EQ(v, 1u);
+}
+
+TEST(ThreadPoolTest, RunParallelWithoutThreads) {
+  ThreadPool pool(0);
+  std::vector<size_t> order;
+  pool.RunParallel(5, [&order](size_t i) { order.push_back(i); });
+  EXPECT_EQ(order, (std::vector<size_t>{0, 1, 2, 3, 4}));
+}
+
+TEST(ThreadPoolTest, RunParallelWhileWorkersBusy) {
+  // Even if all the workers are blocked, RunParallel() must make progress
+  // because the calling thread participates in the work.
+  WaitableEvent unblock;
+  ThreadPool pool(1);
+  pool.PostTask([&unblock] { unblock.Wait(); });
+
+  std::atomic<uint32_t> sum{0};
+  pool.RunParallel(10, [&sum](size_t i) { sum += static_cast<uint32_t>(i); });
+  EXPECT_EQ(sum, 45u);
+  unblock.Notify();
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
@@ -48,6 +48,10 @@ class LazyKernelSymbolizer {
 
   bool is_valid() const { return !!symbol_map_; }
 
+  // Returns the symbol map if it has been created, nullptr otherwise. Unlike
+  // GetOrCreateKernelSymbolMap(), this can be called from any thread.
+  KernelSymbolMap* symbol_map() const { return symbol_map_.get(); }
+
   // Destroys the |symbol_map_| freeing up memory. A further call to
   // GetOrCreateKernelSymbolMap() will create it again.
   void Destroy();
@@ -757,17 +757,16 @@ base::Optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
       packet_writer_ = CreateFilePacketWriter(trace_out_stream_.get());
   }
 
+  // When tracing directly to file, the service takes care of compressing the
+  // trace.
   if (trace_config_->compression_type() ==
-      TraceConfig::COMPRESSION_TYPE_DEFLATE) {
-    if (packet_writer_) {
+          TraceConfig::COMPRESSION_TYPE_DEFLATE &&
+      packet_writer_) {
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
-      packet_writer_ = CreateZipPacketWriter(std::move(packet_writer_));
+    packet_writer_ = CreateZipPacketWriter(std::move(packet_writer_));
 #else
-      PERFETTO_ELOG("Cannot compress. Zlib not enabled in the build config");
+    PERFETTO_ELOG("Cannot compress. Zlib not enabled in the build config");
 #endif
-    } else {
-      PERFETTO_ELOG("Cannot compress when tracing directly to file.");
-    }
   }
 
   bool will_trace_indefinitely =
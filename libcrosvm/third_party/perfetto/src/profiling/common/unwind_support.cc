@@ -22,10 +22,15 @@
 #include <unwindstack/Maps.h>
 #include <unwindstack/Memory.h>
 
-#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/utils.h"
 
 namespace perfetto {
 namespace profiling {
+namespace {
+
+constexpr size_t kMapsReadChunkSize = 64 * 1024;
+
+}  // namespace
 
 StackOverlayMemory::StackOverlayMemory(std::shared_ptr<unwindstack::Memory> mem,
                                        uint64_t sp,
@@ -58,13 +63,24 @@ size_t FDMemory::Read(uint64_t addr, void* dst, size_t size) {
 FDMaps::FDMaps(base::ScopedFile fd) : fd_(std::move(fd)) {}
 
 bool FDMaps::Parse() {
-  // If the process has already exited, lseek or ReadFileDescriptor will
-  // return false.
-  if (lseek(*fd_, 0, SEEK_SET) == -1)
-    return false;
-
+  // Read with pread rather than lseek and read, as heapprofd can parse the
+  // maps of a process from several threads, using dups of the same fd (which
+  // share the file offset).
   std::string content;
-  if (!base::ReadFileDescriptor(*fd_, &content))
+  for (;;) {
+    size_t offset = content.size();
+    content.resize(offset + kMapsReadChunkSize);
+    ssize_t rd = PERFETTO_EINTR(pread64(*fd_, &content[offset],
+                                        kMapsReadChunkSize,
+                                        static_cast<off64_t>(offset)));
+    content.resize(offset + (rd > 0 ? static_cast<size_t>(rd) : 0));
+    if (rd == -1)
+      return false;
+    if (rd == 0)
+      break;
+  }
+  // If the process has already exited, its maps are empty.
+  if (content.empty())
     return false;
 
   unwindstack::SharedString name("");
@@ -30,6 +30,13 @@
 namespace perfetto {
 namespace profiling {
 
+HeapTracker::~HeapTracker() {
+  // The Allocation(s) point to the CallstackAllocations: destroy them first.
+  allocations_.Clear();
+  for (auto it = callstack_allocations_.GetIterator(); it; ++it)
+    callstack_allocations_arena_.Delete(it.value());
+}
+
 void HeapTracker::RecordMalloc(
     const std::vector<unwindstack::FrameData>& callstack,
     const std::vector<std::string>& build_ids,
@@ -44,18 +51,18 @@ void HeapTracker::RecordMalloc(
   for (size_t i = 0; i < callstack.size(); ++i) {
     const unwindstack::FrameData& loc = callstack[i];
     const std::string& build_id = build_ids[i];
-    auto frame_it = frame_cache_.find(loc.pc);
-    if (frame_it != frame_cache_.end()) {
-      frames.emplace_back(frame_it->second);
+    Interned<Frame>* cached_frame = frame_cache_.Find(loc.pc);
+    if (cached_frame) {
+      frames.emplace_back(*cached_frame);
     } else {
       frames.emplace_back(callsites_->InternCodeLocation(loc, build_id));
-      frame_cache_.emplace(loc.pc, frames.back());
+      frame_cache_.Insert(loc.pc, frames.back());
     }
   }
 
-  auto it = allocations_.find(address);
-  if (it != allocations_.end()) {
-    Allocation& alloc = it->second;
+  Allocation* existing_alloc = allocations_.Find(address);
+  if (existing_alloc) {
+    Allocation& alloc = *existing_alloc;
     PERFETTO_DCHECK(alloc.sequence_number != sequence_number);
     if (alloc.sequence_number < sequence_number) {
       // As we are overwriting the previous allocation, the previous allocation
@@ -81,9 +88,9 @@ void HeapTracker::RecordMalloc(
     }
   } else {
     GlobalCallstackTrie::Node* node = callsites_->CreateCallsite(frames);
-    allocations_.emplace(address,
-                         Allocation(sample_size, alloc_size, sequence_number,
-                                    MaybeCreateCallstackAllocations(node)));
+    allocations_.Insert(address,
+                        Allocation(sample_size, alloc_size, sequence_number,
+                                   MaybeCreateCallstackAllocations(node)));
   }
 
   RecordOperation(sequence_number, {address, timestamp});
@@ -92,7 +99,7 @@ void HeapTracker::RecordMalloc(
 void HeapTracker::RecordOperation(uint64_t sequence_number,
                                   const PendingOperation& operation) {
   if (sequence_number != committed_sequence_number_ + 1) {
-    pending_operations_.emplace(sequence_number, operation);
+    pending_operations_.Insert(sequence_number, operation);
     return;
   }
 
@@ -100,11 +107,14 @@ void HeapTracker::RecordOperation(uint64_t sequence_number,
 
   // At this point some other pending operations might be eligible to be
   // committed.
-  auto it = pending_operations_.begin();
-  while (it != pending_operations_.end() &&
-         it->first == committed_sequence_number_ + 1) {
-    CommitOperation(it->first, it->second);
-    it = pending_operations_.erase(it);
+  while (pending_operations_.size() > 0) {
+    const uint64_t next_sequence_number = committed_sequence_number_ + 1;
+    PendingOperation* next = pending_operations_.Find(next_sequence_number);
+    if (!next)
+      break;
+    PendingOperation next_operation = *next;
+    pending_operations_.Erase(next_sequence_number);
+    CommitOperation(next_sequence_number, next_operation);
   }
 }
 
@@ -117,16 +127,16 @@ void HeapTracker::CommitOperation(uint64_t sequence_number,
   uint64_t address = operation.allocation_address;
 
   // We will see many frees for addresses we do not know about.
-  auto leaf_it = allocations_.find(address);
-  if (leaf_it == allocations_.end())
+  Allocation* leaf = allocations_.Find(address);
+  if (!leaf)
     return;
 
-  Allocation& value = leaf_it->second;
+  Allocation& value = *leaf;
   if (value.sequence_number == sequence_number) {
     AddToCallstackAllocations(operation.timestamp, value);
   } else if (value.sequence_number < sequence_number) {
     SubtractFromCallstackAllocations(value);
-    allocations_.erase(leaf_it);
+    allocations_.Erase(address);
   }
   // else (value.sequence_number > sequence_number:
   //  This allocation has been replaced by a newer one in RecordMalloc.
@@ -142,15 +152,17 @@ uint64_t HeapTracker::GetSizeForTesting(
   PERFETTO_DCHECK(!dump_at_max_mode_);
   GlobalCallstackTrie::Node* node =
       callsites_->CreateCallsite(stack, build_ids);
+  // The node might be gone after the hack below.
+  const uint64_t callstack_id = node->id();
   // Hack to make it go away again if it wasn't used before.
   // This is only good because this is used for testing only.
   GlobalCallstackTrie::IncrementNode(node);
   GlobalCallstackTrie::DecrementNode(node);
-  auto it = callstack_allocations_.find(node);
-  if (it == callstack_allocations_.end()) {
+  CallstackAllocations** csa = callstack_allocations_.Find(callstack_id);
+  if (!csa) {
     return 0;
   }
-  const CallstackAllocations& alloc = it->second;
+  const CallstackAllocations& alloc = **csa;
   return alloc.value.totals.allocated - alloc.value.totals.freed;
 }
 
@@ -160,15 +172,17 @@ uint64_t HeapTracker::GetMaxForTesting(
   PERFETTO_DCHECK(dump_at_max_mode_);
   GlobalCallstackTrie::Node* node =
       callsites_->CreateCallsite(stack, build_ids);
+  // The node might be gone after the hack below.
+  const uint64_t callstack_id = node->id();
   // Hack to make it go away again if it wasn't used before.
   // This is only good because this is used for testing only.
   GlobalCallstackTrie::IncrementNode(node);
   GlobalCallstackTrie::DecrementNode(node);
-  auto it = callstack_allocations_.find(node);
-  if (it == callstack_allocations_.end()) {
+  CallstackAllocations** csa = callstack_allocations_.Find(callstack_id);
+  if (!csa) {
     return 0;
   }
-  const CallstackAllocations& alloc = it->second;
+  const CallstackAllocations& alloc = **csa;
   return alloc.value.retain_max.max;
 }
 
@@ -178,15 +192,17 @@ uint64_t HeapTracker::GetMaxCountForTesting(
   PERFETTO_DCHECK(dump_at_max_mode_);
   GlobalCallstackTrie::Node* node =
       callsites_->CreateCallsite(stack, build_ids);
+  // The node might be gone after the hack below.
+  const uint64_t callstack_id = node->id();
   // Hack to make it go away again if it wasn't used before.
   // This is only good because this is used for testing only.
   GlobalCallstackTrie::IncrementNode(node);
   GlobalCallstackTrie::DecrementNode(node);
-  auto it = callstack_allocations_.find(node);
-  if (it == callstack_allocations_.end()) {
+  CallstackAllocations** csa = callstack_allocations_.Find(callstack_id);
+  if (!csa) {
     return 0;
   }
-  const CallstackAllocations& alloc = it->second;
+  const CallstackAllocations& alloc = **csa;
   return alloc.value.retain_max.max_count;
 }
 
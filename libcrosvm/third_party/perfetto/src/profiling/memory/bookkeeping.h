@@ -17,10 +17,13 @@
 #ifndef SRC_PROFILING_MEMORY_BOOKKEEPING_H_
 #define SRC_PROFILING_MEMORY_BOOKKEEPING_H_
 
-#include <map>
+#include <algorithm>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
 #include "perfetto/base/time.h"
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "src/profiling/common/callstack_trie.h"
 #include "src/profiling/common/interner.h"
 #include "src/profiling/memory/unwound_messages.h"
@@ -129,6 +132,10 @@ class HeapTracker {
   // Caller needs to ensure that callsites outlives the HeapTracker.
   explicit HeapTracker(GlobalCallstackTrie* callsites, bool dump_at_max_mode)
       : callsites_(callsites), dump_at_max_mode_(dump_at_max_mode) {}
+  ~HeapTracker();
+
+  HeapTracker(const HeapTracker&) = delete;
+  HeapTracker& operator=(const HeapTracker&) = delete;
 
   void RecordMalloc(const std::vector<unwindstack::FrameData>& callstack,
                     const std::vector<std::string>& build_ids,
@@ -145,42 +152,54 @@ class HeapTracker {
     // * We need to remove them after the callstacks were dumped, which
     //   currently happens after the allocations are dumped.
     // * This way, we do not destroy and recreate callstacks as frequently.
-    for (auto it_and_alloc : dead_callstack_allocations_) {
-      auto& it = it_and_alloc.first;
-      uint64_t allocated = it_and_alloc.second;
-      const CallstackAllocations& alloc = it->second;
+    bool erased_callstacks = false;
+    for (const auto& csa_and_allocated : dead_callstack_allocations_) {
+      CallstackAllocations* csa = csa_and_allocated.first;
+      uint64_t allocated = csa_and_allocated.second;
       // For non-dump-at-max, we need to check, even if there are still no
       // allocations referencing this callstack, whether there were any
       // allocations that happened but were freed again. If that was the case,
       // we need to keep the callsite, because the next dump will indicate a
       // different self_alloc and self_freed.
-      if (alloc.allocs == 0 &&
+      if (csa->allocs == 0 &&
           (dump_at_max_mode_ ||
-           alloc.value.totals.allocation_count == allocated)) {
-        // TODO(fmayer): We could probably be smarter than throw away
-        // our whole frames cache.
-        ClearFrameCache();
-        callstack_allocations_.erase(it);
+           csa->value.totals.allocation_count == allocated)) {
+        callstack_allocations_.Erase(csa->node->id());
+        callstack_allocations_arena_.Delete(csa);
+        erased_callstacks = true;
       }
     }
     dead_callstack_allocations_.clear();
-
-    for (auto it = callstack_allocations_.begin();
-         it != callstack_allocations_.end(); ++it) {
-      const CallstackAllocations& alloc = it->second;
-      fn(alloc);
-
-      if (alloc.allocs == 0)
+    // TODO(fmayer): We could probably be smarter than throw away
+    // our whole frames cache.
+    if (erased_callstacks)
+      ClearFrameCache();
+
+    // The hash table has no meaningful order: visit the callstacks in id
+    // order, so that the dump doesn't depend on the table layout.
+    std::vector<CallstackAllocations*> sorted;
+    sorted.reserve(callstack_allocations_.size());
+    for (auto it = callstack_allocations_.GetIterator(); it; ++it)
+      sorted.push_back(it.value());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const CallstackAllocations* a, const CallstackAllocations* b) {
+                return a->node->id() < b->node->id();
+              });
+
+    for (CallstackAllocations* csa : sorted) {
+      fn(*csa);
+
+      if (csa->allocs == 0)
         dead_callstack_allocations_.emplace_back(
-            it, !dump_at_max_mode_ ? alloc.value.totals.allocation_count : 0);
+            csa, !dump_at_max_mode_ ? csa->value.totals.allocation_count : 0);
     }
   }
 
   template <typename F>
   void GetAllocations(F fn) {
-    for (const auto& addr_and_allocation : allocations_) {
-      const Allocation& alloc = addr_and_allocation.second;
-      fn(addr_and_allocation.first, alloc.sample_size, alloc.alloc_size,
+    for (auto it = allocations_.GetIterator(); it; ++it) {
+      const Allocation& alloc = it.value();
+      fn(it.key(), alloc.sample_size, alloc.alloc_size,
          alloc.callstack_allocations()->node->id());
     }
   }
@@ -191,7 +210,7 @@ class HeapTracker {
     RecordOperation(sequence_number, {address, timestamp});
   }
 
-  void ClearFrameCache() { frame_cache_.clear(); }
+  void ClearFrameCache() { frame_cache_.Clear(); }
 
   uint64_t dump_timestamp() {
     return dump_at_max_mode_ ? max_timestamp_ : committed_timestamp_;
@@ -254,17 +273,53 @@ class HeapTracker {
     uint64_t timestamp;
   };
 
+  // Owns the CallstackAllocations. These are pointed to by the Allocation(s),
+  // so they must not move when |callstack_allocations_| is rehashed. They are
+  // allocated in blocks and the slots of deleted ones are reused, rather than
+  // allocating each of them on the heap.
+  class CallstackAllocationsArena {
+   public:
+    CallstackAllocations* New(GlobalCallstackTrie::Node* node) {
+      void* slot;
+      if (!free_slots_.empty()) {
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+      } else {
+        if (blocks_.empty() || blocks_.back()->used == Block::kCapacity)
+          blocks_.emplace_back(new Block());
+        Block& block = *blocks_.back();
+        slot = &block.storage[block.used++];
+      }
+      return new (slot) CallstackAllocations(node);
+    }
+
+    void Delete(CallstackAllocations* callstack_allocations) {
+      callstack_allocations->~CallstackAllocations();
+      free_slots_.push_back(callstack_allocations);
+    }
+
+   private:
+    struct Block {
+      static constexpr size_t kCapacity = 256;
+
+      std::aligned_storage<sizeof(CallstackAllocations),
+                           alignof(CallstackAllocations)>::type
+          storage[kCapacity];
+      size_t used = 0;
+    };
+
+    std::vector<std::unique_ptr<Block>> blocks_;
+    std::vector<void*> free_slots_;
+  };
+
   CallstackAllocations* MaybeCreateCallstackAllocations(
       GlobalCallstackTrie::Node* node) {
-    auto callstack_allocations_it = callstack_allocations_.find(node);
-    if (callstack_allocations_it == callstack_allocations_.end()) {
+    auto it_and_inserted = callstack_allocations_.Insert(node->id(), nullptr);
+    if (it_and_inserted.second) {
       GlobalCallstackTrie::IncrementNode(node);
-      bool inserted;
-      std::tie(callstack_allocations_it, inserted) =
-          callstack_allocations_.emplace(node, node);
-      PERFETTO_DCHECK(inserted);
+      *it_and_inserted.first = callstack_allocations_arena_.New(node);
     }
-    return &callstack_allocations_it->second;
+    return *it_and_inserted.first;
   }
 
   void RecordOperation(uint64_t sequence_number,
@@ -298,11 +353,11 @@ class HeapTracker {
         alloc.callstack_allocations()->value.retain_max.max_count =
             alloc.callstack_allocations()->value.retain_max.cur_count;
       } else {
-        for (auto& p : callstack_allocations_) {
+        for (auto it = callstack_allocations_.GetIterator(); it; ++it) {
           // We need to reset max = cur for every CallstackAllocation, as we
           // do not know which ones have changed since the last max.
           // TODO(fmayer): Add an index to speed this up
-          CallstackAllocations& csa = p.second;
+          CallstackAllocations& csa = *it.value();
           csa.value.retain_max.max = csa.value.retain_max.cur;
           csa.value.retain_max.max_count = csa.value.retain_max.cur_count;
         }
@@ -328,16 +383,19 @@ class HeapTracker {
     }
   }
 
+  CallstackAllocationsArena callstack_allocations_arena_;
+
   // We cannot use an interner here, because after the last allocation goes
   // away, we still need to keep the CallstackAllocations around until the next
   // dump.
-  std::map<GlobalCallstackTrie::Node*, CallstackAllocations>
+  base::FlatHashMap<uint64_t /* callstack id */, CallstackAllocations*>
       callstack_allocations_;
 
-  std::vector<std::pair<decltype(callstack_allocations_)::iterator, uint64_t>>
+  std::vector<std::pair<CallstackAllocations*, uint64_t>>
       dead_callstack_allocations_;
 
-  std::map<uint64_t /* allocation address */, Allocation> allocations_;
+  base::FlatHashMap<uint64_t /* allocation address */, Allocation>
+      allocations_;
 
   // An operation is either a commit of an allocation or freeing of an
   // allocation. An operation is a free if its seq_id is larger than
@@ -346,7 +404,10 @@ class HeapTracker {
   //
   // If its seq_id is less than the sequence_number of the corresponding
   // allocation it could be either, but is ignored either way.
-  std::map<uint64_t /* seq_id */, PendingOperation /* allocation address */>
+  //
+  // These are only ever looked up by the next sequence number to commit, so
+  // they don't need to be ordered.
+  base::FlatHashMap<uint64_t /* seq_id */, PendingOperation>
       pending_operations_;
 
   uint64_t committed_timestamp_ = 0;
@@ -363,7 +424,7 @@ class HeapTracker {
 
   // We index by abspc, which is unique as long as the maps do not change.
   // This is why we ClearFrameCache after we reparsed maps.
-  std::unordered_map<uint64_t /* abs pc */, Interned<Frame>> frame_cache_;
+  base::FlatHashMap<uint64_t /* abs pc */, Interned<Frame>> frame_cache_;
 };
 
 }  // namespace profiling
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "src/profiling/memory/bookkeeping.h"
+
+namespace {
+
+using ::perfetto::profiling::GlobalCallstackTrie;
+using ::perfetto::profiling::HeapTracker;
+
+constexpr size_t kNumCallstacks = 1024;
+constexpr size_t kCallstackDepth = 16;
+constexpr size_t kNumOperations = 1 << 21;
+// Dumps happen every few seconds, which is about this many operations for an
+// allocation-heavy target.
+constexpr size_t kOperationsPerDump = 1 << 16;
+// Frees are not unwound, so they reach the bookkeeping thread before the
+// mallocs that precede them. Operations are delivered out of order within
+// windows of this size.
+constexpr size_t kReorderWindow = 8;
+
+struct Operation {
+  bool is_free;
+  uint32_t callstack;
+  uint64_t address;
+  uint64_t size;
+  uint64_t sequence_number;
+};
+
+struct Stream {
+  std::vector<std::vector<unwindstack::FrameData>> callstacks;
+  std::vector<std::string> build_ids;
+  std::vector<Operation> operations;
+};
+
+// Creates a malloc/free stream similar to the ones recorded from
+// allocation-heavy apps: once the target has |num_live| live allocations it
+// frees as much as it allocates, the callstacks follow a skewed distribution
+// and addresses are reused after being freed.
+Stream CreateStream(size_t num_live) {
+  std::minstd_rand0 rnd(0);
+  Stream stream;
+  stream.build_ids.assign(kCallstackDepth, "buildid");
+  for (size_t i = 0; i < kNumCallstacks; i++) {
+    std::vector<unwindstack::FrameData> callstack;
+    for (size_t depth = 0; depth < kCallstackDepth; depth++) {
+      unwindstack::FrameData frame{};
+      // Callstacks share their outermost frames, as they do in practice.
+      uint64_t frame_id = depth < kCallstackDepth / 2 ? depth % 4 : i;
+      frame.pc = 0x1000 * (depth + 1) + frame_id;
+      frame.function_name = "fun" + std::to_string(frame.pc);
+      callstack.emplace_back(std::move(frame));
+    }
+    stream.callstacks.emplace_back(std::move(callstack));
+  }
+
+  std::vector<uint64_t> live;
+  std::vector<uint64_t> freed;
+  uint64_t next_address = 0x10000;
+  for (size_t i = 0; i < kNumOperations; i++) {
+    Operation op{};
+    op.sequence_number = i + 1;
+    if (live.size() < num_live || rnd() % 2) {
+      op.is_free = false;
+      size_t max_callstack = 1 + rnd() % kNumCallstacks;
+      op.callstack = static_cast<uint32_t>(rnd() % max_callstack);
+      op.size = 16 * (1 + rnd() % 64);
+      if (!freed.empty() && rnd() % 4) {
+        op.address = freed.back();
+        freed.pop_back();
+      } else {
+        op.address = next_address;
+        next_address += 1024;
+      }
+      live.push_back(op.address);
+    } else {
+      op.is_free = true;
+      size_t idx = rnd() % live.size();
+      op.address = live[idx];
+      live[idx] = live.back();
+      live.pop_back();
+      freed.push_back(op.address);
+    }
+    stream.operations.push_back(op);
+  }
+
+  for (size_t i = 0; i + kReorderWindow <= stream.operations.size();
+       i += kReorderWindow) {
+    std::shuffle(stream.operations.begin() + static_cast<ptrdiff_t>(i),
+                 stream.operations.begin() +
+                     static_cast<ptrdiff_t>(i + kReorderWindow),
+                 rnd);
+  }
+  return stream;
+}
+
+// Replays the stream into a HeapTracker, dumping it periodically as
+// heapprofd does.
+static void BM_HeapTracker_Replay(benchmark::State& state) {
+  const Stream stream = CreateStream(static_cast<size_t>(state.range(0)));
+  for (auto _ : state) {
+    GlobalCallstackTrie callsites;
+    HeapTracker heap_tracker(&callsites, /*dump_at_max_mode=*/false);
+    uint64_t num_samples = 0;
+    for (size_t i = 0; i < stream.operations.size(); i++) {
+      const Operation& op = stream.operations[i];
+      if (op.is_free) {
+        heap_tracker.RecordFree(op.address, op.sequence_number,
+                                op.sequence_number);
+      } else {
+        heap_tracker.RecordMalloc(stream.callstacks[op.callstack],
+                                  stream.build_ids, op.address, op.size,
+                                  op.size, op.sequence_number,
+                                  op.sequence_number);
+      }
+      if (i % kOperationsPerDump == kOperationsPerDump - 1) {
+        heap_tracker.GetCallstackAllocations(
+            [&num_samples](const HeapTracker::CallstackAllocations&) {
+              num_samples++;
+            });
+      }
+    }
+    benchmark::DoNotOptimize(num_samples);
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * stream.operations.size()));
+}
+
+}  // namespace
+
+BENCHMARK(BM_HeapTracker_Replay)
+    ->Arg(1 << 10)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20)
+    ->Unit(benchmark::kMillisecond);
@@ -16,6 +16,9 @@
 
 #include "src/profiling/memory/bookkeeping.h"
 
+#include <algorithm>
+#include <string>
+
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto {
@@ -122,6 +125,68 @@ TEST(BookkeepingTest, Basic) {
   ASSERT_EQ(hd.GetTimestampForTesting(), 100 * (sequence_number - 1));
 }
 
+TEST(BookkeepingTest, ManyCallstacks) {
+  const size_t kNumCallstacks = 1000;
+  GlobalCallstackTrie c;
+  HeapTracker hd(&c, false);
+
+  std::vector<std::vector<unwindstack::FrameData>> stacks;
+  for (size_t i = 0; i < kNumCallstacks; i++) {
+    std::vector<unwindstack::FrameData> s = stack();
+    s.back().function_name = "fun" + std::to_string(100 + i);
+    s.back().pc = 100 + i;
+    stacks.emplace_back(std::move(s));
+  }
+
+  // Deliver the mallocs in reverse order: none of them can be committed until
+  // the first one is received.
+  for (size_t i = kNumCallstacks; i > 0; i--) {
+    uint64_t sequence_number = i;
+    hd.RecordMalloc(stacks[i - 1], DummyBuildIds(2), 0x1000 + i, i, i,
+                    sequence_number, 100 * sequence_number);
+  }
+  for (size_t i = 0; i < kNumCallstacks; i++) {
+    ASSERT_EQ(hd.GetSizeForTesting(stacks[i], DummyBuildIds(2)), i + 1);
+  }
+  ASSERT_EQ(hd.GetTimestampForTesting(), 100 * kNumCallstacks);
+
+  // Callstacks are dumped in id order.
+  std::vector<uint64_t> ids;
+  hd.GetCallstackAllocations(
+      [&ids](const HeapTracker::CallstackAllocations& alloc) {
+        ids.push_back(alloc.node->id());
+      });
+  ASSERT_EQ(ids.size(), kNumCallstacks);
+  EXPECT_TRUE(std::is_sorted(ids.begin(), ids.end()));
+
+  uint64_t sequence_number = kNumCallstacks + 1;
+  for (size_t i = 1; i <= kNumCallstacks; i++) {
+    hd.RecordFree(0x1000 + i, sequence_number, 100 * sequence_number);
+    sequence_number++;
+  }
+
+  // The first dump after the frees still reports the freed bytes, the second
+  // one drops the callstacks.
+  size_t num_callstacks = 0;
+  hd.GetCallstackAllocations(
+      [&num_callstacks](const HeapTracker::CallstackAllocations& alloc) {
+        EXPECT_EQ(alloc.value.totals.allocated, alloc.value.totals.freed);
+        num_callstacks++;
+      });
+  EXPECT_EQ(num_callstacks, kNumCallstacks);
+  num_callstacks = 0;
+  hd.GetCallstackAllocations(
+      [&num_callstacks](const HeapTracker::CallstackAllocations&) {
+        num_callstacks++;
+      });
+  EXPECT_EQ(num_callstacks, 0u);
+
+  // The callstacks can be used again after having been dropped.
+  hd.RecordMalloc(stacks[0], DummyBuildIds(2), 0x1, 5, 5, sequence_number,
+                  100 * sequence_number);
+  ASSERT_EQ(hd.GetSizeForTesting(stacks[0], DummyBuildIds(2)), 5u);
+}
+
 TEST(BookkeepingTest, Max) {
   uint64_t sequence_number = 1;
   GlobalCallstackTrie c;
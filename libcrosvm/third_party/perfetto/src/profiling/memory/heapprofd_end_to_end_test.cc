@@ -843,6 +843,31 @@ TEST_P(HeapprofdEndToEnd, Smoke) {
   ValidateSampleSizes(helper.get(), pid, kAllocSize);
 }
 
+TEST_P(HeapprofdEndToEnd, UnwindingThreads) {
+  constexpr size_t kAllocSize = 1024;
+  constexpr size_t kSamplingInterval = 1;
+
+  base::Subprocess child = ForkContinuousAlloc(allocator_mode(), kAllocSize);
+  const uint64_t pid = static_cast<uint64_t>(child.pid());
+
+  TraceConfig trace_config = MakeTraceConfig([this, pid](HeapprofdConfig* cfg) {
+    cfg->set_sampling_interval_bytes(kSamplingInterval);
+    cfg->add_pid(pid);
+    cfg->add_heaps(allocator_name());
+    cfg->set_unwinding_threads(4);
+    ContinuousDump(cfg);
+  });
+
+  auto helper = Trace(trace_config);
+  WRITE_TRACE(helper->full_trace());
+  PrintStats(helper.get());
+  KillAssertRunning(&child);
+
+  ValidateHasSamples(helper.get(), pid, allocator_name(), kSamplingInterval);
+  ValidateOnlyPID(helper.get(), pid);
+  ValidateSampleSizes(helper.get(), pid, kAllocSize);
+}
+
 TEST_P(HeapprofdEndToEnd, TwoAllocators) {
   constexpr size_t kCustomAllocSize = 1024;
   constexpr size_t kAllocSize = 7;
@@ -58,6 +58,7 @@ using ::perfetto::protos::pbzero::ProfilePacket;
 
 constexpr char kHeapprofdDataSource[] = "android.heapprofd";
 constexpr size_t kUnwinderThreads = 5;
+constexpr uint32_t kMaxUnwindingThreadsPerProcess = 16;
 
 constexpr uint32_t kInitialConnectionBackoffMs = 100;
 constexpr uint32_t kMaxConnectionBackoffMs = 30 * 1000;
@@ -868,6 +869,9 @@ void HeapprofdProducer::SocketDelegate::OnDataAvailable(
     handoff_data.shmem = std::move(pending_process.shmem);
     handoff_data.client_config = data_source.client_configuration;
     handoff_data.stream_allocations = data_source.config.stream_allocations();
+    handoff_data.unwinding_threads =
+        std::min(std::max(data_source.config.unwinding_threads(), 1u),
+                 kMaxUnwindingThreadsPerProcess);
 
     producer_->UnwinderForPID(self->peer_pid_linux())
         .PostHandoffSocket(std::move(handoff_data));
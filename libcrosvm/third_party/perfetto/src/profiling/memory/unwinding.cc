@@ -19,6 +19,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <atomic>
+
 #include <unwindstack/MachineArm.h>
 #include <unwindstack/MachineArm64.h>
 #include <unwindstack/MachineMips.h>
@@ -52,7 +54,9 @@
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/thread_pool.h"
 #include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/utils.h"
 
 #include "src/profiling/memory/unwound_messages.h"
 #include "src/profiling/memory/wire_protocol.h"
@@ -70,6 +74,11 @@ constexpr size_t kMaxFrames = 500;
 // makes sure other tasks get to be run at least every 300ms if the unwinding
 // saturates this thread.
 constexpr size_t kUnwindBatchSize = 1000;
+// Each malloc record carries a copy of the stack, up to 64KB by default, so
+// copying kUnwindBatchSize of them out of the shared memory buffer could use
+// tens of MB. When unwinding in parallel, a batch ends once this much has been
+// copied, which still leaves enough samples to keep the pool busy.
+constexpr size_t kMaxPendingUnwindBytes = 4 * 1024 * 1024;
 constexpr size_t kRecordBatchSize = 1024;
 constexpr size_t kMaxAllocRecordArenaSize = 2 * kRecordBatchSize;
 
@@ -267,6 +276,9 @@ void UnwindingWorker::OnDataAvailable(base::UnixSocket* self) {
 
 UnwindingWorker::ReadAndUnwindBatchResult UnwindingWorker::ReadAndUnwindBatch(
     ClientData* client_data) {
+  if (!client_data->pool_metadata.empty())
+    return ReadAndUnwindBatchParallel(client_data);
+
   SharedRingBuffer& shmem = client_data->shmem;
   SharedRingBuffer::Buffer buf;
   ReadAndUnwindBatchResult res;
@@ -298,6 +310,100 @@ UnwindingWorker::ReadAndUnwindBatchResult UnwindingWorker::ReadAndUnwindBatch(
   return res;
 }
 
+// Unlike ReadAndUnwindBatch, the mallocs are not unwound as they are read.
+// They are copied out of the shared memory buffer, so the space can be reused
+// by the client straight away, and unwound in parallel once the whole batch
+// has been read.
+UnwindingWorker::ReadAndUnwindBatchResult
+UnwindingWorker::ReadAndUnwindBatchParallel(ClientData* client_data) {
+  SharedRingBuffer& shmem = client_data->shmem;
+  pid_t peer_pid = client_data->sock->peer_pid_linux();
+  std::vector<uint8_t>& data = client_data->pending_unwind_data;
+  ReadAndUnwindBatchResult res;
+
+  size_t i;
+  bool has_more = false;
+  for (i = 0; i < kUnwindBatchSize; ++i) {
+    if (data.size() >= kMaxPendingUnwindBytes) {
+      has_more = true;
+      break;
+    }
+    SharedRingBuffer::Buffer buf = shmem.BeginRead();
+    if (!buf)
+      break;
+    WireMessage msg;
+    if (!client_data->stream_allocations &&
+        ReceiveWireMessage(reinterpret_cast<char*>(buf.data), buf.size,
+                           &msg) &&
+        msg.record_type == RecordType::Malloc) {
+      // Keep the alignment the record had in the shared memory buffer.
+      size_t offset = base::AlignUp<sizeof(uint64_t)>(data.size());
+      data.resize(offset + buf.size);
+      memcpy(&data[offset], buf.data, buf.size);
+      client_data->pending_unwinds.push_back(
+          {offset, buf.size, alloc_record_arena_.BorrowAllocRecord()});
+    } else {
+      HandleBuffer(this, &alloc_record_arena_, buf, client_data, peer_pid,
+                   delegate_);
+    }
+    res.bytes_read += shmem.EndRead(std::move(buf));
+  }
+  UnwindPending(client_data);
+
+  if (has_more || i == kUnwindBatchSize) {
+    res.status = ReadAndUnwindBatchResult::Status::kHasMore;
+  } else if (i > 0) {
+    res.status = ReadAndUnwindBatchResult::Status::kReadSome;
+  } else {
+    res.status = ReadAndUnwindBatchResult::Status::kReadNone;
+  }
+  return res;
+}
+
+void UnwindingWorker::UnwindPending(ClientData* client_data) {
+  std::vector<PendingUnwind>& pending = client_data->pending_unwinds;
+  if (pending.empty())
+    return;
+
+  pid_t peer_pid = client_data->sock->peer_pid_linux();
+  DataSourceInstanceID data_source_instance_id =
+      client_data->data_source_instance_id;
+  uint8_t* data = client_data->pending_unwind_data.data();
+  // Unwinding times vary a lot between samples, so rather than splitting the
+  // batch upfront, each thread claims the next sample once it is done with
+  // the previous one. Each invocation of the lambda below runs on a single
+  // thread, so each UnwindingMetadata is only ever used by one thread at a
+  // time.
+  std::atomic<size_t> next{0};
+  unwinding_pool_->RunParallel(
+      1 + client_data->pool_metadata.size(), [&](size_t slot) {
+        UnwindingMetadata* metadata =
+            slot == 0 ? &client_data->metadata
+                      : &client_data->pool_metadata[slot - 1];
+        for (size_t i = next.fetch_add(1); i < pending.size();
+             i = next.fetch_add(1)) {
+          WireMessage msg;
+          // This was already successfully parsed when copying it out of the
+          // shared memory buffer.
+          ReceiveWireMessage(reinterpret_cast<char*>(data + pending[i].offset),
+                             pending[i].size, &msg);
+          AllocRecord* rec = pending[i].rec.get();
+          rec->alloc_metadata = *msg.alloc_header;
+          rec->pid = peer_pid;
+          rec->data_source_instance_id = data_source_instance_id;
+          auto start_time_us = base::GetWallTimeNs() / 1000;
+          DoUnwind(&msg, metadata, rec);
+          rec->unwinding_time_us = static_cast<uint64_t>(
+              ((base::GetWallTimeNs() / 1000) - start_time_us).count());
+        }
+      });
+
+  for (PendingUnwind& p : pending)
+    delegate_->PostAllocRecord(this, std::move(p.rec));
+  pending.clear();
+  client_data->pending_unwind_data.clear();
+}
+
 void UnwindingWorker::BatchUnwindJob(pid_t peer_pid) {
   auto it = client_data_.find(peer_pid);
   if (it == client_data_.end()) {
@@ -444,6 +550,27 @@ void UnwindingWorker::HandleHandoffSocket(HandoffData handoff_data) {
       base::SockFamily::kUnix, base::SockType::kStream);
   pid_t peer_pid = sock->peer_pid_linux();
 
+  // The pool threads get their own copy of the maps and memory of the
+  // process, parsed from duplicates of the fds. FDMaps and FDMemory only use
+  // positional reads, so sharing the file offsets does not matter.
+  std::vector<UnwindingMetadata> pool_metadata;
+  for (uint32_t i = 1; i < handoff_data.unwinding_threads; ++i) {
+    base::ScopedFile maps_fd(dup(*handoff_data.maps_fd));
+    base::ScopedFile mem_fd(dup(*handoff_data.mem_fd));
+    if (!maps_fd || !mem_fd) {
+      PERFETTO_PLOG("Failed to dup maps or mem fd");
+      break;
+    }
+    pool_metadata.emplace_back(std::move(maps_fd), std::move(mem_fd));
+  }
+  // The pool is only used from this thread, by UnwindPending(), so it can be
+  // replaced by a larger one between two batches.
+  uint32_t pool_threads = static_cast<uint32_t>(pool_metadata.size());
+  if (pool_threads > 0 &&
+      (!unwinding_pool_ || unwinding_pool_->num_threads() < pool_threads)) {
+    unwinding_pool_.reset(new base::ThreadPool(pool_threads, "heapprofdunw"));
+  }
+
   UnwindingMetadata metadata(std::move(handoff_data.maps_fd),
                              std::move(handoff_data.mem_fd));
   ClientData client_data{
@@ -455,6 +582,9 @@ void UnwindingWorker::HandleHandoffSocket(HandoffData handoff_data) {
       handoff_data.stream_allocations,
       /*drain_bytes=*/0,
       /*free_records=*/{},
+      std::move(pool_metadata),
+      /*pending_unwind_data=*/{},
+      /*pending_unwinds=*/{},
   };
   client_data.free_records.reserve(kRecordBatchSize);
   client_data.shmem.SetReaderPaused();
@@ -21,6 +21,7 @@
 
 #include "perfetto/base/time.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/thread_pool.h"
 #include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "src/profiling/common/unwind_support.h"
@@ -79,6 +80,9 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
     SharedRingBuffer shmem;
     ClientConfiguration client_config;
     bool stream_allocations;
+    // Number of threads unwinding the samples of this process. See
+    // ClientData::pool_metadata.
+    uint32_t unwinding_threads;
   };
 
   UnwindingWorker(Delegate* delegate, base::ThreadTaskRunner thread_task_runner)
@@ -103,6 +107,14 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
   void OnDataAvailable(base::UnixSocket* self) override;
 
  public:
+  // A malloc record copied out of the shared memory buffer, waiting to be
+  // unwound by the unwinding pool.
+  struct PendingUnwind {
+    size_t offset;  // Into ClientData::pending_unwind_data.
+    size_t size;
+    std::unique_ptr<AllocRecord> rec;
+  };
+
   // public for testing/fuzzer
   struct ClientData {
     DataSourceInstanceID data_source_instance_id;
@@ -113,6 +125,14 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
     bool stream_allocations = false;
     size_t drain_bytes = 0;
     std::vector<FreeRecord> free_records;
+    // Only non-empty if the samples of this process are unwound on more than
+    // one thread. The mallocs of a batch are unwound by the worker thread,
+    // using |metadata|, together with the threads of the worker's
+    // |unwinding_pool_|, each using its own entry of |pool_metadata|, as the
+    // libunwindstack caches are not thread-safe.
+    std::vector<UnwindingMetadata> pool_metadata;
+    std::vector<uint8_t> pending_unwind_data;
+    std::vector<PendingUnwind> pending_unwinds;
   };
 
   // public for testing/fuzzing
@@ -142,6 +162,8 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
     Status status;
   };
   ReadAndUnwindBatchResult ReadAndUnwindBatch(ClientData* client_data);
+  ReadAndUnwindBatchResult ReadAndUnwindBatchParallel(ClientData* client_data);
+  void UnwindPending(ClientData* client_data);
   void BatchUnwindJob(pid_t);
   void DrainJob(pid_t);
 
@@ -149,6 +171,11 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
   std::map<pid_t, ClientData> client_data_;
   Delegate* delegate_;
 
+  // Shared by all the processes handled by this worker, which are unwound one
+  // batch at a time. Lazily created, and grown, for the process that asks for
+  // the most unwinding threads.
+  std::unique_ptr<base::ThreadPool> unwinding_pool_;
+
   // Task runner with a dedicated thread. Keep last as instances this class are
   // currently (incorrectly) being destroyed on the main thread, instead of the
   // task thread. By destroying this task runner first, we ensure that the
@@ -22,6 +22,8 @@
 #include <sys/types.h>
 #include <unwindstack/RegsGetLocal.h>
 
+#include <thread>
+
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "src/profiling/common/unwind_support.h"
@@ -91,6 +93,31 @@ TEST(UnwindingTest, TestFunctionOffset) {
   AssertFunctionOffset();
 }
 
+TEST(UnwindingTest, FDMapsParseConcurrentlyFromDups) {
+  base::ScopedFile proc_maps(base::OpenFile("/proc/self/maps", O_RDONLY));
+  ASSERT_TRUE(proc_maps);
+  FDMaps maps(base::ScopedFile(dup(*proc_maps)));
+  FDMaps other_maps(std::move(proc_maps));
+
+  // The two fds share the file offset, which must not affect parsing.
+  auto parse = [](FDMaps* m) {
+    for (int i = 0; i < 100; i++) {
+      m->Reset();
+      if (!m->Parse())
+        return false;
+      if (!m->Find(reinterpret_cast<uint64_t>(&AssertFunctionOffset)))
+        return false;
+    }
+    return true;
+  };
+  bool other_ok = false;
+  std::thread other_thread(
+      [&other_ok, &other_maps, &parse] { other_ok = parse(&other_maps); });
+  EXPECT_TRUE(parse(&maps));
+  other_thread.join();
+  EXPECT_TRUE(other_ok);
+}
+
 // This is needed because ASAN thinks copying the whole stack is a buffer
 // underrun.
 void __attribute__((noinline))
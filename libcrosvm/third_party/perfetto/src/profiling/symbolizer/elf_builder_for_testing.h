@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_SYMBOLIZER_ELF_BUILDER_FOR_TESTING_H_
+#define SRC_PROFILING_SYMBOLIZER_ELF_BUILDER_FOR_TESTING_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/utils.h"
+#include "src/profiling/symbolizer/elf.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include <zlib.h>
+#endif
+
+// Helpers to build the ELF files parsed by ElfSymbolizer, for its tests and
+// benchmarks.
+
+namespace perfetto {
+namespace profiling {
+namespace elf_for_testing {
+
+constexpr uint8_t kStdOpcodeLengths[] = {0, 1, 1, 1, 1, 0,
+                                         0, 0, 1, 0, 0, 1};
+constexpr int8_t kLineBase = -5;
+constexpr uint8_t kLineRange = 14;
+constexpr uint8_t kOpcodeBase = sizeof(kStdOpcodeLengths) + 1;
+
+template <typename T>
+void Append(std::string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void AppendUleb128(std::string* out, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    out->push_back(static_cast<char>(value ? byte | 0x80 : byte));
+  } while (value);
+}
+
+inline void AppendSleb128(std::string* out, int64_t value) {
+  for (;;) {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    bool done = (value == 0 && !(byte & 0x40)) || (value == -1 && byte & 0x40);
+    out->push_back(static_cast<char>(done ? byte : byte | 0x80));
+    if (done)
+      return;
+  }
+}
+
+inline void AppendCString(std::string* out, const std::string& str) {
+  out->append(str.c_str(), str.size() + 1);
+}
+
+// Assembles a DWARF line number program.
+class LineProgram {
+ public:
+  LineProgram& SetAddress(uint64_t address) {
+    data_ += '\0';
+    AppendUleb128(&data_, 1 + sizeof(address));
+    data_ += '\x02';
+    Append(&data_, address);
+    return *this;
+  }
+  LineProgram& AdvancePc(uint64_t delta) {
+    data_ += '\x02';
+    AppendUleb128(&data_, delta);
+    return *this;
+  }
+  LineProgram& AdvanceLine(int64_t delta) {
+    data_ += '\x03';
+    AppendSleb128(&data_, delta);
+    return *this;
+  }
+  LineProgram& SetFile(uint64_t file) {
+    data_ += '\x04';
+    AppendUleb128(&data_, file);
+    return *this;
+  }
+  LineProgram& SetColumn(uint64_t column) {
+    data_ += '\x05';
+    AppendUleb128(&data_, column);
+    return *this;
+  }
+  LineProgram& Copy() {
+    data_ += '\x01';
+    return *this;
+  }
+  LineProgram& Special(uint8_t address_delta, int8_t line_delta) {
+    data_ += static_cast<char>((line_delta - kLineBase) +
+                               kLineRange * address_delta + kOpcodeBase);
+    return *this;
+  }
+  LineProgram& EndSequence() {
+    data_.append("\0\x01\x01", 3);
+    return *this;
+  }
+
+  const std::string& data() const { return data_; }
+
+ private:
+  std::string data_;
+};
+
+// Builds a little-endian 64-bit ELF file with the sections read by
+// ElfSymbolizer.
+class ElfBuilder {
+ public:
+  void AddSymbol(const std::string& name,
+                 uint64_t address,
+                 uint64_t size,
+                 uint8_t type = STT_FUNC,
+                 bool global = true) {
+    Elf64::Sym sym{};
+    sym.st_name = AddString(&strtab_, name);
+    sym.st_info = static_cast<uint8_t>((global ? STB_GLOBAL : 0) << 4 | type);
+    sym.st_shndx = 1;
+    sym.st_value = address;
+    sym.st_size = size;
+    Append(&symtab_, sym);
+  }
+
+  // Adds a line table of |version| where all the |files| are in "/src". The
+  // files are numbered from 1 in |program|, whatever the version.
+  void AddLineTable(uint16_t version,
+                    const std::vector<std::string>& files,
+                    const LineProgram& program) {
+    std::string header;
+    Append<uint8_t>(&header, 1);  // minimum_instruction_length
+    if (version >= 4)
+      Append<uint8_t>(&header, 1);  // maximum_operations_per_instruction
+    Append<uint8_t>(&header, 1);  // default_is_stmt
+    Append(&header, kLineBase);
+    Append(&header, kLineRange);
+    Append(&header, kOpcodeBase);
+    header.append(reinterpret_cast<const char*>(kStdOpcodeLengths),
+                  sizeof(kStdOpcodeLengths));
+    if (version >= 5) {
+      // Directories: DW_LNCT_path as DW_FORM_line_strp.
+      header += '\x01';
+      AppendUleb128(&header, 1);
+      AppendUleb128(&header, 0x1f);
+      AppendUleb128(&header, 2);
+      Append(&header, AddString(&debug_line_str_, "/comp"));
+      Append(&header, AddString(&debug_line_str_, "/src"));
+      // Files: DW_LNCT_path as DW_FORM_line_strp, DW_LNCT_directory_index as
+      // DW_FORM_udata. File 0 is the primary source file.
+      header += '\x02';
+      AppendUleb128(&header, 1);
+      AppendUleb128(&header, 0x1f);
+      AppendUleb128(&header, 2);
+      AppendUleb128(&header, 0x0f);
+      AppendUleb128(&header, files.size() + 1);
+      for (size_t i = 0; i <= files.size(); i++) {
+        Append(&header,
+               AddString(&debug_line_str_, files[i ? i - 1 : 0]));
+        AppendUleb128(&header, 1);
+      }
+    } else {
+      AppendCString(&header, "/src");
+      header += '\0';
+      for (const std::string& file : files) {
+        AppendCString(&header, file);
+        AppendUleb128(&header, 1);  // Directory.
+        AppendUleb128(&header, 0);  // Modification time.
+        AppendUleb128(&header, 0);  // Size.
+      }
+      header += '\0';
+    }
+
+    std::string unit;
+    Append(&unit, version);
+    if (version >= 5) {
+      Append<uint8_t>(&unit, 8);  // address_size
+      Append<uint8_t>(&unit, 0);  // segment_selector_size
+    }
+    Append(&unit, static_cast<uint32_t>(header.size()));
+    unit += header;
+    unit += program.data();
+    AddLineUnit(unit);
+  }
+
+  // Adds a line table unit whose contents (from the version) are |unit|.
+  void AddLineUnit(const std::string& unit) {
+    Append(&debug_line_, static_cast<uint32_t>(unit.size()));
+    debug_line_ += unit;
+  }
+
+  // Compresses the debug sections (SHF_COMPRESSED) with |ch_type|. Only
+  // ELFCOMPRESS_ZLIB actually compresses the data, which requires zlib; the
+  // data of other types is stored as is.
+  void CompressDebugSections(uint32_t ch_type) { ch_type_ = ch_type; }
+
+  std::string Build() const {
+    struct Section {
+      const char* name;
+      uint32_t type;
+      const std::string* data;
+      uint32_t link;
+    };
+    std::string shstrtab(1, '\0');
+    std::string debug_line = MaybeCompress(debug_line_);
+    std::string debug_line_str = MaybeCompress(debug_line_str_);
+    const Section sections[] = {
+        {".symtab", SHT_SYMTAB, &symtab_, 2},
+        {".strtab", SHT_STRTAB, &strtab_, 0},
+        {".debug_line", SHT_PROGBITS, &debug_line, 0},
+        {".debug_line_str", SHT_PROGBITS, &debug_line_str, 0},
+        {".shstrtab", SHT_STRTAB, &shstrtab, 0},
+    };
+    std::vector<Elf64::Shdr> shdrs(1);
+    for (const Section& section : sections) {
+      Elf64::Shdr shdr{};
+      shdr.sh_name = AddString(&shstrtab, section.name);
+      shdr.sh_type = section.type;
+      shdr.sh_link = section.link;
+      if (ch_type_ && strncmp(section.name, ".debug_", 7) == 0)
+        shdr.sh_flags = SHF_COMPRESSED;
+      shdrs.push_back(shdr);
+    }
+
+    std::string elf(sizeof(Elf64::Ehdr), '\0');
+    for (size_t i = 0; i < base::ArraySize(sections); i++) {
+      shdrs[i + 1].sh_offset = elf.size();
+      shdrs[i + 1].sh_size = sections[i].data->size();
+      elf += *sections[i].data;
+    }
+    Elf64::Ehdr ehdr{};
+    ehdr.e_ident[EI_MAG0] = ELFMAG0;
+    ehdr.e_ident[EI_MAG1] = ELFMAG1;
+    ehdr.e_ident[EI_MAG2] = ELFMAG2;
+    ehdr.e_ident[EI_MAG3] = ELFMAG3;
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_ehsize = sizeof(ehdr);
+    ehdr.e_shentsize = sizeof(Elf64::Shdr);
+    ehdr.e_shnum = static_cast<uint16_t>(shdrs.size());
+    ehdr.e_shstrndx = static_cast<uint16_t>(shdrs.size() - 1);
+    ehdr.e_shoff = elf.size();
+    memcpy(&elf[0], &ehdr, sizeof(ehdr));
+    for (const Elf64::Shdr& shdr : shdrs)
+      Append(&elf, shdr);
+    return elf;
+  }
+
+ private:
+  static uint32_t AddString(std::string* table, const std::string& str) {
+    if (table->empty())
+      *table += '\0';
+    uint32_t offset = static_cast<uint32_t>(table->size());
+    AppendCString(table, str);
+    return offset;
+  }
+
+  std::string MaybeCompress(const std::string& data) const {
+    if (!ch_type_)
+      return data;
+    Elf64::Chdr chdr{};
+    chdr.ch_type = ch_type_;
+    chdr.ch_size = data.size();
+    chdr.ch_addralign = 1;
+    std::string out;
+    Append(&out, chdr);
+    if (ch_type_ != ELFCOMPRESS_ZLIB)
+      return out + data;
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+    uLongf size = compressBound(static_cast<uLong>(data.size()));
+    std::string compressed(size, '\0');
+    PERFETTO_CHECK(compress(reinterpret_cast<Bytef*>(&compressed[0]), &size,
+                            reinterpret_cast<const Bytef*>(data.data()),
+                            static_cast<uLong>(data.size())) == Z_OK);
+    compressed.resize(size);
+    return out + compressed;
+#else
+    PERFETTO_FATAL("zlib is not available.");
+#endif
+  }
+
+  uint32_t ch_type_ = 0;
+  std::string symtab_ = std::string(sizeof(Elf64::Sym), '\0');
+  std::string strtab_;
+  std::string debug_line_;
+  std::string debug_line_str_;
+};
+
+}  // namespace elf_for_testing
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_SYMBOLIZER_ELF_BUILDER_FOR_TESTING_H_
@@ -0,0 +1,940 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/elf_symbolizer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/ext/base/utils.h"
+#include "src/profiling/symbolizer/elf.h"
+#include "src/profiling/symbolizer/scoped_read_mmap.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <cxxabi.h>
+#endif
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace perfetto {
+namespace profiling {
+
+namespace {
+
+// DWARF constants, see the DWARF 5 standard, section 7.22.
+constexpr uint8_t DW_LNS_copy = 1;
+constexpr uint8_t DW_LNS_advance_pc = 2;
+constexpr uint8_t DW_LNS_advance_line = 3;
+constexpr uint8_t DW_LNS_set_file = 4;
+constexpr uint8_t DW_LNS_const_add_pc = 8;
+constexpr uint8_t DW_LNS_fixed_advance_pc = 9;
+constexpr uint8_t DW_LNE_end_sequence = 1;
+constexpr uint8_t DW_LNE_set_address = 2;
+constexpr uint8_t DW_LNE_define_file = 3;
+constexpr uint64_t DW_LNCT_path = 1;
+constexpr uint64_t DW_LNCT_directory_index = 2;
+constexpr uint64_t DW_FORM_block = 0x09;
+constexpr uint64_t DW_FORM_data1 = 0x0b;
+constexpr uint64_t DW_FORM_data2 = 0x05;
+constexpr uint64_t DW_FORM_data4 = 0x06;
+constexpr uint64_t DW_FORM_data8 = 0x07;
+constexpr uint64_t DW_FORM_data16 = 0x1e;
+constexpr uint64_t DW_FORM_line_strp = 0x1f;
+constexpr uint64_t DW_FORM_string = 0x08;
+constexpr uint64_t DW_FORM_strp = 0x0e;
+constexpr uint64_t DW_FORM_udata = 0x0f;
+
+constexpr char kSerializedMagic[8] = {'P', 'F', 'S', 'Y', 'M', 'B', 'L', 'S'};
+constexpr uint32_t kSerializedVersion = 1;
+
+struct SerializedHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_functions;
+  uint32_t num_line_rows;
+  uint32_t num_files;
+  uint64_t strings_size;
+};
+
+struct Section {
+  const uint8_t* data;
+  size_t size;
+};
+
+// Decompresses a SHF_COMPRESSED section into |out|. Only zlib is supported,
+// and only in builds with zlib.
+template <typename E>
+bool DecompressSection(const Section& section, std::vector<uint8_t>* out) {
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+  using Chdr = typename E::Chdr;
+  if (section.size < sizeof(Chdr))
+    return false;
+  Chdr chdr;
+  memcpy(&chdr, section.data, sizeof(chdr));
+  // uLong is 32 bits on some platforms.
+  uLong compressed_size = static_cast<uLong>(section.size - sizeof(Chdr));
+  uLongf out_size = static_cast<uLongf>(chdr.ch_size);
+  // zlib cannot expand data more than ~1032 times, larger sizes are corrupt.
+  if (chdr.ch_type != ELFCOMPRESS_ZLIB ||
+      compressed_size != section.size - sizeof(Chdr) ||
+      out_size != chdr.ch_size || out_size / 1032 > compressed_size) {
+    return false;
+  }
+  out->resize(static_cast<size_t>(out_size));
+  return uncompress(out->data(), &out_size, section.data + sizeof(Chdr),
+                    compressed_size) == Z_OK &&
+         out_size == chdr.ch_size;
+#else
+  base::ignore_result(section, out);
+  return false;
+#endif
+}
+
+// Returns the NUL-terminated string at |offset| of |section|, or nullptr.
+const char* GetString(const Section& section, uint64_t offset) {
+  if (offset >= section.size)
+    return nullptr;
+  const char* str = reinterpret_cast<const char*>(section.data + offset);
+  if (!memchr(str, '\0', section.size - static_cast<size_t>(offset)))
+    return nullptr;
+  return str;
+}
+
+// Bounds-checked reader of little-endian DWARF data. Once a read goes out of
+// bounds, all the subsequent reads return zero and ok() returns false.
+class DwarfReader {
+ public:
+  DwarfReader(const uint8_t* begin, const uint8_t* end)
+      : ptr_(begin), end_(end) {}
+
+  bool ok() const { return ok_; }
+  bool done() const { return ptr_ >= end_; }
+  const uint8_t* ptr() const { return ptr_; }
+  size_t remaining() const { return static_cast<size_t>(end_ - ptr_); }
+
+  template <typename T>
+  T Read() {
+    T value{};
+    if (remaining() < sizeof(T)) {
+      Fail();
+      return value;
+    }
+    memcpy(&value, ptr_, sizeof(T));
+    ptr_ += sizeof(T);
+    return value;
+  }
+
+  uint64_t ReadUint(size_t size) {
+    switch (size) {
+      case 1:
+        return Read<uint8_t>();
+      case 2:
+        return Read<uint16_t>();
+      case 4:
+        return Read<uint32_t>();
+      case 8:
+        return Read<uint64_t>();
+    }
+    Fail();
+    return 0;
+  }
+
+  uint64_t ReadUleb128() {
+    uint64_t value = 0;
+    for (uint32_t shift = 0; ptr_ < end_; shift += 7) {
+      uint8_t byte = *ptr_++;
+      if (shift < 64)
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return value;
+    }
+    Fail();
+    return 0;
+  }
+
+  int64_t ReadSleb128() {
+    uint64_t value = 0;
+    uint32_t shift = 0;
+    for (; ptr_ < end_;) {
+      uint8_t byte = *ptr_++;
+      if (shift < 64)
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      shift += 7;
+      if (!(byte & 0x80)) {
+        if (shift < 64 && (byte & 0x40))
+          value |= ~uint64_t(0) << shift;
+        return static_cast<int64_t>(value);
+      }
+    }
+    Fail();
+    return 0;
+  }
+
+  const char* ReadCString() {
+    const void* nul = memchr(ptr_, '\0', remaining());
+    if (!nul) {
+      Fail();
+      return "";
+    }
+    const char* str = reinterpret_cast<const char*>(ptr_);
+    ptr_ = static_cast<const uint8_t*>(nul) + 1;
+    return str;
+  }
+
+  void Skip(uint64_t size) {
+    if (remaining() < size) {
+      Fail();
+      return;
+    }
+    ptr_ += size;
+  }
+
+ private:
+  void Fail() {
+    ok_ = false;
+    ptr_ = end_;
+  }
+
+  const uint8_t* ptr_;
+  const uint8_t* end_;
+  bool ok_ = true;
+};
+
+std::string JoinPath(const std::string& dir, const std::string& name) {
+  if (dir.empty() || name.empty() || name[0] == '/')
+    return name;
+  if (dir.back() == '/')
+    return dir + name;
+  return dir + "/" + name;
+}
+
+// Returns the index of the first element of the sorted |v| whose key is after
+// |address|, given that it is not before |pos|. Gallops from |pos| before
+// binary searching, as consecutive lookups are close to each other.
+template <typename T, typename GetKey>
+size_t SeekUpperBound(const std::vector<T>& v,
+                      size_t pos,
+                      uint64_t address,
+                      GetKey get_key) {
+  size_t end = pos;
+  for (size_t step = 1; end < v.size() && get_key(v[end]) <= address;
+       step *= 2) {
+    pos = end + 1;
+    end += step;
+  }
+  auto it = std::upper_bound(
+      v.begin() + static_cast<ptrdiff_t>(pos),
+      v.begin() + static_cast<ptrdiff_t>(std::min(end, v.size())), address,
+      [&get_key](uint64_t addr, const T& t) { return addr < get_key(t); });
+  return static_cast<size_t>(it - v.begin());
+}
+
+template <typename T>
+void ReadArray(const char** ptr, size_t count, std::vector<T>* out) {
+  out->resize(count);
+  if (count)
+    memcpy(out->data(), *ptr, count * sizeof(T));
+  *ptr += count * sizeof(T);
+}
+
+std::unique_ptr<std::string> Demangle(const char* name) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  if (strncmp(name, "_Z", 2) == 0) {
+    int ignored = 0;
+    std::unique_ptr<char, base::FreeDeleter> demangled(
+        abi::__cxa_demangle(name, nullptr, nullptr, &ignored));
+    if (demangled)
+      return std::unique_ptr<std::string>(new std::string(demangled.get()));
+  }
+#endif
+  return std::unique_ptr<std::string>(new std::string(name));
+}
+
+}  // namespace
+
+// Fills an ElfSymbolizer from the sections of an ELF file.
+class ElfSymbolizerParser {
+ public:
+  explicit ElfSymbolizerParser(ElfSymbolizer* out) : out_(out) {}
+
+  template <typename E>
+  bool Parse(const uint8_t* mem, size_t size);
+
+ private:
+  struct SymbolCandidate {
+    uint64_t start;
+    uint64_t size;
+    bool global;
+    const char* name;
+  };
+
+  struct Sequence {
+    uint64_t low;
+    size_t first_row;
+    size_t num_rows;
+  };
+
+  template <typename E>
+  void AddSymbols(const uint8_t* mem,
+                  const typename E::Shdr& symtab,
+                  const typename E::Shdr& strtab,
+                  bool is_arm);
+  void FinalizeFunctions();
+
+  bool ParseLineUnit(DwarfReader* reader);
+  bool ParseV5EntryFormats(DwarfReader* reader,
+                           std::vector<std::pair<uint64_t, uint64_t>>* formats);
+  bool ReadV5Entry(DwarfReader* reader,
+                   const std::vector<std::pair<uint64_t, uint64_t>>& formats,
+                   bool dwarf64,
+                   const char** path,
+                   uint64_t* dir_index);
+  void EndSequence(uint64_t end_address, size_t first_row, bool tombstone);
+  void FinalizeLineRows();
+
+  uint32_t AddString(const char* str);
+  uint32_t AddFile(const std::string& path);
+
+  ElfSymbolizer* out_;
+  Section debug_line_{};
+  Section debug_line_str_{};
+  Section debug_str_{};
+  // Backing storage of the decompressed debug sections.
+  std::vector<std::vector<uint8_t>> decompressed_;
+  std::vector<SymbolCandidate> symbols_;
+  std::vector<ElfSymbolizer::LineRow> rows_;
+  std::vector<Sequence> sequences_;
+  std::unordered_map<std::string, uint32_t> file_ids_;
+};
+
+template <typename E>
+bool ElfSymbolizerParser::Parse(const uint8_t* mem, size_t size) {
+  using Ehdr = typename E::Ehdr;
+  using Shdr = typename E::Shdr;
+  if (size < sizeof(Ehdr))
+    return false;
+  Ehdr ehdr;
+  memcpy(&ehdr, mem, sizeof(ehdr));
+  if (ehdr.e_shoff > size || ehdr.e_shnum > (size - ehdr.e_shoff) / sizeof(Shdr))
+    return false;
+  std::vector<Shdr> shdrs(ehdr.e_shnum);
+  if (ehdr.e_shnum)
+    memcpy(shdrs.data(), mem + ehdr.e_shoff, ehdr.e_shnum * sizeof(Shdr));
+
+  auto in_range = [size](const Shdr& shdr) {
+    return shdr.sh_type != SHT_NOBITS && shdr.sh_offset <= size &&
+           shdr.sh_size <= size - shdr.sh_offset;
+  };
+  Section shstrtab{};
+  if (ehdr.e_shstrndx < shdrs.size() && in_range(shdrs[ehdr.e_shstrndx])) {
+    shstrtab.data = mem + shdrs[ehdr.e_shstrndx].sh_offset;
+    shstrtab.size = static_cast<size_t>(shdrs[ehdr.e_shstrndx].sh_size);
+  }
+
+  const bool is_arm = ehdr.e_machine == EM_ARM;
+  for (const Shdr& shdr : shdrs) {
+    if (!in_range(shdr))
+      continue;
+    if (shdr.sh_type == SHT_SYMTAB || shdr.sh_type == SHT_DYNSYM) {
+      if (shdr.sh_link < shdrs.size() && in_range(shdrs[shdr.sh_link]))
+        AddSymbols<E>(mem, shdr, shdrs[shdr.sh_link], is_arm);
+      continue;
+    }
+    const char* name = GetString(shstrtab, shdr.sh_name);
+    if (!name)
+      continue;
+    Section* section = nullptr;
+    if (strcmp(name, ".debug_line") == 0) {
+      section = &debug_line_;
+    } else if (strcmp(name, ".debug_line_str") == 0) {
+      section = &debug_line_str_;
+    } else if (strcmp(name, ".debug_str") == 0) {
+      section = &debug_str_;
+    } else if (strcmp(name, ".zdebug_line") == 0) {
+      // Legacy GNU compression (-gz=zlib-gnu).
+      PERFETTO_ELOG("Compressed .zdebug_line is not supported.");
+      out_->has_unreadable_line_tables_ = true;
+      continue;
+    } else {
+      continue;
+    }
+    *section = {mem + shdr.sh_offset, static_cast<size_t>(shdr.sh_size)};
+    if (shdr.sh_flags & SHF_COMPRESSED) {
+      decompressed_.emplace_back();
+      std::vector<uint8_t>* data = &decompressed_.back();
+      if (!DecompressSection<E>(*section, data)) {
+        PERFETTO_ELOG("Failed to decompress %s.", name);
+        out_->has_unreadable_line_tables_ = true;
+        *section = {};
+        continue;
+      }
+      *section = {data->data(), data->size()};
+    }
+  }
+  FinalizeFunctions();
+
+  DwarfReader reader(debug_line_.data, debug_line_.data + debug_line_.size);
+  while (!reader.done()) {
+    if (!ParseLineUnit(&reader)) {
+      PERFETTO_ELOG("Failed to parse .debug_line.");
+      break;
+    }
+  }
+  FinalizeLineRows();
+  return true;
+}
+
+template <typename E>
+void ElfSymbolizerParser::AddSymbols(const uint8_t* mem,
+                                     const typename E::Shdr& symtab,
+                                     const typename E::Shdr& strtab,
+                                     bool is_arm) {
+  using Sym = typename E::Sym;
+  Section strings{mem + strtab.sh_offset, static_cast<size_t>(strtab.sh_size)};
+  const uint8_t* syms = mem + symtab.sh_offset;
+  size_t num_syms = static_cast<size_t>(symtab.sh_size) / sizeof(Sym);
+  for (size_t i = 0; i < num_syms; i++) {
+    Sym sym;
+    memcpy(&sym, syms + i * sizeof(Sym), sizeof(Sym));
+    uint8_t type = sym.st_info & 0xf;
+    if ((type != STT_FUNC && type != STT_GNU_IFUNC) ||
+        sym.st_shndx == SHN_UNDEF || sym.st_value == 0) {
+      continue;
+    }
+    const char* name = GetString(strings, sym.st_name);
+    if (!name || !*name)
+      continue;
+    uint64_t start = sym.st_value;
+    // The lowest bit of thumb functions is set.
+    if (is_arm)
+      start &= ~uint64_t(1);
+    symbols_.push_back(
+        {start, sym.st_size, (sym.st_info >> 4) == STB_GLOBAL, name});
+  }
+}
+
+void ElfSymbolizerParser::FinalizeFunctions() {
+  // For aliases, prefer the largest symbol, then global over local ones.
+  std::sort(symbols_.begin(), symbols_.end(),
+            [](const SymbolCandidate& a, const SymbolCandidate& b) {
+              if (a.start != b.start)
+                return a.start < b.start;
+              if (a.size != b.size)
+                return a.size > b.size;
+              if (a.global != b.global)
+                return a.global;
+              return strcmp(a.name, b.name) < 0;
+            });
+  std::vector<ElfSymbolizer::Function>& functions = out_->functions_;
+  for (size_t i = 0; i < symbols_.size(); i++) {
+    const SymbolCandidate& sym = symbols_[i];
+    if (!functions.empty() && functions.back().start == sym.start)
+      continue;
+    functions.push_back({sym.start, sym.start + sym.size, AddString(sym.name),
+                         /*reserved=*/0});
+  }
+  // Symbols without a size extend to the next one.
+  for (size_t i = 0; i < functions.size(); i++) {
+    ElfSymbolizer::Function& function = functions[i];
+    if (function.end == function.start) {
+      function.end = i + 1 < functions.size() ? functions[i + 1].start
+                                               : function.start + 1;
+    }
+  }
+  symbols_.clear();
+}
+
+bool ElfSymbolizerParser::ParseLineUnit(DwarfReader* reader) {
+  bool dwarf64 = false;
+  uint64_t unit_length = reader->Read<uint32_t>();
+  if (unit_length == 0xffffffff) {
+    dwarf64 = true;
+    unit_length = reader->Read<uint64_t>();
+  }
+  if (!reader->ok() || unit_length > reader->remaining())
+    return false;
+  DwarfReader unit(reader->ptr(), reader->ptr() + unit_length);
+  reader->Skip(unit_length);
+
+  uint16_t version = unit.Read<uint16_t>();
+  if (version < 2 || version > 5) {
+    PERFETTO_DLOG("Skipping line table of unsupported version %u", version);
+    return unit.ok();
+  }
+  if (version >= 5) {
+    unit.Read<uint8_t>();  // address_size
+    unit.Read<uint8_t>();  // segment_selector_size
+  }
+  uint64_t header_length =
+      dwarf64 ? unit.Read<uint64_t>() : unit.Read<uint32_t>();
+  if (!unit.ok() || header_length > unit.remaining())
+    return false;
+  DwarfReader program(unit.ptr() + header_length, unit.ptr() + unit.remaining());
+
+  uint8_t min_inst_length = unit.Read<uint8_t>();
+  if (version >= 4)
+    unit.Read<uint8_t>();  // maximum_operations_per_instruction
+  unit.Read<uint8_t>();    // default_is_stmt
+  int8_t line_base = unit.Read<int8_t>();
+  uint8_t line_range = unit.Read<uint8_t>();
+  uint8_t opcode_base = unit.Read<uint8_t>();
+  if (!unit.ok() || line_range == 0 || opcode_base == 0)
+    return false;
+  std::vector<uint8_t> opcode_lengths(opcode_base - 1u);
+  for (uint8_t& length : opcode_lengths)
+    length = unit.Read<uint8_t>();
+
+  // Indexed by the file numbers of the line program, which start from 1
+  // before DWARF 5.
+  std::vector<uint32_t> files;
+  if (version >= 5) {
+    std::vector<std::pair<uint64_t, uint64_t>> formats;
+    // Each entry takes at least one byte, unless there are no formats, so
+    // larger counts are corrupt (and would take forever to loop over).
+    auto read_entry_count = [&unit, &formats](uint64_t* count) {
+      *count = unit.ReadUleb128();
+      return unit.ok() && (*count == 0 || !formats.empty()) &&
+             *count <= unit.remaining();
+    };
+    uint64_t count = 0;
+    if (!ParseV5EntryFormats(&unit, &formats) || !read_entry_count(&count))
+      return false;
+    std::vector<std::string> dirs;
+    for (uint64_t n = count; n; n--) {
+      const char* path = nullptr;
+      uint64_t dir_index = 0;
+      if (!ReadV5Entry(&unit, formats, dwarf64, &path, &dir_index))
+        return false;
+      // Directories other than the first one (the compilation directory) can
+      // be relative to it.
+      dirs.emplace_back(dirs.empty() ? std::string(path ? path : "")
+                                     : JoinPath(dirs[0], path ? path : ""));
+    }
+    if (!ParseV5EntryFormats(&unit, &formats) || !read_entry_count(&count))
+      return false;
+    for (uint64_t n = count; n; n--) {
+      const char* path = nullptr;
+      uint64_t dir_index = 0;
+      if (!ReadV5Entry(&unit, formats, dwarf64, &path, &dir_index))
+        return false;
+      if (!path) {
+        files.push_back(ElfSymbolizer::kNoFile);
+        continue;
+      }
+      files.push_back(AddFile(
+          JoinPath(dir_index < dirs.size() ? dirs[dir_index] : "", path)));
+    }
+  } else {
+    std::vector<std::string> dirs(1);  // The compilation directory.
+    for (const char* dir = unit.ReadCString(); *dir; dir = unit.ReadCString())
+      dirs.emplace_back(dir);
+    files.push_back(ElfSymbolizer::kNoFile);
+    for (const char* name = unit.ReadCString(); *name;
+         name = unit.ReadCString()) {
+      uint64_t dir_index = unit.ReadUleb128();
+      unit.ReadUleb128();  // Modification time.
+      unit.ReadUleb128();  // File size.
+      files.push_back(
+          AddFile(JoinPath(dir_index < dirs.size() ? dirs[dir_index] : "",
+                           name)));
+    }
+  }
+  if (!unit.ok())
+    return false;
+
+  // Runs the line number program, see section 6.2 of the DWARF 5 standard.
+  // The op_index of VLIW architectures is ignored.
+  uint64_t address = 0;
+  uint64_t file = 1;
+  int64_t line = 1;
+  bool tombstone = false;
+  size_t first_row = rows_.size();
+  auto emit_row = [&] {
+    uint32_t file_id =
+        file < files.size() ? files[file] : ElfSymbolizer::kNoFile;
+    uint32_t line_u32 =
+        line > 0 ? static_cast<uint32_t>(std::min<int64_t>(line, UINT32_MAX))
+                 : 0;
+    rows_.push_back({address, file_id, line_u32});
+  };
+  while (!program.done()) {
+    uint8_t opcode = program.Read<uint8_t>();
+    if (opcode >= opcode_base) {
+      uint8_t adjusted = static_cast<uint8_t>(opcode - opcode_base);
+      address += static_cast<uint64_t>(min_inst_length) *
+                 (adjusted / line_range);
+      line += line_base + adjusted % line_range;
+      emit_row();
+      continue;
+    }
+    switch (opcode) {
+      case 0: {
+        uint64_t length = program.ReadUleb128();
+        if (length == 0 || length > program.remaining())
+          return false;
+        DwarfReader extended(program.ptr(), program.ptr() + length);
+        program.Skip(length);
+        uint8_t sub_opcode = extended.Read<uint8_t>();
+        if (sub_opcode == DW_LNE_end_sequence) {
+          EndSequence(address, first_row, tombstone);
+          address = 0;
+          file = 1;
+          line = 1;
+          tombstone = false;
+          first_row = rows_.size();
+        } else if (sub_opcode == DW_LNE_set_address) {
+          size_t address_size = extended.remaining();
+          address = extended.ReadUint(address_size);
+          // The code of functions removed by the linker is relocated to 0 or
+          // to -1 (or -2 in .debug_ranges), depending on the linker.
+          uint64_t max_address = address_size >= 8
+                                     ? ~uint64_t(0)
+                                     : (uint64_t(1) << (address_size * 8)) - 1;
+          tombstone |= address == 0 || address >= max_address - 1;
+        } else if (sub_opcode == DW_LNE_define_file) {
+          const char* name = extended.ReadCString();
+          files.push_back(AddFile(name));
+        }
+        break;
+      }
+      case DW_LNS_copy:
+        emit_row();
+        break;
+      case DW_LNS_advance_pc:
+        address += min_inst_length * program.ReadUleb128();
+        break;
+      case DW_LNS_advance_line:
+        line += program.ReadSleb128();
+        break;
+      case DW_LNS_set_file:
+        file = program.ReadUleb128();
+        break;
+      case DW_LNS_const_add_pc:
+        address += static_cast<uint64_t>(min_inst_length) *
+                   ((255u - opcode_base) / line_range);
+        break;
+      case DW_LNS_fixed_advance_pc:
+        address += program.Read<uint16_t>();
+        break;
+      default:
+        // Other standard opcodes only affect the columns and the flags of
+        // the rows, which are not needed.
+        for (uint8_t i = 0; i < opcode_lengths[opcode - 1u]; i++)
+          program.ReadUleb128();
+        break;
+    }
+  }
+  // Rows not terminated by an end_sequence are dropped.
+  rows_.resize(first_row);
+  return program.ok();
+}
+
+bool ElfSymbolizerParser::ParseV5EntryFormats(
+    DwarfReader* reader,
+    std::vector<std::pair<uint64_t, uint64_t>>* formats) {
+  formats->clear();
+  for (uint8_t n = reader->Read<uint8_t>(); n && reader->ok(); n--) {
+    uint64_t content_type = reader->ReadUleb128();
+    uint64_t form = reader->ReadUleb128();
+    formats->emplace_back(content_type, form);
+  }
+  return reader->ok();
+}
+
+bool ElfSymbolizerParser::ReadV5Entry(
+    DwarfReader* reader,
+    const std::vector<std::pair<uint64_t, uint64_t>>& formats,
+    bool dwarf64,
+    const char** path,
+    uint64_t* dir_index) {
+  for (const auto& content_type_and_form : formats) {
+    const char* str = nullptr;
+    uint64_t value = 0;
+    switch (content_type_and_form.second) {
+      case DW_FORM_string:
+        str = reader->ReadCString();
+        break;
+      case DW_FORM_line_strp:
+        str = GetString(debug_line_str_, reader->ReadUint(dwarf64 ? 8 : 4));
+        break;
+      case DW_FORM_strp:
+        str = GetString(debug_str_, reader->ReadUint(dwarf64 ? 8 : 4));
+        break;
+      case DW_FORM_udata:
+        value = reader->ReadUleb128();
+        break;
+      case DW_FORM_data1:
+        value = reader->Read<uint8_t>();
+        break;
+      case DW_FORM_data2:
+        value = reader->Read<uint16_t>();
+        break;
+      case DW_FORM_data4:
+        value = reader->Read<uint32_t>();
+        break;
+      case DW_FORM_data8:
+        value = reader->Read<uint64_t>();
+        break;
+      case DW_FORM_data16:
+        reader->Skip(16);
+        break;
+      case DW_FORM_block:
+        reader->Skip(reader->ReadUleb128());
+        break;
+      default:
+        // E.g. DW_FORM_strx, which would need .debug_str_offsets and the
+        // DW_AT_str_offsets_base of the compilation unit.
+        PERFETTO_DLOG("Unsupported form %" PRIu64,
+                      content_type_and_form.second);
+        return false;
+    }
+    if (content_type_and_form.first == DW_LNCT_path)
+      *path = str;
+    else if (content_type_and_form.first == DW_LNCT_directory_index)
+      *dir_index = value;
+  }
+  return reader->ok();
+}
+
+void ElfSymbolizerParser::EndSequence(uint64_t end_address,
+                                      size_t first_row,
+                                      bool tombstone) {
+  if (tombstone || first_row == rows_.size() ||
+      end_address <= rows_[first_row].address) {
+    rows_.resize(first_row);
+    return;
+  }
+  rows_.push_back({end_address, ElfSymbolizer::kEndOfSequence, 0});
+  sequences_.push_back(
+      {rows_[first_row].address, first_row, rows_.size() - first_row});
+}
+
+void ElfSymbolizerParser::FinalizeLineRows() {
+  std::stable_sort(sequences_.begin(), sequences_.end(),
+                   [](const Sequence& a, const Sequence& b) {
+                     return a.low < b.low;
+                   });
+  std::vector<ElfSymbolizer::LineRow>& line_rows = out_->line_rows_;
+  for (const Sequence& sequence : sequences_) {
+    // Overlapping sequences would break the binary search.
+    if (!line_rows.empty() && sequence.low < line_rows.back().address)
+      continue;
+    line_rows.insert(line_rows.end(), rows_.begin() + static_cast<ptrdiff_t>(
+                                                          sequence.first_row),
+                     rows_.begin() + static_cast<ptrdiff_t>(
+                                         sequence.first_row +
+                                         sequence.num_rows));
+  }
+  rows_.clear();
+  sequences_.clear();
+}
+
+uint32_t ElfSymbolizerParser::AddString(const char* str) {
+  uint32_t offset = static_cast<uint32_t>(out_->strings_.size());
+  out_->strings_.append(str, strlen(str) + 1);
+  return offset;
+}
+
+uint32_t ElfSymbolizerParser::AddFile(const std::string& path) {
+  auto it_and_inserted = file_ids_.emplace(path, 0);
+  if (it_and_inserted.second) {
+    it_and_inserted.first->second = static_cast<uint32_t>(out_->files_.size());
+    out_->files_.push_back(AddString(path.c_str()));
+  }
+  return it_and_inserted.first->second;
+}
+
+constexpr uint32_t ElfSymbolizer::kNoFile;
+constexpr uint32_t ElfSymbolizer::kEndOfSequence;
+
+ElfSymbolizer::ElfSymbolizer() = default;
+ElfSymbolizer::~ElfSymbolizer() = default;
+
+// static
+std::unique_ptr<ElfSymbolizer> ElfSymbolizer::Create(const void* mem,
+                                                     size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(mem);
+  if (size <= EI_VERSION || bytes[EI_MAG0] != ELFMAG0 ||
+      bytes[EI_MAG1] != ELFMAG1 || bytes[EI_MAG2] != ELFMAG2 ||
+      bytes[EI_MAG3] != ELFMAG3 || bytes[EI_DATA] != ELFDATA2LSB) {
+    return nullptr;
+  }
+  std::unique_ptr<ElfSymbolizer> symbolizer(new ElfSymbolizer());
+  ElfSymbolizerParser parser(symbolizer.get());
+  bool success = false;
+  switch (bytes[EI_CLASS]) {
+    case ELFCLASS32:
+      success = parser.Parse<Elf32>(bytes, size);
+      break;
+    case ELFCLASS64:
+      success = parser.Parse<Elf64>(bytes, size);
+      break;
+  }
+  if (!success)
+    return nullptr;
+  symbolizer->function_names_.resize(symbolizer->functions_.size());
+  return symbolizer;
+}
+
+// static
+std::unique_ptr<ElfSymbolizer> ElfSymbolizer::CreateFromFile(
+    const std::string& file_name) {
+  base::Optional<size_t> size = base::GetFileSize(file_name);
+  if (!size.has_value() || *size == 0) {
+    PERFETTO_PLOG("Failed to get file size %s", file_name.c_str());
+    return nullptr;
+  }
+  ScopedReadMmap map(file_name.c_str(), *size);
+  if (!map.IsValid()) {
+    PERFETTO_PLOG("mmap");
+    return nullptr;
+  }
+  return Create(*map, *size);
+}
+
+// static
+std::unique_ptr<ElfSymbolizer> ElfSymbolizer::Deserialize(
+    const std::string& data) {
+  SerializedHeader header;
+  if (data.size() < sizeof(header))
+    return nullptr;
+  memcpy(&header, data.data(), sizeof(header));
+  if (memcmp(header.magic, kSerializedMagic, sizeof(header.magic)) != 0 ||
+      header.version != kSerializedVersion) {
+    return nullptr;
+  }
+  uint64_t expected_size = sizeof(header) +
+                           uint64_t(header.num_functions) * sizeof(Function) +
+                           uint64_t(header.num_line_rows) * sizeof(LineRow) +
+                           uint64_t(header.num_files) * sizeof(uint32_t) +
+                           header.strings_size;
+  if (data.size() != expected_size)
+    return nullptr;
+
+  std::unique_ptr<ElfSymbolizer> symbolizer(new ElfSymbolizer());
+  const char* ptr = data.data() + sizeof(header);
+  ReadArray(&ptr, header.num_functions, &symbolizer->functions_);
+  ReadArray(&ptr, header.num_line_rows, &symbolizer->line_rows_);
+  ReadArray(&ptr, header.num_files, &symbolizer->files_);
+  symbolizer->strings_.assign(ptr, static_cast<size_t>(header.strings_size));
+  if (!symbolizer->IsValid())
+    return nullptr;
+  symbolizer->function_names_.resize(symbolizer->functions_.size());
+  return symbolizer;
+}
+
+std::string ElfSymbolizer::Serialize() const {
+  SerializedHeader header{};
+  memcpy(header.magic, kSerializedMagic, sizeof(header.magic));
+  header.version = kSerializedVersion;
+  header.num_functions = static_cast<uint32_t>(functions_.size());
+  header.num_line_rows = static_cast<uint32_t>(line_rows_.size());
+  header.num_files = static_cast<uint32_t>(files_.size());
+  header.strings_size = strings_.size();
+
+  std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+  data.append(reinterpret_cast<const char*>(functions_.data()),
+              functions_.size() * sizeof(Function));
+  data.append(reinterpret_cast<const char*>(line_rows_.data()),
+              line_rows_.size() * sizeof(LineRow));
+  data.append(reinterpret_cast<const char*>(files_.data()),
+              files_.size() * sizeof(uint32_t));
+  data.append(strings_);
+  return data;
+}
+
+// Checks the invariants relied upon by Symbolize(), for deserialized data.
+bool ElfSymbolizer::IsValid() const {
+  if (!strings_.empty() && strings_.back() != '\0')
+    return false;
+  for (size_t i = 0; i < functions_.size(); i++) {
+    const Function& function = functions_[i];
+    if (function.name >= strings_.size() || function.end <= function.start ||
+        (i > 0 && functions_[i - 1].start >= function.start)) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < line_rows_.size(); i++) {
+    const LineRow& row = line_rows_[i];
+    if ((row.file >= files_.size() && row.file != kNoFile &&
+         row.file != kEndOfSequence) ||
+        (i > 0 && line_rows_[i - 1].address > row.address)) {
+      return false;
+    }
+  }
+  for (uint32_t file : files_) {
+    if (file >= strings_.size())
+      return false;
+  }
+  return true;
+}
+
+const std::string& ElfSymbolizer::GetFunctionName(size_t function_idx) {
+  std::unique_ptr<std::string>& name = function_names_[function_idx];
+  if (!name)
+    name = Demangle(&strings_[functions_[function_idx].name]);
+  return *name;
+}
+
+std::vector<std::vector<SymbolizedFrame>> ElfSymbolizer::Symbolize(
+    const std::vector<uint64_t>& addresses) {
+  // The addresses are resolved in increasing order, so that each lookup
+  // starts from the previous result instead of binary searching the whole
+  // arrays, which mostly misses the cache for large binaries.
+  std::vector<uint32_t> order(addresses.size());
+  for (uint32_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&addresses](uint32_t a, uint32_t b) {
+    return addresses[a] < addresses[b];
+  });
+
+  std::vector<std::vector<SymbolizedFrame>> result(addresses.size());
+  size_t function_idx = 0;
+  size_t row_idx = 0;
+  for (uint32_t i : order) {
+    uint64_t address = addresses[i];
+    // Index of the last function starting at or before |address|, plus one.
+    function_idx =
+        SeekUpperBound(functions_, function_idx, address,
+                       [](const Function& function) { return function.start; });
+    // As with llvm-symbolizer, addresses without a function are not
+    // symbolized, even if they have a line.
+    if (function_idx == 0 || address >= functions_[function_idx - 1].end)
+      continue;
+    result[i].emplace_back();
+    SymbolizedFrame& frame = result[i].back();
+    frame.function_name = GetFunctionName(function_idx - 1);
+    row_idx = SeekUpperBound(line_rows_, row_idx, address,
+                             [](const LineRow& row) { return row.address; });
+    if (row_idx > 0 && line_rows_[row_idx - 1].file < files_.size()) {
+      const LineRow& row = line_rows_[row_idx - 1];
+      frame.file_name = &strings_[files_[row.file]];
+      frame.line = row.line;
+    }
+  }
+  return result;
+}
+
+}  // namespace profiling
+}  // namespace perfetto
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_SYMBOLIZER_ELF_SYMBOLIZER_H_
+#define SRC_PROFILING_SYMBOLIZER_ELF_SYMBOLIZER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/profiling/symbolizer/symbolizer.h"
+
+namespace perfetto {
+namespace profiling {
+
+// Symbolizes the addresses of a single ELF binary in-process, as an
+// alternative to running llvm-symbolizer.
+//
+// The binary is parsed once: the functions of .symtab and .dynsym and the rows
+// of the DWARF line tables (.debug_line, versions 2 to 5) are flattened into
+// arrays sorted by address, which are then binary searched for each address.
+// The parsed arrays can be serialized, to cache them across runs.
+//
+// Unlike llvm-symbolizer, .debug_info is not parsed: each address resolves to
+// at most one frame, with the name of the symbol containing it and the file
+// and line of the innermost inlined function, if any. Debug sections
+// compressed with zlib (SHF_COMPRESSED) are decompressed when building with
+// zlib; for other compressed line tables only the function names are
+// available, see has_unreadable_line_tables().
+class ElfSymbolizer {
+ public:
+  // Parses the ELF binary in [mem, mem + size). Returns nullptr if it is not
+  // a valid little-endian ELF file.
+  static std::unique_ptr<ElfSymbolizer> Create(const void* mem, size_t size);
+  static std::unique_ptr<ElfSymbolizer> CreateFromFile(
+      const std::string& file_name);
+
+  // Loads the output of Serialize(). Returns nullptr if |data| is invalid.
+  static std::unique_ptr<ElfSymbolizer> Deserialize(const std::string& data);
+
+  ~ElfSymbolizer();
+
+  // Returns the frames of each address, with the same semantics as
+  // Symbolizer::Symbolize(). |addresses| are virtual addresses of the ELF
+  // file, i.e. relative pcs including the load bias.
+  std::vector<std::vector<SymbolizedFrame>> Symbolize(
+      const std::vector<uint64_t>& addresses);
+
+  std::string Serialize() const;
+
+  size_t num_functions() const { return functions_.size(); }
+  size_t num_line_rows() const { return line_rows_.size(); }
+
+  // True if the binary has line tables that could not be read, e.g. because
+  // they are compressed with zstd. Not serialized.
+  bool has_unreadable_line_tables() const {
+    return has_unreadable_line_tables_;
+  }
+
+ private:
+  friend class ElfSymbolizerParser;
+
+  static constexpr uint32_t kNoFile = static_cast<uint32_t>(-1);
+  static constexpr uint32_t kEndOfSequence = static_cast<uint32_t>(-2);
+
+  // Symbols covering [start, end). Sorted by |start|, which is unique.
+  struct Function {
+    uint64_t start;
+    uint64_t end;
+    uint32_t name;  // Offset in |strings_|.
+    uint32_t reserved;
+  };
+
+  // Rows of the line table sequences, sorted by |address|. The last row of
+  // each sequence has |file| == kEndOfSequence.
+  struct LineRow {
+    uint64_t address;
+    uint32_t file;  // Index in |files_| or kNoFile.
+    uint32_t line;
+  };
+
+  ElfSymbolizer();
+  bool IsValid() const;
+  const std::string& GetFunctionName(size_t function_idx);
+
+  std::vector<Function> functions_;
+  std::vector<LineRow> line_rows_;
+  std::vector<uint32_t> files_;  // Offsets in |strings_| of the file paths.
+  std::string strings_;          // NUL-terminated strings.
+
+  // Demangled function names, indexed as |functions_|. Filled on first use
+  // as most functions are never looked up.
+  std::vector<std::unique_ptr<std::string>> function_names_;
+
+  bool has_unreadable_line_tables_ = false;
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_SYMBOLIZER_ELF_SYMBOLIZER_H_
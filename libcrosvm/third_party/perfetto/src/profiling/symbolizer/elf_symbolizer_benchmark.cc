@@ -0,0 +1,122 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/logging.h"
+#include "src/profiling/symbolizer/elf_builder_for_testing.h"
+#include "src/profiling/symbolizer/elf_symbolizer.h"
+
+namespace {
+
+using perfetto::profiling::ElfSymbolizer;
+using perfetto::profiling::elf_for_testing::ElfBuilder;
+using perfetto::profiling::elf_for_testing::LineProgram;
+
+constexpr uint64_t kTextStart = 0x10000;
+constexpr uint64_t kFunctionSize = 0x80;
+constexpr uint32_t kFunctionsPerFile = 50;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+uint32_t NumFunctions() {
+  return IsBenchmarkFunctionalOnly() ? 100 : 50000;
+}
+
+size_t NumFrames() {
+  return IsBenchmarkFunctionalOnly() ? 1000 : 1000000;
+}
+
+// Returns a binary with |NumFunctions()| C++ functions, each with a line
+// table sequence of 16 rows.
+std::string CreateElf() {
+  std::vector<std::string> files;
+  for (uint32_t i = 0; i < NumFunctions() / kFunctionsPerFile; i++)
+    files.push_back("file" + std::to_string(i) + ".cc");
+
+  ElfBuilder builder;
+  LineProgram program;
+  for (uint32_t i = 0; i < NumFunctions(); i++) {
+    std::string name = "function" + std::to_string(i);
+    uint64_t start = kTextStart + i * kFunctionSize;
+    builder.AddSymbol("_ZN2ns" + std::to_string(name.size()) + name + "Ev",
+                      start, kFunctionSize);
+    program.SetAddress(start)
+        .SetFile(i / kFunctionsPerFile + 1)
+        .AdvanceLine(i % 1000)
+        .Copy();
+    for (int row = 1; row < 16; row++)
+      program.Special(kFunctionSize / 16, 1);
+    program.AdvancePc(kFunctionSize / 16).EndSequence();
+  }
+  builder.AddLineTable(4, files, program);
+  return builder.Build();
+}
+
+std::vector<uint64_t> RandomAddresses() {
+  std::minstd_rand0 rnd(0);
+  std::uniform_int_distribution<uint64_t> dist(
+      kTextStart, kTextStart + NumFunctions() * kFunctionSize - 1);
+  std::vector<uint64_t> addresses(NumFrames());
+  for (uint64_t& address : addresses)
+    address = dist(rnd);
+  return addresses;
+}
+
+}  // namespace
+
+static void BM_ElfSymbolizerCreate(benchmark::State& state) {
+  std::string elf = CreateElf();
+  for (auto _ : state) {
+    auto symbolizer = ElfSymbolizer::Create(elf.data(), elf.size());
+    PERFETTO_CHECK(symbolizer);
+    benchmark::DoNotOptimize(symbolizer);
+  }
+}
+BENCHMARK(BM_ElfSymbolizerCreate)->Unit(benchmark::kMillisecond);
+
+static void BM_ElfSymbolizerDeserialize(benchmark::State& state) {
+  std::string elf = CreateElf();
+  std::string data = ElfSymbolizer::Create(elf.data(), elf.size())->Serialize();
+  for (auto _ : state) {
+    auto symbolizer = ElfSymbolizer::Deserialize(data);
+    PERFETTO_CHECK(symbolizer);
+    benchmark::DoNotOptimize(symbolizer);
+  }
+}
+BENCHMARK(BM_ElfSymbolizerDeserialize)->Unit(benchmark::kMillisecond);
+
+// Symbolizes 1M frames in a single batch, as done for a heap profile.
+static void BM_ElfSymbolizerSymbolize(benchmark::State& state) {
+  std::string elf = CreateElf();
+  std::vector<uint64_t> addresses = RandomAddresses();
+  for (auto _ : state) {
+    state.PauseTiming();
+    // Function names are demangled on first use.
+    auto symbolizer = ElfSymbolizer::Create(elf.data(), elf.size());
+    state.ResumeTiming();
+    auto frames = symbolizer->Symbolize(addresses);
+    PERFETTO_CHECK(frames.size() == addresses.size() && frames[0].size() == 1);
+    benchmark::DoNotOptimize(frames);
+  }
+  state.counters["frames/s"] = benchmark::Counter(
+      static_cast<double>(addresses.size()), benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_ElfSymbolizerSymbolize)->Unit(benchmark::kMillisecond);
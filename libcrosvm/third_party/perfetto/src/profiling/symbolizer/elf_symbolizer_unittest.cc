@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/elf_symbolizer.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "src/base/test/tmp_dir_tree.h"
+#include "src/profiling/symbolizer/elf.h"
+#include "src/profiling/symbolizer/elf_builder_for_testing.h"
+#include "src/profiling/symbolizer/local_symbolizer.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+using ::testing::IsEmpty;
+using elf_for_testing::Append;
+using elf_for_testing::AppendUleb128;
+using elf_for_testing::ElfBuilder;
+using elf_for_testing::LineProgram;
+
+std::string FunctionName(const std::vector<SymbolizedFrame>& frames) {
+  return frames.empty() ? "" : frames[0].function_name;
+}
+
+std::string FileAndLine(const std::vector<SymbolizedFrame>& frames) {
+  if (frames.empty())
+    return "";
+  return frames[0].file_name + ":" + std::to_string(frames[0].line);
+}
+
+std::unique_ptr<ElfSymbolizer> Create(const std::string& elf) {
+  return ElfSymbolizer::Create(elf.data(), elf.size());
+}
+
+TEST(ElfSymbolizerTest, Functions) {
+  ElfBuilder builder;
+  builder.AddSymbol("foo", 0x1000, 0x100);
+  builder.AddSymbol("foo_alias", 0x1000, 0x100, STT_FUNC, /*global=*/false);
+  builder.AddSymbol("no_size", 0x1100, 0);
+  builder.AddSymbol("_ZN2ns3bazEv", 0x2000, 0x10);
+  builder.AddSymbol("data", 0x3000, 0x100, /*type=*/1);
+  std::unique_ptr<ElfSymbolizer> symbolizer = Create(builder.Build());
+  ASSERT_TRUE(symbolizer);
+  EXPECT_EQ(symbolizer->num_functions(), 3u);
+
+  auto result = symbolizer->Symbolize(
+      {0x500, 0x1000, 0x10ff, 0x1100, 0x1fff, 0x2008, 0x2010, 0x3000});
+  ASSERT_EQ(result.size(), 8u);
+  EXPECT_THAT(result[0], IsEmpty());
+  EXPECT_EQ(FunctionName(result[1]), "foo");
+  EXPECT_EQ(FunctionName(result[2]), "foo");
+  EXPECT_EQ(FunctionName(result[3]), "no_size");
+  EXPECT_EQ(FunctionName(result[4]), "no_size");
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  EXPECT_EQ(FunctionName(result[5]), "ns::baz()");
+#endif
+  EXPECT_THAT(result[6], IsEmpty());
+  EXPECT_THAT(result[7], IsEmpty());
+  // There is no line table.
+  EXPECT_EQ(FileAndLine(result[1]), ":0");
+}
+
+class ElfSymbolizerLineTableTest : public ::testing::TestWithParam<uint16_t> {
+};
+
+TEST_P(ElfSymbolizerLineTableTest, Lines) {
+  ElfBuilder builder;
+  builder.AddSymbol("foo", 0x1000, 0x100);
+  builder.AddSymbol("bar", 0x2000, 0x100);
+  LineProgram program;
+  // The sequences are not sorted by address.
+  program.SetAddress(0x2000)
+      .AdvanceLine(19)
+      .Copy()
+      .AdvancePc(0x10)
+      .EndSequence();
+  program.SetAddress(0x1000)
+      .AdvanceLine(9)
+      .Copy()
+      .Special(0x10, 2)
+      .SetColumn(4)
+      .AdvancePc(0x70)
+      .SetFile(2)
+      .AdvanceLine(-9)
+      .Copy()
+      .AdvancePc(0x80)
+      .EndSequence();
+  // Code removed by the linker.
+  program.SetAddress(0)
+      .AdvanceLine(99)
+      .Copy()
+      .AdvancePc(0x2000)
+      .EndSequence();
+  builder.AddLineTable(GetParam(), {"a.cc", "b.h"}, program);
+  std::unique_ptr<ElfSymbolizer> symbolizer = Create(builder.Build());
+  ASSERT_TRUE(symbolizer);
+  EXPECT_EQ(symbolizer->num_line_rows(), 6u);
+
+  auto result = symbolizer->Symbolize(
+      {0x1000, 0x100f, 0x1010, 0x1080, 0x10ff, 0x2000, 0x200f, 0x2010});
+  ASSERT_EQ(result.size(), 8u);
+  EXPECT_EQ(FileAndLine(result[0]), "/src/a.cc:10");
+  EXPECT_EQ(FileAndLine(result[1]), "/src/a.cc:10");
+  EXPECT_EQ(FileAndLine(result[2]), "/src/a.cc:12");
+  EXPECT_EQ(FileAndLine(result[3]), "/src/b.h:3");
+  EXPECT_EQ(FileAndLine(result[4]), "/src/b.h:3");
+  EXPECT_EQ(FileAndLine(result[5]), "/src/a.cc:20");
+  EXPECT_EQ(FileAndLine(result[6]), "/src/a.cc:20");
+  EXPECT_EQ(FileAndLine(result[7]), ":0");
+  EXPECT_EQ(FunctionName(result[7]), "bar");
+}
+
+INSTANTIATE_TEST_SUITE_P(Versions,
+                         ElfSymbolizerLineTableTest,
+                         ::testing::Values(2, 4, 5));
+
+TEST(ElfSymbolizerTest, SerializeRoundTrip) {
+  ElfBuilder builder;
+  builder.AddSymbol("foo", 0x1000, 0x100);
+  builder.AddSymbol("bar", 0x1100, 0x100);
+  LineProgram program;
+  program.SetAddress(0x1000)
+      .AdvanceLine(41)
+      .Copy()
+      .SetFile(2)
+      .Special(0x80, 1)
+      .AdvancePc(0x100)
+      .EndSequence();
+  builder.AddLineTable(4, {"a.cc", "b.cc"}, program);
+  std::unique_ptr<ElfSymbolizer> symbolizer = Create(builder.Build());
+  ASSERT_TRUE(symbolizer);
+
+  std::string data = symbolizer->Serialize();
+  std::unique_ptr<ElfSymbolizer> deserialized =
+      ElfSymbolizer::Deserialize(data);
+  ASSERT_TRUE(deserialized);
+  std::vector<uint64_t> addresses = {0x1000, 0x1090, 0x1150, 0x1200};
+  auto expected = symbolizer->Symbolize(addresses);
+  auto actual = deserialized->Symbolize(addresses);
+  ASSERT_EQ(actual.size(), expected.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_EQ(FunctionName(actual[i]), FunctionName(expected[i]));
+    EXPECT_EQ(FileAndLine(actual[i]), FileAndLine(expected[i]));
+  }
+  EXPECT_EQ(FileAndLine(actual[1]), "/src/b.cc:43");
+
+  EXPECT_FALSE(ElfSymbolizer::Deserialize(""));
+  EXPECT_FALSE(ElfSymbolizer::Deserialize(data.substr(0, data.size() - 1)));
+  std::string corrupted = data;
+  corrupted[corrupted.size() - 1] = 'x';  // Strings are not NUL-terminated.
+  EXPECT_FALSE(ElfSymbolizer::Deserialize(corrupted));
+}
+
+TEST(ElfSymbolizerTest, InvalidElf) {
+  EXPECT_FALSE(Create(""));
+  EXPECT_FALSE(Create("not an ELF file"));
+
+  ElfBuilder builder;
+  builder.AddSymbol("foo", 0x1000, 0x100);
+  std::string elf = builder.Build();
+  // Truncating the section headers does not crash.
+  for (size_t size : {elf.size() - 1, elf.size() / 2, sizeof(Elf64::Ehdr)}) {
+    std::unique_ptr<ElfSymbolizer> symbolizer = Create(elf.substr(0, size));
+    if (symbolizer) {
+      EXPECT_THAT(symbolizer->Symbolize({0x1000})[0], IsEmpty());
+    }
+  }
+
+  // Truncated line tables are ignored.
+  LineProgram program;
+  program.SetAddress(0x1000).AdvanceLine(1).Copy();
+  builder.AddLineTable(4, {"a.cc"}, program);
+  std::unique_ptr<ElfSymbolizer> symbolizer = Create(builder.Build());
+  ASSERT_TRUE(symbolizer);
+  EXPECT_EQ(symbolizer->num_line_rows(), 0u);
+  EXPECT_EQ(FunctionName(symbolizer->Symbolize({0x1000})[0]), "foo");
+
+  // A DWARF 5 file table with a huge number of entries without any format
+  // (so each entry takes no bytes) is rejected rather than allocated.
+  std::string header;
+  Append<uint8_t>(&header, 1);  // minimum_instruction_length
+  Append<uint8_t>(&header, 1);  // maximum_operations_per_instruction
+  Append<uint8_t>(&header, 1);  // default_is_stmt
+  Append(&header, elf_for_testing::kLineBase);
+  Append(&header, elf_for_testing::kLineRange);
+  Append(&header, elf_for_testing::kOpcodeBase);
+  for (uint8_t length : elf_for_testing::kStdOpcodeLengths)
+    Append(&header, length);
+  Append<uint8_t>(&header, 0);             // directory_entry_format_count
+  Append<uint8_t>(&header, 0);             // directories_count
+  Append<uint8_t>(&header, 0);             // file_name_entry_format_count
+  AppendUleb128(&header, 0x400000000ull);  // file_names_count
+  std::string unit;
+  Append<uint16_t>(&unit, 5);  // version
+  Append<uint8_t>(&unit, 8);   // address_size
+  Append<uint8_t>(&unit, 0);   // segment_selector_size
+  Append(&unit, static_cast<uint32_t>(header.size()));
+  unit += header;
+  ElfBuilder huge_count_builder;
+  huge_count_builder.AddSymbol("foo", 0x1000, 0x100);
+  huge_count_builder.AddLineUnit(unit);
+  symbolizer = Create(huge_count_builder.Build());
+  ASSERT_TRUE(symbolizer);
+  EXPECT_EQ(symbolizer->num_line_rows(), 0u);
+  EXPECT_EQ(FunctionName(symbolizer->Symbolize({0x1000})[0]), "foo");
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+TEST(ElfSymbolizerTest, ZlibCompressedDebugSections) {
+  ElfBuilder builder;
+  builder.AddSymbol("foo", 0x1000, 0x100);
+  LineProgram program;
+  program.SetAddress(0x1000).AdvanceLine(9).Copy().AdvancePc(0x100);
+  program.EndSequence();
+  builder.AddLineTable(5, {"a.cc"}, program);
+  builder.CompressDebugSections(ELFCOMPRESS_ZLIB);
+  std::unique_ptr<ElfSymbolizer> symbolizer = Create(builder.Build());
+  ASSERT_TRUE(symbolizer);
+  EXPECT_FALSE(symbolizer->has_unreadable_line_tables());
+  EXPECT_EQ(symbolizer->num_line_rows(), 2u);
+  EXPECT_EQ(FileAndLine(symbolizer->Symbolize({0x1010})[0]), "/src/a.cc:10");
+}
+#endif
+
+TEST(ElfSymbolizerTest, UnsupportedCompressedDebugSections) {
+  ElfBuilder builder;
+  builder.AddSymbol("foo", 0x1000, 0x100);
+  LineProgram program;
+  program.SetAddress(0x1000).AdvanceLine(9).Copy().AdvancePc(0x100);
+  program.EndSequence();
+  builder.AddLineTable(4, {"a.cc"}, program);
+  builder.CompressDebugSections(/*ELFCOMPRESS_ZSTD=*/2);
+  std::unique_ptr<ElfSymbolizer> symbolizer = Create(builder.Build());
+  ASSERT_TRUE(symbolizer);
+  EXPECT_TRUE(symbolizer->has_unreadable_line_tables());
+  EXPECT_EQ(symbolizer->num_line_rows(), 0u);
+  EXPECT_EQ(FunctionName(symbolizer->Symbolize({0x1010})[0]), "foo");
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_LOCAL_SYMBOLIZER)
+// Returns the binary of every lookup, as the ELF files built here do not
+// have a build id.
+class FakeBinaryFinder : public BinaryFinder {
+ public:
+  explicit FakeBinaryFinder(std::string file_name)
+      : file_name_(std::move(file_name)) {}
+
+  base::Optional<FoundBinary> FindBinary(const std::string&,
+                                         const std::string&) override {
+    return FoundBinary{file_name_, 0};
+  }
+
+ private:
+  std::string file_name_;
+};
+
+TEST(ElfSymbolizerTest, LocalSymbolizerCache) {
+  base::TmpDirTree tmp;
+  ElfBuilder builder;
+  builder.AddSymbol("foo", 0x1000, 0x100);
+  LineProgram program;
+  program.SetAddress(0x1000).AdvanceLine(9).Copy().AdvancePc(0x100);
+  program.EndSequence();
+  builder.AddLineTable(4, {"a.cc"}, program);
+  tmp.AddFile("lib.so", builder.Build());
+  tmp.AddDir("cache");
+  tmp.TrackFile("cache/6275696c642d6964.perfetto_symbols");
+  const std::string cache_dir = tmp.AbsolutePath("cache");
+
+  {
+    LocalSymbolizer symbolizer(
+        std::unique_ptr<BinaryFinder>(
+            new FakeBinaryFinder(tmp.AbsolutePath("lib.so"))),
+        cache_dir);
+    auto result = symbolizer.Symbolize("/lib.so", "build-id", 0, {0x1010});
+    ASSERT_EQ(result.size(), 1u);
+    EXPECT_EQ(FunctionName(result[0]), "foo");
+  }
+  EXPECT_TRUE(
+      base::FileExists(cache_dir + "/6275696c642d6964.perfetto_symbols"));
+
+  // Another binary with the same build id is not parsed.
+  ElfBuilder other_builder;
+  other_builder.AddSymbol("bar", 0x1000, 0x100);
+  tmp.AddFile("other.so", other_builder.Build());
+  LocalSymbolizer symbolizer(std::unique_ptr<BinaryFinder>(new FakeBinaryFinder(
+                                 tmp.AbsolutePath("other.so"))),
+                             cache_dir);
+  auto result = symbolizer.Symbolize("/other.so", "build-id", 0, {0x1010});
+  ASSERT_EQ(result.size(), 1u);
+  EXPECT_EQ(FunctionName(result[0]), "foo");
+}
+
+TEST(ElfSymbolizerTest, LocalSymbolizerDoesNotCacheStrippedBinaries) {
+  base::TmpDirTree tmp;
+  ElfBuilder stripped_builder;
+  stripped_builder.AddSymbol("foo", 0x1000, 0x100);
+  tmp.AddFile("stripped.so", stripped_builder.Build());
+  ElfBuilder builder;
+  builder.AddSymbol("foo", 0x1000, 0x100);
+  LineProgram program;
+  program.SetAddress(0x1000).AdvanceLine(9).Copy().AdvancePc(0x100);
+  program.EndSequence();
+  builder.AddLineTable(4, {"a.cc"}, program);
+  tmp.AddFile("unstripped.so", builder.Build());
+  tmp.AddDir("cache");
+  tmp.TrackFile("cache/6275696c642d6964.perfetto_symbols");
+  const std::string cache_dir = tmp.AbsolutePath("cache");
+
+  {
+    LocalSymbolizer symbolizer(
+        std::unique_ptr<BinaryFinder>(
+            new FakeBinaryFinder(tmp.AbsolutePath("stripped.so"))),
+        cache_dir);
+    auto result = symbolizer.Symbolize("/lib.so", "build-id", 0, {0x1010});
+    ASSERT_EQ(result.size(), 1u);
+    EXPECT_EQ(FunctionName(result[0]), "foo");
+    EXPECT_EQ(FileAndLine(result[0]), ":0");
+  }
+  EXPECT_FALSE(
+      base::FileExists(cache_dir + "/6275696c642d6964.perfetto_symbols"));
+
+  // The unstripped binary with the same build id still provides the lines.
+  LocalSymbolizer symbolizer(std::unique_ptr<BinaryFinder>(new FakeBinaryFinder(
+                                 tmp.AbsolutePath("unstripped.so"))),
+                             cache_dir);
+  auto result = symbolizer.Symbolize("/lib.so", "build-id", 0, {0x1010});
+  ASSERT_EQ(result.size(), 1u);
+  EXPECT_EQ(FunctionName(result[0]), "foo");
+  EXPECT_EQ(FileAndLine(result[0]), "/src/a.cc:10");
+  EXPECT_TRUE(
+      base::FileExists(cache_dir + "/6275696c642d6964.perfetto_symbols"));
+}
+
+TEST(ElfSymbolizerTest, LocalSymbolizerDoesNotCacheUnreadableLineTables) {
+  base::TmpDirTree tmp;
+  ElfBuilder builder;
+  builder.AddSymbol("foo", 0x1000, 0x100);
+  LineProgram program;
+  program.SetAddress(0x1000).AdvanceLine(9).Copy().AdvancePc(0x100);
+  program.EndSequence();
+  builder.AddLineTable(4, {"a.cc"}, program);
+  builder.CompressDebugSections(/*ELFCOMPRESS_ZSTD=*/2);
+  tmp.AddFile("lib.so", builder.Build());
+  tmp.AddDir("cache");
+  const std::string cache_dir = tmp.AbsolutePath("cache");
+
+  // The binary is symbolized by llvm-symbolizer if it is in $PATH, which
+  // finds the same function name.
+  LocalSymbolizer symbolizer(std::unique_ptr<BinaryFinder>(new FakeBinaryFinder(
+                                 tmp.AbsolutePath("lib.so"))),
+                             cache_dir);
+  auto result = symbolizer.Symbolize("/lib.so", "build-id", 0, {0x1010, 0x1020});
+  ASSERT_EQ(result.size(), 2u);
+  EXPECT_EQ(FunctionName(result[0]), "foo");
+  EXPECT_FALSE(
+      base::FileExists(cache_dir + "/6275696c642d6964.perfetto_symbols"));
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_LOCAL_SYMBOLIZER)
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
@@ -17,6 +17,8 @@
 #include "src/profiling/symbolizer/local_symbolizer.h"
 
 #include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include <cinttypes>
 #include <memory>
@@ -53,7 +55,16 @@ std::unique_ptr<Symbolizer> LocalSymbolizerOrDie(
       finder.reset(new LocalBinaryIndexer(std::move(binary_path)));
     else
       PERFETTO_FATAL("Invalid symbolizer mode [find | index]: %s", mode);
-    symbolizer.reset(new LocalSymbolizer(std::move(finder)));
+    // The binaries are symbolized in-process, unless llvm-symbolizer is
+    // requested, e.g. for inlined frames.
+    const char* llvm_symbolizer = getenv("PERFETTO_LLVM_SYMBOLIZER");
+    if (llvm_symbolizer) {
+      symbolizer.reset(new LocalSymbolizer(llvm_symbolizer, std::move(finder)));
+    } else {
+      const char* cache_dir = getenv("PERFETTO_SYMBOL_CACHE_DIR");
+      symbolizer.reset(
+          new LocalSymbolizer(std::move(finder), cache_dir ? cache_dir : ""));
+    }
 #else
     base::ignore_result(mode);
     PERFETTO_FATAL("This build does not support local symbolization.");
@@ -74,6 +85,10 @@ std::unique_ptr<Symbolizer> LocalSymbolizerOrDie(
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <unistd.h>
+#endif
+
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 constexpr const char* kDefaultSymbolizer = "llvm-symbolizer.exe";
 #else
@@ -301,6 +316,26 @@ std::map<std::string, FoundBinary> BuildIdIndex(std::vector<std::string> dirs) {
   return result;
 }
 
+// Returns whether |file| is an executable path, or the name of an executable
+// in $PATH.
+bool IsExecutable(const std::string& file) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  // Launching a missing executable fails gracefully on Windows.
+  base::ignore_result(file);
+  return true;
+#else
+  if (file.find('/') != std::string::npos)
+    return access(file.c_str(), X_OK) == 0;
+  const char* path = getenv("PATH");
+  for (base::StringSplitter dirs(path ? path : "", ':'); dirs.Next();) {
+    std::string candidate = std::string(dirs.cur_token()) + "/" + file;
+    if (access(candidate.c_str(), X_OK) == 0)
+      return true;
+  }
+  return false;
+#endif
+}
+
 }  // namespace
 
 bool ParseLlvmSymbolizerLine(const std::string& line,
@@ -531,20 +566,117 @@ std::vector<std::vector<SymbolizedFrame>> LocalSymbolizer::Symbolize(
     PERFETTO_LOG("Correcting load bias by %" PRIu64 " for %s",
                  load_bias_correction, mapping_name.c_str());
   }
-  std::vector<std::vector<SymbolizedFrame>> result;
-  result.reserve(addresses.size());
-  for (uint64_t address : addresses)
-    result.emplace_back(llvm_symbolizer_.Symbolize(
-        binary->file_name, address + load_bias_correction));
+  if (llvm_symbolizer_) {
+    std::vector<std::vector<SymbolizedFrame>> result;
+    result.reserve(addresses.size());
+    for (uint64_t address : addresses)
+      result.emplace_back(llvm_symbolizer_->Symbolize(
+          binary->file_name, address + load_bias_correction));
+    return result;
+  }
+
+  ElfSymbolizer* elf_symbolizer =
+      GetElfSymbolizer(binary->file_name, build_id);
+  if (!elf_symbolizer)
+    return std::vector<std::vector<SymbolizedFrame>>(addresses.size());
+  const std::vector<uint64_t>* pcs = &addresses;
+  std::vector<uint64_t> corrected_addresses;
+  if (load_bias_correction) {
+    corrected_addresses = addresses;
+    for (uint64_t& address : corrected_addresses)
+      address += load_bias_correction;
+    pcs = &corrected_addresses;
+  }
+  std::vector<std::vector<SymbolizedFrame>> result =
+      elf_symbolizer->Symbolize(*pcs);
+
+  // Without line tables, only the function names are known. llvm-symbolizer
+  // might still be able to read them (e.g. zstd compressed debug sections).
+  LLVMSymbolizerProcess* fallback =
+      elf_symbolizer->has_unreadable_line_tables() ? GetFallbackSymbolizer()
+                                                   : nullptr;
+  if (fallback) {
+    for (size_t i = 0; i < pcs->size(); i++) {
+      std::vector<SymbolizedFrame> frames =
+          fallback->Symbolize(binary->file_name, (*pcs)[i]);
+      if (!frames.empty())
+        result[i] = std::move(frames);
+    }
+  }
   return result;
 }
 
+LLVMSymbolizerProcess* LocalSymbolizer::GetFallbackSymbolizer() {
+  if (!fallback_symbolizer_checked_) {
+    fallback_symbolizer_checked_ = true;
+    if (IsExecutable(kDefaultSymbolizer)) {
+      fallback_symbolizer_.reset(new LLVMSymbolizerProcess(kDefaultSymbolizer));
+    } else {
+      PERFETTO_ELOG(
+          "%s not found, some binaries are symbolized without line numbers.",
+          kDefaultSymbolizer);
+    }
+  }
+  return fallback_symbolizer_.get();
+}
+
+ElfSymbolizer* LocalSymbolizer::GetElfSymbolizer(const std::string& file_name,
+                                                 const std::string& build_id) {
+  auto it_and_inserted = elf_symbolizers_.emplace(file_name, nullptr);
+  std::unique_ptr<ElfSymbolizer>& elf_symbolizer =
+      it_and_inserted.first->second;
+  if (!it_and_inserted.second)
+    return elf_symbolizer.get();
+
+  std::string cache_file;
+  if (!cache_dir_.empty() && !build_id.empty()) {
+    cache_file = cache_dir_ + "/" + base::ToHex(build_id) + ".perfetto_symbols";
+    std::string data;
+    if (base::ReadFile(cache_file, &data)) {
+      elf_symbolizer = ElfSymbolizer::Deserialize(data);
+      if (elf_symbolizer)
+        return elf_symbolizer.get();
+      PERFETTO_ELOG("Ignoring invalid symbol cache %s", cache_file.c_str());
+    }
+  }
+
+  elf_symbolizer = ElfSymbolizer::CreateFromFile(file_name);
+  if (!elf_symbolizer) {
+    PERFETTO_ELOG("Failed to parse %s", file_name.c_str());
+    return nullptr;
+  }
+  // The cache cannot tell that the fallback symbolizer is needed. Neither is
+  // a binary without line tables cached: it is likely stripped, and would hide
+  // the line tables of its unstripped copy, which has the same build id.
+  if (!cache_file.empty() && !elf_symbolizer->has_unreadable_line_tables() &&
+      elf_symbolizer->num_line_rows() > 0) {
+    // Written to a temporary file first, so that concurrent readers never see
+    // a partial cache file.
+    std::string data = elf_symbolizer->Serialize();
+    std::string tmp_file = cache_file + ".tmp";
+    base::ScopedFile fd =
+        base::OpenFile(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd && base::WriteAll(*fd, data.data(), data.size()) ==
+                  static_cast<ssize_t>(data.size())) {
+      fd.reset();
+      if (rename(tmp_file.c_str(), cache_file.c_str()) != 0)
+        PERFETTO_PLOG("Failed to rename %s", tmp_file.c_str());
+    } else {
+      PERFETTO_PLOG("Failed to write symbol cache %s", tmp_file.c_str());
+    }
+  }
+  return elf_symbolizer.get();
+}
+
 LocalSymbolizer::LocalSymbolizer(const std::string& symbolizer_path,
                                  std::unique_ptr<BinaryFinder> finder)
-    : llvm_symbolizer_(symbolizer_path), finder_(std::move(finder)) {}
+    : llvm_symbolizer_(new LLVMSymbolizerProcess(
+          symbolizer_path.empty() ? kDefaultSymbolizer : symbolizer_path)),
+      finder_(std::move(finder)) {}
 
-LocalSymbolizer::LocalSymbolizer(std::unique_ptr<BinaryFinder> finder)
-    : LocalSymbolizer(kDefaultSymbolizer, std::move(finder)) {}
+LocalSymbolizer::LocalSymbolizer(std::unique_ptr<BinaryFinder> finder,
+                                 std::string cache_dir)
+    : finder_(std::move(finder)), cache_dir_(std::move(cache_dir)) {}
 
 LocalSymbolizer::~LocalSymbolizer() = default;
 
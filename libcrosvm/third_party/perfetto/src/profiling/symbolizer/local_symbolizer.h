@@ -24,6 +24,7 @@
 
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "src/profiling/symbolizer/elf_symbolizer.h"
 #include "src/profiling/symbolizer/subprocess.h"
 #include "src/profiling/symbolizer/symbolizer.h"
 
@@ -96,10 +97,16 @@ class LLVMSymbolizerProcess {
 
 class LocalSymbolizer : public Symbolizer {
  public:
+  // Symbolizes by running the llvm-symbolizer at |symbolizer_path|.
   LocalSymbolizer(const std::string& symbolizer_path,
                   std::unique_ptr<BinaryFinder> finder);
 
-  explicit LocalSymbolizer(std::unique_ptr<BinaryFinder> finder);
+  // Symbolizes in-process with ElfSymbolizer. If |cache_dir| is not empty,
+  // the parsed symbols of each binary with line tables are stored there, keyed
+  // by build id, and reused across runs. The binaries whose line tables cannot
+  // be read are symbolized with llvm-symbolizer instead, if it is in $PATH.
+  explicit LocalSymbolizer(std::unique_ptr<BinaryFinder> finder,
+                           std::string cache_dir = "");
 
   std::vector<std::vector<SymbolizedFrame>> Symbolize(
       const std::string& mapping_name,
@@ -112,8 +119,20 @@ class LocalSymbolizer : public Symbolizer {
   ~LocalSymbolizer() override;
 
  private:
-  LLVMSymbolizerProcess llvm_symbolizer_;
+  ElfSymbolizer* GetElfSymbolizer(const std::string& file_name,
+                                  const std::string& build_id);
+  // Returns nullptr if llvm-symbolizer is not available.
+  LLVMSymbolizerProcess* GetFallbackSymbolizer();
+
+  // Only set when using llvm-symbolizer.
+  std::unique_ptr<LLVMSymbolizerProcess> llvm_symbolizer_;
+  // Started on first use, for the binaries ElfSymbolizer cannot fully read.
+  std::unique_ptr<LLVMSymbolizerProcess> fallback_symbolizer_;
+  bool fallback_symbolizer_checked_ = false;
   std::unique_ptr<BinaryFinder> finder_;
+  std::string cache_dir_;
+  // Keyed by file name. nullptr if the file could not be parsed.
+  std::map<std::string, std::unique_ptr<ElfSymbolizer>> elf_symbolizers_;
 };
 
 std::unique_ptr<Symbolizer> LocalSymbolizerOrDie(
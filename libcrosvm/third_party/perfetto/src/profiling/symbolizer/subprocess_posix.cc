@@ -47,7 +47,9 @@ Subprocess::Subprocess(const std::string& file, std::vector<std::string> args)
       PERFETTO_FATAL("Failed to exec %s", file.c_str());
   }
   PERFETTO_CHECK(pid_ != -1);
-  input_pipe_.rd.reset();
+  // Deliberately NOT closing input_pipe_.rd, so that a write() after the child
+  // died does not raise a SIGPIPE. Read() stops the writes once it sees that
+  // the child closed its stdout.
   output_pipe_.wr.reset();
 }
 
@@ -70,7 +72,10 @@ int64_t Subprocess::Read(char* buffer, size_t size) {
   if (!output_pipe_.rd) {
     return -1;
   }
-  return PERFETTO_EINTR(read(output_pipe_.rd.get(), buffer, size));
+  int64_t rd = PERFETTO_EINTR(read(output_pipe_.rd.get(), buffer, size));
+  if (rd == 0)
+    input_pipe_.wr.reset();
+  return rd;
 }
 
 }  // namespace profiling
@@ -66,6 +66,14 @@ class FilterBytecodeParser {
   // start from (typically perfetto.protos.Trace).
   QueryResult Query(uint32_t msg_index, uint32_t field_id);
 
+  // Returns the number of messages in the loaded filter. Valid message indexes
+  // are [0, num_messages()).
+  uint32_t num_messages() const {
+    return message_offset_.empty()
+               ? 0
+               : static_cast<uint32_t>(message_offset_.size() - 1);
+  }
+
   void Reset();
   void set_suppress_logs_for_fuzzer(bool x) { suppress_logs_for_fuzzer_ = x; }
 
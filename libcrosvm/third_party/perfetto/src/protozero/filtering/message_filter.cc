@@ -66,8 +66,28 @@ inline std::pair<uint8_t*, uint32_t> AppendLenDelim(uint32_t field_id,
   const size_t size_field_len = static_cast<size_t>(*out - size_field_start);
   return std::make_pair(size_field_start, size_field_len);
 }
+
+// Copies the encoded fields in [begin, end) as-is.
+inline void AppendBytes(const uint8_t* begin,
+                        const uint8_t* end,
+                        uint8_t** out) {
+  const size_t len = static_cast<size_t>(end - begin);
+  if (len == 0)
+    return;
+  memcpy(*out, begin, len);
+  *out += len;
+}
 }  // namespace
 
+// static
+constexpr size_t MessageFilter::kMaxRetainedBufferSize;
+constexpr uint32_t MessageFilter::kMaxFastPathDepth;
+constexpr uint32_t MessageFilter::kMaxFieldId;
+constexpr uint32_t MessageFilter::kMaxDenseFieldId;
+constexpr uint32_t MessageFilter::kDeniedField;
+constexpr uint32_t MessageFilter::kSimpleField;
+constexpr uint32_t MessageFilter::kFirstNestedMessage;
+
 MessageFilter::MessageFilter() {
   // Push a state on the stack for the implicit root message.
   stack_.emplace_back();
@@ -76,7 +96,53 @@ MessageFilter::MessageFilter() {
 MessageFilter::~MessageFilter() = default;
 
 bool MessageFilter::LoadFilterBytecode(const void* filter_data, size_t len) {
-  return filter_.Load(filter_data, len);
+  compiled_messages_.clear();
+  field_states_.clear();
+  if (!filter_.Load(filter_data, len))
+    return false;
+  CompileFilter();
+  return true;
+}
+
+void MessageFilter::CompileFilter() {
+  // Expands the directly indexed fields of each message, together with the
+  // ranges that overlap with them, into a dense table. The table of each
+  // message is truncated after its last allowed field, as most messages have
+  // only a handful of fields.
+  const uint32_t num_messages = filter_.num_messages();
+  compiled_messages_.resize(num_messages);
+  for (uint32_t msg_index = 0; msg_index < num_messages; ++msg_index) {
+    CompiledMessage& msg = compiled_messages_[msg_index];
+    msg.first_field_state = static_cast<uint32_t>(field_states_.size());
+    msg.num_field_states = 0;
+    for (uint32_t field_id = 0; field_id < kMaxDenseFieldId; ++field_id) {
+      auto res = filter_.Query(msg_index, field_id);
+      uint32_t state = kDeniedField;
+      if (res.allowed) {
+        state = res.simple_field() ? kSimpleField
+                                   : res.nested_msg_index + kFirstNestedMessage;
+      }
+      field_states_.push_back(state);
+      if (state != kDeniedField)
+        msg.num_field_states = field_id + 1;
+    }
+    field_states_.resize(msg.first_field_state + msg.num_field_states);
+  }
+  field_states_.shrink_to_fit();
+}
+
+uint32_t MessageFilter::GetFieldState(uint32_t msg_index,
+                                      const CompiledMessage& msg,
+                                      uint32_t field_id) {
+  if (PERFETTO_LIKELY(field_id < msg.num_field_states))
+    return field_states_[msg.first_field_state + field_id];
+  if (field_id < kMaxDenseFieldId)
+    return kDeniedField;
+  auto res = filter_.Query(msg_index, field_id);
+  if (!res.allowed)
+    return kDeniedField;
+  return res.simple_field() ? kSimpleField
+                            : res.nested_msg_index + kFirstNestedMessage;
 }
 
 bool MessageFilter::SetFilterRoot(const uint32_t* field_ids,
@@ -101,13 +167,157 @@ MessageFilter::FilteredMessage MessageFilter::FilterMessageFragments(
   uint32_t total_len = 0;
   for (size_t i = 0; i < num_slices; ++i)
     total_len += slices[i].len;
-  out_buf_.reset(new uint8_t[total_len]);
+  if (out_buf_capacity_ < total_len) {
+    out_buf_.reset(new uint8_t[total_len]);
+    out_buf_capacity_ = total_len;
+  }
   out_ = out_buf_.get();
   out_end_ = out_ + total_len;
+  error_ = false;
+
+  // The slow path reports an empty input as an error, leave that to it.
+  bool filtered = false;
+  if (fast_path_enabled_ && !track_field_usage_ && total_len > 0 &&
+      root_msg_index_ < compiled_messages_.size()) {
+    const uint8_t* data = nullptr;
+    if (num_slices == 1) {
+      data = static_cast<const uint8_t*>(slices[0].data);
+    } else if (total_len <= kMaxRetainedBufferSize) {
+      in_buf_.resize(total_len);
+      uint8_t* wptr = in_buf_.data();
+      for (size_t i = 0; i < num_slices; ++i) {
+        memcpy(wptr, slices[i].data, slices[i].len);
+        wptr += slices[i].len;
+      }
+      data = in_buf_.data();
+    }
+    if (data) {
+      filtered = FilterMessageFast(root_msg_index_, data, data + total_len, 0);
+      if (!filtered)
+        out_ = out_buf_.get();  // Start over on the slow path.
+    }
+  }
+  if (!filtered)
+    FilterMessageSlow(slices, num_slices, total_len);
+
+  // Construct the output object.
+  PERFETTO_CHECK(out_ >= out_buf_.get() && out_ <= out_end_);
+  auto used_size = static_cast<size_t>(out_ - out_buf_.get());
+  std::unique_ptr<uint8_t[]> data;
+  if (out_buf_capacity_ > kMaxRetainedBufferSize) {
+    // Don't keep a large buffer around (nor copy it) for a one-off message.
+    data = std::move(out_buf_);
+    out_buf_capacity_ = 0;
+  } else {
+    data.reset(new uint8_t[used_size]);
+    if (used_size > 0)
+      memcpy(data.get(), out_buf_.get(), used_size);
+  }
+  if (in_buf_.capacity() > kMaxRetainedBufferSize)
+    std::vector<uint8_t>().swap(in_buf_);
+  FilteredMessage res{std::move(data), used_size};
+  res.error = error_;
+  return res;
+}
+
+bool MessageFilter::FilterMessageFast(uint32_t msg_index,
+                                      const uint8_t* ptr,
+                                      const uint8_t* end,
+                                      uint32_t depth) {
+  using proto_utils::ProtoWireType;
+  if (PERFETTO_UNLIKELY(depth >= kMaxFastPathDepth))
+    return false;
+  PERFETTO_DCHECK(msg_index < compiled_messages_.size());
+  const CompiledMessage& msg = compiled_messages_[msg_index];
+
+  // Allowed fields are copied as-is, batching consecutive ones: the pending
+  // ones start at |run_start|. A denied field or a nested message (which is
+  // re-encoded) ends the run.
+  const uint8_t* run_start = ptr;
+  while (ptr < end) {
+    const uint8_t* const field_start = ptr;
+    uint64_t tag = 0;
+    ptr = proto_utils::ParseVarInt(ptr, end, &tag);
+    if (PERFETTO_UNLIKELY(ptr == field_start))
+      return false;
+    // The slow path ignores field id 0 in peculiar ways, leave it to it.
+    const uint64_t field_id = tag >> 3;
+    if (PERFETTO_UNLIKELY(field_id == 0 || field_id > kMaxFieldId))
+      return false;
+    const uint32_t state =
+        GetFieldState(msg_index, msg, static_cast<uint32_t>(field_id));
+    const bool allowed = state == kSimpleField;
+
+    switch (static_cast<ProtoWireType>(tag & 7u)) {
+      case ProtoWireType::kVarInt: {
+        uint64_t value = 0;
+        const uint8_t* value_end = proto_utils::ParseVarInt(ptr, end, &value);
+        if (PERFETTO_UNLIKELY(value_end == ptr))
+          return false;
+        ptr = value_end;
+        break;
+      }
+      case ProtoWireType::kFixed32:
+        if (PERFETTO_UNLIKELY(end - ptr < 4))
+          return false;
+        ptr += 4;
+        break;
+      case ProtoWireType::kFixed64:
+        if (PERFETTO_UNLIKELY(end - ptr < 8))
+          return false;
+        ptr += 8;
+        break;
+      case ProtoWireType::kLengthDelimited: {
+        uint64_t len = 0;
+        const uint8_t* payload = proto_utils::ParseVarInt(ptr, end, &len);
+        if (PERFETTO_UNLIKELY(payload == ptr ||
+                              len > proto_utils::kMaxMessageLength ||
+                              len > static_cast<uint64_t>(end - payload))) {
+          return false;
+        }
+        ptr = payload + len;
+        if (state >= kFirstNestedMessage) {
+          // The preamble of submessages is re-encoded, as in the slow path.
+          // This gets rid of the redundant length encoding of protozero.
+          AppendBytes(run_start, field_start, &out_);
+          run_start = ptr;
+          // |len| is only an upper bound for the size of the filtered
+          // submessage, which is backfilled at the end.
+          auto size_field = AppendLenDelim(static_cast<uint32_t>(field_id),
+                                           static_cast<uint32_t>(len), &out_);
+          if (len == 0)
+            continue;
+          uint8_t* const nested_start = out_;
+          if (!FilterMessageFast(state - kFirstNestedMessage, payload, ptr,
+                                 depth + 1)) {
+            return false;
+          }
+          proto_utils::WriteRedundantVarInt(
+              static_cast<uint32_t>(out_ - nested_start), size_field.first,
+              size_field.second);
+          continue;
+        }
+        // A string or bytes field.
+        break;
+      }
+      default:
+        return false;
+    }  // switch(type)
 
+    if (!allowed) {
+      AppendBytes(run_start, field_start, &out_);
+      run_start = ptr;
+    }
+  }
+  AppendBytes(run_start, end, &out_);
+  return true;
+}
+
+void MessageFilter::FilterMessageSlow(const InputSlice* slices,
+                                      size_t num_slices,
+                                      uint32_t total_len) {
   // Reset the parser state.
   tokenizer_ = MessageTokenizer();
-  error_ = false;
   stack_.clear();
   stack_.resize(2);
   // stack_[0] is a sentinel and should never be hit in nominal cases. If we
@@ -127,16 +337,10 @@ MessageFilter::FilteredMessage MessageFilter::FilterMessageFragments(
       FilterOneByte(data[i]);
   }
 
-  // Construct the output object.
-  PERFETTO_CHECK(out_ >= out_buf_.get() && out_ <= out_end_);
-  auto used_size = static_cast<size_t>(out_ - out_buf_.get());
-  FilteredMessage res{std::move(out_buf_), used_size};
-  res.error = error_;
   if (stack_.size() != 1 || !tokenizer_.idle() ||
       stack_[0].in_bytes != total_len) {
-    res.error = true;
+    error_ = true;
   }
-  return res;
 }
 
 void MessageFilter::FilterOneByte(uint8_t octet) {
@@ -22,6 +22,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "src/protozero/filtering/filter_bytecode_parser.h"
 #include "src/protozero/filtering/message_tokenizer.h"
@@ -41,8 +42,20 @@ namespace protozero {
 // types, lengths out of bound) the whole filtering failed and the |error| flag
 // of the FilteredMessage object is set to true.
 // The filtering operation is based on rewriting a copy of the message into a
-// self-allocated buffer, which is then returned in the output. The input buffer
-// is NOT altered.
+// buffer owned by the filter and reused across calls. The result is then copied
+// into an exactly-sized buffer, which is returned in the output. The input
+// buffer is NOT altered.
+// There are two implementations of the filtering:
+// - A fast path, used in most cases, which requires a contiguous input (the
+//   fragments are first gathered into a reusable buffer). It looks up fields
+//   in dense per-message tables precompiled from the bytecode, jumps over
+//   denied fields and copies runs of consecutive allowed fields with a single
+//   memcpy().
+// - A slow path, which tokenizes the input one byte at a time. This is used
+//   when field usage tracking is enabled and as a fallback whenever the fast
+//   path bails out (malformed input, deep nesting, huge fragmented inputs).
+//   Malformed inputs are always handled by the slow path, so the error
+//   semantics don't depend on the path taken.
 // Note also that the process of rewriting the protos gets rid of most redundant
 // varint encoding (if present). So even if all fields are allow-listed, the
 // output might NOT be bitwise identical to the input (but it will be
@@ -71,7 +84,8 @@ class MessageFilter {
   // Loads the filter bytecode that will be used to filter any subsequent
   // message. Must be called before the first call to FilterMessage*().
   // |filter_data| must point to a byte buffer for a proto-encoded ProtoFilter
-  // message (see proto_filter.proto).
+  // message (see proto_filter.proto). This also precompiles the lookup tables
+  // used by the fast path.
   bool LoadFilterBytecode(const void* filter_data, size_t len);
 
   // This affects the filter starting point of the subsequent FilterMessage*()
@@ -116,7 +130,60 @@ class MessageFilter {
   // Exposed only for DCHECKS in TracingServiceImpl.
   uint32_t root_msg_index() { return root_msg_index_; }
 
+  // Disables the fast path. Exposed only for tests and benchmarks, to compare
+  // the two implementations.
+  void set_fast_path_enabled_for_testing(bool x) { fast_path_enabled_ = x; }
+
  private:
+  // Inputs larger than this are not copied into |in_buf_| (if fragmented) and
+  // the output buffer is handed over rather than copied and retained.
+  static constexpr size_t kMaxRetainedBufferSize = 1024 * 1024;
+
+  // Nested messages deeper than this make the fast path bail out.
+  static constexpr uint32_t kMaxFastPathDepth = 32;
+
+  // The fast path falls back on the slow path for higher field ids (which are
+  // invalid in the proto encoding anyways).
+  static constexpr uint32_t kMaxFieldId = (1u << 29) - 1;
+
+  // Fields with an id >= this are looked up via |filter_| rather than via the
+  // dense tables in |field_states_|.
+  static constexpr uint32_t kMaxDenseFieldId = 128;
+
+  // Values of |field_states_|. Values >= kFirstNestedMessage are nested
+  // submessages, with message index = value - kFirstNestedMessage.
+  static constexpr uint32_t kDeniedField = 0;
+  static constexpr uint32_t kSimpleField = 1;
+  static constexpr uint32_t kFirstNestedMessage = 2;
+
+  // The location of the dense field table of a message in |field_states_|.
+  struct CompiledMessage {
+    uint32_t first_field_state;  // Index of the state of field id 0.
+    uint32_t num_field_states;   // Fields with ids >= this are not in the table.
+  };
+
+  // Builds |compiled_messages_| and |field_states_| from |filter_|.
+  void CompileFilter();
+
+  // Returns the state (kDeniedField, kSimpleField or a nested message) of the
+  // field |field_id| in the message |msg_index|.
+  uint32_t GetFieldState(uint32_t msg_index,
+                         const CompiledMessage& msg,
+                         uint32_t field_id) PERFETTO_ALWAYS_INLINE;
+
+  // Filters the contiguous encoded message [|ptr|, |end|) (of the type
+  // |msg_index|) into |out_|. Returns false, possibly after having written
+  // part of the output, if the input is malformed or hits one of the cases
+  // that only the slow path deals with. Recurses into nested messages.
+  bool FilterMessageFast(uint32_t msg_index,
+                         const uint8_t* ptr,
+                         const uint8_t* end,
+                         uint32_t depth);
+
+  // Filters the message with the byte-wise state machine below into |out_|.
+  // Sets |error_| if the input is malformed.
+  void FilterMessageSlow(const InputSlice*, size_t num_slices, uint32_t len);
+
   // This is called by FilterMessageFragments().
   // Inlining allows the compiler turn the per-byte call/return into a for loop,
   // while, at the same time, keeping the code easy to read and reason about.
@@ -189,12 +256,24 @@ class MessageFilter {
 
   uint32_t out_written() { return static_cast<uint32_t>(out_ - &out_buf_[0]); }
 
+  // The output buffer, reused across calls unless larger than
+  // kMaxRetainedBufferSize.
   std::unique_ptr<uint8_t[]> out_buf_;
+  size_t out_buf_capacity_ = 0;
   uint8_t* out_ = nullptr;
   uint8_t* out_end_ = nullptr;
   uint32_t root_msg_index_ = 0;
 
+  // Where fragmented inputs are gathered for the fast path.
+  std::vector<uint8_t> in_buf_;
+
   FilterBytecodeParser filter_;
+
+  // The precompiled filter used by the fast path, indexed by message index.
+  std::vector<CompiledMessage> compiled_messages_;
+  std::vector<uint32_t> field_states_;
+  bool fast_path_enabled_ = true;
+
   MessageTokenizer tokenizer_;
   std::vector<StackState> stack_;
 
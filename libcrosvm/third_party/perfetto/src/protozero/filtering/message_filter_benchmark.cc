@@ -16,25 +16,111 @@
 
 #include <algorithm>
 #include <string>
+#include <vector>
 
+#include "perfetto/base/logging.h"
 #include "perfetto/ext/base/file_utils.h"
+#include "perfetto/protozero/proto_decoder.h"
 #include "src/base/test/utils.h"
 #include "src/protozero/filtering/message_filter.h"
 
-static void BM_ProtozeroMessageFilter(benchmark::State& state) {
+namespace {
+
+// The size of the chunks of the shared memory buffer. Packets that cross a
+// chunk boundary reach the filter in several fragments.
+constexpr size_t kChunkSize = 4096;
+
+// The id of the perfetto.protos.Trace.packet field.
+constexpr uint32_t kTracePacketFieldId = 1;
+
+// The packet_kind argument that selects all the packets.
+constexpr int kAllPackets = 0;
+
+std::string ReadTrace() {
   std::string trace_data;
   static const char kTestTrace[] = "test/data/example_android_trace_30s.pb";
   perfetto::base::ReadFile(perfetto::base::GetTestDataPath(kTestTrace),
                            &trace_data);
   PERFETTO_CHECK(!trace_data.empty());
+  return trace_data;
+}
 
+std::string ReadFilter() {
   std::string filter;
   static const char kFullTraceFilter[] = "test/data/full_trace_filter.bytecode";
   perfetto::base::ReadFile(kFullTraceFilter, &filter);
   PERFETTO_CHECK(!filter.empty());
+  return filter;
+}
+
+// Returns the id of the largest field of |packet|, i.e. the type of payload
+// (ftrace_events, process_tree, ...) that dominates the filtering cost.
+uint32_t GetPacketKind(const protozero::ConstBytes& packet) {
+  protozero::ProtoDecoder decoder(packet);
+  uint32_t kind = 0;
+  size_t max_size = 0;
+  for (auto field = decoder.ReadField(); field.valid();
+       field = decoder.ReadField()) {
+    if (field.size() > max_size) {
+      max_size = field.size();
+      kind = field.id();
+    }
+  }
+  return kind;
+}
+
+// Splits the packets of the test trace of the type |kind| (or all of them) as
+// they are passed to the filter by TracingServiceImpl: one packet at a time,
+// fragmented on chunk boundaries.
+std::vector<std::vector<protozero::MessageFilter::InputSlice>> GetPackets(
+    const std::string& trace_data,
+    int kind) {
+  std::vector<std::vector<protozero::MessageFilter::InputSlice>> packets;
+  protozero::ProtoDecoder trace(trace_data.data(), trace_data.size());
+  size_t chunk_offset = 0;
+  for (auto field = trace.ReadField(); field.valid();
+       field = trace.ReadField()) {
+    if (field.id() != kTracePacketFieldId)
+      continue;
+    protozero::ConstBytes packet = field.as_bytes();
+    if (kind != kAllPackets &&
+        GetPacketKind(packet) != static_cast<uint32_t>(kind)) {
+      continue;
+    }
+    std::vector<protozero::MessageFilter::InputSlice> slices;
+    for (size_t offset = 0; offset < packet.size;) {
+      size_t len = std::min(packet.size - offset, kChunkSize - chunk_offset);
+      slices.push_back({packet.data + offset, len});
+      offset += len;
+      chunk_offset = (chunk_offset + len) % kChunkSize;
+    }
+    packets.emplace_back(std::move(slices));
+  }
+  return packets;
+}
+
+void PacketMixArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"fast_path", "packet_kind"});
+  // All packets, ftrace_events, process_tree, sys_stats, process_stats and
+  // track_event.
+  for (int kind : {kAllPackets, 1, 2, 7, 9, 11}) {
+    b->Args({0, kind});
+    b->Args({1, kind});
+  }
+}
+
+}  // namespace
+
+// Filters the whole test trace as a single message (as done by the
+// proto_filter tool). The argument selects the fast path (1) or the slow
+// path (0).
+static void BM_ProtozeroMessageFilter(benchmark::State& state) {
+  std::string trace_data = ReadTrace();
+  std::string filter = ReadFilter();
 
   protozero::MessageFilter filt;
   filt.LoadFilterBytecode(filter.data(), filter.size());
+  filt.set_fast_path_enabled_for_testing(state.range(0) != 0);
 
   for (auto _ : state) {
     auto res = filt.FilterMessage(trace_data.data(), trace_data.size());
@@ -45,4 +131,44 @@ static void BM_ProtozeroMessageFilter(benchmark::State& state) {
       static_cast<int64_t>(state.iterations() * trace_data.size()));
 }
 
-BENCHMARK(BM_ProtozeroMessageFilter);
+BENCHMARK(BM_ProtozeroMessageFilter)->ArgName("fast_path")->Arg(0)->Arg(1);
+
+// Filters the packets of the test trace one by one, as TracingServiceImpl
+// does. The first argument selects the fast path (1) or the slow path (0), the
+// second one the packet mix: all packets (0) or only the ones dominated by one
+// TracePacket field (e.g. 1 = ftrace_events, 2 = process_tree).
+static void BM_ProtozeroMessageFilterPackets(benchmark::State& state) {
+  std::string trace_data = ReadTrace();
+  std::string filter = ReadFilter();
+  auto packets = GetPackets(trace_data, static_cast<int>(state.range(1)));
+  if (packets.empty()) {
+    state.SkipWithError("No packets of this kind in the test trace");
+    return;
+  }
+  size_t total_size = 0;
+  for (const auto& slices : packets) {
+    for (const auto& slice : slices)
+      total_size += slice.len;
+  }
+
+  protozero::MessageFilter filt;
+  filt.LoadFilterBytecode(filter.data(), filter.size());
+  static const uint32_t kTracePacketRoot[] = {kTracePacketFieldId};
+  PERFETTO_CHECK(filt.SetFilterRoot(kTracePacketRoot, 1));
+  filt.set_fast_path_enabled_for_testing(state.range(0) != 0);
+
+  for (auto _ : state) {
+    for (const auto& slices : packets) {
+      auto res = filt.FilterMessageFragments(slices.data(), slices.size());
+      benchmark::DoNotOptimize(res);
+    }
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * total_size));
+  state.counters["packets/s"] = benchmark::Counter(
+      static_cast<double>(packets.size()),
+      benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK(BM_ProtozeroMessageFilterPackets)->Apply(PacketMixArgs);
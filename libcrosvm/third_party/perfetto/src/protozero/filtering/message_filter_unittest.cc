@@ -25,6 +25,7 @@
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "protos/perfetto/trace/trace.pb.h"
+#include "src/protozero/filtering/filter_bytecode_generator.h"
 #include "src/protozero/filtering/filter_util.h"
 #include "src/protozero/filtering/message_filter.h"
 
@@ -806,5 +807,180 @@ TEST(MessageFilterTest, RealTracePassthrough) {
   EXPECT_TRUE(original_ser == filter_ser);
 }
 
+// Creates a filter where:
+// - Message 0 (the root): 1, 2 and [150, 250) are simple fields. 3 and 400 are
+//   nested messages of type 1, 4 is a nested message of type 0.
+// - Message 1: 1 and 3 are simple fields, 2 is a nested message of type 0.
+std::string CreateRecursiveFilter() {
+  FilterBytecodeGenerator gen;
+  gen.AddSimpleField(1);
+  gen.AddSimpleField(2);
+  gen.AddNestedField(3, 1);
+  gen.AddNestedField(4, 0);
+  gen.AddSimpleFieldRange(150, 100);
+  gen.AddNestedField(400, 1);
+  gen.EndMessage();
+  gen.AddSimpleField(1);
+  gen.AddNestedField(2, 0);
+  gen.AddSimpleField(3);
+  gen.EndMessage();
+  return gen.Serialize();
+}
+
+// Appends random fields to |msg| (of type |msg_index| in the filter above)
+// using only canonical encodings for the allowed simple fields, so that the
+// output of the fast and the slow path is bitwise identical.
+void AppendRandomFields(Message* msg,
+                        uint32_t msg_index,
+                        uint32_t depth,
+                        std::minstd_rand0* rnd) {
+  static const uint32_t kSimpleFields[][5] = {{1, 2, 150, 151, 249},
+                                              {1, 3, 1, 3, 3}};
+  static const uint32_t kNestedFields[][3] = {{3, 4, 400}, {2, 2, 2}};
+  static const uint32_t kDeniedFields[] = {5, 127, 128, 300, 1000};
+  const uint32_t num_fields = (*rnd)() % 8;
+  for (uint32_t i = 0; i < num_fields; ++i) {
+    const uint32_t kind = (*rnd)() % 4;
+    if (kind == 0 && depth < 6) {
+      uint32_t field_id = kNestedFields[msg_index][(*rnd)() % 3];
+      uint32_t nested_index = field_id == 4 || field_id == 2 ? 0 : 1;
+      AppendRandomFields(msg->BeginNestedMessage<Message>(field_id),
+                         nested_index, depth + 1, rnd);
+      continue;
+    }
+    uint32_t field_id = kind == 1 ? kDeniedFields[(*rnd)() % 5]
+                                  : kSimpleFields[msg_index][(*rnd)() % 5];
+    switch ((*rnd)() % 5) {
+      case 0:
+        msg->AppendVarInt(field_id, (*rnd)() % 100);
+        break;
+      case 1:
+        msg->AppendVarInt(field_id,
+                          static_cast<int64_t>((*rnd)()) << ((*rnd)() % 40));
+        break;
+      case 2:
+        msg->AppendFixed(field_id, static_cast<uint32_t>((*rnd)()));
+        break;
+      case 3:
+        msg->AppendFixed(field_id, static_cast<uint64_t>((*rnd)()) << 20);
+        break;
+      case 4:
+        msg->AppendString(field_id, std::string((*rnd)() % 200, 'x'));
+        break;
+    }
+    if (kind == 1 && depth < 6 && (*rnd)() % 4 == 0) {
+      // Denied fields can also be submessages.
+      AppendRandomFields(msg->BeginNestedMessage<Message>(field_id), 0,
+                         depth + 1, rnd);
+    }
+  }
+}
+
+std::vector<MessageFilter::InputSlice> SplitRandomly(
+    const std::vector<uint8_t>& data,
+    std::minstd_rand0* rnd) {
+  std::vector<MessageFilter::InputSlice> slices;
+  for (size_t i = 0; i < data.size();) {
+    size_t slice_size = std::min<size_t>(1 + (*rnd)() % 64, data.size() - i);
+    slices.push_back({data.data() + i, slice_size});
+    i += slice_size;
+  }
+  return slices;
+}
+
+std::string ToString(const MessageFilter::FilteredMessage& msg) {
+  return std::string(reinterpret_cast<const char*>(msg.data.get()), msg.size);
+}
+
+TEST(MessageFilterTest, FastPathMatchesSlowPath) {
+  std::string bytecode = CreateRecursiveFilter();
+  MessageFilter fast_flt;
+  ASSERT_TRUE(fast_flt.LoadFilterBytecode(bytecode.data(), bytecode.size()));
+  MessageFilter slow_flt;
+  ASSERT_TRUE(slow_flt.LoadFilterBytecode(bytecode.data(), bytecode.size()));
+  slow_flt.set_fast_path_enabled_for_testing(false);
+
+  std::minstd_rand0 rnd(0);
+  for (int i = 0; i < 500; ++i) {
+    HeapBuffered<Message> msg;
+    AppendRandomFields(msg.get(), 0, 0, &rnd);
+    std::vector<uint8_t> encoded = msg.SerializeAsArray();
+    if (encoded.empty())
+      continue;
+
+    auto expected = slow_flt.FilterMessage(encoded.data(), encoded.size());
+    ASSERT_FALSE(expected.error);
+    auto actual = fast_flt.FilterMessage(encoded.data(), encoded.size());
+    ASSERT_FALSE(actual.error);
+    ASSERT_EQ(ToString(actual), ToString(expected));
+
+    auto slices = SplitRandomly(encoded, &rnd);
+    auto fragmented = fast_flt.FilterMessageFragments(&slices[0], slices.size());
+    ASSERT_FALSE(fragmented.error);
+    ASSERT_EQ(ToString(fragmented), ToString(expected));
+  }
+}
+
+TEST(MessageFilterTest, FastPathDeepNesting) {
+  std::string bytecode = CreateRecursiveFilter();
+  MessageFilter fast_flt;
+  ASSERT_TRUE(fast_flt.LoadFilterBytecode(bytecode.data(), bytecode.size()));
+  MessageFilter slow_flt;
+  ASSERT_TRUE(slow_flt.LoadFilterBytecode(bytecode.data(), bytecode.size()));
+  slow_flt.set_fast_path_enabled_for_testing(false);
+
+  // Deeper than what the fast path deals with.
+  HeapBuffered<Message> msg;
+  Message* nested = msg.get();
+  for (int i = 0; i < 100; ++i) {
+    nested->AppendVarInt(1, i);
+    nested->AppendVarInt(5, i);
+    nested = nested->BeginNestedMessage<Message>(4);
+  }
+  nested->AppendString(2, "leaf");
+  std::vector<uint8_t> encoded = msg.SerializeAsArray();
+
+  auto expected = slow_flt.FilterMessage(encoded.data(), encoded.size());
+  ASSERT_FALSE(expected.error);
+  auto actual = fast_flt.FilterMessage(encoded.data(), encoded.size());
+  ASSERT_FALSE(actual.error);
+  EXPECT_EQ(ToString(actual), ToString(expected));
+  EXPECT_LT(actual.size, encoded.size());
+}
+
+// The fast path must never accept an input that the slow path rejects.
+TEST(MessageFilterTest, FastPathMalformedInput) {
+  std::string bytecode = CreateRecursiveFilter();
+  MessageFilter fast_flt;
+  ASSERT_TRUE(fast_flt.LoadFilterBytecode(bytecode.data(), bytecode.size()));
+  MessageFilter slow_flt;
+  ASSERT_TRUE(slow_flt.LoadFilterBytecode(bytecode.data(), bytecode.size()));
+  slow_flt.set_fast_path_enabled_for_testing(false);
+
+  std::minstd_rand0 rnd(0);
+  size_t num_errors = 0;
+  for (int i = 0; i < 200; ++i) {
+    HeapBuffered<Message> msg;
+    AppendRandomFields(msg.get(), 0, 0, &rnd);
+    std::vector<uint8_t> encoded = msg.SerializeAsArray();
+    if (encoded.empty())
+      continue;
+    for (int j = 0; j < 10; ++j) {
+      std::vector<uint8_t> mutated = encoded;
+      if (j == 0) {
+        mutated.resize(rnd() % mutated.size());
+      } else {
+        mutated[rnd() % mutated.size()] = static_cast<uint8_t>(rnd());
+      }
+      auto expected = slow_flt.FilterMessage(mutated.data(), mutated.size());
+      auto actual = fast_flt.FilterMessage(mutated.data(), mutated.size());
+      ASSERT_EQ(actual.error, expected.error);
+      ASSERT_LE(actual.size, mutated.size());
+      num_errors += expected.error ? 1 : 0;
+    }
+  }
+  EXPECT_GT(num_errors, 0u);
+}
+
 }  // namespace
 }  // namespace protozero
@@ -96,6 +96,27 @@ BitVector::SetBitsIterator BitVector::IterateSetBits() const {
   return SetBitsIterator(this);
 }
 
+void BitVector::And(const BitVector& other) {
+  static_assert(sizeof(Block) == Block::kWords * sizeof(uint64_t),
+                "Block must just consist of words.");
+  PERFETTO_DCHECK(size() == other.size());
+
+  // Safe because of the static_assert above.
+  auto* ptr = reinterpret_cast<uint64_t*>(blocks_.data());
+  const auto* other_ptr =
+      reinterpret_cast<const uint64_t*>(other.blocks_.data());
+  uint32_t word_count = WordCeil(size());
+  for (uint32_t i = 0; i < word_count; ++i) {
+    ptr[i] &= other_ptr[i];
+  }
+
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < counts_.size(); ++i) {
+    counts_[i] = count;
+    count += blocks_[i].CountSetBits();
+  }
+}
+
 void BitVector::UpdateSetBits(const BitVector& update) {
   static_assert(sizeof(Block) == Block::kWords * sizeof(uint64_t),
                 "Block must just consist of words.");
@@ -302,6 +302,47 @@ class BitVector {
     return bv;
   }
 
+  // Creates a BitVector of size |end| with the bits between |start| and |end|
+  // filled a word at a time by calling the filler function
+  // |f(index of first bit, number of bits)|.
+  //
+  // The filler is called with at most 64 bits at a time and should return a
+  // word where the bottom |number of bits| bits are set (or not) for the
+  // corresponding indices and all other bits are zero. Unlike |Range|, this
+  // allows the filler to compute many bits at once (e.g. using SIMD).
+  template <typename WordFiller = uint64_t(uint32_t, uint32_t)>
+  static BitVector RangeWords(uint32_t start, uint32_t end, WordFiller f) {
+    static_assert(sizeof(Block) == Block::kWords * sizeof(uint64_t),
+                  "Block must just consist of words.");
+
+    BitVector bv;
+    uint32_t block_count = BlockCeil(end);
+    bv.blocks_.resize(block_count);
+    bv.counts_.resize(block_count);
+    bv.size_ = end;
+
+    // Safe because of the static_assert above.
+    auto* words = reinterpret_cast<uint64_t*>(bv.blocks_.data());
+    uint32_t word_end = WordCeil(end);
+    for (uint32_t i = start / BitWord::kBits; i < word_end; ++i) {
+      uint32_t word_start = i * BitWord::kBits;
+      uint32_t lo = std::max(start, word_start);
+      uint32_t hi = std::min(end, word_start + BitWord::kBits);
+      words[i] = f(lo, hi - lo) << (lo - word_start);
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < block_count; ++i) {
+      bv.counts_[i] = count;
+      count += bv.blocks_[i].CountSetBits();
+    }
+    return bv;
+  }
+
+  // Bitwise ands |other| into this BitVector. |other| should have the same
+  // size as this BitVector.
+  void And(const BitVector& other);
+
   // Requests the removal of unused capacity.
   // Matches the semantics of std::vector::shrink_to_fit.
   void ShrinkToFit() {
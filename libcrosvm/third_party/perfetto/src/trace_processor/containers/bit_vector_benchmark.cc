@@ -244,6 +244,34 @@ static void BM_BitVectorRangeFixedSize(benchmark::State& state) {
 }
 BENCHMARK(BM_BitVectorRangeFixedSize)->Apply(BitVectorArgs);
 
+static void BM_BitVectorRangeWordsFixedSize(benchmark::State& state) {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+  uint32_t set_percentage = static_cast<uint32_t>(state.range(1));
+
+  std::vector<uint32_t> resize_fill_pool(size);
+  for (uint32_t i = 0; i < size; ++i) {
+    resize_fill_pool[i] = rnd_engine() % 100 < set_percentage ? 90 : 100;
+  }
+
+  for (auto _ : state) {
+    auto filler = [&resize_fill_pool](uint32_t start, uint32_t count)
+                      PERFETTO_ALWAYS_INLINE {
+                        uint64_t word = 0;
+                        for (uint32_t i = 0; i < count; ++i) {
+                          uint64_t bit = resize_fill_pool[start + i] < 95;
+                          word |= bit << i;
+                        }
+                        return word;
+                      };
+    BitVector bv = BitVector::RangeWords(0, size, filler);
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_BitVectorRangeWordsFixedSize)->Apply(BitVectorArgs);
+
 static void BM_BitVectorUpdateSetBits(benchmark::State& state) {
   static constexpr uint32_t kRandomSeed = 42;
   std::minstd_rand0 rnd_engine(kRandomSeed);
@@ -462,6 +462,45 @@ TEST(BitVectorUnittest, Range) {
   ASSERT_EQ(bv.CountSetBits(), 341u);
 }
 
+TEST(BitVectorUnittest, RangeWords) {
+  auto filler = [](uint32_t start, uint32_t count) {
+    uint64_t word = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      word |= static_cast<uint64_t>((start + i) % 3 == 0) << i;
+    }
+    return word;
+  };
+  BitVector bv = BitVector::RangeWords(1, 1025, filler);
+
+  ASSERT_FALSE(bv.IsSet(0));
+  for (uint32_t i = 1; i < 1025; ++i) {
+    ASSERT_EQ(i % 3 == 0, bv.IsSet(i));
+  }
+  ASSERT_EQ(bv.size(), 1025u);
+  ASSERT_EQ(bv.CountSetBits(), 341u);
+
+  // Appending after the end should work as with any other BitVector.
+  bv.AppendTrue();
+  ASSERT_EQ(bv.size(), 1026u);
+  ASSERT_TRUE(bv.IsSet(1025));
+  ASSERT_EQ(bv.CountSetBits(), 342u);
+}
+
+TEST(BitVectorUnittest, And) {
+  BitVector bv =
+      BitVector::Range(0, 1025, [](uint32_t t) { return t % 2 == 0; });
+  BitVector other =
+      BitVector::Range(0, 1025, [](uint32_t t) { return t % 3 == 0; });
+  bv.And(other);
+
+  for (uint32_t i = 0; i < 1025; ++i) {
+    ASSERT_EQ(i % 6 == 0, bv.IsSet(i));
+  }
+  ASSERT_EQ(bv.size(), 1025u);
+  ASSERT_EQ(bv.CountSetBits(), 171u);
+  ASSERT_EQ(bv.IndexOfNthSet(100), 600u);
+}
+
 TEST(BitVectorUnittest, QueryStressTest) {
   BitVector bv;
   std::vector<bool> bool_vec;
@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CONTAINERS_COMPRESSED_VECTOR_H_
+#define SRC_TRACE_PROCESSOR_CONTAINERS_COMPRESSED_VECTOR_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/containers/string_pool.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Converts values of type T to and from "raw" unsigned integers such that
+// comparing raw values as unsigned integers gives the same order as comparing
+// the values themselves.
+//
+// All the integer types share the same mapping (i.e. the value as an int64_t
+// with the sign bit flipped) so the raw value of an int64_t can be compared
+// with the raw value of an int32_t or uint32_t.
+template <typename T>
+struct CompressedVectorTraits {
+  static constexpr bool kSupported = false;
+
+  static uint64_t ToRaw(T) { PERFETTO_FATAL("Unsupported type"); }
+  static T FromRaw(uint64_t) { PERFETTO_FATAL("Unsupported type"); }
+};
+
+template <typename T>
+struct CompressedVectorIntegerTraits {
+  static constexpr bool kSupported = true;
+
+  static uint64_t ToRaw(T value) {
+    return static_cast<uint64_t>(static_cast<int64_t>(value)) ^ (1ull << 63);
+  }
+  static T FromRaw(uint64_t raw) {
+    return static_cast<T>(static_cast<int64_t>(raw ^ (1ull << 63)));
+  }
+};
+
+template <>
+struct CompressedVectorTraits<int32_t>
+    : public CompressedVectorIntegerTraits<int32_t> {};
+
+template <>
+struct CompressedVectorTraits<uint32_t>
+    : public CompressedVectorIntegerTraits<uint32_t> {};
+
+template <>
+struct CompressedVectorTraits<int64_t>
+    : public CompressedVectorIntegerTraits<int64_t> {};
+
+template <>
+struct CompressedVectorTraits<StringPool::Id> {
+  static constexpr bool kSupported = true;
+
+  static uint64_t ToRaw(StringPool::Id id) { return id.raw_id(); }
+  static StringPool::Id FromRaw(uint64_t raw) {
+    return StringPool::Id::Raw(static_cast<uint32_t>(raw));
+  }
+};
+
+// An immutable vector of values which uses fewer bytes per value than the
+// plain std::vector for data with a small range or few distinct values.
+//
+// Each value is replaced by an 8, 16 or 32-bit "code"; codes are computed
+// using one of two encodings:
+//  * frame of reference: the code is the offset of the value from the
+//    smallest value in the vector. Good for values in a small range (e.g.
+//    cpu, depth or priority).
+//  * dictionary: the code is the index of the value in a sorted list of all
+//    the distinct values in the vector. Good for a few values spread over a
+//    large range (e.g. interned strings like category or end_state).
+//
+// With both encodings, codes have the same order as the values they encode;
+// this allows filtering on the codes directly (see |LowerBoundCode| and
+// |CodeOf|) without decoding each value.
+//
+// Note: codes are deliberately not packed into an arbitrary number of bits:
+// unpacking them costs more than scanning the uncompressed values would while
+// codes with a native width can be compared as cheaply as the values.
+template <typename T>
+class CompressedVector {
+ public:
+  using Traits = CompressedVectorTraits<T>;
+
+  // Vectors with fewer values than this are not compressed as the savings
+  // would be minimal.
+  static constexpr uint32_t kMinSizeToCompress = 1024;
+
+  // The maximum number of distinct values in a dictionary.
+  static constexpr uint32_t kMaxDictionarySize = 256;
+
+  CompressedVector(const CompressedVector&) = delete;
+  CompressedVector& operator=(const CompressedVector&) = delete;
+
+  CompressedVector(CompressedVector&&) noexcept = default;
+  CompressedVector& operator=(CompressedVector&&) = default;
+
+  // Compresses |values| using the encoding which needs the smallest codes.
+  // Returns nullptr if the codes would not be at most half the size of the
+  // values.
+  static std::unique_ptr<CompressedVector<T>> Compress(
+      const std::vector<T>& values) {
+    static_assert(Traits::kSupported, "Type cannot be compressed");
+    if (values.size() < kMinSizeToCompress)
+      return nullptr;
+
+    uint64_t min = Traits::ToRaw(values[0]);
+    uint64_t max = min;
+    for (T value : values) {
+      uint64_t raw = Traits::ToRaw(value);
+      min = std::min(min, raw);
+      max = std::max(max, raw);
+    }
+    uint64_t max_code = max - min;
+
+    // Only try building a dictionary if it could need smaller codes than the
+    // frame of reference encoding.
+    std::vector<uint64_t> dictionary;
+    if (max_code >= kMaxDictionarySize &&
+        BuildDictionary(values, kMaxDictionarySize, &dictionary)) {
+      max_code = dictionary.size() - 1;
+    } else {
+      dictionary.clear();
+    }
+
+    uint32_t code_width = max_code <= UINT8_MAX    ? 8
+                          : max_code <= UINT16_MAX ? 16
+                          : max_code <= UINT32_MAX ? 32
+                                                   : 64;
+    if (code_width * 2 > sizeof(T) * 8)
+      return nullptr;
+
+    std::unique_ptr<CompressedVector<T>> cv(new CompressedVector<T>(
+        min, max_code, std::move(dictionary), code_width));
+    switch (code_width) {
+      case 8:
+        cv->AppendCodes(values, &cv->codes8_);
+        break;
+      case 16:
+        cv->AppendCodes(values, &cv->codes16_);
+        break;
+      case 32:
+        cv->AppendCodes(values, &cv->codes32_);
+        break;
+    }
+    return cv;
+  }
+
+  // Returns the value at |idx|.
+  T Get(uint32_t idx) const { return Traits::FromRaw(RawOf(GetCode(idx))); }
+
+  // Returns the code of the value at |idx|.
+  uint64_t GetCode(uint32_t idx) const {
+    switch (code_width_) {
+      case 8:
+        return codes8_[idx];
+      case 16:
+        return codes16_[idx];
+      case 32:
+        return codes32_[idx];
+    }
+    PERFETTO_FATAL("Invalid code width");
+  }
+
+  // Returns the array of codes for all the values. |Code| should be the
+  // unsigned integer type with |code_width| bits.
+  template <typename Code>
+  const Code* codes() const;
+
+  // Returns a std::vector containing all the values in this vector.
+  std::vector<T> Decompress() const {
+    std::vector<T> values(size());
+    for (uint32_t i = 0; i < size(); ++i) {
+      values[i] = Get(i);
+    }
+    return values;
+  }
+
+  // Returns the number of codes whose value is less than the value with the
+  // raw representation |raw|.
+  uint64_t LowerBoundCode(uint64_t raw) const {
+    if (!dictionary_.empty()) {
+      auto it = std::lower_bound(dictionary_.begin(), dictionary_.end(), raw);
+      return static_cast<uint64_t>(std::distance(dictionary_.begin(), it));
+    }
+    if (raw <= reference_)
+      return 0;
+    return std::min(raw - reference_, max_code_ + 1);
+  }
+
+  // Returns the code for the value with the raw representation |raw| or
+  // nullopt if this value cannot be represented in this vector.
+  base::Optional<uint64_t> CodeOf(uint64_t raw) const {
+    uint64_t code = LowerBoundCode(raw);
+    if (code > max_code_ || RawOf(code) != raw)
+      return base::nullopt;
+    return code;
+  }
+
+  // Returns the number of values in this vector.
+  uint32_t size() const { return size_; }
+
+  // Returns the largest code used by any value in this vector.
+  uint64_t max_code() const { return max_code_; }
+
+  // Returns the number of bits used to store each code: one of 8, 16 or 32.
+  uint32_t code_width() const { return code_width_; }
+
+  // Returns whether this vector uses dictionary encoding.
+  bool is_dictionary() const { return !dictionary_.empty(); }
+
+  // Returns the approximate number of bytes of memory used by this vector.
+  size_t ApproxBytesCost() const {
+    return sizeof(*this) + size_ * (code_width_ / 8) +
+           dictionary_.capacity() * sizeof(uint64_t);
+  }
+
+ private:
+  CompressedVector(uint64_t reference,
+                   uint64_t max_code,
+                   std::vector<uint64_t> dictionary,
+                   uint32_t code_width)
+      : reference_(reference),
+        max_code_(max_code),
+        dictionary_(std::move(dictionary)),
+        code_width_(code_width) {}
+
+  template <typename Code>
+  void AppendCodes(const std::vector<T>& values, std::vector<Code>* codes) {
+    codes->reserve(values.size());
+    for (T value : values) {
+      codes->push_back(static_cast<Code>(*CodeOf(Traits::ToRaw(value))));
+    }
+    size_ = static_cast<uint32_t>(codes->size());
+  }
+
+  // Fills |dictionary| with the sorted distinct raw values in |values|.
+  // Returns false if there are more than |max_size| distinct values.
+  static bool BuildDictionary(const std::vector<T>& values,
+                              uint32_t max_size,
+                              std::vector<uint64_t>* dictionary) {
+    dictionary->clear();
+    uint64_t last = 0;
+    for (T value : values) {
+      uint64_t raw = Traits::ToRaw(value);
+      // Values are often repeated so avoid the binary search when possible.
+      if (!dictionary->empty() && raw == last)
+        continue;
+      last = raw;
+
+      auto it = std::lower_bound(dictionary->begin(), dictionary->end(), raw);
+      if (it != dictionary->end() && *it == raw)
+        continue;
+      if (dictionary->size() == max_size)
+        return false;
+      dictionary->insert(it, raw);
+    }
+    return true;
+  }
+
+  uint64_t RawOf(uint64_t code) const {
+    return dictionary_.empty() ? reference_ + code
+                               : dictionary_[static_cast<size_t>(code)];
+  }
+
+  // The smallest raw value in the vector; only used for frame of reference
+  // encoding.
+  uint64_t reference_ = 0;
+
+  // The largest code used by any value in the vector.
+  uint64_t max_code_ = 0;
+
+  // The sorted distinct raw values in the vector; empty for frame of
+  // reference encoding.
+  std::vector<uint64_t> dictionary_;
+
+  // Only the vector matching |code_width_| is used.
+  uint32_t code_width_ = 0;
+  uint32_t size_ = 0;
+  std::vector<uint8_t> codes8_;
+  std::vector<uint16_t> codes16_;
+  std::vector<uint32_t> codes32_;
+};
+
+template <typename T>
+template <typename Code>
+const Code* CompressedVector<T>::codes() const {
+  static_assert(sizeof(Code) == 1 || sizeof(Code) == 2 || sizeof(Code) == 4,
+                "Invalid code type");
+  PERFETTO_DCHECK(sizeof(Code) * 8 == code_width_);
+  switch (sizeof(Code)) {
+    case 1:
+      return reinterpret_cast<const Code*>(codes8_.data());
+    case 2:
+      return reinterpret_cast<const Code*>(codes16_.data());
+    case 4:
+      return reinterpret_cast<const Code*>(codes32_.data());
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CONTAINERS_COMPRESSED_VECTOR_H_
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/compressed_vector.h"
+
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+template <typename T>
+void AssertRoundTrips(const std::vector<T>& values,
+                      const CompressedVector<T>& cv) {
+  ASSERT_EQ(cv.size(), values.size());
+  for (uint32_t i = 0; i < values.size(); ++i) {
+    ASSERT_EQ(cv.Get(i), values[i]);
+  }
+  ASSERT_EQ(cv.Decompress(), values);
+}
+
+TEST(CompressedVector, TooSmall) {
+  std::vector<int64_t> values(10, 1);
+  ASSERT_EQ(CompressedVector<int64_t>::Compress(values), nullptr);
+}
+
+TEST(CompressedVector, FrameOfReference) {
+  std::vector<int64_t> values;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    values.push_back(1000000000000ll + (i * 7919) % 4000);
+  }
+  auto cv = CompressedVector<int64_t>::Compress(values);
+  ASSERT_NE(cv, nullptr);
+  ASSERT_FALSE(cv->is_dictionary());
+  ASSERT_EQ(cv->code_width(), 16u);
+  AssertRoundTrips(values, *cv);
+}
+
+TEST(CompressedVector, NegativeValues) {
+  std::vector<int32_t> values;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    values.push_back(static_cast<int32_t>(i % 7) - 3);
+  }
+  auto cv = CompressedVector<int32_t>::Compress(values);
+  ASSERT_NE(cv, nullptr);
+  ASSERT_EQ(cv->code_width(), 8u);
+  AssertRoundTrips(values, *cv);
+}
+
+TEST(CompressedVector, Dictionary) {
+  std::vector<uint32_t> values;
+  const uint32_t kValues[] = {5, 1000000, 3000000000u, 42};
+  for (uint32_t i = 0; i < 2000; ++i) {
+    values.push_back(kValues[(i * 13) % 4]);
+  }
+  auto cv = CompressedVector<uint32_t>::Compress(values);
+  ASSERT_NE(cv, nullptr);
+  ASSERT_TRUE(cv->is_dictionary());
+  ASSERT_EQ(cv->code_width(), 8u);
+  AssertRoundTrips(values, *cv);
+}
+
+TEST(CompressedVector, StringIds) {
+  StringPool pool;
+  std::vector<StringPool::Id> values;
+  const StringPool::Id kIds[] = {pool.InternString("R"),
+                                 pool.InternString("S"),
+                                 pool.InternString("D")};
+  for (uint32_t i = 0; i < 2000; ++i) {
+    values.push_back(kIds[i % 3]);
+  }
+  auto cv = CompressedVector<StringPool::Id>::Compress(values);
+  ASSERT_NE(cv, nullptr);
+  AssertRoundTrips(values, *cv);
+}
+
+TEST(CompressedVector, NotWorthCompressing) {
+  std::vector<int64_t> values;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    values.push_back(static_cast<int64_t>(i * 0x9E3779B97F4A7C15ull));
+  }
+  ASSERT_EQ(CompressedVector<int64_t>::Compress(values), nullptr);
+
+  // 32-bit codes would not save any memory for 32-bit values.
+  std::vector<uint32_t> small_values;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    small_values.push_back(i * 100);
+  }
+  ASSERT_EQ(CompressedVector<uint32_t>::Compress(small_values), nullptr);
+}
+
+TEST(CompressedVector, Codes) {
+  using Traits = CompressedVectorTraits<int64_t>;
+
+  // Frame of reference.
+  {
+    std::vector<int64_t> values;
+    for (uint32_t i = 0; i < 2000; ++i) {
+      values.push_back(100 + (i % 10) * 2);
+    }
+    auto cv = CompressedVector<int64_t>::Compress(values);
+    ASSERT_NE(cv, nullptr);
+    ASSERT_FALSE(cv->is_dictionary());
+
+    ASSERT_EQ(cv->LowerBoundCode(Traits::ToRaw(-5)), 0u);
+    ASSERT_EQ(cv->LowerBoundCode(Traits::ToRaw(100)), 0u);
+    ASSERT_EQ(cv->LowerBoundCode(Traits::ToRaw(101)), 1u);
+    ASSERT_EQ(cv->LowerBoundCode(Traits::ToRaw(1000)), 19u);
+    ASSERT_EQ(cv->CodeOf(Traits::ToRaw(104)), base::Optional<uint64_t>(4));
+    ASSERT_EQ(cv->CodeOf(Traits::ToRaw(99)), base::nullopt);
+    ASSERT_EQ(cv->CodeOf(Traits::ToRaw(119)), base::nullopt);
+  }
+
+  // Dictionary.
+  {
+    std::vector<int64_t> values;
+    const int64_t kValues[] = {-100000, 0, 100000};
+    for (uint32_t i = 0; i < 2000; ++i) {
+      values.push_back(kValues[i % 3]);
+    }
+    auto cv = CompressedVector<int64_t>::Compress(values);
+    ASSERT_NE(cv, nullptr);
+    ASSERT_TRUE(cv->is_dictionary());
+
+    ASSERT_EQ(cv->LowerBoundCode(Traits::ToRaw(-200000)), 0u);
+    ASSERT_EQ(cv->LowerBoundCode(Traits::ToRaw(-5)), 1u);
+    ASSERT_EQ(cv->LowerBoundCode(Traits::ToRaw(0)), 1u);
+    ASSERT_EQ(cv->LowerBoundCode(Traits::ToRaw(200000)), 3u);
+    ASSERT_EQ(cv->CodeOf(Traits::ToRaw(100000)), base::Optional<uint64_t>(2));
+    ASSERT_EQ(cv->CodeOf(Traits::ToRaw(5)), base::nullopt);
+  }
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -124,6 +124,25 @@ class NullableVector {
   // Returns whether data in this NullableVector is stored densely.
   bool IsDense() const { return mode_ == Mode::kDense; }
 
+  // Returns the backing storage of this NullableVector: |non_null_vector|
+  // contains one entry for each set bit in |non_null_bit_vector| in sparse mode
+  // and one entry per index in dense mode.
+  const std::vector<T>& non_null_vector() const { return data_; }
+  const BitVector& non_null_bit_vector() const { return valid_; }
+
+  // Replaces the contents of this NullableVector with the given backing
+  // storage (see |non_null_vector| for the expected layout). Returns false,
+  // leaving this NullableVector unchanged, if the two are inconsistent.
+  bool Assign(std::vector<T> data, BitVector valid) {
+    uint32_t expected =
+        mode_ == Mode::kDense ? valid.size() : valid.CountSetBits();
+    if (data.size() != expected)
+      return false;
+    data_ = std::move(data);
+    valid_ = std::move(valid);
+    return true;
+  }
+
  private:
   explicit NullableVector(Mode mode) : mode_(mode) {}
 
@@ -165,6 +165,8 @@ RowMap SelectIvWithIv(const std::vector<uint32_t>& iv,
 
 }  // namespace
 
+constexpr uint32_t RowMap::kSmallRangeLimit;
+
 RowMap::RowMap() : RowMap(0, 0) {}
 
 RowMap::RowMap(uint32_t start, uint32_t end, OptimizeFor optimize_for)
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -273,6 +274,19 @@ class RowMap {
   // Returns whether this rowmap is empty.
   bool empty() const { return size() == 0; }
 
+  // Returns the approximate number of bytes of memory used by this RowMap.
+  size_t ApproxBytesCost() const {
+    switch (mode_) {
+      case Mode::kRange:
+        return sizeof(RowMap);
+      case Mode::kBitVector:
+        return sizeof(RowMap) + BitVector::ApproxBytesCost(bit_vector_.size());
+      case Mode::kIndexVector:
+        return sizeof(RowMap) + index_vector_.size() * sizeof(OutputIndex);
+    }
+    PERFETTO_FATAL("For GCC");
+  }
+
   // Returns the index at the given |row|.
   OutputIndex Get(InputRow row) const {
     PERFETTO_DCHECK(row < size());
@@ -440,6 +454,26 @@ class RowMap {
     }
   }
 
+  // Intersects |sorted_indices|, which should be sorted in ascending order,
+  // with |this| writing the result into |this|. The order of the preserved
+  // indices will be the same as |this|.
+  void IntersectSorted(const std::vector<OutputIndex>& sorted_indices) {
+    if (mode_ == Mode::kRange) {
+      // As both |this| and |sorted_indices| are sorted, the intersection is
+      // just the slice of |sorted_indices| inside the range.
+      auto begin = std::lower_bound(sorted_indices.begin(),
+                                    sorted_indices.end(), start_index_);
+      auto end = std::lower_bound(begin, sorted_indices.end(), end_index_);
+      *this = RowMap(std::vector<OutputIndex>(begin, end));
+      return;
+    }
+
+    Filter([&sorted_indices](OutputIndex index) {
+      return std::binary_search(sorted_indices.begin(), sorted_indices.end(),
+                                index);
+    });
+  }
+
   // Clears this RowMap by resetting it to a newly constructed state.
   void Clear() { *this = RowMap(); }
 
@@ -490,6 +524,30 @@ class RowMap {
     }
   }
 
+  // Filters the indices in |out| by keeping those which meet |p| where |p| is
+  // evaluated for up to 64 indices at a time.
+  //
+  // |p(index, count)| should return a word where bit i is set if the index
+  // |index + i| should be kept for all i < |count|; all other bits should be
+  // zero. This is more efficient than |Filter| when |p| can compute many
+  // indices at once (e.g. when comparing contiguous values using SIMD).
+  template <typename WordPredicate = uint64_t(OutputIndex, uint32_t)>
+  void FilterWords(WordPredicate p) {
+    switch (mode_) {
+      case Mode::kRange:
+        FilterRangeWords(p);
+        break;
+      case Mode::kBitVector: {
+        bit_vector_.And(BitVector::RangeWords(0, bit_vector_.size(), p));
+        break;
+      }
+      case Mode::kIndexVector: {
+        Filter([&p](OutputIndex index) { return p(index, 1) != 0; });
+        break;
+      }
+    }
+  }
+
   // Returns the iterator over the rows in this RowMap.
   Iterator IterateRows() const { return Iterator(this); }
 
@@ -506,13 +564,15 @@ class RowMap {
   // ColumnStorage Selector is broken (after filtering is moved out of here).
   friend class ColumnStorageOverlay;
 
-  template <typename Predicate>
-  void FilterRange(Predicate p) {
-    uint32_t count = end_index_ - start_index_;
+  // Optimization: if we are only going to scan a few indices, it's not
+  // worth the haslle of working with a BitVector.
+  static constexpr uint32_t kSmallRangeLimit = 2048;
 
-    // Optimization: if we are only going to scan a few indices, it's not
-    // worth the haslle of working with a BitVector.
-    constexpr uint32_t kSmallRangeLimit = 2048;
+  // Returns whether filtering a range RowMap should produce an index vector
+  // (rather than a BitVector).
+  bool ShouldFilterRangeIntoIndexVector() const {
+    PERFETTO_DCHECK(mode_ == Mode::kRange);
+    uint32_t count = end_index_ - start_index_;
     bool is_small_range = count < kSmallRangeLimit;
 
     // Optimization: weif the cost of a BitVector is more than the highest
@@ -523,8 +583,14 @@ class RowMap {
     // If either of the conditions hold which make it better to use an
     // index vector, use it instead. Alternatively, if we are optimizing for
     // lookup speed, we also want to use an index vector.
-    if (is_small_range || index_vector_cost_ub <= bit_vector_cost ||
-        optimize_for_ == OptimizeFor::kLookupSpeed) {
+    return is_small_range || index_vector_cost_ub <= bit_vector_cost ||
+           optimize_for_ == OptimizeFor::kLookupSpeed;
+  }
+
+  template <typename Predicate>
+  void FilterRange(Predicate p) {
+    uint32_t count = end_index_ - start_index_;
+    if (ShouldFilterRangeIntoIndexVector()) {
       // Try and strike a good balance between not making the vector too
       // big and good performance.
       std::vector<uint32_t> iv(std::min(kSmallRangeLimit, count));
@@ -555,6 +621,32 @@ class RowMap {
     *this = RowMap(BitVector::Range(start_index_, end_index_, p));
   }
 
+  template <typename WordPredicate>
+  void FilterRangeWords(WordPredicate p) {
+    if (!ShouldFilterRangeIntoIndexVector()) {
+      *this = RowMap(BitVector::RangeWords(start_index_, end_index_, p));
+      return;
+    }
+
+    std::vector<uint32_t> iv;
+    for (uint32_t i = start_index_; i < end_index_; i += 64) {
+      uint32_t count = std::min(end_index_ - i, 64u);
+      uint64_t word = p(i, count);
+
+      // As with |FilterRange|, we keep this loop branch free by always
+      // writing the index but only incrementing the size if the bit is set.
+      size_t out_i = iv.size();
+      iv.resize(out_i + count);
+      for (uint32_t j = 0; j < count; ++j) {
+        iv[out_i] = i + j;
+        out_i += (word >> j) & 1u;
+      }
+      iv.resize(out_i);
+    }
+    iv.shrink_to_fit();
+    *this = RowMap(std::move(iv));
+  }
+
   void InsertIntoBitVector(uint32_t row) {
     PERFETTO_DCHECK(mode_ == Mode::kBitVector);
 
@@ -345,6 +345,74 @@ TEST(RowMapUnittest, IntersectManyIv) {
   ASSERT_EQ(rm.Get(2u), 3u);
 }
 
+TEST(RowMapUnittest, IntersectSortedRange) {
+  RowMap rm(3, 7);
+  rm.IntersectSorted({0u, 3u, 5u, 7u, 8u});
+
+  ASSERT_EQ(rm.size(), 2u);
+  ASSERT_EQ(rm.Get(0u), 3u);
+  ASSERT_EQ(rm.Get(1u), 5u);
+}
+
+TEST(RowMapUnittest, IntersectSortedBv) {
+  RowMap rm(BitVector{true, false, true, true, false, true});
+  rm.IntersectSorted({1u, 2u, 5u});
+
+  ASSERT_EQ(rm.size(), 2u);
+  ASSERT_EQ(rm.Get(0u), 2u);
+  ASSERT_EQ(rm.Get(1u), 5u);
+}
+
+TEST(RowMapUnittest, IntersectSortedIv) {
+  RowMap rm(std::vector<uint32_t>{3u, 2u, 0u, 1u, 1u, 3u});
+  rm.IntersectSorted({1u, 3u});
+
+  ASSERT_EQ(rm.size(), 4u);
+  ASSERT_EQ(rm.Get(0u), 3u);
+  ASSERT_EQ(rm.Get(1u), 1u);
+  ASSERT_EQ(rm.Get(2u), 1u);
+  ASSERT_EQ(rm.Get(3u), 3u);
+}
+
+TEST(RowMapUnittest, FilterWords) {
+  // Keeps every index divisible by 3.
+  auto p = [](uint32_t start, uint32_t count) {
+    uint64_t word = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      word |= static_cast<uint64_t>((start + i) % 3 == 0) << i;
+    }
+    return word;
+  };
+
+  // Small ranges are filtered into an index vector.
+  RowMap range(5, 100);
+  range.FilterWords(p);
+  ASSERT_EQ(range.size(), 32u);
+  ASSERT_EQ(range.Get(0u), 6u);
+  ASSERT_EQ(range.Get(31u), 99u);
+
+  // Larger ranges are filtered into a BitVector.
+  RowMap large_range(1, 10000);
+  large_range.FilterWords(p);
+  ASSERT_EQ(large_range.size(), 3333u);
+  ASSERT_EQ(large_range.Get(0u), 3u);
+  ASSERT_EQ(large_range.Get(3332u), 9999u);
+
+  RowMap bv(BitVector{true, false, true, true, false, true, true});
+  bv.FilterWords(p);
+  ASSERT_EQ(bv.size(), 3u);
+  ASSERT_EQ(bv.Get(0u), 0u);
+  ASSERT_EQ(bv.Get(1u), 3u);
+  ASSERT_EQ(bv.Get(2u), 6u);
+
+  RowMap iv(std::vector<uint32_t>{9u, 1u, 3u, 4u, 3u});
+  iv.FilterWords(p);
+  ASSERT_EQ(iv.size(), 3u);
+  ASSERT_EQ(iv.Get(0u), 9u);
+  ASSERT_EQ(iv.Get(1u), 3u);
+  ASSERT_EQ(iv.Get(2u), 3u);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -104,6 +104,71 @@ StringPool::Id StringPool::InsertLargeString(base::StringView str,
   return string_id;
 }
 
+bool StringPool::InsertStringWithId(Id id, base::StringView str) {
+  if (id.is_null() || str.data() == nullptr)
+    return false;
+
+  auto hash = str.Hash();
+  auto it_and_inserted = string_index_.Insert(hash, Id());
+  if (!it_and_inserted.second)
+    return false;
+
+  if (id.is_large_string()) {
+    if (id.large_string_index() != large_strings_.size())
+      return false;
+    *it_and_inserted.first = InsertLargeString(str, hash);
+    return true;
+  }
+
+  // Replicate the block allocation done by InsertString(): a new block is
+  // only created when a string doesn't fit in the current one.
+  bool success;
+  uint32_t offset;
+  std::tie(success, offset) = blocks_.back().TryInsert(str);
+  if (!success) {
+    blocks_.emplace_back(kBlockSizeBytes);
+    std::tie(success, offset) = blocks_.back().TryInsert(str);
+    if (!success)
+      return false;
+  }
+  *it_and_inserted.first = Id::BlockString(blocks_.size() - 1, offset);
+  return *it_and_inserted.first == id;
+}
+
+bool StringPool::HasId(Id id) const {
+  if (id.is_null())
+    return true;
+
+  base::StringView str;
+  if (id.is_large_string()) {
+    if (id.large_string_index() >= large_strings_.size())
+      return false;
+    str = GetLargeString(id);
+  } else {
+    if (id.block_index() >= blocks_.size())
+      return false;
+    const Block& block = blocks_[id.block_index()];
+    if (id.block_offset() >= block.pos())
+      return false;
+
+    // The offset could point anywhere in the block: check that the size and
+    // the string (including its null terminator) fit in the used part of it.
+    const uint8_t* ptr = block.Get(id.block_offset());
+    const uint8_t* end = block.Get(block.pos());
+    uint64_t size = 0;
+    const uint8_t* str_ptr =
+        protozero::proto_utils::ParseVarInt(ptr, end, &size);
+    if (str_ptr == ptr || size >= static_cast<uint64_t>(end - str_ptr))
+      return false;
+    str = base::StringView(reinterpret_cast<const char*>(str_ptr),
+                           static_cast<size_t>(size));
+  }
+
+  // Finally, the string must have been interned with exactly this id.
+  Id* interned = string_index_.Find(str.Hash());
+  return interned && *interned == id;
+}
+
 std::pair<bool /*success*/, uint32_t /*offset*/> StringPool::Block::TryInsert(
     base::StringView str) {
   auto str_size = str.size();
@@ -132,6 +132,13 @@ class StringPool {
     return *id;
   }
 
+  // Inserts |str|, which must not be in the pool yet, such that its id is
+  // |id|. This is used to restore the contents of a pool from a snapshot: for
+  // the ids to be reproduced, strings must be inserted in iteration order into
+  // a newly created pool. Returns false if |str| could not be given |id|; the
+  // pool should not be used anymore if this happens.
+  bool InsertStringWithId(Id id, base::StringView str);
+
   base::Optional<Id> GetId(base::StringView str) const {
     if (str.data() == nullptr)
       return Id::Null();
@@ -145,6 +152,10 @@ class StringPool {
     return base::nullopt;
   }
 
+  // Returns whether |id| is the null id or the id of a string in the pool.
+  // Unlike Get(), this can be called with arbitrary (e.g. untrusted) ids.
+  bool HasId(Id id) const;
+
   NullTermStringView Get(Id id) const {
     if (id.is_null())
       return NullTermStringView();
@@ -18,6 +18,8 @@
 
 #include <array>
 #include <random>
+#include <string>
+#include <vector>
 
 #include "test/gtest_and_gmock.h"
 
@@ -197,6 +199,51 @@ TEST_F(StringPoolTest, BigString) {
   }
 }
 
+TEST_F(StringPoolTest, InsertStringWithId) {
+  // Too big to fit in a block so will be stored in |large_strings_|.
+  std::string large(kBlockSizeBytes, 'x');
+  std::vector<StringPool::Id> ids;
+  ids.push_back(pool_.InternString("foo"));
+  ids.push_back(pool_.InternString(base::StringView(large)));
+  ids.push_back(pool_.InternString("bar"));
+  ASSERT_TRUE(ids[1].is_large_string());
+
+  StringPool copy;
+  auto it = pool_.CreateIterator();
+  for (++it; it; ++it)
+    ASSERT_TRUE(copy.InsertStringWithId(it.StringId(), it.StringView()));
+
+  ASSERT_EQ(copy.size(), pool_.size());
+  for (StringPool::Id id : ids) {
+    ASSERT_EQ(copy.Get(id), pool_.Get(id));
+    ASSERT_EQ(copy.GetId(pool_.Get(id)), id);
+  }
+
+  // Null and already present strings are rejected.
+  ASSERT_FALSE(copy.InsertStringWithId(StringPool::Id::Null(), "baz"));
+  ASSERT_FALSE(copy.InsertStringWithId(ids[0], "foo"));
+}
+
+TEST_F(StringPoolTest, HasId) {
+  std::string large(kBlockSizeBytes, 'x');
+  StringPool::Id foo = pool_.InternString("foo");
+  StringPool::Id large_id = pool_.InternString(base::StringView(large));
+  StringPool::Id bar = pool_.InternString("bar");
+
+  ASSERT_TRUE(pool_.HasId(StringPool::Id::Null()));
+  ASSERT_TRUE(pool_.HasId(foo));
+  ASSERT_TRUE(pool_.HasId(large_id));
+  ASSERT_TRUE(pool_.HasId(bar));
+
+  // Ids pointing inside a string, past the used part of a block, to a block
+  // or large string which doesn't exist.
+  ASSERT_FALSE(pool_.HasId(StringPool::Id::Raw(foo.raw_id() + 1)));
+  ASSERT_FALSE(pool_.HasId(StringPool::Id::Raw(bar.raw_id() + 4)));
+  ASSERT_FALSE(pool_.HasId(StringPool::Id::BlockString(0, 1000)));
+  ASSERT_FALSE(pool_.HasId(StringPool::Id::BlockString(5, 0)));
+  ASSERT_FALSE(pool_.HasId(StringPool::Id::LargeString(1)));
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -16,12 +16,87 @@
 
 #include "src/trace_processor/db/column.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+
 #include "src/trace_processor/db/compare.h"
+#include "src/trace_processor/db/numeric_filter_kernels.h"
+#include "src/trace_processor/db/snapshot_io.h"
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/util/glob.h"
 
 namespace perfetto {
 namespace trace_processor {
+namespace {
+
+// Columns with fewer rows than this are always scanned: scanning them takes a
+// few microseconds so an index (4 bytes per row) would not pay for itself.
+constexpr uint32_t kMinRowsForEqIndex = 4096;
+
+// Default limit on the memory used by the equality indexes of all the columns
+// in the process.
+constexpr size_t kDefaultEqIndexMemoryLimit = 128 * 1024 * 1024;
+
+// The memory currently used by equality indexes and the limit on it. Atomics
+// as several trace processor instances can live on different threads.
+std::atomic<size_t> g_eq_index_bytes{0};
+std::atomic<size_t> g_eq_index_memory_limit{kDefaultEqIndexMemoryLimit};
+
+// Accounts for |bytes| of new index memory. Returns false (without accounting
+// for anything) if this would exceed the limit.
+bool ReserveEqIndexBytes(size_t bytes) {
+  size_t limit = g_eq_index_memory_limit.load(std::memory_order_relaxed);
+  size_t used = g_eq_index_bytes.load(std::memory_order_relaxed);
+  do {
+    if (bytes > limit || used > limit - bytes)
+      return false;
+  } while (!g_eq_index_bytes.compare_exchange_weak(
+      used, used + bytes, std::memory_order_relaxed));
+  return true;
+}
+
+// Number of equality filters which need to be applied to a column without any
+// change to its contents before an index is built. This ensures that columns
+// which are only filtered once or which are interleaved with inserts (e.g.
+// while importing a trace) don't pay the cost of building an index.
+constexpr uint32_t kEqFiltersBeforeIndex = 2;
+
+// The storage of a column read back from a snapshot. |valid| is only used by
+// nullable columns.
+template <typename T>
+struct TypedSnapshotStorage : public Column::SnapshotStorage {
+  std::vector<T> data;
+  BitVector valid;
+};
+
+// Converts |value| to an unsigned integer which compares (as an unsigned
+// integer) in the same order as |value| does with compare::Numeric.
+inline uint64_t ToSortKey(uint32_t value) {
+  return value;
+}
+
+inline uint64_t ToSortKey(int32_t value) {
+  return static_cast<uint32_t>(value) ^ 0x80000000u;
+}
+
+inline uint64_t ToSortKey(int64_t value) {
+  return static_cast<uint64_t>(value) ^ (1ull << 63);
+}
+
+inline uint64_t ToSortKey(double value) {
+  // Normalize -0.0 to 0.0 as the two compare equal. NaNs (which compare equal
+  // to everything in compare::Numeric) are ordered after all other values.
+  if (value == 0)
+    value = 0;
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return (bits & (1ull << 63)) ? ~bits : bits | (1ull << 63);
+}
+
+}  // namespace
 
 Column::Column(const Column& column,
                Table* table,
@@ -100,6 +175,343 @@ void Column::StableSort(bool desc, std::vector<uint32_t>* idx) const {
   }
 }
 
+bool Column::MaterializeSortKeys(bool desc,
+                                 std::vector<uint64_t>* keys) const {
+  switch (type_) {
+    case ColumnType::kInt32:
+      if (IsNullable()) {
+        MaterializeNumericSortKeys<int32_t, true /* is_nullable */>(desc, keys);
+      } else {
+        MaterializeNumericSortKeys<int32_t, false /* is_nullable */>(desc,
+                                                                     keys);
+      }
+      return true;
+    case ColumnType::kUint32:
+      if (IsNullable()) {
+        MaterializeNumericSortKeys<uint32_t, true /* is_nullable */>(desc,
+                                                                     keys);
+      } else {
+        MaterializeNumericSortKeys<uint32_t, false /* is_nullable */>(desc,
+                                                                      keys);
+      }
+      return true;
+    case ColumnType::kInt64:
+      if (IsNullable())
+        return false;
+      MaterializeNumericSortKeys<int64_t, false /* is_nullable */>(desc, keys);
+      return true;
+    case ColumnType::kDouble:
+      if (IsNullable())
+        return false;
+      MaterializeNumericSortKeys<double, false /* is_nullable */>(desc, keys);
+      return true;
+    case ColumnType::kId: {
+      keys->resize(overlay().size());
+      uint64_t mask = desc ? ~0ull : 0ull;
+      for (auto it = overlay().IterateRows(); it; it.Next())
+        (*keys)[it.row()] = it.index() ^ mask;
+      return true;
+    }
+    case ColumnType::kString:
+    case ColumnType::kDummy:
+      return false;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+template <typename T, bool is_nullable>
+void Column::MaterializeNumericSortKeys(bool desc,
+                                        std::vector<uint64_t>* keys) const {
+  PERFETTO_DCHECK(IsNullable() == is_nullable);
+  PERFETTO_DCHECK(ColumnTypeHelper<T>::ToColumnType() == type_);
+
+  keys->resize(overlay().size());
+  uint64_t mask = desc ? ~0ull : 0ull;
+  if (is_nullable) {
+    // Only 32-bit values reach here so we can use the upper bits to order
+    // nulls before all non-null values (matching compare::NullableNumeric).
+    static_assert(sizeof(T) == 4 || !is_nullable,
+                  "Nullable 64-bit keys do not fit in 64 bits");
+    const auto& st = storage<base::Optional<T>>();
+    for (auto it = overlay().IterateRows(); it; it.Next()) {
+      base::Optional<T> value = st.Get(it.index());
+      uint64_t key = value ? (1ull << 32) | ToSortKey(*value) : 0;
+      (*keys)[it.row()] = key ^ mask;
+    }
+  } else if (const CompressedVector<T>* cv = storage<T>().compressed()) {
+    // Codes have the same order as the values they encode so they can be
+    // used as keys directly.
+    for (auto it = overlay().IterateRows(); it; it.Next())
+      (*keys)[it.row()] = cv->GetCode(it.index()) ^ mask;
+  } else {
+    const auto& values = storage<T>().vector();
+    for (auto it = overlay().IterateRows(); it; it.Next())
+      (*keys)[it.row()] = ToSortKey(values[it.index()]) ^ mask;
+  }
+}
+
+bool Column::IsCompressed() const {
+  if (IsNullable() || IsId() || IsDummy())
+    return false;
+  switch (type_) {
+    case ColumnType::kInt32:
+      return storage<int32_t>().compressed() != nullptr;
+    case ColumnType::kUint32:
+      return storage<uint32_t>().compressed() != nullptr;
+    case ColumnType::kInt64:
+      return storage<int64_t>().compressed() != nullptr;
+    case ColumnType::kString:
+      return storage<StringPool::Id>().compressed() != nullptr;
+    case ColumnType::kDouble:
+    case ColumnType::kId:
+    case ColumnType::kDummy:
+      return false;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+Column::EqIndex::EqIndex() = default;
+
+Column::EqIndex::~EqIndex() {
+  g_eq_index_bytes.fetch_sub(reserved_bytes, std::memory_order_relaxed);
+}
+
+// static
+size_t Column::SetIndexMemoryLimitForTesting(size_t bytes) {
+  return g_eq_index_memory_limit.exchange(bytes);
+}
+
+bool Column::HasIndex() const {
+  return eq_index_ && eq_index_->built &&
+         eq_index_->storage_mutation_count == storage_->mutation_count() &&
+         eq_index_->row_count == overlay().size();
+}
+
+bool Column::FilterIntoIndexedEq(SqlValue value, RowMap* rm) const {
+  PERFETTO_DCHECK(!IsId() && !IsDummy());
+  PERFETTO_DCHECK(value.type == type());
+
+  uint32_t row_count = overlay().size();
+  if (row_count < kMinRowsForEqIndex)
+    return false;
+
+  // Any change to the storage or to the rows of the column invalidates the
+  // index (and resets the number of filters seen). The stale index is freed
+  // straight away.
+  uint64_t mutation_count = storage_->mutation_count();
+  if (!eq_index_ || eq_index_->storage_mutation_count != mutation_count ||
+      eq_index_->row_count != row_count) {
+    eq_index_.reset(new EqIndex());
+    eq_index_->storage_mutation_count = mutation_count;
+    eq_index_->row_count = row_count;
+  }
+
+  EqIndex* index = eq_index_.get();
+  if (!index->built) {
+    if (++index->eq_filter_count < kEqFiltersBeforeIndex)
+      return false;
+
+    // When memory is tight, make room by dropping the indexes of the other
+    // columns of this table first: they are the most likely to be stale or to
+    // be superseded by this one. Otherwise, keep scanning.
+    size_t bytes = row_count * sizeof(uint32_t);
+    if (!ReserveEqIndexBytes(bytes)) {
+      for (const Column& col : table_->columns_) {
+        if (&col != this)
+          col.DropIndex();
+      }
+      if (!ReserveEqIndexBytes(bytes))
+        return false;
+    }
+    index->reserved_bytes = bytes;
+    table_->has_eq_indexes_ = true;
+
+    index->sorted_rows.resize(row_count);
+    std::iota(index->sorted_rows.begin(), index->sorted_rows.end(), 0u);
+    StableSort(false /* desc */, &index->sorted_rows);
+    index->built = true;
+  }
+
+  const auto& rows = index->sorted_rows;
+  auto lower = std::lower_bound(rows.begin(), rows.end(), value,
+                                [this](uint32_t row, const SqlValue& val) {
+                                  return compare::SqlValue(Get(row), val) < 0;
+                                });
+  auto upper = std::upper_bound(lower, rows.end(), value,
+                                [this](const SqlValue& val, uint32_t row) {
+                                  return compare::SqlValue(val, Get(row)) < 0;
+                                });
+  rm->IntersectSorted(std::vector<uint32_t>(lower, upper));
+  return true;
+}
+
+bool Column::FilterIntoNumericFast(FilterOp op,
+                                   SqlValue value,
+                                   RowMap* rm) const {
+  PERFETTO_DCHECK(!IsNullable());
+  PERFETTO_DCHECK(value.type == type());
+
+  namespace kernels = numeric_filter_kernels;
+  if (type_ == ColumnType::kInt32) {
+    return FilterIntoCompressed<int32_t>(op, value.AsLong(), rm);
+  } else if (type_ == ColumnType::kUint32) {
+    return FilterIntoCompressed<uint32_t>(op, value.AsLong(), rm);
+  } else if (type_ == ColumnType::kInt64) {
+    int64_t long_value = value.AsLong();
+    if (FilterIntoCompressed<int64_t>(op, long_value, rm))
+      return true;
+
+    switch (op) {
+      case FilterOp::kEq:
+        FilterIntoNumericWords<kernels::Eq>(long_value, rm);
+        return true;
+      case FilterOp::kNe:
+        FilterIntoNumericWords<kernels::Ne>(long_value, rm);
+        return true;
+      case FilterOp::kLt:
+        FilterIntoNumericWords<kernels::Lt>(long_value, rm);
+        return true;
+      case FilterOp::kLe:
+        FilterIntoNumericWords<kernels::Le>(long_value, rm);
+        return true;
+      case FilterOp::kGt:
+        FilterIntoNumericWords<kernels::Gt>(long_value, rm);
+        return true;
+      case FilterOp::kGe:
+        FilterIntoNumericWords<kernels::Ge>(long_value, rm);
+        return true;
+      case FilterOp::kIsNull:
+      case FilterOp::kIsNotNull:
+      case FilterOp::kGlob:
+        return false;
+    }
+  } else if (type_ == ColumnType::kDouble) {
+    double double_value = value.AsDouble();
+    switch (op) {
+      case FilterOp::kEq:
+        FilterIntoNumericWords<kernels::Eq>(double_value, rm);
+        return true;
+      case FilterOp::kNe:
+        FilterIntoNumericWords<kernels::Ne>(double_value, rm);
+        return true;
+      case FilterOp::kLt:
+        FilterIntoNumericWords<kernels::Lt>(double_value, rm);
+        return true;
+      case FilterOp::kLe:
+        FilterIntoNumericWords<kernels::Le>(double_value, rm);
+        return true;
+      case FilterOp::kGt:
+        FilterIntoNumericWords<kernels::Gt>(double_value, rm);
+        return true;
+      case FilterOp::kGe:
+        FilterIntoNumericWords<kernels::Ge>(double_value, rm);
+        return true;
+      case FilterOp::kIsNull:
+      case FilterOp::kIsNotNull:
+      case FilterOp::kGlob:
+        return false;
+    }
+  }
+  return false;
+}
+
+template <typename Op, typename T>
+void Column::FilterIntoNumericWords(T value, RowMap* rm) const {
+  const T* data = storage<T>().vector().data();
+  overlay().FilterIntoWords(rm, [data, value](uint32_t idx, uint32_t count) {
+    return numeric_filter_kernels::CompareWord<Op>(data + idx, count, value);
+  });
+}
+
+template <typename T>
+bool Column::FilterIntoCompressed(FilterOp op,
+                                  int64_t value,
+                                  RowMap* rm) const {
+  const CompressedVector<T>* cv = storage<T>().compressed();
+  if (!cv)
+    return false;
+
+  // As codes have the same order as the values they encode, every constraint
+  // can be converted to a constraint on the codes: |lower| is the number of
+  // codes whose value is < |value| and |upper| is the number of codes whose
+  // value is <= |value|.
+  namespace kernels = numeric_filter_kernels;
+  uint64_t raw = CompressedVectorTraits<int64_t>::ToRaw(value);
+  base::Optional<uint64_t> code = cv->CodeOf(raw);
+  uint64_t lower = cv->LowerBoundCode(raw);
+  uint64_t upper = code ? lower + 1 : lower;
+  switch (op) {
+    case FilterOp::kEq:
+      if (code) {
+        FilterIntoCompressedWords<kernels::Eq>(*cv, *code, rm);
+      } else {
+        rm->Clear();
+      }
+      return true;
+    case FilterOp::kNe:
+      if (code)
+        FilterIntoCompressedWords<kernels::Ne>(*cv, *code, rm);
+      return true;
+    case FilterOp::kLt:
+    case FilterOp::kLe: {
+      uint64_t bound = op == FilterOp::kLt ? lower : upper;
+      if (bound == 0) {
+        rm->Clear();
+      } else if (bound <= cv->max_code()) {
+        FilterIntoCompressedWords<kernels::Lt>(*cv, bound, rm);
+      }
+      return true;
+    }
+    case FilterOp::kGt:
+    case FilterOp::kGe: {
+      uint64_t bound = op == FilterOp::kGe ? lower : upper;
+      if (bound > cv->max_code()) {
+        rm->Clear();
+      } else if (bound > 0) {
+        FilterIntoCompressedWords<kernels::Ge>(*cv, bound, rm);
+      }
+      return true;
+    }
+    case FilterOp::kIsNull:
+    case FilterOp::kIsNotNull:
+    case FilterOp::kGlob:
+      return false;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+template <typename Op, typename T>
+void Column::FilterIntoCompressedWords(const CompressedVector<T>& cv,
+                                       uint64_t code,
+                                       RowMap* rm) const {
+  PERFETTO_DCHECK(code <= cv.max_code());
+  switch (cv.code_width()) {
+    case 8:
+      FilterIntoCodeWords<Op>(cv.template codes<uint8_t>(),
+                              static_cast<uint8_t>(code), rm);
+      break;
+    case 16:
+      FilterIntoCodeWords<Op>(cv.template codes<uint16_t>(),
+                              static_cast<uint16_t>(code), rm);
+      break;
+    case 32:
+      FilterIntoCodeWords<Op>(cv.template codes<uint32_t>(),
+                              static_cast<uint32_t>(code), rm);
+      break;
+    default:
+      PERFETTO_FATAL("Invalid code width");
+  }
+}
+
+template <typename Op, typename Code>
+void Column::FilterIntoCodeWords(const Code* codes,
+                                 Code code,
+                                 RowMap* rm) const {
+  overlay().FilterIntoWords(rm, [codes, code](uint32_t idx, uint32_t count) {
+    return numeric_filter_kernels::CompareWord<Op>(codes + idx, count, code);
+  });
+}
+
 void Column::FilterIntoSlow(FilterOp op, SqlValue value, RowMap* rm) const {
   switch (type_) {
     case ColumnType::kInt32: {
@@ -500,6 +912,149 @@ void Column::StableSortNumeric(std::vector<uint32_t>* out) const {
   });
 }
 
+void Column::SerializeStorage(SnapshotWriter* writer) const {
+  switch (type_) {
+    case ColumnType::kInt32:
+      SerializeTypedStorage<int32_t>(writer);
+      break;
+    case ColumnType::kUint32:
+      SerializeTypedStorage<uint32_t>(writer);
+      break;
+    case ColumnType::kInt64:
+      SerializeTypedStorage<int64_t>(writer);
+      break;
+    case ColumnType::kDouble:
+      SerializeTypedStorage<double>(writer);
+      break;
+    case ColumnType::kString: {
+      const auto& st = storage<StringPool::Id>();
+      if (st.compressed()) {
+        writer->WriteVector(st.compressed()->Decompress());
+      } else {
+        writer->WriteVector(st.vector());
+      }
+      break;
+    }
+    case ColumnType::kId:
+      PERFETTO_FATAL("Id column has no storage to serialize");
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("Dummy column has no storage to serialize");
+  }
+}
+
+Column::SnapshotStorage::~SnapshotStorage() = default;
+
+std::unique_ptr<Column::SnapshotStorage> Column::ReadStorage(
+    SnapshotReader* reader,
+    uint32_t size,
+    const StringPool& strings) const {
+  switch (type_) {
+    case ColumnType::kInt32:
+      return ReadTypedStorage<int32_t>(reader, size);
+    case ColumnType::kUint32:
+      return ReadTypedStorage<uint32_t>(reader, size);
+    case ColumnType::kInt64:
+      return ReadTypedStorage<int64_t>(reader, size);
+    case ColumnType::kDouble:
+      return ReadTypedStorage<double>(reader, size);
+    case ColumnType::kString: {
+      // Nulls are stored inline as the null string id: there is no bitvector
+      // even for nullable string columns.
+      std::unique_ptr<TypedSnapshotStorage<StringPool::Id>> storage(
+          new TypedSnapshotStorage<StringPool::Id>());
+      if (!reader->ReadVector(&storage->data) || storage->data.size() != size)
+        return nullptr;
+      for (StringPool::Id id : storage->data) {
+        if (!strings.HasId(id))
+          return nullptr;
+      }
+      return std::move(storage);
+    }
+    case ColumnType::kId:
+      PERFETTO_FATAL("Id column has no storage to deserialize");
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("Dummy column has no storage to deserialize");
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+void Column::AssignStorage(std::unique_ptr<SnapshotStorage> storage) {
+  switch (type_) {
+    case ColumnType::kInt32:
+      AssignTypedStorage<int32_t>(std::move(storage));
+      return;
+    case ColumnType::kUint32:
+      AssignTypedStorage<uint32_t>(std::move(storage));
+      return;
+    case ColumnType::kInt64:
+      AssignTypedStorage<int64_t>(std::move(storage));
+      return;
+    case ColumnType::kDouble:
+      AssignTypedStorage<double>(std::move(storage));
+      return;
+    case ColumnType::kString: {
+      auto* typed =
+          static_cast<TypedSnapshotStorage<StringPool::Id>*>(storage.get());
+      mutable_storage<StringPool::Id>()->Assign(std::move(typed->data));
+      return;
+    }
+    case ColumnType::kId:
+      PERFETTO_FATAL("Id column has no storage to assign");
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("Dummy column has no storage to assign");
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+template <typename T>
+void Column::SerializeTypedStorage(SnapshotWriter* writer) const {
+  if (IsNullable()) {
+    const auto& nv = storage<base::Optional<T>>().nullable_vector();
+    writer->WriteBitVector(nv.non_null_bit_vector());
+    writer->WriteVector(nv.non_null_vector());
+  } else if (const CompressedVector<T>* cv = storage<T>().compressed()) {
+    writer->WriteVector(cv->Decompress());
+  } else {
+    writer->WriteVector(storage<T>().vector());
+  }
+}
+
+template <typename T>
+std::unique_ptr<Column::SnapshotStorage> Column::ReadTypedStorage(
+    SnapshotReader* reader,
+    uint32_t size) const {
+  std::unique_ptr<TypedSnapshotStorage<T>> storage(
+      new TypedSnapshotStorage<T>());
+  if (IsNullable()) {
+    if (!reader->ReadBitVector(&storage->valid) ||
+        !reader->ReadVector(&storage->data) || storage->valid.size() != size) {
+      return nullptr;
+    }
+    // Dense nullable columns store a value for every row, sparse ones only
+    // for the non-null rows (see NullableVector).
+    uint32_t expected = IsDense() ? size : storage->valid.CountSetBits();
+    if (storage->data.size() != expected)
+      return nullptr;
+    return std::move(storage);
+  }
+  if (!reader->ReadVector(&storage->data) || storage->data.size() != size)
+    return nullptr;
+  return std::move(storage);
+}
+
+template <typename T>
+void Column::AssignTypedStorage(std::unique_ptr<SnapshotStorage> storage) {
+  auto* typed = static_cast<TypedSnapshotStorage<T>*>(storage.get());
+  if (IsNullable()) {
+    bool assigned =
+        mutable_storage<base::Optional<T>>()->mutable_nullable_vector()->Assign(
+            std::move(typed->data), std::move(typed->valid));
+    PERFETTO_CHECK(assigned);
+    return;
+  }
+  mutable_storage<T>()->Assign(std::move(typed->data));
+}
+
 const ColumnStorageOverlay& Column::overlay() const {
   PERFETTO_DCHECK(type_ != ColumnType::kDummy);
   return table_->overlays_[overlay_index()];
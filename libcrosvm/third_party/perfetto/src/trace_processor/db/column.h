@@ -19,9 +19,13 @@
 
 #include <stdint.h>
 
+#include <memory>
+#include <vector>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/compressed_vector.h"
 #include "src/trace_processor/containers/row_map.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/db/column_storage.h"
@@ -102,6 +106,8 @@ struct ColumnTypeHelper<StringPool::Id> {
 template <typename T>
 struct ColumnTypeHelper<base::Optional<T>> : public ColumnTypeHelper<T> {};
 
+class SnapshotReader;
+class SnapshotWriter;
 class Table;
 
 // Represents a named, strongly typed list of data.
@@ -293,6 +299,15 @@ class Column {
   // on the contents of this column.
   void StableSort(bool desc, std::vector<uint32_t>* idx) const;
 
+  // Writes a key for each row of this column into |keys| such that comparing
+  // the keys of two rows as unsigned integers gives the same order as
+  // |StableSort| would (with ties in |StableSort| also being ties in the keys).
+  //
+  // Returns false if this column cannot be represented using 64-bit keys
+  // (i.e. string, dummy and nullable 64-bit columns); |keys| is unchanged in
+  // this case.
+  bool MaterializeSortKeys(bool desc, std::vector<uint64_t>* keys) const;
+
   // Updates the given RowMap by only keeping rows where this column meets the
   // given filter constraint.
   void FilterInto(FilterOp op, SqlValue value, RowMap* rm) const {
@@ -325,9 +340,68 @@ class Column {
         return;
     }
 
+    if (op == FilterOp::kEq && value.type == type() && !IsDummy()) {
+      // If the column is not sorted, equality constraints which are repeatedly
+      // applied can be answered by binary searching an index of the rows
+      // sorted by value instead of doing a full table scan.
+      bool handled = FilterIntoIndexedEq(value, rm);
+      if (handled)
+        return;
+    }
+
+    if (!IsNullable() && value.type == type()) {
+      // If the column is numeric and non-nullable, the values (or their
+      // compressed codes) are stored contiguously so we can compare many values
+      // at once instead of one row at a time.
+      bool handled = FilterIntoNumericFast(op, value, rm);
+      if (handled)
+        return;
+    }
+
     FilterIntoSlow(op, value, rm);
   }
 
+  // Returns whether |FilterInto| with the given constraint can be called
+  // concurrently from multiple threads on RowMaps with disjoint ranges of
+  // rows without doing more work than a single call on the whole range.
+  //
+  // This is only the case for constraints which scan every row: constraints
+  // answered using the sorted order of the column or an index (which is built
+  // lazily) should be applied once on a single thread instead.
+  bool CanFilterConcurrently(FilterOp op, const SqlValue& value) const {
+    if (IsId() && op == FilterOp::kEq)
+      return false;
+    if (IsSetId() && op == FilterOp::kEq && value.type == SqlValue::kLong)
+      return false;
+    if (IsSorted() && value.type == type())
+      return false;
+    if (op == FilterOp::kEq && value.type == type() && !IsDummy())
+      return false;
+
+    // Filtering a chunk of rows through an overlay which is not a range needs
+    // to scan all the indices in the overlay before the chunk.
+    return overlay().IsRange();
+  }
+
+  // Returns true if an up to date index has been built to speed up equality
+  // filters on this column.
+  bool HasIndex() const;
+
+  // Frees the index built for equality filters on this column (if any). It
+  // will be rebuilt if the column keeps being filtered.
+  void DropIndex() const {
+    if (PERFETTO_UNLIKELY(eq_index_))
+      eq_index_.reset();
+  }
+
+  // Sets the maximum number of bytes used by the equality indexes of all the
+  // columns in the process. Returns the previous limit.
+  static size_t SetIndexMemoryLimitForTesting(size_t bytes);
+
+  // Returns true if the storage backing this column is compressed (see
+  // ColumnStorage::ShrinkToFit).
+  bool IsCompressed() const;
+
   // Returns the minimum value in this column. Returns nullopt if this column
   // is empty.
   base::Optional<SqlValue> Min() const {
@@ -356,6 +430,29 @@ class Column {
     return *std::max_element(b, e, &compare::SqlValueComparator);
   }
 
+  // Writes the contents of the storage backing this column to |writer|.
+  // Should not be called on id or dummy columns as they have no storage.
+  void SerializeStorage(SnapshotWriter* writer) const;
+
+  // The contents of the storage of a column read back by ReadStorage().
+  class SnapshotStorage {
+   public:
+    virtual ~SnapshotStorage();
+  };
+
+  // Reads back the data written by SerializeStorage without modifying this
+  // column. String ids are checked against |strings|, which is the pool the
+  // snapshot was restored into (and may not be the pool of this column yet).
+  // Returns nullptr if the data is malformed or doesn't contain exactly |size|
+  // rows.
+  std::unique_ptr<SnapshotStorage> ReadStorage(SnapshotReader* reader,
+                                               uint32_t size,
+                                               const StringPool& strings) const;
+
+  // Replaces the contents of the storage backing this column with |storage|,
+  // which must have been returned by ReadStorage() on this column.
+  void AssignStorage(std::unique_ptr<SnapshotStorage> storage);
+
   // Returns the backing RowMap for this Column.
   // This function is defined out of line because of a circular dependency
   // between |Table| and |Column|.
@@ -615,6 +712,38 @@ class Column {
     rm->Intersect(set_id, ov.size());
   }
 
+  // Filter method for equality constraints which uses (and lazily builds)
+  // |eq_index_|. Returns whether the constraint was handled by the method.
+  bool FilterIntoIndexedEq(SqlValue value, RowMap* rm) const;
+
+  // Filter method for int64 and double non-nullable columns (and integer
+  // columns with compressed storage) which compares a word's worth of rows at
+  // a time. Returns whether the constraint was handled by the method.
+  bool FilterIntoNumericFast(FilterOp op, SqlValue value, RowMap* rm) const;
+
+  // Filters |rm| by comparing every row in the column with |value| using
+  // |Op| from numeric_filter_kernels.h.
+  template <typename Op, typename T>
+  void FilterIntoNumericWords(T value, RowMap* rm) const;
+
+  // Filter method for integer columns with compressed storage which converts
+  // the constraint to a constraint on the compressed codes. Returns whether
+  // the constraint was handled by the method.
+  template <typename T>
+  bool FilterIntoCompressed(FilterOp op, int64_t value, RowMap* rm) const;
+
+  // Filters |rm| by comparing the code of every row in |cv| with |code| using
+  // |Op| from numeric_filter_kernels.h.
+  template <typename Op, typename T>
+  void FilterIntoCompressedWords(const CompressedVector<T>& cv,
+                                 uint64_t code,
+                                 RowMap* rm) const;
+
+  // Filters |rm| by comparing every code in |codes| with |code| using |Op|
+  // from numeric_filter_kernels.h.
+  template <typename Op, typename Code>
+  void FilterIntoCodeWords(const Code* codes, Code code, RowMap* rm) const;
+
   // Slow path filter method which will perform a full table scan.
   void FilterIntoSlow(FilterOp op, SqlValue value, RowMap* rm) const;
 
@@ -639,11 +768,26 @@ class Column {
   template <bool desc>
   void StableSort(std::vector<uint32_t>* out) const;
 
+  // Typed implementation of MaterializeSortKeys. |T| and |is_nullable|
+  // should match the type and nullability of this column.
+  template <typename T, bool is_nullable>
+  void MaterializeNumericSortKeys(bool desc, std::vector<uint64_t>* keys) const;
+
   // Stable sorts this column storing the result in |out|.
   // |T| and |is_nullable| should match the type and nullability of this column.
   template <bool desc, typename T, bool is_nullable>
   void StableSortNumeric(std::vector<uint32_t>* out) const;
 
+  // Typed implementations of SerializeStorage/ReadStorage/AssignStorage.
+  // |T| should match the type of this column.
+  template <typename T>
+  void SerializeTypedStorage(SnapshotWriter* writer) const;
+  template <typename T>
+  std::unique_ptr<SnapshotStorage> ReadTypedStorage(SnapshotReader* reader,
+                                                    uint32_t size) const;
+  template <typename T>
+  void AssignTypedStorage(std::unique_ptr<SnapshotStorage> storage);
+
   static constexpr bool IsDense(uint32_t flags) {
     return (flags & Flag::kDense) != 0;
   }
@@ -709,6 +853,29 @@ class Column {
   uint32_t index_in_table_ = 0;
   uint32_t overlay_index_ = 0;
   const StringPool* string_pool_ = nullptr;
+
+  // Secondary index used by equality filters on columns which are not sorted.
+  // See FilterIntoIndexedEq for when this is built and invalidated. The memory
+  // used by |sorted_rows| is accounted against a process-wide limit.
+  struct EqIndex {
+    EqIndex();
+    ~EqIndex();
+
+    // All the rows of the column stably sorted by value (nulls first); rows
+    // with the same value are therefore in ascending order.
+    std::vector<uint32_t> sorted_rows;
+    bool built = false;
+
+    // State of the column when the index was built (or, if |built| is false,
+    // when the equality filters counted by |eq_filter_count| were applied).
+    uint64_t storage_mutation_count = 0;
+    uint32_t row_count = 0;
+    uint32_t eq_filter_count = 0;
+
+    // The number of bytes accounted for |sorted_rows|.
+    size_t reserved_bytes = 0;
+  };
+  mutable std::unique_ptr<EqIndex> eq_index_;
 };
 
 }  // namespace trace_processor
@@ -17,6 +17,11 @@
 #ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_STORAGE_H_
 #define SRC_TRACE_PROCESSOR_DB_COLUMN_STORAGE_H_
 
+#include <memory>
+#include <type_traits>
+
+#include "perfetto/base/compiler.h"
+#include "src/trace_processor/containers/compressed_vector.h"
 #include "src/trace_processor/containers/nullable_vector.h"
 
 namespace perfetto {
@@ -34,6 +39,17 @@ class ColumnStorageBase {
 
   ColumnStorageBase(ColumnStorageBase&&) = default;
   ColumnStorageBase& operator=(ColumnStorageBase&&) noexcept = default;
+
+  // Returns a counter which is incremented every time the contents of the
+  // storage are changed. This allows data derived from the storage (e.g. the
+  // indexes built by Column) to detect when they are stale.
+  uint64_t mutation_count() const { return mutation_count_; }
+
+ protected:
+  void OnMutation() { ++mutation_count_; }
+
+ private:
+  uint64_t mutation_count_ = 0;
 };
 
 // Class used for implementing storage for non-null columns.
@@ -48,11 +64,52 @@ class ColumnStorage : public ColumnStorageBase {
   ColumnStorage(ColumnStorage&&) = default;
   ColumnStorage& operator=(ColumnStorage&&) noexcept = default;
 
-  T Get(uint32_t idx) const { return vector_[idx]; }
-  void Append(T val) { vector_.emplace_back(val); }
-  void Set(uint32_t idx, T val) { vector_[idx] = val; }
-  uint32_t size() const { return static_cast<uint32_t>(vector_.size()); }
-  void ShrinkToFit() { vector_.shrink_to_fit(); }
+  T Get(uint32_t idx) const {
+    if (PERFETTO_UNLIKELY(compressed_))
+      return compressed_->Get(idx);
+    return vector_[idx];
+  }
+  void Append(T val) {
+    OnMutation();
+    Decompress();
+    vector_.emplace_back(val);
+  }
+  void Set(uint32_t idx, T val) {
+    OnMutation();
+    Decompress();
+    vector_[idx] = val;
+  }
+  uint32_t size() const {
+    return compressed_ ? compressed_->size()
+                       : static_cast<uint32_t>(vector_.size());
+  }
+
+  // Removes unused capacity and, for integer and string columns, tries to
+  // compress the storage (see CompressedVector). This should be called once
+  // the storage is unlikely to change again (e.g. when the trace is fully
+  // loaded) as any later change will decompress the storage.
+  void ShrinkToFit() {
+    MaybeCompress(std::integral_constant<
+                  bool, CompressedVectorTraits<T>::kSupported>());
+    if (!compressed_)
+      vector_.shrink_to_fit();
+  }
+
+  // Returns the compressed representation of this storage or nullptr if this
+  // storage is not compressed.
+  const CompressedVector<T>* compressed() const { return compressed_.get(); }
+
+  // Returns the values in this storage. Should only be called when the
+  // storage is not compressed.
+  const std::vector<T>& vector() const {
+    PERFETTO_DCHECK(!compressed_);
+    return vector_;
+  }
+  void Assign(std::vector<T> vector) {
+    OnMutation();
+    compressed_.reset();
+    vector_ = std::move(vector);
+  }
 
   template <bool IsDense>
   static ColumnStorage<T> Create() {
@@ -61,7 +118,24 @@ class ColumnStorage : public ColumnStorageBase {
   }
 
  private:
+  void MaybeCompress(std::true_type) {
+    if (compressed_)
+      return;
+    compressed_ = CompressedVector<T>::Compress(vector_);
+    if (compressed_)
+      vector_ = std::vector<T>();
+  }
+  void MaybeCompress(std::false_type) {}
+
+  void Decompress() {
+    if (PERFETTO_LIKELY(!compressed_))
+      return;
+    vector_ = compressed_->Decompress();
+    compressed_.reset();
+  }
+
   std::vector<T> vector_;
+  std::unique_ptr<CompressedVector<T>> compressed_;
 };
 
 // Class used for implementing storage for nullable columns.
@@ -77,13 +151,28 @@ class ColumnStorage<base::Optional<T>> : public ColumnStorageBase {
   ColumnStorage& operator=(ColumnStorage&&) noexcept = default;
 
   base::Optional<T> Get(uint32_t idx) const { return nv_.Get(idx); }
-  void Append(T val) { nv_.Append(val); }
-  void Append(base::Optional<T> val) { nv_.Append(val); }
-  void Set(uint32_t idx, T val) { nv_.Set(idx, val); }
+  void Append(T val) {
+    OnMutation();
+    nv_.Append(val);
+  }
+  void Append(base::Optional<T> val) {
+    OnMutation();
+    nv_.Append(val);
+  }
+  void Set(uint32_t idx, T val) {
+    OnMutation();
+    nv_.Set(idx, val);
+  }
   uint32_t size() const { return nv_.size(); }
   bool IsDense() const { return nv_.IsDense(); }
   void ShrinkToFit() { nv_.ShrinkToFit(); }
 
+  const NullableVector<T>& nullable_vector() const { return nv_; }
+  NullableVector<T>* mutable_nullable_vector() {
+    OnMutation();
+    return &nv_;
+  }
+
   template <bool IsDense>
   static ColumnStorage<base::Optional<T>> Create() {
     return IsDense
@@ -109,6 +109,14 @@ class ColumnStorageOverlay {
   // Returns whether this ColumnStorageOverlay is empty.
   bool empty() const { return size() == 0; }
 
+  // Returns whether this ColumnStorageOverlay is a contiguous range of
+  // indices.
+  bool IsRange() const { return row_map_.IsRange(); }
+
+  // Returns the approximate number of bytes of memory used by this
+  // ColumnStorageOverlay.
+  size_t ApproxBytesCost() const { return row_map_.ApproxBytesCost(); }
+
   // Returns the index at the given |row|.
   OutputIndex Get(uint32_t row) const { return row_map_.Get(row); }
 
@@ -203,6 +211,31 @@ class ColumnStorageOverlay {
     }
   }
 
+  // Filters the current ColumnStorageOverlay into |out| in the same way as
+  // |FilterInto| but with |p| evaluated for up to 64 contiguous indices at a
+  // time.
+  //
+  // |p(idx, count)| should return a word where bit i is set if the index
+  // |idx + i| should be retained in |out| for all i < |count|; all other bits
+  // should be zero. This allows |p| to be implemented by comparing many values
+  // at once (e.g. using SIMD) when |this| is a range.
+  template <typename WordPredicate>
+  void FilterIntoWords(RowMap* out, WordPredicate p) const {
+    PERFETTO_DCHECK(size() >= out->size());
+
+    if (row_map_.mode_ != RowMap::Mode::kRange || out->size() <= 1) {
+      // If |this| is not a range, the indices passed to |p| are not contiguous
+      // so just fallback to filtering one index at a time.
+      FilterInto(out, [&p](uint32_t idx) { return p(idx, 1) != 0; });
+      return;
+    }
+
+    uint32_t start = row_map_.start_index_;
+    out->FilterWords([start, &p](uint32_t row, uint32_t count) {
+      return p(start + row, count);
+    });
+  }
+
   template <typename Comparator = bool(uint32_t, uint32_t)>
   void StableSort(std::vector<uint32_t>* out, Comparator c) const {
     return row_map_.StableSort(out, c);
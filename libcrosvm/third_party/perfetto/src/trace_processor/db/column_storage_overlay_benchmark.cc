@@ -17,11 +17,15 @@
 #include <benchmark/benchmark.h>
 
 #include "src/trace_processor/db/column_storage_overlay.h"
+#include "src/trace_processor/db/numeric_filter_kernels.h"
 
 using perfetto::trace_processor::BitVector;
 using perfetto::trace_processor::ColumnStorageOverlay;
 using perfetto::trace_processor::RowMap;
 
+namespace numeric_filter_kernels =
+    perfetto::trace_processor::numeric_filter_kernels;
+
 namespace {
 
 static constexpr uint32_t kPoolSize = 100000;
@@ -61,6 +65,63 @@ BitVector CreateBitVector(uint32_t size) {
   return bv;
 }
 
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+// The sizes of the columns used by the numeric filter benchmarks. The largest
+// size models the counter table of a large trace.
+void NumericFilterArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(1024);
+  } else {
+    b->Arg(1024 * 1024);
+    b->Arg(100 * 1000 * 1000);
+  }
+}
+
+template <typename T>
+std::vector<T> CreateNumericValues(uint32_t size) {
+  static constexpr uint32_t kRandomSeed = 1234;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+  std::vector<T> values(size);
+  for (uint32_t i = 0; i < size; ++i) {
+    values[i] = static_cast<T>(rnd_engine() % 1000);
+  }
+  return values;
+}
+
+// Filters a range overlay over |state.range(0)| values keeping values less
+// than the median either one row at a time (if |words| is false) or using the
+// word at a time kernels.
+template <typename T>
+void BenchFilterIntoNumericLt(benchmark::State& state, bool words) {
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+  std::vector<T> values = CreateNumericValues<T>(size);
+  const T* data = values.data();
+  T value = static_cast<T>(500);
+
+  ColumnStorageOverlay overlay(size);
+  for (auto _ : state) {
+    RowMap out(0, size);
+    if (words) {
+      overlay.FilterIntoWords(&out, [data, value](uint32_t idx,
+                                                  uint32_t count) {
+        return numeric_filter_kernels::CompareWord<numeric_filter_kernels::Lt>(
+            data + idx, count, value);
+      });
+    } else {
+      overlay.FilterInto(&out, [data, value](uint32_t idx) {
+        return data[idx] < value;
+      });
+    }
+    benchmark::DoNotOptimize(out);
+  }
+  state.counters["s/row"] =
+      benchmark::Counter(size, benchmark::Counter::kIsIterationInvariantRate |
+                                   benchmark::Counter::kInvert);
+}
+
 template <typename Factory>
 void BenchFilterInto(benchmark::State& state,
                      ColumnStorageOverlay rm,
@@ -138,3 +199,23 @@ static void BM_CSOFilterIntoIvWithBv(benchmark::State& state) {
   });
 }
 BENCHMARK(BM_CSOFilterIntoIvWithBv);
+
+static void BM_CSOFilterIntoInt64LtByRow(benchmark::State& state) {
+  BenchFilterIntoNumericLt<int64_t>(state, false);
+}
+BENCHMARK(BM_CSOFilterIntoInt64LtByRow)->Apply(NumericFilterArgs);
+
+static void BM_CSOFilterIntoInt64LtByWord(benchmark::State& state) {
+  BenchFilterIntoNumericLt<int64_t>(state, true);
+}
+BENCHMARK(BM_CSOFilterIntoInt64LtByWord)->Apply(NumericFilterArgs);
+
+static void BM_CSOFilterIntoDoubleLtByRow(benchmark::State& state) {
+  BenchFilterIntoNumericLt<double>(state, false);
+}
+BENCHMARK(BM_CSOFilterIntoDoubleLtByRow)->Apply(NumericFilterArgs);
+
+static void BM_CSOFilterIntoDoubleLtByWord(benchmark::State& state) {
+  BenchFilterIntoNumericLt<double>(state, true);
+}
+BENCHMARK(BM_CSOFilterIntoDoubleLtByWord)->Apply(NumericFilterArgs);
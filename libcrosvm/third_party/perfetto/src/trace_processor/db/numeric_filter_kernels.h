@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_NUMERIC_FILTER_KERNELS_H_
+#define SRC_TRACE_PROCESSOR_DB_NUMERIC_FILTER_KERNELS_H_
+
+#include <stdint.h>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+#include <immintrin.h>
+#endif
+
+namespace perfetto {
+namespace trace_processor {
+
+// Kernels which compare a word's worth (i.e. 64) of contiguous numeric values
+// against a single value and return the result as a bitmask. These are used to
+// filter non-nullable numeric columns where the values are stored contiguously
+// in memory.
+//
+// All comparisions match the semantics of compare::Numeric: specifically, if
+// either value is NaN, the values are considered equal.
+namespace numeric_filter_kernels {
+
+struct Eq {
+  template <typename T>
+  static bool Scalar(T a, T b) {
+    return !(a < b) && !(a > b);
+  }
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+  static __m256i Vector(__m256i a, __m256i b) {
+    return _mm256_cmpeq_epi64(a, b);
+  }
+  static __m256d Vector(__m256d a, __m256d b) {
+    return _mm256_cmp_pd(a, b, _CMP_EQ_UQ);
+  }
+#endif
+};
+
+struct Ne {
+  template <typename T>
+  static bool Scalar(T a, T b) {
+    return a < b || a > b;
+  }
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+  static __m256i Vector(__m256i a, __m256i b) {
+    return _mm256_xor_si256(_mm256_cmpeq_epi64(a, b),
+                            _mm256_set1_epi64x(-1));
+  }
+  static __m256d Vector(__m256d a, __m256d b) {
+    return _mm256_cmp_pd(a, b, _CMP_NEQ_OQ);
+  }
+#endif
+};
+
+struct Lt {
+  template <typename T>
+  static bool Scalar(T a, T b) {
+    return a < b;
+  }
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+  static __m256i Vector(__m256i a, __m256i b) {
+    return _mm256_cmpgt_epi64(b, a);
+  }
+  static __m256d Vector(__m256d a, __m256d b) {
+    return _mm256_cmp_pd(a, b, _CMP_LT_OQ);
+  }
+#endif
+};
+
+struct Le {
+  template <typename T>
+  static bool Scalar(T a, T b) {
+    return !(a > b);
+  }
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+  static __m256i Vector(__m256i a, __m256i b) {
+    return _mm256_xor_si256(_mm256_cmpgt_epi64(a, b), _mm256_set1_epi64x(-1));
+  }
+  static __m256d Vector(__m256d a, __m256d b) {
+    return _mm256_cmp_pd(a, b, _CMP_NGT_UQ);
+  }
+#endif
+};
+
+struct Gt {
+  template <typename T>
+  static bool Scalar(T a, T b) {
+    return a > b;
+  }
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+  static __m256i Vector(__m256i a, __m256i b) {
+    return _mm256_cmpgt_epi64(a, b);
+  }
+  static __m256d Vector(__m256d a, __m256d b) {
+    return _mm256_cmp_pd(a, b, _CMP_GT_OQ);
+  }
+#endif
+};
+
+struct Ge {
+  template <typename T>
+  static bool Scalar(T a, T b) {
+    return !(a < b);
+  }
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+  static __m256i Vector(__m256i a, __m256i b) {
+    return _mm256_xor_si256(_mm256_cmpgt_epi64(b, a), _mm256_set1_epi64x(-1));
+  }
+  static __m256d Vector(__m256d a, __m256d b) {
+    return _mm256_cmp_pd(a, b, _CMP_NLT_UQ);
+  }
+#endif
+};
+
+// Compares |count| (<= 64) values starting at |data| with |value| one at a
+// time. This loop is simple enough that compilers are generally able to
+// autovectorize it even without the intrinsics below.
+template <typename Op, typename T>
+uint64_t CompareWordScalar(const T* data, uint32_t count, T value) {
+  PERFETTO_DCHECK(count <= 64);
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    word |= static_cast<uint64_t>(Op::Scalar(data[i], value)) << i;
+  }
+  return word;
+}
+
+// Compares |count| (<= 64) values starting at |data| with |value| and returns
+// a word with bit i set if |Op| is true for |data[i]|. All bits at or above
+// |count| are zero.
+template <typename Op, typename T>
+uint64_t CompareWord(const T* data, uint32_t count, T value) {
+  return CompareWordScalar<Op>(data, count, value);
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+// AVX2 specializations which compare 4 values per instruction. Only used for
+// full words: partial words at the start and end of a range are handled by
+// the scalar implementation.
+template <typename Op>
+uint64_t CompareWord(const int64_t* data, uint32_t count, int64_t value) {
+  if (count != 64)
+    return CompareWordScalar<Op>(data, count, value);
+
+  __m256i v = _mm256_set1_epi64x(value);
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < 64; i += 4) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    auto mask = _mm256_movemask_pd(_mm256_castsi256_pd(Op::Vector(d, v)));
+    word |= static_cast<uint64_t>(mask) << i;
+  }
+  return word;
+}
+
+template <typename Op>
+uint64_t CompareWord(const double* data, uint32_t count, double value) {
+  if (count != 64)
+    return CompareWordScalar<Op>(data, count, value);
+
+  __m256d v = _mm256_set1_pd(value);
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < 64; i += 4) {
+    __m256d d = _mm256_loadu_pd(data + i);
+    auto mask = _mm256_movemask_pd(Op::Vector(d, v));
+    word |= static_cast<uint64_t>(mask) << i;
+  }
+  return word;
+}
+#endif
+
+}  // namespace numeric_filter_kernels
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DB_NUMERIC_FILTER_KERNELS_H_
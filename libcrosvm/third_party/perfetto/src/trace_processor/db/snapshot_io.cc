@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/snapshot_io.h"
+
+#include <errno.h>
+
+#include <algorithm>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "src/trace_processor/containers/bit_vector_iterators.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+constexpr size_t kWriteBufferSize = 1024 * 1024;
+constexpr size_t kArrayAlignment = 8;
+constexpr int kTotalSizeOffset = 16;
+
+// Computed in 64 bits: (size + 7) wraps around for sizes near UINT32_MAX.
+uint64_t BitVectorBytes(uint32_t size) {
+  return (uint64_t{size} + 7) / 8;
+}
+
+}  // namespace
+
+bool IsSnapshot(const uint8_t* data, size_t size) {
+  return size >= kSnapshotMagicSize &&
+         memcmp(data, kSnapshotMagic, kSnapshotMagicSize) == 0;
+}
+
+base::Status ParseSnapshotHeader(const uint8_t* data,
+                                 size_t size,
+                                 uint64_t* total_size) {
+  if (!IsSnapshot(data, size) || size < kSnapshotHeaderSize)
+    return base::ErrStatus("Snapshot header is truncated");
+  uint32_t version = 0;
+  memcpy(&version, data + kSnapshotMagicSize, sizeof(version));
+  if (version != kSnapshotVersion) {
+    return base::ErrStatus(
+        "Snapshot version %u is not supported (expected version %u)", version,
+        kSnapshotVersion);
+  }
+  memcpy(total_size, data + kTotalSizeOffset, sizeof(*total_size));
+  if (*total_size < kSnapshotHeaderSize)
+    return base::ErrStatus("Snapshot header is malformed");
+  return base::OkStatus();
+}
+
+SnapshotWriter::SnapshotWriter(int fd) : fd_(fd) {
+  buf_.reserve(kWriteBufferSize);
+  WriteRaw(kSnapshotMagic, kSnapshotMagicSize);
+  WriteU32(kSnapshotVersion);
+  WriteU32(0);  // Reserved.
+  WriteU64(0);  // Total size, filled in by Finalize().
+  PERFETTO_DCHECK(offset_ == kSnapshotHeaderSize);
+}
+
+SnapshotWriter::~SnapshotWriter() = default;
+
+void SnapshotWriter::WriteString(base::StringView str) {
+  WriteU32(static_cast<uint32_t>(str.size()));
+  WriteRaw(str.data(), str.size());
+}
+
+void SnapshotWriter::WriteBitVector(const BitVector& bv) {
+  std::vector<uint8_t> bytes(static_cast<size_t>(BitVectorBytes(bv.size())));
+  for (auto it = bv.IterateSetBits(); it; it.Next()) {
+    uint32_t idx = it.index();
+    bytes[idx / 8] |= static_cast<uint8_t>(1u << (idx % 8));
+  }
+  WriteU32(bv.size());
+  WriteVector(bytes);
+}
+
+void SnapshotWriter::WriteRaw(const void* data, size_t size) {
+  const uint8_t* ptr = static_cast<const uint8_t*>(data);
+  offset_ += size;
+  while (size > 0) {
+    size_t chunk = std::min(size, kWriteBufferSize - buf_.size());
+    buf_.insert(buf_.end(), ptr, ptr + chunk);
+    ptr += chunk;
+    size -= chunk;
+    if (buf_.size() == kWriteBufferSize)
+      Flush();
+  }
+}
+
+void SnapshotWriter::Align() {
+  static const uint8_t kPadding[kArrayAlignment] = {};
+  size_t misalignment = static_cast<size_t>(offset_ % kArrayAlignment);
+  if (misalignment)
+    WriteRaw(kPadding, kArrayAlignment - misalignment);
+}
+
+void SnapshotWriter::Flush() {
+  if (buf_.empty() || failed_) {
+    buf_.clear();
+    return;
+  }
+  ssize_t res = base::WriteAll(fd_, buf_.data(), buf_.size());
+  failed_ = res != static_cast<ssize_t>(buf_.size());
+  buf_.clear();
+}
+
+base::Status SnapshotWriter::Finalize() {
+  Flush();
+  if (failed_)
+    return base::ErrStatus("Failed to write snapshot (errno: %d)", errno);
+
+  uint64_t total_size = offset_;
+  if (lseek(fd_, kTotalSizeOffset, SEEK_SET) < 0 ||
+      base::WriteAll(fd_, &total_size, sizeof(total_size)) !=
+          static_cast<ssize_t>(sizeof(total_size))) {
+    return base::ErrStatus("Failed to finalize snapshot (errno: %d)", errno);
+  }
+  return base::OkStatus();
+}
+
+SnapshotReader::SnapshotReader(const uint8_t* data, size_t size)
+    : data_(data), size_(size), offset_(std::min(size, kSnapshotHeaderSize)) {}
+
+bool SnapshotReader::ReadString(base::StringView* str) {
+  uint32_t size = 0;
+  if (!ReadU32(&size) || size > size_ - offset_)
+    return false;
+  *str = base::StringView(reinterpret_cast<const char*>(data_ + offset_), size);
+  offset_ += size;
+  return true;
+}
+
+bool SnapshotReader::ReadBitVector(BitVector* bv) {
+  uint32_t size = 0;
+  std::vector<uint8_t> bytes;
+  if (!ReadU32(&size) || BitVectorBytes(size) > size_ - offset_ ||
+      !ReadVector(&bytes) || bytes.size() != BitVectorBytes(size)) {
+    return false;
+  }
+  *bv = BitVector::Range(0, size, [&bytes](uint32_t idx) {
+    return ((bytes[idx / 8] >> (idx % 8)) & 1) != 0;
+  });
+  return true;
+}
+
+bool SnapshotReader::Align() {
+  size_t misalignment = offset_ % kArrayAlignment;
+  if (!misalignment)
+    return true;
+  size_t padding = kArrayAlignment - misalignment;
+  if (padding > size_ - offset_)
+    return false;
+  offset_ += padding;
+  return true;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_SNAPSHOT_IO_H_
+#define SRC_TRACE_PROCESSOR_DB_SNAPSHOT_IO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <type_traits>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/string_view.h"
+#include "src/trace_processor/containers/bit_vector.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// A snapshot is a binary dump of the contents of TraceStorage which can be
+// loaded back without parsing the original trace. It is laid out as follows:
+//
+// [header: magic, version, total size][payload]
+//
+// The payload is a sequence of fields written and read back in the same order
+// by the TraceStorage/table code. Integers are stored in host byte order and
+// arrays are aligned to 8 bytes from the start of the file so that their
+// contents can be used in place when the file is mapped in memory.
+//
+// Snapshots are an optimization and not an interchange format: they can only
+// be loaded by the same version of trace processor which wrote them.
+constexpr char kSnapshotMagic[] = "PFTPSNAP";
+constexpr size_t kSnapshotMagicSize = sizeof(kSnapshotMagic) - 1;
+constexpr uint32_t kSnapshotVersion = 1;
+constexpr size_t kSnapshotHeaderSize = 24;
+
+// Returns true if |data| starts with the snapshot magic.
+bool IsSnapshot(const uint8_t* data, size_t size);
+
+// Parses the snapshot header at the start of |data| and sets |total_size| to
+// the size of the whole snapshot (including the header).
+base::Status ParseSnapshotHeader(const uint8_t* data,
+                                 size_t size,
+                                 uint64_t* total_size);
+
+// Writes a snapshot to a file descriptor.
+class SnapshotWriter {
+ public:
+  // |fd| must be positioned at the start of an empty, seekable file.
+  explicit SnapshotWriter(int fd);
+  ~SnapshotWriter();
+
+  void WriteU32(uint32_t value) { WriteRaw(&value, sizeof(value)); }
+  void WriteU64(uint64_t value) { WriteRaw(&value, sizeof(value)); }
+  void WriteI64(int64_t value) { WriteRaw(&value, sizeof(value)); }
+  void WriteString(base::StringView str);
+  void WriteBitVector(const BitVector& bv);
+
+  template <typename T>
+  void WriteVector(const std::vector<T>& vec) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only trivially copyable types can be written as arrays");
+    WriteU64(vec.size());
+    Align();
+    WriteRaw(vec.data(), vec.size() * sizeof(T));
+  }
+
+  // Flushes any buffered data and fills in the size of the snapshot in the
+  // header. Must be called once after all the fields have been written.
+  base::Status Finalize();
+
+ private:
+  void WriteRaw(const void* data, size_t size);
+  void Align();
+  void Flush();
+
+  int fd_ = -1;
+  std::vector<uint8_t> buf_;
+  uint64_t offset_ = 0;
+  bool failed_ = false;
+};
+
+// Reads back the fields of a snapshot written by SnapshotWriter. All the Read*
+// methods return false if the snapshot is truncated or malformed.
+class SnapshotReader {
+ public:
+  // |data| must point to the start of the snapshot (i.e. the header) and
+  // remain valid for the lifetime of this reader.
+  SnapshotReader(const uint8_t* data, size_t size);
+
+  bool ReadU32(uint32_t* value) { return ReadRaw(value, sizeof(*value)); }
+  bool ReadU64(uint64_t* value) { return ReadRaw(value, sizeof(*value)); }
+  bool ReadI64(int64_t* value) { return ReadRaw(value, sizeof(*value)); }
+
+  // The returned view points inside the snapshot data.
+  bool ReadString(base::StringView* str);
+  bool ReadBitVector(BitVector* bv);
+
+  template <typename T>
+  bool ReadVector(std::vector<T>* vec) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only trivially copyable types can be read as arrays");
+    uint64_t count = 0;
+    if (!ReadU64(&count) || !Align() || count > (size_ - offset_) / sizeof(T))
+      return false;
+    vec->resize(static_cast<size_t>(count));
+    return ReadRaw(vec->data(), vec->size() * sizeof(T));
+  }
+
+  // Returns true if all the data in the snapshot has been read.
+  bool AtEnd() const { return offset_ == size_; }
+
+ private:
+  bool ReadRaw(void* data, size_t size) {
+    if (size > size_ - offset_)
+      return false;
+    if (size > 0)
+      memcpy(data, data_ + offset_, size);
+    offset_ += size;
+    return true;
+  }
+  bool Align();
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DB_SNAPSHOT_IO_H_
@@ -16,8 +16,138 @@
 
 #include "src/trace_processor/db/table.h"
 
+#include <algorithm>
+#include <array>
+#include <numeric>
+
+#include "perfetto/ext/base/thread_pool.h"
+
 namespace perfetto {
 namespace trace_processor {
+namespace {
+
+// The maximum number of order by columns (excluding already sorted leading and
+// trailing columns) which will be sorted using materialized keys. Each key
+// costs 8 bytes per row so past this, the memory cost outweighs the benefit.
+constexpr size_t kMaxSortKeys = 3;
+
+template <size_t N>
+struct SortEntry {
+  std::array<uint64_t, N> keys;
+  uint32_t row;
+
+  // Rows are used as a tie breaker to make the sort stable.
+  bool operator<(const SortEntry& other) const {
+    for (size_t i = 0; i < N; ++i) {
+      if (keys[i] != other.keys[i])
+        return keys[i] < other.keys[i];
+    }
+    return row < other.row;
+  }
+};
+
+// The minimum number of rows in each chunk when filtering in parallel.
+constexpr uint32_t kMinRowsPerParallelChunk = 16 * 1024;
+
+// The number of chunks per thread when filtering in parallel. Having a few
+// chunks per thread balances the load when constraints are cheaper to evaluate
+// on some rows than on others.
+constexpr uint32_t kParallelChunksPerThread = 4;
+
+// Tables with fewer rows than this are sorted with std::sort as the fixed cost
+// of the radix sort (histograms, temporary buffer) does not pay for itself.
+constexpr uint32_t kMinRowsForRadixSort = 1024;
+
+// Stable LSD radix sort of |entries| by their keys, one byte at a time. Bytes
+// which are the same in every entry (e.g. the upper bytes of small values)
+// are skipped so, in practice, only a handful of passes are needed.
+template <size_t N>
+void RadixSort(std::vector<SortEntry<N>>* entries) {
+  constexpr size_t kBytes = N * sizeof(uint64_t);
+  uint32_t size = static_cast<uint32_t>(entries->size());
+
+  // counts[k * 8 + b] is the histogram of byte b of key k.
+  std::vector<std::array<uint32_t, 256>> counts(kBytes);
+  for (auto& histogram : counts)
+    histogram.fill(0);
+  for (const SortEntry<N>& entry : *entries) {
+    for (size_t k = 0; k < N; ++k) {
+      for (size_t b = 0; b < sizeof(uint64_t); ++b) {
+        counts[k * 8 + b][(entry.keys[k] >> (b * 8)) & 0xff]++;
+      }
+    }
+  }
+
+  std::vector<SortEntry<N>> tmp(size);
+  std::vector<SortEntry<N>>* src = entries;
+  std::vector<SortEntry<N>>* dst = &tmp;
+  for (size_t k = N; k-- > 0;) {
+    for (size_t b = 0; b < sizeof(uint64_t); ++b) {
+      std::array<uint32_t, 256>& histogram = counts[k * 8 + b];
+      uint8_t first_byte = (src->front().keys[k] >> (b * 8)) & 0xff;
+      if (histogram[first_byte] == size)
+        continue;
+
+      uint32_t offset = 0;
+      for (uint32_t& count : histogram) {
+        uint32_t c = count;
+        count = offset;
+        offset += c;
+      }
+      for (const SortEntry<N>& entry : *src) {
+        (*dst)[histogram[(entry.keys[k] >> (b * 8)) & 0xff]++] = entry;
+      }
+      std::swap(src, dst);
+    }
+  }
+  if (src != entries)
+    entries->swap(*src);
+}
+
+// Sorts the rows by the lexiographical order of |keys| (one vector of keys per
+// order by) and writes the result to |idx|.
+//
+// If |runs| is non-null, the rows are already sorted by |runs| so we only need
+// to sort runs of rows with an equal value in |runs|.
+template <size_t N>
+void SortByKeys(const std::vector<std::vector<uint64_t>>& keys,
+                const std::vector<uint64_t>* runs,
+                std::vector<uint32_t>* idx) {
+  PERFETTO_DCHECK(keys.size() == N);
+
+  uint32_t size = static_cast<uint32_t>(idx->size());
+  std::vector<SortEntry<N>> entries(size);
+  for (uint32_t i = 0; i < size; ++i) {
+    entries[i].row = i;
+  }
+  for (size_t k = 0; k < N; ++k) {
+    const std::vector<uint64_t>& col_keys = keys[k];
+    for (uint32_t i = 0; i < size; ++i) {
+      entries[i].keys[k] = col_keys[i];
+    }
+  }
+
+  if (runs) {
+    for (uint32_t start = 0; start < size;) {
+      uint32_t end = start + 1;
+      while (end < size && (*runs)[end] == (*runs)[start])
+        end++;
+      if (end - start > 1)
+        std::sort(entries.begin() + start, entries.begin() + end);
+      start = end;
+    }
+  } else if (size >= kMinRowsForRadixSort) {
+    RadixSort(&entries);
+  } else {
+    std::sort(entries.begin(), entries.end());
+  }
+
+  for (uint32_t i = 0; i < size; ++i) {
+    (*idx)[i] = entries[i].row;
+  }
+}
+
+}  // namespace
 
 Table::Table() = default;
 Table::~Table() = default;
@@ -27,6 +157,7 @@ Table::Table(StringPool* pool) : string_pool_(pool) {}
 Table& Table::operator=(Table&& other) noexcept {
   row_count_ = other.row_count_;
   string_pool_ = other.string_pool_;
+  has_eq_indexes_ = other.has_eq_indexes_;
 
   overlays_ = std::move(other.overlays_);
   columns_ = std::move(other.columns_);
@@ -54,6 +185,80 @@ Table Table::CopyExceptOverlays() const {
   return table;
 }
 
+RowMap Table::FilterToRowMapParallel(const std::vector<Constraint>& cs,
+                                     RowMap::OptimizeFor optimize_for,
+                                     base::ThreadPool* thread_pool) const {
+  RowMap rm(0, row_count_, optimize_for);
+  std::vector<const Constraint*> scans;
+  for (const Constraint& c : cs) {
+    const Column& col = columns_[c.col_idx];
+    if (col.CanFilterConcurrently(c.op, c.value)) {
+      scans.push_back(&c);
+    } else {
+      col.FilterInto(c.op, c.value, &rm);
+    }
+  }
+
+  // Only ranges can be cheaply split into chunks. In practice, this is almost
+  // always the case as the constraints above narrow the table to a range.
+  if (scans.empty() || !rm.IsRange() || rm.size() < kMinRowsForParallelFilter ||
+      thread_pool->num_threads() == 0) {
+    for (const Constraint* c : scans) {
+      columns_[c->col_idx].FilterInto(c->op, c->value, &rm);
+    }
+    return rm;
+  }
+
+  uint32_t start = rm.Get(0);
+  uint32_t end = start + rm.size();
+
+  // Chunks are aligned to words so every chunk writes to a disjoint set of
+  // words in |words|.
+  uint32_t max_chunks =
+      (thread_pool->num_threads() + 1) * kParallelChunksPerThread;
+  uint32_t chunk_size = std::max(kMinRowsPerParallelChunk,
+                                 (rm.size() + max_chunks - 1) / max_chunks);
+  chunk_size = (chunk_size + 63) / 64 * 64;
+
+  uint32_t first_word = start / 64;
+  uint32_t chunk_base = first_word * 64;
+  uint32_t chunk_count = (end - chunk_base + chunk_size - 1) / chunk_size;
+  std::vector<uint64_t> words((end + 63) / 64 - first_word);
+  thread_pool->RunParallel(chunk_count, [&](size_t i) {
+    uint32_t chunk_idx = static_cast<uint32_t>(i);
+    uint32_t chunk_start = std::max(start, chunk_base + chunk_idx * chunk_size);
+    uint32_t chunk_end =
+        std::min(end, chunk_base + (chunk_idx + 1) * chunk_size);
+
+    // Optimizing for lookup speed makes the RowMap use an index vector rather
+    // than a BitVector spanning all the rows before the chunk.
+    RowMap chunk(chunk_start, chunk_end, RowMap::OptimizeFor::kLookupSpeed);
+    for (const Constraint* c : scans) {
+      columns_[c->col_idx].FilterInto(c->op, c->value, &chunk);
+    }
+    for (auto it = chunk.IterateRows(); it; it.Next()) {
+      uint32_t row = it.index();
+      words[row / 64 - first_word] |= 1ull << (row % 64);
+    }
+  });
+
+  // No bits are set outside of [start, end) so the words can be copied into
+  // the BitVector as is.
+  BitVector bv = BitVector::RangeWords(
+      start, end, [&words, first_word](uint32_t idx, uint32_t) {
+        return words[idx / 64 - first_word] >> (idx % 64);
+      });
+  if (optimize_for == RowMap::OptimizeFor::kMemory)
+    return RowMap(std::move(bv));
+
+  std::vector<uint32_t> rows;
+  rows.reserve(bv.CountSetBits());
+  for (auto it = bv.IterateSetBits(); it; it.Next()) {
+    rows.push_back(it.index());
+  }
+  return RowMap(std::move(rows));
+}
+
 Table Table::Sort(const std::vector<Order>& od) const {
   if (od.empty())
     return Copy();
@@ -74,9 +279,10 @@ Table Table::Sort(const std::vector<Order>& od) const {
     // to reverse the order of this column.
     PERFETTO_DCHECK(od.front().desc);
     std::iota(idx.rbegin(), idx.rend(), 0);
-  } else {
-    // As our data is columnar, it's always more efficient to sort one column
-    // at a time rather than try and sort lexiographically all at once.
+  } else if (!SortUsingKeys(od, &idx)) {
+    // If we can't convert the columns to keys (e.g. for string columns), it's
+    // more efficient to sort one column at a time rather than try and sort
+    // lexiographically all at once as our data is columnar.
     // To preserve correctness, we need to stably sort the index vector once
     // for each order by in *reverse* order. Reverse order is important as it
     // preserves the lexiographical property.
@@ -135,5 +341,58 @@ Table Table::Sort(const std::vector<Order>& od) const {
   return table;
 }
 
+bool Table::SortUsingKeys(const std::vector<Order>& od,
+                          std::vector<uint32_t>* idx) const {
+  auto is_sorted_asc = [this](const Order& o) {
+    return !o.desc && columns_[o.col_idx].IsSorted();
+  };
+
+  // If the first column is already sorted in ascending order (e.g. ts), the
+  // rows are already in order for that column: we only need to sort the runs
+  // of rows with the same value by the remaining columns.
+  bool leading_sorted = is_sorted_asc(od.front());
+  size_t first_key = leading_sorted ? 1 : 0;
+
+  // Similarly, trailing columns which are sorted in ascending order (e.g.
+  // "track_id, ts") don't need keys as ties are broken by the row order which
+  // already matches the order of these columns.
+  size_t last_key = od.size();
+  while (last_key > first_key && is_sorted_asc(od[last_key - 1]))
+    last_key--;
+
+  if (last_key - first_key > kMaxSortKeys)
+    return false;
+
+  std::vector<uint64_t> runs;
+  if (leading_sorted && last_key > first_key &&
+      !columns_[od.front().col_idx].MaterializeSortKeys(false, &runs)) {
+    return false;
+  }
+
+  std::vector<std::vector<uint64_t>> keys(last_key - first_key);
+  for (size_t i = first_key; i < last_key; ++i) {
+    const Column& col = columns_[od[i].col_idx];
+    if (!col.MaterializeSortKeys(od[i].desc, &keys[i - first_key]))
+      return false;
+  }
+
+  const std::vector<uint64_t>* runs_ptr = leading_sorted ? &runs : nullptr;
+  switch (keys.size()) {
+    case 0:
+      std::iota(idx->begin(), idx->end(), 0);
+      return true;
+    case 1:
+      SortByKeys<1>(keys, runs_ptr, idx);
+      return true;
+    case 2:
+      SortByKeys<2>(keys, runs_ptr, idx);
+      return true;
+    case 3:
+      SortByKeys<3>(keys, runs_ptr, idx);
+      return true;
+  }
+  PERFETTO_FATAL("Unexpected number of sort keys");
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
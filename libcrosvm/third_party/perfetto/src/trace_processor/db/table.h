@@ -31,6 +31,11 @@
 #include "src/trace_processor/db/typed_column.h"
 
 namespace perfetto {
+
+namespace base {
+class ThreadPool;
+}  // namespace base
+
 namespace trace_processor {
 
 // Represents a table of data with named, strongly typed columns.
@@ -112,9 +117,16 @@ class Table {
   // specifying what the returned RowMap should optimize for.
   // Returns a RowMap which, if applied to the table, would contain the rows
   // post filter.
+  //
+  // If |thread_pool| is non-null, filtering large tables is spread across the
+  // threads of the pool (see |FilterToRowMapParallel|).
   RowMap FilterToRowMap(
       const std::vector<Constraint>& cs,
-      RowMap::OptimizeFor optimize_for = RowMap::OptimizeFor::kMemory) const {
+      RowMap::OptimizeFor optimize_for = RowMap::OptimizeFor::kMemory,
+      base::ThreadPool* thread_pool = nullptr) const {
+    if (thread_pool && row_count_ >= kMinRowsForParallelFilter)
+      return FilterToRowMapParallel(cs, optimize_for, thread_pool);
+
     RowMap rm(0, row_count_, optimize_for);
     for (const Constraint& c : cs) {
       columns_[c.col_idx].FilterInto(c.op, c.value, &rm);
@@ -201,6 +213,18 @@ class Table {
 
   uint32_t row_count() const { return row_count_; }
   StringPool* string_pool() const { return string_pool_; }
+
+  // Returns the approximate number of bytes of memory used by this table.
+  // This does not include the storage of the columns as this is shared with
+  // any tables created from this table using Filter/Sort etc.
+  size_t ApproxBytesCost() const {
+    size_t bytes = sizeof(Table) + columns_.size() * sizeof(Column);
+    for (const ColumnStorageOverlay& overlay : overlays_) {
+      bytes += overlay.ApproxBytesCost();
+    }
+    return bytes;
+  }
+
   const std::vector<ColumnStorageOverlay>& overlays() const {
     return overlays_;
   }
@@ -217,6 +241,17 @@ class Table {
     return rm;
   }
 
+  // Frees the equality indexes built by the columns of this table (see
+  // Column::DropIndex). Should be called when rows are added to the table as
+  // this makes all of them stale.
+  void DropIndexes() {
+    if (PERFETTO_LIKELY(!has_eq_indexes_))
+      return;
+    for (const Column& col : columns_)
+      col.DropIndex();
+    has_eq_indexes_ = false;
+  }
+
   std::vector<ColumnStorageOverlay> overlays_;
   std::vector<Column> columns_;
   uint32_t row_count_ = 0;
@@ -225,9 +260,33 @@ class Table {
 
  private:
   friend class Column;
+
+  // Whether any column of this table may have built an equality index.
+  mutable bool has_eq_indexes_ = false;
+
   friend class View;
 
+  // Tables with fewer rows than this are always filtered on the calling
+  // thread as the cost of coordinating the threads would outweigh the gains.
+  static constexpr uint32_t kMinRowsForParallelFilter = 64 * 1024;
+
   Table CopyExceptOverlays() const;
+
+  // Implementation of |FilterToRowMap| using |thread_pool|. Constraints which
+  // can be applied without scanning every row (e.g. on sorted or id columns)
+  // are applied first on the calling thread; the remaining rows are then
+  // split into chunks which are filtered concurrently by the other
+  // constraints and the results concatenated.
+  RowMap FilterToRowMapParallel(const std::vector<Constraint>& cs,
+                                RowMap::OptimizeFor optimize_for,
+                                base::ThreadPool* thread_pool) const;
+
+  // Fast path for |Sort| which converts the value of each order by column
+  // into integer keys and sorts all the rows in a single pass, skipping
+  // leading and trailing columns which are already sorted. Returns false
+  // (leaving |idx| unchanged) if any of the columns cannot be converted.
+  bool SortUsingKeys(const std::vector<Order>& od,
+                     std::vector<uint32_t>* idx) const;
 };
 
 }  // namespace trace_processor
@@ -15,7 +15,13 @@
  */
 
 #include "src/trace_processor/db/table.h"
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
 #include "perfetto/ext/base/optional.h"
+#include "perfetto/ext/base/thread_pool.h"
 #include "src/trace_processor/db/typed_column.h"
 #include "src/trace_processor/tables/macros.h"
 
@@ -35,6 +41,50 @@ PERFETTO_TP_TABLE(PERFETTO_TP_TEST_EVENT_TABLE_DEF);
 
 TestEventTable::~TestEventTable() = default;
 
+#define PERFETTO_TP_TEST_INDEXED_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestIndexedTable, "indexed")                         \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)              \
+  C(int64_t, value)                                         \
+  C(base::Optional<int64_t>, opt_value)                     \
+  C(StringPool::Id, name)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_INDEXED_TABLE_DEF);
+
+TestIndexedTable::~TestIndexedTable() = default;
+
+#define PERFETTO_TP_TEST_COUNTER_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestCounterTable, "counter")                         \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)              \
+  C(int64_t, ts)                                            \
+  C(double, value)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_COUNTER_TABLE_DEF);
+
+TestCounterTable::~TestCounterTable() = default;
+
+#define PERFETTO_TP_TEST_SORT_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestSortTable, "sort")                            \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)           \
+  C(int64_t, ts, Column::Flag::kSorted)                  \
+  C(int64_t, dur)                                        \
+  C(int32_t, depth)                                      \
+  C(base::Optional<uint32_t>, track_id)                  \
+  C(double, value)                                       \
+  C(StringPool::Id, name)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_SORT_TABLE_DEF);
+
+TestSortTable::~TestSortTable() = default;
+
+#define PERFETTO_TP_TEST_COMPRESSED_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestCompressedTable, "compressed")                      \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)                 \
+  C(int64_t, ts)                                               \
+  C(uint32_t, cpu)                                             \
+  C(int32_t, depth)                                            \
+  C(int64_t, sparse)                                           \
+  C(StringPool::Id, name)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_COMPRESSED_TABLE_DEF);
+
+TestCompressedTable::~TestCompressedTable() = default;
+
 TEST(TableTest, SetIdColumns) {
   StringPool pool;
   TestEventTable table{&pool, nullptr};
@@ -126,6 +176,374 @@ TEST(TableTest, SetIdColumns) {
   }
 }
 
+TEST(TableTest, EqIndex) {
+  static constexpr uint32_t kRowCount = 4096;
+  static const char* const kNames[] = {"a", "b", "c", "d", "e"};
+
+  StringPool pool;
+  TestIndexedTable table{&pool, nullptr};
+  for (uint32_t i = 0; i < kRowCount; ++i) {
+    TestIndexedTable::Row row;
+    row.value = (i * 7919) % 64;
+    row.opt_value = i % 3 == 0 ? base::nullopt
+                               : base::make_optional<int64_t>(i % 16);
+    row.name = pool.InternString(kNames[i % 5]);
+    table.Insert(row);
+  }
+
+  // Returns the rows of |table| where |col| is equal to |value|, checking that
+  // they are returned in ascending order.
+  auto filter = [&table](const Column& col, Constraint c) {
+    Table res = table.Filter({c});
+    std::vector<uint32_t> rows;
+    for (auto it = res.IterateRows(); it; it.Next()) {
+      SqlValue row = it.Get(static_cast<uint32_t>(
+          TestIndexedTable::ColumnIndex::id));
+      rows.push_back(static_cast<uint32_t>(row.AsLong()));
+    }
+    EXPECT_TRUE(std::is_sorted(rows.begin(), rows.end()));
+    for (uint32_t row : rows)
+      EXPECT_EQ(compare::SqlValue(col.Get(row), c.value), 0);
+    return rows;
+  };
+
+  // The first filter is a scan; the index is only built on the second one.
+  const Column& value = table.value();
+  std::vector<uint32_t> scanned = filter(value, table.value().eq(5));
+  ASSERT_FALSE(value.HasIndex());
+  ASSERT_EQ(filter(value, table.value().eq(5)), scanned);
+  ASSERT_TRUE(value.HasIndex());
+  ASSERT_EQ(scanned.size(), kRowCount / 64);
+  ASSERT_TRUE(filter(value, table.value().eq(1000)).empty());
+
+  const Column& opt_value = table.opt_value();
+  scanned = filter(opt_value, table.opt_value().eq(3));
+  ASSERT_EQ(filter(opt_value, table.opt_value().eq(3)), scanned);
+  ASSERT_TRUE(opt_value.HasIndex());
+  ASSERT_EQ(scanned.size(), 170u);
+
+  const Column& name = table.name();
+  scanned = filter(name, table.name().eq("c"));
+  ASSERT_EQ(filter(name, table.name().eq("c")), scanned);
+  ASSERT_TRUE(name.HasIndex());
+  ASSERT_EQ(scanned.size(), kRowCount / 5);
+  ASSERT_TRUE(filter(name, table.name().eq("z")).empty());
+
+  // Adding a row should invalidate the index.
+  TestIndexedTable::Row row;
+  row.value = 5;
+  table.Insert(row);
+  ASSERT_FALSE(value.HasIndex());
+  ASSERT_EQ(filter(value, table.value().eq(5)).back(), kRowCount);
+  ASSERT_EQ(filter(value, table.value().eq(5)).size(), kRowCount / 64 + 1);
+  ASSERT_TRUE(value.HasIndex());
+
+  // Changing a value should also invalidate the index.
+  table.mutable_value()->Set(0, 5);
+  ASSERT_FALSE(value.HasIndex());
+  ASSERT_EQ(filter(value, table.value().eq(5)).front(), 0u);
+  ASSERT_EQ(filter(value, table.value().eq(5)).front(), 0u);
+  ASSERT_TRUE(value.HasIndex());
+}
+
+TEST(TableTest, EqIndexSmallTable) {
+  StringPool pool;
+  TestIndexedTable table{&pool, nullptr};
+  for (uint32_t i = 0; i < 16; ++i) {
+    TestIndexedTable::Row row;
+    row.value = i % 4;
+    table.Insert(row);
+  }
+  for (uint32_t i = 0; i < 4; ++i)
+    ASSERT_EQ(table.Filter({table.value().eq(1)}).row_count(), 4u);
+  ASSERT_FALSE(table.value().HasIndex());
+}
+
+TEST(TableTest, EqIndexMemoryLimit) {
+  static constexpr uint32_t kRowCount = 4096;
+  static constexpr size_t kIndexBytes = kRowCount * sizeof(uint32_t);
+
+  StringPool pool;
+  TestIndexedTable table{&pool, nullptr};
+  for (uint32_t i = 0; i < kRowCount; ++i) {
+    TestIndexedTable::Row row;
+    row.value = i % 64;
+    row.opt_value = i % 16;
+    table.Insert(row);
+  }
+  auto filter_twice = [&table](Constraint c) {
+    uint32_t rows = table.Filter({c}).row_count();
+    EXPECT_EQ(table.Filter({c}).row_count(), rows);
+    return rows;
+  };
+
+  // Only one index fits: building the second one drops the first.
+  size_t old_limit =
+      Column::SetIndexMemoryLimitForTesting(kIndexBytes + kIndexBytes / 2);
+  ASSERT_EQ(filter_twice(table.value().eq(3)), kRowCount / 64);
+  ASSERT_TRUE(table.value().HasIndex());
+  ASSERT_EQ(filter_twice(table.opt_value().eq(3)), kRowCount / 16);
+  ASSERT_TRUE(table.opt_value().HasIndex());
+  ASSERT_FALSE(table.value().HasIndex());
+
+  // Inserting a row frees all the indexes of the table.
+  table.Insert(TestIndexedTable::Row());
+  ASSERT_FALSE(table.opt_value().HasIndex());
+
+  // Without room for any index, columns are scanned.
+  Column::SetIndexMemoryLimitForTesting(kIndexBytes / 2);
+  ASSERT_EQ(filter_twice(table.value().eq(3)), kRowCount / 64);
+  ASSERT_FALSE(table.value().HasIndex());
+
+  Column::SetIndexMemoryLimitForTesting(old_limit);
+}
+
+TEST(TableTest, NumericFilter) {
+  static constexpr uint32_t kRowCount = 5000;
+
+  StringPool pool;
+  TestCounterTable table{&pool, nullptr};
+  for (uint32_t i = 0; i < kRowCount; ++i) {
+    TestCounterTable::Row row;
+    row.ts = static_cast<int64_t>((i * 7919) % 1000) - 500;
+    row.value = static_cast<double>((i * 104729) % 1000) / 4;
+    table.Insert(row);
+  }
+
+  // Checks that filtering |col| (directly and after another constraint)
+  // returns the same rows as comparing each row with |value|.
+  auto check = [&table](const Column& col, SqlValue value) {
+    const FilterOp kOps[] = {FilterOp::kEq, FilterOp::kNe, FilterOp::kLt,
+                             FilterOp::kLe, FilterOp::kGt, FilterOp::kGe};
+    for (FilterOp op : kOps) {
+      auto matches = [&col, op, value](uint32_t row) {
+        int cmp = compare::SqlValue(col.Get(row), value);
+        switch (op) {
+          case FilterOp::kEq:
+            return cmp == 0;
+          case FilterOp::kNe:
+            return cmp != 0;
+          case FilterOp::kLt:
+            return cmp < 0;
+          case FilterOp::kLe:
+            return cmp <= 0;
+          case FilterOp::kGt:
+            return cmp > 0;
+          case FilterOp::kGe:
+            return cmp >= 0;
+          case FilterOp::kIsNull:
+          case FilterOp::kIsNotNull:
+          case FilterOp::kGlob:
+            break;
+        }
+        PERFETTO_FATAL("Unexpected op");
+      };
+
+      Constraint c{col.index_in_table(), op, value};
+      RowMap rm = table.FilterToRowMap({c});
+      uint32_t expected = 0;
+      for (uint32_t i = 0; i < kRowCount; ++i) {
+        expected += matches(i);
+        ASSERT_EQ(rm.Contains(i), matches(i));
+      }
+      ASSERT_EQ(rm.size(), expected);
+
+      // Filter after another constraint has already removed some rows.
+      Constraint first = table.ts().gt(0);
+      rm = table.FilterToRowMap({first, c});
+      for (uint32_t i = 0; i < kRowCount; ++i) {
+        bool first_matches = table.ts()[i] > 0;
+        ASSERT_EQ(rm.Contains(i), first_matches && matches(i));
+      }
+    }
+  };
+  check(table.ts(), SqlValue::Long(-250));
+  check(table.ts(), SqlValue::Long(0));
+  check(table.ts(), SqlValue::Long(1000));
+  check(table.value(), SqlValue::Double(50.25));
+  check(table.value(), SqlValue::Double(100));
+  check(table.value(), SqlValue::Double(-1));
+}
+
+TEST(TableTest, MultiColumnSort) {
+  static constexpr uint32_t kRowCount = 2000;
+
+  StringPool pool;
+  TestSortTable table{&pool, nullptr};
+  const StringPool::Id names[] = {pool.InternString("foo"),
+                                  pool.InternString("bar"),
+                                  pool.InternString("baz")};
+  const double values[] = {-1.5, -0.0, 0.0, 2.5, 1e10};
+  for (uint32_t i = 0; i < kRowCount; ++i) {
+    TestSortTable::Row row;
+    row.ts = i / 7;
+    row.dur = static_cast<int64_t>((i * 7919) % 13) - 6;
+    row.depth = static_cast<int32_t>((i * 104729) % 5) - 2;
+    if (i % 3 != 0)
+      row.track_id = (i * 31) % 4;
+    row.value = values[(i * 17) % 5];
+    row.name = names[(i * 13) % 3];
+    table.Insert(row);
+  }
+
+  // Checks that sorting by |od| gives the same order as stably sorting the
+  // rows by comparing the values of each column in turn.
+  auto check = [&table](const std::vector<Order>& od) {
+    std::vector<uint32_t> expected(kRowCount);
+    std::iota(expected.begin(), expected.end(), 0);
+    std::stable_sort(expected.begin(), expected.end(),
+                     [&table, &od](uint32_t a, uint32_t b) {
+                       for (const Order& o : od) {
+                         const Column& col = table.GetColumn(o.col_idx);
+                         int res = compare::SqlValue(col.Get(a), col.Get(b));
+                         if (res != 0)
+                           return o.desc ? res > 0 : res < 0;
+                       }
+                       return false;
+                     });
+
+    Table sorted = table.Sort(od);
+    ASSERT_EQ(sorted.row_count(), kRowCount);
+    for (uint32_t i = 0; i < kRowCount; ++i) {
+      ASSERT_EQ(sorted.GetColumn(0).Get(i).AsLong(), expected[i]);
+    }
+  };
+
+  check({table.ts().ascending(), table.dur().descending()});
+  check({table.track_id().ascending(), table.ts().ascending()});
+  check({table.track_id().descending(), table.depth().ascending(),
+         table.value().descending()});
+  check({table.value().ascending(), table.depth().descending()});
+  check({table.ts().descending(), table.dur().ascending()});
+  check({table.ts().ascending(), table.depth().ascending(),
+         table.value().ascending(), table.id().descending()});
+  check({table.dur().ascending(), table.id().ascending()});
+  check({table.ts().ascending(), table.id().ascending()});
+
+  // Order bys which fallback to sorting one column at a time.
+  check({table.name().ascending(), table.dur().ascending()});
+  check({table.dur().ascending(), table.depth().ascending(),
+         table.track_id().ascending(), table.value().ascending()});
+}
+
+TEST(TableTest, CompressedStorage) {
+  static constexpr uint32_t kRowCount = 3000;
+
+  StringPool pool;
+  TestCompressedTable table{&pool, nullptr};
+  const StringPool::Id names[] = {pool.InternString("R"),
+                                  pool.InternString("S"),
+                                  pool.InternString("D")};
+  for (uint32_t i = 0; i < kRowCount; ++i) {
+    TestCompressedTable::Row row;
+    row.ts = 1000000000 + (i * 7919) % 100000;
+    row.cpu = i % 8;
+    row.depth = static_cast<int32_t>((i * 104729) % 20) - 10;
+    row.sparse = static_cast<int64_t>((i * 13) % 3) * 1000000000000ll;
+    row.name = names[(i * 17) % 3];
+    table.Insert(row);
+  }
+
+  std::vector<Constraint> constraints;
+  const FilterOp kOps[] = {FilterOp::kEq, FilterOp::kNe, FilterOp::kLt,
+                           FilterOp::kLe, FilterOp::kGt, FilterOp::kGe};
+  const std::pair<const Column*, std::vector<int64_t>> kColumnValues[] = {
+      {&table.ts(), {0, 1000000000, 1000050000, 1000050001, 2000000000}},
+      {&table.cpu(), {-1, 0, 3, 7, 8, 1ll << 40}},
+      {&table.depth(), {-11, -10, 0, 9, 10}},
+      {&table.sparse(), {-1, 0, 1, 1000000000000ll, 2000000000000ll,
+                         3000000000000ll}},
+  };
+  for (const auto& column_values : kColumnValues) {
+    for (int64_t value : column_values.second) {
+      for (FilterOp op : kOps) {
+        constraints.push_back(Constraint{
+            column_values.first->index_in_table(), op, SqlValue::Long(value)});
+      }
+    }
+  }
+  constraints.push_back(table.name().eq("S"));
+
+  std::vector<RowMap> expected;
+  for (const Constraint& c : constraints) {
+    expected.emplace_back(table.FilterToRowMap({c}));
+  }
+  Table expected_sorted =
+      table.Sort({table.depth().ascending(), table.sparse().descending()});
+
+  int32_t depth_6 = table.depth()[6];
+
+  table.ShrinkToFit();
+  ASSERT_TRUE(table.ts().IsCompressed());
+  ASSERT_TRUE(table.cpu().IsCompressed());
+  ASSERT_TRUE(table.depth().IsCompressed());
+  ASSERT_TRUE(table.sparse().IsCompressed());
+  ASSERT_TRUE(table.name().IsCompressed());
+
+  for (uint32_t i = 0; i < constraints.size(); ++i) {
+    RowMap rm = table.FilterToRowMap({constraints[i]});
+    ASSERT_EQ(rm.size(), expected[i].size()) << "constraint " << i;
+    for (uint32_t row = 0; row < kRowCount; ++row) {
+      ASSERT_EQ(rm.Contains(row), expected[i].Contains(row));
+    }
+  }
+
+  Table sorted =
+      table.Sort({table.depth().ascending(), table.sparse().descending()});
+  for (uint32_t i = 0; i < kRowCount; ++i) {
+    ASSERT_EQ(sorted.GetColumn(0).Get(i).AsLong(),
+              expected_sorted.GetColumn(0).Get(i).AsLong());
+  }
+
+  // Changing a value should decompress the column.
+  table.mutable_depth()->Set(5, 100);
+  ASSERT_FALSE(table.depth().IsCompressed());
+  ASSERT_EQ(table.depth()[5], 100);
+  ASSERT_EQ(table.depth()[6], depth_6);
+}
+
+TEST(TableTest, FilterInParallel) {
+  static constexpr uint32_t kRowCount = 200000;
+
+  StringPool pool;
+  TestSortTable table{&pool, nullptr};
+  const StringPool::Id names[] = {pool.InternString("foo"),
+                                  pool.InternString("bar")};
+  for (uint32_t i = 0; i < kRowCount; ++i) {
+    TestSortTable::Row row;
+    row.ts = i * 10;
+    row.dur = (i * 7919) % 1000;
+    row.depth = static_cast<int32_t>(i % 7);
+    row.track_id = i % 5 == 0 ? base::nullopt : base::make_optional(i % 13);
+    row.value = static_cast<double>((i * 104729) % 100) / 100;
+    row.name = names[(i / 3) % 2];
+    table.Insert(row);
+  }
+
+  const std::vector<Constraint> kConstraints[] = {
+      {table.dur().gt(900)},
+      {table.dur().lt(10), table.value().ge(0.5)},
+      {table.ts().ge(12345), table.ts().lt(1500005), table.dur().le(500)},
+      {table.ts().gt(1000000), table.depth().eq(3), table.name().ne("foo")},
+      {table.track_id().is_null(), table.value().lt(0.25)},
+      {table.track_id().ge(7), table.name().eq("bar")},
+      {table.dur().gt(1000)},
+  };
+
+  base::ThreadPool thread_pool(3);
+  for (const auto& cs : kConstraints) {
+    for (auto optimize_for :
+         {RowMap::OptimizeFor::kMemory, RowMap::OptimizeFor::kLookupSpeed}) {
+      RowMap expected = table.FilterToRowMap(cs, optimize_for);
+      RowMap actual = table.FilterToRowMap(cs, optimize_for, &thread_pool);
+      ASSERT_EQ(actual.size(), expected.size());
+      for (uint32_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQ(actual.Get(i), expected.Get(i));
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
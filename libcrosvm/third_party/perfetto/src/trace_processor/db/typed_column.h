@@ -135,6 +135,7 @@ class TypedColumn : public Column {
 
   // Public for use by macro tables.
   void SetAtIdx(uint32_t idx, non_optional_type v) {
+    DropIndex();
     auto serialized = Serializer::Serialize(v);
     mutable_storage()->Set(idx, serialized);
   }
@@ -141,8 +141,8 @@ class BFS {
         GoToRelativesImpl(*opt_ancestors);
     }
     if (visit_relatives & VISIT_DESCENDANTS) {
-      auto opt_descendants =
-          DescendantGenerator::GetDescendantSlices(slice_table, slice_id);
+      auto opt_descendants = DescendantGenerator::GetDescendantSlices(
+          slice_table, context_->storage->slice_interval_index(), slice_id);
       if (opt_descendants)
         GoToRelativesImpl(*opt_descendants);
     }
@@ -62,6 +62,7 @@ std::unique_ptr<Table> ExtendWithStartId(
 
 base::Status GetDescendants(
     const tables::SliceTable& slices,
+    const SliceIntervalIndex& index,
     SliceId starting_id,
     std::vector<tables::SliceTable::RowNumber>& row_numbers_accumulator) {
   auto start_ref = slices.FindById(starting_id);
@@ -71,6 +72,13 @@ base::Status GetDescendants(
                            static_cast<uint32_t>(starting_id.value));
   }
 
+  // Once the trace is fully imported, the descendants are a contiguous range
+  // of the preorder stored in the index so there's no need to scan the table.
+  if (index.IsValidFor(slices)) {
+    index.GetDescendants(start_ref->ToRowNumber(), &row_numbers_accumulator);
+    return base::OkStatus();
+  }
+
   // As an optimization, for any finished slices, we only need to consider
   // slices which started before the end of this slice (because slices on a
   // track are always perfectly stacked).
@@ -122,6 +130,7 @@ base::Status DescendantGenerator::ComputeTable(
     const BitVector&,
     std::unique_ptr<Table>& table_return) {
   const auto& slices = context_->storage->slice_table();
+  const auto& index = context_->storage->slice_interval_index();
 
   uint32_t column = tables::DescendantSliceTable::ColumnIndex::start_id;
   auto constraint_it =
@@ -140,8 +149,9 @@ base::Status DescendantGenerator::ComputeTable(
     case Descendant::kSlice: {
       // Build up all the children row ids.
       uint32_t start_id_uint = static_cast<uint32_t>(start_id);
-      RETURN_IF_ERROR(GetDescendants(
-          slices, tables::SliceTable::Id(start_id_uint), descendants));
+      RETURN_IF_ERROR(GetDescendants(slices, index,
+                                     tables::SliceTable::Id(start_id_uint),
+                                     descendants));
       table_return = ExtendWithStartId<tables::DescendantSliceTable>(
           start_id_uint, slices, std::move(descendants));
       break;
@@ -149,7 +159,7 @@ base::Status DescendantGenerator::ComputeTable(
     case Descendant::kSliceByStack: {
       auto sbs_cs = {slices.stack_id().eq(start_id)};
       for (auto it = slices.FilterToIterator(sbs_cs); it; ++it) {
-        RETURN_IF_ERROR(GetDescendants(slices, it.id(), descendants));
+        RETURN_IF_ERROR(GetDescendants(slices, index, it.id(), descendants));
       }
       table_return = ExtendWithStartId<tables::DescendantSliceByStackTable>(
           start_id, slices, std::move(descendants));
@@ -187,9 +197,10 @@ uint32_t DescendantGenerator::EstimateRowCount() {
 // static
 base::Optional<std::vector<tables::SliceTable::RowNumber>>
 DescendantGenerator::GetDescendantSlices(const tables::SliceTable& slices,
+                                         const SliceIntervalIndex& index,
                                          SliceId slice_id) {
   std::vector<tables::SliceTable::RowNumber> ret;
-  auto status = GetDescendants(slices, slice_id, ret);
+  auto status = GetDescendants(slices, index, slice_id, ret);
   if (!status.ok())
     return base::nullopt;
   return std::move(ret);
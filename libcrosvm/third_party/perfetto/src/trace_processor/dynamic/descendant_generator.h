@@ -49,8 +49,11 @@ class DescendantGenerator : public DynamicTableGenerator {
   // Returns a vector of slice rows which are descendants of |slice_id|. Returns
   // base::nullopt if an invalid |slice_id| is given. This is used by
   // ConnectedFlowGenerator to traverse flow indirectly connected flow events.
+  // |index| is used instead of scanning |slices| if it is up to date.
   static base::Optional<std::vector<tables::SliceTable::RowNumber>>
-  GetDescendantSlices(const tables::SliceTable& slices, SliceId slice_id);
+  GetDescendantSlices(const tables::SliceTable& slices,
+                      const SliceIntervalIndex& index,
+                      SliceId slice_id);
 
  private:
   Descendant type_;
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_slices_in_range_generator.h"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+#include "src/trace_processor/sqlite/sqlite_utils.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using CI = tables::ExperimentalSlicesInRangeTable::ColumnIndex;
+
+base::Optional<int64_t> FindEqLong(const std::vector<Constraint>& cs,
+                                   uint32_t col_idx) {
+  auto it = std::find_if(cs.begin(), cs.end(), [col_idx](const Constraint& c) {
+    return c.col_idx == col_idx && c.op == FilterOp::kEq;
+  });
+  if (it == cs.end() || it->value.type != SqlValue::Type::kLong)
+    return base::nullopt;
+  return it->value.AsLong();
+}
+
+// Returns the end of the range [ts, ts + dur), saturated to the largest
+// timestamp. An empty range (i.e. dur = 0) is treated as the instant |ts|,
+// which overlaps the slices starting at |ts| as well as the ones spanning it.
+int64_t RangeEnd(int64_t ts, int64_t dur) {
+  int64_t len = std::max(dur, int64_t{1});
+  if (ts > 0 && len > std::numeric_limits<int64_t>::max() - ts)
+    return std::numeric_limits<int64_t>::max();
+  return ts + len;
+}
+
+}  // namespace
+
+ExperimentalSlicesInRangeGenerator::ExperimentalSlicesInRangeGenerator(
+    TraceProcessorContext* context)
+    : context_(context) {}
+
+base::Status ExperimentalSlicesInRangeGenerator::ValidateConstraints(
+    const QueryConstraints& qc) {
+  bool has_track_id = false;
+  bool has_ts = false;
+  bool has_dur = false;
+  for (const auto& c : qc.constraints()) {
+    if (!sqlite_utils::IsOpEq(c.op))
+      continue;
+    has_track_id |= c.column == static_cast<int>(CI::range_track_id);
+    has_ts |= c.column == static_cast<int>(CI::range_ts);
+    has_dur |= c.column == static_cast<int>(CI::range_dur);
+  }
+  return has_track_id && has_ts && has_dur
+             ? base::OkStatus()
+             : base::ErrStatus("Failed to find required constraints");
+}
+
+base::Status ExperimentalSlicesInRangeGenerator::ComputeTable(
+    const std::vector<Constraint>& cs,
+    const std::vector<Order>&,
+    const BitVector&,
+    std::unique_ptr<Table>& table_return) {
+  base::Optional<int64_t> track_id =
+      FindEqLong(cs, static_cast<uint32_t>(CI::range_track_id));
+  base::Optional<int64_t> ts =
+      FindEqLong(cs, static_cast<uint32_t>(CI::range_ts));
+  base::Optional<int64_t> dur =
+      FindEqLong(cs, static_cast<uint32_t>(CI::range_dur));
+  if (!track_id || *track_id < 0 || *track_id > UINT32_MAX)
+    return base::ErrStatus("experimental_slices_in_range: invalid track id");
+  if (!ts)
+    return base::ErrStatus("experimental_slices_in_range: invalid ts");
+  if (!dur || *dur < 0)
+    return base::ErrStatus("experimental_slices_in_range: invalid dur");
+
+  table_return = ComputeSlicesInRangeTable(
+      context_->storage->slice_table(),
+      context_->storage->slice_interval_index(),
+      static_cast<uint32_t>(*track_id), *ts, *dur);
+  return base::OkStatus();
+}
+
+// static
+std::unique_ptr<Table>
+ExperimentalSlicesInRangeGenerator::ComputeSlicesInRangeTable(
+    const tables::SliceTable& slices,
+    const SliceIntervalIndex& index,
+    uint32_t track_id,
+    int64_t ts,
+    int64_t dur) {
+  int64_t end = RangeEnd(ts, dur);
+  std::vector<tables::SliceTable::RowNumber> rows;
+  if (index.IsValidFor(slices)) {
+    index.GetOverlapping(TrackId(track_id), ts, end, &rows);
+  } else {
+    // The trace is still being imported: fall back to scanning all the slices
+    // on the track which start before the end of the range.
+    auto it = slices.FilterToIterator(
+        {slices.track_id().eq(track_id), slices.ts().lt(end)});
+    for (; it; ++it) {
+      if (it.ts() >= ts || it.dur() < 0 || it.ts() + it.dur() > ts)
+        rows.emplace_back(it.row_number());
+    }
+  }
+
+  uint32_t count = static_cast<uint32_t>(rows.size());
+  ColumnStorage<uint32_t> range_track_ids;
+  ColumnStorage<int64_t> range_ts;
+  ColumnStorage<int64_t> range_durs;
+  for (uint32_t i = 0; i < count; ++i) {
+    range_track_ids.Append(track_id);
+    range_ts.Append(ts);
+    range_durs.Append(dur);
+  }
+  return tables::ExperimentalSlicesInRangeTable::SelectAndExtendParent(
+      slices, std::move(rows), std::move(range_track_ids), std::move(range_ts),
+      std::move(range_durs));
+}
+
+Table::Schema ExperimentalSlicesInRangeGenerator::CreateSchema() {
+  return tables::ExperimentalSlicesInRangeTable::ComputeStaticSchema();
+}
+
+std::string ExperimentalSlicesInRangeGenerator::TableName() {
+  return tables::ExperimentalSlicesInRangeTable::Name();
+}
+
+uint32_t ExperimentalSlicesInRangeGenerator::EstimateRowCount() {
+  return context_->storage->slice_table().row_count();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_SLICES_IN_RANGE_GENERATOR_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_SLICES_IN_RANGE_GENERATOR_H_
+
+#include "src/trace_processor/dynamic/dynamic_table_generator.h"
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceProcessorContext;
+
+// Dynamic table generator for the "experimental_slices_in_range" table.
+//
+// Takes a track id, a timestamp and a duration and returns all the slices on
+// the track which overlap [ts, ts + dur) (or the instant ts if dur is 0):
+// this is the query done by the UI
+// when rendering a track and, once the trace is fully imported, is answered
+// using the slice interval index instead of scanning the slice table.
+class ExperimentalSlicesInRangeGenerator : public DynamicTableGenerator {
+ public:
+  explicit ExperimentalSlicesInRangeGenerator(TraceProcessorContext* context);
+
+  Table::Schema CreateSchema() override;
+  std::string TableName() override;
+  uint32_t EstimateRowCount() override;
+  base::Status ValidateConstraints(const QueryConstraints&) override;
+  base::Status ComputeTable(const std::vector<Constraint>& cs,
+                            const std::vector<Order>& ob,
+                            const BitVector& cols_used,
+                            std::unique_ptr<Table>& table_return) override;
+
+  // Visible for testing.
+  static std::unique_ptr<Table> ComputeSlicesInRangeTable(
+      const tables::SliceTable& slices,
+      const SliceIntervalIndex& index,
+      uint32_t track_id,
+      int64_t ts,
+      int64_t dur);
+
+ private:
+  TraceProcessorContext* context_ = nullptr;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_SLICES_IN_RANGE_GENERATOR_H_
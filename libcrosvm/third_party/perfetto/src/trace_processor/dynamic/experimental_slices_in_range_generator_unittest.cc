@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_slices_in_range_generator.h"
+
+#include <limits>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+void Insert(tables::SliceTable* table,
+            int64_t ts,
+            int64_t dur,
+            uint32_t track_id) {
+  tables::SliceTable::Row row;
+  row.ts = ts;
+  row.dur = dur;
+  row.track_id = tables::TrackTable::Id{track_id};
+  table->Insert(row);
+}
+
+std::vector<int64_t> Ids(const Table& table) {
+  const Column* id_column = table.GetColumnByName("id");
+  std::vector<int64_t> ids;
+  for (uint32_t i = 0; i < table.row_count(); ++i) {
+    ids.push_back(id_column->Get(i).long_value);
+  }
+  return ids;
+}
+
+TEST(ExperimentalSlicesInRangeGeneratorTest, SlicesInRange) {
+  StringPool pool;
+  tables::SliceTable slices(&pool, nullptr);
+
+  // Track 1:
+  // [0      50]     [60    -1 ...
+  //   [10 20]
+  // Track 2:
+  //     [15 30]
+  Insert(&slices, 0, 50, 1);
+  Insert(&slices, 10, 10, 1);
+  Insert(&slices, 15, 15, 2);
+  Insert(&slices, 60, -1, 1);
+
+  // Until the index is built, the slice table should be scanned.
+  SliceIntervalIndex index;
+  auto table = ExperimentalSlicesInRangeGenerator::ComputeSlicesInRangeTable(
+      slices, index, 1, 15, 50);
+  ASSERT_THAT(Ids(*table), ElementsAre(0, 1, 3));
+
+  index.Build(slices);
+  table = ExperimentalSlicesInRangeGenerator::ComputeSlicesInRangeTable(
+      slices, index, 1, 15, 50);
+  ASSERT_THAT(Ids(*table), ElementsAre(0, 1, 3));
+
+  table = ExperimentalSlicesInRangeGenerator::ComputeSlicesInRangeTable(
+      slices, index, 1, 20, 40);
+  ASSERT_THAT(Ids(*table), ElementsAre(0));
+
+  const Column* range_ts = table->GetColumnByName("range_ts");
+  ASSERT_EQ(range_ts->Get(0).long_value, 20);
+}
+
+TEST(ExperimentalSlicesInRangeGeneratorTest, EmptyAndUnboundedRanges) {
+  StringPool pool;
+  tables::SliceTable slices(&pool, nullptr);
+
+  // Track 1:
+  // [0      50]     [60    -1 ...
+  //   [10 20]
+  //          [50 0]
+  Insert(&slices, 0, 50, 1);
+  Insert(&slices, 10, 10, 1);
+  Insert(&slices, 50, 0, 1);
+  Insert(&slices, 60, -1, 1);
+
+  // Both the scan and the index should agree on the same rows.
+  SliceIntervalIndex index;
+  for (int i = 0; i < 2; ++i) {
+    // An empty range returns the slices starting at or spanning ts.
+    auto table = ExperimentalSlicesInRangeGenerator::ComputeSlicesInRangeTable(
+        slices, index, 1, 10, 0);
+    ASSERT_THAT(Ids(*table), ElementsAre(0, 1));
+    table = ExperimentalSlicesInRangeGenerator::ComputeSlicesInRangeTable(
+        slices, index, 1, 50, 0);
+    ASSERT_THAT(Ids(*table), ElementsAre(2));
+    table = ExperimentalSlicesInRangeGenerator::ComputeSlicesInRangeTable(
+        slices, index, 1, 55, 0);
+    ASSERT_THAT(Ids(*table), IsEmpty());
+
+    // The end of the range saturates rather than overflows.
+    table = ExperimentalSlicesInRangeGenerator::ComputeSlicesInRangeTable(
+        slices, index, 1, 20, std::numeric_limits<int64_t>::max());
+    ASSERT_THAT(Ids(*table), ElementsAre(0, 2, 3));
+
+    index.Build(slices);
+  }
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -18,9 +18,11 @@
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "src/trace_processor/db/snapshot_io.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/proto/proto_trace_parser.h"
 #include "src/trace_processor/importers/proto/proto_trace_reader.h"
+#include "src/trace_processor/snapshot_trace_reader.h"
 #include "src/trace_processor/sorter/trace_sorter.h"
 
 namespace perfetto {
@@ -150,6 +152,10 @@ util::Status ForwardingTraceParser::Parse(TraceBlobView blob) {
         }
         return util::ErrStatus("Android Bugreport support is disabled. %s",
                                kNoZlibErr);
+      case kSnapshotTraceType:
+        PERFETTO_DLOG("Trace processor snapshot detected");
+        reader_.reset(new SnapshotTraceReader(context_));
+        break;
       case kUnknownTraceType:
         // If renaming this error message don't remove the "(ERR:fmt)" part.
         // The UI's error_dialog.ts uses it to make the dialog more graceful.
@@ -167,6 +173,10 @@ void ForwardingTraceParser::NotifyEndOfFile() {
 TraceType GuessTraceType(const uint8_t* data, size_t size) {
   if (size == 0)
     return kUnknownTraceType;
+  // Checked first as the contents of a snapshot are arbitrary binary data
+  // which could match some of the heuristics below.
+  if (IsSnapshot(data, size))
+    return kSnapshotTraceType;
   std::string start(reinterpret_cast<const char*>(data),
                     std::min<size_t>(size, kGuessTraceMaxLookahead));
   if (size >= 8) {
@@ -16,6 +16,7 @@
 
 #include "src/trace_processor/forwarding_trace_parser.h"
 
+#include "src/trace_processor/db/snapshot_io.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto {
@@ -32,6 +33,12 @@ TEST(TraceProcessorImplTest, GuessTraceType_Json) {
   EXPECT_EQ(kJsonTraceType, GuessTraceType(prefix, sizeof(prefix)));
 }
 
+TEST(TraceProcessorImplTest, GuessTraceType_Snapshot) {
+  EXPECT_EQ(kSnapshotTraceType,
+            GuessTraceType(reinterpret_cast<const uint8_t*>(kSnapshotMagic),
+                           kSnapshotMagicSize));
+}
+
 TEST(TraceProcessorImplTest, GuessTraceType_Ninja) {
   const uint8_t prefix[] = "# ninja log v5\n";
   EXPECT_EQ(kNinjaLogTraceType, GuessTraceType(prefix, sizeof(prefix)));
@@ -333,6 +333,11 @@ void SliceTracker::FlushPendingSlices() {
   translatable_args_.clear();
 
   stacks_.Clear();
+
+  // All the slices have been imported so build the index used to speed up
+  // descendant and overlap queries on the slice table.
+  auto* storage = context_->storage.get();
+  storage->mutable_slice_interval_index()->Build(storage->slice_table());
 }
 
 void SliceTracker::SetOnSliceBeginCallback(OnSliceBeginCallback callback) {
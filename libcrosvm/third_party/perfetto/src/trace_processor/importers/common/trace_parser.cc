@@ -26,7 +26,7 @@ namespace trace_processor {
 void TraceParser::ParseTracePacket(int64_t, TracePacketData) {
   PERFETTO_FATAL("Wrong parser type");
 }
-void TraceParser::ParseJsonPacket(int64_t, std::string) {
+void TraceParser::ParseJsonPacket(int64_t, TraceBlobView) {
   PERFETTO_FATAL("Wrong parser type");
 }
 void TraceParser::ParseFuchsiaRecord(int64_t, FuchsiaRecord) {
@@ -28,6 +28,7 @@ struct InlineSchedSwitch;
 class FuchsiaRecord;
 struct SystraceLine;
 struct InlineSchedWaking;
+class TraceBlobView;
 struct TracePacketData;
 struct TrackEventData;
 
@@ -36,7 +37,7 @@ class TraceParser {
   virtual ~TraceParser();
 
   virtual void ParseTracePacket(int64_t, TracePacketData);
-  virtual void ParseJsonPacket(int64_t, std::string);
+  virtual void ParseJsonPacket(int64_t, TraceBlobView);
   virtual void ParseFuchsiaRecord(int64_t, FuchsiaRecord);
   virtual void ParseTrackEvent(int64_t, TrackEventData);
   virtual void ParseSystraceLine(int64_t, SystraceLine);
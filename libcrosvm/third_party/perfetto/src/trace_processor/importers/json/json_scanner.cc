@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/json/json_scanner.h"
+
+#include <algorithm>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/compiler.h"
+#include "perfetto/base/logging.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+#include <immintrin.h>
+#endif
+
+namespace perfetto {
+namespace trace_processor {
+namespace json {
+
+namespace {
+
+// '[' and ']' only differ from '{' and '}' in bit 0x20 so setting this bit
+// allows all four to be detected with two comparisons.
+constexpr uint8_t kLowerCaseBit = 0x20;
+
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+uint32_t StructuralCharMask32(const char* data) {
+  __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+  __m256i quotes = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('"'));
+  __m256i backslashes = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\\'));
+  __m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(kLowerCaseBit));
+  __m256i brackets =
+      _mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('{')),
+                      _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('}')));
+  __m256i all =
+      _mm256_or_si256(_mm256_or_si256(quotes, backslashes), brackets);
+  return static_cast<uint32_t>(_mm256_movemask_epi8(all));
+}
+#endif
+
+bool IsWhitespace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Returns the index of the lowest set bit of |mask| which must be non-zero.
+uint32_t LowestSetBit(uint64_t mask) {
+  return static_cast<uint32_t>(PERFETTO_POPCOUNT((mask & (~mask + 1)) - 1));
+}
+
+base::Optional<uint32_t> ParseHex4(const char* data) {
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < 4; ++i) {
+    char c = data[i];
+    uint32_t digit;
+    if (c >= '0' && c <= '9') {
+      digit = static_cast<uint32_t>(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      digit = static_cast<uint32_t>(c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      digit = static_cast<uint32_t>(c - 'A' + 10);
+    } else {
+      return base::nullopt;
+    }
+    value = (value << 4) | digit;
+  }
+  return value;
+}
+
+void AppendUtf8(uint32_t code_point, std::string* out) {
+  if (code_point < 0x80) {
+    out->push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    out->push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else if (code_point < 0x10000) {
+    out->push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else {
+    out->push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  }
+}
+
+}  // namespace
+
+uint64_t StructuralCharMask(const char* data, size_t size) {
+  PERFETTO_DCHECK(size <= 64);
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+  if (size == 64) {
+    uint64_t lo = StructuralCharMask32(data);
+    uint64_t hi = StructuralCharMask32(data + 32);
+    return lo | (hi << 32);
+  }
+#endif
+  uint64_t mask = 0;
+  for (size_t i = 0; i < size; ++i) {
+    auto c = static_cast<uint8_t>(data[i]);
+    auto lower = static_cast<uint8_t>(c | kLowerCaseBit);
+    bool structural = c == '"' || c == '\\' || lower == '{' || lower == '}';
+    mask |= static_cast<uint64_t>(structural) << i;
+  }
+  return mask;
+}
+
+StructuralCharIterator::StructuralCharIterator(const char* start,
+                                               const char* end)
+    : block_(start), end_(end) {
+  LoadBlock();
+}
+
+void StructuralCharIterator::LoadBlock() {
+  size_t size = std::min<size_t>(static_cast<size_t>(end_ - block_), 64);
+  mask_ = StructuralCharMask(block_, size);
+}
+
+const char* StructuralCharIterator::Next() {
+  while (mask_ == 0) {
+    if (end_ - block_ <= 64)
+      return end_;
+    block_ += 64;
+    LoadBlock();
+  }
+  uint32_t idx = LowestSetBit(mask_);
+  mask_ &= mask_ - 1;
+  return block_ + idx;
+}
+
+const char* FindStringEnd(const char* start, const char* end) {
+  StructuralCharIterator it(start, end);
+  const char* escaped = nullptr;
+  for (const char* p = it.Next(); p != end; p = it.Next()) {
+    if (p == escaped)
+      continue;
+    if (*p == '\\') {
+      escaped = p + 1;
+    } else if (*p == '"') {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+const char* FindValueEnd(const char* start, const char* end) {
+  if (start == end)
+    return nullptr;
+
+  if (*start == '"') {
+    const char* string_end = FindStringEnd(start + 1, end);
+    return string_end ? string_end + 1 : nullptr;
+  }
+
+  if (*start == '{' || *start == '[') {
+    StructuralCharIterator it(start, end);
+    const char* escaped = nullptr;
+    uint32_t depth = 0;
+    bool in_string = false;
+    for (const char* p = it.Next(); p != end; p = it.Next()) {
+      if (p == escaped)
+        continue;
+      switch (*p) {
+        case '\\':
+          escaped = p + 1;
+          break;
+        case '"':
+          in_string = !in_string;
+          break;
+        case '{':
+        case '[':
+          depth += !in_string;
+          break;
+        case '}':
+        case ']':
+          if (!in_string && --depth == 0)
+            return p + 1;
+          break;
+      }
+    }
+    return nullptr;
+  }
+
+  // Numbers and literals end at the first delimiter.
+  const char* p = start;
+  for (; p != end; ++p) {
+    char c = *p;
+    if (c == ',' || c == '}' || c == ']' || c == ':' || IsWhitespace(c))
+      break;
+  }
+  return p == start ? nullptr : p;
+}
+
+bool UnescapeString(base::StringView escaped, std::string* out) {
+  const char* p = escaped.data();
+  const char* end = escaped.data() + escaped.size();
+  while (p != end) {
+    const char* backslash = std::find(p, end, '\\');
+    out->append(p, static_cast<size_t>(backslash - p));
+    if (backslash == end)
+      break;
+    p = backslash + 1;
+    if (p == end)
+      return false;
+    char c = *p++;
+    switch (c) {
+      case '"':
+      case '\\':
+      case '/':
+        out->push_back(c);
+        break;
+      case 'b':
+        out->push_back('\b');
+        break;
+      case 'f':
+        out->push_back('\f');
+        break;
+      case 'n':
+        out->push_back('\n');
+        break;
+      case 'r':
+        out->push_back('\r');
+        break;
+      case 't':
+        out->push_back('\t');
+        break;
+      case 'u': {
+        if (end - p < 4)
+          return false;
+        base::Optional<uint32_t> code_point = ParseHex4(p);
+        if (!code_point)
+          return false;
+        p += 4;
+        if (*code_point >= 0xD800 && *code_point <= 0xDBFF) {
+          // High surrogate: must be followed by the low surrogate.
+          if (end - p < 6 || p[0] != '\\' || p[1] != 'u')
+            return false;
+          base::Optional<uint32_t> low = ParseHex4(p + 2);
+          if (!low || *low < 0xDC00 || *low > 0xDFFF)
+            return false;
+          p += 6;
+          code_point =
+              0x10000 + ((*code_point - 0xD800) << 10) + (*low - 0xDC00);
+        }
+        AppendUtf8(*code_point, out);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+RawValue::Type RawValue::type() const {
+  if (text_.empty())
+    return Type::kInvalid;
+  switch (text_.at(0)) {
+    case '"':
+      return Type::kString;
+    case '{':
+      return Type::kObject;
+    case '[':
+      return Type::kArray;
+    case 't':
+    case 'f':
+      return Type::kBool;
+    case 'n':
+      return Type::kNull;
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+      return Type::kNumber;
+  }
+  return Type::kInvalid;
+}
+
+base::Optional<base::StringView> RawValue::AsString(
+    std::string* storage) const {
+  if (type() != Type::kString || text_.size() < 2)
+    return base::nullopt;
+  base::StringView contents = text_.substr(1, text_.size() - 2);
+  if (contents.find('\\') == base::StringView::npos)
+    return contents;
+  storage->clear();
+  if (!UnescapeString(contents, storage))
+    return base::nullopt;
+  return base::StringView(*storage);
+}
+
+DictIterator::DictIterator(base::StringView dict)
+    : cur_(dict.data()), end_(dict.data() + dict.size()) {}
+
+void DictIterator::SkipWhitespace() {
+  while (cur_ != end_ && IsWhitespace(*cur_))
+    ++cur_;
+}
+
+bool DictIterator::Consume(char c) {
+  if (cur_ == end_ || *cur_ != c)
+    return false;
+  ++cur_;
+  return true;
+}
+
+bool DictIterator::Next() {
+  if (!ok_ || done_)
+    return false;
+
+  SkipWhitespace();
+  if (!started_) {
+    started_ = true;
+    if (!Consume('{'))
+      return Fail();
+    SkipWhitespace();
+    if (Consume('}')) {
+      done_ = true;
+      return false;
+    }
+  } else {
+    if (Consume('}')) {
+      done_ = true;
+      return false;
+    }
+    if (!Consume(','))
+      return Fail();
+    SkipWhitespace();
+  }
+
+  if (cur_ == end_ || *cur_ != '"')
+    return Fail();
+  const char* key_end = FindStringEnd(cur_ + 1, end_);
+  if (!key_end)
+    return Fail();
+  RawValue key(base::StringView(cur_, static_cast<size_t>(key_end + 1 - cur_)));
+  base::Optional<base::StringView> decoded_key = key.AsString(&key_storage_);
+  if (!decoded_key)
+    return Fail();
+  key_ = *decoded_key;
+  cur_ = key_end + 1;
+
+  SkipWhitespace();
+  if (!Consume(':'))
+    return Fail();
+  SkipWhitespace();
+
+  const char* value_end = FindValueEnd(cur_, end_);
+  if (!value_end)
+    return Fail();
+  value_ = RawValue(
+      base::StringView(cur_, static_cast<size_t>(value_end - cur_)));
+  cur_ = value_end;
+  return true;
+}
+
+}  // namespace json
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_JSON_JSON_SCANNER_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_JSON_JSON_SCANNER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/ext/base/string_view.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace json {
+
+// Utilities to read JSON text in place (i.e. without building a DOM). These
+// are used to tokenize and parse JSON traces where building a Json::Value for
+// every event dominates the import time.
+//
+// None of these validate the JSON: they only look at the structure of the
+// text and expect the caller to deal with values which don't have the
+// expected type.
+
+// Returns a bitmask with bit i set if |data[i]| is one of the characters
+// which determine the structure of JSON text: '"', '\\', '{', '}', '[' and
+// ']'. |size| must be at most 64.
+uint64_t StructuralCharMask(const char* data, size_t size);
+
+// Iterates over the structural characters (see |StructuralCharMask|) in
+// [start, end). The text is classified 64 bytes at a time (using SIMD where
+// available) so long runs of other characters (e.g. the contents of strings)
+// are skipped without looking at each character in turn.
+class StructuralCharIterator {
+ public:
+  StructuralCharIterator(const char* start, const char* end);
+
+  // Returns a pointer to the next structural character or |end| if there are
+  // none left.
+  const char* Next();
+
+ private:
+  void LoadBlock();
+
+  const char* block_ = nullptr;
+  const char* end_ = nullptr;
+  uint64_t mask_ = 0;
+};
+
+// Returns a pointer to the closing quote of the string whose contents start
+// at |start| (i.e. just after the opening quote) or nullptr if the string is
+// not terminated before |end|.
+const char* FindStringEnd(const char* start, const char* end);
+
+// Returns a pointer one past the end of the value (string, object, array,
+// number or literal) starting at |start| or nullptr if the value is not
+// terminated before |end|.
+const char* FindValueEnd(const char* start, const char* end);
+
+// Decodes the escape sequences in the contents of a JSON string (i.e. without
+// the surrounding quotes) and appends the result to |out|. Returns false if
+// an invalid escape sequence is found.
+bool UnescapeString(base::StringView escaped, std::string* out);
+
+// A JSON value as it appears in the source text.
+class RawValue {
+ public:
+  enum class Type {
+    kInvalid,
+    kNull,
+    kBool,
+    kNumber,
+    kString,
+    kObject,
+    kArray,
+  };
+
+  RawValue() = default;
+  explicit RawValue(base::StringView text) : text_(text) {}
+
+  // The type of the value, based only on its first character.
+  Type type() const;
+
+  // The text of the value. For strings, this includes the quotes.
+  base::StringView text() const { return text_; }
+
+  // Returns the decoded contents of the string. The returned view points into
+  // the source text unless the string contains escape sequences, in which case
+  // |storage| is used to hold the decoded string. Returns nullopt if this is
+  // not a string or it contains invalid escape sequences.
+  base::Optional<base::StringView> AsString(std::string* storage) const;
+
+  // Returns true if this is the literal true.
+  bool IsTrue() const { return text_ == "true"; }
+
+ private:
+  base::StringView text_;
+};
+
+// Iterates over the keys and values of a JSON object.
+// Usage:
+//   for (DictIterator it(dict); it.Next();) {
+//     if (it.key() == "ts") ...
+//   }
+//   if (!it.ok()) ...
+class DictIterator {
+ public:
+  explicit DictIterator(base::StringView dict);
+
+  // Moves to the next key of the object. Returns false once all the keys have
+  // been read or if the object is malformed (in which case ok() is false).
+  bool Next();
+
+  // The decoded key and the value of the current member.
+  base::StringView key() const { return key_; }
+  const RawValue& value() const { return value_; }
+
+  bool ok() const { return ok_; }
+
+ private:
+  bool Fail() {
+    ok_ = false;
+    return false;
+  }
+  void SkipWhitespace();
+  bool Consume(char c);
+
+  const char* cur_ = nullptr;
+  const char* end_ = nullptr;
+  bool started_ = false;
+  bool done_ = false;
+  bool ok_ = true;
+
+  base::StringView key_;
+  std::string key_storage_;
+  RawValue value_;
+};
+
+}  // namespace json
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_JSON_JSON_SCANNER_H_
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/json/json_scanner.h"
+
+#include <string>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace json {
+namespace {
+
+using ::testing::ElementsAre;
+
+std::vector<size_t> StructuralChars(const std::string& text) {
+  const char* end = text.data() + text.size();
+  StructuralCharIterator it(text.data(), end);
+  std::vector<size_t> positions;
+  for (const char* p = it.Next(); p != end; p = it.Next())
+    positions.push_back(static_cast<size_t>(p - text.data()));
+  return positions;
+}
+
+TEST(JsonScannerTest, StructuralCharMaskAllChars) {
+  // Check every possible byte both in a full block (which may be classified
+  // using SIMD) and in a partial block.
+  for (uint32_t c = 0; c < 256; ++c) {
+    std::string block(64, 'a');
+    block[37] = static_cast<char>(c);
+    bool expected = c == '"' || c == '\\' || c == '{' || c == '}' ||
+                    c == '[' || c == ']';
+    uint64_t expected_mask = expected ? 1ull << 37 : 0;
+    ASSERT_EQ(StructuralCharMask(block.data(), 64), expected_mask) << c;
+    ASSERT_EQ(StructuralCharMask(block.data(), 40), expected_mask) << c;
+  }
+}
+
+TEST(JsonScannerTest, StructuralCharIterator) {
+  ASSERT_THAT(StructuralChars(""), ElementsAre());
+  ASSERT_THAT(StructuralChars("{\"a\":[1]}"), ElementsAre(0, 1, 3, 5, 7, 8));
+
+  // Structural characters on both sides of block boundaries.
+  std::string text(200, ' ');
+  text[0] = '{';
+  text[63] = '"';
+  text[64] = '"';
+  text[128] = '\\';
+  text[199] = '}';
+  ASSERT_THAT(StructuralChars(text), ElementsAre(0, 63, 64, 128, 199));
+}
+
+TEST(JsonScannerTest, FindValueEnd) {
+  auto value_end = [](const std::string& text) -> base::Optional<size_t> {
+    const char* end = FindValueEnd(text.data(), text.data() + text.size());
+    if (!end)
+      return base::nullopt;
+    return static_cast<size_t>(end - text.data());
+  };
+  ASSERT_EQ(value_end("123,"), 3u);
+  ASSERT_EQ(value_end("-1.5e3}"), 6u);
+  ASSERT_EQ(value_end("true"), 4u);
+  ASSERT_EQ(value_end("\"a\\\"b\" "), 6u);
+  ASSERT_EQ(value_end("{\"a\":\"}\"},"), 9u);
+  ASSERT_EQ(value_end("[1, [2, {\"b\": \"\\\\\"}]]"), 21u);
+  ASSERT_EQ(value_end("\"abc"), base::nullopt);
+  ASSERT_EQ(value_end("{\"a\": [1}"), base::nullopt);
+  ASSERT_EQ(value_end(","), base::nullopt);
+  ASSERT_EQ(value_end(""), base::nullopt);
+}
+
+TEST(JsonScannerTest, UnescapeString) {
+  auto unescape = [](const std::string& text) -> base::Optional<std::string> {
+    std::string out;
+    if (!UnescapeString(base::StringView(text), &out))
+      return base::nullopt;
+    return out;
+  };
+  ASSERT_EQ(unescape("abc"), "abc");
+  ASSERT_EQ(unescape("a\\\"b\\\\c\\/d"), "a\"b\\c/d");
+  ASSERT_EQ(unescape("\\b\\f\\n\\r\\t"), "\b\f\n\r\t");
+  ASSERT_EQ(unescape("\\u0041\\u00e9\\u20AC"), "A\xC3\xA9\xE2\x82\xAC");
+  ASSERT_EQ(unescape("\\ud83d\\ude00"), "\xF0\x9F\x98\x80");
+  ASSERT_EQ(unescape("\\ud83d"), base::nullopt);
+  ASSERT_EQ(unescape("\\u12"), base::nullopt);
+  ASSERT_EQ(unescape("\\x"), base::nullopt);
+  ASSERT_EQ(unescape("abc\\"), base::nullopt);
+}
+
+TEST(JsonScannerTest, RawValue) {
+  ASSERT_EQ(RawValue("123").type(), RawValue::Type::kNumber);
+  ASSERT_EQ(RawValue("-1").type(), RawValue::Type::kNumber);
+  ASSERT_EQ(RawValue("\"a\"").type(), RawValue::Type::kString);
+  ASSERT_EQ(RawValue("{}").type(), RawValue::Type::kObject);
+  ASSERT_EQ(RawValue("[]").type(), RawValue::Type::kArray);
+  ASSERT_EQ(RawValue("false").type(), RawValue::Type::kBool);
+  ASSERT_EQ(RawValue("null").type(), RawValue::Type::kNull);
+  ASSERT_EQ(RawValue().type(), RawValue::Type::kInvalid);
+
+  // Strings without escapes should point into the source text.
+  std::string text = "\"abc\"";
+  std::string storage;
+  base::Optional<base::StringView> str =
+      RawValue(base::StringView(text)).AsString(&storage);
+  ASSERT_EQ(*str, "abc");
+  ASSERT_EQ(str->data(), text.data() + 1);
+
+  str = RawValue("\"a\\nb\"").AsString(&storage);
+  ASSERT_EQ(*str, "a\nb");
+  ASSERT_EQ(RawValue("1").AsString(&storage), base::nullopt);
+}
+
+TEST(JsonScannerTest, DictIterator) {
+  std::string dict =
+      R"({ "ph": "X", "ts" :1.5, "args": {"a": [1, "}"]}, "n\"m": null })";
+  DictIterator it(base::StringView{dict});
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+  while (it.Next()) {
+    keys.push_back(it.key().ToStdString());
+    values.push_back(it.value().text().ToStdString());
+  }
+  ASSERT_TRUE(it.ok());
+  ASSERT_THAT(keys, ElementsAre("ph", "ts", "args", "n\"m"));
+  ASSERT_THAT(values,
+              ElementsAre("\"X\"", "1.5", "{\"a\": [1, \"}\"]}", "null"));
+  ASSERT_FALSE(it.Next());
+  ASSERT_TRUE(it.ok());
+}
+
+TEST(JsonScannerTest, DictIteratorEmpty) {
+  DictIterator it(" { } ");
+  ASSERT_FALSE(it.Next());
+  ASSERT_TRUE(it.ok());
+}
+
+TEST(JsonScannerTest, DictIteratorMalformed) {
+  for (const char* dict :
+       {"[]", "{\"a\" 1}", "{\"a\": 1", "{\"a\": 1 \"b\": 2}", "{a: 1}",
+        "{\"a\": }", "{\"a\": \"b}"}) {
+    DictIterator it(dict);
+    while (it.Next()) {
+    }
+    ASSERT_FALSE(it.ok()) << dict;
+  }
+}
+
+}  // namespace
+}  // namespace json
+}  // namespace trace_processor
+}  // namespace perfetto
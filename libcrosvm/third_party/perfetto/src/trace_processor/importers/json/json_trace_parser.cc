@@ -29,6 +29,7 @@
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/common/slice_tracker.h"
 #include "src/trace_processor/importers/common/track_tracker.h"
+#include "src/trace_processor/importers/json/json_scanner.h"
 #include "src/trace_processor/importers/json/json_utils.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/tables/slice_tables.h"
@@ -37,21 +38,105 @@
 namespace perfetto {
 namespace trace_processor {
 
+// The fields of a trace event used by the parser. These are read in place
+// from the JSON text of the event: only the args are parsed into a Json::Value.
+struct JsonTraceParser::Event {
+  json::RawValue ph;
+  json::RawValue pid;
+  json::RawValue tid;
+  json::RawValue id;
+  json::RawValue cat;
+  json::RawValue name;
+  json::RawValue args;
+  json::RawValue tts;
+  json::RawValue tdur;
+  json::RawValue dur;
+  json::RawValue s;
+  json::RawValue bp;
+  json::RawValue bind_id;
+  json::RawValue flow_in;
+  json::RawValue flow_out;
+};
+
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 namespace {
 
-base::Optional<uint64_t> MaybeExtractFlowIdentifier(const Json::Value& value,
-                                                    bool version2) {
-  std::string id_key = (version2 ? "bind_id" : "id");
-  if (!value.isMember(id_key))
-    return base::nullopt;
-  auto id = value[id_key];
-  if (id.isNumeric())
-    return id.asUInt64();
-  if (!id.isString())
-    return base::nullopt;
-  const char* c_string = id.asCString();
-  return base::CStringToUInt64(c_string, 16);
+bool IsPresent(const json::RawValue& value) {
+  return value.type() != json::RawValue::Type::kInvalid;
+}
+
+// Returns the contents of |value| if it is a string or an empty view
+// otherwise.
+base::StringView GetString(const json::RawValue& value, std::string* storage) {
+  return value.AsString(storage).value_or(base::StringView());
+}
+
+// Matches Json::Value::asString(): strings are unescaped and other scalars
+// are returned as they appear in the trace.
+std::string GetIdString(const json::RawValue& value) {
+  switch (value.type()) {
+    case json::RawValue::Type::kString: {
+      std::string storage;
+      return GetString(value, &storage).ToStdString();
+    }
+    case json::RawValue::Type::kInvalid:
+    case json::RawValue::Type::kNull:
+      return std::string();
+    case json::RawValue::Type::kBool:
+    case json::RawValue::Type::kNumber:
+    case json::RawValue::Type::kObject:
+    case json::RawValue::Type::kArray:
+      return value.text().ToStdString();
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+// Matches Json::Value::asBool(): numbers are true if they are non-zero.
+bool CoerceToBool(const json::RawValue& value) {
+  switch (value.type()) {
+    case json::RawValue::Type::kBool:
+      return value.IsTrue();
+    case json::RawValue::Type::kNumber: {
+      std::string text = value.text().ToStdString();
+      return base::CStringToDouble(text.c_str()).value_or(0) != 0;
+    }
+    case json::RawValue::Type::kInvalid:
+    case json::RawValue::Type::kNull:
+    case json::RawValue::Type::kString:
+    case json::RawValue::Type::kObject:
+    case json::RawValue::Type::kArray:
+      return false;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+base::Optional<uint64_t> MaybeExtractFlowIdentifier(const json::RawValue& id) {
+  switch (id.type()) {
+    case json::RawValue::Type::kNumber: {
+      std::string text = id.text().ToStdString();
+      base::Optional<uint64_t> n = base::CStringToUInt64(text.c_str());
+      if (n)
+        return n;
+      base::Optional<double> d = base::CStringToDouble(text.c_str());
+      if (!d || *d < 0)
+        return base::nullopt;
+      return static_cast<uint64_t>(*d);
+    }
+    case json::RawValue::Type::kString: {
+      std::string storage;
+      base::Optional<base::StringView> str = id.AsString(&storage);
+      if (!str)
+        return base::nullopt;
+      return base::CStringToUInt64(str->ToStdString().c_str(), 16);
+    }
+    case json::RawValue::Type::kInvalid:
+    case json::RawValue::Type::kNull:
+    case json::RawValue::Type::kBool:
+    case json::RawValue::Type::kObject:
+    case json::RawValue::Type::kArray:
+      return base::nullopt;
+  }
+  PERFETTO_FATAL("For GCC");
 }
 
 }  // namespace
@@ -62,59 +147,112 @@ JsonTraceParser::JsonTraceParser(TraceProcessorContext* context)
 
 JsonTraceParser::~JsonTraceParser() = default;
 
+// static
+bool JsonTraceParser::ReadEvent(base::StringView dict, Event* event) {
+  json::DictIterator it(dict);
+  while (it.Next()) {
+    base::StringView key = it.key();
+    const json::RawValue& value = it.value();
+    if (key == "ph") {
+      event->ph = value;
+    } else if (key == "pid") {
+      event->pid = value;
+    } else if (key == "tid") {
+      event->tid = value;
+    } else if (key == "id") {
+      event->id = value;
+    } else if (key == "cat") {
+      event->cat = value;
+    } else if (key == "name") {
+      event->name = value;
+    } else if (key == "args") {
+      event->args = value;
+    } else if (key == "tts") {
+      event->tts = value;
+    } else if (key == "tdur") {
+      event->tdur = value;
+    } else if (key == "dur") {
+      event->dur = value;
+    } else if (key == "s") {
+      event->s = value;
+    } else if (key == "bp") {
+      event->bp = value;
+    } else if (key == "bind_id") {
+      event->bind_id = value;
+    } else if (key == "flow_in") {
+      event->flow_in = value;
+    } else if (key == "flow_out") {
+      event->flow_out = value;
+    }
+  }
+  return it.ok();
+}
+
 void JsonTraceParser::ParseSystraceLine(int64_t, SystraceLine line) {
   systrace_line_parser_.ParseLine(line);
 }
 
-void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
-                                      std::string string_value) {
+void JsonTraceParser::ParseJsonPacket(int64_t timestamp, TraceBlobView blob) {
   PERFETTO_DCHECK(json::IsJsonSupported());
 
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
-  auto opt_value = json::ParseJsonString(base::StringView(string_value));
-  if (!opt_value) {
+  Event event;
+  base::StringView dict(reinterpret_cast<const char*>(blob.data()),
+                        blob.size());
+  if (!ReadEvent(dict, &event)) {
     context_->storage->IncrementStats(stats::json_parser_failure);
     return;
   }
 
+  // Only the args are parsed into a Json::Value as they are flattened into
+  // the args table.
+  Json::Value args;
+  if (IsPresent(event.args)) {
+    auto opt_args = json::ParseJsonString(event.args.text());
+    if (!opt_args) {
+      context_->storage->IncrementStats(stats::json_parser_failure);
+      return;
+    }
+    args = std::move(*opt_args);
+  }
+
   ProcessTracker* procs = context_->process_tracker.get();
   TraceStorage* storage = context_->storage.get();
   SliceTracker* slice_tracker = context_->slice_tracker.get();
   FlowTracker* flow_tracker = context_->flow_tracker.get();
 
-  const Json::Value& value = *opt_value;
-  auto& ph = value["ph"];
-  if (!ph.isString())
+  std::string ph_storage;
+  base::Optional<base::StringView> ph = event.ph.AsString(&ph_storage);
+  if (!ph)
     return;
-  char phase = *ph.asCString();
+  char phase = ph->empty() ? '\0' : ph->at(0);
 
   base::Optional<uint32_t> opt_pid;
   base::Optional<uint32_t> opt_tid;
 
-  if (value.isMember("pid"))
-    opt_pid = json::CoerceToUint32(value["pid"]);
-  if (value.isMember("tid"))
-    opt_tid = json::CoerceToUint32(value["tid"]);
+  if (IsPresent(event.pid))
+    opt_pid = json::CoerceToUint32(event.pid);
+  if (IsPresent(event.tid))
+    opt_tid = json::CoerceToUint32(event.tid);
 
   uint32_t pid = opt_pid.value_or(0);
   uint32_t tid = opt_tid.value_or(pid);
   UniqueTid utid = procs->UpdateThread(tid, pid);
 
-  std::string id = value.isMember("id") ? value["id"].asString() : "";
+  std::string id = GetIdString(event.id);
 
-  base::StringView cat = value.isMember("cat")
-                             ? base::StringView(value["cat"].asCString())
-                             : base::StringView();
+  std::string cat_storage;
+  base::StringView cat = GetString(event.cat, &cat_storage);
   StringId cat_id = storage->InternString(cat);
 
-  base::StringView name = value.isMember("name")
-                              ? base::StringView(value["name"].asCString())
-                              : base::StringView();
+  std::string name_storage;
+  base::StringView name = GetString(event.name, &name_storage);
   StringId name_id = name.empty() ? kNullStringId : storage->InternString(name);
 
-  auto args_inserter = [this, &value](ArgsTracker::BoundInserter* inserter) {
-    if (value.isMember("args")) {
-      json::AddJsonValueToArgs(value["args"], /* flat_key = */ "args",
+  auto args_inserter = [this, &event,
+                        &args](ArgsTracker::BoundInserter* inserter) {
+    if (IsPresent(event.args)) {
+      json::AddJsonValueToArgs(args, /* flat_key = */ "args",
                                /* key = */ "args", context_->storage.get(),
                                inserter);
     }
@@ -129,9 +267,9 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
     row.track_id = track_id;
     row.category = cat_id;
     row.name = name_id;
-    row.thread_ts = json::CoerceToTs(value["tts"]);
+    row.thread_ts = json::CoerceToTs(event.tts);
     // tdur will only exist on 'X' events.
-    row.thread_dur = json::CoerceToTs(value["tdur"]);
+    row.thread_dur = json::CoerceToTs(event.tdur);
     // JSON traces don't report these counters as part of slices.
     row.thread_instruction_count = base::nullopt;
     row.thread_instruction_delta = base::nullopt;
@@ -143,7 +281,7 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
       slice_tracker->BeginTyped(storage->mutable_slice_table(),
                                 make_slice_row(track_id), args_inserter);
-      MaybeAddFlow(track_id, value);
+      MaybeAddFlow(track_id, event);
       break;
     }
     case 'E': {  // TRACE_EVENT_END.
@@ -151,7 +289,7 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       auto opt_slice_id = slice_tracker->End(timestamp, track_id, cat_id,
                                              name_id, args_inserter);
       // Now try to update thread_dur if we have a tts field.
-      auto opt_tts = json::CoerceToTs(value["tts"]);
+      auto opt_tts = json::CoerceToTs(event.tts);
       if (opt_slice_id.has_value() && opt_tts) {
         auto* slice = storage->mutable_slice_table();
         auto maybe_row = slice->id().IndexOf(*opt_slice_id);
@@ -179,7 +317,7 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       if (phase == 'b') {
         slice_tracker->BeginTyped(storage->mutable_slice_table(),
                                   make_slice_row(track_id), args_inserter);
-        MaybeAddFlow(track_id, value);
+        MaybeAddFlow(track_id, event);
       } else if (phase == 'e') {
         slice_tracker->End(timestamp, track_id, cat_id, name_id, args_inserter);
         // We don't handle tts here as we do in the 'E'
@@ -187,12 +325,12 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       } else {
         context_->slice_tracker->Scoped(timestamp, track_id, cat_id, name_id,
                                         0);
-        MaybeAddFlow(track_id, value);
+        MaybeAddFlow(track_id, event);
       }
       break;
     }
     case 'X': {  // TRACE_EVENT (scoped event).
-      base::Optional<int64_t> opt_dur = json::CoerceToTs(value["dur"]);
+      base::Optional<int64_t> opt_dur = json::CoerceToTs(event.dur);
       if (!opt_dur.has_value())
         return;
       TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
@@ -200,11 +338,10 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       row.dur = opt_dur.value();
       slice_tracker->ScopedTyped(storage->mutable_slice_table(), std::move(row),
                                  args_inserter);
-      MaybeAddFlow(track_id, value);
+      MaybeAddFlow(track_id, event);
       break;
     }
     case 'C': {  // TRACE_EVENT_COUNTER
-      auto args = value["args"];
       if (!args.isObject()) {
         context_->storage->IncrementStats(stats::json_parser_failure);
         break;
@@ -241,9 +378,10 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
     case 'R':
     case 'I':
     case 'i': {  // TRACE_EVENT_INSTANT
+      std::string scope_storage;
       base::StringView scope;
-      if (value.isMember("s")) {
-        scope = value["s"].asCString();
+      if (IsPresent(event.s)) {
+        scope = GetString(event.s, &scope_storage);
       }
 
       TrackId track_id;
@@ -283,8 +421,7 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
     }
     case 's': {  // TRACE_EVENT_FLOW_START
       TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
-      auto opt_source_id =
-          MaybeExtractFlowIdentifier(value, /* version2 = */ false);
+      auto opt_source_id = MaybeExtractFlowIdentifier(event.id);
       if (opt_source_id) {
         FlowId flow_id = flow_tracker->GetFlowIdForV1Event(
             opt_source_id.value(), cat_id, name_id);
@@ -296,8 +433,7 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
     }
     case 't': {  // TRACE_EVENT_FLOW_STEP
       TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
-      auto opt_source_id =
-          MaybeExtractFlowIdentifier(value, /* version2 = */ false);
+      auto opt_source_id = MaybeExtractFlowIdentifier(event.id);
       if (opt_source_id) {
         FlowId flow_id = flow_tracker->GetFlowIdForV1Event(
             opt_source_id.value(), cat_id, name_id);
@@ -309,13 +445,12 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
     }
     case 'f': {  // TRACE_EVENT_FLOW_END
       TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
-      auto opt_source_id =
-          MaybeExtractFlowIdentifier(value, /* version2 = */ false);
+      auto opt_source_id = MaybeExtractFlowIdentifier(event.id);
       if (opt_source_id) {
         FlowId flow_id = flow_tracker->GetFlowIdForV1Event(
             opt_source_id.value(), cat_id, name_id);
-        bool bind_enclosing_slice =
-            value.isMember("bp") && strcmp(value["bp"].asCString(), "e") == 0;
+        std::string bp_storage;
+        bool bind_enclosing_slice = GetString(event.bp, &bp_storage) == "e";
         flow_tracker->End(track_id, flow_id, bind_enclosing_slice,
                           /* close_flow = */ false);
       } else {
@@ -324,15 +459,15 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
       break;
     }
     case 'M': {  // Metadata events (process and thread names).
-      if (name == "thread_name" && !value["args"]["name"].empty()) {
-        const char* thread_name = value["args"]["name"].asCString();
+      if (name == "thread_name" && args.isObject() && !args["name"].empty()) {
+        const char* thread_name = args["name"].asCString();
         auto thread_name_id = context_->storage->InternString(thread_name);
         procs->UpdateThreadName(tid, thread_name_id,
                                 ThreadNamePriority::kOther);
         break;
       }
-      if (name == "process_name" && !value["args"]["name"].empty()) {
-        const char* proc_name = value["args"]["name"].asCString();
+      if (name == "process_name" && args.isObject() && !args["name"].empty()) {
+        const char* proc_name = args["name"].asCString();
         procs->SetProcessMetadata(pid, base::nullopt, proc_name,
                                   base::StringView());
         break;
@@ -342,19 +477,19 @@ void JsonTraceParser::ParseJsonPacket(int64_t timestamp,
 #else
   perfetto::base::ignore_result(timestamp);
   perfetto::base::ignore_result(context_);
-  perfetto::base::ignore_result(string_value);
+  perfetto::base::ignore_result(blob);
   PERFETTO_ELOG("Cannot parse JSON trace due to missing JSON support");
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 }
 
-void JsonTraceParser::MaybeAddFlow(TrackId track_id, const Json::Value& event) {
+void JsonTraceParser::MaybeAddFlow(TrackId track_id, const Event& event) {
   PERFETTO_DCHECK(json::IsJsonSupported());
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
-  auto opt_bind_id = MaybeExtractFlowIdentifier(event, /* version2 = */ true);
+  auto opt_bind_id = MaybeExtractFlowIdentifier(event.bind_id);
   if (opt_bind_id) {
     FlowTracker* flow_tracker = context_->flow_tracker.get();
-    bool flow_out = event.isMember("flow_out") && event["flow_out"].asBool();
-    bool flow_in = event.isMember("flow_in") && event["flow_in"].asBool();
+    bool flow_out = CoerceToBool(event.flow_out);
+    bool flow_in = CoerceToBool(event.flow_in);
     if (flow_in && flow_out) {
       flow_tracker->Step(track_id, opt_bind_id.value());
     } else if (flow_out) {
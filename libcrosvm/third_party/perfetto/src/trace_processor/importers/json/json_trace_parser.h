@@ -22,14 +22,12 @@
 #include <memory>
 #include <tuple>
 
+#include "perfetto/ext/base/string_view.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/common/trace_parser.h"
 #include "src/trace_processor/importers/systrace/systrace_line.h"
 #include "src/trace_processor/importers/systrace/systrace_line_parser.h"
 
-namespace Json {
-class Value;
-}
-
 namespace perfetto {
 namespace trace_processor {
 
@@ -43,14 +41,20 @@ class JsonTraceParser : public TraceParser {
   ~JsonTraceParser() override;
 
   // TraceParser implementation.
-  void ParseJsonPacket(int64_t timestamp, std::string string_value) override;
+  void ParseJsonPacket(int64_t timestamp, TraceBlobView event) override;
   void ParseSystraceLine(int64_t timestamp, SystraceLine line) override;
 
  private:
+  struct Event;
+
+  // Reads the fields used by the parser from the JSON dictionary of an event.
+  // Returns false if the dictionary is malformed.
+  static bool ReadEvent(base::StringView dict, Event* event);
+
   TraceProcessorContext* const context_;
   SystraceLineParser systrace_line_parser_;
 
-  void MaybeAddFlow(TrackId track_id, const Json::Value& event);
+  void MaybeAddFlow(TrackId track_id, const Event& event);
 };
 
 }  // namespace trace_processor
@@ -16,12 +16,15 @@
 
 #include "src/trace_processor/importers/json/json_trace_tokenizer.h"
 
+#include <algorithm>
 #include <memory>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/string_utils.h"
 
+#include "perfetto/trace_processor/trace_blob.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/importers/json/json_scanner.h"
 #include "src/trace_processor/importers/json/json_utils.h"
 #include "src/trace_processor/sorter/trace_sorter.h"
 #include "src/trace_processor/storage/stats.h"
@@ -175,6 +178,32 @@ base::Status SetOutAndReturn(const char* ptr, const char** out) {
   return base::OkStatus();
 }
 
+// Coerces the ts of an event to nanoseconds. Unlike json::CoerceToTs, numbers
+// are converted using their decimal representation (rather than as a double)
+// so that large timestamps with a fractional part are not rounded.
+base::Optional<int64_t> CoerceEventTs(const json::RawValue& value) {
+  switch (value.type()) {
+    case json::RawValue::Type::kNumber:
+      return json::CoerceToTs(value.text().ToStdString());
+    case json::RawValue::Type::kString: {
+      std::string storage;
+      base::Optional<base::StringView> str = value.AsString(&storage);
+      return str ? json::CoerceToTs(str->ToStdString()) : base::nullopt;
+    }
+    case json::RawValue::Type::kInvalid:
+    case json::RawValue::Type::kNull:
+    case json::RawValue::Type::kBool:
+    case json::RawValue::Type::kObject:
+    case json::RawValue::Type::kArray:
+      return base::nullopt;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+// The minimum number of bytes of a new chunk appended to |buffer_| when
+// gluing together values spanning multiple chunks.
+constexpr size_t kMinGlueSize = 4096;
+
 }  // namespace
 
 ReadDictRes ReadOneJsonDict(const char* start,
@@ -185,20 +214,22 @@ ReadDictRes ReadOneJsonDict(const char* start,
   int square_brackets = 0;
   const char* dict_begin = nullptr;
   bool in_string = false;
-  bool is_escaping = false;
-  for (const char* s = start; s < end; s++) {
-    if (isspace(*s) || *s == ',')
+  const char* escaped = nullptr;
+  // Only the structural characters ("\{}[]) affect the result so jump
+  // straight to them rather than looking at every character.
+  json::StructuralCharIterator it(start, end);
+  for (const char* s = it.Next(); s != end; s = it.Next()) {
+    if (s == escaped)
       continue;
-    if (*s == '"' && !is_escaping) {
+    if (*s == '"') {
       in_string = !in_string;
       continue;
     }
     if (in_string) {
-      // If we're in a string and we see a backslash and the last character was
-      // not a backslash the next character is escaped:
-      is_escaping = *s == '\\' && !is_escaping;
-      // If we're currently parsing a string we should ignore otherwise special
-      // characters:
+      // If we're in a string and we see a backslash the next character is
+      // escaped. Otherwise special characters should be ignored.
+      if (*s == '\\')
+        escaped = s + 1;
       continue;
     }
     if (*s == '{') {
@@ -440,10 +471,43 @@ JsonTraceTokenizer::~JsonTraceTokenizer() = default;
 base::Status JsonTraceTokenizer::Parse(TraceBlobView blob) {
   PERFETTO_DCHECK(json::IsJsonSupported());
 
-  buffer_.insert(buffer_.end(), blob.data(), blob.data() + blob.size());
-  const char* buf = buffer_.data();
+  size_t blob_offset = 0;
+  if (!buffer_.empty()) {
+    // The previous chunk ended in the middle of a value. Rather than copying
+    // all of |blob| after it, append increasingly large prefixes of |blob|
+    // until the value is complete and then continue parsing directly from
+    // |blob|: this way, only the values spanning chunks are copied.
+    size_t appended = 0;
+    for (;;) {
+      size_t leftover = buffer_.size() - appended;
+      size_t to_append = std::min(blob.size() - appended,
+                                  std::max(buffer_.size(), kMinGlueSize));
+      const char* blob_data = reinterpret_cast<const char*>(blob.data());
+      buffer_.insert(buffer_.end(), blob_data + appended,
+                     blob_data + appended + to_append);
+      appended += to_append;
+
+      const char* buf = buffer_.data();
+      const char* next = buf;
+      RETURN_IF_ERROR(
+          ParseInternal(buf, buf + buffer_.size(), &next, nullptr));
+      size_t consumed = static_cast<size_t>(next - buf);
+      offset_ += consumed;
+      if (consumed >= leftover) {
+        blob_offset = consumed - leftover;
+        buffer_.clear();
+        break;
+      }
+      buffer_.erase(buffer_.begin(),
+                    buffer_.begin() + static_cast<ptrdiff_t>(consumed));
+      if (appended == blob.size())
+        return base::OkStatus();
+    }
+  }
+
+  const char* buf = reinterpret_cast<const char*>(blob.data()) + blob_offset;
   const char* next = buf;
-  const char* end = buf + buffer_.size();
+  const char* end = reinterpret_cast<const char*>(blob.data()) + blob.size();
 
   if (offset_ == 0) {
     // Strip leading whitespace.
@@ -477,25 +541,26 @@ base::Status JsonTraceTokenizer::Parse(TraceBlobView blob) {
                     ? TracePosition::kDictionaryKey
                     : TracePosition::kInsideTraceEventsArray;
   }
-  RETURN_IF_ERROR(ParseInternal(next, end, &next));
+  RETURN_IF_ERROR(ParseInternal(next, end, &next, &blob));
 
   offset_ += static_cast<uint64_t>(next - buf);
-  buffer_.erase(buffer_.begin(), buffer_.begin() + (next - buf));
+  buffer_.assign(next, end);
   return base::OkStatus();
 }
 
 base::Status JsonTraceTokenizer::ParseInternal(const char* start,
                                                const char* end,
-                                               const char** out) {
+                                               const char** out,
+                                               const TraceBlobView* blob) {
   PERFETTO_DCHECK(json::IsJsonSupported());
 
   switch (position_) {
     case TracePosition::kDictionaryKey:
-      return HandleDictionaryKey(start, end, out);
+      return HandleDictionaryKey(start, end, out, blob);
     case TracePosition::kInsideSystemTraceEventsString:
-      return HandleSystemTraceEvent(start, end, out);
+      return HandleSystemTraceEvent(start, end, out, blob);
     case TracePosition::kInsideTraceEventsArray:
-      return HandleTraceEvent(start, end, out);
+      return HandleTraceEvent(start, end, out, blob);
     case TracePosition::kEof: {
       return start == end
                  ? base::OkStatus()
@@ -508,7 +573,8 @@ base::Status JsonTraceTokenizer::ParseInternal(const char* start,
 
 base::Status JsonTraceTokenizer::HandleTraceEvent(const char* start,
                                                   const char* end,
-                                                  const char** out) {
+                                                  const char** out,
+                                                  const TraceBlobView* blob) {
   for (const char* next = start; next < end;) {
     base::StringView unparsed;
     switch (ReadOneJsonDict(next, end, &unparsed, &next)) {
@@ -519,7 +585,7 @@ base::Status JsonTraceTokenizer::HandleTraceEvent(const char* start,
         }
 
         position_ = TracePosition::kDictionaryKey;
-        return ParseInternal(next, end, out);
+        return ParseInternal(next, end, out, blob);
       }
       case ReadDictRes::kEndOfTrace:
         position_ = TracePosition::kEof;
@@ -530,30 +596,52 @@ base::Status JsonTraceTokenizer::HandleTraceEvent(const char* start,
         break;
     }
 
-    base::Optional<std::string> opt_raw_ts;
-    RETURN_IF_ERROR(ExtractValueForJsonKey(unparsed, "ts", &opt_raw_ts));
-    base::Optional<int64_t> opt_ts =
-        opt_raw_ts ? json::CoerceToTs(*opt_raw_ts) : base::nullopt;
+    // Only the ts (and, for events without a ts, the ph) is needed here so
+    // stop as soon as it is found rather than scanning the rest of the event.
+    json::DictIterator it(unparsed);
+    bool found_ts = false;
+    base::Optional<int64_t> opt_ts;
+    bool is_metadata = false;
+    while (it.Next()) {
+      if (it.key() == "ts" && !found_ts) {
+        found_ts = true;
+        opt_ts = CoerceEventTs(it.value());
+        if (opt_ts)
+          break;
+      } else if (it.key() == "ph") {
+        std::string storage;
+        base::Optional<base::StringView> ph = it.value().AsString(&storage);
+        is_metadata = ph && *ph == "M";
+      }
+    }
+    if (!it.ok())
+      return base::ErrStatus("Failure parsing JSON: malformed trace event");
+
     int64_t ts = 0;
     if (opt_ts.has_value()) {
       ts = opt_ts.value();
-    } else {
+    } else if (!is_metadata) {
       // Metadata events may omit ts. In all other cases error:
-      base::Optional<std::string> opt_raw_ph;
-      RETURN_IF_ERROR(ExtractValueForJsonKey(unparsed, "ph", &opt_raw_ph));
-      if (!opt_raw_ph || *opt_raw_ph != "M") {
-        context_->storage->IncrementStats(stats::json_tokenizer_failure);
-        continue;
-      }
+      context_->storage->IncrementStats(stats::json_tokenizer_failure);
+      continue;
     }
-    context_->sorter->PushJsonValue(ts, unparsed.ToStdString());
+
+    // Events which are fully inside |blob| are passed on without copying.
+    TraceBlobView event =
+        blob ? blob->slice(reinterpret_cast<const uint8_t*>(unparsed.data()),
+                           unparsed.size())
+             : TraceBlobView(
+                   TraceBlob::CopyFrom(unparsed.data(), unparsed.size()));
+    context_->sorter->PushJsonValue(ts, std::move(event));
   }
-  return base::OkStatus();
+  return SetOutAndReturn(end, out);
 }
 
-base::Status JsonTraceTokenizer::HandleDictionaryKey(const char* start,
-                                                     const char* end,
-                                                     const char** out) {
+base::Status JsonTraceTokenizer::HandleDictionaryKey(
+    const char* start,
+    const char* end,
+    const char** out,
+    const TraceBlobView* blob) {
   if (format_ != TraceFormat::kOuterDictionary) {
     return base::ErrStatus(
         "Failure parsing JSON: illegal format when parsing dictionary key");
@@ -587,7 +675,7 @@ base::Status JsonTraceTokenizer::HandleDictionaryKey(const char* start,
     next++;
 
     position_ = TracePosition::kInsideTraceEventsArray;
-    return ParseInternal(next, end, out);
+    return ParseInternal(next, end, out, blob);
   }
 
   if (key == "systemTraceEvents") {
@@ -599,7 +687,7 @@ base::Status JsonTraceTokenizer::HandleDictionaryKey(const char* start,
     next++;
 
     position_ = TracePosition::kInsideSystemTraceEventsString;
-    return ParseInternal(next, end, out);
+    return ParseInternal(next, end, out, blob);
   }
 
   if (key == "displayTimeUnit") {
@@ -607,8 +695,11 @@ base::Status JsonTraceTokenizer::HandleDictionaryKey(const char* start,
     auto result = ReadOneJsonString(next, end, &time_unit, &next);
     if (result == ReadStringRes::kFatalError)
       return base::ErrStatus("Could not parse displayTimeUnit");
+    // Read the key again once the whole value is available.
+    if (result == ReadStringRes::kNeedsMoreData)
+      return SetOutAndReturn(start, out);
     context_->storage->IncrementStats(stats::json_display_time_unit);
-    return ParseInternal(next, end, out);
+    return ParseInternal(next, end, out, blob);
   }
 
   // If we don't know the key for this JSON value just skip it.
@@ -618,16 +709,19 @@ base::Status JsonTraceTokenizer::HandleDictionaryKey(const char* start,
           "Failure parsing JSON: error while parsing value for key %s",
           key.c_str());
     case SkipValueRes::kNeedsMoreData:
-      return SetOutAndReturn(next, out);
+      // Read the key again once the whole value is available.
+      return SetOutAndReturn(start, out);
     case SkipValueRes::kEndOfValue:
-      return ParseInternal(next, end, out);
+      return ParseInternal(next, end, out, blob);
   }
   PERFETTO_FATAL("For GCC");
 }
 
-base::Status JsonTraceTokenizer::HandleSystemTraceEvent(const char* start,
-                                                        const char* end,
-                                                        const char** out) {
+base::Status JsonTraceTokenizer::HandleSystemTraceEvent(
+    const char* start,
+    const char* end,
+    const char** out,
+    const TraceBlobView* blob) {
   if (format_ != TraceFormat::kOuterDictionary) {
     return base::ErrStatus(
         "Failure parsing JSON: illegal format when parsing system events");
@@ -645,7 +739,7 @@ base::Status JsonTraceTokenizer::HandleSystemTraceEvent(const char* start,
         return SetOutAndReturn(next, out);
       case ReadSystemLineRes::kEndOfSystemTrace:
         position_ = TracePosition::kDictionaryKey;
-        return ParseInternal(next, end, out);
+        return ParseInternal(next, end, out, blob);
       case ReadSystemLineRes::kFoundLine:
         break;
     }
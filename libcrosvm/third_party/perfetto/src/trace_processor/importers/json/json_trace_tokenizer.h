@@ -133,21 +133,28 @@ class JsonTraceTokenizer : public ChunkedTraceReader {
     kEof,
   };
 
+  // |blob| is the chunk which [start, end) points into (in which case trace
+  // events are passed to the sorter as slices of it) or nullptr if the data
+  // is in |buffer_| (in which case trace events are copied).
   base::Status ParseInternal(const char* start,
                              const char* end,
-                             const char** out);
+                             const char** out,
+                             const TraceBlobView* blob);
 
   base::Status HandleTraceEvent(const char* start,
                                 const char* end,
-                                const char** out);
+                                const char** out,
+                                const TraceBlobView* blob);
 
   base::Status HandleDictionaryKey(const char* start,
                                    const char* end,
-                                   const char** out);
+                                   const char** out,
+                                   const TraceBlobView* blob);
 
   base::Status HandleSystemTraceEvent(const char* start,
                                       const char* end,
-                                      const char** out);
+                                      const char** out,
+                                      const TraceBlobView* blob);
 
   TraceProcessorContext* const context_;
 
@@ -157,8 +164,8 @@ class JsonTraceTokenizer : public ChunkedTraceReader {
   SystraceLineTokenizer systrace_line_tokenizer_;
 
   uint64_t offset_ = 0;
-  // Used to glue together JSON objects that span across two (or more)
-  // Parse boundaries.
+  // Holds the unparsed data at the end of the previous chunk. Used to glue
+  // together JSON objects that span across two (or more) Parse boundaries.
   std::vector<char> buffer_;
 };
 
@@ -53,6 +53,28 @@ TEST(JsonTraceTokenizerTest, ReadDictQuotedBraces) {
   ASSERT_EQ(parsed["foo"].asString(), "}\"bar{\\");
 }
 
+TEST(JsonTraceTokenizerTest, ReadDictLongEscapedStrings) {
+  // Strings long enough that escapes and quotes straddle the blocks used when
+  // looking for structural characters.
+  std::string foo = std::string(61, 'a') + "\\\\" + std::string(70, '}');
+  std::string bar = std::string(62, '[') + "\\\"" + std::string(3, '{');
+  std::string dict = R"({"foo": ")" + foo + R"(", "bar": ")" + bar + R"("})";
+  const char* start = dict.data();
+  const char* end = start + dict.size();
+  const char* next = nullptr;
+  base::StringView value;
+  ReadDictRes result = ReadOneJsonDict(start, end, &value, &next);
+
+  ASSERT_EQ(result, ReadDictRes::kFoundDict);
+  ASSERT_EQ(next, end);
+
+  Json::Value parsed = *json::ParseJsonString(value);
+  ASSERT_EQ(parsed["foo"].asString(), std::string(61, 'a') + "\\" +
+                                          std::string(70, '}'));
+  ASSERT_EQ(parsed["bar"].asString(),
+            std::string(62, '[') + "\"" + std::string(3, '{'));
+}
+
 TEST(JsonTraceTokenizerTest, ReadDictTwoDicts) {
   const char* start = R"({"foo": 1}, {"bar": 2})";
   const char* middle = start + strlen(R"({"foo": 1})");
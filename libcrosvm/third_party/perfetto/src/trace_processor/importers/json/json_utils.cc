@@ -20,9 +20,10 @@
 
 #include <limits>
 
+#include "perfetto/ext/base/string_utils.h"
+
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 #include <json/reader.h>
-#include "perfetto/ext/base/string_utils.h"
 #endif
 
 namespace perfetto {
@@ -123,6 +124,95 @@ base::Optional<uint32_t> CoerceToUint32(const Json::Value& value) {
 #endif
 }
 
+namespace {
+
+// Returns true if the number should be treated as an integer rather than as
+// a double (i.e. jsoncpp would parse it as an intValue or uintValue).
+bool IsIntegerNumber(base::StringView text) {
+  for (char c : text) {
+    if (c == '.' || c == 'e' || c == 'E')
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+base::Optional<int64_t> CoerceToTs(const RawValue& value) {
+  switch (value.type()) {
+    case RawValue::Type::kNumber: {
+      std::string text = value.text().ToStdString();
+      if (IsIntegerNumber(value.text())) {
+        base::Optional<int64_t> n = base::CStringToInt64(text.c_str());
+        return n ? base::make_optional(*n * 1000) : base::nullopt;
+      }
+      base::Optional<double> d = base::CStringToDouble(text.c_str());
+      return d ? base::make_optional(static_cast<int64_t>(*d * 1000.0))
+               : base::nullopt;
+    }
+    case RawValue::Type::kString: {
+      std::string storage;
+      base::Optional<base::StringView> s = value.AsString(&storage);
+      return s ? CoerceToTs(s->ToStdString()) : base::nullopt;
+    }
+    case RawValue::Type::kInvalid:
+    case RawValue::Type::kNull:
+    case RawValue::Type::kBool:
+    case RawValue::Type::kObject:
+    case RawValue::Type::kArray:
+      return base::nullopt;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+base::Optional<int64_t> CoerceToInt64(const RawValue& value) {
+  switch (value.type()) {
+    case RawValue::Type::kNumber: {
+      std::string text = value.text().ToStdString();
+      if (IsIntegerNumber(value.text())) {
+        if (text[0] == '-')
+          return base::CStringToInt64(text.c_str());
+        // Like jsoncpp's uintValue, positive values which don't fit in an
+        // int64 wrap around.
+        base::Optional<uint64_t> n = base::CStringToUInt64(text.c_str());
+        return n ? base::make_optional(static_cast<int64_t>(*n))
+                 : base::nullopt;
+      }
+      base::Optional<double> d = base::CStringToDouble(text.c_str());
+      return d ? base::make_optional(static_cast<int64_t>(*d)) : base::nullopt;
+    }
+    case RawValue::Type::kString: {
+      std::string storage;
+      base::Optional<base::StringView> s = value.AsString(&storage);
+      if (!s)
+        return base::nullopt;
+      std::string str = s->ToStdString();
+      char* end;
+      int64_t n = strtoll(str.c_str(), &end, 10);
+      if (end != str.data() + str.size())
+        return base::nullopt;
+      return n;
+    }
+    case RawValue::Type::kInvalid:
+    case RawValue::Type::kNull:
+    case RawValue::Type::kBool:
+    case RawValue::Type::kObject:
+    case RawValue::Type::kArray:
+      return base::nullopt;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+base::Optional<uint32_t> CoerceToUint32(const RawValue& value) {
+  base::Optional<int64_t> result = CoerceToInt64(value);
+  if (!result.has_value())
+    return base::nullopt;
+  int64_t n = result.value();
+  if (n < 0 || n > std::numeric_limits<uint32_t>::max())
+    return base::nullopt;
+  return static_cast<uint32_t>(n);
+}
+
 base::Optional<Json::Value> ParseJsonString(base::StringView raw_string) {
   PERFETTO_DCHECK(IsJsonSupported());
 
@@ -23,6 +23,7 @@
 #include "perfetto/ext/base/string_view.h"
 
 #include "src/trace_processor/importers/common/args_tracker.h"
+#include "src/trace_processor/importers/json/json_scanner.h"
 
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 #include <json/value.h>
@@ -45,6 +46,13 @@ base::Optional<int64_t> CoerceToTs(const std::string& value);
 base::Optional<int64_t> CoerceToInt64(const Json::Value& value);
 base::Optional<uint32_t> CoerceToUint32(const Json::Value& value);
 
+// Same as above but for values read in place from the JSON text. These follow
+// the same rules as the Json::Value versions so both can be used
+// interchangeably.
+base::Optional<int64_t> CoerceToTs(const RawValue& value);
+base::Optional<int64_t> CoerceToInt64(const RawValue& value);
+base::Optional<uint32_t> CoerceToUint32(const RawValue& value);
+
 // Parses the given JSON string into a JSON::Value object.
 // This function should only be called if |IsJsonSupported()| returns true.
 base::Optional<Json::Value> ParseJsonString(base::StringView raw_string);
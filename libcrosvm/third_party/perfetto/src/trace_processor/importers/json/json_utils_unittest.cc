@@ -56,6 +56,25 @@ TEST(JsonTraceUtilsTest, CoerceToTs) {
   ASSERT_FALSE(CoerceToTs(Json::Value("1234!")).has_value());
 }
 
+TEST(JsonTraceUtilsTest, CoerceRawValue) {
+  ASSERT_EQ(CoerceToUint32(RawValue("42")).value_or(0), 42u);
+  ASSERT_EQ(CoerceToUint32(RawValue("\"42\"")).value_or(0), 42u);
+  ASSERT_FALSE(CoerceToUint32(RawValue("-1")).has_value());
+
+  ASSERT_EQ(CoerceToInt64(RawValue("-42")).value_or(0), -42);
+  ASSERT_EQ(CoerceToInt64(RawValue("42.1")).value_or(-1), 42);
+  ASSERT_EQ(CoerceToInt64(RawValue("18446744073709551615")).value_or(0), -1);
+  ASSERT_FALSE(CoerceToInt64(RawValue("\"1234!\"")).has_value());
+  ASSERT_FALSE(CoerceToInt64(RawValue("null")).has_value());
+
+  ASSERT_EQ(CoerceToTs(RawValue("42")).value_or(-1), 42000);
+  ASSERT_EQ(CoerceToTs(RawValue("42.1")).value_or(-1), 42100);
+  ASSERT_EQ(CoerceToTs(RawValue("4.2e1")).value_or(-1), 42000);
+  ASSERT_EQ(CoerceToTs(RawValue("\"42.1\"")).value_or(-1), 42100);
+  ASSERT_FALSE(CoerceToTs(RawValue("true")).has_value());
+  ASSERT_FALSE(CoerceToTs(RawValue("{}")).has_value());
+}
+
 }  // namespace
 }  // namespace json
 }  // namespace trace_processor
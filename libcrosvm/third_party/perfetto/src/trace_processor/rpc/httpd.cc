@@ -20,9 +20,21 @@
 
 #include "src/trace_processor/rpc/httpd.h"
 
+#include <string.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/compiler.h"
 #include "perfetto/ext/base/http/http_server.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/unix_task_runner.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
@@ -38,6 +50,11 @@ namespace {
 
 constexpr int kBindPort = 9001;
 
+// HTTP requests are routed to the session named by this header. Requests
+// without it (and websockets connected to plain /websocket) use the default
+// session, which is also the one holding the preloaded trace, if any.
+constexpr char kSessionIdHeader[] = "x-tp-session-id";
+
 // Sets the Access-Control-Allow-Origin: $origin on the following origins.
 // This affects only browser clients that use CORS. Other HTTP clients (e.g. the
 // python API) don't look at CORS headers.
@@ -47,6 +64,81 @@ const char* kAllowedCORSOrigins[] = {
     "http://127.0.0.1:10000",
 };
 
+struct Session;
+
+// A client connection. Requests are handled on the worker thread of a
+// session, which only holds a reference to this rather than to the connection
+// itself: the latter is destroyed as soon as the client disconnects.
+struct Client {
+  explicit Client(base::HttpServerConnection* c) : conn(c) {}
+
+  // Only accessed on the HTTP thread and only if |disconnected| is false.
+  base::HttpServerConnection* const conn;
+  std::atomic<bool> disconnected{false};
+
+  // The session the websocket (if this is one) is bound to. Only accessed on
+  // the HTTP thread.
+  std::shared_ptr<Session> websocket_session;
+};
+
+// A trace loaded into its own TraceProcessor instance. Each session has its
+// own worker thread, which runs the requests for the session one at a time in
+// the order they were received, while the requests for different sessions run
+// concurrently. This relies on SQLite being built with SQLITE_THREADSAFE=2:
+// each TraceProcessor instance has its own connection, which is only ever used
+// by one thread at a time.
+// The Rpc is created lazily and destroyed on the worker, as both can take a
+// while for large traces (see Httpd::CreateSession()).
+struct Session {
+  Session(std::unique_ptr<Rpc> r, std::vector<uint8_t> s)
+      : rpc(std::move(r)),
+        status(std::move(s)),
+        worker(base::ThreadTaskRunner::CreateAndStart("TPHttpdSession")) {}
+
+  // Interrupts the query currently running in the session, if any. Can be
+  // called on any thread.
+  void InterruptQuery() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (rpc)
+      rpc->InterruptQuery();
+  }
+
+  // Runs |fn| on behalf of |client|, unless it has disconnected by then.
+  // Called on |worker|.
+  void RunTask(const Client* client, const std::function<void(Rpc*)>& fn) {
+    // |rpc| is only ever replaced on the worker, so it can be read without
+    // holding the lock here.
+    std::unique_ptr<Rpc> new_rpc;
+    if (!rpc)
+      new_rpc.reset(new Rpc());
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      active_client = client;
+      if (new_rpc)
+        rpc = std::move(new_rpc);
+    }
+    if (!client->disconnected)
+      fn(rpc.get());
+    std::vector<uint8_t> new_status = rpc->GetStatus();
+    std::lock_guard<std::mutex> lock(mutex);
+    active_client = nullptr;
+    status = std::move(new_status);
+  }
+
+  std::unique_ptr<Rpc> rpc;  // Only replaced with |mutex| held.
+  std::mutex mutex;
+  const Client* active_client = nullptr;  // Guarded by |mutex|.
+
+  // The result of Rpc::GetStatus() as of the end of the last request. /status
+  // is answered from this on the HTTP thread, without waiting for the queries
+  // queued for the session. Guarded by |mutex|.
+  std::vector<uint8_t> status;
+
+  // Declared last so that the thread is joined before the members above are
+  // destroyed.
+  base::ThreadTaskRunner worker;
+};
+
 class Httpd : public base::HttpRequestHandler {
  public:
   explicit Httpd(std::unique_ptr<TraceProcessor>);
@@ -57,42 +149,174 @@ class Httpd : public base::HttpRequestHandler {
   // HttpRequestHandler implementation.
   void OnHttpRequest(const base::HttpRequest&) override;
   void OnWebsocketMessage(const base::WebsocketMessage&) override;
+  void OnHttpConnectionClosed(base::HttpServerConnection*) override;
 
   void ServeHelpPage(const base::HttpRequest&);
 
-  Rpc trace_processor_rpc_;
+  std::shared_ptr<Client> GetOrCreateClient(base::HttpServerConnection*);
+  std::shared_ptr<Session> GetOrCreateSession(const std::string& id);
+
+  // Creates a session whose TraceProcessor instance is destroyed on its worker
+  // thread, after the requests still queued for it, once the last reference
+  // to the session is dropped. The session itself (and so the worker thread)
+  // is then destroyed on the HTTP thread.
+  std::shared_ptr<Session> CreateSession(std::unique_ptr<Rpc>,
+                                         std::vector<uint8_t> status);
+
+  // Queues |fn| to be run on the worker of |session| after all the requests
+  // previously posted to it. |fn| is skipped if |client| disconnects before
+  // it gets to run.
+  void PostToSession(const std::shared_ptr<Session>&,
+                     std::shared_ptr<Client>,
+                     std::function<void(Rpc*)> fn);
+
+  // Runs a request of the byte-pipe RPC interface, forwarding the responses to
+  // |client|. Called on the worker thread of a session.
+  void RunRpcRequest(Rpc*, std::shared_ptr<Client>, const std::string& req);
+
   base::UnixTaskRunner task_runner_;
   base::HttpServer http_srv_;
-};
 
-base::HttpServerConnection* g_cur_conn;
+  // Only accessed on the HTTP thread.
+  std::map<std::string, std::shared_ptr<Session>> sessions_;
+  std::map<base::HttpServerConnection*, std::shared_ptr<Client>> clients_;
+
+  // The status of a session in which no trace has been loaded yet.
+  std::vector<uint8_t> empty_status_;
+};
 
 base::StringView Vec2Sv(const std::vector<uint8_t>& v) {
   return base::StringView(reinterpret_cast<const char*>(v.data()), v.size());
 }
 
+const uint8_t* Bytes(const std::string& s) {
+  return reinterpret_cast<const uint8_t*>(s.data());
+}
+
+void SendProtoResponse(base::HttpServerConnection* conn,
+                       base::StringView body = {}) {
+  conn->SendResponse("200 OK",
+                     {
+                         "Cache-Control: no-cache",               //
+                         "Content-Type: application/x-protobuf",  //
+                         "Transfer-Encoding: identity",           //
+                     },
+                     body);
+}
+
+// Sends the response of a request for which DeferResponse() was called.
+void SendDeferredProtoResponse(base::HttpServerConnection* conn,
+                               base::StringView body = {}) {
+  SendProtoResponse(conn, body);
+  conn->EndDeferredResponse();
+}
+
+void SendChunkedResponseHeaders(base::HttpServerConnection* conn) {
+  conn->SendResponseHeaders("200 OK",
+                            {
+                                "Cache-Control: no-cache",               //
+                                "Content-Type: application/x-protobuf",  //
+                                "Transfer-Encoding: chunked",            //
+                            },
+                            base::HttpServerConnection::kOmitContentLength);
+}
+
+// Can be called on any thread. Runs |fn| on the HTTP thread, unless |client|
+// has disconnected by then.
+void PostToClient(base::TaskRunner* task_runner,
+                  std::shared_ptr<Client> client,
+                  std::function<void(base::HttpServerConnection*)> fn) {
+  task_runner->PostTask([client, fn] {
+    if (!client->disconnected)
+      fn(client->conn);
+  });
+}
+
+// Collects the output of an Rpc instance running on the worker of a session and
+// streams it to the client, either as websocket messages or as the chunks of
+// a HTTP response with chunked transfer encoding.
+class RpcResponseSink {
+ public:
+  RpcResponseSink(base::TaskRunner* task_runner, std::shared_ptr<Client> client)
+      : task_runner_(task_runner), client_(std::move(client)) {}
+
+  void Append(const void* data, size_t len) {
+    const uint8_t* begin = static_cast<const uint8_t*>(data);
+    buf_.insert(buf_.end(), begin, begin + len);
+  }
+
+  void Flush() {
+    if (buf_.empty())
+      return;
+    PostToClient(task_runner_, client_,
+                 [data = std::move(buf_)](base::HttpServerConnection* conn) {
+                   if (conn->is_websocket()) {
+                     conn->SendWebsocketMessage(data.data(), data.size());
+                     return;
+                   }
+                   base::StackString<32> chunk_hdr("%zx\r\n", data.size());
+                   conn->SendResponseBody(chunk_hdr.c_str(), chunk_hdr.len());
+                   conn->SendResponseBody(data.data(), data.size());
+                   conn->SendResponseBody("\r\n", 2);
+                 });
+    buf_.clear();
+  }
+
+  // Flushes the pending data and, for HTTP, terminates the chunked response.
+  // If |close| is true, the connection is closed afterwards.
+  void Finish(bool close = false) {
+    if (finished_)
+      return;
+    finished_ = true;
+    Flush();
+    PostToClient(task_runner_, client_,
+                 [close](base::HttpServerConnection* conn) {
+                   if (conn->is_websocket()) {
+                     if (close)
+                       conn->Close();
+                     return;
+                   }
+                   conn->SendResponseBody("0\r\n\r\n", 5);
+                   if (close) {
+                     conn->Close();
+                   } else {
+                     conn->EndDeferredResponse();
+                   }
+                 });
+  }
+
+ private:
+  base::TaskRunner* const task_runner_;
+  const std::shared_ptr<Client> client_;
+  std::vector<uint8_t> buf_;
+  bool finished_ = false;
+};
+
+// The sink of the RPC request being run on the current thread.
+PERFETTO_THREAD_LOCAL RpcResponseSink* g_cur_sink;
+
 // Used both by websockets and /rpc chunked HTTP endpoints.
 void SendRpcChunk(const void* data, uint32_t len) {
   if (data == nullptr) {
     // Unrecoverable RPC error case.
-    if (!g_cur_conn->is_websocket())
-      g_cur_conn->SendResponseBody("0\r\n\r\n", 5);
-    g_cur_conn->Close();
+    g_cur_sink->Finish(/*close=*/true);
     return;
   }
-  if (g_cur_conn->is_websocket()) {
-    g_cur_conn->SendWebsocketMessage(data, len);
-  } else {
-    base::StackString<32> chunk_hdr("%x\r\n", len);
-    g_cur_conn->SendResponseBody(chunk_hdr.c_str(), chunk_hdr.len());
-    g_cur_conn->SendResponseBody(data, len);
-    g_cur_conn->SendResponseBody("\r\n", 2);
-  }
+  // Rpc sends each response message (e.g. each batch of query results) as soon
+  // as it is serialized, in fragments of ~128KB. Forward them right away, so
+  // the first rows of a query don't wait for the following batches.
+  g_cur_sink->Append(data, len);
+  g_cur_sink->Flush();
 }
 
 Httpd::Httpd(std::unique_ptr<TraceProcessor> preloaded_instance)
-    : trace_processor_rpc_(std::move(preloaded_instance)),
-      http_srv_(&task_runner_, this) {}
+    : http_srv_(&task_runner_, this) {
+  // The default session is created upfront to hold the preloaded instance.
+  empty_status_ = Rpc().GetStatus();
+  std::unique_ptr<Rpc> rpc(new Rpc(std::move(preloaded_instance)));
+  std::vector<uint8_t> status = rpc->GetStatus();
+  sessions_[""] = CreateSession(std::move(rpc), std::move(status));
+}
 Httpd::~Httpd() = default;
 
 void Httpd::Run(int port) {
@@ -109,6 +333,63 @@ void Httpd::Run(int port) {
   task_runner_.Run();
 }
 
+std::shared_ptr<Client> Httpd::GetOrCreateClient(
+    base::HttpServerConnection* conn) {
+  std::shared_ptr<Client>& client = clients_[conn];
+  if (!client)
+    client = std::make_shared<Client>(conn);
+  return client;
+}
+
+std::shared_ptr<Session> Httpd::GetOrCreateSession(const std::string& id) {
+  std::shared_ptr<Session>& session = sessions_[id];
+  if (!session) {
+    PERFETTO_ILOG("[HTTP] Creating session \"%s\"", id.c_str());
+    session = CreateSession(nullptr, empty_status_);
+  }
+  return session;
+}
+
+std::shared_ptr<Session> Httpd::CreateSession(std::unique_ptr<Rpc> rpc,
+                                              std::vector<uint8_t> status) {
+  // The deleter only posts tasks, so the last reference can be dropped on any
+  // thread.
+  base::TaskRunner* task_runner = &task_runner_;
+  return std::shared_ptr<Session>(
+      new Session(std::move(rpc), std::move(status)),
+      [task_runner](Session* session) {
+        session->worker.PostTask([session, task_runner] {
+          session->rpc.reset();
+          task_runner->PostTask([session] { delete session; });
+        });
+      });
+}
+
+void Httpd::PostToSession(const std::shared_ptr<Session>& session,
+                          std::shared_ptr<Client> client,
+                          std::function<void(Rpc*)> fn) {
+  // The session outlives the tasks posted to its worker (see CreateSession()),
+  // so they don't need to hold a reference to it.
+  Session* raw_session = session.get();
+  session->worker.PostTask([raw_session, client, fn] {
+    raw_session->RunTask(client.get(), fn);
+  });
+}
+
+void Httpd::RunRpcRequest(Rpc* rpc,
+                          std::shared_ptr<Client> client,
+                          const std::string& req) {
+  RpcResponseSink sink(&task_runner_, std::move(client));
+  PERFETTO_CHECK(g_cur_sink == nullptr);
+  g_cur_sink = &sink;
+  rpc->SetRpcResponseFunction(SendRpcChunk);
+  // OnRpcRequest() will call SendRpcChunk() one or more times.
+  rpc->OnRpcRequest(req.data(), req.size());
+  rpc->SetRpcResponseFunction(nullptr);
+  g_cur_sink = nullptr;
+  sink.Finish();
+}
+
 void Httpd::OnHttpRequest(const base::HttpRequest& req) {
   base::HttpServerConnection& conn = *req.conn;
   if (req.uri == "/") {
@@ -126,25 +407,66 @@ void Httpd::OnHttpRequest(const base::HttpRequest& req) {
     last_req_id = seq_id;
   }
 
-  // This is the default. Overridden by the /query handler for chunked replies.
-  char transfer_encoding_hdr[255] = "Transfer-Encoding: identity";
-  std::initializer_list<const char*> headers = {
-      "Cache-Control: no-cache",               //
-      "Content-Type: application/x-protobuf",  //
-      transfer_encoding_hdr,                   //
-  };
-
-  if (req.uri == "/status") {
-    auto status = trace_processor_rpc_.GetStatus();
-    return conn.SendResponse("200 OK", headers, Vec2Sv(status));
-  }
-
-  if (req.uri == "/websocket" && req.is_websocket_handshake) {
+  std::string session_id = req.GetHeader(kSessionIdHeader)
+                               .value_or(base::StringView())
+                               .ToStdString();
+
+  static constexpr char kWebsocketPrefix[] = "/websocket/";
+  if ((req.uri == "/websocket" || req.uri.StartsWith(kWebsocketPrefix)) &&
+      req.is_websocket_handshake) {
+    // Browsers can't set headers on websockets, so the session is chosen by
+    // connecting to /websocket/$session_id instead. All the messages of the
+    // websocket go to that session.
+    if (req.uri.size() > strlen(kWebsocketPrefix))
+      session_id = req.uri.substr(strlen(kWebsocketPrefix)).ToStdString();
+    std::shared_ptr<Client> client = GetOrCreateClient(req.conn);
+    client->websocket_session = GetOrCreateSession(session_id);
     // Will trigger OnWebsocketMessage() when is received.
     // It returns a 403 if the origin is not in kAllowedCORSOrigins.
     return conn.UpgradeToWebsocket(req);
   }
 
+  // Interrupts the query currently running in the session. This is handled
+  // right away on the HTTP thread, without waiting for the session.
+  if (req.uri == "/cancel") {
+    auto it = sessions_.find(session_id);
+    if (it != sessions_.end())
+      it->second->InterruptQuery();
+    return SendProtoResponse(req.conn);
+  }
+
+  // Drops the session and the trace loaded in it. The trace processor
+  // instance is destroyed once the requests still queued for it are done.
+  if (req.uri == "/close_session") {
+    auto it = sessions_.find(session_id);
+    if (it != sessions_.end()) {
+      PERFETTO_ILOG("[HTTP] Closing session \"%s\"", session_id.c_str());
+      it->second->InterruptQuery();
+      sessions_.erase(it);
+    }
+    return SendProtoResponse(req.conn);
+  }
+
+  // Answered from the status cached at the end of the last request of the
+  // session, so that it doesn't wait behind long queries.
+  if (req.uri == "/status") {
+    auto it = sessions_.find(session_id);
+    std::vector<uint8_t> status = empty_status_;
+    if (it != sessions_.end()) {
+      std::lock_guard<std::mutex> lock(it->second->mutex);
+      status = it->second->status;
+    }
+    return SendProtoResponse(req.conn, Vec2Sv(status));
+  }
+
+  // All the endpoints below are served on the worker of the session and reply
+  // asynchronously. The request body is only valid until this function
+  // returns, so it needs to be copied.
+  std::shared_ptr<Client> client = GetOrCreateClient(req.conn);
+  std::string body = req.body.ToStdString();
+  base::TaskRunner* task_runner = &task_runner_;
+  std::function<void(Rpc*)> handler;
+
   // --- Everything below this line is a legacy endpoint not used by the UI.
   // There are two generations of pre-websocket legacy-ness:
   // 1. The /rpc based endpoint. This is based on a chunked transfer, doing one
@@ -154,103 +476,122 @@ void Httpd::OnHttpRequest(const base::HttpRequest& req) {
   //    This is unused and will be removed at some point.
 
   if (req.uri == "/rpc") {
-    // Start the chunked reply.
-    base::StringCopy(transfer_encoding_hdr, "Transfer-Encoding: chunked",
-                     sizeof(transfer_encoding_hdr));
-    conn.SendResponseHeaders("200 OK", headers,
-                             base::HttpServerConnection::kOmitContentLength);
-    PERFETTO_CHECK(g_cur_conn == nullptr);
-    g_cur_conn = req.conn;
-    trace_processor_rpc_.SetRpcResponseFunction(SendRpcChunk);
-    // OnRpcRequest() will call SendRpcChunk() one or more times.
-    trace_processor_rpc_.OnRpcRequest(req.body.data(), req.body.size());
-    trace_processor_rpc_.SetRpcResponseFunction(nullptr);
-    g_cur_conn = nullptr;
-
-    // Terminate chunked stream.
-    conn.SendResponseBody("0\r\n\r\n", 5);
-    return;
-  }
-
-  if (req.uri == "/parse") {
-    base::Status status = trace_processor_rpc_.Parse(
-        reinterpret_cast<const uint8_t*>(req.body.data()), req.body.size());
-    protozero::HeapBuffered<protos::pbzero::AppendTraceDataResult> result;
-    if (!status.ok()) {
-      result->set_error(status.c_message());
-    }
-    return conn.SendResponse("200 OK", headers,
-                             Vec2Sv(result.SerializeAsArray()));
-  }
-
-  if (req.uri == "/notify_eof") {
-    trace_processor_rpc_.NotifyEndOfFile();
-    return conn.SendResponse("200 OK", headers);
-  }
-
-  if (req.uri == "/restore_initial_tables") {
-    trace_processor_rpc_.RestoreInitialTables();
-    return conn.SendResponse("200 OK", headers);
+    handler = [this, client, body](Rpc* rpc) {
+      // Start the chunked reply.
+      PostToClient(&task_runner_, client, SendChunkedResponseHeaders);
+      RunRpcRequest(rpc, client, body);
+    };
+  } else if (req.uri == "/parse") {
+    handler = [task_runner, client, body](Rpc* rpc) {
+      base::Status status = rpc->Parse(Bytes(body), body.size());
+      protozero::HeapBuffered<protos::pbzero::AppendTraceDataResult> result;
+      if (!status.ok()) {
+        result->set_error(status.c_message());
+      }
+      std::vector<uint8_t> res = result.SerializeAsArray();
+      PostToClient(task_runner, client, [res](base::HttpServerConnection* c) {
+        SendDeferredProtoResponse(c, Vec2Sv(res));
+      });
+    };
+  } else if (req.uri == "/notify_eof") {
+    handler = [task_runner, client](Rpc* rpc) {
+      rpc->NotifyEndOfFile();
+      PostToClient(task_runner, client, [](base::HttpServerConnection* c) {
+        SendDeferredProtoResponse(c);
+      });
+    };
+  } else if (req.uri == "/restore_initial_tables") {
+    handler = [task_runner, client](Rpc* rpc) {
+      rpc->RestoreInitialTables();
+      PostToClient(task_runner, client, [](base::HttpServerConnection* c) {
+        SendDeferredProtoResponse(c);
+      });
+    };
   }
 
   // New endpoint, returns data in batches using chunked transfer encoding.
   // The batch size is determined by |cells_per_batch_| and
   // |batch_split_threshold_| in query_result_serializer.h.
   // This is temporary, it will be switched to WebSockets soon.
-  if (req.uri == "/query") {
-    std::vector<uint8_t> response;
-
-    // Start the chunked reply.
-    base::StringCopy(transfer_encoding_hdr, "Transfer-Encoding: chunked",
-                     sizeof(transfer_encoding_hdr));
-    conn.SendResponseHeaders("200 OK", headers,
-                             base::HttpServerConnection::kOmitContentLength);
-
-    // |on_result_chunk| will be called nested within the same callstack of the
-    // rpc.Query() call. No further calls will be made once Query() returns.
-    auto on_result_chunk = [&](const uint8_t* buf, size_t len, bool has_more) {
-      PERFETTO_DLOG("Sending response chunk, len=%zu eof=%d", len, !has_more);
-      base::StackString<32> chunk_hdr("%zx\r\n", len);
-      conn.SendResponseBody(chunk_hdr.c_str(), chunk_hdr.len());
-      conn.SendResponseBody(buf, len);
-      conn.SendResponseBody("\r\n", 2);
-      if (!has_more)
-        conn.SendResponseBody("0\r\n\r\n", 5);
+  else if (req.uri == "/query") {
+    handler = [task_runner, client, body](Rpc* rpc) {
+      // Start the chunked reply.
+      PostToClient(task_runner, client, SendChunkedResponseHeaders);
+      RpcResponseSink sink(task_runner, client);
+      // |on_result_chunk| will be called nested within the same callstack of
+      // the rpc.Query() call. No further calls will be made once Query()
+      // returns.
+      auto on_result_chunk = [&](const uint8_t* buf, size_t len, bool) {
+        PERFETTO_DLOG("Sending response chunk, len=%zu", len);
+        sink.Append(buf, len);
+        sink.Flush();
+      };
+      rpc->Query(Bytes(body), body.size(), on_result_chunk);
+      sink.Finish();
+    };
+  } else if (req.uri == "/compute_metric") {
+    handler = [task_runner, client, body](Rpc* rpc) {
+      std::vector<uint8_t> res = rpc->ComputeMetric(Bytes(body), body.size());
+      PostToClient(task_runner, client, [res](base::HttpServerConnection* c) {
+        SendDeferredProtoResponse(c, Vec2Sv(res));
+      });
+    };
+  } else if (req.uri == "/enable_metatrace") {
+    handler = [task_runner, client, body](Rpc* rpc) {
+      rpc->EnableMetatrace(Bytes(body), body.size());
+      PostToClient(task_runner, client, [](base::HttpServerConnection* c) {
+        SendDeferredProtoResponse(c);
+      });
+    };
+  } else if (req.uri == "/disable_and_read_metatrace") {
+    handler = [task_runner, client](Rpc* rpc) {
+      std::vector<uint8_t> res = rpc->DisableAndReadMetatrace();
+      PostToClient(task_runner, client, [res](base::HttpServerConnection* c) {
+        SendDeferredProtoResponse(c, Vec2Sv(res));
+      });
     };
-    trace_processor_rpc_.Query(
-        reinterpret_cast<const uint8_t*>(req.body.data()), req.body.size(),
-        on_result_chunk);
-    return;
-  }
-
-  if (req.uri == "/compute_metric") {
-    std::vector<uint8_t> res = trace_processor_rpc_.ComputeMetric(
-        reinterpret_cast<const uint8_t*>(req.body.data()), req.body.size());
-    return conn.SendResponse("200 OK", headers, Vec2Sv(res));
-  }
-
-  if (req.uri == "/enable_metatrace") {
-    trace_processor_rpc_.EnableMetatrace(
-        reinterpret_cast<const uint8_t*>(req.body.data()), req.body.size());
-    return conn.SendResponse("200 OK", headers);
   }
 
-  if (req.uri == "/disable_and_read_metatrace") {
-    std::vector<uint8_t> res = trace_processor_rpc_.DisableAndReadMetatrace();
-    return conn.SendResponse("200 OK", headers, Vec2Sv(res));
-  }
+  if (!handler)
+    return conn.SendResponseAndClose("404 Not Found");
 
-  return conn.SendResponseAndClose("404 Not Found", headers);
+  conn.DeferResponse();
+  PostToSession(GetOrCreateSession(session_id), client, std::move(handler));
 }
 
 void Httpd::OnWebsocketMessage(const base::WebsocketMessage& msg) {
-  PERFETTO_CHECK(g_cur_conn == nullptr);
-  g_cur_conn = msg.conn;
-  trace_processor_rpc_.SetRpcResponseFunction(SendRpcChunk);
-  // OnRpcRequest() will call SendRpcChunk() one or more times.
-  trace_processor_rpc_.OnRpcRequest(msg.data.data(), msg.data.size());
-  trace_processor_rpc_.SetRpcResponseFunction(nullptr);
-  g_cur_conn = nullptr;
+  std::shared_ptr<Client> client = GetOrCreateClient(msg.conn);
+  std::shared_ptr<Session> session = client->websocket_session;
+  if (!session)
+    session = GetOrCreateSession("");
+  std::string data = msg.data.ToStdString();
+  PostToSession(session, client, [this, client, data](Rpc* rpc) {
+    RunRpcRequest(rpc, client, data);
+  });
+}
+
+void Httpd::OnHttpConnectionClosed(base::HttpServerConnection* conn) {
+  auto it = clients_.find(conn);
+  if (it == clients_.end())
+    return;
+  const Client* client = it->second.get();
+  it->second->disconnected = true;
+
+  // Nobody is going to read the result of the query currently being run on
+  // behalf of the client (if any): interrupt it, rather than keeping the
+  // session busy.
+  auto maybe_interrupt = [client](Session* session) {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (session->active_client == client && session->rpc)
+      session->rpc->InterruptQuery();
+  };
+  for (const auto& id_and_session : sessions_)
+    maybe_interrupt(id_and_session.second.get());
+  if (client->websocket_session) {
+    maybe_interrupt(client->websocket_session.get());
+    it->second->websocket_session.reset();
+  }
+  clients_.erase(it);
 }
 
 }  // namespace
@@ -16,8 +16,12 @@
 
 #include "src/trace_processor/rpc/query_result_serializer.h"
 
+#include <string.h>
+
+#include <algorithm>
 #include <vector>
 
+#include "perfetto/ext/base/hash.h"
 #include "perfetto/protozero/packed_repeated_fields.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
@@ -32,9 +36,12 @@ namespace {
 
 namespace pu = ::protozero::proto_utils;
 using BatchProto = protos::pbzero::QueryResult::CellsBatch;
+using ColumnsBatchProto = protos::pbzero::QueryResult::ColumnsBatch;
+using ColumnProto = protos::pbzero::QueryResult::ColumnsBatch::Column;
 using ResultProto = protos::pbzero::QueryResult;
 
-// The reserved field in trace_processor.proto.
+// The reserved field in trace_processor.proto, both in CellsBatch and in
+// ColumnsBatch.Column.
 static constexpr uint32_t kPaddingFieldId = 7;
 
 uint8_t MakeLenDelimTag(uint32_t field_num) {
@@ -43,10 +50,71 @@ uint8_t MakeLenDelimTag(uint32_t field_num) {
   return static_cast<uint8_t>(tag);
 }
 
+// Appends a length-delimited blob field to |out|.
+void AppendBlob(uint32_t field_num,
+                const SqlValue& value,
+                std::vector<uint8_t>* out) {
+  auto* src = static_cast<const uint8_t*>(value.bytes_value);
+  uint32_t len = static_cast<uint32_t>(value.bytes_count);
+  uint8_t preamble[16];
+  uint8_t* preamble_end = &preamble[0];
+  *(preamble_end++) = MakeLenDelimTag(field_num);
+  preamble_end = pu::WriteVarInt(len, preamble_end);
+  out->insert(out->end(), preamble, preamble_end);
+  out->insert(out->end(), src, src + len);
+}
+
+// Appends a packed fixed64 field containing the |size| bytes at |doubles|.
+// The payload is appended at a 64-bit aligned offset, so that JS can access
+// it by overlaying a TypedArray, without extra copies.
+void AppendAlignedDoubles(protozero::Message* msg,
+                          uint32_t field_num,
+                          const void* doubles,
+                          uint32_t size) {
+  const auto& writer = *msg->stream_writer();
+  uint8_t preamble[16];
+  uint8_t* preamble_end = &preamble[0];
+  *(preamble_end++) = MakeLenDelimTag(field_num);
+  preamble_end = pu::WriteVarInt(size, preamble_end);
+  uint32_t preamble_size = static_cast<uint32_t>(preamble_end - &preamble[0]);
+
+  // The byte after the preamble must start at a 64bit-aligned offset.
+  // The padding needs to be > 1 Byte because of proto encoding.
+  const uint32_t off = static_cast<uint32_t>(writer.written() + preamble_size);
+  const uint32_t aligned_off = (off + 7) & ~7u;
+  uint32_t padding = aligned_off - off;
+  padding = padding == 1 ? 9 : padding;
+  if (padding > 0) {
+    uint8_t pad_buf[10];
+    uint8_t* pad = pad_buf;
+    *(pad++) = pu::MakeTagVarInt(kPaddingFieldId);
+    for (uint32_t i = 0; i < padding - 2; i++)
+      *(pad++) = 0x80;
+    *(pad++) = 0;
+    msg->AppendRawProtoBytes(pad_buf, static_cast<size_t>(pad - pad_buf));
+  }
+  msg->AppendRawProtoBytes(preamble, preamble_size);
+  PERFETTO_CHECK(writer.written() % 8 == 0);
+  msg->AppendRawProtoBytes(doubles, size);
+}
+
+// The buffered cells of one column of a ColumnsBatch.
+struct ColumnBuffer {
+  std::vector<uint8_t> cell_types;
+  protozero::PackedVarInt varint_deltas;  // Zigzag-encoded.
+  protozero::PackedFixedSizeInt<double> doubles;
+  protozero::PackedVarInt string_ids;
+  std::vector<uint8_t> blobs;  // Preamble-prefixed |blob_cells| fields.
+  int64_t last_varint = 0;
+  bool mixed_types = false;
+};
+
 }  // namespace
 
-QueryResultSerializer::QueryResultSerializer(Iterator iter)
-    : iter_(iter.take_impl()), num_cols_(iter_->ColumnCount()) {}
+QueryResultSerializer::QueryResultSerializer(Iterator iter, Format format)
+    : iter_(iter.take_impl()),
+      num_cols_(iter_->ColumnCount()),
+      format_(format) {}
 
 QueryResultSerializer::~QueryResultSerializer() = default;
 
@@ -67,16 +135,27 @@ bool QueryResultSerializer::Serialize(protos::pbzero::QueryResult* res) {
     did_write_metadata_ = true;
   }
 
-  // In case of an error we still want to go through SerializeBatch(). That will
-  // write an empty batch with the EOF marker. Errors can happen also in the
-  // middle of a query, not just before starting it.
-
-  SerializeBatch(res);
+  // In case of an error we still want to serialize a batch. That will write an
+  // empty batch with the EOF marker. Errors can happen also in the middle of a
+  // query, not just before starting it.
+
+  // A batch always contains at least one row, even if the row alone exceeds
+  // the cell limit.
+  uint32_t max_cells =
+      std::max(std::min(next_batch_cells_, cells_per_batch_), num_cols_);
+  next_batch_cells_ = std::min(next_batch_cells_, cells_per_batch_ / 2) * 2;
+  if (format_ == Format::kColumnsBatch) {
+    SerializeColumnsBatch(res, max_cells);
+  } else {
+    SerializeCellsBatch(res, max_cells);
+  }
   MaybeSerializeError(res);
   return !eof_reached_;
 }
 
-void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
+void QueryResultSerializer::SerializeCellsBatch(
+    protos::pbzero::QueryResult* res,
+    uint32_t max_cells) {
   // The buffer is filled in this way:
   // - Append all the strings as we iterate through the results. The rationale
   //   is that strings are typically the largest part of the result and we want
@@ -87,7 +166,6 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   // Note: this function uses uint32_t instead of size_t because Wasm doesn't
   // have yet native 64-bit integers and this is perf-sensitive.
 
-  const auto& writer = *res->stream_writer();
   auto* batch = res->add_batch();
 
   // Start the |string_cells|.
@@ -100,7 +178,7 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   // lot of very large strings and ending up with an enormous batch.
   uint32_t approx_batch_size = 16;
 
-  std::vector<uint8_t> cell_types(cells_per_batch_);
+  std::vector<uint8_t> cell_types(max_cells);
 
   // Varints and doubles are written on stack-based storage and appended later.
   protozero::PackedVarInt varints;
@@ -129,7 +207,7 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
       // We need to guarantee that a batch contains whole rows. Before moving to
       // the next row, make sure that: (i) there is space for all the columns;
       // (ii) the batch didn't grow too much.
-      if (cell_idx + num_cols_ > cells_per_batch_ ||
+      if (cell_idx + num_cols_ > max_cells ||
           approx_batch_size > batch_split_threshold_) {
         batch_full = true;
         break;
@@ -172,15 +250,9 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
         // Each blob is stored as its own repeated proto field, unlike strings.
         // Blobs don't incur in text-decoding overhead (and are also rare).
         cell_type = BatchProto::CELL_BLOB;
-        auto* src = static_cast<const uint8_t*>(value.bytes_value);
-        uint32_t len = static_cast<uint32_t>(value.bytes_count);
-        uint8_t preamble[16];
-        uint8_t* preamble_end = &preamble[0];
-        *(preamble_end++) = MakeLenDelimTag(BatchProto::kBlobCellsFieldNumber);
-        preamble_end = pu::WriteVarInt(len, preamble_end);
-        blobs.insert(blobs.end(), preamble, preamble_end);
-        blobs.insert(blobs.end(), src, src + len);
-        approx_batch_size += len + 4;  // 4 is a guess on the preamble size.
+        AppendBlob(BatchProto::kBlobCellsFieldNumber, value, &blobs);
+        // 4 is a guess on the preamble size.
+        approx_batch_size += static_cast<uint32_t>(value.bytes_count) + 4;
         break;
       }
     }
@@ -203,37 +275,12 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   if (varints.size())
     batch->set_varint_cells(varints);
 
-  // Append the |float64_cells|, copying over the packed fixed64 buffer. This is
-  // appended at a 64-bit aligned offset, so that JS can access these by overlay
-  // a TypedArray, without extra copies.
+  // Append the |float64_cells|, copying over the packed fixed64 buffer.
   const uint32_t doubles_size = static_cast<uint32_t>(doubles.size());
   if (doubles_size > 0) {
-    uint8_t preamble[16];
-    uint8_t* preamble_end = &preamble[0];
-    *(preamble_end++) = MakeLenDelimTag(BatchProto::kFloat64CellsFieldNumber);
-    preamble_end = pu::WriteVarInt(doubles_size, preamble_end);
-    uint32_t preamble_size = static_cast<uint32_t>(preamble_end - &preamble[0]);
-
-    // The byte after the preamble must start at a 64bit-aligned offset.
-    // The padding needs to be > 1 Byte because of proto encoding.
-    const uint32_t off =
-        static_cast<uint32_t>(writer.written() + preamble_size);
-    const uint32_t aligned_off = (off + 7) & ~7u;
-    uint32_t padding = aligned_off - off;
-    padding = padding == 1 ? 9 : padding;
-    if (padding > 0) {
-      uint8_t pad_buf[10];
-      uint8_t* pad = pad_buf;
-      *(pad++) = pu::MakeTagVarInt(kPaddingFieldId);
-      for (uint32_t i = 0; i < padding - 2; i++)
-        *(pad++) = 0x80;
-      *(pad++) = 0;
-      batch->AppendRawProtoBytes(pad_buf, static_cast<size_t>(pad - pad_buf));
-    }
-    batch->AppendRawProtoBytes(preamble, preamble_size);
-    PERFETTO_CHECK(writer.written() % 8 == 0);
-    batch->AppendRawProtoBytes(doubles.data(), doubles_size);
-  }  // if (doubles_size > 0)
+    AppendAlignedDoubles(batch, BatchProto::kFloat64CellsFieldNumber,
+                         doubles.data(), doubles_size);
+  }
 
   // Append the blobs.
   if (blobs.size() > 0) {
@@ -250,6 +297,174 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   batch->Finalize();
 }
 
+void QueryResultSerializer::SerializeColumnsBatch(
+    protos::pbzero::QueryResult* res,
+    uint32_t max_cells) {
+  // Unlike SerializeCellsBatch(), all the cells are buffered per column and
+  // the batch is written at the end, once the column types, the distinct
+  // strings and the sizes of the arrays are known.
+  std::unique_ptr<ColumnBuffer[]> columns(new ColumnBuffer[num_cols_]);
+  for (uint32_t c = 0; c < num_cols_; ++c)
+    columns[c].cell_types.reserve(max_cells / num_cols_);
+  strings_.Clear();
+
+  uint32_t approx_batch_size = 16;
+  uint32_t num_rows = 0;
+  bool batch_full = false;
+
+  for (;; ++num_rows) {
+    // See the comments in SerializeCellsBatch(). col_ is 0 if the row was
+    // fetched by the previous batch but didn't fit in it.
+    if (col_ >= num_cols_) {
+      col_ = 0;
+      if (!iter_->Next())
+        break;  // EOF or error.
+      PERFETTO_DCHECK(num_cols_ > 0);
+      if ((num_rows + 1) * num_cols_ > max_cells ||
+          approx_batch_size > batch_split_threshold_) {
+        batch_full = true;
+        break;
+      }
+    }
+
+    for (; col_ < num_cols_; ++col_) {
+      ColumnBuffer& column = columns[col_];
+      auto value = iter_->Get(col_);
+      uint8_t cell_type = BatchProto::CELL_INVALID;
+      switch (value.type) {
+        case SqlValue::Type::kNull: {
+          cell_type = BatchProto::CELL_NULL;
+          break;
+        }
+        case SqlValue::Type::kLong: {
+          // Timestamps, durations and ids are typically sorted or clustered,
+          // so the deltas encode in much fewer bytes than the values. The
+          // subtraction is done unsigned to wrap around rather than overflow.
+          cell_type = BatchProto::CELL_VARINT;
+          auto delta = static_cast<int64_t>(
+              static_cast<uint64_t>(value.long_value) -
+              static_cast<uint64_t>(column.last_varint));
+          column.last_varint = value.long_value;
+          column.varint_deltas.Append(pu::ZigZagEncode(delta));
+          approx_batch_size += 2;  // Just a guess, doesn't need to be accurate.
+          break;
+        }
+        case SqlValue::Type::kDouble: {
+          cell_type = BatchProto::CELL_FLOAT64;
+          column.doubles.Append(value.double_value);
+          approx_batch_size += sizeof(double);
+          break;
+        }
+        case SqlValue::Type::kString: {
+          cell_type = BatchProto::CELL_STRING;
+          size_t dict_size = strings_.strings().size();
+          uint32_t id = strings_.Intern(
+              value.string_value,
+              static_cast<uint32_t>(strlen(value.string_value)));
+          column.string_ids.Append(id);
+          approx_batch_size +=
+              static_cast<uint32_t>(strings_.strings().size() - dict_size) + 2;
+          break;
+        }
+        case SqlValue::Type::kBytes: {
+          cell_type = BatchProto::CELL_BLOB;
+          AppendBlob(ColumnProto::kBlobCellsFieldNumber, value, &column.blobs);
+          approx_batch_size += static_cast<uint32_t>(value.bytes_count) + 4;
+          break;
+        }
+      }
+      PERFETTO_DCHECK(cell_type != BatchProto::CELL_INVALID);
+      if (!column.cell_types.empty() && column.cell_types[0] != cell_type)
+        column.mixed_types = true;
+      column.cell_types.push_back(cell_type);
+    }
+  }  // for (row)
+
+  auto* batch = res->add_columns_batch();
+  batch->set_num_rows(num_rows);
+  if (!strings_.strings().empty()) {
+    batch->AppendBytes(ColumnsBatchProto::kStringDictFieldNumber,
+                       strings_.strings().data(), strings_.strings().size());
+  }
+
+  for (uint32_t c = 0; num_rows > 0 && c < num_cols_; ++c) {
+    const ColumnBuffer& column = columns[c];
+    auto* col = batch->add_columns();
+    // Most columns have a single type (or a type and NULLs, in which case the
+    // type array is still needed): avoid sending one byte per cell for them.
+    if (column.mixed_types) {
+      col->AppendBytes(ColumnProto::kCellsFieldNumber,
+                       column.cell_types.data(), column.cell_types.size());
+    } else {
+      col->AppendVarInt(ColumnProto::kCellTypeFieldNumber,
+                        column.cell_types[0]);
+    }
+    if (column.varint_deltas.size())
+      col->set_varint_deltas(column.varint_deltas);
+    if (column.doubles.size()) {
+      AppendAlignedDoubles(col, ColumnProto::kFloat64CellsFieldNumber,
+                           column.doubles.data(),
+                           static_cast<uint32_t>(column.doubles.size()));
+    }
+    if (column.string_ids.size())
+      col->set_string_ids(column.string_ids);
+    if (!column.blobs.empty())
+      col->AppendRawProtoBytes(column.blobs.data(), column.blobs.size());
+    col->Finalize();
+  }
+
+  if (!batch_full) {
+    eof_reached_ = true;
+    batch->set_is_last_batch(true);
+  }
+  batch->Finalize();
+}
+
+uint32_t QueryResultSerializer::StringDictionary::Intern(const char* str,
+                                                         uint32_t size) {
+  // Keep the load factor <= 50%.
+  if ((entries_.size() + 1) * 2 > slots_.size())
+    Grow();
+
+  base::Hasher hasher;
+  hasher.Update(str, size);
+  const uint64_t hash = hasher.digest();
+  const size_t mask = slots_.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    uint32_t slot = slots_[i];
+    if (slot == 0) {
+      auto id = static_cast<uint32_t>(entries_.size());
+      entries_.push_back({hash, static_cast<uint32_t>(strings_.size()), size});
+      strings_.append(str, size);
+      strings_.push_back('\0');
+      slots_[i] = id + 1;
+      return id;
+    }
+    const Entry& entry = entries_[slot - 1];
+    if (entry.hash == hash && entry.size == size &&
+        memcmp(&strings_[entry.offset], str, size) == 0) {
+      return slot - 1;
+    }
+  }
+}
+
+void QueryResultSerializer::StringDictionary::Grow() {
+  slots_.assign(std::max<size_t>(slots_.size() * 2, 1024), 0);
+  const size_t mask = slots_.size() - 1;
+  for (uint32_t id = 0; id < entries_.size(); ++id) {
+    size_t i = entries_[id].hash & mask;
+    while (slots_[i] != 0)
+      i = (i + 1) & mask;
+    slots_[i] = id + 1;
+  }
+}
+
+void QueryResultSerializer::StringDictionary::Clear() {
+  strings_.clear();
+  entries_.clear();
+  std::fill(slots_.begin(), slots_.end(), 0);
+}
+
 void QueryResultSerializer::MaybeSerializeError(
     protos::pbzero::QueryResult* res) {
   if (iter_->Status().ok())
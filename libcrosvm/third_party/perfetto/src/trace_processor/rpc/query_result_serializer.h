@@ -18,6 +18,7 @@
 #define SRC_TRACE_PROCESSOR_RPC_QUERY_RESULT_SERIALIZER_H_
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <limits.h>
@@ -51,10 +52,26 @@ class IteratorImpl;
 //   of a row).
 // The intended use case is streaaming these batches onto through a
 // chunked-encoded HTTP response, or through a repetition of Wasm calls.
+// Batches start small and double in size up to |cells_per_batch_|, so that the
+// first rows of a large result reach the client without waiting for a full
+// batch to be produced.
+// Results can be encoded either row-major (CellsBatch, the default) or
+// column-major (ColumnsBatch), see Format below and trace_processor.proto.
 class QueryResultSerializer {
  public:
   static constexpr uint32_t kDefaultBatchSplitThreshold = 128 * 1024;
-  explicit QueryResultSerializer(Iterator);
+  static constexpr uint32_t kFirstBatchCells = 1024;
+
+  enum class Format {
+    // QueryResult.batch: one type byte per cell plus one payload array per
+    // type, shared by all the columns.
+    kCellsBatch,
+    // QueryResult.columns_batch: typed arrays per column, with delta-encoded
+    // integers and a per-batch dictionary of the distinct strings.
+    kColumnsBatch,
+  };
+
+  explicit QueryResultSerializer(Iterator, Format = Format::kCellsBatch);
   ~QueryResultSerializer();
 
   // No copy or move.
@@ -70,18 +87,50 @@ class QueryResultSerializer {
   // extra copies.
   bool Serialize(std::vector<uint8_t>*);
 
+  // Note: this also disables the ramp-up of the batch size, so that all the
+  // batches are split at |cells_per_batch|.
   void set_batch_size_for_testing(uint32_t cells_per_batch, uint32_t thres) {
     cells_per_batch_ = cells_per_batch;
     batch_split_threshold_ = thres;
+    next_batch_cells_ = cells_per_batch;
   }
 
  private:
+  // Assigns consecutive ids to the distinct strings of a ColumnsBatch, in
+  // order of first appearance.
+  class StringDictionary {
+   public:
+    // Returns the id of the |size| bytes at |str|, appending them to
+    // |strings()| (NUL-terminated) if they were not seen before.
+    uint32_t Intern(const char* str, uint32_t size);
+    void Clear();
+
+    const std::string& strings() const { return strings_; }
+
+   private:
+    struct Entry {
+      uint64_t hash;
+      uint32_t offset;
+      uint32_t size;
+    };
+
+    void Grow();
+
+    std::string strings_;
+    std::vector<Entry> entries_;
+    // Open-addressing hash table. Each slot contains 1 + the index of the
+    // entry in |entries_| or 0 if empty. The size is a power of two.
+    std::vector<uint32_t> slots_;
+  };
+
   void SerializeMetadata(protos::pbzero::QueryResult*);
-  void SerializeBatch(protos::pbzero::QueryResult*);
+  void SerializeCellsBatch(protos::pbzero::QueryResult*, uint32_t max_cells);
+  void SerializeColumnsBatch(protos::pbzero::QueryResult*, uint32_t max_cells);
   void MaybeSerializeError(protos::pbzero::QueryResult*);
 
   std::unique_ptr<IteratorImpl> iter_;
   const uint32_t num_cols_;
+  const Format format_;
   bool did_write_metadata_ = false;
   bool eof_reached_ = false;
   uint32_t col_ = UINT32_MAX;
@@ -94,6 +143,13 @@ class QueryResultSerializer {
   // Overridable for testing only.
   uint32_t cells_per_batch_ = 50000;
   uint32_t batch_split_threshold_ = kDefaultBatchSplitThreshold;
+
+  // The max number of cells of the next batch, see the class-level comment.
+  uint32_t next_batch_cells_ = kFirstBatchCells;
+
+  // Only used by the kColumnsBatch format. Kept across batches to reuse its
+  // allocations.
+  StringDictionary strings_;
 };
 
 }  // namespace trace_processor
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/rpc/query_result_serializer.h"
 
+#include <string>
+
 #include <benchmark/benchmark.h>
 
 #include "perfetto/trace_processor/basic_types.h"
@@ -46,51 +48,78 @@ void RunQueryChecked(TraceProcessor* tp, const std::string& query) {
   PERFETTO_CHECK(iter.Status().ok());
 }
 
-}  // namespace
-
-static void BM_QueryResultSerializer_Mixed(benchmark::State& state) {
+void RunSerializerBenchmark(benchmark::State& state,
+                            const char* query,
+                            int64_t num_rows,
+                            QueryResultSerializer::Format format) {
   auto tp = TraceProcessor::CreateInstance(Config());
   RunQueryChecked(tp.get(), "create virtual table win using window;");
-  RunQueryChecked(tp.get(),
-                  "update win set window_start=0, window_dur=50000, quantum=1 "
-                  "where rowid = 0");
+  RunQueryChecked(tp.get(), "update win set window_start=0, window_dur=" +
+                                std::to_string(num_rows) +
+                                ", quantum=1 where rowid = 0");
   VectorType buf;
+  size_t bytes = 0;
   for (auto _ : state) {
-    auto iter = tp->ExecuteQuery(
-        "select dur || dur as x, ts, dur * 1.0 as dur, quantum_ts from win");
-    QueryResultSerializer serializer(std::move(iter));
+    auto iter = tp->ExecuteQuery(query);
+    QueryResultSerializer serializer(std::move(iter), format);
     serializer.set_batch_size_for_testing(
         static_cast<uint32_t>(state.range(0)),
         static_cast<uint32_t>(state.range(1)));
     while (serializer.Serialize(&buf)) {
     }
     benchmark::DoNotOptimize(buf.data());
+    bytes = buf.size();
     buf.clear();
   }
   benchmark::ClobberMemory();
+  state.counters["bytes"] = static_cast<double>(bytes);
+}
+
+constexpr char kMixedQuery[] =
+    "select dur || dur as x, ts, dur * 1.0 as dur, quantum_ts from win";
+constexpr char kStringsQuery[] =
+    "select  ts || '-' || ts , (dur * 1.0) || dur from win";
+// Resembles a query on the slice table: sorted timestamps, small integers and
+// few distinct names.
+constexpr char kSlicesQuery[] =
+    "select ts, ts / 100 as id, quantum_ts % 16 as depth, "
+    "'slice_' || (ts % 32) as name from win";
+
+}  // namespace
+
+static void BM_QueryResultSerializer_Mixed(benchmark::State& state) {
+  RunSerializerBenchmark(state, kMixedQuery, 50000,
+                         QueryResultSerializer::Format::kCellsBatch);
+}
+
+static void BM_QueryResultSerializer_MixedColumns(benchmark::State& state) {
+  RunSerializerBenchmark(state, kMixedQuery, 50000,
+                         QueryResultSerializer::Format::kColumnsBatch);
 }
 
 static void BM_QueryResultSerializer_Strings(benchmark::State& state) {
-  auto tp = TraceProcessor::CreateInstance(Config());
-  RunQueryChecked(tp.get(), "create virtual table win using window;");
-  RunQueryChecked(tp.get(),
-                  "update win set window_start=0, window_dur=100000, quantum=1 "
-                  "where rowid = 0");
-  VectorType buf;
-  for (auto _ : state) {
-    auto iter = tp->ExecuteQuery(
-        "select  ts || '-' || ts , (dur * 1.0) || dur from win");
-    QueryResultSerializer serializer(std::move(iter));
-    serializer.set_batch_size_for_testing(
-        static_cast<uint32_t>(state.range(0)),
-        static_cast<uint32_t>(state.range(1)));
-    while (serializer.Serialize(&buf)) {
-    }
-    benchmark::DoNotOptimize(buf.data());
-    buf.clear();
-  }
-  benchmark::ClobberMemory();
+  RunSerializerBenchmark(state, kStringsQuery, 100000,
+                         QueryResultSerializer::Format::kCellsBatch);
+}
+
+static void BM_QueryResultSerializer_StringsColumns(benchmark::State& state) {
+  RunSerializerBenchmark(state, kStringsQuery, 100000,
+                         QueryResultSerializer::Format::kColumnsBatch);
+}
+
+static void BM_QueryResultSerializer_Slices(benchmark::State& state) {
+  RunSerializerBenchmark(state, kSlicesQuery, 100000,
+                         QueryResultSerializer::Format::kCellsBatch);
+}
+
+static void BM_QueryResultSerializer_SlicesColumns(benchmark::State& state) {
+  RunSerializerBenchmark(state, kSlicesQuery, 100000,
+                         QueryResultSerializer::Format::kColumnsBatch);
 }
 
 BENCHMARK(BM_QueryResultSerializer_Mixed)->Apply(BenchmarkArgs);
+BENCHMARK(BM_QueryResultSerializer_MixedColumns)->Apply(BenchmarkArgs);
 BENCHMARK(BM_QueryResultSerializer_Strings)->Apply(BenchmarkArgs);
+BENCHMARK(BM_QueryResultSerializer_StringsColumns)->Apply(BenchmarkArgs);
+BENCHMARK(BM_QueryResultSerializer_Slices)->Apply(BenchmarkArgs);
+BENCHMARK(BM_QueryResultSerializer_SlicesColumns)->Apply(BenchmarkArgs);
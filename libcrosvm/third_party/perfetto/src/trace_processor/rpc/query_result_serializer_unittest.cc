@@ -18,12 +18,14 @@
 #include "src/trace_processor/rpc/query_result_serializer.h"
 
 #include <deque>
+#include <limits>
 #include <ostream>
 #include <random>
 #include <string>
 #include <vector>
 
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/trace_processor.h"
 #include "test/gtest_and_gmock.h"
@@ -71,7 +73,9 @@ namespace {
 
 using ::testing::ElementsAre;
 using BatchProto = protos::pbzero::QueryResult::CellsBatch;
+using ColumnsBatchProto = protos::pbzero::QueryResult::ColumnsBatch;
 using ResultProto = protos::pbzero::QueryResult;
+using Format = QueryResultSerializer::Format;
 
 void RunQueryChecked(TraceProcessor* tp, const std::string& query) {
   auto iter = tp->ExecuteQuery(query);
@@ -87,13 +91,29 @@ class TestDeserializer {
 
   std::vector<std::string> columns;
   std::vector<SqlValue> cells;
+  std::vector<uint32_t> cells_per_batch;
   std::string error;
   bool eof_reached = false;
 
  private:
+  void DeserializeColumnsBatch(protozero::ConstBytes);
+  SqlValue CopyString(const std::string&);
+  SqlValue CopyBytes(const std::string&);
+
   std::vector<std::unique_ptr<char[]>> copied_buf_;
 };
 
+std::deque<std::string> SplitStrings(const std::string& merged_strings) {
+  std::deque<std::string> strings;
+  for (size_t pos = 0; pos < merged_strings.size();) {
+    // Will return npos for the last string, but it's fine
+    size_t next_sep = merged_strings.find('\0', pos);
+    strings.emplace_back(merged_strings.substr(pos, next_sep - pos));
+    pos = next_sep == std::string::npos ? next_sep : next_sep + 1;
+  }
+  return strings;
+}
+
 void TestDeserializer::SerializeAndDeserialize(
     QueryResultSerializer* serializer) {
   std::vector<uint8_t> buf;
@@ -131,14 +151,8 @@ void TestDeserializer::DeserializeBuffer(const uint8_t* start, size_t size) {
     for (auto it = batch.blob_cells(); it; ++it)
       blobs.emplace_back((*it).ToStdString());
 
-    std::string merged_strings = batch.string_cells().ToStdString();
-    std::deque<std::string> strings;
-    for (size_t pos = 0; pos < merged_strings.size();) {
-      // Will return npos for the last string, but it's fine
-      size_t next_sep = merged_strings.find('\0', pos);
-      strings.emplace_back(merged_strings.substr(pos, next_sep - pos));
-      pos = next_sep == std::string::npos ? next_sep : next_sep + 1;
-    }
+    std::deque<std::string> strings =
+        SplitStrings(batch.string_cells().ToStdString());
 
     uint32_t num_cells = 0;
     for (auto it = batch.cells(&parse_error); it; ++it, ++num_cells) {
@@ -161,21 +175,13 @@ void TestDeserializer::DeserializeBuffer(const uint8_t* start, size_t size) {
           break;
         case BatchProto::CELL_STRING: {
           ASSERT_GT(strings.size(), 0u);
-          const std::string& str = strings.front();
-          copied_buf_.emplace_back(new char[str.size() + 1]);
-          char* new_buf = copied_buf_.back().get();
-          memcpy(new_buf, str.c_str(), str.size() + 1);
-          cells.emplace_back(SqlValue::String(new_buf));
+          cells.emplace_back(CopyString(strings.front()));
           strings.pop_front();
           break;
         }
         case BatchProto::CELL_BLOB: {
           ASSERT_GT(blobs.size(), 0u);
-          auto bytes = blobs.front();
-          copied_buf_.emplace_back(new char[bytes.size()]);
-          memcpy(copied_buf_.back().get(), bytes.data(), bytes.size());
-          cells.emplace_back(
-              SqlValue::Bytes(copied_buf_.back().get(), bytes.size()));
+          cells.emplace_back(CopyBytes(blobs.front()));
           blobs.pop_front();
           break;
         }
@@ -190,7 +196,102 @@ void TestDeserializer::DeserializeBuffer(const uint8_t* start, size_t size) {
     } else {
       EXPECT_EQ(num_cells % columns.size(), 0u);
     }
+    cells_per_batch.push_back(num_cells);
   }
+
+  for (auto batch_it = result.columns_batch(); batch_it; ++batch_it) {
+    ASSERT_FALSE(eof_reached);
+    DeserializeColumnsBatch(*batch_it);
+  }
+}
+
+void TestDeserializer::DeserializeColumnsBatch(protozero::ConstBytes bytes) {
+  ColumnsBatchProto::Decoder batch(bytes);
+  eof_reached = batch.is_last_batch();
+  const uint32_t num_rows = batch.num_rows();
+  std::deque<std::string> dict_deque =
+      SplitStrings(batch.string_dict().ToStdString());
+  std::vector<std::string> dict(dict_deque.begin(), dict_deque.end());
+
+  // Decodes each column and then transposes them into |cells|.
+  std::vector<std::vector<SqlValue>> cols;
+  for (auto col_it = batch.columns(); col_it; ++col_it) {
+    ColumnsBatchProto::Column::Decoder col(*col_it);
+    bool parse_error = false;
+    std::vector<uint8_t> cell_types;
+    if (col.has_cell_type()) {
+      cell_types.assign(num_rows, static_cast<uint8_t>(col.cell_type()));
+    } else {
+      for (auto it = col.cells(&parse_error); it; ++it)
+        cell_types.push_back(static_cast<uint8_t>(*it));
+    }
+    ASSERT_EQ(cell_types.size(), num_rows);
+
+    auto varint_it = col.varint_deltas(&parse_error);
+    auto double_it = col.float64_cells(&parse_error);
+    auto string_it = col.string_ids(&parse_error);
+    auto blob_it = col.blob_cells();
+    uint64_t last_varint = 0;
+    cols.emplace_back();
+    for (uint8_t cell_type : cell_types) {
+      switch (cell_type) {
+        case BatchProto::CELL_NULL:
+          cols.back().emplace_back(SqlValue());
+          break;
+        case BatchProto::CELL_VARINT: {
+          ASSERT_TRUE(varint_it);
+          last_varint += static_cast<uint64_t>(
+              protozero::proto_utils::ZigZagDecode(
+                  static_cast<uint64_t>(*varint_it)));
+          cols.back().emplace_back(
+              SqlValue::Long(static_cast<int64_t>(last_varint)));
+          ++varint_it;
+          break;
+        }
+        case BatchProto::CELL_FLOAT64:
+          ASSERT_TRUE(double_it);
+          cols.back().emplace_back(SqlValue::Double(*double_it));
+          ++double_it;
+          break;
+        case BatchProto::CELL_STRING:
+          ASSERT_TRUE(string_it);
+          ASSERT_LT(*string_it, dict.size());
+          cols.back().emplace_back(CopyString(dict[*string_it]));
+          ++string_it;
+          break;
+        case BatchProto::CELL_BLOB:
+          ASSERT_TRUE(blob_it);
+          cols.back().emplace_back(CopyBytes((*blob_it).ToStdString()));
+          ++blob_it;
+          break;
+        default:
+          FAIL() << "Unknown cell type " << cell_type;
+      }
+    }
+    EXPECT_FALSE(varint_it || double_it || string_it || blob_it);
+    EXPECT_FALSE(parse_error);
+  }
+
+  if (num_rows > 0) {
+    ASSERT_EQ(cols.size(), columns.size());
+  }
+  for (uint32_t row = 0; row < num_rows; ++row) {
+    for (const auto& col : cols)
+      cells.push_back(col[row]);
+  }
+  cells_per_batch.push_back(num_rows * static_cast<uint32_t>(columns.size()));
+}
+
+SqlValue TestDeserializer::CopyString(const std::string& str) {
+  copied_buf_.emplace_back(new char[str.size() + 1]);
+  memcpy(copied_buf_.back().get(), str.c_str(), str.size() + 1);
+  return SqlValue::String(copied_buf_.back().get());
+}
+
+SqlValue TestDeserializer::CopyBytes(const std::string& bytes) {
+  copied_buf_.emplace_back(new char[bytes.size()]);
+  memcpy(copied_buf_.back().get(), bytes.data(), bytes.size());
+  return SqlValue::Bytes(copied_buf_.back().get(), bytes.size());
 }
 
 TEST(QueryResultSerializerTest, ShortBatch) {
@@ -386,9 +487,10 @@ TEST(QueryResultSerializerTest, RandomSizes) {
   }
 
   // Serialize and de-serialize with different batch and payload sizes.
-  for (int rep = 0; rep < 10; rep++) {
+  for (int rep = 0; rep < 20; rep++) {
     auto iter = tp->ExecuteQuery("select * from tab");
-    QueryResultSerializer ser(std::move(iter));
+    QueryResultSerializer ser(
+        std::move(iter), rep % 2 ? Format::kColumnsBatch : Format::kCellsBatch);
     uint32_t cells_per_batch = 1 << (rnd_engine() % 8 + 2);
     uint32_t binary_payload_size = 1 << (rnd_engine() % 8 + 8);
     ser.set_batch_size_for_testing(cells_per_batch, binary_payload_size);
@@ -401,6 +503,104 @@ TEST(QueryResultSerializerTest, RandomSizes) {
   }
 }
 
+TEST(QueryResultSerializerTest, FirstBatchesAreSmall) {
+  auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+
+  RunQueryChecked(tp.get(), "create virtual table win using window;");
+  RunQueryChecked(tp.get(),
+                  "update win set window_start=0, window_dur=8192, quantum=1 "
+                  "where rowid = 0");
+
+  for (Format format : {Format::kCellsBatch, Format::kColumnsBatch}) {
+    auto iter = tp->ExecuteQuery(
+        "select 'x' as x, ts, dur * 1.0 as dur, quantum_ts from win");
+    QueryResultSerializer ser(std::move(iter), format);
+    TestDeserializer deser;
+    deser.SerializeAndDeserialize(&ser);
+
+    constexpr uint32_t kFirst = QueryResultSerializer::kFirstBatchCells;
+    ASSERT_EQ(deser.cells.size(), 4 * 8192u);
+    ASSERT_GE(deser.cells_per_batch.size(), 4u);
+    EXPECT_EQ(deser.cells_per_batch[0], kFirst);
+    EXPECT_EQ(deser.cells_per_batch[1], kFirst * 2);
+    EXPECT_EQ(deser.cells_per_batch[2], kFirst * 4);
+  }
+}
+
+TEST(QueryResultSerializerTest, ColumnsBatch) {
+  auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+
+  // The second row checks NULLs mixed with other types and the wrap-around of
+  // the deltas between the int64 extremes.
+  auto iter = tp->ExecuteQuery(
+      "select 1 as i8, -9223372036854775808 as i64, 1e9 as f64, "
+      "'a_string' as str, cast('a_blob' as blob) as blb, NULL as nul "
+      "union all "
+      "select 128, 9223372036854775807, NULL, 'a_string', NULL, 'b'");
+  QueryResultSerializer ser(std::move(iter), Format::kColumnsBatch);
+  TestDeserializer deser;
+  deser.SerializeAndDeserialize(&ser);
+
+  EXPECT_EQ(deser.error, "");
+  EXPECT_THAT(deser.columns,
+              ElementsAre("i8", "i64", "f64", "str", "blb", "nul"));
+  EXPECT_THAT(
+      deser.cells,
+      ElementsAre(SqlValue::Long(1),
+                  SqlValue::Long(std::numeric_limits<int64_t>::min()),
+                  SqlValue::Double(1e9), SqlValue::String("a_string"),
+                  SqlValue::Bytes("a_blob", 6), SqlValue(),
+                  SqlValue::Long(128),
+                  SqlValue::Long(std::numeric_limits<int64_t>::max()),
+                  SqlValue(), SqlValue::String("a_string"), SqlValue(),
+                  SqlValue::String("b")));
+}
+
+TEST(QueryResultSerializerTest, ColumnsBatchEncoding) {
+  auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+
+  RunQueryChecked(tp.get(), "create virtual table win using window;");
+  RunQueryChecked(tp.get(),
+                  "update win set window_start=0, window_dur=1000, quantum=1 "
+                  "where rowid = 0");
+  auto iter = tp->ExecuteQuery(
+      "select ts, 'slice_' || (ts % 4) as name from win");
+  QueryResultSerializer ser(std::move(iter), Format::kColumnsBatch);
+  ser.set_batch_size_for_testing(2000, 1024 * 1024);
+  std::vector<uint8_t> buf;
+  ASSERT_FALSE(ser.Serialize(&buf));
+
+  ResultProto::Decoder result(buf.data(), buf.size());
+  ASSERT_TRUE(result.has_columns_batch());
+  ASSERT_FALSE(result.has_batch());
+  ColumnsBatchProto::Decoder batch(*result.columns_batch());
+  EXPECT_EQ(batch.num_rows(), 1000u);
+  EXPECT_TRUE(batch.is_last_batch());
+
+  // Each distinct string is sent only once.
+  EXPECT_THAT(SplitStrings(batch.string_dict().ToStdString()),
+              ElementsAre("slice_0", "slice_1", "slice_2", "slice_3"));
+
+  auto col_it = batch.columns();
+  ColumnsBatchProto::Column::Decoder ts(*col_it);
+  EXPECT_EQ(ts.cell_type(), BatchProto::CELL_VARINT);
+  EXPECT_FALSE(ts.has_cells());
+  // The ts grows by 1 at each row, so each delta takes one byte.
+  EXPECT_EQ(
+      ts.Get(ColumnsBatchProto::Column::kVarintDeltasFieldNumber).size(),
+      1000u);
+
+  ++col_it;
+  ColumnsBatchProto::Column::Decoder name(*col_it);
+  EXPECT_EQ(name.cell_type(), BatchProto::CELL_STRING);
+  bool parse_error = false;
+  uint32_t row = 0;
+  for (auto it = name.string_ids(&parse_error); it; ++it, ++row)
+    ASSERT_EQ(*it, row % 4);
+  EXPECT_EQ(row, 1000u);
+  EXPECT_FALSE(parse_error);
+}
+
 TEST(QueryResultSerializerTest, ErrorBeforeStartingQuery) {
   auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
   auto iter = tp->ExecuteQuery("insert into incomplete_input");
@@ -98,7 +98,15 @@ Rpc::Rpc() : Rpc(nullptr) {}
 Rpc::~Rpc() = default;
 
 void Rpc::ResetTraceProcessor() {
-  trace_processor_ = TraceProcessor::CreateInstance(Config());
+  std::unique_ptr<TraceProcessor> old_instance;
+  {
+    std::lock_guard<std::mutex> lock(trace_processor_mutex_);
+    old_instance = std::move(trace_processor_);
+    trace_processor_ = TraceProcessor::CreateInstance(Config());
+  }
+  // Destroy the old instance (which can take a while for big traces) without
+  // holding the lock.
+  old_instance.reset();
   bytes_parsed_ = bytes_last_progress_ = 0;
   t_parse_started_ = base::GetWallTimeNs().count();
   // Deliberately not resetting the RPC channel state (rxbuf_, {tx,rx}_seq_id_).
@@ -145,6 +153,14 @@ TraceProcessor::MetatraceCategories MetatraceCategoriesToPublicEnum(
   return TraceProcessor::MetatraceCategories::NONE;
 }
 
+QueryResultSerializer::Format GetResultFormat(const uint8_t* args,
+                                              size_t len) {
+  protos::pbzero::QueryArgs::Decoder query(args, len);
+  if (query.result_format() == protos::pbzero::QueryArgs::COLUMNS_BATCH)
+    return QueryResultSerializer::Format::kColumnsBatch;
+  return QueryResultSerializer::Format::kCellsBatch;
+}
+
 }  // namespace
 
 // [data, len] here is a tokenized TraceProcessorRpc proto message, without the
@@ -205,7 +221,8 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
       } else {
         protozero::ConstBytes args = req.query_args();
         auto it = QueryInternal(args.data, args.size);
-        QueryResultSerializer serializer(std::move(it));
+        QueryResultSerializer serializer(
+            std::move(it), GetResultFormat(args.data, args.size));
         for (bool has_more = true; has_more;) {
           Response resp(tx_seq_id_++, req_type);
           has_more = serializer.Serialize(resp->set_query_result());
@@ -325,7 +342,7 @@ void Rpc::Query(const uint8_t* args,
                 size_t len,
                 QueryResultBatchCallback result_callback) {
   auto it = QueryInternal(args, len);
-  QueryResultSerializer serializer(std::move(it));
+  QueryResultSerializer serializer(std::move(it), GetResultFormat(args, len));
 
   std::vector<uint8_t> res;
   for (bool has_more = true; has_more;) {
@@ -354,6 +371,12 @@ void Rpc::RestoreInitialTables() {
   trace_processor_->RestoreInitialTables();
 }
 
+void Rpc::InterruptQuery() {
+  std::lock_guard<std::mutex> lock(trace_processor_mutex_);
+  if (trace_processor_)
+    trace_processor_->InterruptQuery();
+}
+
 std::vector<uint8_t> Rpc::ComputeMetric(const uint8_t* args, size_t len) {
   protozero::HeapBuffered<protos::pbzero::ComputeMetricResult> result;
   ComputeMetricInternal(args, len, result.get());
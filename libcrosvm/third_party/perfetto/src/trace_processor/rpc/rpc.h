@@ -19,6 +19,7 @@
 
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <stddef.h>
@@ -112,6 +113,12 @@ class Rpc {
   // tables/view created by the ingestion process are preserved.
   void RestoreInitialTables();
 
+  // Interrupts the query currently being executed (if any), which will then
+  // fail with an "interrupted" error. Unlike all the other methods, this can
+  // be called from any thread, so that a query can be cancelled while it is
+  // blocking the thread running it.
+  void InterruptQuery();
+
   // Runs a query and returns results in batch. Each batch is a proto-encoded
   // TraceProcessor.QueryResult message and contains a variable number of rows.
   // The callbacks are called inline, so the whole callstack looks as follows:
@@ -140,6 +147,10 @@ class Rpc {
   void DisableAndReadMetatraceInternal(
       protos::pbzero::DisableAndReadMetatraceResult*);
 
+  // Guards the replacement of |trace_processor_| against concurrent calls to
+  // InterruptQuery(). All the other accesses happen on the same thread which
+  // replaces the instance, so they don't need to hold the lock.
+  std::mutex trace_processor_mutex_;
   std::unique_ptr<TraceProcessor> trace_processor_;
   RpcResponseFunction rpc_response_fn_;
   protozero::ProtoRingBuffer rxbuf_;
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/snapshot_trace_reader.h"
+
+#include <cinttypes>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/db/snapshot_io.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "src/trace_processor/util/status_macros.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+SnapshotTraceReader::SnapshotTraceReader(TraceProcessorContext* context)
+    : context_(context) {}
+
+SnapshotTraceReader::~SnapshotTraceReader() = default;
+
+util::Status SnapshotTraceReader::Parse(TraceBlobView blob) {
+  if (loaded_)
+    return util::ErrStatus("Unexpected data after the end of the snapshot");
+
+  bool is_contiguous =
+      buffer_.empty() &&
+      (!mapped_blob_ || (blob.blob() == mapped_blob_ &&
+                         blob.data() == mapped_data_ + mapped_size_));
+  if (is_contiguous) {
+    if (!mapped_blob_) {
+      mapped_blob_ = blob.blob();
+      mapped_data_ = blob.data();
+    }
+    mapped_size_ += blob.size();
+  } else {
+    if (buffer_.empty()) {
+      if (total_size_)
+        buffer_.reserve(static_cast<size_t>(total_size_));
+      buffer_.assign(mapped_data_, mapped_data_ + mapped_size_);
+      mapped_blob_.reset();
+      mapped_data_ = nullptr;
+      mapped_size_ = 0;
+    }
+    buffer_.insert(buffer_.end(), blob.data(), blob.data() + blob.size());
+  }
+
+  if (!total_size_) {
+    if (size() < kSnapshotHeaderSize)
+      return util::OkStatus();
+    RETURN_IF_ERROR(ParseSnapshotHeader(data(), size(), &total_size_));
+    if (!buffer_.empty())
+      buffer_.reserve(static_cast<size_t>(total_size_));
+  }
+  if (size() < total_size_)
+    return util::OkStatus();
+  if (size() > total_size_)
+    return util::ErrStatus("Unexpected data after the end of the snapshot");
+
+  SnapshotReader reader(data(), size());
+  util::Status status = context_->storage->DeserializeFromSnapshot(&reader);
+  loaded_ = true;
+  mapped_blob_.reset();
+  std::vector<uint8_t>().swap(buffer_);
+  return status;
+}
+
+void SnapshotTraceReader::NotifyEndOfFile() {
+  if (loaded_)
+    return;
+  PERFETTO_ELOG("Snapshot is truncated (%zu of %" PRIu64 " bytes received)",
+                size(), total_size_);
+  context_->storage->IncrementStats(stats::snapshot_truncated);
+}
+
+const uint8_t* SnapshotTraceReader::data() const {
+  return buffer_.empty() ? mapped_data_ : buffer_.data();
+}
+
+size_t SnapshotTraceReader::size() const {
+  return buffer_.empty() ? mapped_size_ : buffer_.size();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
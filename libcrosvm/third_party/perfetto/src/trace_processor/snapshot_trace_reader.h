@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SNAPSHOT_TRACE_READER_H_
+#define SRC_TRACE_PROCESSOR_SNAPSHOT_TRACE_READER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/trace_processor/ref_counted.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "src/trace_processor/importers/common/chunked_trace_reader.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceProcessorContext;
+
+// Loads a snapshot written by TraceProcessor::SaveSnapshot() into the
+// TraceStorage. The snapshot replaces the whole contents of the storage as
+// soon as all of its bytes have been received.
+//
+// When the snapshot is passed as consecutive slices of the same blob (e.g.
+// when the file is mmapped by ReadTrace()), the data is read in place;
+// otherwise the chunks are first copied into a contiguous buffer.
+class SnapshotTraceReader : public ChunkedTraceReader {
+ public:
+  explicit SnapshotTraceReader(TraceProcessorContext*);
+  ~SnapshotTraceReader() override;
+
+  // ChunkedTraceReader implementation.
+  util::Status Parse(TraceBlobView) override;
+  void NotifyEndOfFile() override;
+
+ private:
+  const uint8_t* data() const;
+  size_t size() const;
+
+  TraceProcessorContext* const context_;
+
+  // Set when all the chunks received so far are contiguous in the same blob.
+  RefPtr<TraceBlob> mapped_blob_;
+  const uint8_t* mapped_data_ = nullptr;
+  size_t mapped_size_ = 0;
+
+  // Used instead of the above as soon as a chunk is not contiguous.
+  std::vector<uint8_t> buffer_;
+
+  // Size of the snapshot, set once the header has been received.
+  uint64_t total_size_ = 0;
+  bool loaded_ = false;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SNAPSHOT_TRACE_READER_H_
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/snapshot_trace_reader.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/db/snapshot_io.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+class SnapshotTraceReaderTest : public ::testing::Test {
+ public:
+  SnapshotTraceReaderTest() {
+    context_.storage.reset(new TraceStorage());
+    reader_.reset(new SnapshotTraceReader(&context_));
+
+    TraceStorage source;
+    tables::ThreadTable::Row row(42);
+    row.name = source.InternString("thread");
+    row.start_ts = 1000;
+    source.mutable_thread_table()->Insert(row);
+    source.IncrementStats(stats::json_parser_failure, 3);
+    source.SetIndexedStats(stats::ftrace_cpu_bytes_read_delta, 2, 100);
+
+    base::TempFile file = base::TempFile::Create();
+    SnapshotWriter writer(file.fd());
+    source.SerializeToSnapshot(&writer);
+    PERFETTO_CHECK(writer.Finalize().ok());
+    PERFETTO_CHECK(base::ReadFile(file.path(), &snapshot_));
+  }
+
+ protected:
+  TraceBlobView SnapshotBlob() const {
+    return TraceBlobView(
+        TraceBlob::CopyFrom(snapshot_.data(), snapshot_.size()));
+  }
+
+  void CheckLoaded() {
+    const TraceStorage& storage = *context_.storage;
+    const auto& threads = storage.thread_table();
+    ASSERT_EQ(threads.row_count(), 1u);
+    ASSERT_EQ(threads.tid()[0], 42u);
+    ASSERT_EQ(threads.start_ts()[0], 1000);
+    ASSERT_EQ(storage.GetString(*threads.name()[0]), "thread");
+    ASSERT_EQ(storage.stats()[stats::json_parser_failure].value, 3);
+    ASSERT_EQ(storage.stats()[stats::ftrace_cpu_bytes_read_delta].indexed_values.at(2),
+              100);
+    ASSERT_EQ(storage.stats()[stats::snapshot_truncated].value, 0);
+  }
+
+  TraceProcessorContext context_;
+  std::unique_ptr<SnapshotTraceReader> reader_;
+  std::string snapshot_;
+};
+
+TEST_F(SnapshotTraceReaderTest, SingleChunk) {
+  ASSERT_TRUE(reader_->Parse(SnapshotBlob()).ok());
+  reader_->NotifyEndOfFile();
+  CheckLoaded();
+}
+
+TEST_F(SnapshotTraceReaderTest, ContiguousChunks) {
+  TraceBlobView blob = SnapshotBlob();
+  for (size_t off = 0; off < blob.size(); off += 7) {
+    size_t size = std::min<size_t>(7, blob.size() - off);
+    ASSERT_TRUE(reader_->Parse(blob.slice_off(off, size)).ok());
+  }
+  reader_->NotifyEndOfFile();
+  CheckLoaded();
+}
+
+TEST_F(SnapshotTraceReaderTest, CopiedChunks) {
+  for (size_t off = 0; off < snapshot_.size(); off += 5) {
+    size_t size = std::min<size_t>(5, snapshot_.size() - off);
+    TraceBlobView chunk(TraceBlob::CopyFrom(snapshot_.data() + off, size));
+    ASSERT_TRUE(reader_->Parse(std::move(chunk)).ok());
+  }
+  reader_->NotifyEndOfFile();
+  CheckLoaded();
+}
+
+TEST_F(SnapshotTraceReaderTest, Truncated) {
+  TraceBlobView blob = SnapshotBlob();
+  ASSERT_TRUE(reader_->Parse(blob.slice_off(0, blob.size() - 1)).ok());
+  reader_->NotifyEndOfFile();
+  ASSERT_EQ(context_.storage->thread_table().row_count(), 0u);
+  ASSERT_EQ(context_.storage->stats()[stats::snapshot_truncated].value, 1);
+}
+
+TEST_F(SnapshotTraceReaderTest, TrailingData) {
+  snapshot_.push_back('\0');
+  ASSERT_FALSE(reader_->Parse(SnapshotBlob()).ok());
+}
+
+TEST_F(SnapshotTraceReaderTest, UnsupportedVersion) {
+  snapshot_[kSnapshotMagicSize] = static_cast<char>(kSnapshotVersion + 1);
+  ASSERT_FALSE(reader_->Parse(SnapshotBlob()).ok());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sorter/spill_file.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/utils.h"
+#include "src/trace_processor/util/status_macros.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <unistd.h>
+#endif
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+// Size of the write buffer and of the read-ahead window.
+constexpr size_t kBufferSize = 1024 * 1024;
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) || PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+base::Status WriteAt(int, const uint8_t*, size_t, uint64_t) {
+  return base::ErrStatus("Spill files are not supported on this platform");
+}
+
+base::Status ReadAt(int, uint8_t*, size_t, uint64_t) {
+  return base::ErrStatus("Spill files are not supported on this platform");
+}
+#else
+// Writes at an explicit offset rather than appending, so that a write which
+// fails half-way can be retried without corrupting the file.
+base::Status WriteAt(int fd, const uint8_t* data, size_t size, uint64_t off) {
+  for (size_t done = 0; done < size;) {
+    ssize_t res = PERFETTO_EINTR(
+        pwrite(fd, data + done, size - done, static_cast<off_t>(off + done)));
+    if (res <= 0) {
+      return base::ErrStatus("Failed to write the spill file (errno: %d, %s)",
+                             errno, strerror(errno));
+    }
+    done += static_cast<size_t>(res);
+  }
+  return base::OkStatus();
+}
+
+base::Status ReadAt(int fd, uint8_t* data, size_t size, uint64_t off) {
+  for (size_t done = 0; done < size;) {
+    ssize_t res = PERFETTO_EINTR(
+        pread(fd, data + done, size - done, static_cast<off_t>(off + done)));
+    if (res < 0) {
+      return base::ErrStatus("Failed to read the spill file (errno: %d, %s)",
+                             errno, strerror(errno));
+    }
+    if (res == 0) {
+      return base::ErrStatus("Unexpected end of the spill file at %" PRIu64,
+                             off + done);
+    }
+    done += static_cast<size_t>(res);
+  }
+  return base::OkStatus();
+}
+#endif
+}  // namespace
+
+// static
+std::unique_ptr<SpillFile> SpillFile::Create() {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) || PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  return nullptr;
+#else
+  return std::unique_ptr<SpillFile>(
+      new SpillFile(base::TempFile::CreateUnlinked()));
+#endif
+}
+
+SpillFile::SpillFile(base::TempFile file) : file_(std::move(file)) {
+  write_buf_.reserve(kBufferSize);
+}
+
+SpillFile::~SpillFile() = default;
+
+base::Status SpillFile::Write(const TraceBlobView& data, Ref* ref) {
+  if (write_buf_.size() + data.size() > kBufferSize)
+    RETURN_IF_ERROR(Flush());
+
+  uint64_t offset = size();
+  if (data.size() > kBufferSize) {
+    // Too large for the write buffer (which is empty at this point).
+    RETURN_IF_ERROR(WriteAt(*file_, data.data(), data.size(), offset));
+    flushed_size_ += data.size();
+  } else {
+    write_buf_.insert(write_buf_.end(), data.data(), data.data() + data.size());
+  }
+  *ref = Ref{offset, static_cast<uint32_t>(data.size())};
+  return base::OkStatus();
+}
+
+base::Status SpillFile::Read(Ref ref, TraceBlobView* data) {
+  PERFETTO_DCHECK(ref.offset + ref.size <= size());
+  if (ref.size == 0) {
+    *data = TraceBlobView();
+    return base::OkStatus();
+  }
+
+  // Payloads are never split between the file and the write buffer.
+  if (ref.offset >= flushed_size_) {
+    const uint8_t* start = write_buf_.data() + (ref.offset - flushed_size_);
+    *data = TraceBlobView(TraceBlob::CopyFrom(start, ref.size));
+    return base::OkStatus();
+  }
+
+  if (ref.size > kBufferSize) {
+    TraceBlob blob = TraceBlob::Allocate(ref.size);
+    RETURN_IF_ERROR(ReadAt(*file_, blob.data(), ref.size, ref.offset));
+    *data = TraceBlobView(std::move(blob));
+    return base::OkStatus();
+  }
+
+  if (ref.offset < read_buf_offset_ ||
+      ref.offset + ref.size > read_buf_offset_ + read_buf_size_) {
+    if (!read_buf_)
+      read_buf_.reset(new uint8_t[kBufferSize]);
+    size_t read_size = static_cast<size_t>(
+        std::min<uint64_t>(kBufferSize, flushed_size_ - ref.offset));
+    // Invalidate the window first in case the read fails half-way.
+    read_buf_size_ = 0;
+    RETURN_IF_ERROR(ReadAt(*file_, read_buf_.get(), read_size, ref.offset));
+    read_buf_offset_ = ref.offset;
+    read_buf_size_ = read_size;
+  }
+  const uint8_t* start = read_buf_.get() + (ref.offset - read_buf_offset_);
+  *data = TraceBlobView(TraceBlob::CopyFrom(start, ref.size));
+  return base::OkStatus();
+}
+
+base::Status SpillFile::Flush() {
+  if (write_buf_.empty())
+    return base::OkStatus();
+  RETURN_IF_ERROR(
+      WriteAt(*file_, write_buf_.data(), write_buf_.size(), flushed_size_));
+  flushed_size_ += write_buf_.size();
+  write_buf_.clear();
+  return base::OkStatus();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
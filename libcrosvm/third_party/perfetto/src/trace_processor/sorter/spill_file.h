@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SORTER_SPILL_FILE_H_
+#define SRC_TRACE_PROCESSOR_SORTER_SPILL_FILE_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// An append-only, unlinked temporary file used by the TraceSorter to move
+// packet payloads out of memory while they wait to be sorted.
+//
+// Writes are buffered and reads are served from a read-ahead window: the
+// sorter extracts events in (mostly) the same order they were pushed, so
+// reading back payloads is (mostly) sequential. Both buffers are allocated
+// once and reused for the lifetime of the file.
+//
+// I/O errors (e.g. ENOSPC or EIO) are returned to the caller rather than
+// being fatal: a failed write can be retried and leaves the file unchanged.
+class SpillFile {
+ public:
+  struct Ref {
+    uint64_t offset;
+    uint32_t size;
+  };
+
+  // Returns nullptr if spilling is not supported on this platform.
+  static std::unique_ptr<SpillFile> Create();
+
+  ~SpillFile();
+
+  // Copies the payload of |data| to the end of the file. On success, |ref| is
+  // set to the location to pass to Read().
+  base::Status Write(const TraceBlobView& data, Ref* ref);
+
+  // Reads back the payload previously written by Write() into |data|. The
+  // payload is copied into a blob of its own, so the returned view does not
+  // keep the read-ahead window alive.
+  base::Status Read(Ref ref, TraceBlobView* data);
+
+  // Total number of bytes written to the file so far.
+  uint64_t size() const { return flushed_size_ + write_buf_.size(); }
+
+ private:
+  explicit SpillFile(base::TempFile file);
+
+  base::Status Flush();
+
+  base::TempFile file_;
+
+  // Payloads which have been written but not flushed to |file_| yet.
+  std::vector<uint8_t> write_buf_;
+  uint64_t flushed_size_ = 0;
+
+  // A copy of the file contents in [read_buf_offset_, read_buf_offset_ +
+  // read_buf_size_).
+  std::unique_ptr<uint8_t[]> read_buf_;
+  uint64_t read_buf_offset_ = 0;
+  size_t read_buf_size_ = 0;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SORTER_SPILL_FILE_H_
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sorter/spill_file.h"
+
+#include <string>
+#include <vector>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+
+TraceBlobView BlobFromString(const std::string& str) {
+  return TraceBlobView(TraceBlob::CopyFrom(str.data(), str.size()));
+}
+
+SpillFile::Ref WriteString(SpillFile* file, const std::string& str) {
+  SpillFile::Ref ref{};
+  base::Status status = file->Write(BlobFromString(str), &ref);
+  PERFETTO_CHECK(status.ok());
+  return ref;
+}
+
+std::string ReadString(SpillFile* file, SpillFile::Ref ref) {
+  TraceBlobView tbv;
+  base::Status status = file->Read(ref, &tbv);
+  PERFETTO_CHECK(status.ok());
+  return std::string(reinterpret_cast<const char*>(tbv.data()), tbv.size());
+}
+
+TEST(SpillFileTest, ReadBackUnflushed) {
+  auto file = SpillFile::Create();
+  ASSERT_TRUE(file);
+  SpillFile::Ref foo = WriteString(file.get(), "foo");
+  SpillFile::Ref bar = WriteString(file.get(), "bar");
+  EXPECT_EQ(file->size(), 6u);
+  EXPECT_EQ(ReadString(file.get(), bar), "bar");
+  EXPECT_EQ(ReadString(file.get(), foo), "foo");
+}
+
+TEST(SpillFileTest, EmptyPayload) {
+  auto file = SpillFile::Create();
+  SpillFile::Ref empty = WriteString(file.get(), "");
+  EXPECT_EQ(ReadString(file.get(), empty), "");
+}
+
+TEST(SpillFileTest, ManyPayloads) {
+  // Write enough data to go through several flushes and read-ahead windows.
+  auto file = SpillFile::Create();
+  std::vector<std::pair<SpillFile::Ref, std::string>> payloads;
+  for (uint32_t i = 0; i < 10000; ++i) {
+    std::string payload(i % 1000, static_cast<char>('a' + i % 26));
+    payloads.emplace_back(WriteString(file.get(), payload), payload);
+  }
+
+  // Interleave a large payload which doesn't fit in the read-ahead window.
+  std::string large(3 * 1024 * 1024, 'x');
+  SpillFile::Ref large_ref = WriteString(file.get(), large);
+
+  for (size_t i = 0; i < payloads.size(); i += 7) {
+    ASSERT_EQ(ReadString(file.get(), payloads[i].first), payloads[i].second);
+  }
+  EXPECT_EQ(ReadString(file.get(), large_ref), large);
+
+  // Read some payloads backwards as well.
+  for (size_t i = payloads.size(); i > 0; i -= 13) {
+    ASSERT_EQ(ReadString(file.get(), payloads[i - 1].first),
+              payloads[i - 1].second);
+    if (i < 13)
+      break;
+  }
+}
+
+TEST(SpillFileTest, ReadViewsOutliveWindow) {
+  // Views returned by Read() must stay valid after the read-ahead window has
+  // been refilled with other parts of the file.
+  auto file = SpillFile::Create();
+  std::vector<SpillFile::Ref> refs;
+  for (uint32_t i = 0; i < 64; ++i)
+    refs.push_back(WriteString(file.get(), std::string(64 * 1024, 'a' + i)));
+
+  std::vector<TraceBlobView> views;
+  for (const SpillFile::Ref& ref : refs) {
+    TraceBlobView tbv;
+    ASSERT_TRUE(file->Read(ref, &tbv).ok());
+    views.push_back(std::move(tbv));
+  }
+  for (uint32_t i = 0; i < views.size(); ++i) {
+    ASSERT_EQ(views[i].size(), 64u * 1024u);
+    ASSERT_EQ(views[i].data()[0], 'a' + i);
+    ASSERT_EQ(views[i].data()[views[i].size() - 1], 'a' + i);
+  }
+}
+
+#endif  // !OS_WIN && !OS_WASM
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
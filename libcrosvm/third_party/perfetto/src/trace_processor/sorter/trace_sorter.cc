@@ -15,6 +15,8 @@
  */
 
 #include <algorithm>
+#include <functional>
+#include <limits>
 #include <memory>
 #include <utility>
 
@@ -37,6 +39,13 @@ TraceSorter::TraceSorter(TraceProcessorContext* context,
   bypass_next_stage_for_testing_ = env && !strcmp(env, "1");
   if (bypass_next_stage_for_testing_)
     PERFETTO_ELOG("TEST MODE: bypassing protobuf parsing stage");
+
+  if (context_->config.sorting_memory_limit_bytes > 0) {
+    spill_file_ = SpillFile::Create();
+    memory_limit_bytes_ = context_->config.sorting_memory_limit_bytes;
+    if (!spill_file_)
+      PERFETTO_ELOG("Sorting memory limit not supported on this platform");
+  }
 }
 
 TraceSorter::~TraceSorter() {
@@ -62,12 +71,19 @@ void TraceSorter::Queue::Sort() {
 
   // We know that all events between [0, sort_start_idx_] are sorted. Within
   // this range, perform a bound search and find the iterator for the min
-  // timestamp that broke the monotonicity. Re-sort from there to the end.
+  // timestamp that broke the monotonicity. Only the events from there to the
+  // end need to be reordered.
   auto sort_end = events_.begin() + static_cast<ssize_t>(sort_start_idx_);
   PERFETTO_DCHECK(std::is_sorted(events_.begin(), sort_end));
   auto sort_begin = std::lower_bound(events_.begin(), sort_end, sort_min_ts_,
                                      &TimestampedDescriptor::Compare);
-  std::sort(sort_begin, events_.end());
+
+  // Rather than re-sorting the whole [sort_begin, end) range, only sort the
+  // out-of-order tail and merge it with the (already sorted) overlapping part
+  // of the head. The tail is typically much smaller than the overlap, so this
+  // turns an O(n log n) sort into an O(t log t + n) sort + merge.
+  std::sort(sort_end, events_.end());
+  std::inplace_merge(sort_begin, sort_end, events_.end());
   sort_start_idx_ = 0;
   sort_min_ts_ = 0;
 
@@ -89,44 +105,38 @@ void TraceSorter::Queue::Sort() {
 //  q2              {min_ts: 12    max_ts: 40}
 //
 // We know that we can extract all events from q1 until we hit ts=10 without
-// looking at any other queue. After hitting ts=10, we need to re-look to all of
-// them to figure out the next min-event.
-// There are more suitable data structures to do this (e.g. keeping a min-heap
-// to avoid re-scanning all the queues all the times) but doesn't seem worth it.
-// With Android traces (that have 8 CPUs) this function accounts for ~1-3% cpu
-// time in a profiler.
+// looking at any other queue. After hitting ts=10, we need to figure out the
+// next min-event again.
+// The queues are kept in a binary min-heap keyed by their min_ts (ties are
+// broken by queue index) so that finding the two oldest queues is O(1) and
+// re-inserting the queue we just extracted from is O(log N). This matters for
+// traces from machines with 100+ CPUs where re-scanning all the queues for
+// every burst would dominate the merge.
 void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_offset) {
   constexpr int64_t kTsMax = std::numeric_limits<int64_t>::max();
-  for (;;) {
-    size_t min_queue_idx = 0;  // The index of the queue with the min(ts).
-
-    // The top-2 min(ts) among all queues.
-    // queues_[min_queue_idx].events.timestamp == min_queue_ts[0].
-    int64_t min_queue_ts[2]{kTsMax, kTsMax};
-
-    // This loop identifies the queue which starts with the earliest event and
-    // also remembers the earliest event of the 2nd queue (in min_queue_ts[1]).
-    bool has_queues_with_expired_events = false;
-    for (size_t i = 0; i < queues_.size(); i++) {
-      auto& queue = queues_[i];
-      if (queue.events_.empty())
-        continue;
-      PERFETTO_DCHECK(queue.min_ts_ >= global_min_ts_);
-      PERFETTO_DCHECK(queue.max_ts_ <= global_max_ts_);
-      if (!has_queues_with_expired_events || queue.min_ts_ < min_queue_ts[0]) {
-        min_queue_ts[1] = min_queue_ts[0];
-        min_queue_ts[0] = queue.min_ts_;
-        min_queue_idx = i;
-        has_queues_with_expired_events = true;
-      } else if (queue.min_ts_ < min_queue_ts[1]) {
-        min_queue_ts[1] = queue.min_ts_;
-      }
-    }
-    if (!has_queues_with_expired_events) {
-      // All the queues have events that start after the window (i.e. they are
-      // too recent and not eligible to be extracted given the current window).
-      break;
-    }
+  merge_heap_.clear();
+  for (size_t i = 0; i < queues_.size(); i++) {
+    const Queue& queue = queues_[i];
+    if (queue.events_.empty())
+      continue;
+    PERFETTO_DCHECK(queue.min_ts_ >= global_min_ts_);
+    PERFETTO_DCHECK(queue.max_ts_ <= global_max_ts_);
+    merge_heap_.push_back(MergeHeapEntry{queue.min_ts_, i});
+  }
+  std::make_heap(merge_heap_.begin(), merge_heap_.end(),
+                 std::greater<MergeHeapEntry>());
+
+  // If the heap is empty, all the queues have no events that can be
+  // extracted.
+  while (!merge_heap_.empty()) {
+    // The queue with the min(ts) is at the root of the heap and the 2nd one is
+    // one of its children.
+    size_t min_queue_idx = merge_heap_[0].queue_idx;
+    int64_t next_queue_min_ts = kTsMax;
+    if (merge_heap_.size() > 1)
+      next_queue_min_ts = merge_heap_[1].ts;
+    if (merge_heap_.size() > 2)
+      next_queue_min_ts = std::min(next_queue_min_ts, merge_heap_[2].ts);
 
     Queue& queue = queues_[min_queue_idx];
     auto& events = queue.events_;
@@ -141,7 +151,7 @@ void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_offset) {
     size_t num_extracted = 0;
     for (auto& event : events) {
       if (event.descriptor.offset() >= limit_offset ||
-          event.ts > min_queue_ts[1]) {
+          event.ts > next_queue_min_ts) {
         break;
       }
 
@@ -151,7 +161,7 @@ void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_offset) {
 
     if (!num_extracted) {
       // No events can be extracted from any of the queues. This means that
-      // either we hit the window or all queues are empty.
+      // we hit the window.
       break;
     }
 
@@ -164,10 +174,13 @@ void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_offset) {
     variadic_queue_.FreeMemory();
 
     // Update the global_{min,max}_ts to reflect the bounds after extraction.
+    std::pop_heap(merge_heap_.begin(), merge_heap_.end(),
+                  std::greater<MergeHeapEntry>());
     if (events.empty()) {
+      merge_heap_.pop_back();
       queue.min_ts_ = kTsMax;
       queue.max_ts_ = 0;
-      global_min_ts_ = min_queue_ts[1];
+      global_min_ts_ = next_queue_min_ts;
 
       // If we extraced the max entry from a queue (i.e. we emptied the queue)
       // we need to recompute the global max, because it might have been the one
@@ -177,9 +190,12 @@ void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_offset) {
         global_max_ts_ = std::max(global_max_ts_, q.max_ts_);
     } else {
       queue.min_ts_ = queue.events_.front().ts;
-      global_min_ts_ = std::min(queue.min_ts_, min_queue_ts[1]);
+      global_min_ts_ = std::min(queue.min_ts_, next_queue_min_ts);
+      merge_heap_.back().ts = queue.min_ts_;
+      std::push_heap(merge_heap_.begin(), merge_heap_.end(),
+                     std::greater<MergeHeapEntry>());
     }
-  }  // for(;;)
+  }  // while (!merge_heap_.empty())
 
 #if PERFETTO_DCHECK_IS_ON()
   // Check that the global min/max are consistent.
@@ -194,19 +210,69 @@ void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_offset) {
 #endif
 }
 
+bool TraceSorter::Spill(const TraceBlobView& packet, SpillFile::Ref* ref) {
+  base::Status status = spill_file_->Write(packet, ref);
+  if (!status.ok()) {
+    PERFETTO_ELOG("%s: keeping packets in memory", status.c_message());
+    context_->storage->IncrementStats(stats::sorter_spill_failures);
+    spill_write_failed_ = true;
+    return false;
+  }
+  context_->storage->IncrementStats(stats::sorter_spilled_bytes,
+                                    static_cast<int64_t>(packet.size()));
+  return true;
+}
+
+bool TraceSorter::ReadSpilled(SpillFile::Ref ref, TraceBlobView* packet) {
+  base::Status status = spill_file_->Read(ref, packet);
+  if (!status.ok()) {
+    PERFETTO_ELOG("%s: dropping packet", status.c_message());
+    context_->storage->IncrementStats(stats::sorter_spill_failures);
+    return false;
+  }
+  return true;
+}
+
+base::Optional<TracePacketData> TraceSorter::EvictTracePacketData(
+    const TimestampedDescriptor& ts_desc) {
+  if (ts_desc.descriptor.type() == EventType::kTracePacket ||
+      ts_desc.descriptor.type() == EventType::kFtraceEvent) {
+    TracePacketData data = EvictTypedVariadic<TracePacketData>(ts_desc);
+    in_memory_packet_bytes_ -= data.packet.size();
+    return data;
+  }
+  auto spilled = EvictTypedVariadic<SpilledPacket<TracePacketData>>(ts_desc);
+  if (!ReadSpilled(spilled.ref, &spilled.data.packet))
+    return base::nullopt;
+  return std::move(spilled.data);
+}
+
+base::Optional<TrackEventData> TraceSorter::EvictTrackEventData(
+    const TimestampedDescriptor& ts_desc) {
+  if (ts_desc.descriptor.type() == EventType::kTrackEvent) {
+    TrackEventData data = EvictTypedVariadic<TrackEventData>(ts_desc);
+    in_memory_packet_bytes_ -= data.trace_packet_data.packet.size();
+    return data;
+  }
+  auto spilled = EvictTypedVariadic<SpilledPacket<TrackEventData>>(ts_desc);
+  if (!ReadSpilled(spilled.ref, &spilled.data.trace_packet_data.packet))
+    return base::nullopt;
+  return std::move(spilled.data);
+}
+
 void TraceSorter::EvictVariadic(const TimestampedDescriptor& ts_desc) {
   switch (ts_desc.descriptor.type()) {
     case EventType::kTracePacket:
-      EvictTypedVariadic<TracePacketData>(ts_desc);
+      EvictTracePacketData(ts_desc);
       return;
     case EventType::kTrackEvent:
-      EvictTypedVariadic<TrackEventData>(ts_desc);
+      EvictTrackEventData(ts_desc);
       return;
     case EventType::kFuchsiaRecord:
       EvictTypedVariadic<FuchsiaRecord>(ts_desc);
       return;
     case EventType::kJsonValue:
-      EvictTypedVariadic<std::string>(ts_desc);
+      EvictTypedVariadic<TraceBlobView>(ts_desc);
       return;
     case EventType::kSystraceLine:
       EvictTypedVariadic<SystraceLine>(ts_desc);
@@ -218,7 +284,15 @@ void TraceSorter::EvictVariadic(const TimestampedDescriptor& ts_desc) {
       EvictTypedVariadic<InlineSchedWaking>(ts_desc);
       return;
     case EventType::kFtraceEvent:
-      EvictTypedVariadic<TracePacketData>(ts_desc);
+      EvictTracePacketData(ts_desc);
+      return;
+    case EventType::kSpilledTracePacket:
+    case EventType::kSpilledFtraceEvent:
+      // No need to read back the payload of packets which are being dropped.
+      EvictTypedVariadic<SpilledPacket<TracePacketData>>(ts_desc);
+      return;
+    case EventType::kSpilledTrackEvent:
+      EvictTypedVariadic<SpilledPacket<TrackEventData>>(ts_desc);
       return;
     case EventType::kInvalid:
       PERFETTO_FATAL("Invalid event type");
@@ -229,20 +303,26 @@ void TraceSorter::EvictVariadic(const TimestampedDescriptor& ts_desc) {
 void TraceSorter::ParseTracePacket(const TimestampedDescriptor& ts_desc) {
   switch (ts_desc.descriptor.type()) {
     case EventType::kTracePacket:
-      parser_->ParseTracePacket(ts_desc.ts,
-                                EvictTypedVariadic<TracePacketData>(ts_desc));
+    case EventType::kSpilledTracePacket: {
+      base::Optional<TracePacketData> data = EvictTracePacketData(ts_desc);
+      if (data)
+        parser_->ParseTracePacket(ts_desc.ts, std::move(*data));
       return;
+    }
     case EventType::kTrackEvent:
-      parser_->ParseTrackEvent(ts_desc.ts,
-                               EvictTypedVariadic<TrackEventData>(ts_desc));
+    case EventType::kSpilledTrackEvent: {
+      base::Optional<TrackEventData> data = EvictTrackEventData(ts_desc);
+      if (data)
+        parser_->ParseTrackEvent(ts_desc.ts, std::move(*data));
       return;
+    }
     case EventType::kFuchsiaRecord:
       parser_->ParseFuchsiaRecord(ts_desc.ts,
                                   EvictTypedVariadic<FuchsiaRecord>(ts_desc));
       return;
     case EventType::kJsonValue:
       parser_->ParseJsonPacket(ts_desc.ts,
-                               EvictTypedVariadic<std::string>(ts_desc));
+                               EvictTypedVariadic<TraceBlobView>(ts_desc));
       return;
     case EventType::kSystraceLine:
       parser_->ParseSystraceLine(ts_desc.ts,
@@ -251,6 +331,7 @@ void TraceSorter::ParseTracePacket(const TimestampedDescriptor& ts_desc) {
     case EventType::kInlineSchedSwitch:
     case EventType::kInlineSchedWaking:
     case EventType::kFtraceEvent:
+    case EventType::kSpilledFtraceEvent:
     case EventType::kInvalid:
       PERFETTO_FATAL("Invalid event type");
   }
@@ -269,12 +350,17 @@ void TraceSorter::ParseFtracePacket(uint32_t cpu,
           cpu, ts_desc.ts, EvictTypedVariadic<InlineSchedWaking>(ts_desc));
       return;
     case EventType::kFtraceEvent:
-      parser_->ParseFtraceEvent(cpu, ts_desc.ts,
-                                EvictTypedVariadic<TracePacketData>(ts_desc));
+    case EventType::kSpilledFtraceEvent: {
+      base::Optional<TracePacketData> data = EvictTracePacketData(ts_desc);
+      if (data)
+        parser_->ParseFtraceEvent(cpu, ts_desc.ts, std::move(*data));
       return;
+    }
     case EventType::kTrackEvent:
+    case EventType::kSpilledTrackEvent:
     case EventType::kSystraceLine:
     case EventType::kTracePacket:
+    case EventType::kSpilledTracePacket:
     case EventType::kJsonValue:
     case EventType::kFuchsiaRecord:
     case EventType::kInvalid:
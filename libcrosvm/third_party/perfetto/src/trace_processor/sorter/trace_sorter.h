@@ -19,10 +19,12 @@
 
 #include <algorithm>
 #include <memory>
+#include <tuple>
 #include <utility>
 #include <vector>
 
 #include "perfetto/ext/base/circular_queue.h"
+#include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
@@ -30,6 +32,7 @@
 #include "src/trace_processor/importers/common/trace_parser.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_record.h"
 #include "src/trace_processor/importers/systrace/systrace_line.h"
+#include "src/trace_processor/sorter/spill_file.h"
 #include "src/trace_processor/sorter/trace_sorter_queue.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 
@@ -45,6 +48,9 @@ enum class EventType : uint8_t {
   kFuchsiaRecord,
   kTrackEvent,
   kSystraceLine,
+  kSpilledTracePacket,
+  kSpilledFtraceEvent,
+  kSpilledTrackEvent,
   kInvalid,
   kSize = kInvalid,
 };
@@ -82,7 +88,8 @@ class VariadicQueue;
 //
 // Due to this, this class is oprerates as a streaming merge-sort of N+1 queues
 // (N = num cpus + 1 for non-ftrace events). Each queue in turn gets sorted (if
-// necessary) before proceeding with the global merge-sort-extract.
+// necessary) before proceeding with the global merge-sort-extract, which keeps
+// the queues in a min-heap keyed by their oldest event.
 //
 // When an event is pushed through, it is just appended to the end of one of
 // the N queues. While appending, we keep track of the fact that the queue
@@ -97,8 +104,17 @@ class VariadicQueue;
 // At any time, the first partition of |events_| [0 .. sort_start_idx_) is
 // ordered, and the second partition [sort_start_idx_.. end] is not.
 // We use a logarithmic bound search operation to figure out what is the index
-// within the first partition where sorting should start, and sort all events
-// from there to the end.
+// within the first partition where the events need to be reordered. Only the
+// second partition is then sorted and merged back into the first one.
+//
+// Bounded memory sorting
+//
+// When Config::sorting_memory_limit_bytes is set, the payload of packets
+// pushed after the limit is reached are written to a SpillFile rather than
+// being kept in the |variadic_queue_|. Only their sort keys and the remaining
+// (small) fields stay in memory. The payloads are read back when the events
+// are extracted: since the extraction order is mostly the push order, this
+// results in mostly sequential reads of the file.
 class TraceSorter {
  private:
   using VariadicQueue = trace_sorter_internal::VariadicQueue;
@@ -117,12 +133,21 @@ class TraceSorter {
   inline void PushTracePacket(int64_t timestamp,
                               RefPtr<PacketSequenceStateGeneration> state,
                               TraceBlobView event) {
+    SpillFile::Ref ref{};
+    if (PERFETTO_UNLIKELY(ShouldSpill(event)) && Spill(event, &ref)) {
+      SpilledPacket<TracePacketData> spilled{
+          {TraceBlobView(), std::move(state)}, ref};
+      AppendNonFtraceEvent(timestamp, variadic_queue_.Append(std::move(spilled)),
+                           EventType::kSpilledTracePacket);
+      return;
+    }
+    in_memory_packet_bytes_ += event.size();
     TracePacketData tpd{std::move(event), std::move(state)};
     AppendNonFtraceEvent(timestamp, variadic_queue_.Append(std::move(tpd)),
                          EventType::kTracePacket);
   }
 
-  inline void PushJsonValue(int64_t timestamp, std::string json_value) {
+  inline void PushJsonValue(int64_t timestamp, TraceBlobView json_value) {
     AppendNonFtraceEvent(timestamp,
                          variadic_queue_.Append(std::move(json_value)),
                          EventType::kJsonValue);
@@ -143,6 +168,16 @@ class TraceSorter {
 
   inline void PushTrackEventPacket(int64_t timestamp,
                                    TrackEventData track_event) {
+    TraceBlobView& packet = track_event.trace_packet_data.packet;
+    SpillFile::Ref ref{};
+    if (PERFETTO_UNLIKELY(ShouldSpill(packet)) && Spill(packet, &ref)) {
+      packet = TraceBlobView();
+      SpilledPacket<TrackEventData> spilled{std::move(track_event), ref};
+      AppendNonFtraceEvent(timestamp, variadic_queue_.Append(std::move(spilled)),
+                           EventType::kSpilledTrackEvent);
+      return;
+    }
+    in_memory_packet_bytes_ += packet.size();
     AppendNonFtraceEvent(timestamp,
                          variadic_queue_.Append(std::move(track_event)),
                          EventType::kTrackEvent);
@@ -153,6 +188,17 @@ class TraceSorter {
                               TraceBlobView event,
                               RefPtr<PacketSequenceStateGeneration> state) {
     auto* queue = GetQueue(cpu + 1);
+    SpillFile::Ref spill_ref{};
+    if (PERFETTO_UNLIKELY(ShouldSpill(event)) && Spill(event, &spill_ref)) {
+      SpilledPacket<TracePacketData> spilled{
+          {TraceBlobView(), std::move(state)}, spill_ref};
+      queue->Append(TimestampedDescriptor{
+          timestamp, Descriptor(variadic_queue_.Append(std::move(spilled)),
+                                EventType::kSpilledFtraceEvent)});
+      UpdateGlobalTs(queue);
+      return;
+    }
+    in_memory_packet_bytes_ += event.size();
     VariadicQueue::ValueReference ref = variadic_queue_.Append(
         TracePacketData{std::move(event), std::move(state)});
     queue->Append(TimestampedDescriptor{
@@ -324,6 +370,26 @@ class TraceSorter {
     int64_t sort_min_ts_ = std::numeric_limits<int64_t>::max();
   };
 
+  // An entry of the min-heap used to merge |queues_| in
+  // SortAndExtractEventsUntilPacket().
+  struct MergeHeapEntry {
+    int64_t ts;  // The min_ts_ of the queue.
+    size_t queue_idx;
+
+    // Ties are broken by queue index to keep the extraction order stable.
+    bool operator>(const MergeHeapEntry& other) const {
+      return std::tie(ts, queue_idx) > std::tie(other.ts, other.queue_idx);
+    }
+  };
+
+  // A packet whose payload has been written to |spill_file_|. The payload
+  // inside |data| is empty.
+  template <typename T>
+  struct SpilledPacket {
+    T data;
+    SpillFile::Ref ref;
+  };
+
   void SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx);
 
   inline Queue* GetQueue(size_t index) {
@@ -354,6 +420,28 @@ class TraceSorter {
         ts_desc.descriptor.ToVariadicQueueValueReference());
   }
 
+  // Like EvictTypedVariadic() but also keeps track of |in_memory_packet_bytes_|
+  // or reads back the payload from |spill_file_| for spilled packets. Returns
+  // nullopt if the payload of a spilled packet could not be read back.
+  base::Optional<TracePacketData> EvictTracePacketData(
+      const TimestampedDescriptor& ts_desc);
+  base::Optional<TrackEventData> EvictTrackEventData(
+      const TimestampedDescriptor& ts_desc);
+
+  inline bool ShouldSpill(const TraceBlobView& packet) const {
+    return spill_file_ && !spill_write_failed_ &&
+           in_memory_packet_bytes_ + packet.size() > memory_limit_bytes_;
+  }
+
+  // Writes the payload of |packet| to |spill_file_|. Returns false (and
+  // disables spilling) if the write fails, in which case the packet should be
+  // kept in memory.
+  bool Spill(const TraceBlobView& packet, SpillFile::Ref* ref);
+
+  // Reads back the payload of a spilled packet. Returns false if the read
+  // fails, in which case the packet is dropped.
+  bool ReadSpilled(SpillFile::Ref ref, TraceBlobView* packet);
+
   void EvictVariadic(const TimestampedDescriptor& ts_desc);
 
   void MaybePushAndEvictEvent(size_t queue_idx,
@@ -378,11 +466,25 @@ class TraceSorter {
   // Stores the metadata for each event type in a memory efficient manner.
   VariadicQueue variadic_queue_;
 
+  // Only set if Config::sorting_memory_limit_bytes is non-zero (and spilling
+  // is supported on this platform).
+  std::unique_ptr<SpillFile> spill_file_;
+  uint64_t memory_limit_bytes_ = 0;
+  bool spill_write_failed_ = false;
+
+  // The total size of the payloads of the packets in |variadic_queue_| which
+  // have not been spilled.
+  uint64_t in_memory_packet_bytes_ = 0;
+
   // queues_[0] is the general (non-ftrace) queue.
   // queues_[1] is the ftrace queue for CPU(0).
   // queues_[x] is the ftrace queue for CPU(x - 1).
   std::vector<Queue> queues_;
 
+  // Scratch space for SortAndExtractEventsUntilPacket(), kept around to avoid
+  // re-allocating it on every incremental extraction.
+  std::vector<MergeHeapEntry> merge_heap_;
+
   // max(e.timestamp for e in queues_).
   int64_t global_max_ts_ = 0;
 
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "src/trace_processor/importers/common/parser_types.h"
+#include "src/trace_processor/importers/common/trace_parser.h"
+#include "src/trace_processor/sorter/trace_sorter.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+
+using perfetto::trace_processor::InlineSchedSwitch;
+using perfetto::trace_processor::TraceParser;
+using perfetto::trace_processor::TraceProcessorContext;
+using perfetto::trace_processor::TraceSorter;
+using perfetto::trace_processor::TraceStorage;
+
+namespace {
+
+// Total number of events pushed into the sorter on each iteration. Spread
+// evenly across all the CPUs.
+static constexpr uint32_t kNumEvents = 1024 * 1024;
+
+// Number of consecutive events for the same CPU, mimicking ftrace bundles.
+static constexpr uint32_t kBundleSize = 64;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+// Args: {number of CPUs, percentage of out-of-order events}.
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Args({8, 1});
+    return;
+  }
+  for (int64_t cpus : {8, 32, 128, 256}) {
+    for (int64_t disorder : {0, 1, 10})
+      b->Args({cpus, disorder});
+  }
+}
+
+class NoopParser : public TraceParser {
+ public:
+  void ParseInlineSchedSwitch(uint32_t, int64_t, InlineSchedSwitch) override {}
+};
+
+struct Event {
+  uint32_t cpu;
+  int64_t ts;
+};
+
+// Generates the events in the order they would be seen by the tokenizer:
+// bundles of events for one CPU at a time, with timestamps monotonic within
+// each CPU except for |disorder_pct| percent of the events which are moved
+// back in time.
+std::vector<Event> CreateEvents(uint32_t num_cpus, uint32_t disorder_pct) {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+
+  std::vector<int64_t> cpu_ts(num_cpus, 1000000);
+  std::vector<Event> events;
+  events.reserve(kNumEvents);
+  while (events.size() < kNumEvents) {
+    uint32_t cpu = static_cast<uint32_t>(rnd_engine() % num_cpus);
+    for (uint32_t i = 0; i < kBundleSize; ++i) {
+      cpu_ts[cpu] += 1 + static_cast<int64_t>(rnd_engine() % 100);
+      int64_t ts = cpu_ts[cpu];
+      if (rnd_engine() % 100 < disorder_pct)
+        ts -= static_cast<int64_t>(rnd_engine() % 10000);
+      events.push_back(Event{cpu, ts});
+    }
+  }
+  return events;
+}
+
+}  // namespace
+
+static void BM_TraceSorterPushAndExtract(benchmark::State& state) {
+  std::vector<Event> events =
+      CreateEvents(static_cast<uint32_t>(state.range(0)),
+                   static_cast<uint32_t>(state.range(1)));
+
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+  for (auto _ : state) {
+    context.sorter.reset(
+        new TraceSorter(&context, std::unique_ptr<TraceParser>(new NoopParser),
+                        TraceSorter::SortingMode::kFullSort));
+    for (const Event& event : events)
+      context.sorter->PushInlineFtraceEvent(event.cpu, event.ts,
+                                            InlineSchedSwitch{});
+    context.sorter->ExtractEventsForced();
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(events.size()));
+}
+BENCHMARK(BM_TraceSorterPushAndExtract)->Apply(BenchmarkArgs);
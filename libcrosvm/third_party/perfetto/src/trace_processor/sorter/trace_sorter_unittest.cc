@@ -15,10 +15,13 @@
  */
 #include "src/trace_processor/importers/proto/proto_trace_parser.h"
 
+#include <algorithm>
 #include <map>
 #include <random>
+#include <string>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/trace_blob.h"
 #include "src/trace_processor/importers/common/parser_types.h"
@@ -312,6 +315,89 @@ TEST_F(TraceSorterTest, MultiQueueSorting) {
   EXPECT_TRUE(expectations.empty());
 }
 
+// Simulates ftrace data from a machine with many CPUs where each CPU is mostly
+// sorted, with the occasional event going back in time. Exercises both the
+// merge of the sorted/unsorted partitions inside a queue and the merge of the
+// queues.
+TEST_F(TraceSorterTest, ManyQueuesMostlySorted) {
+  PacketSequenceState state(&context_);
+  std::minstd_rand0 rnd_engine(0);
+  constexpr uint32_t kNumCpus = 128;
+
+  std::vector<int64_t> expected_ts;
+  std::vector<int64_t> cpu_ts(kNumCpus, 1000000);
+  for (int i = 0; i < 20000; i++) {
+    uint32_t cpu = static_cast<uint32_t>(rnd_engine() % kNumCpus);
+    cpu_ts[cpu] += static_cast<int64_t>(rnd_engine() % 100);
+    int64_t ts = cpu_ts[cpu];
+    if (rnd_engine() % 20 == 0)
+      ts -= static_cast<int64_t>(rnd_engine() % 1000);
+    expected_ts.push_back(ts);
+    context_.sorter->PushFtraceEvent(cpu, ts, TraceBlobView(),
+                                     state.current_generation());
+  }
+  std::sort(expected_ts.begin(), expected_ts.end());
+
+  std::vector<int64_t> actual_ts;
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(_, _, _, _))
+      .WillRepeatedly(
+          Invoke([&actual_ts](uint32_t, int64_t timestamp, const uint8_t*,
+                              size_t) { actual_ts.push_back(timestamp); }));
+  context_.sorter->ExtractEventsForced();
+  EXPECT_EQ(actual_ts, expected_ts);
+}
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+// Checks that packets over the sorting memory limit are spilled to disk and
+// read back with the same contents, in the right order.
+TEST_F(TraceSorterTest, SpillToDisk) {
+  context_.config.sorting_memory_limit_bytes = 8;
+  CreateSorter();
+
+  PacketSequenceState state(&context_);
+  std::vector<std::string> payloads = {"aaaa", "bbbb", "cccc", "dddd", "eeee"};
+  auto blob = [](const std::string& str) {
+    return TraceBlobView(TraceBlob::CopyFrom(str.data(), str.size()));
+  };
+  auto to_string = [](const uint8_t* data, size_t size) {
+    return std::string(reinterpret_cast<const char*>(data), size);
+  };
+
+  std::vector<std::pair<int64_t, std::string>> parsed;
+  EXPECT_CALL(*parser_, MOCK_ParseTracePacket(_, _, _))
+      .WillRepeatedly(Invoke(
+          [&](int64_t ts, const uint8_t* data, size_t size) {
+            parsed.emplace_back(ts, to_string(data, size));
+          }));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(_, _, _, _))
+      .WillRepeatedly(Invoke(
+          [&](uint32_t, int64_t ts, const uint8_t* data, size_t size) {
+            parsed.emplace_back(ts, to_string(data, size));
+          }));
+
+  // The first two packets fit in the limit, all the others are spilled.
+  context_.sorter->PushTracePacket(1005, state.current_generation(),
+                                   blob(payloads[4]));
+  context_.sorter->PushFtraceEvent(0, 1001, blob(payloads[0]),
+                                   state.current_generation());
+  context_.sorter->PushTracePacket(1003, state.current_generation(),
+                                   blob(payloads[2]));
+  context_.sorter->PushFtraceEvent(1, 1004, blob(payloads[3]),
+                                   state.current_generation());
+  context_.sorter->PushTracePacket(1002, state.current_generation(),
+                                   blob(payloads[1]));
+  EXPECT_EQ(context_.storage->stats()[stats::sorter_spilled_bytes].value, 12);
+
+  context_.sorter->ExtractEventsForced();
+  ASSERT_EQ(parsed.size(), payloads.size());
+  for (size_t i = 0; i < payloads.size(); ++i) {
+    EXPECT_EQ(parsed[i].first, static_cast<int64_t>(1001 + i));
+    EXPECT_EQ(parsed[i].second, payloads[i]);
+  }
+}
+#endif  // !OS_WIN && !OS_WASM
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -129,6 +129,7 @@ class SafeStringWriter {
 
 DbSqliteTable::DbSqliteTable(sqlite3*, Context context)
     : cache_(context.cache),
+      thread_pool_(context.thread_pool),
       computation_(context.computation),
       static_table_(context.static_table),
       generator_(std::move(context.generator)) {}
@@ -136,15 +137,18 @@ DbSqliteTable::~DbSqliteTable() = default;
 
 void DbSqliteTable::RegisterTable(sqlite3* db,
                                   QueryCache* cache,
+                                  base::ThreadPool* thread_pool,
                                   const Table* table,
                                   const std::string& name) {
-  Context context{cache, TableComputation::kStatic, table, nullptr};
+  Context context{cache, thread_pool, TableComputation::kStatic, table,
+                  nullptr};
   SqliteTable::Register<DbSqliteTable, Context>(db, std::move(context), name);
 }
 
 void DbSqliteTable::RegisterTable(
     sqlite3* db,
     QueryCache* cache,
+    base::ThreadPool* thread_pool,
     std::unique_ptr<DynamicTableGenerator> generator) {
   // Figure out if the table needs explicit args (in the form of constraints
   // on hidden columns) passed to it in order to make the query valid.
@@ -153,7 +157,7 @@ void DbSqliteTable::RegisterTable(
   bool requires_args = !status.ok();
 
   std::string table_name = generator->TableName();
-  Context context{cache, TableComputation::kDynamic, nullptr,
+  Context context{cache, thread_pool, TableComputation::kDynamic, nullptr,
                   std::move(generator)};
   SqliteTable::Register<DbSqliteTable, Context>(
       db, std::move(context), table_name, false, requires_args);
@@ -200,7 +204,7 @@ SqliteTable::Schema DbSqliteTable::ComputeSchema(const Table::Schema& schema,
 int DbSqliteTable::BestIndex(const QueryConstraints& qc, BestIndexInfo* info) {
   switch (computation_) {
     case TableComputation::kStatic:
-      BestIndex(schema_, static_table_->row_count(), qc, info);
+      BestIndex(schema_, static_table_->row_count(), qc, info, static_table_);
       break;
     case TableComputation::kDynamic:
       base::Status status = generator_->ValidateConstraints(qc);
@@ -215,8 +219,9 @@ int DbSqliteTable::BestIndex(const QueryConstraints& qc, BestIndexInfo* info) {
 void DbSqliteTable::BestIndex(const Table::Schema& schema,
                               uint32_t row_count,
                               const QueryConstraints& qc,
-                              BestIndexInfo* info) {
-  auto cost_and_rows = EstimateCost(schema, row_count, qc);
+                              BestIndexInfo* info,
+                              const Table* table) {
+  auto cost_and_rows = EstimateCost(schema, row_count, qc, table);
   info->estimated_cost = cost_and_rows.cost;
   info->estimated_rows = cost_and_rows.rows;
 
@@ -300,7 +305,8 @@ void DbSqliteTable::ModifyConstraints(const Table::Schema& schema,
 DbSqliteTable::QueryCost DbSqliteTable::EstimateCost(
     const Table::Schema& schema,
     uint32_t row_count,
-    const QueryConstraints& qc) {
+    const QueryConstraints& qc,
+    const Table* table) {
   // Currently our cost estimation algorithm is quite simplistic but is good
   // enough for the simplest cases.
   // TODO(lalitm): replace hardcoded constants with either more heuristics
@@ -343,10 +349,12 @@ DbSqliteTable::QueryCost DbSqliteTable::EstimateCost(
       // to sort by that column and then binary search if we see the constraint
       // set often. Model this by dividing by the log of the number of rows as
       // a good approximation. Otherwise, we'll need to do a full table scan.
-      // Alternatively, if the column is sorted, we can use the same binary
-      // search logic so we have the same low cost (even better because we don't
-      // have to sort at all).
-      filter_cost += cs.size() == 1 || col_schema.is_sorted
+      // Alternatively, if the column is sorted or has an index, we can use
+      // the same binary search logic so we have the same low cost (even better
+      // because we don't have to sort at all).
+      bool has_index =
+          table && table->GetColumn(static_cast<uint32_t>(c.column)).HasIndex();
+      filter_cost += cs.size() == 1 || col_schema.is_sorted || has_index
                          ? log2(current_row_count)
                          : current_row_count;
 
@@ -415,7 +423,7 @@ void DbSqliteTable::Cursor::TryCacheCreateSortedTable(
 
     // Check if the new constraint set is cached by another cursor.
     sorted_cache_table_ =
-        cache_->GetIfCached(upstream_table_, qc.constraints());
+        cache_->GetIfCached(upstream_table_, qc.constraints(), qc.order_by());
     return;
   }
 
@@ -447,10 +455,15 @@ void DbSqliteTable::Cursor::TryCacheCreateSortedTable(
   if (upstream_table_->GetColumn(col).IsSorted())
     return;
 
-  // Try again to get the result or start caching it.
-  sorted_cache_table_ =
-      cache_->GetOrCache(upstream_table_, qc.constraints(), [this, col]() {
-        return upstream_table_->Sort({Order{col, false}});
+  // Try again to get the result or start caching it. The table is sorted on
+  // the constrained column first so the constraint can be answered with a
+  // binary search and then on the order by columns so the rows matching the
+  // constraint are already in the order the query asks for.
+  sorted_cache_table_ = cache_->GetOrCache(
+      upstream_table_, qc.constraints(), qc.order_by(), [this, col]() {
+        std::vector<Order> orders{Order{col, false}};
+        orders.insert(orders.end(), orders_.begin(), orders_.end());
+        return upstream_table_->Sort(orders);
       });
 }
 
@@ -603,7 +616,8 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
   RowMap::OptimizeFor optimize_for = orders_.empty()
                                          ? RowMap::OptimizeFor::kMemory
                                          : RowMap::OptimizeFor::kLookupSpeed;
-  RowMap filter_map = SourceTable()->FilterToRowMap(constraints_, optimize_for);
+  RowMap filter_map = SourceTable()->FilterToRowMap(
+      constraints_, optimize_for, db_sqlite_table_->thread_pool_);
 
   // If we have no order by constraints and it's cheap for us to use the
   // RowMap, just use the RowMap directoy.
@@ -626,7 +640,11 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
     mode_ = Mode::kTable;
 
     db_table_ = SourceTable()->Apply(std::move(filter_map));
-    if (!orders_.empty())
+
+    // The sorted cache table is already sorted by |orders_| for the rows
+    // matching the (single equality) constraint so we only need to sort if we
+    // are not using it.
+    if (!orders_.empty() && !sorted_cache_table_)
       db_table_ = db_table_->Sort(orders_);
 
     iterator_ = db_table_->IterateRows();
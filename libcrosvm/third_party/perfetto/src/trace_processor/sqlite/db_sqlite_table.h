@@ -91,8 +91,8 @@ class DbSqliteTable : public SqliteTable {
     bool eof_ = true;
 
     // Stores a sorted version of |db_table_| sorted on a repeated equals
-    // constraint. This allows speeding up repeated subqueries in joins
-    // significantly.
+    // constraint (and then on the order by columns of the query). This allows
+    // speeding up repeated subqueries in joins significantly.
     std::shared_ptr<Table> sorted_cache_table_;
 
     // Stores the count of repeated equality queries to decide whether it is
@@ -110,6 +110,10 @@ class DbSqliteTable : public SqliteTable {
   };
   struct Context {
     QueryCache* cache;
+
+    // If non-null, the threads used to filter large tables in parallel.
+    base::ThreadPool* thread_pool;
+
     TableComputation computation;
 
     // Only valid when computation == TableComputation::kStatic.
@@ -121,11 +125,13 @@ class DbSqliteTable : public SqliteTable {
 
   static void RegisterTable(sqlite3* db,
                             QueryCache* cache,
+                            base::ThreadPool* thread_pool,
                             const Table* table,
                             const std::string& name);
 
   static void RegisterTable(sqlite3* db,
                             QueryCache* cache,
+                            base::ThreadPool* thread_pool,
                             std::unique_ptr<DynamicTableGenerator> generator);
 
   DbSqliteTable(sqlite3*, Context context);
@@ -147,15 +153,20 @@ class DbSqliteTable : public SqliteTable {
   static void BestIndex(const Table::Schema&,
                         uint32_t row_count,
                         const QueryConstraints&,
-                        BestIndexInfo*);
+                        BestIndexInfo*,
+                        const Table* table = nullptr);
 
   // static for testing.
+  // If |table| is non-null, it should be the table described by the schema
+  // and is used to take into account the indexes built on its columns.
   static QueryCost EstimateCost(const Table::Schema&,
                                 uint32_t row_count,
-                                const QueryConstraints& qc);
+                                const QueryConstraints& qc,
+                                const Table* table = nullptr);
 
  private:
   QueryCache* cache_ = nullptr;
+  base::ThreadPool* thread_pool_ = nullptr;
 
   TableComputation computation_ = TableComputation::kStatic;
 
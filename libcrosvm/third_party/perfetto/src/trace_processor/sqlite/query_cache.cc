@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/query_cache.h"
+
+#include <algorithm>
+
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+constexpr size_t QueryCache::kDefaultMaxBytes;
+
+QueryCache::QueryCache(TraceStorage* storage, size_t max_bytes)
+    : storage_(storage), max_bytes_(max_bytes) {}
+
+QueryCache::~QueryCache() = default;
+
+std::shared_ptr<Table> QueryCache::GetIfCached(
+    const Table* source,
+    const std::vector<Constraint>& cs,
+    const std::vector<OrderBy>& obs) {
+  auto it = Find(source, cs, obs);
+  if (it == entries_.end())
+    return nullptr;
+
+  // Move the entry to the front as it is now the most recently used.
+  entries_.splice(entries_.begin(), entries_, it);
+  IncrementStats(stats::query_cache_hits);
+  return it->table;
+}
+
+std::shared_ptr<Table> QueryCache::GetOrCache(
+    const Table* source,
+    const std::vector<Constraint>& cs,
+    const std::vector<OrderBy>& obs,
+    std::function<Table()> fn) {
+  std::shared_ptr<Table> cached = GetIfCached(source, cs, obs);
+  if (cached)
+    return cached;
+
+  IncrementStats(stats::query_cache_misses);
+
+  CachedTable entry;
+  entry.table.reset(new Table(fn()));
+  entry.bytes = entry.table->ApproxBytesCost();
+  entry.source = source;
+  entry.source_row_count = source->row_count();
+  entry.constraints = cs;
+  entry.order_bys = obs;
+
+  bytes_ += entry.bytes;
+  entries_.emplace_front(std::move(entry));
+  EvictIfNeeded();
+  return entries_.front().table;
+}
+
+std::list<QueryCache::CachedTable>::iterator QueryCache::Find(
+    const Table* source,
+    const std::vector<Constraint>& cs,
+    const std::vector<OrderBy>& obs) {
+  auto cs_eq = [](const Constraint& a, const Constraint& b) {
+    return a.column == b.column && a.op == b.op;
+  };
+  auto ob_eq = [](const OrderBy& a, const OrderBy& b) {
+    return a.iColumn == b.iColumn && a.desc == b.desc;
+  };
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (it->source != source || it->constraints.size() != cs.size() ||
+        it->order_bys.size() != obs.size()) {
+      continue;
+    }
+    if (!std::equal(cs.begin(), cs.end(), it->constraints.begin(), cs_eq) ||
+        !std::equal(obs.begin(), obs.end(), it->order_bys.begin(), ob_eq)) {
+      continue;
+    }
+
+    // If rows were added to the source since the table was cached, the cached
+    // table is stale so drop it.
+    if (it->source_row_count != source->row_count()) {
+      bytes_ -= it->bytes;
+      entries_.erase(it);
+      return entries_.end();
+    }
+    return it;
+  }
+  return entries_.end();
+}
+
+void QueryCache::EvictIfNeeded() {
+  while (bytes_ > max_bytes_ && entries_.size() > 1) {
+    bytes_ -= entries_.back().bytes;
+    entries_.pop_back();
+    IncrementStats(stats::query_cache_evictions);
+  }
+}
+
+void QueryCache::IncrementStats(size_t key) {
+  if (storage_)
+    storage_->IncrementStats(key);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
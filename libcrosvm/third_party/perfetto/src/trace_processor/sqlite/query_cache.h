@@ -17,7 +17,12 @@
 #ifndef SRC_TRACE_PROCESSOR_SQLITE_QUERY_CACHE_H_
 #define SRC_TRACE_PROCESSOR_SQLITE_QUERY_CACHE_H_
 
-#include "perfetto/ext/base/optional.h"
+#include <stddef.h>
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <vector>
 
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/sqlite/query_constraints.h"
@@ -25,54 +30,81 @@
 namespace perfetto {
 namespace trace_processor {
 
+class TraceStorage;
+
 // Implements a simple caching strategy for commonly executed queries.
+//
+// Up to |max_bytes| worth of tables are cached keyed on the source table, the
+// constraint set and the order by set of the query which created them. When
+// the limit is exceeded, the least recently used tables are evicted. If
+// |storage| is non-null, hits, misses and evictions are recorded in its stats.
+//
 // TODO(lalitm): the design of this class is very experimental. It was mainly
 // introduced to solve a specific problem (slow process summary tracks in the
 // Perfetto UI) and should not be modified without a full design discussion.
 class QueryCache {
  public:
   using Constraint = QueryConstraints::Constraint;
+  using OrderBy = QueryConstraints::OrderBy;
+
+  // By default, we cache up to this many bytes of tables. As cached tables
+  // share the column storage of their source, this only includes the
+  // overlays: this is enough for many sorted copies of even the largest
+  // tables.
+  static constexpr size_t kDefaultMaxBytes = 128 * 1024 * 1024;
+
+  explicit QueryCache(TraceStorage* storage = nullptr,
+                      size_t max_bytes = kDefaultMaxBytes);
+  ~QueryCache();
 
   // Returns a cached table if the passed query set are currenly cached or
   // nullptr otherwise.
   std::shared_ptr<Table> GetIfCached(const Table* source,
-                                     const std::vector<Constraint>& cs) const {
-    if (cached_.source != source || cs.size() != cached_.constraints.size())
-      return nullptr;
-
-    auto p = [](const Constraint& a, const Constraint& b) {
-      return a.column == b.column && a.op == b.op;
-    };
-    bool same_cs =
-        std::equal(cs.begin(), cs.end(), cached_.constraints.begin(), p);
-    return same_cs ? cached_.table : nullptr;
-  }
+                                     const std::vector<Constraint>& cs,
+                                     const std::vector<OrderBy>& obs);
 
   // Caches the table with the given source, constraint and order set. Returns
   // a pointer to the newly cached table.
-  std::shared_ptr<Table> GetOrCache(
-      const Table* source,
-      const std::vector<QueryConstraints::Constraint>& cs,
-      std::function<Table()> fn) {
-    std::shared_ptr<Table> cached = GetIfCached(source, cs);
-    if (cached)
-      return cached;
-
-    cached_.source = source;
-    cached_.constraints = cs;
-    cached_.table.reset(new Table(fn()));
-    return cached_.table;
-  }
+  std::shared_ptr<Table> GetOrCache(const Table* source,
+                                    const std::vector<Constraint>& cs,
+                                    const std::vector<OrderBy>& obs,
+                                    std::function<Table()> fn);
+
+  // Returns the number of tables currently cached.
+  size_t size() const { return entries_.size(); }
+
+  // Returns the approximate number of bytes used by the cached tables.
+  size_t bytes() const { return bytes_; }
 
  private:
   struct CachedTable {
     std::shared_ptr<Table> table;
+    size_t bytes = 0;
 
     const Table* source = nullptr;
+    uint32_t source_row_count = 0;
     std::vector<Constraint> constraints;
+    std::vector<OrderBy> order_bys;
   };
 
-  CachedTable cached_;
+  // Returns the entry for the given query in |entries_| or |entries_.end()|
+  // if the query is not cached.
+  std::list<CachedTable>::iterator Find(const Table* source,
+                                        const std::vector<Constraint>& cs,
+                                        const std::vector<OrderBy>& obs);
+
+  // Evicts the least recently used tables until we are within |max_bytes_|
+  // (always keeping the most recently used table).
+  void EvictIfNeeded();
+
+  void IncrementStats(size_t key);
+
+  TraceStorage* const storage_;
+  const size_t max_bytes_;
+  size_t bytes_ = 0;
+
+  // Ordered from most recently used to least recently used.
+  std::list<CachedTable> entries_;
 };
 
 }  // namespace trace_processor
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/query_cache.h"
+
+#include <sqlite3.h>
+
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/tables/macros.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+#define PERFETTO_TP_TEST_CACHE_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestCacheTable, "cache")                           \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                       \
+  C(int64_t, ts)                                          \
+  C(uint32_t, utid)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_CACHE_TABLE_DEF);
+
+TestCacheTable::~TestCacheTable() = default;
+
+using Constraint = QueryCache::Constraint;
+using OrderBy = QueryCache::OrderBy;
+
+class QueryCacheUnittest : public ::testing::Test {
+ protected:
+  QueryCacheUnittest() : table_(storage_.mutable_string_pool(), nullptr) {
+    for (uint32_t i = 0; i < 1024; ++i) {
+      TestCacheTable::Row row;
+      row.ts = 1024 - i;
+      row.utid = i % 16;
+      table_.Insert(row);
+    }
+  }
+
+  // Returns a function which sorts |table_| and records that it was called.
+  std::function<Table()> SortFn(uint32_t col) {
+    return [this, col]() {
+      ++sort_count_;
+      return table_.Sort({Order{col, false}});
+    };
+  }
+
+  int64_t stat(size_t key) { return storage_.stats()[key].value; }
+
+  TraceStorage storage_;
+  TestCacheTable table_;
+  uint32_t sort_count_ = 0;
+};
+
+TEST_F(QueryCacheUnittest, MultipleEntries) {
+  QueryCache cache(&storage_);
+  std::vector<Constraint> eq_utid{Constraint{2, SQLITE_INDEX_CONSTRAINT_EQ, 0}};
+  std::vector<Constraint> eq_ts{Constraint{1, SQLITE_INDEX_CONSTRAINT_EQ, 0}};
+  std::vector<OrderBy> by_ts{OrderBy{1, false}};
+
+  ASSERT_EQ(cache.GetIfCached(&table_, eq_utid, {}), nullptr);
+
+  auto utid_table = cache.GetOrCache(&table_, eq_utid, {}, SortFn(2));
+  auto ts_table = cache.GetOrCache(&table_, eq_ts, {}, SortFn(1));
+  auto ordered_table = cache.GetOrCache(&table_, eq_utid, by_ts, SortFn(2));
+  ASSERT_EQ(sort_count_, 3u);
+  ASSERT_EQ(cache.size(), 3u);
+  ASSERT_NE(utid_table, ordered_table);
+
+  // Interleaving the queries should not evict any of the tables.
+  ASSERT_EQ(cache.GetOrCache(&table_, eq_utid, {}, SortFn(2)), utid_table);
+  ASSERT_EQ(cache.GetOrCache(&table_, eq_ts, {}, SortFn(1)), ts_table);
+  ASSERT_EQ(cache.GetIfCached(&table_, eq_utid, by_ts), ordered_table);
+  ASSERT_EQ(sort_count_, 3u);
+
+  ASSERT_EQ(stat(stats::query_cache_hits), 3);
+  ASSERT_EQ(stat(stats::query_cache_misses), 3);
+  ASSERT_EQ(stat(stats::query_cache_evictions), 0);
+}
+
+TEST_F(QueryCacheUnittest, EvictLeastRecentlyUsed) {
+  std::vector<Constraint> eq_utid{Constraint{2, SQLITE_INDEX_CONSTRAINT_EQ, 0}};
+  std::vector<Constraint> eq_ts{Constraint{1, SQLITE_INDEX_CONSTRAINT_EQ, 0}};
+  std::vector<Constraint> eq_id{Constraint{0, SQLITE_INDEX_CONSTRAINT_EQ, 0}};
+
+  // Size the cache so that exactly two sorted tables fit.
+  size_t table_bytes = table_.Sort({Order{2, false}}).ApproxBytesCost();
+  QueryCache cache(&storage_, table_bytes * 2);
+
+  cache.GetOrCache(&table_, eq_utid, {}, SortFn(2));
+  cache.GetOrCache(&table_, eq_ts, {}, SortFn(1));
+  ASSERT_EQ(cache.size(), 2u);
+  ASSERT_EQ(cache.bytes(), table_bytes * 2);
+
+  // Use the utid table so that the ts table is the least recently used.
+  ASSERT_NE(cache.GetIfCached(&table_, eq_utid, {}), nullptr);
+  cache.GetOrCache(&table_, eq_id, {}, SortFn(0));
+
+  ASSERT_EQ(cache.size(), 2u);
+  ASSERT_NE(cache.GetIfCached(&table_, eq_utid, {}), nullptr);
+  ASSERT_NE(cache.GetIfCached(&table_, eq_id, {}), nullptr);
+  ASSERT_EQ(cache.GetIfCached(&table_, eq_ts, {}), nullptr);
+  ASSERT_EQ(stat(stats::query_cache_evictions), 1);
+}
+
+TEST_F(QueryCacheUnittest, InvalidateOnInsert) {
+  QueryCache cache(&storage_);
+  std::vector<Constraint> eq_utid{Constraint{2, SQLITE_INDEX_CONSTRAINT_EQ, 0}};
+
+  cache.GetOrCache(&table_, eq_utid, {}, SortFn(2));
+  ASSERT_NE(cache.GetIfCached(&table_, eq_utid, {}), nullptr);
+
+  table_.Insert({});
+  ASSERT_EQ(cache.GetIfCached(&table_, eq_utid, {}), nullptr);
+  ASSERT_EQ(cache.size(), 0u);
+  ASSERT_EQ(cache.bytes(), 0u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -83,6 +83,33 @@ std::string OpToString(int op) {
   }
 }
 
+base::Optional<FilterOp> SqliteOpToFilterOp(int op) {
+  switch (op) {
+    case SQLITE_INDEX_CONSTRAINT_EQ:
+      return FilterOp::kEq;
+    case SQLITE_INDEX_CONSTRAINT_NE:
+      return FilterOp::kNe;
+    case SQLITE_INDEX_CONSTRAINT_GE:
+    case SqliteTable::kSourceGeqOpCode:
+      return FilterOp::kGe;
+    case SQLITE_INDEX_CONSTRAINT_GT:
+      return FilterOp::kGt;
+    case SQLITE_INDEX_CONSTRAINT_LE:
+      return FilterOp::kLe;
+    case SQLITE_INDEX_CONSTRAINT_LT:
+      return FilterOp::kLt;
+    case SQLITE_INDEX_CONSTRAINT_GLOB:
+      return FilterOp::kGlob;
+    case SQLITE_INDEX_CONSTRAINT_ISNULL:
+      return FilterOp::kIsNull;
+    case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
+      return FilterOp::kIsNotNull;
+    default:
+      // Leave any other constraints (e.g. like) to SQLite.
+      return base::nullopt;
+  }
+}
+
 std::string EscapedSqliteValueAsString(sqlite3_value* value) {
   switch (sqlite3_value_type(value)) {
     case SQLITE_INTEGER:
@@ -105,22 +132,26 @@ std::string EscapedSqliteValueAsString(sqlite3_value* value) {
 
 }  // namespace
 
-SpanJoinOperatorTable::SpanJoinOperatorTable(sqlite3* db, const TraceStorage*)
-    : db_(db) {}
+SpanJoinOperatorTable::SpanJoinOperatorTable(
+    sqlite3* db,
+    const StaticTableMap* static_tables)
+    : db_(db), static_tables_(static_tables) {}
 
 void SpanJoinOperatorTable::RegisterTable(sqlite3* db,
-                                          const TraceStorage* storage) {
-  SqliteTable::Register<SpanJoinOperatorTable>(db, storage, "span_join",
+                                          const StaticTableMap* static_tables) {
+  SqliteTable::Register<SpanJoinOperatorTable>(db, static_tables, "span_join",
                                                /* read_write */ false,
                                                /* requires_args */ true);
 
-  SqliteTable::Register<SpanJoinOperatorTable>(db, storage, "span_left_join",
-                                               /* read_write */ false,
-                                               /* requires_args */ true);
+  SqliteTable::Register<SpanJoinOperatorTable>(
+      db, static_tables, "span_left_join",
+      /* read_write */ false,
+      /* requires_args */ true);
 
-  SqliteTable::Register<SpanJoinOperatorTable>(db, storage, "span_outer_join",
-                                               /* read_write */ false,
-                                               /* requires_args */ true);
+  SqliteTable::Register<SpanJoinOperatorTable>(
+      db, static_tables, "span_outer_join",
+      /* read_write */ false,
+      /* requires_args */ true);
 }
 
 util::Status SpanJoinOperatorTable::Init(int argc,
@@ -290,34 +321,75 @@ int SpanJoinOperatorTable::FindFunction(const char* name,
   return 0;
 }
 
-std::vector<std::string>
-SpanJoinOperatorTable::ComputeSqlConstraintsForDefinition(
+std::string SpanJoinOperatorTable::GetChildColumnForConstraint(
+    const TableDefinition& defn,
+    const QueryConstraints::Constraint& cs) {
+  auto col_name = GetNameForGlobalColumnIndex(defn, cs.column);
+  if (col_name.empty())
+    return "";
+
+  // Le constraints can be passed straight to the child tables as they won't
+  // affect the span join computation. Similarily, source_geq constraints
+  // explicitly request that they are passed as geq constraints to the source
+  // tables.
+  if (col_name == kTsColumnName && !sqlite_utils::IsOpLe(cs.op) &&
+      cs.op != kSourceGeqOpCode)
+    return "";
+
+  // Allow SQLite handle any constraints on duration apart from source_geq
+  // constraints.
+  if (col_name == kDurColumnName && cs.op != kSourceGeqOpCode)
+    return "";
+
+  // If we're emitting shadow slices, don't propogate any constraints
+  // on this table as this will break the shadow slice computation.
+  if (defn.ShouldEmitPresentPartitionShadow())
+    return "";
+
+  return col_name;
+}
+
+bool SpanJoinOperatorTable::ComputeDbConstraintsForDefinition(
     const TableDefinition& defn,
     const QueryConstraints& qc,
-    sqlite3_value** argv) {
-  std::vector<std::string> constraints;
+    sqlite3_value** argv,
+    std::vector<Constraint>* constraints) {
   for (size_t i = 0; i < qc.constraints().size(); i++) {
     const auto& cs = qc.constraints()[i];
-    auto col_name = GetNameForGlobalColumnIndex(defn, cs.column);
+    auto col_name = GetChildColumnForConstraint(defn, cs);
     if (col_name.empty())
       continue;
 
-    // Le constraints can be passed straight to the child tables as they won't
-    // affect the span join computation. Similarily, source_geq constraints
-    // explicitly request that they are passed as geq constraints to the source
-    // tables.
-    if (col_name == kTsColumnName && !sqlite_utils::IsOpLe(cs.op) &&
-        cs.op != kSourceGeqOpCode)
-      continue;
+    base::Optional<FilterOp> opt_op = SqliteOpToFilterOp(cs.op);
+    if (!opt_op)
+      return false;
 
-    // Allow SQLite handle any constraints on duration apart from source_geq
-    // constraints.
-    if (col_name == kDurColumnName && cs.op != kSourceGeqOpCode)
-      continue;
+    SqlValue value = sqlite_utils::SqliteValueToSqlValue(argv[i]);
+    bool is_null_op =
+        *opt_op == FilterOp::kIsNull || *opt_op == FilterOp::kIsNotNull;
+    // Comparisons with null never match in SQL; let SQLite deal with these
+    // rather than second guessing it.
+    if (value.is_null() && !is_null_op)
+      return false;
 
-    // If we're emitting shadow slices, don't propogate any constraints
-    // on this table as this will break the shadow slice computation.
-    if (defn.ShouldEmitPresentPartitionShadow())
+    base::Optional<uint32_t> opt_col =
+        defn.db_table()->GetColumnIndexByName(col_name.c_str());
+    PERFETTO_DCHECK(opt_col.has_value());
+    constraints->emplace_back(Constraint{*opt_col, *opt_op, value});
+  }
+  return true;
+}
+
+std::vector<std::string>
+SpanJoinOperatorTable::ComputeSqlConstraintsForDefinition(
+    const TableDefinition& defn,
+    const QueryConstraints& qc,
+    sqlite3_value** argv) {
+  std::vector<std::string> constraints;
+  for (size_t i = 0; i < qc.constraints().size(); i++) {
+    const auto& cs = qc.constraints()[i];
+    auto col_name = GetChildColumnForConstraint(defn, cs);
+    if (col_name.empty())
       continue;
 
     auto op = OpToString(cs.op == kSourceGeqOpCode ? SQLITE_INDEX_CONSTRAINT_GE
@@ -382,8 +454,39 @@ util::Status SpanJoinOperatorTable::CreateTableDefinition(
   PERFETTO_DCHECK(ts_idx < cols.size());
   PERFETTO_DCHECK(dur_idx < cols.size());
 
+  // If the table is backed by a db::Table, find the db::Table column for every
+  // column so the table can be read without going through SQLite.
+  const Table* db_table = nullptr;
+  std::vector<uint32_t> db_col_idx;
+  const Table* const* opt_table =
+      static_tables_ ? static_tables_->Find(desc.name) : nullptr;
+  if (opt_table) {
+    db_table = *opt_table;
+    for (const SqliteTable::Column& col : cols) {
+      base::Optional<uint32_t> opt_idx =
+          db_table->GetColumnIndexByName(col.name().c_str());
+      if (!opt_idx) {
+        db_table = nullptr;
+        break;
+      }
+      db_col_idx.push_back(*opt_idx);
+    }
+  }
+
+  // Partition values are read as integers so only use the db::Table if the
+  // partition column is an integer column (otherwise, the SQL path will report
+  // the appropriate error).
+  if (db_table && desc.IsPartitioned() &&
+      db_table->GetColumn(db_col_idx[partition_idx]).type() !=
+          SqlValue::Type::kLong) {
+    db_table = nullptr;
+  }
+  if (!db_table)
+    db_col_idx.clear();
+
   *defn = TableDefinition(desc.name, desc.partition_col, std::move(cols),
-                          emit_shadow_type, ts_idx, dur_idx, partition_idx);
+                          emit_shadow_type, ts_idx, dur_idx, partition_idx,
+                          db_table, std::move(db_col_idx));
   return util::OkStatus();
 }
 
@@ -616,8 +719,15 @@ util::Status SpanJoinOperatorTable::Query::Initialize(
     sqlite3_value** argv,
     InitialEofBehavior eof_behavior) {
   *this = Query(table_, definition(), db_);
-  sql_query_ = CreateSqlQuery(
-      table_->ComputeSqlConstraintsForDefinition(*defn_, qc, argv));
+
+  std::vector<Constraint> cs;
+  if (defn_->db_table() &&
+      table_->ComputeDbConstraintsForDefinition(*defn_, qc, argv, &cs)) {
+    InitializeDbTable(std::move(cs));
+  } else {
+    sql_query_ = CreateSqlQuery(
+        table_->ComputeSqlConstraintsForDefinition(*defn_, qc, argv));
+  }
   util::Status status = Rewind();
   if (!status.ok())
     return status;
@@ -740,20 +850,28 @@ util::Status SpanJoinOperatorTable::Query::NextSliceState() {
 }
 
 util::Status SpanJoinOperatorTable::Query::Rewind() {
-  sqlite3_stmt* stmt = nullptr;
-  int res =
-      sqlite3_prepare_v2(db_, sql_query_.c_str(),
-                         static_cast<int>(sql_query_.size()), &stmt, nullptr);
-  stmt_.reset(stmt);
-
-  cursor_eof_ = res != SQLITE_OK;
-  if (res != SQLITE_OK)
-    return util::ErrStatus(
-        "%s", sqlite_utils::FormatErrorMessage(
-                  stmt_.get(), base::StringView(sql_query_), db_, res)
-                  .c_message());
-
-  RETURN_IF_ERROR(CursorNext());
+  if (use_db_table_) {
+    // The rows are already in memory so rewinding is just resetting the
+    // index; this is important for the mixed partition case where we rewind
+    // once for every partition.
+    db_idx_ = 0;
+    cursor_eof_ = db_ts_.empty();
+  } else {
+    sqlite3_stmt* stmt = nullptr;
+    int res =
+        sqlite3_prepare_v2(db_, sql_query_.c_str(),
+                           static_cast<int>(sql_query_.size()), &stmt, nullptr);
+    stmt_.reset(stmt);
+
+    cursor_eof_ = res != SQLITE_OK;
+    if (res != SQLITE_OK)
+      return util::ErrStatus(
+          "%s", sqlite_utils::FormatErrorMessage(
+                    stmt_.get(), base::StringView(sql_query_), db_, res)
+                    .c_message());
+
+    RETURN_IF_ERROR(CursorNext());
+  }
 
   // Setup the first slice as a missing partition shadow from the lowest
   // partition until the first slice partition. We will handle finding the real
@@ -776,6 +894,11 @@ util::Status SpanJoinOperatorTable::Query::Rewind() {
 }
 
 util::Status SpanJoinOperatorTable::Query::CursorNext() {
+  if (use_db_table_) {
+    cursor_eof_ = ++db_idx_ >= db_ts_.size();
+    return util::OkStatus();
+  }
+
   auto* stmt = stmt_.get();
   int res;
   if (defn_->IsPartitioned()) {
@@ -799,6 +922,55 @@ util::Status SpanJoinOperatorTable::Query::CursorNext() {
              : util::ErrStatus("SPAN_JOIN: %s", sqlite3_errmsg(db_));
 }
 
+void SpanJoinOperatorTable::Query::InitializeDbTable(
+    std::vector<Constraint> cs) {
+  PERFETTO_TP_TRACE(metatrace::Category::QUERY, "SPAN_JOIN_DB_TABLE",
+                    [this](metatrace::Record* r) {
+                      r->AddArg("Table", defn_->name());
+                    });
+
+  const Table* table = defn_->db_table();
+  // Note: Column is also the name of the enum of columns in this table so
+  // qualify the db::Table column.
+  const trace_processor::Column& ts =
+      table->GetColumn(defn_->db_col_idx(defn_->ts_idx()));
+  const trace_processor::Column& dur =
+      table->GetColumn(defn_->db_col_idx(defn_->dur_idx()));
+
+  // Rows with null partitions are skipped (as in |CursorNext()|) so filter
+  // them out up front.
+  std::vector<Order> ob;
+  const trace_processor::Column* partition = nullptr;
+  if (defn_->IsPartitioned()) {
+    partition = &table->GetColumn(defn_->db_col_idx(defn_->partition_idx()));
+    cs.emplace_back(partition->is_not_null());
+    ob.emplace_back(partition->ascending());
+  }
+  ob.emplace_back(ts.ascending());
+
+  use_db_table_ = true;
+  db_table_ = table->Filter(cs).Sort(ob);
+
+  // The ts, dur and partition of each row are needed many times while
+  // stepping through the slices so read them once into flat arrays. Like
+  // |sqlite3_column_int64|, null values are treated as zero.
+  auto as_long = [](const SqlValue& value) {
+    return value.is_null() ? 0 : value.AsLong();
+  };
+  uint32_t ts_col = ts.index_in_table();
+  uint32_t dur_col = dur.index_in_table();
+  db_ts_.reserve(db_table_.row_count());
+  db_dur_.reserve(db_table_.row_count());
+  if (partition)
+    db_partition_.reserve(db_table_.row_count());
+  for (auto it = db_table_.IterateRows(); it; it.Next()) {
+    db_ts_.push_back(as_long(it.Get(ts_col)));
+    db_dur_.push_back(as_long(it.Get(dur_col)));
+    if (partition)
+      db_partition_.push_back(it.Get(partition->index_in_table()).AsLong());
+  }
+}
+
 std::string SpanJoinOperatorTable::Query::CreateSqlQuery(
     const std::vector<std::string>& cs) const {
   std::vector<std::string> col_names;
@@ -827,6 +999,17 @@ void SpanJoinOperatorTable::Query::ReportSqliteResult(sqlite3_context* context,
     return;
   }
 
+  if (use_db_table_) {
+    // Strings in db::Tables are owned by the string pool which outlives any
+    // query so they don't need to be copied.
+    const trace_processor::Column& col =
+        db_table_.GetColumn(defn_->db_col_idx(index));
+    sqlite_utils::ReportSqlValue(context, col.Get(db_idx_),
+                                 sqlite_utils::kSqliteStatic,
+                                 sqlite_utils::kSqliteStatic);
+    return;
+  }
+
   sqlite3_stmt* stmt = stmt_.get();
   int idx = static_cast<int>(index);
   switch (sqlite3_column_type(stmt, idx)) {
@@ -856,14 +1039,18 @@ SpanJoinOperatorTable::TableDefinition::TableDefinition(
     EmitShadowType emit_shadow_type,
     uint32_t ts_idx,
     uint32_t dur_idx,
-    uint32_t partition_idx)
+    uint32_t partition_idx,
+    const Table* db_table,
+    std::vector<uint32_t> db_col_idx)
     : emit_shadow_type_(emit_shadow_type),
       name_(std::move(name)),
       partition_col_(std::move(partition_col)),
       cols_(std::move(cols)),
       ts_idx_(ts_idx),
       dur_idx_(dur_idx),
-      partition_idx_(partition_idx) {}
+      partition_idx_(partition_idx),
+      db_table_(db_table),
+      db_col_idx_(std::move(db_col_idx)) {}
 
 util::Status SpanJoinOperatorTable::TableDescriptor::Parse(
     const std::string& raw_descriptor,
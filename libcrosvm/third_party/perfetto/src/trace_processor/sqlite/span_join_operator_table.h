@@ -31,6 +31,7 @@
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
+#include "src/trace_processor/db/table.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
 #include "src/trace_processor/sqlite/sqlite_table.h"
 
@@ -69,8 +70,16 @@ namespace trace_processor {
 //
 // All other columns apart from timestamp (ts), duration (dur) and the join key
 // are passed through unchanged.
+//
+// When a child table is backed by a db::Table (i.e. it is one of the static
+// tables in TraceStorage), the rows of that table are filtered and sorted
+// using the db::Table directly instead of going through an SQL query.
 class SpanJoinOperatorTable : public SqliteTable {
  public:
+  // Map from the name of each static table registered with SQLite to the
+  // db::Table backing it.
+  using StaticTableMap = base::FlatHashMap<std::string, const Table*>;
+
   // Enum indicating whether the queries on the two inner tables should
   // emit shadows.
   enum class EmitShadowType {
@@ -97,7 +106,9 @@ class SpanJoinOperatorTable : public SqliteTable {
                     EmitShadowType emit_shadow_type,
                     uint32_t ts_idx,
                     uint32_t dur_idx,
-                    uint32_t partition_idx);
+                    uint32_t partition_idx,
+                    const Table* db_table = nullptr,
+                    std::vector<uint32_t> db_col_idx = {});
 
     // Returns whether this table should emit present partition shadow slices.
     bool ShouldEmitPresentPartitionShadow() const {
@@ -121,6 +132,13 @@ class SpanJoinOperatorTable : public SqliteTable {
     uint32_t dur_idx() const { return dur_idx_; }
     uint32_t partition_idx() const { return partition_idx_; }
 
+    // Returns the db::Table backing this table or nullptr if this table can
+    // only be queried using SQL.
+    const Table* db_table() const { return db_table_; }
+
+    // Returns the index in |db_table()| of the column at |idx| in |columns()|.
+    uint32_t db_col_idx(size_t idx) const { return db_col_idx_[idx]; }
+
    private:
     EmitShadowType emit_shadow_type_ = EmitShadowType::kNone;
 
@@ -131,6 +149,9 @@ class SpanJoinOperatorTable : public SqliteTable {
     uint32_t ts_idx_ = std::numeric_limits<uint32_t>::max();
     uint32_t dur_idx_ = std::numeric_limits<uint32_t>::max();
     uint32_t partition_idx_ = std::numeric_limits<uint32_t>::max();
+
+    const Table* db_table_ = nullptr;
+    std::vector<uint32_t> db_col_idx_;
   };
 
   // Stores information about a single subquery into one of the two child
@@ -254,6 +275,10 @@ class SpanJoinOperatorTable : public SqliteTable {
     // Creates an SQL query from the given set of constraint strings.
     std::string CreateSqlQuery(const std::vector<std::string>& cs) const;
 
+    // Filters and sorts the db::Table backing this query's table using the
+    // given constraints and reads the ts, dur and partition of every row.
+    void InitializeDbTable(std::vector<Constraint> cs);
+
     // Returns whether the current slice pointed to is a present partition
     // shadow.
     bool IsPresentPartitionShadow() const {
@@ -276,12 +301,16 @@ class SpanJoinOperatorTable : public SqliteTable {
 
     int64_t CursorTs() const {
       PERFETTO_DCHECK(!cursor_eof_);
+      if (use_db_table_)
+        return db_ts_[db_idx_];
       auto ts_idx = static_cast<int>(defn_->ts_idx());
       return sqlite3_column_int64(stmt_.get(), ts_idx);
     }
 
     int64_t CursorDur() const {
       PERFETTO_DCHECK(!cursor_eof_);
+      if (use_db_table_)
+        return db_dur_[db_idx_];
       auto dur_idx = static_cast<int>(defn_->dur_idx());
       return sqlite3_column_int64(stmt_.get(), dur_idx);
     }
@@ -289,6 +318,8 @@ class SpanJoinOperatorTable : public SqliteTable {
     int64_t CursorPartition() const {
       PERFETTO_DCHECK(!cursor_eof_);
       PERFETTO_DCHECK(defn_->IsPartitioned());
+      if (use_db_table_)
+        return db_partition_[db_idx_];
       auto partition_idx = static_cast<int>(defn_->partition_idx());
       return sqlite3_column_int64(stmt_.get(), partition_idx);
     }
@@ -310,6 +341,15 @@ class SpanJoinOperatorTable : public SqliteTable {
     std::string sql_query_;
     ScopedStmt stmt_;
 
+    // Only used when the rows come from the db::Table backing the table
+    // rather than from |stmt_|.
+    bool use_db_table_ = false;
+    Table db_table_;
+    std::vector<int64_t> db_ts_;
+    std::vector<int64_t> db_dur_;
+    std::vector<int64_t> db_partition_;
+    uint32_t db_idx_ = 0;
+
     const TableDefinition* defn_ = nullptr;
     sqlite3* db_ = nullptr;
     SpanJoinOperatorTable* table_ = nullptr;
@@ -369,9 +409,11 @@ class SpanJoinOperatorTable : public SqliteTable {
     SpanJoinOperatorTable* table_;
   };
 
-  SpanJoinOperatorTable(sqlite3*, const TraceStorage*);
+  SpanJoinOperatorTable(sqlite3*, const StaticTableMap* static_tables);
 
-  static void RegisterTable(sqlite3* db, const TraceStorage* storage);
+  // |static_tables| may be null (or only be filled in after this call); it
+  // is only read when a span join table is created.
+  static void RegisterTable(sqlite3* db, const StaticTableMap* static_tables);
 
   // Table implementation.
   util::Status Init(int, const char* const*, SqliteTable::Schema*) override;
@@ -434,6 +476,19 @@ class SpanJoinOperatorTable : public SqliteTable {
       EmitShadowType emit_shadow_type,
       SpanJoinOperatorTable::TableDefinition* defn);
 
+  // Returns the name of the column of |defn| which the constraint |cs| should
+  // be passed to or an empty string if |cs| should not be passed to |defn|.
+  std::string GetChildColumnForConstraint(
+      const TableDefinition& defn,
+      const QueryConstraints::Constraint& cs);
+
+  // Converts the constraints which should be passed to |defn| to constraints
+  // on |defn.db_table()|. Returns false if any of them cannot be converted.
+  bool ComputeDbConstraintsForDefinition(const TableDefinition& defn,
+                                         const QueryConstraints& qc,
+                                         sqlite3_value** argv,
+                                         std::vector<Constraint>* cs);
+
   std::vector<std::string> ComputeSqlConstraintsForDefinition(
       const TableDefinition& defn,
       const QueryConstraints& qc,
@@ -451,6 +506,7 @@ class SpanJoinOperatorTable : public SqliteTable {
   base::FlatHashMap<size_t, ColumnLocator> global_index_to_column_locator_;
 
   sqlite3* const db_;
+  const StaticTableMap* const static_tables_;
 };
 
 }  // namespace trace_processor
@@ -0,0 +1,173 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark for the SPAN_JOIN operator table.
+// This benchmark compares span joining a table backed by a db::Table (which
+// the operator reads directly) with span joining a view on the same table
+// (which the operator has to read using an SQL query).
+
+#include <array>
+#include <random>
+
+#include <benchmark/benchmark.h>
+#include <sqlite3.h>
+
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/sqlite/scoped_db.h"
+#include "src/trace_processor/sqlite/span_join_operator_table.h"
+#include "src/trace_processor/tables/macros.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+#define PERFETTO_TP_FIRST_SPAN_TABLE_DEF(NAME, PARENT, C) \
+  NAME(FirstSpanTable, "first_span")                     \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                      \
+  C(int64_t, ts)                                         \
+  C(int64_t, dur)                                        \
+  C(uint32_t, cpu)                                       \
+  C(int64_t, f_value)
+PERFETTO_TP_TABLE(PERFETTO_TP_FIRST_SPAN_TABLE_DEF);
+
+#define PERFETTO_TP_SECOND_SPAN_TABLE_DEF(NAME, PARENT, C) \
+  NAME(SecondSpanTable, "second_span")                    \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                       \
+  C(int64_t, ts)                                          \
+  C(int64_t, dur)                                         \
+  C(uint32_t, cpu)                                        \
+  C(int64_t, s_value)
+PERFETTO_TP_TABLE(PERFETTO_TP_SECOND_SPAN_TABLE_DEF);
+
+FirstSpanTable::~FirstSpanTable() = default;
+SecondSpanTable::~SecondSpanTable() = default;
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
+
+namespace {
+
+using perfetto::trace_processor::DbSqliteTable;
+using perfetto::trace_processor::FirstSpanTable;
+using perfetto::trace_processor::ScopedDb;
+using perfetto::trace_processor::ScopedStmt;
+using perfetto::trace_processor::SecondSpanTable;
+using perfetto::trace_processor::SpanJoinOperatorTable;
+using perfetto::trace_processor::StringPool;
+using perfetto::trace_processor::Table;
+
+constexpr uint32_t kCpuCount = 8;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void SpanJoinArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(1024);
+  } else {
+    b->Arg(1024 * 1024)->Arg(10 * 1024 * 1024);
+  }
+}
+
+// Fills |table| with |rows| spans spread randomly over |kCpuCount| cpus; the
+// spans on each cpu don't overlap but there are gaps between them.
+template <typename SpanTable>
+void FillTable(SpanTable* table, uint32_t rows, uint32_t seed) {
+  std::minstd_rand0 rnd_engine(seed);
+  std::array<int64_t, kCpuCount> next_ts{};
+  for (uint32_t i = 0; i < rows; ++i) {
+    uint32_t cpu = rnd_engine() % kCpuCount;
+    int64_t dur = static_cast<int64_t>(rnd_engine() % 1000) + 1;
+    table->Insert({next_ts[cpu], dur, cpu, i});
+    next_ts[cpu] += dur + static_cast<int64_t>(rnd_engine() % 100);
+  }
+}
+
+void RunStatement(sqlite3* db, const std::string& sql) {
+  char* error = nullptr;
+  int res = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &error);
+  PERFETTO_CHECK(res == SQLITE_OK);
+}
+
+// Span joins two tables with |state.range(0)| rows each. If |use_db_table| is
+// true, the first table is read directly; otherwise both tables are read
+// using views.
+void SpanJoinBenchmark(benchmark::State& state, bool use_db_table) {
+  uint32_t rows = static_cast<uint32_t>(state.range(0));
+
+  StringPool pool;
+  FirstSpanTable first(&pool, nullptr);
+  SecondSpanTable second(&pool, nullptr);
+  FillTable(&first, rows, 476);
+  FillTable(&second, rows, 1337);
+
+  sqlite3_initialize();
+
+  ScopedDb db;
+  sqlite3* raw_db = nullptr;
+  PERFETTO_CHECK(sqlite3_open(":memory:", &raw_db) == SQLITE_OK);
+  db.reset(raw_db);
+  RunStatement(*db, "CREATE TABLE perfetto_tables(name STRING)");
+
+  SpanJoinOperatorTable::StaticTableMap static_tables;
+  SpanJoinOperatorTable::RegisterTable(*db, &static_tables);
+  DbSqliteTable::RegisterTable(*db, nullptr, nullptr, &first, "f");
+  DbSqliteTable::RegisterTable(*db, nullptr, nullptr, &second, "s");
+  static_tables.Insert("f", &first);
+  static_tables.Insert("s", &second);
+
+  // Both tables have an id column so the second table always needs to be
+  // joined using a view.
+  RunStatement(*db, "CREATE VIEW f_view AS SELECT ts, dur, cpu, f_value FROM f");
+  RunStatement(*db, "CREATE VIEW s_view AS SELECT ts, dur, cpu, s_value FROM s");
+  RunStatement(*db, std::string("CREATE VIRTUAL TABLE sp USING span_join(") +
+                        (use_db_table ? "f" : "f_view") +
+                        " PARTITIONED cpu, s_view PARTITIONED cpu)");
+
+  ScopedStmt stmt;
+  sqlite3_stmt* raw_stmt;
+  std::string sql = "SELECT SUM(dur), SUM(f_value), SUM(s_value) FROM sp";
+  int err = sqlite3_prepare_v2(*db, sql.c_str(), static_cast<int>(sql.size()),
+                               &raw_stmt, nullptr);
+  PERFETTO_CHECK(err == SQLITE_OK);
+  stmt.reset(raw_stmt);
+
+  for (auto _ : state) {
+    sqlite3_reset(raw_stmt);
+    PERFETTO_CHECK(sqlite3_step(*stmt) == SQLITE_ROW);
+    benchmark::DoNotOptimize(sqlite3_column_int64(*stmt, 0));
+    PERFETTO_CHECK(sqlite3_step(*stmt) == SQLITE_DONE);
+  }
+
+  state.counters["s/row"] =
+      benchmark::Counter(static_cast<double>(rows),
+                         benchmark::Counter::kIsIterationInvariantRate |
+                             benchmark::Counter::kInvert);
+}
+
+static void BM_SpanJoinDbTable(benchmark::State& state) {
+  SpanJoinBenchmark(state, true);
+}
+
+BENCHMARK(BM_SpanJoinDbTable)->Apply(SpanJoinArgs);
+
+static void BM_SpanJoinSqlQuery(benchmark::State& state) {
+  SpanJoinBenchmark(state, false);
+}
+
+BENCHMARK(BM_SpanJoinSqlQuery)->Apply(SpanJoinArgs);
+
+}  // namespace
@@ -16,12 +16,35 @@
 
 #include "src/trace_processor/sqlite/span_join_operator_table.h"
 
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/tables/macros.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto {
 namespace trace_processor {
 namespace {
 
+#define PERFETTO_TP_FIRST_SPAN_TEST_TABLE_DEF(NAME, PARENT, C) \
+  NAME(FirstSpanTestTable, "first_span")                      \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                           \
+  C(int64_t, ts)                                              \
+  C(int64_t, dur)                                             \
+  C(base::Optional<uint32_t>, cpu)                            \
+  C(base::Optional<StringPool::Id>, f_name)
+PERFETTO_TP_TABLE(PERFETTO_TP_FIRST_SPAN_TEST_TABLE_DEF);
+
+#define PERFETTO_TP_SECOND_SPAN_TEST_TABLE_DEF(NAME, PARENT, C) \
+  NAME(SecondSpanTestTable, "second_span")                     \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                            \
+  C(int64_t, ts)                                               \
+  C(int64_t, dur)                                              \
+  C(base::Optional<uint32_t>, cpu)                             \
+  C(base::Optional<StringPool::Id>, s_name)
+PERFETTO_TP_TABLE(PERFETTO_TP_SECOND_SPAN_TEST_TABLE_DEF);
+
+FirstSpanTestTable::~FirstSpanTestTable() = default;
+SecondSpanTestTable::~SecondSpanTestTable() = default;
+
 class SpanJoinOperatorTableTest : public ::testing::Test {
  public:
   SpanJoinOperatorTableTest() {
@@ -30,7 +53,36 @@ class SpanJoinOperatorTableTest : public ::testing::Test {
     PERFETTO_CHECK(sqlite3_open(":memory:", &db) == SQLITE_OK);
     db_.reset(db);
 
-    SpanJoinOperatorTable::RegisterTable(db_.get(), nullptr);
+    SpanJoinOperatorTable::RegisterTable(db_.get(), &static_tables_);
+
+    // Needed to register static tables.
+    RunStatement("CREATE TABLE perfetto_tables(name STRING)");
+  }
+
+  // Registers |table| with SQLite as a static table which span join can read
+  // directly.
+  void RegisterDbTable(const Table* table, const std::string& name) {
+    DbSqliteTable::RegisterTable(*db_, nullptr, nullptr, table, name);
+    static_tables_.Insert(name, table);
+  }
+
+  // Returns all the rows returned by |sql| with every value converted to a
+  // string.
+  std::vector<std::vector<std::string>> QueryAsStrings(const std::string& sql) {
+    PrepareValidStatement(sql);
+    std::vector<std::vector<std::string>> rows;
+    int res;
+    while ((res = sqlite3_step(stmt_.get())) == SQLITE_ROW) {
+      std::vector<std::string> row;
+      for (int i = 0; i < sqlite3_column_count(stmt_.get()); ++i) {
+        const char* value = reinterpret_cast<const char*>(
+            sqlite3_column_text(stmt_.get(), i));
+        row.emplace_back(value ? value : "[NULL]");
+      }
+      rows.emplace_back(std::move(row));
+    }
+    EXPECT_EQ(res, SQLITE_DONE);
+    return rows;
   }
 
   void PrepareValidStatement(const std::string& sql) {
@@ -55,6 +107,8 @@ class SpanJoinOperatorTableTest : public ::testing::Test {
   }
 
  protected:
+  StringPool pool_;
+  SpanJoinOperatorTable::StaticTableMap static_tables_;
   ScopedDb db_;
   ScopedStmt stmt_;
 };
@@ -375,6 +429,111 @@ TEST_F(SpanJoinOperatorTableTest, CapitalizedLeftJoin) {
   ASSERT_EQ(sqlite3_step(stmt_.get()), SQLITE_DONE);
 }
 
+TEST_F(SpanJoinOperatorTableTest, JoinDbTables) {
+  FirstSpanTestTable f(&pool_, nullptr);
+  f.Insert({100, 10, 5u, pool_.InternString("a")});
+  f.Insert({110, 50, 5u, pool_.InternString("b")});
+  f.Insert({120, 100, 2u, base::nullopt});
+  f.Insert({160, 10, 5u, pool_.InternString("c")});
+  f.Insert({170, 10, base::nullopt, pool_.InternString("d")});
+  RegisterDbTable(&f, "f");
+
+  SecondSpanTestTable s(&pool_, nullptr);
+  s.Insert({160, 100, 2u, pool_.InternString("z")});
+  s.Insert({110, 50, 2u, pool_.InternString("y")});
+  s.Insert({105, 100, 5u, base::nullopt});
+  s.Insert({100, 5, 5u, pool_.InternString("x")});
+  RegisterDbTable(&s, "s");
+
+  // Both tables have an id column so join a view with the other columns of
+  // |s|: this reads |f| directly and |s| using SQL.
+  RunStatement("CREATE VIEW s_view AS SELECT ts, dur, cpu, s_name FROM s;");
+  RunStatement(
+      "CREATE VIRTUAL TABLE sp USING span_join(f PARTITIONED cpu, "
+      "s_view PARTITIONED cpu);");
+
+  auto rows = QueryAsStrings("SELECT ts, dur, cpu, id, f_name, s_name FROM sp");
+  std::vector<std::vector<std::string>> expected = {
+      {"120", "40", "2", "2", "[NULL]", "y"},
+      {"160", "60", "2", "2", "[NULL]", "z"},
+      {"100", "5", "5", "0", "a", "x"},
+      {"105", "5", "5", "0", "a", "[NULL]"},
+      {"110", "50", "5", "1", "b", "[NULL]"},
+      {"160", "10", "5", "3", "c", "[NULL]"},
+  };
+  ASSERT_EQ(rows, expected);
+}
+
+TEST_F(SpanJoinOperatorTableTest, DbTablesMatchSqlQueries) {
+  uint32_t seed = 42;
+  auto rand = [&seed]() {
+    seed = seed * 1103515245u + 12345u;
+    return (seed >> 16) & 0x7fff;
+  };
+  auto random_cpu = [&rand]() -> base::Optional<uint32_t> {
+    if (rand() % 16 == 0)
+      return base::nullopt;
+    return rand() % 4;
+  };
+  auto random_name = [this, &rand]() {
+    return pool_.InternString(base::StringView(std::to_string(rand() % 8)));
+  };
+
+  FirstSpanTestTable f(&pool_, nullptr);
+  SecondSpanTestTable s(&pool_, nullptr);
+  for (uint32_t i = 0; i < 200; ++i) {
+    f.Insert({rand() % 1000, rand() % 50, random_cpu(), random_name()});
+    s.Insert({rand() % 1000, rand() % 50, random_cpu(), random_name()});
+  }
+  RegisterDbTable(&f, "f");
+  RegisterDbTable(&s, "s");
+
+  // Views are not backed by a db::Table so span joins on them always use SQL.
+  RunStatement("CREATE VIEW f_view AS SELECT ts, dur, cpu, f_name FROM f;");
+  RunStatement("CREATE VIEW s_view AS SELECT ts, dur, cpu, s_name FROM s;");
+  RunStatement("CREATE VIEW f_no_cpu AS SELECT ts, dur, f_name FROM f;");
+  RunStatement("CREATE VIEW s_no_cpu AS SELECT ts, dur, s_name FROM s;");
+
+  // Pairs of span join arguments reading one of the tables directly and the
+  // equivalent arguments reading both tables using SQL.
+  const std::pair<const char*, const char*> kTables[] = {
+      {"f PARTITIONED cpu, s_view PARTITIONED cpu",
+       "f_view PARTITIONED cpu, s_view PARTITIONED cpu"},
+      {"f_view PARTITIONED cpu, s PARTITIONED cpu",
+       "f_view PARTITIONED cpu, s_view PARTITIONED cpu"},
+      {"f PARTITIONED cpu, s_no_cpu", "f_view PARTITIONED cpu, s_no_cpu"},
+      {"f_no_cpu, s PARTITIONED cpu", "f_no_cpu, s_view PARTITIONED cpu"},
+      {"f, s_no_cpu", "f_view, s_no_cpu"},
+      {"f_no_cpu, s", "f_no_cpu, s_view"},
+  };
+  const char* kJoins[] = {"span_join", "span_left_join", "span_outer_join"};
+  const char* kWheres[] = {
+      "",
+      "WHERE ts <= 500",
+      "WHERE f_name = '3'",
+      "WHERE f_name >= '2' AND s_name != '1'",
+  };
+  for (const auto& tables : kTables) {
+    for (const char* join : kJoins) {
+      RunStatement("DROP TABLE IF EXISTS sp_db;");
+      RunStatement("DROP TABLE IF EXISTS sp_sql;");
+      RunStatement(std::string("CREATE VIRTUAL TABLE sp_db USING ") + join +
+                   "(" + tables.first + ");");
+      RunStatement(std::string("CREATE VIRTUAL TABLE sp_sql USING ") + join +
+                   "(" + tables.second + ");");
+      for (const char* where : kWheres) {
+        std::string suffix =
+            std::string(" ") + where + " ORDER BY ts, dur, f_name, s_name";
+        std::string select = "SELECT ts, dur, f_name, s_name FROM ";
+        auto expected = QueryAsStrings(select + "sp_sql" + suffix);
+        ASSERT_FALSE(expected.empty());
+        ASSERT_EQ(QueryAsStrings(select + "sp_db" + suffix), expected)
+            << join << "(" << tables.first << ") " << where;
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -540,7 +540,8 @@ void ArgsSerializer::WriteValue(const Variadic& value) {
 
 SqliteRawTable::SqliteRawTable(sqlite3* db, Context context)
     : DbSqliteTable(db,
-                    {context.cache, TableComputation::kStatic,
+                    {context.cache, context.thread_pool,
+                     TableComputation::kStatic,
                      &context.context->storage->raw_table(), nullptr}),
       serializer_(context.context) {
   auto fn = [](sqlite3_context* ctx, int argc, sqlite3_value** argv) {
@@ -556,9 +557,10 @@ SqliteRawTable::~SqliteRawTable() = default;
 
 void SqliteRawTable::RegisterTable(sqlite3* db,
                                    QueryCache* cache,
+                                   base::ThreadPool* thread_pool,
                                    TraceProcessorContext* context) {
-  SqliteTable::Register<SqliteRawTable, Context>(db, Context{cache, context},
-                                                 "raw");
+  SqliteTable::Register<SqliteRawTable, Context>(
+      db, Context{cache, thread_pool, context}, "raw");
 }
 
 void SqliteRawTable::ToSystrace(sqlite3_context* ctx,
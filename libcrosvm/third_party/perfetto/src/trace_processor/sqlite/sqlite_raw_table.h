@@ -51,13 +51,17 @@ class SqliteRawTable : public DbSqliteTable {
  public:
   struct Context {
     QueryCache* cache;
+    base::ThreadPool* thread_pool;
     TraceProcessorContext* context;
   };
 
   SqliteRawTable(sqlite3*, Context);
   ~SqliteRawTable() override;
 
-  static void RegisterTable(sqlite3* db, QueryCache*, TraceProcessorContext*);
+  static void RegisterTable(sqlite3* db,
+                            QueryCache*,
+                            base::ThreadPool*,
+                            TraceProcessorContext*);
 
  private:
   void ToSystrace(sqlite3_context* ctx, int argc, sqlite3_value** argv);
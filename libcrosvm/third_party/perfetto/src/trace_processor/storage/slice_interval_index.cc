@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage/slice_interval_index.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+constexpr uint32_t kNoRow = std::numeric_limits<uint32_t>::max();
+
+}  // namespace
+
+SliceIntervalIndex::SliceIntervalIndex() = default;
+SliceIntervalIndex::~SliceIntervalIndex() = default;
+
+SliceIntervalIndex::SliceIntervalIndex(SliceIntervalIndex&&) noexcept =
+    default;
+SliceIntervalIndex& SliceIntervalIndex::operator=(SliceIntervalIndex&&) =
+    default;
+
+void SliceIntervalIndex::Build(const tables::SliceTable& slices) {
+  uint32_t row_count = slices.row_count();
+
+  valid_ = false;
+  row_count_ = row_count;
+  preorder_.clear();
+  preorder_.reserve(row_count);
+  preorder_index_.assign(row_count, kNoRow);
+  subtree_end_.assign(row_count, kNoRow);
+  tracks_.Clear();
+
+  // Link each slice into the list of children of its parent. We go backwards
+  // so that each list of children ends up sorted by row (and so by ts).
+  std::vector<uint32_t> first_child(row_count, kNoRow);
+  std::vector<uint32_t> next_sibling(row_count, kNoRow);
+  for (uint32_t i = row_count; i > 0; --i) {
+    uint32_t row = i - 1;
+    auto parent_id = slices.parent_id()[row];
+    if (!parent_id)
+      continue;
+    base::Optional<uint32_t> parent_row = slices.id().IndexOf(*parent_id);
+    if (!parent_row)
+      continue;
+    next_sibling[row] = first_child[*parent_row];
+    first_child[*parent_row] = row;
+  }
+
+  // Walk the forest from each root, computing the preorder and the extent of
+  // each subtree in it. |first_child| is consumed to keep track of the next
+  // child to visit for each slice on the stack.
+  std::vector<uint32_t> stack;
+  for (uint32_t root = 0; root < row_count; ++root) {
+    auto parent_id = slices.parent_id()[root];
+    if (parent_id && slices.id().IndexOf(*parent_id))
+      continue;
+
+    preorder_index_[root] = static_cast<uint32_t>(preorder_.size());
+    preorder_.push_back(root);
+    stack.push_back(root);
+    while (!stack.empty()) {
+      uint32_t top = stack.back();
+      uint32_t child = first_child[top];
+      if (child == kNoRow) {
+        subtree_end_[top] = static_cast<uint32_t>(preorder_.size());
+        stack.pop_back();
+        continue;
+      }
+      first_child[top] = next_sibling[child];
+      preorder_index_[child] = static_cast<uint32_t>(preorder_.size());
+      preorder_.push_back(child);
+      stack.push_back(child);
+    }
+  }
+
+  // Slices which are not reachable from any root can only happen if
+  // |parent_id| has a cycle: just leave the index invalid in this case so
+  // callers fall back to the table.
+  if (preorder_.size() != row_count)
+    return;
+
+  // Split the slices by track. As ts is sorted in the slice table, the slices
+  // on each track also end up sorted by ts.
+  for (uint32_t row = 0; row < row_count; ++row) {
+    TrackIntervals& track = tracks_[slices.track_id()[row].value];
+    int64_t ts = slices.ts()[row];
+    int64_t dur = slices.dur()[row];
+    PERFETTO_DCHECK(track.starts.empty() || track.starts.back() <= ts);
+
+    track.rows.push_back(row);
+    track.starts.push_back(ts);
+    track.ends.push_back(dur < 0 ? std::numeric_limits<int64_t>::max()
+                                 : ts + dur);
+  }
+
+  for (auto it = tracks_.GetIterator(); it; ++it) {
+    TrackIntervals& track = it.value();
+    uint32_t size = static_cast<uint32_t>(track.rows.size());
+    uint32_t blocks = (size + kBlockSize - 1) / kBlockSize;
+
+    track.leaf_count = 1;
+    while (track.leaf_count < blocks)
+      track.leaf_count *= 2;
+
+    track.max_end.assign(2 * track.leaf_count,
+                         std::numeric_limits<int64_t>::min());
+    for (uint32_t i = 0; i < size; ++i) {
+      int64_t& leaf = track.max_end[track.leaf_count + i / kBlockSize];
+      leaf = std::max(leaf, track.ends[i]);
+    }
+    for (uint32_t node = track.leaf_count - 1; node > 0; --node) {
+      track.max_end[node] =
+          std::max(track.max_end[2 * node], track.max_end[2 * node + 1]);
+    }
+  }
+
+  valid_ = true;
+}
+
+void SliceIntervalIndex::GetDescendants(RowNumber row,
+                                        std::vector<RowNumber>* out) const {
+  PERFETTO_DCHECK(valid_);
+  uint32_t idx = preorder_index_[row.row_number()];
+  uint32_t end = subtree_end_[row.row_number()];
+
+  // The preorder is not necessarily sorted by row as siblings can start at
+  // the same ts as the end of the subtree which precedes them.
+  size_t first = out->size();
+  for (uint32_t i = idx + 1; i < end; ++i) {
+    out->emplace_back(preorder_[i]);
+  }
+  std::sort(out->begin() + static_cast<std::ptrdiff_t>(first), out->end());
+}
+
+void SliceIntervalIndex::GetOverlapping(tables::TrackTable::Id track_id,
+                                        int64_t start,
+                                        int64_t end,
+                                        std::vector<RowNumber>* out) const {
+  PERFETTO_DCHECK(valid_);
+  const TrackIntervals* track = tracks_.Find(track_id.value);
+  if (!track)
+    return;
+
+  // Slices in [0, range_begin) start before the range while slices in
+  // [range_begin, range_end) start inside the range.
+  auto starts_begin = track->starts.begin();
+  uint32_t range_begin = static_cast<uint32_t>(
+      std::lower_bound(starts_begin, track->starts.end(), start) -
+      starts_begin);
+  uint32_t range_end = static_cast<uint32_t>(
+      std::lower_bound(starts_begin + range_begin, track->starts.end(), end) -
+      starts_begin);
+
+  CollectEndingAfter(*track, 1, 0, track->leaf_count, range_begin, start, out);
+  for (uint32_t i = range_begin; i < range_end; ++i) {
+    out->emplace_back(track->rows[i]);
+  }
+}
+
+// static
+void SliceIntervalIndex::CollectEndingAfter(const TrackIntervals& track,
+                                            uint32_t node,
+                                            uint32_t lo,
+                                            uint32_t hi,
+                                            uint32_t limit,
+                                            int64_t start,
+                                            std::vector<RowNumber>* out) {
+  if (lo * kBlockSize >= limit || track.max_end[node] <= start)
+    return;
+
+  if (hi - lo == 1) {
+    uint32_t block_end = std::min(hi * kBlockSize, limit);
+    for (uint32_t i = lo * kBlockSize; i < block_end; ++i) {
+      if (track.ends[i] > start)
+        out->emplace_back(track.rows[i]);
+    }
+    return;
+  }
+
+  uint32_t mid = lo + (hi - lo) / 2;
+  CollectEndingAfter(track, 2 * node, lo, mid, limit, start, out);
+  CollectEndingAfter(track, 2 * node + 1, mid, hi, limit, start, out);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_STORAGE_SLICE_INTERVAL_INDEX_H_
+#define SRC_TRACE_PROCESSOR_STORAGE_SLICE_INTERVAL_INDEX_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "src/trace_processor/tables/slice_tables.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Index over the slice table which answers "descendants of slice X" and
+// "slices on track T overlapping [start, end)" without scanning the table.
+//
+// Descendants are found using a nested-set numbering: the slices are laid out
+// in the preorder of the forest formed by |parent_id| so the descendants of
+// any slice are a contiguous range of this order.
+//
+// Overlapping slices are found using, for each track, the slices sorted by ts
+// together with a tree storing the maximum end of each block of slices. This
+// makes no assumption about how slices on a track nest so also works for
+// tracks (e.g. GPU or frame tracks) where slices can partially overlap.
+//
+// The index is a snapshot of the slice table: it is built once all slices
+// have been imported and is only valid as long as no rows are added to the
+// table after this point (see |IsValidFor|). Users should fall back to
+// querying the table directly if this is not the case.
+class SliceIntervalIndex {
+ public:
+  using RowNumber = tables::SliceTable::RowNumber;
+
+  SliceIntervalIndex();
+  ~SliceIntervalIndex();
+
+  SliceIntervalIndex(SliceIntervalIndex&&) noexcept;
+  SliceIntervalIndex& operator=(SliceIntervalIndex&&);
+
+  // Builds the index over all the rows currently in |slices|, discarding any
+  // previously built index.
+  void Build(const tables::SliceTable& slices);
+
+  // Returns whether the index was built and covers all the rows in |slices|.
+  bool IsValidFor(const tables::SliceTable& slices) const {
+    return valid_ && row_count_ == slices.row_count();
+  }
+
+  // Appends the rows of all the (direct and indirect) descendants of |row| to
+  // |out| in ascending order.
+  void GetDescendants(RowNumber row, std::vector<RowNumber>* out) const;
+
+  // Appends the rows of all the slices on |track_id| which overlap the range
+  // [start, end) to |out| in ascending order. A slice overlaps the range if it
+  // starts inside the range or if it starts before the range and ends after
+  // |start|. Incomplete slices (i.e. dur = -1) are treated as never ending.
+  void GetOverlapping(tables::TrackTable::Id track_id,
+                      int64_t start,
+                      int64_t end,
+                      std::vector<RowNumber>* out) const;
+
+ private:
+  // The number of slices whose maximum end is stored in a single leaf of
+  // |TrackIntervals::max_end|.
+  static constexpr uint32_t kBlockSize = 32;
+
+  struct TrackIntervals {
+    // The rows, start and end timestamps of the slices on this track sorted
+    // by start timestamp.
+    std::vector<uint32_t> rows;
+    std::vector<int64_t> starts;
+    std::vector<int64_t> ends;
+
+    // Implicit binary tree (root at index 1) where each leaf stores the
+    // maximum end of |kBlockSize| consecutive slices and each internal node
+    // the maximum of its children.
+    std::vector<int64_t> max_end;
+    uint32_t leaf_count = 0;
+  };
+
+  // Appends the rows of the slices in [0, limit) of |track| which end after
+  // |start|, restricted to the blocks covered by |node| ([lo, hi) in block
+  // units).
+  static void CollectEndingAfter(const TrackIntervals& track,
+                                 uint32_t node,
+                                 uint32_t lo,
+                                 uint32_t hi,
+                                 uint32_t limit,
+                                 int64_t start,
+                                 std::vector<RowNumber>* out);
+
+  bool valid_ = false;
+  uint32_t row_count_ = 0;
+
+  // The rows of the slice table in preorder of the |parent_id| forest.
+  std::vector<uint32_t> preorder_;
+
+  // For each row, the index of the row in |preorder_| and the index one past
+  // the last of its descendants in |preorder_|.
+  std::vector<uint32_t> preorder_index_;
+  std::vector<uint32_t> subtree_end_;
+
+  base::FlatHashMap<uint32_t, TrackIntervals> tracks_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_STORAGE_SLICE_INTERVAL_INDEX_H_
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage/slice_interval_index.h"
+
+#include <random>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+using RowNumber = SliceIntervalIndex::RowNumber;
+
+class SliceIntervalIndexTest : public ::testing::Test {
+ protected:
+  uint32_t Insert(int64_t ts,
+                  int64_t dur,
+                  uint32_t track_id,
+                  base::Optional<uint32_t> parent_row = base::nullopt) {
+    tables::SliceTable::Row row;
+    row.ts = ts;
+    row.dur = dur;
+    row.track_id = tables::TrackTable::Id{track_id};
+    if (parent_row) {
+      row.parent_id = slices_.id()[*parent_row];
+      row.depth = slices_.depth()[*parent_row] + 1;
+    }
+    return slices_.Insert(row).row;
+  }
+
+  std::vector<uint32_t> Descendants(uint32_t row) {
+    std::vector<RowNumber> out;
+    index_.GetDescendants(RowNumber(row), &out);
+    return ToRows(out);
+  }
+
+  std::vector<uint32_t> Overlapping(uint32_t track_id,
+                                    int64_t start,
+                                    int64_t end) {
+    std::vector<RowNumber> out;
+    index_.GetOverlapping(tables::TrackTable::Id{track_id}, start, end, &out);
+    return ToRows(out);
+  }
+
+  static std::vector<uint32_t> ToRows(const std::vector<RowNumber>& rows) {
+    std::vector<uint32_t> ret;
+    for (RowNumber row : rows)
+      ret.push_back(row.row_number());
+    return ret;
+  }
+
+  StringPool pool_;
+  tables::SliceTable slices_{&pool_, nullptr};
+  SliceIntervalIndex index_;
+};
+
+TEST_F(SliceIntervalIndexTest, Descendants) {
+  // Track 1:
+  // [0                  100]
+  //   [10   40][40    80]
+  //     [20 30]
+  // Track 2:
+  // [5     50]
+  uint32_t a = Insert(0, 100, 1);
+  uint32_t b = Insert(5, 45, 2);
+  uint32_t c = Insert(10, 30, 1, a);
+  uint32_t d = Insert(20, 10, 1, c);
+  uint32_t e = Insert(40, 40, 1, a);
+  index_.Build(slices_);
+
+  ASSERT_TRUE(index_.IsValidFor(slices_));
+  ASSERT_THAT(Descendants(a), ElementsAre(c, d, e));
+  ASSERT_THAT(Descendants(b), IsEmpty());
+  ASSERT_THAT(Descendants(c), ElementsAre(d));
+  ASSERT_THAT(Descendants(d), IsEmpty());
+  ASSERT_THAT(Descendants(e), IsEmpty());
+}
+
+TEST_F(SliceIntervalIndexTest, DescendantsOutOfOrder) {
+  // The sibling |c| is inserted before the instant child |d| of |b| even
+  // though both have the same ts: the preorder is then not sorted by row but
+  // the descendants should still be.
+  uint32_t a = Insert(0, 100, 1);
+  uint32_t b = Insert(10, 10, 1, a);
+  uint32_t c = Insert(20, 10, 1, a);
+  uint32_t d = Insert(20, 0, 1, b);
+  index_.Build(slices_);
+
+  ASSERT_THAT(Descendants(a), ElementsAre(b, c, d));
+  ASSERT_THAT(Descendants(b), ElementsAre(d));
+}
+
+TEST_F(SliceIntervalIndexTest, Overlapping) {
+  // Track 1:
+  // [0      50]     [60    -1 ...
+  //   [10 20]
+  // Track 2 (slices partially overlap):
+  //   [10      40]
+  //        [25      60]
+  uint32_t a = Insert(0, 50, 1);
+  uint32_t b = Insert(10, 10, 1, a);
+  uint32_t c = Insert(10, 30, 2);
+  uint32_t d = Insert(25, 35, 2);
+  uint32_t e = Insert(60, -1, 1);
+  index_.Build(slices_);
+
+  ASSERT_THAT(Overlapping(1, 0, 5), ElementsAre(a));
+  ASSERT_THAT(Overlapping(1, 15, 16), ElementsAre(a, b));
+  ASSERT_THAT(Overlapping(1, 20, 60), ElementsAre(a));
+  ASSERT_THAT(Overlapping(1, 20, 61), ElementsAre(a, e));
+  ASSERT_THAT(Overlapping(1, 1000, 1001), ElementsAre(e));
+  ASSERT_THAT(Overlapping(2, 0, 10), IsEmpty());
+  ASSERT_THAT(Overlapping(2, 30, 30), ElementsAre(c, d));
+  ASSERT_THAT(Overlapping(2, 40, 100), ElementsAre(d));
+  ASSERT_THAT(Overlapping(3, 0, 100), IsEmpty());
+}
+
+TEST_F(SliceIntervalIndexTest, OverlappingMatchesScan) {
+  std::minstd_rand0 rnd_engine(42);
+  int64_t ts = 0;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    ts += static_cast<int64_t>(rnd_engine() % 10);
+    int64_t dur = rnd_engine() % 50 == 0
+                      ? -1
+                      : static_cast<int64_t>(rnd_engine() % 200);
+    Insert(ts, dur, rnd_engine() % 3);
+  }
+  index_.Build(slices_);
+
+  for (uint32_t i = 0; i < 500; ++i) {
+    uint32_t track_id = rnd_engine() % 4;
+    int64_t start = static_cast<int64_t>(rnd_engine() % 10000);
+    int64_t end = start + static_cast<int64_t>(rnd_engine() % 500);
+
+    std::vector<uint32_t> expected;
+    for (uint32_t row = 0; row < slices_.row_count(); ++row) {
+      if (slices_.track_id()[row].value != track_id)
+        continue;
+      int64_t slice_ts = slices_.ts()[row];
+      int64_t slice_dur = slices_.dur()[row];
+      bool starts_inside = slice_ts >= start && slice_ts < end;
+      bool ends_after =
+          slice_ts < start && (slice_dur < 0 || slice_ts + slice_dur > start);
+      if (starts_inside || ends_after)
+        expected.push_back(row);
+    }
+    ASSERT_EQ(Overlapping(track_id, start, end), expected);
+  }
+}
+
+TEST_F(SliceIntervalIndexTest, InvalidatedByInsert) {
+  ASSERT_FALSE(index_.IsValidFor(slices_));
+
+  Insert(0, 10, 1);
+  index_.Build(slices_);
+  ASSERT_TRUE(index_.IsValidFor(slices_));
+
+  Insert(20, 10, 1);
+  ASSERT_FALSE(index_.IsValidFor(slices_));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
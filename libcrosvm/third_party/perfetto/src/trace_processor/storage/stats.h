@@ -233,6 +233,23 @@ namespace stats {
       "Trace events are out of order event after sorting. This can happen "    \
       "due to many factors including clock sync drift, producers emitting "    \
       "events out of order or a bug in trace processor's logic of sorting."),  \
+  F(sorter_spilled_bytes,               kSingle,  kInfo,     kAnalysis,        \
+      "Bytes of trace packets written to disk by the sorter to stay within "   \
+      "Config::sorting_memory_limit_bytes."),                                  \
+  F(sorter_spill_failures,              kSingle,  kDataLoss, kAnalysis,        \
+      "Writing to or reading from the sorter spill file failed (e.g. the "     \
+      "disk is full). Packets which could not be read back are dropped; "      \
+      "spilling is disabled after a write failure."),                          \
+  F(snapshot_truncated,                 kSingle,  kError,    kTrace,           \
+      "The trace is a trace processor snapshot which ended before all of its " \
+      "contents were received: nothing was loaded from it."),                  \
+  F(query_cache_hits,                   kSingle,  kInfo,     kAnalysis,        \
+      "Number of queries which reused a table cached by a previous query."),   \
+  F(query_cache_misses,                 kSingle,  kInfo,     kAnalysis,        \
+      "Number of tables computed and added to the query cache."),              \
+  F(query_cache_evictions,              kSingle,  kInfo,     kAnalysis,        \
+      "Number of tables evicted from the query cache to stay within its "      \
+      "memory limit."),                                                        \
   F(unknown_extension_fields,           kSingle,  kError,    kTrace,           \
       "TraceEvent had unknown extension fields, which might result in "        \
       "missing some arguments. You may need a newer version of trace "         \
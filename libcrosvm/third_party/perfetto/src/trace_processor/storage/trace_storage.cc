@@ -21,6 +21,7 @@
 #include <limits>
 
 #include "perfetto/ext/base/no_destructor.h"
+#include "src/trace_processor/db/snapshot_io.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -62,6 +63,13 @@ std::vector<NullTermStringView> CreateRefTypeStringMap() {
   return map;
 }
 
+using SnapshotTable = std::pair<const char*, macros_internal::MacroTable*>;
+
+template <typename Table>
+void AddSnapshotTable(Table* table, std::vector<SnapshotTable>* tables) {
+  tables->emplace_back(Table::Name(), table);
+}
+
 }  // namespace
 
 const std::vector<NullTermStringView>& GetRefTypeStringMap() {
@@ -142,5 +150,233 @@ std::pair<int64_t, int64_t> TraceStorage::GetTraceTimestampBoundsNs() const {
   return std::make_pair(start_ns, end_ns);
 }
 
+void TraceStorage::SerializeToSnapshot(SnapshotWriter* writer) const {
+  // The null string is implicitly part of every pool (and not counted in its
+  // size) so it's not written.
+  writer->WriteU64(string_pool_.size());
+  for (auto it = string_pool_.CreateIterator(); it; ++it) {
+    if (it.StringId().is_null())
+      continue;
+    writer->WriteU32(it.StringId().raw_id());
+    writer->WriteString(it.StringView());
+  }
+
+  writer->WriteU32(static_cast<uint32_t>(stats_.size()));
+  for (const Stats& stat : stats_) {
+    writer->WriteI64(stat.value);
+    writer->WriteU32(static_cast<uint32_t>(stat.indexed_values.size()));
+    for (const auto& index_and_value : stat.indexed_values) {
+      writer->WriteI64(index_and_value.first);
+      writer->WriteI64(index_and_value.second);
+    }
+  }
+
+  auto tables = const_cast<TraceStorage*>(this)->SnapshotTables();
+  writer->WriteU32(static_cast<uint32_t>(tables.size()));
+  for (const SnapshotTable& table : tables) {
+    writer->WriteString(table.first);
+    table.second->SerializeToSnapshot(writer);
+  }
+
+  const VirtualTrackSlices& vts = virtual_track_slices_;
+  std::vector<uint32_t> slice_ids;
+  slice_ids.reserve(vts.slice_count());
+  for (SliceId id : vts.slice_ids())
+    slice_ids.push_back(id.value);
+  writer->WriteVector(slice_ids);
+  writer->WriteVector(std::vector<int64_t>(vts.thread_timestamp_ns().begin(),
+                                           vts.thread_timestamp_ns().end()));
+  writer->WriteVector(std::vector<int64_t>(vts.thread_duration_ns().begin(),
+                                           vts.thread_duration_ns().end()));
+  writer->WriteVector(
+      std::vector<int64_t>(vts.thread_instruction_counts().begin(),
+                           vts.thread_instruction_counts().end()));
+  writer->WriteVector(
+      std::vector<int64_t>(vts.thread_instruction_deltas().begin(),
+                           vts.thread_instruction_deltas().end()));
+}
+
+base::Status TraceStorage::DeserializeFromSnapshot(SnapshotReader* reader) {
+  // Everything is first read into temporaries and validated (string ids
+  // against the restored pool, row maps against the parent tables) so that
+  // this storage is only modified if the whole snapshot is valid.
+
+  // Strings are restored into a new pool so that they get back the ids
+  // referenced by the string columns of the tables below.
+  StringPool pool;
+  uint64_t string_count = 0;
+  if (!reader->ReadU64(&string_count))
+    return base::ErrStatus("Snapshot is truncated");
+  for (uint64_t i = 0; i < string_count; ++i) {
+    uint32_t raw_id = 0;
+    base::StringView str;
+    if (!reader->ReadU32(&raw_id) || !reader->ReadString(&str))
+      return base::ErrStatus("Snapshot is truncated");
+    if (!pool.InsertStringWithId(StringId::Raw(raw_id), str))
+      return base::ErrStatus("Snapshot has an inconsistent string pool");
+  }
+
+  uint32_t stats_count = 0;
+  if (!reader->ReadU32(&stats_count))
+    return base::ErrStatus("Snapshot is truncated");
+  if (stats_count != stats_.size())
+    return base::ErrStatus("Snapshot has a mismatching number of stats");
+  StatsMap stats{};
+  for (Stats& stat : stats) {
+    uint32_t indexed_count = 0;
+    if (!reader->ReadI64(&stat.value) || !reader->ReadU32(&indexed_count))
+      return base::ErrStatus("Snapshot is truncated");
+    for (uint32_t i = 0; i < indexed_count; ++i) {
+      int64_t index = 0;
+      int64_t value = 0;
+      if (!reader->ReadI64(&index) || !reader->ReadI64(&value))
+        return base::ErrStatus("Snapshot is truncated");
+      stat.indexed_values[static_cast<int>(index)] = value;
+    }
+  }
+
+  using SnapshotData = macros_internal::MacroTable::SnapshotData;
+  auto tables = SnapshotTables();
+  uint32_t table_count = 0;
+  if (!reader->ReadU32(&table_count))
+    return base::ErrStatus("Snapshot is truncated");
+  if (table_count != tables.size())
+    return base::ErrStatus("Snapshot has a mismatching number of tables");
+  std::vector<SnapshotData> table_data(tables.size());
+  for (size_t i = 0; i < tables.size(); ++i) {
+    const SnapshotTable& table = tables[i];
+    base::StringView name;
+    if (!reader->ReadString(&name) || name != table.first)
+      return base::ErrStatus("Snapshot is missing table %s", table.first);
+
+    // Parents always come before their children in |tables|.
+    const SnapshotData* parent_data = nullptr;
+    if (const Table* parent = table.second->parent()) {
+      auto it = std::find_if(
+          tables.begin(), tables.begin() + static_cast<ptrdiff_t>(i),
+          [parent](const SnapshotTable& t) { return t.second == parent; });
+      PERFETTO_CHECK(it != tables.begin() + static_cast<ptrdiff_t>(i));
+      parent_data = &table_data[static_cast<size_t>(it - tables.begin())];
+    }
+    base::Status status =
+        table.second->ReadSnapshot(reader, pool, parent_data, &table_data[i]);
+    if (!status.ok()) {
+      return base::ErrStatus("Failed to restore table %s: %s", table.first,
+                             status.c_message());
+    }
+  }
+
+  std::vector<uint32_t> slice_ids;
+  std::vector<int64_t> thread_ts;
+  std::vector<int64_t> thread_dur;
+  std::vector<int64_t> thread_instruction_counts;
+  std::vector<int64_t> thread_instruction_deltas;
+  if (!reader->ReadVector(&slice_ids) || !reader->ReadVector(&thread_ts) ||
+      !reader->ReadVector(&thread_dur) ||
+      !reader->ReadVector(&thread_instruction_counts) ||
+      !reader->ReadVector(&thread_instruction_deltas)) {
+    return base::ErrStatus("Snapshot is truncated");
+  }
+  size_t slice_count = slice_ids.size();
+  if (thread_ts.size() != slice_count || thread_dur.size() != slice_count ||
+      thread_instruction_counts.size() != slice_count ||
+      thread_instruction_deltas.size() != slice_count) {
+    return base::ErrStatus("Snapshot has malformed virtual track slices");
+  }
+  // Virtual track slices are looked up by binary search on their slice id,
+  // which is also the row of the slice in the (root) slice table.
+  auto slice_table = std::find_if(
+      tables.begin(), tables.end(),
+      [this](const SnapshotTable& t) { return t.second == &slice_table_; });
+  PERFETTO_CHECK(slice_table != tables.end());
+  uint32_t slice_rows =
+      table_data[static_cast<size_t>(slice_table - tables.begin())].row_count;
+  for (size_t i = 0; i < slice_count; ++i) {
+    if (slice_ids[i] >= slice_rows ||
+        (i > 0 && slice_ids[i] <= slice_ids[i - 1])) {
+      return base::ErrStatus("Snapshot has malformed virtual track slices");
+    }
+  }
+  if (!reader->AtEnd())
+    return base::ErrStatus("Snapshot has unexpected trailing data");
+
+  // The snapshot is valid: replace the contents of this storage.
+  string_pool_ = std::move(pool);
+  for (uint32_t i = 0; i < variadic_type_ids_.size(); ++i) {
+    variadic_type_ids_[i] = InternString(Variadic::kTypeNames[i]);
+  }
+  stats_ = std::move(stats);
+  for (size_t i = 0; i < tables.size(); ++i)
+    tables[i].second->RestoreSnapshot(std::move(table_data[i]));
+  virtual_track_slices_ = VirtualTrackSlices();
+  for (size_t i = 0; i < slice_count; ++i) {
+    virtual_track_slices_.AddVirtualTrackSlice(
+        SliceId(slice_ids[i]), thread_ts[i], thread_dur[i],
+        thread_instruction_counts[i], thread_instruction_deltas[i]);
+  }
+  return base::OkStatus();
+}
+
+std::vector<SnapshotTable> TraceStorage::SnapshotTables() {
+  std::vector<SnapshotTable> tables;
+  AddSnapshotTable(&metadata_table_, &tables);
+  AddSnapshotTable(&clock_snapshot_table_, &tables);
+  AddSnapshotTable(&track_table_, &tables);
+  AddSnapshotTable(&thread_state_table_, &tables);
+  AddSnapshotTable(&gpu_track_table_, &tables);
+  AddSnapshotTable(&process_track_table_, &tables);
+  AddSnapshotTable(&thread_track_table_, &tables);
+  AddSnapshotTable(&counter_track_table_, &tables);
+  AddSnapshotTable(&thread_counter_track_table_, &tables);
+  AddSnapshotTable(&process_counter_track_table_, &tables);
+  AddSnapshotTable(&cpu_counter_track_table_, &tables);
+  AddSnapshotTable(&irq_counter_track_table_, &tables);
+  AddSnapshotTable(&softirq_counter_track_table_, &tables);
+  AddSnapshotTable(&gpu_counter_track_table_, &tables);
+  AddSnapshotTable(&energy_counter_track_table_, &tables);
+  AddSnapshotTable(&uid_counter_track_table_, &tables);
+  AddSnapshotTable(&energy_per_uid_counter_track_table_, &tables);
+  AddSnapshotTable(&gpu_counter_group_table_, &tables);
+  AddSnapshotTable(&perf_counter_track_table_, &tables);
+  AddSnapshotTable(&arg_table_, &tables);
+  AddSnapshotTable(&thread_table_, &tables);
+  AddSnapshotTable(&process_table_, &tables);
+  AddSnapshotTable(&slice_table_, &tables);
+  AddSnapshotTable(&flow_table_, &tables);
+  AddSnapshotTable(&sched_slice_table_, &tables);
+  AddSnapshotTable(&gpu_slice_table_, &tables);
+  AddSnapshotTable(&counter_table_, &tables);
+  AddSnapshotTable(&raw_table_, &tables);
+  AddSnapshotTable(&cpu_table_, &tables);
+  AddSnapshotTable(&cpu_freq_table_, &tables);
+  AddSnapshotTable(&android_log_table_, &tables);
+  AddSnapshotTable(&android_dumpstate_table_, &tables);
+  AddSnapshotTable(&stack_profile_mapping_table_, &tables);
+  AddSnapshotTable(&stack_profile_frame_table_, &tables);
+  AddSnapshotTable(&stack_profile_callsite_table_, &tables);
+  AddSnapshotTable(&stack_sample_table_, &tables);
+  AddSnapshotTable(&heap_profile_allocation_table_, &tables);
+  AddSnapshotTable(&cpu_profile_stack_sample_table_, &tables);
+  AddSnapshotTable(&perf_sample_table_, &tables);
+  AddSnapshotTable(&package_list_table_, &tables);
+  AddSnapshotTable(&android_game_intervention_list_table_, &tables);
+  AddSnapshotTable(&profiler_smaps_table_, &tables);
+  AddSnapshotTable(&symbol_table_, &tables);
+  AddSnapshotTable(&heap_graph_object_table_, &tables);
+  AddSnapshotTable(&heap_graph_class_table_, &tables);
+  AddSnapshotTable(&heap_graph_reference_table_, &tables);
+  AddSnapshotTable(&vulkan_memory_allocations_table_, &tables);
+  AddSnapshotTable(&graphics_frame_slice_table_, &tables);
+  AddSnapshotTable(&memory_snapshot_table_, &tables);
+  AddSnapshotTable(&process_memory_snapshot_table_, &tables);
+  AddSnapshotTable(&memory_snapshot_node_table_, &tables);
+  AddSnapshotTable(&memory_snapshot_edge_table_, &tables);
+  AddSnapshotTable(&expected_frame_timeline_slice_table_, &tables);
+  AddSnapshotTable(&actual_frame_timeline_slice_table_, &tables);
+  AddSnapshotTable(&experimental_proto_content_table_, &tables);
+  AddSnapshotTable(&experimental_missing_chrome_processes_table_, &tables);
+  return tables;
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -35,6 +35,7 @@
 #include "perfetto/trace_processor/status.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/storage/metadata.h"
+#include "src/trace_processor/storage/slice_interval_index.h"
 #include "src/trace_processor/storage/stats.h"
 #include "src/trace_processor/tables/android_tables.h"
 #include "src/trace_processor/tables/counter_tables.h"
@@ -450,6 +451,13 @@ class TraceStorage {
   const tables::SliceTable& slice_table() const { return slice_table_; }
   tables::SliceTable* mutable_slice_table() { return &slice_table_; }
 
+  const SliceIntervalIndex& slice_interval_index() const {
+    return slice_interval_index_;
+  }
+  SliceIntervalIndex* mutable_slice_interval_index() {
+    return &slice_interval_index_;
+  }
+
   const tables::FlowTable& flow_table() const { return flow_table_; }
   tables::FlowTable* mutable_flow_table() { return &flow_table_; }
 
@@ -717,6 +725,15 @@ class TraceStorage {
   // Returns (0, 0) if the trace is empty.
   std::pair<int64_t, int64_t> GetTraceTimestampBoundsNs() const;
 
+  // Writes the strings, stats and the contents of all the tables in this
+  // storage to |writer|. See snapshot_io.h for details.
+  void SerializeToSnapshot(SnapshotWriter* writer) const;
+
+  // Replaces the contents of this storage with the data written by
+  // SerializeToSnapshot. The whole snapshot is validated first: if an error is
+  // returned, this storage is left unchanged.
+  base::Status DeserializeFromSnapshot(SnapshotReader* reader);
+
   util::Status ExtractArg(uint32_t arg_set_id,
                           const char* key,
                           base::Optional<Variadic>* result) {
@@ -798,6 +815,11 @@ class TraceStorage {
   TraceStorage(TraceStorage&&) = delete;
   TraceStorage& operator=(TraceStorage&&) = delete;
 
+  // Returns the name and a pointer to all the tables which are part of a
+  // snapshot. Parent tables always come before their children.
+  std::vector<std::pair<const char*, macros_internal::MacroTable*>>
+  SnapshotTables();
+
   // One entry for each unique string in the trace.
   StringPool string_pool_;
 
@@ -853,6 +875,9 @@ class TraceStorage {
   // Slices coming from userspace events (e.g. Chromium TRACE_EVENT macros).
   tables::SliceTable slice_table_{&string_pool_, nullptr};
 
+  // Index over |slice_table_| built once all the slices have been imported.
+  SliceIntervalIndex slice_interval_index_;
+
   // Flow events from userspace events (e.g. Chromium TRACE_EVENT macros).
   tables::FlowTable flow_table_{&string_pool_, nullptr};
 
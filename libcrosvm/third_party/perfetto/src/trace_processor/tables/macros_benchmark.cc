@@ -41,8 +41,18 @@ PERFETTO_TP_TABLE(PERFETTO_TP_ROOT_TEST_TABLE);
 
 PERFETTO_TP_TABLE(PERFETTO_TP_CHILD_TABLE);
 
+#define PERFETTO_TP_SLICE_TEST_TABLE(NAME, PARENT, C) \
+  NAME(SliceTestTable, "slice_table")                 \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                   \
+  C(int64_t, ts, Column::Flag::kSorted)               \
+  C(int64_t, dur)                                     \
+  C(uint32_t, track_id)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_SLICE_TEST_TABLE);
+
 RootTestTable::~RootTestTable() = default;
 ChildTestTable::~ChildTestTable() = default;
+SliceTestTable::~SliceTestTable() = default;
 
 }  // namespace
 }  // namespace trace_processor
@@ -77,6 +87,7 @@ void TableSortArgs(benchmark::internal::Benchmark* b) {
 using perfetto::trace_processor::ChildTestTable;
 using perfetto::trace_processor::RootTestTable;
 using perfetto::trace_processor::RowMap;
+using perfetto::trace_processor::SliceTestTable;
 using perfetto::trace_processor::SqlValue;
 using perfetto::trace_processor::StringPool;
 using perfetto::trace_processor::Table;
@@ -559,3 +570,44 @@ static void BM_TableSortChildNullableInParent(benchmark::State& state) {
   }
 }
 BENCHMARK(BM_TableSortChildNullableInParent)->Apply(TableSortArgs);
+
+static void SliceTableForSort(uint32_t size, SliceTestTable* slice) {
+  std::minstd_rand0 rnd_engine;
+  int64_t ts = 0;
+  for (uint32_t i = 0; i < size; ++i) {
+    // Give ~1/4 of the slices the same timestamp as the previous slice to
+    // make sure there are ties to be broken by the second column.
+    if (rnd_engine() % 4 != 0)
+      ts += rnd_engine() % 1000;
+
+    SliceTestTable::Row row;
+    row.ts = ts;
+    row.dur = static_cast<int64_t>(rnd_engine() % 10000);
+    row.track_id = static_cast<uint32_t>(rnd_engine() % 64);
+    slice->Insert(row);
+  }
+}
+
+static void BM_TableSortSliceTsDurDesc(benchmark::State& state) {
+  StringPool pool;
+  SliceTestTable slice(&pool, nullptr);
+  SliceTableForSort(static_cast<uint32_t>(state.range(0)), &slice);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        slice.Sort({slice.ts().ascending(), slice.dur().descending()}));
+  }
+}
+BENCHMARK(BM_TableSortSliceTsDurDesc)->Apply(TableSortArgs);
+
+static void BM_TableSortSliceTrackIdTs(benchmark::State& state) {
+  StringPool pool;
+  SliceTestTable slice(&pool, nullptr);
+  SliceTableForSort(static_cast<uint32_t>(state.range(0)), &slice);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        slice.Sort({slice.track_id().ascending(), slice.ts().ascending()}));
+  }
+}
+BENCHMARK(BM_TableSortSliceTrackIdTs)->Apply(TableSortArgs);
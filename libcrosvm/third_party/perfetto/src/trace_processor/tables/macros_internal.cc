@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/tables/macros_internal.h"
+
+#include "src/trace_processor/db/snapshot_io.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace macros_internal {
+
+namespace {
+
+// How the indices of a ColumnStorageOverlay are encoded in a snapshot.
+enum class OverlayEncoding : uint32_t {
+  kRange = 0,
+  kBitVector = 1,
+  kIndexVector = 2,
+};
+
+void SerializeOverlay(const ColumnStorageOverlay& overlay,
+                      SnapshotWriter* writer) {
+  std::vector<uint32_t> indices;
+  indices.reserve(overlay.size());
+  bool is_range = true;
+  bool is_sorted = true;
+  for (auto it = overlay.IterateRows(); it; it.Next()) {
+    uint32_t index = it.index();
+    if (!indices.empty()) {
+      is_range = is_range && index == indices.back() + 1;
+      is_sorted = is_sorted && index > indices.back();
+    }
+    indices.push_back(index);
+  }
+
+  // The overlays of macro tables are either the identity (root tables and the
+  // last overlay of child tables) or a sorted subset of the parent rows so
+  // the first two encodings cover almost all cases.
+  if (is_range) {
+    writer->WriteU32(static_cast<uint32_t>(OverlayEncoding::kRange));
+    writer->WriteU32(indices.empty() ? 0 : indices.front());
+    writer->WriteU32(indices.empty() ? 0 : indices.back() + 1);
+  } else if (is_sorted) {
+    BitVector bv;
+    for (uint32_t index : indices) {
+      bv.Resize(index, false);
+      bv.AppendTrue();
+    }
+    writer->WriteU32(static_cast<uint32_t>(OverlayEncoding::kBitVector));
+    writer->WriteBitVector(bv);
+  } else {
+    writer->WriteU32(static_cast<uint32_t>(OverlayEncoding::kIndexVector));
+    writer->WriteVector(indices);
+  }
+}
+
+// Reads back an overlay written by SerializeOverlay. Returns false if the
+// data is malformed or if any of the indices is not smaller than
+// |storage_size|.
+bool DeserializeOverlay(SnapshotReader* reader,
+                        uint32_t storage_size,
+                        ColumnStorageOverlay* overlay) {
+  uint32_t encoding = 0;
+  if (!reader->ReadU32(&encoding))
+    return false;
+  switch (static_cast<OverlayEncoding>(encoding)) {
+    case OverlayEncoding::kRange: {
+      uint32_t start = 0;
+      uint32_t end = 0;
+      if (!reader->ReadU32(&start) || !reader->ReadU32(&end) || start > end ||
+          end > storage_size) {
+        return false;
+      }
+      *overlay = ColumnStorageOverlay(start, end);
+      return true;
+    }
+    case OverlayEncoding::kBitVector: {
+      BitVector bv;
+      if (!reader->ReadBitVector(&bv))
+        return false;
+      // Trailing unset bits are allowed as they don't select any row.
+      if (bv.size() > storage_size &&
+          bv.CountSetBits() != bv.CountSetBits(storage_size)) {
+        return false;
+      }
+      *overlay = ColumnStorageOverlay(std::move(bv));
+      return true;
+    }
+    case OverlayEncoding::kIndexVector: {
+      std::vector<uint32_t> indices;
+      if (!reader->ReadVector(&indices))
+        return false;
+      for (uint32_t index : indices) {
+        if (index >= storage_size)
+          return false;
+      }
+      *overlay = ColumnStorageOverlay(std::move(indices));
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+void MacroTable::SerializeToSnapshot(SnapshotWriter* writer) const {
+  writer->WriteU32(row_count_);
+  writer->WriteU32(static_cast<uint32_t>(overlays_.size()));
+  for (const ColumnStorageOverlay& overlay : overlays_)
+    SerializeOverlay(overlay, writer);
+
+  uint32_t owned_columns = 0;
+  for (const Column& col : columns_) {
+    if (OwnsStorage(col))
+      owned_columns++;
+  }
+  writer->WriteU32(owned_columns);
+  for (const Column& col : columns_) {
+    if (!OwnsStorage(col))
+      continue;
+    writer->WriteString(col.name());
+    col.SerializeStorage(writer);
+  }
+}
+
+MacroTable::SnapshotData::SnapshotData() = default;
+MacroTable::SnapshotData::~SnapshotData() = default;
+MacroTable::SnapshotData::SnapshotData(SnapshotData&&) noexcept = default;
+MacroTable::SnapshotData& MacroTable::SnapshotData::operator=(
+    SnapshotData&&) noexcept = default;
+
+base::Status MacroTable::ReadSnapshot(SnapshotReader* reader,
+                                      const StringPool& strings,
+                                      const SnapshotData* parent,
+                                      SnapshotData* out) const {
+  uint32_t row_count = 0;
+  uint32_t overlay_count = 0;
+  if (!reader->ReadU32(&row_count) || !reader->ReadU32(&overlay_count))
+    return base::ErrStatus("Snapshot is truncated");
+  if (overlay_count != overlays_.size())
+    return base::ErrStatus("Snapshot has a mismatching number of row maps");
+
+  SnapshotData data;
+  data.row_count = row_count;
+  if (parent) {
+    if (parent->storage_sizes.size() + 1 != overlay_count)
+      return base::ErrStatus("Snapshot has mismatching parent row maps");
+    data.storage_sizes = parent->storage_sizes;
+  } else if (overlay_count != 1) {
+    return base::ErrStatus("Snapshot is missing the parent table");
+  }
+  data.storage_sizes.push_back(row_count);
+
+  data.overlays.resize(overlay_count);
+  for (uint32_t i = 0; i < overlay_count; ++i) {
+    ColumnStorageOverlay& overlay = data.overlays[i];
+    if (!DeserializeOverlay(reader, data.storage_sizes[i], &overlay))
+      return base::ErrStatus("Snapshot has a malformed row map");
+    if (overlay.size() != row_count)
+      return base::ErrStatus("Snapshot has a row map with the wrong size");
+  }
+
+  uint32_t owned_columns = 0;
+  if (!reader->ReadU32(&owned_columns))
+    return base::ErrStatus("Snapshot is truncated");
+  for (const Column& col : columns_) {
+    if (!OwnsStorage(col))
+      continue;
+    base::StringView name;
+    if (owned_columns-- == 0 || !reader->ReadString(&name) ||
+        name != col.name()) {
+      return base::ErrStatus("Snapshot has mismatching columns for column %s",
+                             col.name());
+    }
+    auto storage = col.ReadStorage(reader, row_count, strings);
+    if (!storage) {
+      return base::ErrStatus("Snapshot has malformed data for column %s",
+                             col.name());
+    }
+    data.storage.emplace_back(std::move(storage));
+  }
+  if (owned_columns != 0)
+    return base::ErrStatus("Snapshot has more columns than expected");
+
+  *out = std::move(data);
+  return base::OkStatus();
+}
+
+void MacroTable::RestoreSnapshot(SnapshotData data) {
+  PERFETTO_CHECK(data.overlays.size() == overlays_.size());
+  auto storage_it = data.storage.begin();
+  for (Column& col : columns_) {
+    if (!OwnsStorage(col))
+      continue;
+    PERFETTO_CHECK(storage_it != data.storage.end());
+    col.AssignStorage(std::move(*storage_it++));
+  }
+  PERFETTO_CHECK(storage_it == data.storage.end());
+  overlays_ = std::move(data.overlays);
+  row_count_ = data.row_count;
+}
+
+}  // namespace macros_internal
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -17,8 +17,11 @@
 #ifndef SRC_TRACE_PROCESSOR_TABLES_MACROS_INTERNAL_H_
 #define SRC_TRACE_PROCESSOR_TABLES_MACROS_INTERNAL_H_
 
+#include <memory>
 #include <type_traits>
+#include <vector>
 
+#include "perfetto/base/status.h"
 #include "perfetto/ext/base/small_vector.h"
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/db/typed_column.h"
@@ -85,6 +88,51 @@ struct IdHelper<RootParentTable, Class> {
 // This class is used to extract common code from the macro tables to reduce
 // code size.
 class MacroTable : public Table {
+ public:
+  // Writes the contents of this table to |writer|: this includes the row
+  // maps and the columns this table owns the storage for but not the storage
+  // of the columns inherited from the parent table (which is written out by
+  // the parent itself).
+  void SerializeToSnapshot(SnapshotWriter* writer) const;
+
+  // The contents of a table read back by ReadSnapshot().
+  struct SnapshotData {
+    SnapshotData();
+    ~SnapshotData();
+    SnapshotData(SnapshotData&&) noexcept;
+    SnapshotData& operator=(SnapshotData&&) noexcept;
+
+    uint32_t row_count = 0;
+
+    // The number of rows in the storage indexed by each of |overlays|: the
+    // row counts of the root table down to this table.
+    std::vector<uint32_t> storage_sizes;
+
+    std::vector<ColumnStorageOverlay> overlays;
+
+    // The storage of the columns owned by this table, in column order.
+    std::vector<std::unique_ptr<Column::SnapshotStorage>> storage;
+  };
+
+  // Reads back the data written by SerializeToSnapshot without modifying this
+  // table, so that a whole snapshot can be validated before any table is
+  // changed. String ids are checked against |strings| and row maps against
+  // |parent|, the data read back for the parent table (nullptr for root
+  // tables).
+  base::Status ReadSnapshot(SnapshotReader* reader,
+                            const StringPool& strings,
+                            const SnapshotData* parent,
+                            SnapshotData* out) const;
+
+  // Replaces the contents of this table with |data|, which must have been
+  // returned by ReadSnapshot() on this table. The parent table (if any)
+  // should be restored separately.
+  void RestoreSnapshot(SnapshotData data);
+
+  // Returns the table this table was created as a child of (nullptr for root
+  // tables).
+  const Table* parent() const { return parent_; }
+
  protected:
   // Constructors for tables created by the regular constructor.
   MacroTable(StringPool* pool, const Table* parent)
@@ -144,6 +192,14 @@ class MacroTable : public Table {
     // Also add the index of the new row to the identity row map and increment
     // the size.
     overlays_.back().Insert(row_count_++);
+    DropIndexes();
+  }
+
+  // Returns whether the storage of |col| is owned by this table rather than
+  // by one of its parents.
+  bool OwnsStorage(const Column& col) const {
+    return !col.IsId() && !col.IsDummy() &&
+           col.overlay_index() == overlays_.size() - 1;
   }
 
   std::vector<ColumnStorageOverlay> FilterAndApplyToOverlays(
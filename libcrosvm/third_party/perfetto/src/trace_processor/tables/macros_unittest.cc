@@ -16,6 +16,10 @@
 
 #include "src/trace_processor/tables/macros.h"
 
+#include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "src/trace_processor/db/snapshot_io.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto {
@@ -468,6 +472,181 @@ TEST_F(TableMacrosUnittest, ChildDoesntInheritArgsSetFlag) {
                    .is_set_id);
 }
 
+// base::TempFile is not supported on Windows.
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+using SnapshotData = macros_internal::MacroTable::SnapshotData;
+
+template <typename Fn>
+std::string WriteSnapshot(Fn fn) {
+  base::TempFile file = base::TempFile::Create();
+  {
+    SnapshotWriter writer(file.fd());
+    fn(&writer);
+    PERFETTO_CHECK(writer.Finalize().ok());
+  }
+  std::string data;
+  PERFETTO_CHECK(base::ReadFile(file.path(), &data));
+  return data;
+}
+
+SnapshotReader ReaderFor(const std::string& data) {
+  return SnapshotReader(reinterpret_cast<const uint8_t*>(data.data()),
+                        data.size());
+}
+
+TEST_F(TableMacrosUnittest, SnapshotRoundTrip) {
+  event_.Insert(TestEventTable::Row(0 /* ts */, 1 /* arg_set_id */));
+  slice_.Insert(TestSliceTable::Row(1, 2, 10, 0));
+  cpu_slice_.Insert(TestCpuSliceTable::Row(2, 3, base::nullopt, 1, 4, 5,
+                                           pool_.InternString("R")));
+  event_.Insert(TestEventTable::Row(3, 4));
+  slice_.Insert(TestSliceTable::Row(4, 5, base::nullopt, 2));
+
+  std::string data = WriteSnapshot([this](SnapshotWriter* writer) {
+    event_.SerializeToSnapshot(writer);
+    slice_.SerializeToSnapshot(writer);
+    cpu_slice_.SerializeToSnapshot(writer);
+  });
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(data.data());
+
+  uint64_t total_size = 0;
+  ASSERT_TRUE(ParseSnapshotHeader(ptr, data.size(), &total_size).ok());
+  ASSERT_EQ(total_size, data.size());
+
+  TestEventTable event{&pool_, nullptr};
+  TestSliceTable slice{&pool_, &event};
+  TestCpuSliceTable cpu_slice{&pool_, &slice};
+  SnapshotReader reader = ReaderFor(data);
+  SnapshotData event_data;
+  SnapshotData slice_data;
+  SnapshotData cpu_slice_data;
+  ASSERT_TRUE(event.ReadSnapshot(&reader, pool_, nullptr, &event_data).ok());
+  ASSERT_TRUE(
+      slice.ReadSnapshot(&reader, pool_, &event_data, &slice_data).ok());
+  ASSERT_TRUE(
+      cpu_slice.ReadSnapshot(&reader, pool_, &slice_data, &cpu_slice_data)
+          .ok());
+  ASSERT_TRUE(reader.AtEnd());
+
+  // Nothing changes until the data is restored.
+  ASSERT_EQ(event.row_count(), 0u);
+  event.RestoreSnapshot(std::move(event_data));
+  slice.RestoreSnapshot(std::move(slice_data));
+  cpu_slice.RestoreSnapshot(std::move(cpu_slice_data));
+
+  ASSERT_EQ(event.row_count(), 5u);
+  ASSERT_EQ(slice.row_count(), 3u);
+  ASSERT_EQ(cpu_slice.row_count(), 1u);
+
+  ASSERT_EQ(event.type().GetString(2), "cpu_slice");
+  ASSERT_EQ(event.ts()[3], 3);
+  ASSERT_EQ(slice.ts()[2], 4);
+  ASSERT_EQ(slice.dur()[0], 10);
+  ASSERT_EQ(slice.dur()[2], base::nullopt);
+  ASSERT_EQ(slice.depth()[2], 2);
+  ASSERT_EQ(cpu_slice.id()[0].value, 2u);
+  ASSERT_EQ(cpu_slice.arg_set_id()[0], 3);
+  ASSERT_EQ(cpu_slice.priority()[0], 5);
+  ASSERT_EQ(cpu_slice.end_state().GetString(0), "R");
+
+  // Rows can still be inserted after loading a snapshot.
+  auto id = slice.Insert(TestSliceTable::Row(5, 6, 7, 3)).id;
+  ASSERT_EQ(id.value, 5u);
+  ASSERT_EQ(event.row_count(), 6u);
+  ASSERT_EQ(slice.dur()[3], 7);
+}
+
+TEST_F(TableMacrosUnittest, SnapshotMismatchingTable) {
+  event_.Insert(TestEventTable::Row(0, 1));
+  std::string data = WriteSnapshot(
+      [this](SnapshotWriter* writer) { event_.SerializeToSnapshot(writer); });
+
+  TestArgsTable args{&pool_, nullptr};
+  SnapshotReader reader = ReaderFor(data);
+  SnapshotData args_data;
+  ASSERT_FALSE(args.ReadSnapshot(&reader, pool_, nullptr, &args_data).ok());
+  ASSERT_EQ(args.row_count(), 0u);
+}
+
+TEST_F(TableMacrosUnittest, SnapshotRowMapOutOfRange) {
+  // A row map of a root table pointing past the end of its storage.
+  std::string data = WriteSnapshot([](SnapshotWriter* writer) {
+    writer->WriteU32(1);  // Row count.
+    writer->WriteU32(1);  // Row map count.
+    writer->WriteU32(2);  // OverlayEncoding::kIndexVector.
+    writer->WriteVector(std::vector<uint32_t>{5});
+    writer->WriteU32(1);  // Owned column count.
+    writer->WriteString("arg_set_id");
+    writer->WriteVector(std::vector<uint32_t>{0});
+  });
+  SnapshotReader reader = ReaderFor(data);
+  SnapshotData args_data;
+  ASSERT_FALSE(args_.ReadSnapshot(&reader, pool_, nullptr, &args_data).ok());
+}
+
+TEST_F(TableMacrosUnittest, SnapshotBitVectorSizeOverflow) {
+  // The byte count of a bit vector of ~4G bits must not wrap around to zero.
+  std::string data = WriteSnapshot([](SnapshotWriter* writer) {
+    writer->WriteU32(0xfffffffa);  // Size in bits.
+    writer->WriteVector(std::vector<uint8_t>{});
+  });
+  SnapshotReader reader = ReaderFor(data);
+  BitVector bv;
+  ASSERT_FALSE(reader.ReadBitVector(&bv));
+}
+
+TEST_F(TableMacrosUnittest, SnapshotParentRowMapOutOfRange) {
+  // The slices refer to rows 1 and 2 of the event table but the event table
+  // in the snapshot only has a single row.
+  event_.Insert(TestEventTable::Row(0, 0));
+  slice_.Insert(TestSliceTable::Row(1, 0, 10, 0));
+  slice_.Insert(TestSliceTable::Row(2, 0, 10, 0));
+  TestEventTable small_event{&pool_, nullptr};
+  small_event.Insert(TestEventTable::Row(0, 0));
+
+  std::string data = WriteSnapshot([&](SnapshotWriter* writer) {
+    small_event.SerializeToSnapshot(writer);
+    slice_.SerializeToSnapshot(writer);
+  });
+
+  TestEventTable event{&pool_, nullptr};
+  TestSliceTable slice{&pool_, &event};
+  SnapshotReader reader = ReaderFor(data);
+  SnapshotData event_data;
+  SnapshotData slice_data;
+  ASSERT_TRUE(event.ReadSnapshot(&reader, pool_, nullptr, &event_data).ok());
+  ASSERT_FALSE(
+      slice.ReadSnapshot(&reader, pool_, &event_data, &slice_data).ok());
+}
+
+TEST_F(TableMacrosUnittest, SnapshotStringIdNotInPool) {
+  event_.Insert(TestEventTable::Row(0, 0));
+  slice_.Insert(TestSliceTable::Row(1, 0, 10, 0));
+  cpu_slice_.Insert(TestCpuSliceTable::Row(2, 3, base::nullopt, 1, 4, 5,
+                                           pool_.InternString("R")));
+  std::string data = WriteSnapshot([this](SnapshotWriter* writer) {
+    cpu_slice_.SerializeToSnapshot(writer);
+  });
+
+  // The pool the snapshot is restored into doesn't have the "R" string.
+  StringPool other_pool;
+  other_pool.InternString("cpu_slice");
+  SnapshotData slice_data;
+  slice_data.storage_sizes = {3, 2};
+  SnapshotReader reader = ReaderFor(data);
+  SnapshotData cpu_slice_data;
+  ASSERT_FALSE(cpu_slice_
+                   .ReadSnapshot(&reader, other_pool, &slice_data,
+                                 &cpu_slice_data)
+                   .ok());
+
+  reader = ReaderFor(data);
+  ASSERT_TRUE(
+      cpu_slice_.ReadSnapshot(&reader, pool_, &slice_data, &cpu_slice_data)
+          .ok());
+}
+#endif  // !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -171,6 +171,15 @@ PERFETTO_TP_TABLE(PERFETTO_TP_ACTUAL_FRAME_TIMELINE_SLICES_DEF);
 
 PERFETTO_TP_TABLE(PERFETTO_TP_EXPERIMENTAL_FLAT_SLICE_TABLE_DEF);
 
+#define PERFETTO_TP_EXPERIMENTAL_SLICES_IN_RANGE_TABLE_DEF(NAME, PARENT, C) \
+  NAME(ExperimentalSlicesInRangeTable, "experimental_slices_in_range")     \
+  PARENT(PERFETTO_TP_SLICE_TABLE_DEF, C)                                   \
+  C(uint32_t, range_track_id, Column::Flag::kHidden)                       \
+  C(int64_t, range_ts, Column::Flag::kHidden)                              \
+  C(int64_t, range_dur, Column::Flag::kHidden)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_EXPERIMENTAL_SLICES_IN_RANGE_TABLE_DEF);
+
 }  // namespace tables
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -79,6 +79,7 @@ ThreadStateTable::~ThreadStateTable() = default;
 ExpectedFrameTimelineSliceTable::~ExpectedFrameTimelineSliceTable() = default;
 ActualFrameTimelineSliceTable::~ActualFrameTimelineSliceTable() = default;
 ExperimentalFlatSliceTable::~ExperimentalFlatSliceTable() = default;
+ExperimentalSlicesInRangeTable::~ExperimentalSlicesInRangeTable() = default;
 
 // track_tables.h
 TrackTable::~TrackTable() = default;
@@ -41,7 +41,7 @@ ProtoEnum MetatraceCategoriesToProtoEnum(MetatraceCategories categories) {
 
 }  // namespace
 
-Category g_enabled_categories = Category::NONE;
+PERFETTO_THREAD_LOCAL Category g_enabled_categories = Category::NONE;
 
 void Enable(MetatraceConfig config) {
   g_enabled_categories = MetatraceCategoriesToProtoEnum(config.categories);
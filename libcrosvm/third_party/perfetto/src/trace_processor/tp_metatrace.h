@@ -21,6 +21,7 @@
 #include <functional>
 #include <vector>
 
+#include "perfetto/base/compiler.h"
 #include "perfetto/base/time.h"
 #include "perfetto/ext/base/metatrace_events.h"
 #include "perfetto/ext/base/string_view.h"
@@ -40,8 +41,10 @@ namespace metatrace {
 
 using Category = protos::pbzero::MetatraceCategories;
 
-// Stores whether meta-tracing is enabled.
-extern Category g_enabled_categories;
+// Stores whether meta-tracing is enabled. Meta-tracing is per thread (e.g. the
+// sessions of the HTTP RPC server run on their own threads and are traced
+// separately), as is the RingBuffer below.
+extern PERFETTO_THREAD_LOCAL Category g_enabled_categories;
 
 inline uint64_t TraceTimeNowNs() {
   return static_cast<uint64_t>(base::GetBootTimeNs().count());
@@ -132,8 +135,8 @@ class RingBuffer {
   void ReadAll(std::function<void(Record*)>);
 
   static RingBuffer* GetInstance() {
-    static RingBuffer* rb = new RingBuffer();
-    return rb;
+    static PERFETTO_THREAD_LOCAL RingBuffer rb;
+    return &rb;
   }
 
   uint64_t IndexOf(Record* record) {
@@ -26,10 +26,12 @@
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/base/time.h"
+#include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "src/trace_processor/db/snapshot_io.h"
 #include "src/trace_processor/dynamic/ancestor_generator.h"
 #include "src/trace_processor/dynamic/connected_flow_generator.h"
 #include "src/trace_processor/dynamic/descendant_generator.h"
@@ -39,6 +41,7 @@
 #include "src/trace_processor/dynamic/experimental_flat_slice_generator.h"
 #include "src/trace_processor/dynamic/experimental_sched_upid_generator.h"
 #include "src/trace_processor/dynamic/experimental_slice_layout_generator.h"
+#include "src/trace_processor/dynamic/experimental_slices_in_range_generator.h"
 #include "src/trace_processor/dynamic/view_generator.h"
 #include "src/trace_processor/importers/additional_modules.h"
 #include "src/trace_processor/importers/android_bugreport/android_bugreport_parser.h"
@@ -651,6 +654,8 @@ const char* TraceTypeToString(TraceType trace_type) {
       return "ninja_log";
     case kAndroidBugreportTraceType:
       return "android_bugreport";
+    case kSnapshotTraceType:
+      return "snapshot";
   }
   PERFETTO_FATAL("For GCC");
 }
@@ -756,7 +761,13 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
   SetupMetrics(this, *db_, &sql_metrics_, cfg.skip_builtin_metric_paths);
 
   // Setup the query cache.
-  query_cache_.reset(new QueryCache());
+  query_cache_.reset(new QueryCache(context_.storage.get()));
+
+  // Setup the threads used to parallelize queries.
+  if (cfg.query_threads > 0) {
+    query_thread_pool_.reset(
+        new base::ThreadPool(cfg.query_threads, "TPQuery"));
+  }
 
   const TraceStorage* storage = context_.storage.get();
 
@@ -764,12 +775,13 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
   StatsTable::RegisterTable(*db_, storage);
 
   // Operator tables.
-  SpanJoinOperatorTable::RegisterTable(*db_, storage);
+  SpanJoinOperatorTable::RegisterTable(*db_, &static_tables_);
   WindowOperatorTable::RegisterTable(*db_, storage);
   CreateViewFunction::RegisterTable(*db_);
 
   // New style tables but with some custom logic.
-  SqliteRawTable::RegisterTable(*db_, query_cache_.get(), &context_);
+  SqliteRawTable::RegisterTable(*db_, query_cache_.get(),
+                                query_thread_pool_.get(), &context_);
 
   // Tables dynamically generated at query time.
   RegisterDynamicTable(std::unique_ptr<ExperimentalFlamegraphGenerator>(
@@ -808,6 +820,8 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
       new ExperimentalAnnotatedStackGenerator(&context_)));
   RegisterDynamicTable(std::unique_ptr<ExperimentalFlatSliceGenerator>(
       new ExperimentalFlatSliceGenerator(&context_)));
+  RegisterDynamicTable(std::unique_ptr<ExperimentalSlicesInRangeGenerator>(
+      new ExperimentalSlicesInRangeGenerator(&context_)));
 
   // Views.
   RegisterView(storage->thread_slice_view());
@@ -1171,6 +1185,19 @@ std::vector<uint8_t> TraceProcessorImpl::GetMetricDescriptors() {
   return pool_.SerializeAsDescriptorSet();
 }
 
+base::Status TraceProcessorImpl::SaveSnapshot(const std::string& path) {
+  if (!notify_eof_called_)
+    return base::ErrStatus("Snapshots can only be saved after NotifyEndOfFile");
+
+  base::ScopedFile fd(base::OpenFile(path, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  if (!fd)
+    return base::ErrStatus("Failed to open %s", path.c_str());
+
+  SnapshotWriter writer(*fd);
+  context_.storage->SerializeToSnapshot(&writer);
+  return writer.Finalize();
+}
+
 void TraceProcessorImpl::EnableMetatrace(MetatraceConfig config) {
   metatrace::Enable(config);
 }
@@ -27,6 +27,7 @@
 
 #include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/thread_pool.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
 #include "perfetto/trace_processor/trace_processor.h"
@@ -36,6 +37,7 @@
 #include "src/trace_processor/sqlite/functions/import.h"
 #include "src/trace_processor/sqlite/query_cache.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
+#include "src/trace_processor/sqlite/span_join_operator_table.h"
 #include "src/trace_processor/trace_processor_storage_impl.h"
 #include "src/trace_processor/util/sql_modules.h"
 
@@ -95,6 +97,8 @@ class TraceProcessorImpl : public TraceProcessor,
 
   size_t RestoreInitialTables() override;
 
+  base::Status SaveSnapshot(const std::string& path) override;
+
   std::string GetCurrentTraceName() override;
   void SetCurrentTraceName(const std::string&) override;
 
@@ -109,12 +113,15 @@ class TraceProcessorImpl : public TraceProcessor,
 
   template <typename Table>
   void RegisterDbTable(const Table& table) {
-    DbSqliteTable::RegisterTable(*db_, query_cache_.get(), &table,
+    DbSqliteTable::RegisterTable(*db_, query_cache_.get(),
+                                 query_thread_pool_.get(), &table,
                                  Table::Name());
+    static_tables_.Insert(Table::Name(), &table);
   }
 
   void RegisterDynamicTable(std::unique_ptr<DynamicTableGenerator> generator) {
     DbSqliteTable::RegisterTable(*db_, query_cache_.get(),
+                                 query_thread_pool_.get(),
                                  std::move(generator));
   }
 
@@ -133,6 +140,13 @@ class TraceProcessorImpl : public TraceProcessor,
 
   std::unique_ptr<QueryCache> query_cache_;
 
+  // Only set if Config::query_threads is non-zero.
+  std::unique_ptr<base::ThreadPool> query_thread_pool_;
+
+  // The static tables registered using |RegisterDbTable| by name. Used by
+  // span join to read these tables without going through SQLite.
+  SpanJoinOperatorTable::StaticTableMap static_tables_;
+
   DescriptorPool pool_;
 
   // Map from module name to module contents. Used for IMPORT function.
@@ -704,6 +704,9 @@ struct CommandLineOptions {
   bool dev = false;
   bool no_ftrace_raw = false;
   bool analyze_trace_proto_content = false;
+  uint64_t sorting_memory_limit_mb = 0;
+  uint32_t query_threads = 0;
+  std::string snapshot_file_path;
 };
 
 void PrintUsage(char** argv) {
@@ -775,7 +778,21 @@ Options:
                                       processor when loading traces containing
                                       ftrace events.
 --analyze-trace-proto-content         Enables trace proto content analysis in
-                                      trace processor.)",
+                                      trace processor.
+ --sorting-memory-limit-mb N          Caps the memory used to hold trace
+                                      packets waiting to be sorted to N MB.
+                                      Packets above the limit are spilled to
+                                      a temporary file (default: 0, i.e. no
+                                      limit).
+ --query-threads N                    Uses N worker threads to filter large
+                                      tables in parallel while running
+                                      queries (default: 0, i.e. filter on the
+                                      main thread).
+ --save-snapshot FILE                 Writes a snapshot of the trace tables to
+                                      FILE once the trace is loaded. The
+                                      snapshot can be passed back to trace
+                                      processor in place of the trace to load
+                                      it without parsing it again.)",
                 argv[0]);
 }
 
@@ -794,6 +811,9 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     OPT_METATRACE_BUFFER_CAPACITY,
     OPT_METATRACE_CATEGORIES,
     OPT_ANALYZE_TRACE_PROTO_CONTENT,
+    OPT_SORTING_MEMORY_LIMIT_MB,
+    OPT_QUERY_THREADS,
+    OPT_SAVE_SNAPSHOT,
   };
 
   static const option long_options[] = {
@@ -822,6 +842,10 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       {"no-ftrace-raw", no_argument, nullptr, OPT_NO_FTRACE_RAW},
       {"analyze-trace-proto-content", no_argument, nullptr,
        OPT_ANALYZE_TRACE_PROTO_CONTENT},
+      {"sorting-memory-limit-mb", required_argument, nullptr,
+       OPT_SORTING_MEMORY_LIMIT_MB},
+      {"query-threads", required_argument, nullptr, OPT_QUERY_THREADS},
+      {"save-snapshot", required_argument, nullptr, OPT_SAVE_SNAPSHOT},
       {nullptr, 0, nullptr, 0}};
 
   bool explicit_interactive = false;
@@ -945,6 +969,22 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_SORTING_MEMORY_LIMIT_MB) {
+      command_line_options.sorting_memory_limit_mb =
+          static_cast<uint64_t>(atoll(optarg));
+      continue;
+    }
+
+    if (option == OPT_QUERY_THREADS) {
+      command_line_options.query_threads = static_cast<uint32_t>(atoi(optarg));
+      continue;
+    }
+
+    if (option == OPT_SAVE_SNAPSHOT) {
+      command_line_options.snapshot_file_path = optarg;
+      continue;
+    }
+
     PrintUsage(argv);
     exit(option == 'h' ? 0 : 1);
   }
@@ -953,7 +993,8 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       explicit_interactive || (command_line_options.pre_metrics_path.empty() &&
                                command_line_options.metric_names.empty() &&
                                command_line_options.query_file_path.empty() &&
-                               command_line_options.sqlite_file_path.empty());
+                               command_line_options.sqlite_file_path.empty() &&
+                               command_line_options.snapshot_file_path.empty());
 
   // Only allow non-interactive queries to emit perf data.
   if (!command_line_options.perf_file_path.empty() &&
@@ -1433,6 +1474,9 @@ base::Status TraceProcessorMain(int argc, char** argv) {
                             : SortingMode::kDefaultHeuristics;
   config.ingest_ftrace_in_raw_table = !options.no_ftrace_raw;
   config.analyze_trace_proto_content = options.analyze_trace_proto_content;
+  config.sorting_memory_limit_bytes =
+      options.sorting_memory_limit_mb * 1024 * 1024;
+  config.query_threads = options.query_threads;
 
   std::vector<MetricExtension> metric_extensions;
   RETURN_IF_ERROR(ParseMetricExtensionPaths(
@@ -1486,6 +1530,9 @@ base::Status TraceProcessorMain(int argc, char** argv) {
                   t_load_s, size_mb / t_load_s);
 
     RETURN_IF_ERROR(PrintStats());
+
+    if (!options.snapshot_file_path.empty())
+      RETURN_IF_ERROR(tp->SaveSnapshot(options.snapshot_file_path));
   }
 
 #if PERFETTO_HAS_SIGNAL_H()
@@ -36,6 +36,7 @@ enum TraceType {
   kCtraceTraceType,
   kNinjaLogTraceType,
   kAndroidBugreportTraceType,
+  kSnapshotTraceType,
 };
 
 class ArgsTracker;
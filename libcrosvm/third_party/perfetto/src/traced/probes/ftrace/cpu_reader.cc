@@ -19,6 +19,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/uio.h>
 
 #include <algorithm>
 #include <utility>
@@ -34,6 +35,7 @@
 #include "src/kallsyms/kernel_symbol_map.h"
 #include "src/kallsyms/lazy_kernel_symbolizer.h"
 #include "src/traced/probes/ftrace/cpu_stats_parser.h"
+#include "src/traced/probes/ftrace/event_decode_program.h"
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
 #include "src/traced/probes/ftrace/ftrace_controller.h"
 #include "src/traced/probes/ftrace/ftrace_data_source.h"
@@ -146,6 +148,88 @@ bool ZeroPaddedPageTail(const uint8_t* start, const uint8_t* end) {
   return true;
 }
 
+// Encodes the field of |op| at |pos|, returning the end of the encoded bytes.
+// See EventDecodeProgram.
+inline uint8_t* RunDecodeOp(const EventDecodeOp& op,
+                            const uint8_t* start,
+                            uint8_t* pos,
+                            FtraceMetadata* metadata) {
+  using protozero::proto_utils::WriteVarInt;
+  const uint8_t* field_start = start + op.ftrace_offset;
+  // Always copy the largest preamble, the buffer has room for it.
+  memcpy(pos, op.preamble, sizeof(op.preamble));
+  pos += op.preamble_size;
+  switch (op.type) {
+    case EventDecodeOp::kUint8:
+      return WriteVarInt(ReadValue<uint8_t>(field_start), pos);
+    case EventDecodeOp::kUint16:
+      return WriteVarInt(ReadValue<uint16_t>(field_start), pos);
+    case EventDecodeOp::kUint32:
+      return WriteVarInt(ReadValue<uint32_t>(field_start), pos);
+    case EventDecodeOp::kUint64:
+      return WriteVarInt(ReadValue<uint64_t>(field_start), pos);
+    case EventDecodeOp::kInt8:
+      return WriteVarInt(ReadValue<int8_t>(field_start), pos);
+    case EventDecodeOp::kInt16:
+      return WriteVarInt(ReadValue<int16_t>(field_start), pos);
+    case EventDecodeOp::kInt32:
+      return WriteVarInt(ReadValue<int32_t>(field_start), pos);
+    case EventDecodeOp::kInt64:
+      return WriteVarInt(ReadValue<int64_t>(field_start), pos);
+    case EventDecodeOp::kPid32: {
+      int32_t pid = ReadValue<int32_t>(field_start);
+      metadata->AddPid(pid);
+      return WriteVarInt(pid, pos);
+    }
+    case EventDecodeOp::kCommonPid32: {
+      int32_t pid = ReadValue<int32_t>(field_start);
+      metadata->AddCommonPid(pid);
+      return WriteVarInt(pid, pos);
+    }
+    case EventDecodeOp::kFixedCString: {
+      size_t len =
+          strnlen(reinterpret_cast<const char*>(field_start), op.ftrace_size);
+      pos = WriteVarInt(static_cast<uint32_t>(len), pos);
+      memcpy(pos, field_start, len);
+      return pos + len;
+    }
+  }
+  PERFETTO_FATAL("Unexpected decode op");
+}
+
+// Encodes the event starting at |start| into |message| with |program|. The
+// caller must guarantee that the event is at least Event::size bytes long.
+void RunDecodeProgram(const EventDecodeProgram& program,
+                      const uint8_t* start,
+                      protozero::Message* message,
+                      FtraceMetadata* metadata) {
+  using protozero::proto_utils::kMaxTagEncodedSize;
+  using protozero::proto_utils::kMessageLengthFieldSize;
+  uint8_t buf[kMaxEventDecodeProgramEncodedSize + kMaxTagEncodedSize];
+  uint8_t* pos = buf;
+  const EventDecodeOp* op = program.ops.data();
+  const EventDecodeOp* const common_end = op + program.num_common_ops;
+  const EventDecodeOp* const end = op + program.ops.size();
+  for (; op != common_end; op++)
+    pos = RunDecodeOp(*op, start, pos, metadata);
+
+  // The event specific message gets a redundant varint length, as
+  // Message::BeginNestedMessage() would do.
+  memcpy(pos, program.preamble, sizeof(program.preamble));
+  pos += program.preamble_size;
+  uint8_t* size_field = pos;
+  pos += kMessageLengthFieldSize;
+  uint8_t* nested_start = pos;
+  for (; op != end; op++)
+    pos = RunDecodeOp(*op, start, pos, metadata);
+  protozero::proto_utils::WriteRedundantVarInt(
+      static_cast<uint32_t>(pos - nested_start), size_field);
+
+  PERFETTO_DCHECK(static_cast<size_t>(pos - buf) <=
+                  kMaxEventDecodeProgramEncodedSize);
+  message->AppendRawProtoBytes(buf, static_cast<size_t>(pos - buf));
+}
+
 void LogInvalidPage(const void* start, size_t size) {
   PERFETTO_ELOG("Invalid ftrace page");
   std::string hexdump = base::HexDump(start, size);
@@ -180,7 +264,8 @@ size_t CpuReader::ReadCycle(
     uint8_t* parsing_buf,
     size_t parsing_buf_size_pages,
     size_t max_pages,
-    const std::set<FtraceDataSource*>& started_data_sources) {
+    const std::set<FtraceDataSource*>& started_data_sources,
+    size_t reader) {
   PERFETTO_DCHECK(max_pages > 0 && parsing_buf_size_pages > 0);
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_CPU_READ_CYCLE);
@@ -190,7 +275,7 @@ size_t CpuReader::ReadCycle(
   size_t total_pages_read = 0;
   for (bool is_first_batch = true;; is_first_batch = false) {
     size_t pages_read = ReadAndProcessBatch(
-        parsing_buf, batch_pages, is_first_batch, started_data_sources);
+        parsing_buf, batch_pages, is_first_batch, started_data_sources, reader);
 
     PERFETTO_DCHECK(pages_read <= batch_pages);
     total_pages_read += pages_read;
@@ -216,71 +301,17 @@ size_t CpuReader::ReadAndProcessBatch(
     uint8_t* parsing_buf,
     size_t max_pages,
     bool first_batch_in_cycle,
-    const std::set<FtraceDataSource*>& started_data_sources) {
+    const std::set<FtraceDataSource*>& started_data_sources,
+    size_t reader) {
   size_t pages_read = 0;
   {
     metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                                metatrace::FTRACE_CPU_READ_BATCH);
-    for (; pages_read < max_pages;) {
-      uint8_t* curr_page = parsing_buf + (pages_read * base::kPageSize);
-      ssize_t res =
-          PERFETTO_EINTR(read(*trace_fd_, curr_page, base::kPageSize));
-      if (res < 0) {
-        // Expected errors:
-        // EAGAIN: no data (since we're in non-blocking mode).
-        // ENONMEM, EBUSY: temporary ftrace failures (they happen).
-        // ENODEV: the cpu is offline (b/145583318).
-        if (errno != EAGAIN && errno != ENOMEM && errno != EBUSY &&
-            errno != ENODEV) {
-          PERFETTO_PLOG("Unexpected error on raw ftrace read");
-        }
-        break;  // stop reading regardless of errno
-      }
-
-      // As long as all of our reads are for a single page, the kernel should
-      // return exactly a well-formed raw ftrace page (if not in the steady
-      // state of reading out fully-written pages, the kernel will construct
-      // pages as necessary, copying over events and zero-filling at the end).
-      // A sub-page read() is therefore not expected in practice (unless
-      // there's a concurrent reader requesting less than a page?). Crash if
-      // encountering this situation. Kernel source pointer: see usage of
-      // |info->read| within |tracing_buffers_read|.
-      if (res == 0) {
-        // Very rare, but possible. Stop for now, should recover.
-        PERFETTO_DLOG("[cpu%zu]: 0-sized read from ftrace pipe.", cpu_);
-        break;
-      }
-      PERFETTO_CHECK(res == static_cast<ssize_t>(base::kPageSize));
-
-      pages_read += 1;
-
-      // Compare the amount of ftrace data read against an empirical threshold
-      // to make an educated guess on whether we should read more. To figure
-      // out the amount of ftrace data, we need to parse the page header (since
-      // the read always returns a page, zero-filled at the end). If we read
-      // fewer bytes than the threshold, it means that we caught up with the
-      // write pointer and we started consuming ftrace events in real-time.
-      // This cannot be just 4096 because it needs to account for
-      // fragmentation, i.e. for the fact that the last trace event didn't fit
-      // in the current page and hence the current page was terminated
-      // prematurely.
-      static constexpr size_t kRoughlyAPage = base::kPageSize - 512;
-      const uint8_t* scratch_ptr = curr_page;
-      base::Optional<PageHeader> hdr =
-          ParsePageHeader(&scratch_ptr, table_->page_header_size_len());
-      PERFETTO_DCHECK(hdr && hdr->size > 0 && hdr->size <= base::kPageSize);
-      if (!hdr.has_value()) {
-        PERFETTO_ELOG("[cpu%zu]: can't parse page header", cpu_);
-        break;
-      }
-      // Note that the first read after starting the read cycle being small is
-      // normal. It means that we're given the remainder of events from a
-      // page that we've partially consumed during the last read of the previous
-      // cycle (having caught up to the writer).
-      if (hdr->size < kRoughlyAPage &&
-          !(first_batch_in_cycle && pages_read == 1)) {
-        break;
-      }
+    if (batched_reads_) {
+      pages_read =
+          ReadPagesBatched(parsing_buf, max_pages, first_batch_in_cycle);
+    } else {
+      pages_read = ReadPages(parsing_buf, max_pages, first_batch_in_cycle);
     }
   }  // end of metatrace::FTRACE_CPU_READ_BATCH
 
@@ -291,7 +322,8 @@ size_t CpuReader::ReadAndProcessBatch(
 
   for (FtraceDataSource* data_source : started_data_sources) {
     size_t pages_parsed_ok = ProcessPagesForDataSource(
-        data_source->trace_writer(), data_source->mutable_metadata(), cpu_,
+        data_source->reader_trace_writer(reader),
+        data_source->reader_metadata(reader), cpu_,
         data_source->parsing_config(), parsing_buf, pages_read, table_,
         symbolizer_, ftrace_clock_snapshot_, ftrace_clock_);
     // If this happens, it means that we did not know how to parse the kernel
@@ -310,6 +342,124 @@ size_t CpuReader::ReadAndProcessBatch(
   return pages_read;
 }
 
+size_t CpuReader::ReadPages(uint8_t* parsing_buf,
+                            size_t max_pages,
+                            bool first_batch_in_cycle) {
+  size_t pages_read = 0;
+  for (; pages_read < max_pages;) {
+    uint8_t* curr_page = parsing_buf + (pages_read * base::kPageSize);
+    ssize_t res = PERFETTO_EINTR(read(*trace_fd_, curr_page, base::kPageSize));
+    if (res < 0) {
+      // Expected errors:
+      // EAGAIN: no data (since we're in non-blocking mode).
+      // ENONMEM, EBUSY: temporary ftrace failures (they happen).
+      // ENODEV: the cpu is offline (b/145583318).
+      if (errno != EAGAIN && errno != ENOMEM && errno != EBUSY &&
+          errno != ENODEV) {
+        PERFETTO_PLOG("Unexpected error on raw ftrace read");
+      }
+      break;  // stop reading regardless of errno
+    }
+
+    // As long as all of our reads are for a single page, the kernel should
+    // return exactly a well-formed raw ftrace page (if not in the steady
+    // state of reading out fully-written pages, the kernel will construct
+    // pages as necessary, copying over events and zero-filling at the end).
+    // A sub-page read() is therefore not expected in practice (unless
+    // there's a concurrent reader requesting less than a page?). Crash if
+    // encountering this situation. Kernel source pointer: see usage of
+    // |info->read| within |tracing_buffers_read|.
+    if (res == 0) {
+      // Very rare, but possible. Stop for now, should recover.
+      PERFETTO_DLOG("[cpu%zu]: 0-sized read from ftrace pipe.", cpu_);
+      break;
+    }
+    PERFETTO_CHECK(res == static_cast<ssize_t>(base::kPageSize));
+
+    pages_read += 1;
+    if (IsLastPageToRead(curr_page, first_batch_in_cycle && pages_read == 1))
+      break;
+  }
+  return pages_read;
+}
+
+// trace_pipe_raw doesn't implement read_iter, so the kernel serves a readv()
+// with a read of each iovec in turn, stopping at the first one that fails
+// (e.g. with EAGAIN) or comes back short. Hence each iovec gets a well-formed
+// page, as with ReadPages(), but with a single syscall for the whole batch.
+size_t CpuReader::ReadPagesBatched(uint8_t* parsing_buf,
+                                   size_t max_pages,
+                                   bool first_batch_in_cycle) {
+  constexpr size_t kMaxPagesPerReadv = 64;
+  struct iovec iov[kMaxPagesPerReadv];
+  size_t pages_read = 0;
+  while (pages_read < max_pages) {
+    size_t num_pages = std::min(max_pages - pages_read, kMaxPagesPerReadv);
+    for (size_t i = 0; i < num_pages; i++) {
+      iov[i].iov_base = parsing_buf + ((pages_read + i) * base::kPageSize);
+      iov[i].iov_len = base::kPageSize;
+    }
+    ssize_t res =
+        PERFETTO_EINTR(readv(*trace_fd_, iov, static_cast<int>(num_pages)));
+    if (res < 0) {
+      // See ReadPages() for the expected errors.
+      if (errno != EAGAIN && errno != ENOMEM && errno != EBUSY &&
+          errno != ENODEV) {
+        PERFETTO_PLOG("Unexpected error on raw ftrace read");
+      }
+      break;
+    }
+    if (res == 0) {
+      PERFETTO_DLOG("[cpu%zu]: 0-sized read from ftrace pipe.", cpu_);
+      break;
+    }
+    PERFETTO_CHECK(static_cast<size_t>(res) % base::kPageSize == 0);
+
+    // All the pages returned have been consumed from the kernel buffer, so
+    // they must be processed even if one of the earlier ones suggests that
+    // we caught up with the writer.
+    size_t new_pages = static_cast<size_t>(res) / base::kPageSize;
+    bool last_read = new_pages < num_pages;
+    for (size_t i = 0; i < new_pages; i++) {
+      const uint8_t* curr_page = parsing_buf + (pages_read * base::kPageSize);
+      pages_read += 1;
+      last_read |= IsLastPageToRead(curr_page,
+                                    first_batch_in_cycle && pages_read == 1);
+    }
+    if (last_read)
+      break;
+  }
+  return pages_read;
+}
+
+bool CpuReader::IsLastPageToRead(const uint8_t* page,
+                                 bool first_page_in_cycle) {
+  // Compare the amount of ftrace data read against an empirical threshold
+  // to make an educated guess on whether we should read more. To figure
+  // out the amount of ftrace data, we need to parse the page header (since
+  // the read always returns a page, zero-filled at the end). If we read
+  // fewer bytes than the threshold, it means that we caught up with the
+  // write pointer and we started consuming ftrace events in real-time.
+  // This cannot be just 4096 because it needs to account for
+  // fragmentation, i.e. for the fact that the last trace event didn't fit
+  // in the current page and hence the current page was terminated
+  // prematurely.
+  static constexpr size_t kRoughlyAPage = base::kPageSize - 512;
+  const uint8_t* scratch_ptr = page;
+  base::Optional<PageHeader> hdr =
+      ParsePageHeader(&scratch_ptr, table_->page_header_size_len());
+  PERFETTO_DCHECK(hdr && hdr->size > 0 && hdr->size <= base::kPageSize);
+  if (!hdr.has_value()) {
+    PERFETTO_ELOG("[cpu%zu]: can't parse page header", cpu_);
+    return true;
+  }
+  // Note that the first read after starting the read cycle being small is
+  // normal. It means that we're given the remainder of events from a
+  // page that we've partially consumed during the last read of the previous
+  // cycle (having caught up to the writer).
+  return hdr->size < kRoughlyAPage && !first_page_in_cycle;
+}
+
 // static
 size_t CpuReader::ProcessPagesForDataSource(
     TraceWriter* trace_writer,
@@ -350,7 +500,11 @@ size_t CpuReader::ProcessPagesForDataSource(
       uint32_t max_index_at_start = metadata->last_kernel_addr_index_written;
       PERFETTO_DCHECK(max_index_at_start <= metadata->kernel_addrs.size());
       protos::pbzero::InternedData* interned_data = nullptr;
-      auto* ksyms_map = symbolizer->GetOrCreateKernelSymbolMap();
+      // The map is normally created on the main thread when the data source
+      // starts, so that it can be used as is from the reader threads.
+      auto* ksyms_map = symbolizer->is_valid()
+                            ? symbolizer->symbol_map()
+                            : symbolizer->GetOrCreateKernelSymbolMap();
       bool wrote_at_least_one_symbol = false;
       for (const FtraceMetadata::KernelAddr& kaddr : metadata->kernel_addrs) {
         if (kaddr.index <= max_index_at_start)
@@ -694,34 +848,42 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
   }
 
   bool success = true;
-  for (const Field& field : table->common_fields())
-    success &= ParseField(field, start, end, table, message, metadata);
-
-  protozero::Message* nested =
-      message->BeginNestedMessage<protozero::Message>(info.proto_field_id);
-
-  // Parse generic event.
-  if (PERFETTO_UNLIKELY(info.proto_field_id ==
-                        protos::pbzero::FtraceEvent::kGenericFieldNumber)) {
-    nested->AppendString(GenericFtraceEvent::kEventNameFieldNumber, info.name);
-    for (const Field& field : info.fields) {
-      auto generic_field = nested->BeginNestedMessage<protozero::Message>(
-          GenericFtraceEvent::kFieldFieldNumber);
-      generic_field->AppendString(GenericFtraceEvent::Field::kNameFieldNumber,
-                                  field.ftrace_name);
-      success &= ParseField(field, start, end, table, generic_field, metadata);
-    }
-  } else if (PERFETTO_UNLIKELY(
-                 info.proto_field_id ==
-                 protos::pbzero::FtraceEvent::kSysEnterFieldNumber)) {
-    success &= ParseSysEnter(info, start, end, nested, metadata);
-  } else if (PERFETTO_UNLIKELY(
-                 info.proto_field_id ==
-                 protos::pbzero::FtraceEvent::kSysExitFieldNumber)) {
-    success &= ParseSysExit(info, start, end, ds_config, nested, metadata);
-  } else {  // Parse all other events.
-    for (const Field& field : info.fields) {
-      success &= ParseField(field, start, end, table, nested, metadata);
+  const EventDecodeProgram* program = table->GetDecodeProgram(ftrace_event_id);
+  if (PERFETTO_LIKELY(program)) {
+    // Fast path for the events made only of fixed size fields.
+    RunDecodeProgram(*program, start, message, metadata);
+  } else {
+    for (const Field& field : table->common_fields())
+      success &= ParseField(field, start, end, table, message, metadata);
+
+    protozero::Message* nested =
+        message->BeginNestedMessage<protozero::Message>(info.proto_field_id);
+
+    // Parse generic event.
+    if (PERFETTO_UNLIKELY(info.proto_field_id ==
+                          protos::pbzero::FtraceEvent::kGenericFieldNumber)) {
+      nested->AppendString(GenericFtraceEvent::kEventNameFieldNumber,
+                           info.name);
+      for (const Field& field : info.fields) {
+        auto generic_field = nested->BeginNestedMessage<protozero::Message>(
+            GenericFtraceEvent::kFieldFieldNumber);
+        generic_field->AppendString(GenericFtraceEvent::Field::kNameFieldNumber,
+                                    field.ftrace_name);
+        success &=
+            ParseField(field, start, end, table, generic_field, metadata);
+      }
+    } else if (PERFETTO_UNLIKELY(
+                   info.proto_field_id ==
+                   protos::pbzero::FtraceEvent::kSysEnterFieldNumber)) {
+      success &= ParseSysEnter(info, start, end, nested, metadata);
+    } else if (PERFETTO_UNLIKELY(
+                   info.proto_field_id ==
+                   protos::pbzero::FtraceEvent::kSysExitFieldNumber)) {
+      success &= ParseSysExit(info, start, end, ds_config, nested, metadata);
+    } else {  // Parse all other events.
+      for (const Field& field : info.fields) {
+        success &= ParseField(field, start, end, table, nested, metadata);
+      }
     }
   }
 
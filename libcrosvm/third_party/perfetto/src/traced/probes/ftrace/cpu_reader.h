@@ -75,10 +75,13 @@ class CpuReader {
 
   // Reads and parses all ftrace data for this cpu (in batches), until we catch
   // up to the writer, or hit |max_pages|. Returns number of pages read.
+  // The events are written with the trace writers of the |reader|-th reader
+  // thread of the data sources (see FtraceDataSource::reader_trace_writer()).
   size_t ReadCycle(uint8_t* parsing_buf,
                    size_t parsing_buf_size_pages,
                    size_t max_pages,
-                   const std::set<FtraceDataSource*>& started_data_sources);
+                   const std::set<FtraceDataSource*>& started_data_sources,
+                   size_t reader);
 
   template <typename T>
   static bool ReadAndAdvance(const uint8_t** ptr, const uint8_t* end, T* out) {
@@ -271,6 +274,10 @@ class CpuReader {
     ftrace_clock_ = clock;
   }
 
+  // If true, each batch of pages is read with a single readv() rather than
+  // with a read() per page.
+  void set_batched_reads(bool batched_reads) { batched_reads_ = batched_reads; }
+
  private:
   CpuReader(const CpuReader&) = delete;
   CpuReader& operator=(const CpuReader&) = delete;
@@ -283,7 +290,22 @@ class CpuReader {
       uint8_t* parsing_buf,
       size_t max_pages,
       bool first_batch_in_cycle,
-      const std::set<FtraceDataSource*>& started_data_sources);
+      const std::set<FtraceDataSource*>& started_data_sources,
+      size_t reader);
+
+  // Read at most |max_pages| of ftrace data into |parsing_buf|, with a read()
+  // per page or with readv()s of several pages respectively. Return the number
+  // of pages read.
+  size_t ReadPages(uint8_t* parsing_buf,
+                   size_t max_pages,
+                   bool first_batch_in_cycle);
+  size_t ReadPagesBatched(uint8_t* parsing_buf,
+                          size_t max_pages,
+                          bool first_batch_in_cycle);
+
+  // Returns true if |page| suggests that we caught up with the writer, and
+  // should stop reading for this cycle.
+  bool IsLastPageToRead(const uint8_t* page, bool first_page_in_cycle);
 
   const size_t cpu_;
   const ProtoTranslationTable* const table_;
@@ -291,6 +313,7 @@ class CpuReader {
   const FtraceClockSnapshot* const ftrace_clock_snapshot_;
   base::ScopedFile trace_fd_;
   protos::pbzero::FtraceClock ftrace_clock_{};
+  bool batched_reads_ = false;
 };
 
 }  // namespace perfetto
@@ -14,8 +14,14 @@
 
 #include <benchmark/benchmark.h>
 
+#include <string.h>
+
+#include <memory>
+
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/root_message.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/protozero/scattered_stream_null_delegate.h"
 #include "perfetto/protozero/scattered_stream_writer.h"
 #include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
@@ -24,6 +30,7 @@
 #include "src/traced/probes/ftrace/ftrace_print_filter.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 #include "src/traced/probes/ftrace/test/cpu_reader_support.h"
+#include "src/tracing/core/null_trace_writer.h"
 
 namespace perfetto {
 namespace {
@@ -615,6 +622,82 @@ void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
 }
 BENCHMARK(BM_ParsePageFullOfSchedSwitch);
 
+// Returns the number of events in |page| that are written to the bundle.
+size_t CountParsedEvents(const uint8_t* page,
+                         ProtoTranslationTable* table,
+                         const FtraceDataSourceConfig* ds_config) {
+  protozero::HeapBuffered<FtraceEventBundle> bundle;
+  CompactSchedBuffer compact_buffer;
+  FtraceMetadata metadata{};
+  const uint8_t* parse_pos = page;
+  base::Optional<CpuReader::PageHeader> page_header =
+      CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+  PERFETTO_CHECK(page_header.has_value());
+  CpuReader::ParsePagePayload(parse_pos, &page_header.value(), table,
+                              ds_config, &compact_buffer, bundle.get(),
+                              &metadata);
+  std::vector<uint8_t> serialized = bundle.SerializeAsArray();
+  protozero::ProtoDecoder decoder(serialized.data(), serialized.size());
+  size_t events = 0;
+  for (auto f = decoder.ReadField(); f.valid(); f = decoder.ReadField()) {
+    if (f.id() == FtraceEventBundle::kEventFieldNumber)
+      events++;
+  }
+  return events;
+}
+
+// Same as BM_ParsePageFullOfSchedSwitch, but compares the precompiled decode
+// program of sched_switch (decode_program = 1) with the field by field parsing
+// of the event (decode_program = 0). The rate is reported in events per
+// second (items_per_second).
+void BM_ParsePageFullOfSchedSwitchDecodeProgram(benchmark::State& state) {
+  ProtoTranslationTable* table = GetTable(g_full_page_sched_switch.name);
+  auto page = PageFromXxd(g_full_page_sched_switch.data);
+
+  FtraceDataSourceConfig ds_config{EventFilter{},
+                                   EventFilter{},
+                                   DisabledCompactSchedConfigForTesting(),
+                                   base::nullopt,
+                                   {},
+                                   {},
+                                   false /*symbolize_ksyms*/,
+                                   false /*preserve_ftrace_buffer*/,
+                                   {}};
+  size_t sched_switch_id =
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch"));
+  ds_config.event_filter.AddEnabledEvent(sched_switch_id);
+
+  // The table is shared by all the benchmarks, restore it once done.
+  table->set_decode_programs_enabled_for_testing(state.range(0) != 0);
+  PERFETTO_CHECK((table->GetDecodeProgram(sched_switch_id) != nullptr) ==
+                 (state.range(0) != 0));
+  size_t events = CountParsedEvents(page.get(), table, &ds_config);
+
+  ScatteredStreamWriterNullDelegate delegate(base::kPageSize);
+  ScatteredStreamWriter stream(&delegate);
+  protozero::RootMessage<FtraceEventBundle> writer;
+  CompactSchedBuffer compact_buffer;
+  FtraceMetadata metadata{};
+  for (auto _ : state) {
+    writer.Reset(&stream);
+    const uint8_t* parse_pos = page.get();
+    base::Optional<CpuReader::PageHeader> page_header =
+        CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+    PERFETTO_CHECK(page_header.has_value());
+    CpuReader::ParsePagePayload(parse_pos, &page_header.value(), table,
+                                &ds_config, &compact_buffer, &writer,
+                                &metadata);
+    metadata.Clear();
+  }
+  table->set_decode_programs_enabled_for_testing(true);
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * events));
+}
+BENCHMARK(BM_ParsePageFullOfSchedSwitchDecodeProgram)
+    ->ArgName("decode_program")
+    ->Arg(0)
+    ->Arg(1);
+
 void BM_ParsePageFullOfPrint(benchmark::State& state) {
   DoParse(g_full_page_print, {GroupAndName("ftrace", "print")}, base::nullopt,
           state);
@@ -633,5 +716,71 @@ void BM_ParsePageFullOfPrintWithFilterRules(benchmark::State& state) {
 }
 BENCHMARK(BM_ParsePageFullOfPrintWithFilterRules)->DenseRange(0, 16, 1);
 
+// A batch of pages full of "sched/sched_switch" events, as read in one go by
+// CpuReader::ReadAndProcessBatch().
+constexpr size_t kPagesPerBatch = 32;
+
+struct SchedSwitchBatch {
+  ProtoTranslationTable* table;
+  std::unique_ptr<uint8_t[]> pages;
+  FtraceDataSourceConfig ds_config;
+};
+
+const SchedSwitchBatch& GetSchedSwitchBatch() {
+  // Shared by the benchmark threads, hence initialized only once.
+  static const SchedSwitchBatch* batch = [] {
+    ProtoTranslationTable* table = GetTable(g_full_page_sched_switch.name);
+    auto page = PageFromXxd(g_full_page_sched_switch.data);
+    std::unique_ptr<uint8_t[]> pages(
+        new uint8_t[base::kPageSize * kPagesPerBatch]);
+    for (size_t i = 0; i < kPagesPerBatch; i++)
+      memcpy(&pages[i * base::kPageSize], page.get(), base::kPageSize);
+
+    FtraceDataSourceConfig ds_config{EventFilter{},
+                                     EventFilter{},
+                                     DisabledCompactSchedConfigForTesting(),
+                                     base::nullopt,
+                                     {},
+                                     {},
+                                     false /*symbolize_ksyms*/,
+                                     false /*preserve_ftrace_buffer*/,
+                                     {}};
+    ds_config.event_filter.AddEnabledEvent(
+        table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+    return new SchedSwitchBatch{table, std::move(pages), std::move(ds_config)};
+  }();
+  return *batch;
+}
+
+// Parses batches of pages into a trace writer per thread, as the ftrace reader
+// threads do (see FtraceConfig.reader_threads). The rate is reported in pages
+// per second, both overall and per thread, to show how well the parsing scales
+// across cores.
+void BM_ProcessPagesForDataSource(benchmark::State& state) {
+  const SchedSwitchBatch& batch = GetSchedSwitchBatch();
+  NullTraceWriter trace_writer;
+  FtraceMetadata metadata{};
+  for (auto _ : state) {
+    size_t pages_parsed = CpuReader::ProcessPagesForDataSource(
+        &trace_writer, &metadata, /*cpu=*/0, &batch.ds_config,
+        batch.pages.get(), kPagesPerBatch, batch.table,
+        /*symbolizer=*/nullptr, /*ftrace_clock_snapshot=*/nullptr,
+        protos::pbzero::FTRACE_CLOCK_UNSPECIFIED);
+    PERFETTO_CHECK(pages_parsed == kPagesPerBatch);
+    metadata.Clear();
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * kPagesPerBatch));
+  state.counters["pages_per_core"] = benchmark::Counter(
+      static_cast<double>(state.iterations() * kPagesPerBatch),
+      benchmark::Counter::kAvgThreadsRate);
+}
+BENCHMARK(BM_ProcessPagesForDataSource)
+    ->Threads(1)
+    ->Threads(2)
+    ->Threads(4)
+    ->Threads(8)
+    ->UseRealTime();
+
 }  // namespace
 }  // namespace perfetto
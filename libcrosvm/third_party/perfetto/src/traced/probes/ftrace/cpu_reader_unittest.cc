@@ -21,12 +21,15 @@
 #include <sys/syscall.h>
 
 #include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/pipe.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/protozero/scattered_stream_writer.h"
 #include "src/traced/probes/ftrace/event_info.h"
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
+#include "src/traced/probes/ftrace/ftrace_data_source.h"
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 #include "src/traced/probes/ftrace/test/cpu_reader_support.h"
@@ -1241,6 +1244,111 @@ TEST_F(CpuReaderTableTest, ParseAllFields) {
               Contains(Pair(99u, k64BitUserspaceBlockDeviceId)));
 }
 
+// Events made only of fixed size fields are encoded with an EventDecodeProgram,
+// which must produce the same bytes as encoding their fields one by one.
+TEST_F(CpuReaderTableTest, ParseEventWithDecodeProgram) {
+  const uint16_t ftrace_event_id = 102;
+  struct FieldSpec {
+    uint16_t size;
+    FtraceFieldType ftrace_type;
+    ProtoSchemaType proto_type;
+  };
+  const FieldSpec kCommonFields[] = {
+      {4, kFtraceUint32, ProtoSchemaType::kUint32},
+      {4, kFtraceCommonPid32, ProtoSchemaType::kInt32},
+  };
+  const FieldSpec kEventFields[] = {
+      {1, kFtraceUint8, ProtoSchemaType::kUint32},
+      {2, kFtraceUint16, ProtoSchemaType::kUint32},
+      {4, kFtraceUint32, ProtoSchemaType::kUint64},
+      {8, kFtraceUint64, ProtoSchemaType::kUint64},
+      {1, kFtraceInt8, ProtoSchemaType::kInt32},
+      {2, kFtraceInt16, ProtoSchemaType::kInt64},
+      {4, kFtraceInt32, ProtoSchemaType::kInt32},
+      {8, kFtraceInt64, ProtoSchemaType::kInt64},
+      {4, kFtracePid32, ProtoSchemaType::kInt32},
+      {1, kFtraceBool, ProtoSchemaType::kUint32},
+      {16, kFtraceFixedCString, ProtoSchemaType::kString},
+      {8, kFtraceFixedCString, ProtoSchemaType::kString},
+  };
+
+  uint16_t offset = 0;
+  auto make_field = [&offset](const FieldSpec& spec, uint32_t proto_field_id) {
+    Field field{};
+    field.ftrace_offset = offset;
+    field.ftrace_size = spec.size;
+    field.ftrace_type = spec.ftrace_type;
+    field.proto_field_id = proto_field_id;
+    field.proto_field_type = spec.proto_type;
+    PERFETTO_CHECK(SetTranslationStrategy(
+        field.ftrace_type, field.proto_field_type, &field.strategy));
+    offset += spec.size;
+    return field;
+  };
+  std::vector<Field> common_fields;
+  for (const FieldSpec& spec : kCommonFields)
+    common_fields.push_back(make_field(spec, 1 + common_fields.size()));
+  std::vector<Event> events(1);
+  Event* event = &events.back();
+  event->name = "";
+  event->group = "";
+  event->proto_field_id = 42;
+  event->ftrace_event_id = ftrace_event_id;
+  // Field ids which need a two bytes tag too.
+  for (const FieldSpec& spec : kEventFields)
+    event->fields.push_back(make_field(spec, 10 + 10 * event->fields.size()));
+  event->size = offset;
+
+  ProtoTranslationTable table(
+      &ftrace_, events, common_fields,
+      ProtoTranslationTable::DefaultPageHeaderSpecForTesting(),
+      InvalidCompactSchedEventFormatForTesting(), PrintkMap());
+  ASSERT_NE(table.GetDecodeProgram(ftrace_event_id), nullptr);
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+
+  BinaryWriter writer;
+  writer.Write<uint32_t>(0xffffffff);  // Common field.
+  writer.Write<int32_t>(9999);         // Common pid.
+  writer.Write<uint8_t>(200);
+  writer.Write<uint16_t>(60000);
+  writer.Write<uint32_t>(4000000000u);
+  writer.Write<uint64_t>(1ull << 63);
+  writer.Write<int8_t>(-1);
+  writer.Write<int16_t>(-300);
+  writer.Write<int32_t>(-70000);
+  writer.Write<int64_t>(-(1ll << 40));
+  writer.Write<int32_t>(97);  // Pid.
+  writer.Write<uint8_t>(1);   // Bool.
+  writer.WriteFixedString(16, "Hello");
+  for (char c : std::string("12345678"))  // Not null terminated.
+    writer.Write<char>(c);
+  ASSERT_EQ(writer.written(), offset);
+
+  auto input = writer.GetCopy();
+  protozero::HeapBuffered<protozero::Message> message;
+  FtraceMetadata metadata{};
+  ASSERT_TRUE(CpuReader::ParseEvent(ftrace_event_id, input.get(),
+                                    input.get() + offset, &table, &ds_config,
+                                    message.get(), &metadata));
+
+  protozero::HeapBuffered<protozero::Message> expected;
+  FtraceMetadata expected_metadata{};
+  for (const Field& field : common_fields) {
+    ASSERT_TRUE(CpuReader::ParseField(field, input.get(), input.get() + offset,
+                                      &table, expected.get(),
+                                      &expected_metadata));
+  }
+  auto* nested = expected->BeginNestedMessage<protozero::Message>(42);
+  for (const Field& field : event->fields) {
+    ASSERT_TRUE(CpuReader::ParseField(field, input.get(), input.get() + offset,
+                                      &table, nested, &expected_metadata));
+  }
+
+  EXPECT_EQ(message.SerializeAsArray(), expected.SerializeAsArray());
+  EXPECT_THAT(metadata.pids, Contains(97));
+  EXPECT_THAT(metadata.pids, Contains(9999));
+}
+
 TEST(CpuReaderTest, SysEnterEvent) {
   BinaryWriter writer;
   ProtoTranslationTable* table = GetTable("synthetic");
@@ -2206,6 +2314,51 @@ TEST(CpuReaderTest, ParseFullPageSchedSwitch) {
   EXPECT_EQ(bundle->event().size(), 59u);
 }
 
+// Reads full pages from a pipe standing in for trace_pipe_raw, both with a
+// read() per page and with a readv() for the whole batch.
+TEST(CpuReaderTest, ReadCycle) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  static constexpr size_t kTestPages = 3;
+  static constexpr size_t kParsingBufferSizePages = 32;
+  std::unique_ptr<uint8_t[]> parsing_buf(
+      new uint8_t[base::kPageSize * kParsingBufferSizePages]);
+
+  for (bool batched_reads : {false, true}) {
+    base::Pipe pipe = base::Pipe::Create(base::Pipe::kRdNonBlock);
+    for (size_t i = 0; i < kTestPages; i++) {
+      ASSERT_EQ(base::WriteAll(*pipe.wr, page.get(), base::kPageSize),
+                static_cast<ssize_t>(base::kPageSize));
+    }
+    CpuReader cpu_reader(/*cpu=*/0, table, /*symbolizer=*/nullptr,
+                         /*ftrace_clock_snapshot=*/nullptr, std::move(pipe.rd));
+    cpu_reader.set_batched_reads(batched_reads);
+
+    auto* trace_writer = new TraceWriterForTesting();
+    FtraceDataSource data_source(
+        base::WeakPtr<FtraceController>(), /*session_id=*/0, FtraceConfig(),
+        std::unique_ptr<TraceWriter>(trace_writer),
+        /*create_trace_writer=*/nullptr);
+    data_source.Initialize(/*config_id=*/1, &ds_config);
+
+    size_t pages_read = cpu_reader.ReadCycle(
+        parsing_buf.get(), kParsingBufferSizePages, kParsingBufferSizePages,
+        {&data_source}, /*reader=*/0);
+    EXPECT_EQ(pages_read, kTestPages);
+
+    size_t num_events = 0;
+    for (const auto& packet : trace_writer->GetAllTracePackets())
+      num_events += packet.ftrace_events().event().size();
+    EXPECT_EQ(num_events, kTestPages * 59u);
+  }
+}
+
 // clang-format off
 // # tracer: nop
 // #
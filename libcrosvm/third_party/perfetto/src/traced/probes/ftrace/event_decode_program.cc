@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/event_decode_program.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+
+namespace perfetto {
+namespace {
+
+using protozero::proto_utils::kMaxSimpleFieldEncodedSize;
+using protozero::proto_utils::kMaxTagEncodedSize;
+using protozero::proto_utils::kMessageLengthFieldSize;
+
+// Returns false if |strategy| isn't supported by EventDecodeOp.
+bool GetOpType(TranslationStrategy strategy, EventDecodeOp::Type* type) {
+  switch (strategy) {
+    case kUint8ToUint32:
+    case kUint8ToUint64:
+    case kBoolToUint32:
+    case kBoolToUint64:
+      *type = EventDecodeOp::kUint8;
+      return true;
+    case kUint16ToUint32:
+    case kUint16ToUint64:
+      *type = EventDecodeOp::kUint16;
+      return true;
+    case kUint32ToUint32:
+    case kUint32ToUint64:
+      *type = EventDecodeOp::kUint32;
+      return true;
+    case kUint64ToUint64:
+      *type = EventDecodeOp::kUint64;
+      return true;
+    case kInt8ToInt32:
+    case kInt8ToInt64:
+      *type = EventDecodeOp::kInt8;
+      return true;
+    case kInt16ToInt32:
+    case kInt16ToInt64:
+      *type = EventDecodeOp::kInt16;
+      return true;
+    case kInt32ToInt32:
+    case kInt32ToInt64:
+      *type = EventDecodeOp::kInt32;
+      return true;
+    case kInt64ToInt64:
+      *type = EventDecodeOp::kInt64;
+      return true;
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+      *type = EventDecodeOp::kPid32;
+      return true;
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+      *type = EventDecodeOp::kCommonPid32;
+      return true;
+    case kFixedCStringToString:
+      *type = EventDecodeOp::kFixedCString;
+      return true;
+    // These need to look at the event (e.g. for the length of the string), or
+    // have side effects beyond the pids in FtraceMetadata.
+    case kCStringToString:
+    case kStringPtrToString:
+    case kDataLocToString:
+    case kInode32ToUint64:
+    case kInode64ToUint64:
+    case kDevId32ToUint64:
+    case kDevId64ToUint64:
+    case kFtraceSymAddr64ToUint64:
+    case kInvalidTranslationStrategy:
+      break;
+  }
+  return false;
+}
+
+// Appends the op for |field| to |program|, and adds the largest size it can
+// encode to |max_size|. Returns false if |field| isn't supported.
+bool AddOp(const Field& field, EventDecodeProgram* program, size_t* max_size) {
+  EventDecodeOp op{};
+  if (!field.proto_field_id || !GetOpType(field.strategy, &op.type))
+    return false;
+  op.ftrace_offset = field.ftrace_offset;
+  op.ftrace_size = field.ftrace_size;
+
+  uint32_t tag;
+  if (op.type == EventDecodeOp::kFixedCString) {
+    tag = protozero::proto_utils::MakeTagLengthDelimited(field.proto_field_id);
+    *max_size += kMaxSimpleFieldEncodedSize + field.ftrace_size;
+  } else {
+    tag = protozero::proto_utils::MakeTagVarInt(field.proto_field_id);
+    *max_size += kMaxSimpleFieldEncodedSize;
+  }
+  uint8_t* end = protozero::proto_utils::WriteVarInt(tag, op.preamble);
+  op.preamble_size = static_cast<uint8_t>(end - op.preamble);
+  program->ops.push_back(op);
+  return true;
+}
+
+}  // namespace
+
+EventDecodeProgram CompileEventDecodeProgram(
+    const Event& event,
+    const std::vector<Field>& common_fields) {
+  using protos::pbzero::FtraceEvent;
+  EventDecodeProgram program;
+  // These events have their own parsing logic in CpuReader.
+  if (!event.proto_field_id ||
+      event.proto_field_id == FtraceEvent::kGenericFieldNumber ||
+      event.proto_field_id == FtraceEvent::kSysEnterFieldNumber ||
+      event.proto_field_id == FtraceEvent::kSysExitFieldNumber) {
+    return program;
+  }
+
+  size_t max_size = kMaxTagEncodedSize + kMessageLengthFieldSize;
+  for (const Field& field : common_fields) {
+    if (!AddOp(field, &program, &max_size))
+      return EventDecodeProgram();
+  }
+  program.num_common_ops = program.ops.size();
+  for (const Field& field : event.fields) {
+    if (!AddOp(field, &program, &max_size))
+      return EventDecodeProgram();
+  }
+  if (max_size > kMaxEventDecodeProgramEncodedSize)
+    return EventDecodeProgram();
+
+  uint8_t* end = protozero::proto_utils::WriteVarInt(
+      protozero::proto_utils::MakeTagLengthDelimited(event.proto_field_id),
+      program.preamble);
+  program.preamble_size = static_cast<uint8_t>(end - program.preamble);
+  program.valid = true;
+  return program;
+}
+
+}  // namespace perfetto
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_EVENT_DECODE_PROGRAM_H_
+#define SRC_TRACED_PROBES_FTRACE_EVENT_DECODE_PROGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/protozero/proto_utils.h"
+#include "src/traced/probes/ftrace/event_info_constants.h"
+
+namespace perfetto {
+
+// Upper bound of the size of an event encoded by an EventDecodeProgram,
+// common fields included. Events which could be larger are not compiled.
+constexpr size_t kMaxEventDecodeProgramEncodedSize = 512;
+
+// Decodes one field of the raw event and encodes it as a proto field.
+struct EventDecodeOp {
+  enum Type : uint8_t {
+    kUint8 = 0,
+    kUint16,
+    kUint32,
+    kUint64,
+    kInt8,
+    kInt16,
+    kInt32,
+    kInt64,
+    kPid32,
+    kCommonPid32,
+    kFixedCString,
+  };
+
+  Type type;
+  uint8_t preamble_size;
+  uint16_t ftrace_offset;
+  uint16_t ftrace_size;
+  // The pre-encoded proto tag of the field.
+  uint8_t preamble[protozero::proto_utils::kMaxTagEncodedSize];
+};
+
+// The format of an event compiled into a flat list of ops, for the events
+// whose fields all have a fixed size and a numeric, pid or fixed-length string
+// type. This covers the most frequent events (e.g. sched_switch, sched_waking,
+// irq_handler_entry, cpu_frequency).
+//
+// CpuReader::ParseEvent() runs the ops to encode the whole event into a
+// stack buffer, which is then appended to the FtraceEvent with a single write,
+// instead of dispatching on the TranslationStrategy of each field and going
+// through protozero::Message for each of them. The encoded bytes are the same
+// in both cases.
+struct EventDecodeProgram {
+  // If false, the event has to be parsed field by field.
+  bool valid = false;
+
+  // The ops of the common fields, written into the FtraceEvent, followed by
+  // the ops of the fields of the event specific message.
+  std::vector<EventDecodeOp> ops;
+  size_t num_common_ops = 0;
+
+  // The pre-encoded proto tag of the event specific message in FtraceEvent.
+  uint8_t preamble_size = 0;
+  uint8_t preamble[protozero::proto_utils::kMaxTagEncodedSize]{};
+};
+
+// Compiles the decode program of |event|. The returned program is not valid
+// if some of the fields of |event| or |common_fields| need the generic path.
+EventDecodeProgram CompileEventDecodeProgram(
+    const Event& event,
+    const std::vector<Field>& common_fields);
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_EVENT_DECODE_PROGRAM_H_
@@ -24,7 +24,9 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <string>
 #include <utility>
 
@@ -72,6 +74,9 @@ constexpr size_t kMaxPagesPerCpuPerReadTick = 256;  // 1 MB per cpu
 // should be a single counter in the cpu_reader, similar to lost_events case.
 constexpr size_t kParsingBufferSizePages = 32;
 
+// Upper bound for FtraceConfig.reader_threads.
+constexpr size_t kMaxReaderThreads = 32;
+
 uint32_t ClampDrainPeriodMs(uint32_t drain_period_ms) {
   if (drain_period_ms == 0) {
     return kDefaultDrainPeriodMs;
@@ -272,6 +277,13 @@ void FtraceController::StartIfNeeded() {
 // drain period. Therefore we introduce |per_cpu_.period_page_quota|. If the
 // consumer wants to handle a high bandwidth of ftrace events, they should set
 // the config values appropriately.
+//
+// If the configs ask for several reader threads, the cpus are split among the
+// threads of |reader_pool_| and the main thread, which read and parse their
+// buffers concurrently. The main thread is blocked until they are all done, so
+// the rest of the logic (quotas, reposting) stays the same. As the main thread
+// can't send commits in the meantime, the writers of the other threads drop
+// data rather than stall when the shared memory buffer is full.
 void FtraceController::ReadTick(int generation) {
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_READ_TICK);
@@ -290,19 +302,21 @@ void FtraceController::ReadTick(int generation) {
 #endif
 
   // Read all cpu buffers with remaining per-period quota.
-  bool all_cpus_done = true;
-  uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
+  std::atomic<bool> all_cpus_done{true};
   const auto ftrace_clock = ftrace_config_muxer_->ftrace_clock();
-  for (size_t i = 0; i < per_cpu_.size(); i++) {
+  const size_t num_readers = SetUpReaders();
+  ForEachCpu(num_readers, [&](size_t reader, size_t i) {
     size_t orig_quota = per_cpu_[i].period_page_quota;
     if (orig_quota == 0)
-      continue;
+      return;
 
     size_t max_pages = std::min(orig_quota, kMaxPagesPerCpuPerReadTick);
     CpuReader& cpu_reader = *per_cpu_[i].reader;
     cpu_reader.set_ftrace_clock(ftrace_clock);
-    size_t pages_read = cpu_reader.ReadCycle(
-        parsing_buf, kParsingBufferSizePages, max_pages, started_data_sources_);
+    cpu_reader.set_batched_reads(num_readers > 1);
+    size_t pages_read =
+        cpu_reader.ReadCycle(parsing_buf(reader), kParsingBufferSizePages,
+                             max_pages, started_data_sources_, reader);
 
     size_t new_quota = (pages_read >= orig_quota) ? 0 : orig_quota - pages_read;
     per_cpu_[i].period_page_quota = new_quota;
@@ -317,7 +331,9 @@ void FtraceController::ReadTick(int generation) {
     PERFETTO_DCHECK(pages_read <= max_pages);
     if (pages_read == max_pages && new_quota > 0)
       all_cpus_done = false;
-  }
+  });
+  for (FtraceDataSource* data_source : started_data_sources_)
+    data_source->MergeReadersMetadata();
   observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
 
   // More work to do in this period.
@@ -348,6 +364,56 @@ void FtraceController::ReadTick(int generation) {
   }
 }
 
+size_t FtraceController::SetUpReaders() {
+  size_t num_readers = 1;
+  for (const FtraceDataSource* data_source : started_data_sources_) {
+    num_readers =
+        std::max<size_t>(num_readers, data_source->config().reader_threads());
+  }
+  num_readers = std::min(num_readers, kMaxReaderThreads);
+  num_readers = std::max<size_t>(std::min(num_readers, per_cpu_.size()), 1);
+
+  const size_t num_threads = num_readers - 1;
+  if (num_threads == 0) {
+    reader_pool_.reset();
+  } else if (!reader_pool_ || reader_pool_->num_threads() != num_threads) {
+    reader_pool_.reset(new base::ThreadPool(static_cast<uint32_t>(num_threads),
+                                            "ftraceread"));
+  }
+  while (reader_parsing_mem_.size() < num_threads) {
+    reader_parsing_mem_.emplace_back(
+        base::PagedMemory::Allocate(base::kPageSize * kParsingBufferSizePages));
+  }
+  for (FtraceDataSource* data_source : started_data_sources_)
+    data_source->SetNumReaders(num_readers);
+  return num_readers;
+}
+
+void FtraceController::ForEachCpu(
+    size_t num_readers,
+    const std::function<void(size_t, size_t)>& fn) {
+  if (num_readers <= 1) {
+    for (size_t cpu = 0; cpu < per_cpu_.size(); cpu++)
+      fn(0, cpu);
+    return;
+  }
+  // The cpus are claimed dynamically rather than split upfront, as the
+  // amount of data to read is usually very skewed across cpus.
+  std::atomic<size_t> next_cpu{0};
+  reader_pool_->RunParallel(num_readers, [&](size_t reader) {
+    for (size_t cpu = next_cpu.fetch_add(1); cpu < per_cpu_.size();
+         cpu = next_cpu.fetch_add(1)) {
+      fn(reader, cpu);
+    }
+  });
+}
+
+uint8_t* FtraceController::parsing_buf(size_t reader) {
+  base::PagedMemory& mem =
+      reader == 0 ? parsing_mem_ : reader_parsing_mem_[reader - 1];
+  return reinterpret_cast<uint8_t*>(mem.Get());
+}
+
 uint32_t FtraceController::GetDrainPeriodMs() {
   if (data_sources_.empty())
     return kDefaultDrainPeriodMs;
@@ -376,12 +442,15 @@ void FtraceController::Flush(FlushRequestID flush_id) {
   // events.
   size_t per_cpu_buf_size_pages =
       ftrace_config_muxer_->GetPerCpuBufferSizePages();
-  uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
-  for (size_t i = 0; i < per_cpu_.size(); i++) {
-    per_cpu_[i].reader->ReadCycle(parsing_buf, kParsingBufferSizePages,
-                                  per_cpu_buf_size_pages,
-                                  started_data_sources_);
-  }
+  const size_t num_readers = SetUpReaders();
+  ForEachCpu(num_readers, [&](size_t reader, size_t i) {
+    per_cpu_[i].reader->set_batched_reads(num_readers > 1);
+    per_cpu_[i].reader->ReadCycle(parsing_buf(reader), kParsingBufferSizePages,
+                                  per_cpu_buf_size_pages, started_data_sources_,
+                                  reader);
+  });
+  for (FtraceDataSource* data_source : started_data_sources_)
+    data_source->MergeReadersMetadata();
   observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
 
   for (FtraceDataSource* data_source : started_data_sources_)
@@ -398,6 +467,8 @@ void FtraceController::StopIfNeeded() {
 
   per_cpu_.clear();
   cpu_zero_stats_fd_.reset();
+  reader_pool_.reset();
+  reader_parsing_mem_.clear();
 
   // Muxer cannot change the current_tracer until we close the trace pipe fds
   // (i.e. per_cpu_). Hence an explicit request here.
@@ -26,9 +26,11 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/thread_pool.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/base/weak_ptr.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
@@ -124,6 +126,19 @@ class FtraceController {
 
   uint32_t GetDrainPeriodMs();
 
+  // Sets up |reader_pool_| and the data sources for the number of reader
+  // threads requested by the configs (see FtraceConfig.reader_threads).
+  // Returns the number of readers.
+  size_t SetUpReaders();
+
+  // Invokes |fn(reader, cpu)| for each cpu, on |num_readers| threads. Each
+  // reader thread claims the next cpu left when done with the previous one.
+  void ForEachCpu(size_t num_readers,
+                  const std::function<void(size_t, size_t)>& fn);
+
+  // Returns the parsing buffer of the |reader|-th reader thread.
+  uint8_t* parsing_buf(size_t reader);
+
   void StartIfNeeded();
   void StopIfNeeded();
 
@@ -132,6 +147,10 @@ class FtraceController {
   base::TaskRunner* const task_runner_;
   Observer* const observer_;
   base::PagedMemory parsing_mem_;
+  // The parsing buffers of the reader threads other than the main one, and
+  // the threads themselves. Unset unless FtraceConfig.reader_threads > 1.
+  std::vector<base::PagedMemory> reader_parsing_mem_;
+  std::unique_ptr<base::ThreadPool> reader_pool_;
   base::ScopedFile cpu_zero_stats_fd_;
   std::unique_ptr<LazyKernelSymbolizer> symbolizer_;
   std::unique_ptr<FtraceProcfs> ftrace_procfs_;
@@ -20,6 +20,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <mutex>
+
 #include "perfetto/ext/base/file_utils.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/cpu_reader.h"
@@ -39,9 +41,11 @@
 using testing::_;
 using testing::AnyNumber;
 using testing::ByMove;
+using testing::Each;
 using testing::ElementsAre;
 using testing::Invoke;
 using testing::IsEmpty;
+using testing::Lt;
 using testing::MatchesRegex;
 using testing::Mock;
 using testing::NiceMock;
@@ -184,18 +188,31 @@ class TestFtraceController : public FtraceController,
   MockFtraceProcfs* procfs() { return procfs_; }
   uint64_t NowMs() const override { return now_ms; }
   uint32_t drain_period_ms() { return GetDrainPeriodMs(); }
+  size_t set_up_readers() { return SetUpReaders(); }
+  void for_each_cpu(size_t num_readers,
+                    const std::function<void(size_t, size_t)>& fn) {
+    ForEachCpu(num_readers, fn);
+  }
 
-  std::unique_ptr<FtraceDataSource> AddFakeDataSource(const FtraceConfig& cfg) {
+  std::unique_ptr<FtraceDataSource> AddFakeDataSource(
+      const FtraceConfig& cfg,
+      std::unique_ptr<TraceWriter> trace_writer = nullptr,
+      FtraceDataSource::TraceWriterFactory create_trace_writer = nullptr) {
     std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
-        GetWeakPtr(), 0 /* session id */, cfg, nullptr /* trace_writer */));
+        GetWeakPtr(), 0 /* session id */, cfg, std::move(trace_writer),
+        std::move(create_trace_writer)));
     if (!AddDataSource(data_source.get()))
       return nullptr;
     return data_source;
   }
 
-  void OnFtraceDataWrittenIntoDataSourceBuffers() override {}
+  void OnFtraceDataWrittenIntoDataSourceBuffers() override {
+    if (on_data_written)
+      on_data_written();
+  }
 
   uint64_t now_ms = 0;
+  std::function<void()> on_data_written;
 
  private:
   TestFtraceController(const TestFtraceController&) = delete;
@@ -473,6 +490,68 @@ TEST(FtraceControllerTest, PeriodicDrainConfig) {
   }
 }
 
+TEST(FtraceControllerTest, ReaderThreads) {
+  auto controller =
+      CreateTestController(true /* nice procfs */, 4 /* cpu_count */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_reader_threads(3);
+  size_t writers_created = 0;
+  auto data_source = controller->AddFakeDataSource(
+      config, std::unique_ptr<TraceWriter>(new TraceWriterForTesting()),
+      [&writers_created] {
+        writers_created++;
+        return std::unique_ptr<TraceWriter>(new TraceWriterForTesting());
+      });
+  ASSERT_TRUE(data_source);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+
+  // The main thread is one of the readers, the other two need a writer each.
+  EXPECT_EQ(3u, controller->set_up_readers());
+  EXPECT_EQ(2u, writers_created);
+
+  // Every cpu is read exactly once, by any of the readers.
+  std::mutex mutex;
+  std::vector<size_t> cpus;
+  std::vector<size_t> readers;
+  controller->for_each_cpu(3, [&](size_t reader, size_t cpu) {
+    std::lock_guard<std::mutex> lock(mutex);
+    readers.push_back(reader);
+    cpus.push_back(cpu);
+  });
+  EXPECT_THAT(cpus, UnorderedElementsAre(0u, 1u, 2u, 3u));
+  EXPECT_THAT(readers, Each(Lt(3u)));
+
+  // The metadata of the readers must be merged before the observer is
+  // notified, which in turn must happen before the flush is acked.
+  data_source->reader_metadata(0)->AddPid(10);
+  data_source->reader_metadata(1)->AddPid(11);
+  data_source->reader_metadata(2)->AddPid(12);
+  std::vector<std::string> events;
+  controller->on_data_written = [&] {
+    EXPECT_THAT(data_source->mutable_metadata()->pids,
+                ElementsAre(10, 11, 12));
+    EXPECT_THAT(data_source->reader_metadata(1)->pids, IsEmpty());
+    EXPECT_THAT(data_source->reader_metadata(2)->pids, IsEmpty());
+    data_source->mutable_metadata()->Clear();
+    events.push_back("data_written");
+  };
+  data_source->Flush(1, [&events] { events.push_back("flush_complete"); });
+  EXPECT_THAT(events, ElementsAre("data_written", "flush_complete"));
+  EXPECT_EQ(2u, writers_created);
+
+  // The number of readers is truncated to the number of cpus.
+  FtraceConfig config_many = CreateFtraceConfig({"group/foo"});
+  config_many.set_reader_threads(16);
+  auto data_source_many = controller->AddFakeDataSource(
+      config_many, std::unique_ptr<TraceWriter>(new TraceWriterForTesting()),
+      [] { return std::unique_ptr<TraceWriter>(new TraceWriterForTesting()); });
+  ASSERT_TRUE(data_source_many);
+  ASSERT_TRUE(controller->StartDataSource(data_source_many.get()));
+  EXPECT_EQ(4u, controller->set_up_readers());
+  EXPECT_EQ(3u, writers_created);
+}
+
 TEST(FtraceMetadataTest, Clear) {
   FtraceMetadata metadata;
   metadata.inode_and_device.insert(std::make_pair(1, 1));
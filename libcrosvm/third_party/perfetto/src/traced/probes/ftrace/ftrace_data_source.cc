@@ -84,9 +84,11 @@ FtraceDataSource::FtraceDataSource(
     base::WeakPtr<FtraceController> controller_weak,
     TracingSessionID session_id,
     const FtraceConfig& config,
-    std::unique_ptr<TraceWriter> writer)
+    std::unique_ptr<TraceWriter> writer,
+    TraceWriterFactory create_trace_writer)
     : ProbesDataSource(session_id, &descriptor),
       config_(config),
+      create_trace_writer_(std::move(create_trace_writer)),
       writer_(std::move(writer)),
       controller_weak_(std::move(controller_weak)) {}
 
@@ -103,6 +105,23 @@ void FtraceDataSource::Initialize(
   parsing_config_ = parsing_config;
 }
 
+void FtraceDataSource::SetNumReaders(size_t num_readers) {
+  // Readers are never removed, as their writers can still hold data which
+  // hasn't been committed.
+  while (readers_.size() + 1 < num_readers) {
+    std::unique_ptr<ReaderState> reader(new ReaderState());
+    reader->writer = create_trace_writer_();
+    readers_.emplace_back(std::move(reader));
+  }
+}
+
+void FtraceDataSource::MergeReadersMetadata() {
+  for (const auto& reader : readers_) {
+    metadata_.MergeFrom(reader->metadata);
+    reader->metadata.Clear();
+  }
+}
+
 void FtraceDataSource::Start() {
   FtraceController* ftrace = controller_weak_.get();
   if (!ftrace)
@@ -156,6 +175,10 @@ void FtraceDataSource::OnFtraceFlushComplete(FlushRequestID flush_request_id) {
   pending_flushes_.erase(it);
   if (writer_) {
     WriteStats();
+    // The flush of |writer_| is acked only after the commits of the chunks
+    // returned here.
+    for (const auto& reader : readers_)
+      reader->writer->Flush();
     writer_->Flush(std::move(callback));
   }
 }
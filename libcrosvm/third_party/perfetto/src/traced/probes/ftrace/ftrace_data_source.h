@@ -23,6 +23,7 @@
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/weak_ptr.h"
@@ -56,10 +57,17 @@ class FtraceDataSource : public ProbesDataSource {
  public:
   static const ProbesDataSource::Descriptor descriptor;
 
+  using TraceWriterFactory = std::function<std::unique_ptr<TraceWriter>()>;
+
+  // |create_trace_writer| is used to create the writers of the additional
+  // reader threads, when FtraceConfig.reader_threads is set. These writers are
+  // used while the main thread is blocked, so they must not stall when the
+  // shared memory buffer is full (i.e. use BufferExhaustedPolicy::kDrop).
   FtraceDataSource(base::WeakPtr<FtraceController>,
                    TracingSessionID,
                    const FtraceConfig&,
-                   std::unique_ptr<TraceWriter>);
+                   std::unique_ptr<TraceWriter>,
+                   TraceWriterFactory create_trace_writer);
   ~FtraceDataSource() override;
 
   // Called by FtraceController soon after ProbesProducer creates the data
@@ -84,6 +92,22 @@ class FtraceDataSource : public ProbesDataSource {
   FtraceSetupErrors* mutable_setup_errors() { return &setup_errors_; }
   TraceWriter* trace_writer() { return writer_.get(); }
 
+  // When FtraceController reads ftrace on several threads, each thread
+  // writes into its own trace writer and collects its own metadata. Reader 0
+  // uses trace_writer() and mutable_metadata(). SetNumReaders() must be called
+  // on the main thread, while the readers are idle.
+  void SetNumReaders(size_t num_readers);
+  TraceWriter* reader_trace_writer(size_t reader) {
+    return reader == 0 ? writer_.get() : readers_[reader - 1]->writer.get();
+  }
+  FtraceMetadata* reader_metadata(size_t reader) {
+    return reader == 0 ? &metadata_ : &readers_[reader - 1]->metadata;
+  }
+
+  // Moves the metadata collected by the other readers into
+  // mutable_metadata(), see FtraceMetadata::MergeFrom().
+  void MergeReadersMetadata();
+
  private:
   // Hands out internal pointers to callbacks.
   FtraceDataSource(const FtraceDataSource&) = delete;
@@ -100,6 +124,14 @@ class FtraceDataSource : public ProbesDataSource {
   FtraceSetupErrors setup_errors_{};
   std::map<FlushRequestID, std::function<void()>> pending_flushes_;
 
+  // The reader threads other than the main one, see SetNumReaders().
+  struct ReaderState {
+    std::unique_ptr<TraceWriter> writer;
+    FtraceMetadata metadata;
+  };
+  TraceWriterFactory create_trace_writer_;
+  std::vector<std::unique_ptr<ReaderState>> readers_;
+
   // -- Fields initialized by the Initialize() call:
   FtraceConfigId config_id_ = 0;
   std::unique_ptr<TraceWriter> writer_;
@@ -77,9 +77,9 @@ struct FtraceMetadata {
 #if PERFETTO_DCHECK_IS_ON()
     PERFETTO_DCHECK(seen_device_id);
 #endif
-    static int32_t cached_pid = 0;
-    if (!cached_pid)
-      cached_pid = getpid();
+    // Initialized once in a thread-safe way, as ftrace can be parsed on
+    // several threads (see FtraceConfig.reader_threads).
+    static const int32_t cached_pid = getpid();
 
     PERFETTO_DCHECK(last_seen_common_pid);
     PERFETTO_DCHECK(cached_pid == getpid());
@@ -120,6 +120,18 @@ struct FtraceMetadata {
     return it_and_inserted.first->index;
   }
 
+  // Adds the pids, renamed pids and inodes seen by |other|. The kernel
+  // symbols are not merged, as their indexes are interned separately for each
+  // trace writer.
+  void MergeFrom(const FtraceMetadata& other) {
+    for (const InodeBlockPair& inode : other.inode_and_device)
+      inode_and_device.insert(inode);
+    for (int32_t pid : other.rename_pids)
+      rename_pids.insert(pid);
+    for (int32_t pid : other.pids)
+      AddPid(pid);
+  }
+
   void Clear() {
     inode_and_device.clear();
     rename_pids.clear();
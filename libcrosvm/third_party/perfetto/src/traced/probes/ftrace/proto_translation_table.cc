@@ -528,6 +528,11 @@ ProtoTranslationTable::ProtoTranslationTable(
     name_to_events_[event.name].push_back(&events_.at(event.ftrace_event_id));
     group_to_events_[event.group].push_back(&events_.at(event.ftrace_event_id));
   }
+  decode_programs_.resize(events_.size());
+  for (const Event& event : events) {
+    decode_programs_[event.ftrace_event_id] =
+        CompileEventDecodeProgram(event, common_fields_);
+  }
 }
 
 const Event* ProtoTranslationTable::GetOrCreateEvent(
@@ -29,6 +29,7 @@
 
 #include "perfetto/ext/base/scoped_file.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
+#include "src/traced/probes/ftrace/event_decode_program.h"
 #include "src/traced/probes/ftrace/event_info.h"
 #include "src/traced/probes/ftrace/format_parser/format_parser.h"
 #include "src/traced/probes/ftrace/printk_formats_parser.h"
@@ -166,6 +167,22 @@ class ProtoTranslationTable {
     return compact_sched_format_;
   }
 
+  // Returns the decode program of the event with the given id, or nullptr if
+  // the event has to be parsed field by field.
+  const EventDecodeProgram* GetDecodeProgram(size_t id) const {
+    if (!decode_programs_enabled_ || id >= decode_programs_.size() ||
+        !decode_programs_[id].valid) {
+      return nullptr;
+    }
+    return &decode_programs_[id];
+  }
+
+  // Forces all the events to be parsed field by field. Used by benchmarks to
+  // compare the two decoding paths.
+  void set_decode_programs_enabled_for_testing(bool enabled) {
+    decode_programs_enabled_ = enabled;
+  }
+
   base::StringView LookupTraceString(uint64_t address) const {
     return printk_formats_.at(address);
   }
@@ -191,6 +208,10 @@ class ProtoTranslationTable {
   std::set<std::string> interned_strings_;
   CompactSchedEventFormat compact_sched_format_;
   PrintkMap printk_formats_;
+  // Indexed by ftrace event id. Only the events known at construction time
+  // are compiled, the generic ones added later are parsed field by field.
+  std::vector<EventDecodeProgram> decode_programs_;
+  bool decode_programs_enabled_ = true;
 };
 
 // Class for efficient 'is event with id x enabled?' checks.
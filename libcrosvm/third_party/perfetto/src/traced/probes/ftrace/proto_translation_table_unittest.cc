@@ -19,6 +19,7 @@
 #include "src/base/test/gtest_test_suite.h"
 #include "src/base/test/utils.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
+#include "src/traced/probes/ftrace/event_decode_program.h"
 #include "src/traced/probes/ftrace/event_info.h"
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 #include "test/gtest_and_gmock.h"
@@ -300,6 +301,43 @@ TEST(TranslationTableTest, CompactSchedFormatParsingWalleyeData) {
   EXPECT_EQ(8u, format.sched_waking.comm_offset);
 }
 
+TEST(TranslationTableTest, DecodeProgramsWalleyeData) {
+  std::string path = base::GetTestDataPath(
+      "src/traced/probes/ftrace/test/data/"
+      "android_walleye_OPM5.171019.017.A1_4.4.88/");
+  FtraceProcfs ftrace_procfs(path);
+  auto table = ProtoTranslationTable::Create(
+      &ftrace_procfs, GetStaticEventInfo(), GetStaticCommonFieldsInfo());
+  PERFETTO_CHECK(table);
+
+  // sched_switch has only fixed size fields.
+  const EventDecodeProgram* program = table->GetDecodeProgram(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+  ASSERT_NE(program, nullptr);
+  EXPECT_EQ(program->num_common_ops, 1u);
+  ASSERT_EQ(program->ops.size(), 8u);
+  EXPECT_EQ(program->ops[0].type, EventDecodeOp::kCommonPid32);
+  EXPECT_EQ(program->ops[0].ftrace_offset, 4u);
+  EXPECT_EQ(program->ops[1].type, EventDecodeOp::kFixedCString);
+  EXPECT_EQ(program->ops[1].ftrace_offset, 8u);
+  EXPECT_EQ(program->ops[1].ftrace_size, 16u);
+  // prev_pid, field 2 of SchedSwitchFtraceEvent.
+  EXPECT_EQ(program->ops[2].type, EventDecodeOp::kPid32);
+  EXPECT_EQ(program->ops[2].preamble_size, 1u);
+  EXPECT_EQ(program->ops[2].preamble[0], 2u << 3);
+  EXPECT_EQ(program->ops[4].type, EventDecodeOp::kInt64);
+  EXPECT_EQ(program->ops[4].ftrace_offset, 32u);
+
+  // The tag of the SchedSwitchFtraceEvent message, field 4 of FtraceEvent.
+  EXPECT_EQ(program->preamble_size, 1u);
+  EXPECT_EQ(program->preamble[0], (4u << 3) | 2u);
+
+  // print ends with a string of unknown size.
+  EXPECT_EQ(table->GetDecodeProgram(
+                table->EventToFtraceId(GroupAndName("ftrace", "print"))),
+            nullptr);
+}
+
 TEST(TranslationTableTest, CompactSchedFormatParsingSeedData) {
   std::string path =
       "src/traced/probes/ftrace/test/data/android_seed_N2F62_3.10.49/";
@@ -477,6 +515,7 @@ print fmt: "some format")"));
   // Check getters
   EXPECT_EQ(static_cast<int>(table->GetEventById(42)->proto_field_id),
             protos::pbzero::FtraceEvent::kGenericFieldNumber);
+  EXPECT_EQ(table->GetDecodeProgram(42), nullptr);
   EXPECT_EQ(static_cast<int>(table->GetEvent(group_and_name)->proto_field_id),
             protos::pbzero::FtraceEvent::kGenericFieldNumber);
   EXPECT_EQ(table->GetEventsByGroup("group")->front()->name,
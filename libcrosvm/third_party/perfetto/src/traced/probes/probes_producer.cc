@@ -146,9 +146,15 @@ ProbesProducer::CreateDSInstance<FtraceDataSource>(
 
   PERFETTO_LOG("Ftrace setup (target_buf=%" PRIu32 ")", config.target_buffer());
   const BufferID buffer_id = static_cast<BufferID>(config.target_buffer());
+  // The writers of the additional reader threads must not stall: the main
+  // thread is blocked while they write, so it can't send the commits that
+  // would free up chunks of the shared memory buffer.
   std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
       ftrace_->GetWeakPtr(), session_id, std::move(ftrace_config),
-      endpoint_->CreateTraceWriter(buffer_id)));
+      endpoint_->CreateTraceWriter(buffer_id), [this, buffer_id] {
+        return endpoint_->CreateTraceWriter(buffer_id,
+                                            BufferExhaustedPolicy::kDrop);
+      }));
   if (!ftrace_->AddDataSource(data_source.get())) {
     PERFETTO_ELOG("Failed to setup ftrace");
     return nullptr;
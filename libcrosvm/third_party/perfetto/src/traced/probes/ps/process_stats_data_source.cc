@@ -17,6 +17,7 @@
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
 #include <stdlib.h>
+#include <sys/resource.h>
 
 #include <algorithm>
 #include <utility>
@@ -30,6 +31,7 @@
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/tracing/core/data_source_config.h"
+#include "src/traced/probes/ps/procfs_scanner.h"
 
 #include "protos/perfetto/config/process_stats/process_stats_config.pbzero.h"
 #include "protos/perfetto/trace/ps/process_stats.pbzero.h"
@@ -50,6 +52,9 @@ namespace perfetto {
 
 namespace {
 
+constexpr uint32_t kMaxProcfsScanThreads = 8;
+constexpr size_t kMaxProcfsScanCachedPids = 1 << 16;
+
 int32_t ReadNextNumericDir(DIR* dirp) {
   while (struct dirent* dir_ent = readdir(dirp)) {
     if (dir_ent->d_type != DT_DIR)
@@ -69,6 +74,16 @@ inline uint32_t ToU32(const char* str) {
   return static_cast<uint32_t>(strtol(str, nullptr, 10));
 }
 
+// ProcfsScanner keeps two files open per process. Leave most of the fds to
+// the rest of traced_probes.
+size_t GetMaxProcfsScanCachedPids() {
+  struct rlimit rlim {};
+  if (getrlimit(RLIMIT_NOFILE, &rlim) != 0)
+    return 0;
+  return static_cast<size_t>(
+      std::min<rlim_t>(rlim.rlim_cur / 8, kMaxProcfsScanCachedPids));
+}
+
 }  // namespace
 
 // static
@@ -113,6 +128,13 @@ ProcessStatsDataSource::ProcessStatsDataSource(
     process_stats_cache_ttl_ticks_ =
         std::max(proc_stats_ttl_ms / poll_period_ms_, 1u);
   }
+
+  if (poll_period_ms_ > 0 && cfg.proc_stats_scan_threads() > 0) {
+    procfs_scanner_.reset(new ProcfsScanner(
+        "/proc",
+        std::min(cfg.proc_stats_scan_threads(), kMaxProcfsScanThreads),
+        GetMaxProcfsScanCachedPids()));
+  }
 }
 
 ProcessStatsDataSource::~ProcessStatsDataSource() = default;
@@ -424,6 +446,8 @@ void ProcessStatsDataSource::Tick(
   if (++thiz.cache_ticks_ == thiz.process_stats_cache_ttl_ticks_) {
     thiz.cache_ticks_ = 0;
     thiz.process_stats_cache_.clear();
+    if (thiz.procfs_scanner_)
+      thiz.procfs_scanner_->InvalidateContents();
   }
 }
 
@@ -434,6 +458,10 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
 
   CacheProcFsScanStartTimestamp();
   PERFETTO_METATRACE_SCOPED(TAG_PROC_POLLERS, PS_WRITE_ALL_PROCESS_STATS);
+  if (procfs_scanner_) {
+    WriteChangedProcessStats();
+    return;
+  }
   base::ScopedDir proc_dir = OpenProcDir();
   if (!proc_dir)
     return;
@@ -459,16 +487,7 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
       continue;
     }
 
-    std::string oom_score_adj = ReadProcPidFile(pid, "oom_score_adj");
-    if (!oom_score_adj.empty()) {
-      CachedProcessStats& cached = process_stats_cache_[pid];
-      auto counter = ToInt(oom_score_adj);
-      if (counter != cached.oom_score_adj) {
-        GetOrCreateStatsProcess(pid)->set_oom_score_adj(counter);
-        cached.oom_score_adj = counter;
-      }
-    }
-
+    WriteOomScoreAdj(pid, ReadProcPidFile(pid, "oom_score_adj"));
     pids.insert(pid);
   }
   FinalizeCurPacket();
@@ -478,6 +497,49 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
   WriteProcessTree(pids);
 }
 
+void ProcessStatsDataSource::WriteChangedProcessStats() {
+  // The processes whose status and oom_score_adj didn't change since the
+  // previous scan are not returned, as their counters would be deduplicated
+  // by |process_stats_cache_| anyway.
+  base::FlatSet<int32_t> pids;
+  for (const ProcfsScanner::Process& process : procfs_scanner_->Scan()) {
+    int32_t pid = process.pid;
+    cur_ps_stats_process_ = nullptr;
+
+    if (process.pid_reused) {
+      // Forget about the previous process, so that the counters and the
+      // long-term info of the new one are written.
+      process_stats_cache_.erase(pid);
+      seen_pids_.erase(pid);
+    }
+
+    if (process.status.empty())
+      continue;
+    if (!WriteMemCounters(pid, process.status)) {
+      // Very likely a kernel thread, see WriteAllProcessStats().
+      procfs_scanner_->IgnorePid(pid);
+      continue;
+    }
+    WriteOomScoreAdj(pid, process.oom_score_adj);
+    pids.insert(pid);
+  }
+  FinalizeCurPacket();
+  WriteProcessTree(pids);
+}
+
+void ProcessStatsDataSource::WriteOomScoreAdj(
+    int32_t pid,
+    const std::string& oom_score_adj) {
+  if (oom_score_adj.empty())
+    return;
+  CachedProcessStats& cached = process_stats_cache_[pid];
+  auto counter = ToInt(oom_score_adj);
+  if (counter != cached.oom_score_adj) {
+    GetOrCreateStatsProcess(pid)->set_oom_score_adj(counter);
+    cached.oom_score_adj = counter;
+  }
+}
+
 // Returns true if the stats for the given |pid| have been written, false it
 // it failed (e.g., |pid| was a kernel thread and, as such, didn't report any
 // memory counters).
@@ -603,6 +665,10 @@ void ProcessStatsDataSource::ClearIncrementalState() {
 
   cache_ticks_ = 0;
   process_stats_cache_.clear();
+  if (procfs_scanner_) {
+    procfs_scanner_->InvalidateContents();
+    procfs_scanner_->ClearIgnoredPids();
+  }
 
   // Set the relevant flag in the next packet.
   did_clear_incremental_state_ = true;
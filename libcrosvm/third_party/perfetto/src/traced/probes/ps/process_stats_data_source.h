@@ -39,6 +39,8 @@ namespace base {
 class TaskRunner;
 }
 
+class ProcfsScanner;
+
 namespace protos {
 namespace pbzero {
 class ProcessTree;
@@ -120,7 +122,9 @@ class ProcessStatsDataSource : public ProbesDataSource {
   // Functions for periodically sampling process stats/counters.
   static void Tick(base::WeakPtr<ProcessStatsDataSource>);
   void WriteAllProcessStats();
+  void WriteChangedProcessStats();
   bool WriteMemCounters(int32_t pid, const std::string& proc_status);
+  void WriteOomScoreAdj(int32_t pid, const std::string& oom_score_adj);
   bool ShouldWriteThreadStats(int32_t pid);
   void WriteThreadStats(int32_t pid, int32_t tid);
 
@@ -170,6 +174,10 @@ class ProcessStatsDataSource : public ProbesDataSource {
   uint32_t process_stats_cache_ttl_ticks_ = 0;
   std::unordered_map<int32_t, CachedProcessStats> process_stats_cache_;
 
+  // Set if ProcessStatsConfig.proc_stats_scan_threads > 0. Replaces the scan
+  // of /proc in WriteAllProcessStats().
+  std::unique_ptr<ProcfsScanner> procfs_scanner_;
+
   using TimeInStateCacheEntry = std::tuple</* tid */ int32_t,
                                            /* cpu_freq_index */ uint32_t,
                                            /* ticks */ uint64_t>;
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ps/procfs_scanner.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/hash.h"
+#include "perfetto/ext/base/string_splitter.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/thread_pool.h"
+#include "perfetto/ext/base/utils.h"
+
+namespace perfetto {
+
+namespace {
+
+// The number of consecutive processes read by a thread at a time.
+constexpr size_t kPidsPerBatch = 64;
+
+// Most status files are less than 2KB.
+constexpr size_t kInitialReadSize = 4096;
+
+int32_t ReadNextNumericDir(DIR* dirp) {
+  while (struct dirent* dir_ent = readdir(dirp)) {
+    if (dir_ent->d_type != DT_DIR)
+      continue;
+    auto int_value = base::CStringToInt32(dir_ent->d_name);
+    if (int_value)
+      return *int_value;
+  }
+  return 0;
+}
+
+// Reads the whole of |fd| from the beginning. procfs files are generated on
+// the first read at offset 0, so they are read with a single pread() into a
+// buffer large enough for them, to get a consistent snapshot.
+bool PreadAll(int fd, std::string* out) {
+  for (size_t size = kInitialReadSize;; size *= 2) {
+    out->resize(size);
+    ssize_t rsize = PERFETTO_EINTR(pread(fd, &(*out)[0], size, 0));
+    if (rsize < 0) {
+      out->clear();
+      return false;
+    }
+    if (static_cast<size_t>(rsize) < size) {
+      out->resize(static_cast<size_t>(rsize));
+      return true;
+    }
+  }
+}
+
+}  // namespace
+
+ProcfsScanner::ProcfsScanner(std::string root,
+                             uint32_t num_threads,
+                             size_t max_cached_pids)
+    : root_(std::move(root)), max_cached_pids_(max_cached_pids) {
+  // The calling thread reads too.
+  if (num_threads > 1)
+    pool_.reset(new base::ThreadPool(num_threads - 1, "procscan"));
+}
+
+ProcfsScanner::~ProcfsScanner() = default;
+
+std::vector<ProcfsScanner::Process> ProcfsScanner::Scan() {
+  base::ScopedDir proc_dir(opendir(root_.c_str()));
+  if (!proc_dir) {
+    PERFETTO_PLOG("Failed to opendir(%s)", root_.c_str());
+    return {};
+  }
+
+  // |entries_| is only modified on this thread, before and after the reads.
+  num_scans_++;
+  std::vector<std::pair<int32_t, PidEntry*>> work;
+  while (int32_t pid = ReadNextNumericDir(*proc_dir)) {
+    PidEntry* entry = &entries_[pid];
+    entry->last_scan = num_scans_;
+    if (entry->ignored)
+      continue;
+    if (!entry->cache_fds && num_cached_pids_ < max_cached_pids_) {
+      entry->cache_fds = true;
+      num_cached_pids_++;
+    }
+    work.emplace_back(pid, entry);
+  }
+
+  std::vector<Process> processes(work.size());
+  std::vector<ReadResult> results(work.size());
+  std::atomic<size_t> next_batch{0};
+  auto read_batches = [&](size_t) {
+    for (size_t begin = next_batch.fetch_add(1) * kPidsPerBatch;
+         begin < work.size();
+         begin = next_batch.fetch_add(1) * kPidsPerBatch) {
+      size_t end = std::min(begin + kPidsPerBatch, work.size());
+      for (size_t i = begin; i < end; i++)
+        results[i] = ReadProcess(work[i].first, work[i].second, &processes[i]);
+    }
+  };
+  if (pool_) {
+    pool_->RunParallel(pool_->num_threads() + 1, read_batches);
+  } else {
+    read_batches(0);
+  }
+
+  std::vector<Process> changed;
+  for (size_t i = 0; i < work.size(); i++) {
+    if (results[i] == ReadResult::kChanged) {
+      changed.emplace_back(std::move(processes[i]));
+    } else if (results[i] == ReadResult::kFailed) {
+      // Most likely the process exited after the listing.
+      work[i].second->last_scan = 0;
+    }
+  }
+
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.last_scan == num_scans_) {
+      ++it;
+      continue;
+    }
+    UncacheFds(&it->second);
+    it = entries_.erase(it);
+  }
+  return changed;
+}
+
+ProcfsScanner::ReadResult ProcfsScanner::ReadProcess(int32_t pid,
+                                                     PidEntry* entry,
+                                                     Process* out) {
+  out->pid = pid;
+  bool opened = false;
+  if (!entry->status_fd) {
+    if (!OpenFiles(pid, entry, out))
+      return ReadResult::kFailed;
+    opened = true;
+  }
+
+  bool read = PreadAll(*entry->status_fd, &out->status) &&
+              PreadAll(*entry->oom_score_adj_fd, &out->oom_score_adj);
+  if (!read && !opened) {
+    // The files of an exited process fail to read with ESRCH. As |pid| is
+    // still listed, it might have been reused by a new process.
+    if (OpenFiles(pid, entry, out)) {
+      read = PreadAll(*entry->status_fd, &out->status) &&
+             PreadAll(*entry->oom_score_adj_fd, &out->oom_score_adj);
+    }
+  }
+  if (!entry->cache_fds) {
+    entry->status_fd.reset();
+    entry->oom_score_adj_fd.reset();
+  }
+  if (!read)
+    return ReadResult::kFailed;
+
+  uint64_t status_hash = base::Hasher::Combine(out->status);
+  uint64_t oom_score_adj_hash = base::Hasher::Combine(out->oom_score_adj);
+  if (entry->has_contents && status_hash == entry->status_hash &&
+      oom_score_adj_hash == entry->oom_score_adj_hash) {
+    return ReadResult::kUnchanged;
+  }
+  entry->has_contents = true;
+  entry->status_hash = status_hash;
+  entry->oom_score_adj_hash = oom_score_adj_hash;
+  return ReadResult::kChanged;
+}
+
+bool ProcfsScanner::OpenFiles(int32_t pid, PidEntry* entry, Process* out) {
+  uint64_t start_time = 0;
+  if (!ReadStartTime(pid, &start_time))
+    return false;
+  entry->status_fd = OpenPidFile(pid, "status");
+  entry->oom_score_adj_fd = OpenPidFile(pid, "oom_score_adj");
+  if (!entry->status_fd || !entry->oom_score_adj_fd)
+    return false;
+  if (entry->has_start_time && entry->start_time != start_time) {
+    out->pid_reused = true;
+    entry->has_contents = false;
+  }
+  entry->start_time = start_time;
+  entry->has_start_time = true;
+  return true;
+}
+
+base::ScopedFile ProcfsScanner::OpenPidFile(int32_t pid, const char* file) {
+  base::StackString<256> path("%s/%" PRId32 "/%s", root_.c_str(), pid, file);
+  return base::OpenFile(path.c_str(), O_RDONLY);
+}
+
+bool ProcfsScanner::ReadStartTime(int32_t pid, uint64_t* start_time) {
+  base::ScopedFile fd = OpenPidFile(pid, "stat");
+  std::string stat;
+  if (!fd || !PreadAll(*fd, &stat))
+    return false;
+  // The command name (field 2) is in parentheses and can contain both spaces
+  // and parentheses, so the fields are counted from the last ')'.
+  size_t pos = stat.rfind(')');
+  if (pos == std::string::npos)
+    return false;
+  base::StringSplitter ss(stat.substr(pos + 1), ' ');
+  for (int field = 3; ss.Next(); field++) {
+    if (field != 22)
+      continue;
+    auto value = base::CStringToUInt64(ss.cur_token());
+    if (!value)
+      return false;
+    *start_time = *value;
+    return true;
+  }
+  return false;
+}
+
+void ProcfsScanner::IgnorePid(int32_t pid) {
+  auto it = entries_.find(pid);
+  if (it == entries_.end())
+    return;
+  it->second.ignored = true;
+  UncacheFds(&it->second);
+}
+
+void ProcfsScanner::ClearIgnoredPids() {
+  for (auto& it : entries_)
+    it.second.ignored = false;
+}
+
+void ProcfsScanner::InvalidateContents() {
+  for (auto& it : entries_)
+    it.second.has_contents = false;
+}
+
+void ProcfsScanner::UncacheFds(PidEntry* entry) {
+  entry->status_fd.reset();
+  entry->oom_score_adj_fd.reset();
+  if (entry->cache_fds) {
+    entry->cache_fds = false;
+    num_cached_pids_--;
+  }
+}
+
+}  // namespace perfetto
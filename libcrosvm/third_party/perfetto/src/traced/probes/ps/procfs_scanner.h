@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_PS_PROCFS_SCANNER_H_
+#define SRC_TRACED_PROBES_PS_PROCFS_SCANNER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "perfetto/ext/base/scoped_file.h"
+
+namespace perfetto {
+
+namespace base {
+class ThreadPool;
+}
+
+// Reads /proc/pid/status and /proc/pid/oom_score_adj of all the processes,
+// for the periodic polling of ProcessStatsDataSource. Compared to opening and
+// reading the files of each process on every poll:
+// - The files are kept open across scans and re-read with pread(), up to
+//   |max_cached_pids| processes.
+// - Only the processes whose files changed since the previous scan are
+//   returned, which spares the parsing of idle processes.
+// - The files are read on |num_threads| threads (the calling one included).
+//
+// The start time of each process (from /proc/pid/stat) is read when its files
+// are opened, to tell a process which exited and whose pid was reused from a
+// process which didn't change.
+//
+// Not thread-safe: Scan() must be called from one thread at a time.
+class ProcfsScanner {
+ public:
+  struct Process {
+    int32_t pid = 0;
+    // True if |pid| belonged to a different process in the previous scan.
+    bool pid_reused = false;
+    std::string status;
+    std::string oom_score_adj;
+  };
+
+  // |root| is the procfs mount point, "/proc" outside of tests.
+  ProcfsScanner(std::string root,
+                uint32_t num_threads,
+                size_t max_cached_pids);
+  ~ProcfsScanner();
+
+  ProcfsScanner(const ProcfsScanner&) = delete;
+  ProcfsScanner& operator=(const ProcfsScanner&) = delete;
+
+  // Returns the processes which are new or whose status or oom_score_adj
+  // changed since the previous scan, in the order of the procfs listing.
+  // The processes whose files can't be read (e.g. because they exited in the
+  // middle of the scan) are omitted.
+  std::vector<Process> Scan();
+
+  // Stops reading |pid| (e.g. a kernel thread with no memory counters) until
+  // it exits or ClearIgnoredPids() is called.
+  void IgnorePid(int32_t pid);
+  void ClearIgnoredPids();
+
+  // Makes the next scan return all the processes, as if they all changed.
+  void InvalidateContents();
+
+  size_t num_cached_pids() const { return num_cached_pids_; }
+
+ private:
+  struct PidEntry {
+    // Field 22 of /proc/pid/stat, in clock ticks since boot.
+    uint64_t start_time = 0;
+    bool has_start_time = false;
+    bool has_contents = false;
+    bool cache_fds = false;
+    bool ignored = false;
+    uint64_t last_scan = 0;
+    base::ScopedFile status_fd;
+    base::ScopedFile oom_score_adj_fd;
+    uint64_t status_hash = 0;
+    uint64_t oom_score_adj_hash = 0;
+  };
+
+  enum class ReadResult : uint8_t { kUnchanged, kChanged, kFailed };
+
+  // Reads the files of |pid| into |out|. Called concurrently for different
+  // entries.
+  ReadResult ReadProcess(int32_t pid, PidEntry*, Process* out);
+  bool OpenFiles(int32_t pid, PidEntry*, Process* out);
+  base::ScopedFile OpenPidFile(int32_t pid, const char* file);
+  bool ReadStartTime(int32_t pid, uint64_t* start_time);
+  void UncacheFds(PidEntry*);
+
+  const std::string root_;
+  const size_t max_cached_pids_;
+  std::unique_ptr<base::ThreadPool> pool_;
+  uint64_t num_scans_ = 0;
+  size_t num_cached_pids_ = 0;
+
+  std::unordered_map<int32_t, PidEntry> entries_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_PS_PROCFS_SCANNER_H_
@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ps/procfs_scanner.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::UnorderedElementsAreArray;
+
+// A fake /proc with the files read by ProcfsScanner.
+class FakeProcfs {
+ public:
+  FakeProcfs() : dir_(base::TempDir::Create()) {}
+
+  ~FakeProcfs() {
+    std::vector<int32_t> pids;
+    for (const auto& it : start_times_)
+      pids.push_back(it.first);
+    for (int32_t pid : pids)
+      RemoveProcess(pid);
+  }
+
+  const std::string& root() const { return dir_.path(); }
+
+  void AddProcess(int32_t pid, uint64_t start_time) {
+    base::Mkdir(PidPath(pid, nullptr));
+    // The command name can contain spaces and parentheses.
+    std::string stat = std::to_string(pid) + " (comm) x) S";
+    for (int field = 4; field < 22; field++)
+      stat += " 0";
+    stat += " " + std::to_string(start_time) + " 0 0\n";
+    WriteFile(pid, "stat", stat);
+    SetStatus(pid, "VmSize: 100 kB\n");
+    SetOomScoreAdj(pid, "0\n");
+    start_times_[pid] = start_time;
+  }
+
+  void RemoveProcess(int32_t pid) {
+    for (const char* file : {"stat", "status", "oom_score_adj"})
+      remove(PidPath(pid, file).c_str());
+    base::Rmdir(PidPath(pid, nullptr));
+    start_times_.erase(pid);
+  }
+
+  void SetStatus(int32_t pid, const std::string& status) {
+    WriteFile(pid, "status", status);
+  }
+
+  void SetOomScoreAdj(int32_t pid, const std::string& oom_score_adj) {
+    WriteFile(pid, "oom_score_adj", oom_score_adj);
+  }
+
+ private:
+  std::string PidPath(int32_t pid, const char* file) {
+    std::string path = dir_.path() + "/" + std::to_string(pid);
+    if (file)
+      path += std::string("/") + file;
+    return path;
+  }
+
+  void WriteFile(int32_t pid, const char* file, const std::string& contents) {
+    base::ScopedFile fd = base::OpenFile(PidPath(pid, file),
+                                         O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TRUE(fd);
+    ASSERT_EQ(base::WriteAll(*fd, contents.data(), contents.size()),
+              static_cast<ssize_t>(contents.size()));
+  }
+
+  base::TempDir dir_;
+  std::map<int32_t, uint64_t> start_times_;
+};
+
+std::vector<int32_t> GetPids(const std::vector<ProcfsScanner::Process>& v) {
+  std::vector<int32_t> pids;
+  for (const auto& process : v)
+    pids.push_back(process.pid);
+  return pids;
+}
+
+TEST(ProcfsScannerTest, ReadsNewProcesses) {
+  FakeProcfs procfs;
+  procfs.AddProcess(1, 10);
+  procfs.AddProcess(42, 20);
+  procfs.SetStatus(42, "VmSize: 4242 kB\n");
+  procfs.SetOomScoreAdj(42, "-800\n");
+
+  ProcfsScanner scanner(procfs.root(), /*num_threads=*/1,
+                        /*max_cached_pids=*/16);
+  std::vector<ProcfsScanner::Process> processes = scanner.Scan();
+  ASSERT_THAT(GetPids(processes), UnorderedElementsAreArray({1, 42}));
+  for (const auto& process : processes) {
+    EXPECT_FALSE(process.pid_reused);
+    if (process.pid == 42) {
+      EXPECT_EQ(process.status, "VmSize: 4242 kB\n");
+      EXPECT_EQ(process.oom_score_adj, "-800\n");
+    } else {
+      EXPECT_EQ(process.status, "VmSize: 100 kB\n");
+      EXPECT_EQ(process.oom_score_adj, "0\n");
+    }
+  }
+  EXPECT_EQ(scanner.num_cached_pids(), 2u);
+}
+
+TEST(ProcfsScannerTest, SkipsUnchangedProcesses) {
+  FakeProcfs procfs;
+  procfs.AddProcess(1, 10);
+  procfs.AddProcess(2, 10);
+  procfs.AddProcess(3, 10);
+
+  ProcfsScanner scanner(procfs.root(), 1, 16);
+  EXPECT_EQ(scanner.Scan().size(), 3u);
+  EXPECT_THAT(scanner.Scan(), IsEmpty());
+
+  procfs.SetStatus(2, "VmSize: 200 kB\n");
+  procfs.SetOomScoreAdj(3, "100\n");
+  std::vector<ProcfsScanner::Process> processes = scanner.Scan();
+  ASSERT_THAT(GetPids(processes), UnorderedElementsAreArray({2, 3}));
+  for (const auto& process : processes) {
+    if (process.pid == 2) {
+      EXPECT_EQ(process.status, "VmSize: 200 kB\n");
+    } else {
+      EXPECT_EQ(process.oom_score_adj, "100\n");
+    }
+  }
+  EXPECT_THAT(scanner.Scan(), IsEmpty());
+
+  scanner.InvalidateContents();
+  EXPECT_EQ(scanner.Scan().size(), 3u);
+  EXPECT_THAT(scanner.Scan(), IsEmpty());
+}
+
+TEST(ProcfsScannerTest, ExitedProcesses) {
+  FakeProcfs procfs;
+  procfs.AddProcess(1, 10);
+  procfs.AddProcess(2, 10);
+
+  ProcfsScanner scanner(procfs.root(), 1, 16);
+  EXPECT_EQ(scanner.Scan().size(), 2u);
+  EXPECT_EQ(scanner.num_cached_pids(), 2u);
+
+  procfs.RemoveProcess(2);
+  EXPECT_THAT(scanner.Scan(), IsEmpty());
+  EXPECT_EQ(scanner.num_cached_pids(), 1u);
+
+  // The pid was not listed in between, so it is a new process.
+  procfs.AddProcess(2, 10);
+  std::vector<ProcfsScanner::Process> processes = scanner.Scan();
+  ASSERT_THAT(GetPids(processes), ElementsAre(2));
+  EXPECT_FALSE(processes[0].pid_reused);
+}
+
+// Unlike in procfs, the files of a removed process can still be read through
+// the fds opened before, so this only covers the processes whose files are
+// not cached.
+TEST(ProcfsScannerTest, ReusedPid) {
+  FakeProcfs procfs;
+  procfs.AddProcess(1, 10);
+  procfs.AddProcess(2, 10);
+
+  ProcfsScanner scanner(procfs.root(), 1, /*max_cached_pids=*/0);
+  EXPECT_EQ(scanner.Scan().size(), 2u);
+  EXPECT_EQ(scanner.num_cached_pids(), 0u);
+
+  procfs.RemoveProcess(2);
+  procfs.AddProcess(2, 30);
+  std::vector<ProcfsScanner::Process> processes = scanner.Scan();
+  ASSERT_THAT(GetPids(processes), ElementsAre(2));
+  EXPECT_TRUE(processes[0].pid_reused);
+  EXPECT_EQ(processes[0].status, "VmSize: 100 kB\n");
+
+  EXPECT_THAT(scanner.Scan(), IsEmpty());
+}
+
+TEST(ProcfsScannerTest, IgnoredPids) {
+  FakeProcfs procfs;
+  procfs.AddProcess(1, 10);
+  procfs.AddProcess(2, 10);
+
+  ProcfsScanner scanner(procfs.root(), 1, 16);
+  EXPECT_EQ(scanner.Scan().size(), 2u);
+  scanner.IgnorePid(2);
+  EXPECT_EQ(scanner.num_cached_pids(), 1u);
+
+  procfs.SetStatus(2, "VmSize: 200 kB\n");
+  EXPECT_THAT(scanner.Scan(), IsEmpty());
+
+  scanner.ClearIgnoredPids();
+  std::vector<ProcfsScanner::Process> processes = scanner.Scan();
+  ASSERT_THAT(GetPids(processes), ElementsAre(2));
+  EXPECT_EQ(processes[0].status, "VmSize: 200 kB\n");
+  EXPECT_EQ(scanner.num_cached_pids(), 2u);
+}
+
+TEST(ProcfsScannerTest, ManyProcessesOnSeveralThreads) {
+  FakeProcfs procfs;
+  std::vector<int32_t> pids;
+  for (int32_t pid = 1; pid <= 500; pid++) {
+    procfs.AddProcess(pid, 10);
+    procfs.SetStatus(pid, "VmSize: " + std::to_string(pid) + " kB\n");
+    pids.push_back(pid);
+  }
+
+  // Only some of the processes keep their files open.
+  ProcfsScanner scanner(procfs.root(), /*num_threads=*/4,
+                        /*max_cached_pids=*/100);
+  std::vector<ProcfsScanner::Process> processes = scanner.Scan();
+  ASSERT_THAT(GetPids(processes), UnorderedElementsAreArray(pids));
+  for (const auto& process : processes) {
+    EXPECT_EQ(process.status,
+              "VmSize: " + std::to_string(process.pid) + " kB\n");
+  }
+  EXPECT_EQ(scanner.num_cached_pids(), 100u);
+
+  std::vector<int32_t> changed_pids;
+  for (int32_t pid = 3; pid <= 500; pid += 7) {
+    procfs.SetOomScoreAdj(pid, "1000\n");
+    changed_pids.push_back(pid);
+  }
+  processes = scanner.Scan();
+  ASSERT_THAT(GetPids(processes), UnorderedElementsAreArray(changed_pids));
+  for (const auto& process : processes)
+    EXPECT_EQ(process.oom_score_adj, "1000\n");
+  EXPECT_THAT(scanner.Scan(), IsEmpty());
+}
+
+}  // namespace
+}  // namespace perfetto
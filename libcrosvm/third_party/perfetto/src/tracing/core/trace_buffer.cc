@@ -16,9 +16,11 @@
 
 #include "src/tracing/core/trace_buffer.h"
 
+#include <algorithm>
 #include <limits>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/small_vector.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/shared_memory_abi.h"
 #include "perfetto/ext/tracing/core/trace_packet.h"
@@ -81,9 +83,9 @@ bool TraceBuffer::Initialize(size_t size) {
   stats_.set_buffer_size(size);
   max_chunk_size_ = std::min(size, ChunkRecord::kMaxSize);
   wptr_ = begin();
-  index_.clear();
-  last_chunk_id_written_.clear();
-  read_iter_ = GetReadIterForSequence(index_.end());
+  sequences_.clear();
+  sequences_by_key_.Clear();
+  read_iter_ = GetReadIterForSequence(sequences_.size());
   return true;
 }
 
@@ -144,9 +146,9 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // before receiving commit requests for them from the producer. Note that the
   // service may scrape and thus override chunks in arbitrary order since the
   // chunks aren't ordered in the SMB.
-  const auto it = index_.find(key);
-  if (PERFETTO_UNLIKELY(it != index_.end())) {
-    ChunkMeta* record_meta = &it->second;
+  ChunkSequence* seq = FindSequence(producer_id_trusted, writer_id);
+  ChunkMeta* record_meta = seq ? seq->Find(chunk_id) : nullptr;
+  if (PERFETTO_UNLIKELY(record_meta)) {
     ChunkRecord* prev = GetChunkRecordAt(begin() + record_meta->record_off);
 
     // Verify that the old chunk's metadata corresponds to the new one.
@@ -178,13 +180,10 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
     // chunk N after having read from chunk N+1, thereby violating sequential
     // read of packets. This shouldn't happen if the producer is well-behaved,
     // because it shouldn't start chunk N+1 before completing chunk N.
-    ChunkMeta::Key subsequent_key = key;
     static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
                   "ChunkID wraps");
-    subsequent_key.chunk_id++;
-    const auto subsequent_it = index_.find(subsequent_key);
-    if (subsequent_it != index_.end() &&
-        subsequent_it->second.num_fragments_read > 0) {
+    const ChunkMeta* subsequent_meta = seq->Find(chunk_id + 1);
+    if (subsequent_meta && subsequent_meta->num_fragments_read > 0) {
       stats_.set_abi_violations(stats_.abi_violations() + 1);
       PERFETTO_DCHECK(suppress_client_dchecks_for_testing_);
       return;
@@ -264,10 +263,13 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   stats_.set_bytes_written(stats_.bytes_written() + record_size);
 
   uint32_t chunk_off = GetOffset(GetChunkRecordAt(wptr_));
-  auto it_and_inserted = index_.emplace(
-      key, ChunkMeta(chunk_off, num_fragments, chunk_complete, chunk_flags,
-                     producer_uid_trusted, producer_pid_trusted));
-  PERFETTO_DCHECK(it_and_inserted.second);
+  if (PERFETTO_UNLIKELY(!seq))
+    seq = CreateSequence(producer_id_trusted, writer_id);
+  bool inserted = seq->Insert(
+      chunk_id, ChunkMeta(chunk_off, num_fragments, chunk_complete, chunk_flags,
+                          producer_uid_trusted, producer_pid_trusted));
+  PERFETTO_DCHECK(inserted);
+  base::ignore_result(inserted);
   TRACE_BUFFER_DLOG("  copying @ [%lu - %lu] %zu", wptr_ - begin(),
                     uintptr_t(wptr_ - begin()) + record_size, record_size);
   WriteChunkRecord(wptr_, record, src, size);
@@ -292,8 +294,7 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // last_chunk_id shouldn't be updated even though it's larger (e.g. |chunk_id|
   // = kMaxChunkId and |last_chunk_id| = 1; chunk_id - last_chunk_id =
   // kMaxChunkId - 1).
-  auto producer_and_writer_id = std::make_pair(producer_id_trusted, writer_id);
-  ChunkID& last_chunk_id = last_chunk_id_written_[producer_and_writer_id];
+  ChunkID& last_chunk_id = seq->last_chunk_id_written;
   static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
                 "This code assumes that ChunkID wraps at kMaxChunkID");
   if (chunk_id - last_chunk_id < kMaxChunkID / 2) {
@@ -318,7 +319,8 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
   TRACE_BUFFER_DLOG("Delete [%zu %zu]", wptr_ - begin(), search_end - begin());
   DcheckIsAlignedAndWithinBounds(wptr_);
   PERFETTO_DCHECK(search_end <= end());
-  std::vector<ChunkMap::iterator> index_delete;
+  // Writing a chunk overwrites only a handful of chunks, usually just one.
+  base::SmallVector<std::pair<ChunkSequence*, ChunkID>, 8> index_delete;
   uint64_t chunks_overwritten = stats_.chunks_overwritten();
   uint64_t bytes_overwritten = stats_.bytes_overwritten();
   uint64_t padding_bytes_cleared = stats_.padding_bytes_cleared();
@@ -344,17 +346,17 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
     // records are not part of the index).
     if (PERFETTO_LIKELY(!next_chunk.is_padding)) {
       ChunkMeta::Key key(next_chunk);
-      auto it = index_.find(key);
+      ChunkSequence* seq = FindSequence(key.producer_id, key.writer_id);
+      const ChunkMeta* meta = seq ? seq->Find(key.chunk_id) : nullptr;
       bool will_remove = false;
-      if (PERFETTO_LIKELY(it != index_.end())) {
-        const ChunkMeta& meta = it->second;
-        if (PERFETTO_UNLIKELY(meta.num_fragments_read < meta.num_fragments)) {
+      if (PERFETTO_LIKELY(meta)) {
+        if (PERFETTO_UNLIKELY(meta->num_fragments_read < meta->num_fragments)) {
           if (overwrite_policy_ == kDiscard)
             return -1;
           chunks_overwritten++;
           bytes_overwritten += next_chunk.size;
         }
-        index_delete.push_back(it);
+        index_delete.emplace_back(seq, key.chunk_id);
         will_remove = true;
       }
       TRACE_BUFFER_DLOG(
@@ -377,8 +379,10 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
   }
 
   // Remove from the index.
-  for (auto it : index_delete) {
-    index_.erase(it);
+  for (const auto& seq_and_chunk_id : index_delete) {
+    bool erased = seq_and_chunk_id.first->Erase(seq_and_chunk_id.second);
+    PERFETTO_DCHECK(erased);
+    base::ignore_result(erased);
   }
   stats_.set_chunks_overwritten(chunks_overwritten);
   stats_.set_bytes_overwritten(bytes_overwritten);
@@ -406,19 +410,20 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
                                         size_t patches_size,
                                         bool other_patches_pending) {
   PERFETTO_CHECK(!read_only_);
-  ChunkMeta::Key key(producer_id, writer_id, chunk_id);
-  auto it = index_.find(key);
-  if (it == index_.end()) {
+  ChunkSequence* seq = FindSequence(producer_id, writer_id);
+  ChunkMeta* chunk_meta_ptr = seq ? seq->Find(chunk_id) : nullptr;
+  if (!chunk_meta_ptr) {
     stats_.set_patches_failed(stats_.patches_failed() + 1);
     return false;
   }
-  ChunkMeta& chunk_meta = it->second;
+  ChunkMeta& chunk_meta = *chunk_meta_ptr;
 
   // Check that the index is consistent with the actual ProducerID/WriterID
   // stored in the ChunkRecord.
 
   ChunkRecord* chunk_record = GetChunkRecordAt(begin() + chunk_meta.record_off);
-  PERFETTO_DCHECK(ChunkMeta::Key(*chunk_record) == key);
+  PERFETTO_DCHECK(ChunkMeta::Key(*chunk_record) ==
+                  ChunkMeta::Key(producer_id, writer_id, chunk_id));
   uint8_t* chunk_begin = reinterpret_cast<uint8_t*>(chunk_record);
   PERFETTO_DCHECK(chunk_begin >= begin());
   uint8_t* chunk_end = chunk_begin + chunk_record->size;
@@ -459,49 +464,29 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
 }
 
 void TraceBuffer::BeginRead() {
-  read_iter_ = GetReadIterForSequence(index_.begin());
+  read_iter_ = GetReadIterForSequence(0);
 #if PERFETTO_DCHECK_IS_ON()
   changed_since_last_read_ = false;
 #endif
 }
 
 TraceBuffer::SequenceIterator TraceBuffer::GetReadIterForSequence(
-    ChunkMap::iterator seq_begin) {
+    size_t seq_idx) {
   SequenceIterator iter;
-  iter.seq_begin = seq_begin;
-  if (seq_begin == index_.end()) {
-    iter.cur = iter.seq_end = index_.end();
+  iter.seq_idx = seq_idx;
+  if (seq_idx >= sequences_.size())
     return iter;
-  }
-
-#if PERFETTO_DCHECK_IS_ON()
-  // Either |seq_begin| is == index_.begin() or the item immediately before must
-  // belong to a different {ProducerID, WriterID} sequence.
-  if (seq_begin != index_.begin() && seq_begin != index_.end()) {
-    auto prev_it = seq_begin;
-    prev_it--;
-    PERFETTO_DCHECK(
-        seq_begin == index_.begin() ||
-        std::tie(prev_it->first.producer_id, prev_it->first.writer_id) <
-            std::tie(seq_begin->first.producer_id, seq_begin->first.writer_id));
-  }
-#endif
 
-  // Find the first entry that has a greater {ProducerID, WriterID} (or just
-  // index_.end() if we reached the end).
-  ChunkMeta::Key key = seq_begin->first;  // Deliberate copy.
-  key.chunk_id = kMaxChunkID;
-  iter.seq_end = index_.upper_bound(key);
-  PERFETTO_DCHECK(iter.seq_begin != iter.seq_end);
+  ChunkSequence* seq = sequences_[seq_idx].get();
+  iter.seq = seq;
+  iter.seq_begin = seq->first;
+  iter.seq_end = seq->entries.size();
 
   // Now find the first entry between [seq_begin, seq_end) that is
-  // > last_chunk_id_written_. This is where we the sequence will start (see
+  // > last_chunk_id_written. This is where we the sequence will start (see
   // notes about wrapping of IDs in the header).
-  auto producer_and_writer_id = std::make_pair(key.producer_id, key.writer_id);
-  PERFETTO_DCHECK(last_chunk_id_written_.count(producer_and_writer_id));
-  iter.wrapping_id = last_chunk_id_written_[producer_and_writer_id];
-  key.chunk_id = iter.wrapping_id;
-  iter.cur = index_.upper_bound(key);
+  iter.wrapping_id = seq->last_chunk_id_written;
+  iter.cur = seq->UpperBound(iter.wrapping_id);
   if (iter.cur == iter.seq_end)
     iter.cur = iter.seq_begin;
   return iter;
@@ -510,29 +495,120 @@ TraceBuffer::SequenceIterator TraceBuffer::GetReadIterForSequence(
 void TraceBuffer::SequenceIterator::MoveNext() {
   // Stop iterating when we reach the end of the sequence.
   // Note: |seq_begin| might be == |seq_end|.
-  if (cur == seq_end || cur->first.chunk_id == wrapping_id) {
+  if (cur == seq_end || chunk_id() == wrapping_id) {
     cur = seq_end;
     return;
   }
 
   // If the current chunk wasn't completed yet, we shouldn't advance past it as
   // it may be rewritten with additional packets.
-  if (!cur->second.is_complete()) {
+  if (!seq->entries[cur].meta.is_complete()) {
     cur = seq_end;
     return;
   }
 
-  ChunkID last_chunk_id = cur->first.chunk_id;
+  ChunkID last_chunk_id = chunk_id();
   if (++cur == seq_end)
     cur = seq_begin;
 
   // There may be a missing chunk in the sequence of chunks, in which case the
   // next chunk's ID won't follow the last one's. If so, skip the rest of the
   // sequence. We'll return to it later once the hole is filled.
-  if (last_chunk_id + 1 != cur->first.chunk_id)
+  if (last_chunk_id + 1 != chunk_id())
     cur = seq_end;
 }
 
+size_t TraceBuffer::ChunkSequence::LowerBound(ChunkID chunk_id) const {
+  // Fast paths for the common cases of looking up a new chunk and the oldest
+  // one (when it's about to be overwritten).
+  if (empty() || chunk_id > entries.back().chunk_id)
+    return entries.size();
+  if (chunk_id <= entries[first].chunk_id)
+    return first;
+  auto it = std::lower_bound(
+      entries.begin() + static_cast<ptrdiff_t>(first), entries.end(), chunk_id,
+      [](const Entry& entry, ChunkID id) { return entry.chunk_id < id; });
+  return static_cast<size_t>(it - entries.begin());
+}
+
+size_t TraceBuffer::ChunkSequence::UpperBound(ChunkID chunk_id) const {
+  if (empty() || chunk_id >= entries.back().chunk_id)
+    return entries.size();
+  if (chunk_id < entries[first].chunk_id)
+    return first;
+  auto it = std::upper_bound(
+      entries.begin() + static_cast<ptrdiff_t>(first), entries.end(), chunk_id,
+      [](ChunkID id, const Entry& entry) { return id < entry.chunk_id; });
+  return static_cast<size_t>(it - entries.begin());
+}
+
+TraceBuffer::ChunkMeta* TraceBuffer::ChunkSequence::Find(ChunkID chunk_id) {
+  size_t pos = LowerBound(chunk_id);
+  if (pos == entries.size() || entries[pos].chunk_id != chunk_id)
+    return nullptr;
+  return &entries[pos].meta;
+}
+
+bool TraceBuffer::ChunkSequence::Insert(ChunkID chunk_id,
+                                        const ChunkMeta& meta) {
+  if (empty() || chunk_id > entries.back().chunk_id) {
+    entries.push_back(Entry{chunk_id, meta});
+    return true;
+  }
+  size_t pos = LowerBound(chunk_id);
+  if (entries[pos].chunk_id == chunk_id)
+    return false;
+  // A chunk older than all the others can reuse a slot of the deleted ones.
+  if (pos == first && first > 0) {
+    entries[--first] = Entry{chunk_id, meta};
+    return true;
+  }
+  entries.insert(entries.begin() + static_cast<ptrdiff_t>(pos),
+                 Entry{chunk_id, meta});
+  return true;
+}
+
+bool TraceBuffer::ChunkSequence::Erase(ChunkID chunk_id) {
+  if (empty())
+    return false;
+  size_t pos = first;
+  if (entries[pos].chunk_id != chunk_id) {
+    pos = LowerBound(chunk_id);
+    if (pos == entries.size() || entries[pos].chunk_id != chunk_id)
+      return false;
+  }
+  if (pos != first) {
+    entries.erase(entries.begin() + static_cast<ptrdiff_t>(pos));
+    return true;
+  }
+  first++;
+  if (empty()) {
+    entries.clear();
+    first = 0;
+  } else if (first * 2 >= entries.size()) {
+    entries.erase(entries.begin(),
+                  entries.begin() + static_cast<ptrdiff_t>(first));
+    first = 0;
+  }
+  return true;
+}
+
+TraceBuffer::ChunkSequence* TraceBuffer::CreateSequence(ProducerID producer_id,
+                                                        WriterID writer_id) {
+  PERFETTO_DCHECK(!FindSequence(producer_id, writer_id));
+  const uint32_t key = SequenceKey(producer_id, writer_id);
+  auto it = std::upper_bound(
+      sequences_.begin(), sequences_.end(), key,
+      [](uint32_t k, const std::unique_ptr<ChunkSequence>& seq) {
+        return k < SequenceKey(seq->producer_id, seq->writer_id);
+      });
+  it = sequences_.emplace(
+      it, std::unique_ptr<ChunkSequence>(
+              new ChunkSequence(producer_id, writer_id)));
+  sequences_by_key_.Insert(key, it->get());
+  return it->get();
+}
+
 bool TraceBuffer::ReadNextTracePacket(
     TracePacket* packet,
     PacketSequenceProperties* sequence_properties,
@@ -560,16 +636,15 @@ bool TraceBuffer::ReadNextTracePacket(
   for (;; read_iter_.MoveNext()) {
     if (PERFETTO_UNLIKELY(!read_iter_.is_valid())) {
       // We ran out of chunks in the current {ProducerID, WriterID} sequence or
-      // we just reached the index_.end().
-
-      if (PERFETTO_UNLIKELY(read_iter_.seq_end == index_.end()))
-        return false;
-
-      // We reached the end of sequence, move to the next one.
-      // Note: ++read_iter_.seq_end might become index_.end(), but
-      // GetReadIterForSequence() knows how to deal with that.
-      read_iter_ = GetReadIterForSequence(read_iter_.seq_end);
-      PERFETTO_DCHECK(read_iter_.is_valid() && read_iter_.cur != index_.end());
+      // we just reached the end of the index.
+
+      // We reached the end of sequence, move to the next one that has chunks.
+      // Sequences without chunks are kept in the index, see |sequences_|.
+      do {
+        if (PERFETTO_UNLIKELY(read_iter_.seq_idx + 1 >= sequences_.size()))
+          return false;
+        read_iter_ = GetReadIterForSequence(read_iter_.seq_idx + 1);
+      } while (!read_iter_.is_valid());
       previous_packet_dropped = true;
     }
 
@@ -911,7 +986,6 @@ TraceBuffer::TraceBuffer(CloneCtor, const TraceBuffer& src)
 
   data_.EnsureCommitted(data_.size());
   memcpy(data_.Get(), src.data_.Get(), src.data_.size());
-  last_chunk_id_written_ = src.last_chunk_id_written_;
 
   stats_ = src.stats_;
   stats_.set_bytes_read(0);
@@ -920,12 +994,18 @@ TraceBuffer::TraceBuffer(CloneCtor, const TraceBuffer& src)
   stats_.set_readaheads_succeeded(0);
 
   // Copy the index of chunk metadata and reset the read states.
-  index_ = ChunkMap(src.index_);
-  for (auto& kv : index_) {
-    ChunkMeta& chunk_meta = kv.second;
-    chunk_meta.num_fragments_read = 0;
-    chunk_meta.cur_fragment_offset = 0;
-    chunk_meta.set_last_read_packet_skipped(false);
+  sequences_.reserve(src.sequences_.size());
+  for (const auto& src_seq : src.sequences_) {
+    std::unique_ptr<ChunkSequence> seq(new ChunkSequence(*src_seq));
+    for (ChunkSequence::Entry& entry : seq->entries) {
+      ChunkMeta& chunk_meta = entry.meta;
+      chunk_meta.num_fragments_read = 0;
+      chunk_meta.cur_fragment_offset = 0;
+      chunk_meta.set_last_read_packet_skipped(false);
+    }
+    sequences_by_key_.Insert(SequenceKey(seq->producer_id, seq->writer_id),
+                             seq.get());
+    sequences_.emplace_back(std::move(seq));
   }
   read_iter_ = SequenceIterator();
 }
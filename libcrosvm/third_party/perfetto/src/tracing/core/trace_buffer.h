@@ -22,10 +22,12 @@
 
 #include <array>
 #include <limits>
-#include <map>
+#include <memory>
 #include <tuple>
+#include <vector>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/thread_annotations.h"
 #include "perfetto/ext/base/utils.h"
@@ -110,8 +112,8 @@ class TracePacket;
 // quite useful in future to recover the buffer from crash reports).
 //
 // However, in order to keep some operations (patching and reading) fast, a
-// lookaside index is maintained (in |index_|), keeping each chunk in the buffer
-// indexed by their {ProducerID, WriterID, ChunkID} tuple.
+// lookaside index is maintained (in |sequences_|), keeping each chunk in the
+// buffer indexed by their {ProducerID, WriterID, ChunkID} tuple.
 //
 // Patching data out-of-band
 // -------------------------
@@ -341,7 +343,7 @@ class TraceBuffer {
   // This struct should not have any field that is essential for reconstructing
   // the contents of the buffer from a crash dump.
   struct ChunkMeta {
-    // Key used for sorting in the map.
+    // Identifies a chunk in the index.
     struct Key {
       Key(ProducerID p, WriterID w, ChunkID c)
           : producer_id{p}, writer_id{w}, chunk_id{c} {}
@@ -404,6 +406,7 @@ class TraceBuffer {
     }
 
     ChunkMeta(const ChunkMeta&) noexcept = default;
+    ChunkMeta& operator=(const ChunkMeta&) noexcept = default;
 
     bool is_complete() const { return index_flags & kComplete; }
 
@@ -427,9 +430,11 @@ class TraceBuffer {
       }
     }
 
-    const uint32_t record_off;  // Offset of ChunkRecord within |data_|.
-    const uid_t trusted_uid;    // uid of the producer.
-    const pid_t trusted_pid;    // pid of the producer.
+    // These are not const only to allow moving the entries within
+    // ChunkSequence::entries, they never change after the chunk is copied.
+    uint32_t record_off;  // Offset of ChunkRecord within |data_|.
+    uid_t trusted_uid;    // uid of the producer.
+    pid_t trusted_pid;    // pid of the producer.
 
     // Flags set by TraceBuffer to track the state of the chunk in the index.
     uint8_t index_flags = 0;
@@ -450,12 +455,58 @@ class TraceBuffer {
     uint16_t cur_fragment_offset = 0;
   };
 
-  using ChunkMap = std::map<ChunkMeta::Key, ChunkMeta>;
+  // The index entries of all the chunks of a {ProducerID, WriterID} sequence,
+  // sorted by ChunkID. As for ChunkMeta::Key, the sorting doesn't take into
+  // account the wrapping of ChunkID, SequenceIterator deals with that.
+  // Writers allocate ChunkIDs incrementally and chunks are overwritten in the
+  // same order they are written. Hence, almost always, new entries are
+  // appended at the back of |entries| and deleted entries are at the front.
+  // Deleting the front entry just advances |first|: the slots before it are
+  // reclaimed in bulk once they make up half of |entries|. This keeps both
+  // operations amortized O(1), while lookups are a binary search over a
+  // contiguous array.
+  struct ChunkSequence {
+    struct Entry {
+      ChunkID chunk_id;
+      ChunkMeta meta;
+    };
+
+    ChunkSequence(ProducerID p, WriterID w) : producer_id(p), writer_id(w) {}
+
+    bool empty() const { return first == entries.size(); }
+
+    // Return the position in |entries| of the first entry with a ChunkID
+    // >= (LowerBound) or > (UpperBound) |chunk_id|, or entries.size().
+    size_t LowerBound(ChunkID chunk_id) const;
+    size_t UpperBound(ChunkID chunk_id) const;
+
+    // Returns nullptr if there is no entry for |chunk_id|.
+    ChunkMeta* Find(ChunkID chunk_id);
+
+    // Returns false, without changing the index, if an entry for |chunk_id|
+    // exists already.
+    bool Insert(ChunkID chunk_id, const ChunkMeta& meta);
+
+    // Returns false if there is no entry for |chunk_id|.
+    bool Erase(ChunkID chunk_id);
+
+    ProducerID producer_id;
+    WriterID writer_id;
+
+    // Keeps track of the highest ChunkID written for the sequence, taking into
+    // account a potential overflow of ChunkIDs. In the case of overflow, stores
+    // the highest ChunkID written since the overflow.
+    ChunkID last_chunk_id_written = 0;
+
+    // Only the entries in [|first|, entries.size()) are valid.
+    std::vector<Entry> entries;
+    size_t first = 0;
+  };
 
-  // Allows to iterate over a sub-sequence of |index_| for all keys belonging to
-  // the same {ProducerID,WriterID}. Furthermore takes into account the wrapping
-  // of ChunkID. Instances are valid only as long as the |index_| is not altered
-  // (can be used safely only between adjacent ReadNextTracePacket() calls).
+  // Allows to iterate over the chunks of a ChunkSequence, taking into account
+  // the wrapping of ChunkID. Instances are valid only as long as the index is
+  // not altered (can be used safely only between adjacent
+  // ReadNextTracePacket() calls).
   // The order of the iteration will proceed in the following order:
   // |wrapping_id| + 1 -> |seq_end|, |seq_begin| -> |wrapping_id|.
   // Practical example:
@@ -466,41 +517,50 @@ class TraceBuffer {
   //   through a CopyChunkUntrusted()).
   // The resulting iteration order will be: c5, c6, c7, c0, c1, c2, c3, c4.
   struct SequenceIterator {
-    // Points to the 1st key (the one with the numerically min ChunkID).
-    ChunkMap::iterator seq_begin;
+    // The sequence being iterated. nullptr past the last sequence.
+    ChunkSequence* seq = nullptr;
+
+    // Position of |seq| in |sequences_|.
+    size_t seq_idx = 0;
+
+    // The positions below are indexes in |seq->entries|.
 
-    // Points one past the last key (the one with the numerically max ChunkID).
-    ChunkMap::iterator seq_end;
+    // Points to the 1st entry (the one with the numerically min ChunkID).
+    size_t seq_begin = 0;
 
-    // Current iterator, always >= seq_begin && <= seq_end.
-    ChunkMap::iterator cur;
+    // Points one past the last entry (the one with the numerically max
+    // ChunkID).
+    size_t seq_end = 0;
+
+    // Current position, always >= seq_begin && <= seq_end.
+    size_t cur = 0;
 
     // The latest ChunkID written. Determines the start/end of the sequence.
-    ChunkID wrapping_id;
+    ChunkID wrapping_id = 0;
 
     bool is_valid() const { return cur != seq_end; }
 
     ProducerID producer_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.producer_id;
+      return seq->producer_id;
     }
 
     WriterID writer_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.writer_id;
+      return seq->writer_id;
     }
 
     ChunkID chunk_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.chunk_id;
+      return seq->entries[cur].chunk_id;
     }
 
     ChunkMeta& operator*() {
       PERFETTO_DCHECK(is_valid());
-      return cur->second;
+      return seq->entries[cur].meta;
     }
 
-    // Moves |cur| to the next chunk in the index.
+    // Moves |cur| to the next chunk in the sequence.
     // is_valid() will become false after calling this, if this was the last
     // entry of the sequence.
     void MoveNext();
@@ -531,14 +591,29 @@ class TraceBuffer {
 
   bool Initialize(size_t size);
 
-  // Returns an object that allows to iterate over chunks in the |index_| that
-  // have the same {ProducerID, WriterID} of
-  // |seq_begin.first.{producer,writer}_id|. |seq_begin| must be an iterator to
-  // the first entry in the |index_| that has a different {ProducerID, WriterID}
-  // from the previous one. It is valid for |seq_begin| to be == index_.end()
-  // (i.e. if the index is empty). The iteration takes care of ChunkID wrapping,
-  // by using |last_chunk_id_|.
-  SequenceIterator GetReadIterForSequence(ChunkMap::iterator seq_begin);
+  // Returns an object that allows to iterate over the chunks of
+  // |sequences_[seq_idx]|. It is valid for |seq_idx| to be >=
+  // sequences_.size(), in which case the returned iterator is not valid. The
+  // iteration takes care of ChunkID wrapping, by using
+  // |ChunkSequence::last_chunk_id_written|.
+  SequenceIterator GetReadIterForSequence(size_t seq_idx);
+
+  // Packs {ProducerID, WriterID} into the key of |sequences_by_key_|.
+  static uint32_t SequenceKey(ProducerID producer_id, WriterID writer_id) {
+    static_assert(sizeof(ProducerID) + sizeof(WriterID) <= sizeof(uint32_t),
+                  "SequenceKey() must fit both IDs");
+    return (static_cast<uint32_t>(producer_id) << 16) | writer_id;
+  }
+
+  // Returns nullptr if no chunk has ever been copied for the sequence.
+  ChunkSequence* FindSequence(ProducerID producer_id, WriterID writer_id) {
+    ChunkSequence** seq =
+        sequences_by_key_.Find(SequenceKey(producer_id, writer_id));
+    return seq ? *seq : nullptr;
+  }
+
+  // Adds a new, empty sequence to the index.
+  ChunkSequence* CreateSequence(ProducerID, WriterID);
 
   // Used as a last resort when a buffer corruption is detected.
   void ClearContentsAndResetRWCursors();
@@ -659,11 +734,21 @@ class TraceBuffer {
   uint8_t* wptr_ = nullptr;    // Write pointer.
 
   // An index that keeps track of the positions and metadata of each
-  // ChunkRecord.
-  ChunkMap index_;
+  // ChunkRecord, split by sequence and sorted by {ProducerID, WriterID}.
+  // Sequences are kept after all their chunks have been deleted, to remember
+  // their |last_chunk_id_written|.
+  //
+  // TODO(primiano): should clean up sequences from the index. Right now it
+  // grows without bounds (although realistically is not a problem unless we
+  // have too many producers/writers within the same trace session).
+  std::vector<std::unique_ptr<ChunkSequence>> sequences_;
+
+  // Maps SequenceKey() to the entries of |sequences_|, to avoid a binary search
+  // over the sequences for each chunk.
+  base::FlatHashMap<uint32_t, ChunkSequence*> sequences_by_key_;
 
   // Read iterator used for ReadNext(). It is reset by calling BeginRead().
-  // It becomes invalid after any call to methods that alters the |index_|.
+  // It becomes invalid after any call to methods that alters the index.
   SequenceIterator read_iter_;
 
   // See comments at the top of the file.
@@ -677,15 +762,6 @@ class TraceBuffer {
   // a write fails because it would overwrite unread chunks.
   bool discard_writes_ = false;
 
-  // Keeps track of the highest ChunkID written for a given sequence, taking
-  // into account a potential overflow of ChunkIDs. In the case of overflow,
-  // stores the highest ChunkID written since the overflow.
-  //
-  // TODO(primiano): should clean up keys from this map. Right now it grows
-  // without bounds (although realistically is not a problem unless we have too
-  // many producers/writers within the same trace session).
-  std::map<std::pair<ProducerID, WriterID>, ChunkID> last_chunk_id_written_;
-
   // Statistics about buffer usage.
   TraceStats::BufferStats stats_;
 
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/tracing/core/basic_types.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "src/tracing/core/trace_buffer.h"
+
+namespace {
+
+using namespace perfetto;
+
+// A 4KB chunk, minus the ChunkRecord header, holding 8 packets.
+constexpr size_t kChunkPayloadSize = 4096 - 16;
+constexpr uint16_t kPacketsPerChunk = 8;
+constexpr size_t kPacketSize = kChunkPayloadSize / kPacketsPerChunk;
+
+// The number of chunks committed between two ReadBuffers() of the service.
+constexpr size_t kChunksPerRead = 1024;
+
+// Writers are spread across producers, as it happens with multi-threaded
+// producers.
+constexpr size_t kWritersPerProducer = 64;
+
+std::vector<uint8_t> CreateChunkPayload() {
+  std::vector<uint8_t> payload(kChunkPayloadSize, 0x42);
+  for (size_t i = 0; i < kPacketsPerChunk; i++) {
+    protozero::proto_utils::WriteRedundantVarInt(
+        static_cast<uint32_t>(kPacketSize -
+                              protozero::proto_utils::kMessageLengthFieldSize),
+        &payload[i * kPacketSize]);
+  }
+  return payload;
+}
+
+// Simulates |num_writers| writers committing chunks in random order into a
+// 32MB buffer, with a readout every kChunksPerRead chunks. A few of the chunks
+// are also patched out-of-band after being committed.
+static void BM_TraceBuffer_WriteRead(benchmark::State& state) {
+  const size_t num_writers = static_cast<size_t>(state.range(0));
+  std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(32 * 1024 * 1024);
+  PERFETTO_CHECK(buf);
+  const std::vector<uint8_t> payload = CreateChunkPayload();
+  std::vector<ChunkID> next_chunk_id(num_writers);
+  std::minstd_rand0 rnd(0);
+
+  TraceBuffer::Patch patch{};
+  protozero::proto_utils::WriteRedundantVarInt(
+      static_cast<uint32_t>(kPacketSize -
+                            protozero::proto_utils::kMessageLengthFieldSize),
+      patch.data.data());
+
+  uint64_t packets_read = 0;
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < kChunksPerRead; i++) {
+      size_t writer = rnd() % num_writers;
+      ProducerID producer_id =
+          static_cast<ProducerID>(1 + writer / kWritersPerProducer);
+      WriterID writer_id =
+          static_cast<WriterID>(1 + writer % kWritersPerProducer);
+      ChunkID chunk_id = next_chunk_id[writer]++;
+      buf->CopyChunkUntrusted(producer_id, /*producer_uid_trusted=*/0,
+                              /*producer_pid_trusted=*/0, writer_id, chunk_id,
+                              kPacketsPerChunk, /*chunk_flags=*/0,
+                              /*chunk_complete=*/true, payload.data(),
+                              payload.size());
+      if (i % 8 == 0) {
+        buf->TryPatchChunkContents(producer_id, writer_id, chunk_id, &patch, 1,
+                                   /*other_patches_pending=*/false);
+      }
+    }
+
+    buf->BeginRead();
+    TracePacket packet;
+    TraceBuffer::PacketSequenceProperties sequence_properties{};
+    bool previous_packet_dropped = false;
+    while (buf->ReadNextTracePacket(&packet, &sequence_properties,
+                                    &previous_packet_dropped)) {
+      packets_read++;
+      packet = TracePacket();
+    }
+  }
+  PERFETTO_CHECK(packets_read ==
+                 state.iterations() * kChunksPerRead * kPacketsPerChunk);
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * kChunksPerRead));
+  state.SetBytesProcessed(static_cast<int64_t>(
+      state.iterations() * kChunksPerRead * kChunkPayloadSize));
+}
+
+}  // namespace
+
+BENCHMARK(BM_TraceBuffer_WriteRead)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(256)
+    ->Arg(4096);
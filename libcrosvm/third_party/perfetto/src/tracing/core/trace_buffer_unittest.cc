@@ -16,6 +16,7 @@
 
 #include <string.h>
 
+#include <algorithm>
 #include <initializer_list>
 #include <random>
 #include <sstream>
@@ -41,6 +42,8 @@ class TraceBufferTest : public testing::Test {
   using SequenceIterator = TraceBuffer::SequenceIterator;
   using ChunkMetaKey = TraceBuffer::ChunkMeta::Key;
   using ChunkRecord = TraceBuffer::ChunkRecord;
+  using ChunkMeta = TraceBuffer::ChunkMeta;
+  using ChunkSequence = TraceBuffer::ChunkSequence;
 
   static constexpr uint8_t kContFromPrevChunk =
       SharedMemoryABI::ChunkHeader::kFirstPacketContinuesFromPrevChunk;
@@ -127,9 +130,15 @@ class TraceBufferTest : public testing::Test {
   }
 
   SequenceIterator GetReadIterForSequence(ProducerID p, WriterID w) {
-    TraceBuffer::ChunkMeta::Key key(p, w, 0);
-    return trace_buffer_->GetReadIterForSequence(
-        trace_buffer_->index_.lower_bound(key));
+    const auto& sequences = trace_buffer_->sequences_;
+    size_t seq_idx = 0;
+    for (; seq_idx < sequences.size(); seq_idx++) {
+      if (sequences[seq_idx]->producer_id == p &&
+          sequences[seq_idx]->writer_id == w) {
+        break;
+      }
+    }
+    return trace_buffer_->GetReadIterForSequence(seq_idx);
   }
 
   void SuppressClientDchecksForTesting() {
@@ -138,9 +147,12 @@ class TraceBufferTest : public testing::Test {
 
   std::vector<ChunkMetaKey> GetIndex() {
     std::vector<ChunkMetaKey> keys;
-    keys.reserve(trace_buffer_->index_.size());
-    for (const auto& it : trace_buffer_->index_)
-      keys.push_back(it.first);
+    for (const auto& seq : trace_buffer_->sequences_) {
+      for (size_t i = seq->first; i < seq->entries.size(); i++) {
+        keys.emplace_back(seq->producer_id, seq->writer_id,
+                          seq->entries[i].chunk_id);
+      }
+    }
     return keys;
   }
 
@@ -1379,6 +1391,109 @@ TEST_F(TraceBufferTest, Iterator_ManyStreamsWrapping) {
   ASSERT_TRUE(IteratorSeqEq(ProducerID(3), WriterID(1), {Neg(-1), 0, 1}));
 }
 
+// -------------------
+// Index tests
+// -------------------
+TEST_F(TraceBufferTest, Index_ChunkSequence) {
+  ChunkSequence seq(ProducerID(1), WriterID(1));
+  auto meta = [](ChunkID c) {
+    return ChunkMeta(c * 16, 1, true, 0, kInvalidUid, base::kInvalidPid);
+  };
+  auto chunk_ids = [&seq] {
+    std::vector<ChunkID> ids;
+    for (size_t i = seq.first; i < seq.entries.size(); i++)
+      ids.push_back(seq.entries[i].chunk_id);
+    return ids;
+  };
+
+  // Out of order inserts keep the entries sorted.
+  for (ChunkID c : {1u, 2u, 3u, 5u, 4u, 0u})
+    ASSERT_TRUE(seq.Insert(c, meta(c)));
+  ASSERT_FALSE(seq.Insert(3, meta(42)));
+  ASSERT_THAT(chunk_ids(), ElementsAre(0u, 1u, 2u, 3u, 4u, 5u));
+  ASSERT_EQ(seq.Find(4)->record_off, 4u * 16);
+  ASSERT_EQ(seq.Find(3)->record_off, 3u * 16);
+  ASSERT_EQ(seq.Find(6), nullptr);
+
+  // Deleting from the front just skips the entries.
+  ASSERT_TRUE(seq.Erase(0));
+  ASSERT_TRUE(seq.Erase(1));
+  ASSERT_EQ(seq.first, 2u);
+  ASSERT_EQ(seq.Find(0), nullptr);
+  ASSERT_TRUE(seq.Erase(4));
+  ASSERT_FALSE(seq.Erase(4));
+  ASSERT_FALSE(seq.Erase(7));
+  ASSERT_THAT(chunk_ids(), ElementsAre(2u, 3u, 5u));
+  ASSERT_EQ(seq.UpperBound(2), seq.first + 1);
+  ASSERT_EQ(seq.LowerBound(4), seq.first + 2);
+
+  // A chunk older than the others reuses the space at the front.
+  ASSERT_TRUE(seq.Insert(1, meta(1)));
+  ASSERT_EQ(seq.first, 1u);
+  ASSERT_THAT(chunk_ids(), ElementsAre(1u, 2u, 3u, 5u));
+
+  // Once most entries are deleted, the space at the front is reclaimed.
+  ASSERT_TRUE(seq.Erase(1));
+  ASSERT_TRUE(seq.Erase(2));
+  ASSERT_EQ(seq.first, 0u);
+  ASSERT_THAT(chunk_ids(), ElementsAre(3u, 5u));
+  ASSERT_TRUE(seq.Erase(3));
+  ASSERT_TRUE(seq.Erase(5));
+  ASSERT_TRUE(seq.empty());
+  ASSERT_TRUE(seq.entries.empty());
+}
+
+TEST_F(TraceBufferTest, Index_ManyWritersWrapping) {
+  ResetBuffer(64 * 1024);
+  const size_t kNumWriters = 32;
+  const ChunkID kNumChunks = 100;
+  auto producer_of = [](size_t w) { return ProducerID(1 + w % 4); };
+  std::vector<ChunkID> next_chunk_to_read(kNumWriters);
+  auto read_all = [&] {
+    trace_buffer()->BeginRead();
+    for (;;) {
+      TraceBuffer::PacketSequenceProperties props{};
+      std::vector<FakePacketFragment> packet = ReadPacket(&props);
+      if (packet.empty())
+        break;
+      ASSERT_EQ(packet.size(), 1u);
+      size_t w = props.writer_id;
+      ASSERT_LT(w, kNumWriters);
+      ASSERT_EQ(props.producer_id_trusted, producer_of(w));
+      // Packets of the same writer are read in order, skipping only the
+      // chunks that got overwritten.
+      ChunkID c = next_chunk_to_read[w];
+      for (; c < kNumChunks; c++) {
+        if (packet[0] == FakePacketFragment(400, static_cast<char>(c)))
+          break;
+      }
+      ASSERT_LT(c, kNumChunks);
+      next_chunk_to_read[w] = c + 1;
+    }
+  };
+
+  for (ChunkID c = 0; c < kNumChunks; c++) {
+    for (size_t w = 0; w < kNumWriters; w++) {
+      CreateChunk(producer_of(w), WriterID(w), c)
+          .AddPacket(400, static_cast<char>(c))
+          .PadTo(512)
+          .CopyIntoTraceBuffer();
+    }
+    if (c % 5 == 4)
+      read_all();
+  }
+  read_all();
+  for (size_t w = 0; w < kNumWriters; w++)
+    ASSERT_EQ(next_chunk_to_read[w], kNumChunks);
+
+  // The index has only the chunks that fit in the buffer, sorted.
+  std::vector<ChunkMetaKey> index = GetIndex();
+  ASSERT_EQ(index.size(), 64 * 1024 / 512u);
+  ASSERT_TRUE(std::is_sorted(index.begin(), index.end()));
+  for (const ChunkMetaKey& key : index)
+    ASSERT_GE(key.chunk_id, kNumChunks - 4);
+}
+
 // -------------------
 // Re-writing same chunk id
 // -------------------
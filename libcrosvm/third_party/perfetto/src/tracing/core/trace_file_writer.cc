@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/trace_file_writer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/protozero/proto_utils.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+#include "perfetto/ext/base/no_destructor.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#endif
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace perfetto {
+namespace {
+
+int64_t NowNs() {
+  return base::GetBootTimeNs().count();
+}
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+base::ThreadTaskRunner* GetIoThread() {
+  static base::NoDestructor<base::ThreadTaskRunner> io_thread(
+      base::ThreadTaskRunner::CreateAndStart("traced.file"));
+  return &io_thread.ref();
+}
+#endif
+
+// Runs |task| on the I/O thread or, where there are no threads, right away.
+void PostToIoThread(std::function<void()> task) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  task();
+#else
+  GetIoThread()->PostTask(std::move(task));
+#endif
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
+using protozero::proto_utils::MakeTagLengthDelimited;
+using protozero::proto_utils::ParseVarInt;
+using protozero::proto_utils::WriteVarInt;
+
+// ID of |compressed_packets| in trace_packet.proto.
+constexpr uint32_t kCompressedPacketsFieldNumber = 50;
+
+// These match ZipPacketWriter in perfetto_cmd: compressed packets are kept
+// below 512KB, as some transports have a limit on the packet size, and every
+// kPendingBytesLimit the zlib stream is flushed, so that the space left in the
+// output buffer is known without being overly conservative.
+constexpr size_t kMaxPacketSize = 500 * 1024;
+constexpr size_t kPendingBytesLimit = 32 * 1024;
+
+void AppendPreamble(uint32_t field_id, size_t size, std::string* out) {
+  uint8_t preamble[16];
+  uint8_t* ptr = WriteVarInt(MakeTagLengthDelimited(field_id), preamble);
+  ptr = WriteVarInt(size, ptr);
+  out->append(reinterpret_cast<const char*>(preamble),
+              static_cast<size_t>(ptr - preamble));
+}
+
+class Deflater {
+ public:
+  explicit Deflater(std::string* out)
+      : out_(out), buf_(new uint8_t[kMaxPacketSize]) {}
+  ~Deflater() {
+    if (is_compressing_)
+      FinalizeCompressedPacket();
+  }
+
+  // |packet| points to the preamble of a packet whose payload is
+  // |payload_size| bytes long.
+  void AddPacket(const char* packet, size_t size, size_t payload_size);
+
+ private:
+  void FinalizeCompressedPacket();
+  void CheckEq(int actual_code, int expected_code);
+
+  std::string* const out_;
+  std::unique_ptr<uint8_t[]> buf_;
+  z_stream stream_{};
+  bool is_compressing_ = false;
+  size_t pending_bytes_ = 0;
+};
+
+void Deflater::AddPacket(const char* packet,
+                         size_t size,
+                         size_t payload_size) {
+  if (is_compressing_) {
+    // Every input byte can turn into at most two compressed bytes, so keeping
+    // pending_bytes_ below half of the remaining space guarantees that the
+    // output fits. See ZipPacketWriter::WritePacket() for more details.
+    if (pending_bytes_ > kPendingBytesLimit) {
+      CheckEq(deflate(&stream_, Z_SYNC_FLUSH), Z_OK);
+      pending_bytes_ = 0;
+    }
+    size_t remaining = stream_.avail_out;
+    if ((pending_bytes_ + payload_size + 1024) * 2 > remaining)
+      FinalizeCompressedPacket();
+  }
+
+  // Large packets could overflow the output buffer, write them uncompressed.
+  if (payload_size > kMaxPacketSize) {
+    PERFETTO_DCHECK(!is_compressing_);
+    out_->append(packet, size);
+    return;
+  }
+
+  if (!is_compressing_) {
+    memset(&stream_, 0, sizeof(stream_));
+    CheckEq(deflateInit(&stream_, 6), Z_OK);
+    is_compressing_ = true;
+    stream_.next_out = buf_.get();
+    stream_.avail_out = static_cast<unsigned int>(kMaxPacketSize);
+  }
+
+  stream_.next_in = reinterpret_cast<uint8_t*>(const_cast<char*>(packet));
+  stream_.avail_in = static_cast<unsigned int>(size);
+  CheckEq(deflate(&stream_, Z_NO_FLUSH), Z_OK);
+  PERFETTO_CHECK(stream_.avail_in == 0);
+  pending_bytes_ += size;
+}
+
+void Deflater::FinalizeCompressedPacket() {
+  PERFETTO_DCHECK(is_compressing_);
+  CheckEq(deflate(&stream_, Z_FINISH), Z_STREAM_END);
+  size_t size = static_cast<size_t>(stream_.next_out - buf_.get());
+
+  // The compressed packets are wrapped in a TracePacket, which in turn is a
+  // packet of the root Trace proto.
+  std::string preamble;
+  AppendPreamble(kCompressedPacketsFieldNumber, size, &preamble);
+  AppendPreamble(TracePacket::kPacketFieldNumber, preamble.size() + size, out_);
+  out_->append(preamble);
+  out_->append(reinterpret_cast<const char*>(buf_.get()), size);
+
+  is_compressing_ = false;
+  pending_bytes_ = 0;
+  CheckEq(deflateEnd(&stream_), Z_OK);
+}
+
+void Deflater::CheckEq(int actual_code, int expected_code) {
+  if (actual_code == expected_code)
+    return;
+  PERFETTO_FATAL("Expected %d got %d: %s", expected_code, actual_code,
+                 stream_.msg ? stream_.msg : "");
+}
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
+}  // namespace
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+void DeflateTracePackets(const std::string& trace, std::string* out) {
+  constexpr uint32_t kPacketTag =
+      MakeTagLengthDelimited(TracePacket::kPacketFieldNumber);
+  Deflater deflater(out);
+  const auto* start = reinterpret_cast<const uint8_t*>(trace.data());
+  const auto* end = start + trace.size();
+  for (const uint8_t* packet = start; packet < end;) {
+    uint64_t tag = 0;
+    uint64_t payload_size = 0;
+    const uint8_t* ptr = ParseVarInt(packet, end, &tag);
+    ptr = ParseVarInt(ptr, end, &payload_size);
+    PERFETTO_CHECK(tag == kPacketTag &&
+                   payload_size <= static_cast<uint64_t>(end - ptr));
+    const uint8_t* packet_end = ptr + payload_size;
+    deflater.AddPacket(reinterpret_cast<const char*>(packet),
+                       static_cast<size_t>(packet_end - packet),
+                       static_cast<size_t>(payload_size));
+    packet = packet_end;
+  }
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
+struct TraceFileWriter::IoState {
+  IoState(base::ScopedFile f, bool deflate)
+      : fd(std::move(f)), compress_deflate(deflate) {}
+
+  const base::ScopedFile fd;
+  const bool compress_deflate;
+
+  // Only accessed by the I/O thread while |back_busy| is true.
+  Batch back;
+  std::string compressed;
+
+  std::mutex mutex;
+  std::condition_variable back_idle;
+  bool back_busy = false;  // Guarded by |mutex|.
+  Stats stats;             // Guarded by |mutex|.
+  std::atomic<bool> has_error{false};
+};
+
+// static
+bool TraceFileWriter::IsDeflateSupported() {
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+  return true;
+#else
+  return false;
+#endif
+}
+
+// static
+void TraceFileWriter::WaitForIoThreadForTesting() {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  GetIoThread()->PostTaskAndWaitForTesting([] {});
+#endif
+}
+
+TraceFileWriter::TraceFileWriter(base::ScopedFile fd, bool compress_deflate)
+    : io_state_(new IoState(std::move(fd),
+                            compress_deflate && IsDeflateSupported())) {
+  if (compress_deflate && !io_state_->compress_deflate)
+    PERFETTO_ELOG("Cannot compress. Zlib not enabled in the build config");
+}
+
+TraceFileWriter::~TraceFileWriter() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  // The I/O thread runs tasks in order, so by the time this runs the batch in
+  // flight (if any) is done and the back buffer is free. The task keeps
+  // |io_state_| alive, the file is closed when it's done.
+  std::shared_ptr<IoState> state = io_state_;
+  front_.commit_time_ns = NowNs();
+  PostToIoThread([state, last = std::move(front_)]() mutable {
+    if (!last.data.empty()) {
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        PERFETTO_DCHECK(!state->back_busy);
+        state->stats.input_bytes += last.data.size();
+        state->stats.batches++;
+        std::swap(state->back, last);
+        state->back_busy = true;
+      }
+      WriteBackBuffer(state.get());
+    }
+    if (!state->has_error)
+      base::FlushFile(*state->fd);
+  });
+}
+
+bool TraceFileWriter::has_error() const {
+  return io_state_->has_error.load(std::memory_order_relaxed);
+}
+
+void TraceFileWriter::AppendPacket(TracePacket* packet) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  char* preamble;
+  size_t preamble_size = 0;
+  std::tie(preamble, preamble_size) = packet->GetProtoPreamble();
+  front_.data.append(preamble, preamble_size);
+  for (const Slice& slice : packet->slices())
+    front_.data.append(static_cast<const char*>(slice.start), slice.size);
+}
+
+void TraceFileWriter::Commit() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (front_.data.empty())
+    return;
+  front_.commit_time_ns = NowNs();
+  IoState* state = io_state_.get();
+  {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->stats.input_bytes += front_.data.size();
+    state->stats.batches++;
+    if (state->back_busy) {
+      state->stats.stalls++;
+      state->back_idle.wait(lock, [state] { return !state->back_busy; });
+      state->stats.stall_duration_ns +=
+          static_cast<uint64_t>(NowNs() - front_.commit_time_ns);
+    }
+    // The back buffer has been cleared by the I/O thread but keeps its
+    // capacity, so the front buffer doesn't need to grow again.
+    std::swap(front_, state->back);
+    state->back_busy = true;
+  }
+  std::shared_ptr<IoState> keep_alive = io_state_;
+  PostToIoThread([keep_alive] { WriteBackBuffer(keep_alive.get()); });
+}
+
+bool TraceFileWriter::Flush() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  Commit();
+  IoState* state = io_state_.get();
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->back_idle.wait(lock, [state] { return !state->back_busy; });
+  return !has_error();
+}
+
+TraceFileWriter::Stats TraceFileWriter::GetStats() {
+  std::lock_guard<std::mutex> lock(io_state_->mutex);
+  return io_state_->stats;
+}
+
+// static
+void TraceFileWriter::WriteBackBuffer(IoState* state) {
+  int64_t start_ns = NowNs();
+  bool failed = false;
+  size_t wr_size = 0;
+  if (!state->has_error) {
+    const std::string* data = &state->back.data;
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+    if (state->compress_deflate) {
+      state->compressed.clear();
+      DeflateTracePackets(state->back.data, &state->compressed);
+      data = &state->compressed;
+    }
+#endif
+    wr_size = data->size();
+    if (base::WriteAll(*state->fd, data->data(), wr_size) !=
+        static_cast<ssize_t>(wr_size)) {
+      PERFETTO_PLOG("Failed to write the trace into the file");
+      failed = true;
+      state->has_error.store(true, std::memory_order_relaxed);
+    }
+  }
+  int64_t end_ns = NowNs();
+  state->back.data.clear();
+
+  std::lock_guard<std::mutex> lock(state->mutex);
+  if (failed) {
+    state->stats.errors++;
+  } else if (!state->has_error) {
+    state->stats.output_bytes += wr_size;
+  }
+  state->stats.write_duration_ns += static_cast<uint64_t>(end_ns - start_ns);
+  state->stats.max_write_lag_ns =
+      std::max(state->stats.max_write_lag_ns,
+               static_cast<uint64_t>(end_ns - state->back.commit_time_ns));
+  state->back_busy = false;
+  state->back_idle.notify_one();
+}
+
+}  // namespace perfetto
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_CORE_TRACE_FILE_WRITER_H_
+#define SRC_TRACING_CORE_TRACE_FILE_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/thread_checker.h"
+
+namespace perfetto {
+
+class TracePacket;
+
+// Writes the packets of a write_into_file tracing session into its file
+// without blocking the service thread on the file I/O.
+//
+// The service appends packets into a front buffer and, at the end of each
+// drain, hands it over to the I/O thread with Commit(). The I/O thread writes
+// (and optionally deflates) the back buffer while the service keeps filling
+// the front one. Buffers are recycled, so in the steady state the two buffers
+// are the only memory used. Commit() blocks only if the I/O thread is still
+// busy with the previous buffer, which happens only when the file can't keep
+// up with the trace.
+//
+// The I/O thread is shared by all the writers of the process. On NaCl, which
+// has no threads, the writes happen synchronously in Commit().
+//
+// All the methods must be called on the same thread, the service one.
+class TraceFileWriter {
+ public:
+  struct Stats {
+    uint64_t input_bytes = 0;
+    uint64_t output_bytes = 0;
+    uint64_t batches = 0;
+    uint64_t stalls = 0;
+    uint64_t stall_duration_ns = 0;
+    uint64_t write_duration_ns = 0;
+    uint64_t max_write_lag_ns = 0;
+    uint64_t errors = 0;
+  };
+
+  // Returns true if the build supports |compress_deflate|.
+  static bool IsDeflateSupported();
+
+  // If |compress_deflate| is true, the packets are written into the file
+  // wrapped into deflated TracePacket.compressed_packets, like perfetto_cmd
+  // does when reading back the trace over IPC.
+  TraceFileWriter(base::ScopedFile fd, bool compress_deflate);
+
+  // Doesn't block: the pending data is written, and the file synced and closed,
+  // on the I/O thread after the writer is gone.
+  ~TraceFileWriter();
+
+  TraceFileWriter(const TraceFileWriter&) = delete;
+  TraceFileWriter& operator=(const TraceFileWriter&) = delete;
+
+  // Copies |packet|, preceded by its proto preamble, into the front buffer.
+  void AppendPacket(TracePacket* packet);
+
+  // Hands the front buffer over to the I/O thread.
+  void Commit();
+
+  // Commits and waits until all the data is written into the file. Returns
+  // false if any write failed. This doesn't sync the file to the storage,
+  // which is left to the destructor.
+  bool Flush();
+
+  // True if a write failed. Becomes true asynchronously, after the Commit() of
+  // the failing batch.
+  bool has_error() const;
+
+  Stats GetStats();
+
+  // Waits until the I/O thread has run all the tasks posted so far, including
+  // the ones of destroyed writers.
+  static void WaitForIoThreadForTesting();
+
+ private:
+  struct Batch {
+    std::string data;
+    int64_t commit_time_ns = 0;
+  };
+
+  // The part of the writer used by the I/O thread. It's shared with the tasks
+  // posted there, since the last one runs after the writer is destroyed.
+  struct IoState;
+
+  // Called on the I/O thread.
+  static void WriteBackBuffer(IoState*);
+
+  const std::shared_ptr<IoState> io_state_;
+  Batch front_;
+
+  PERFETTO_THREAD_CHECKER(thread_checker_)
+};
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+// Appends to |out| the packets serialized in |trace| (a sequence of
+// TracePacket preambles and payloads, i.e. a serialized Trace proto) deflated
+// into one or more TracePacket.compressed_packets. Packets too big to be
+// compressed are appended as they are. Exposed for testing.
+void DeflateTracePackets(const std::string& trace, std::string* out);
+#endif
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_CORE_TRACE_FILE_WRITER_H_
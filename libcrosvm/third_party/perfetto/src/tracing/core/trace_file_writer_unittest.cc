@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/trace_file_writer.h"
+
+#include <fcntl.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/base/utils.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/test_event.gen.h"
+#include "protos/perfetto/trace/trace.gen.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace perfetto {
+namespace {
+
+using ::testing::ElementsAreArray;
+
+std::string SerializePacket(const std::string& payload) {
+  protos::gen::TracePacket packet;
+  packet.mutable_for_testing()->set_str(payload);
+  return packet.SerializeAsString();
+}
+
+void AppendPacket(TraceFileWriter* writer, const std::string& raw_packet) {
+  TracePacket packet;
+  // Split the packet in two slices, to check that slices are stitched back.
+  size_t half = raw_packet.size() / 2;
+  packet.AddSlice(raw_packet.data(), half);
+  packet.AddSlice(raw_packet.data() + half, raw_packet.size() - half);
+  writer->AppendPacket(&packet);
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+std::string Inflate(const std::string& compressed) {
+  z_stream stream{};
+  PERFETTO_CHECK(inflateInit(&stream) == Z_OK);
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+  stream.avail_in = static_cast<uInt>(compressed.size());
+  std::string out;
+  char buf[4096];
+  int ret = Z_OK;
+  while (ret == Z_OK) {
+    stream.next_out = reinterpret_cast<Bytef*>(buf);
+    stream.avail_out = sizeof(buf);
+    ret = inflate(&stream, Z_NO_FLUSH);
+    out.append(buf, sizeof(buf) - stream.avail_out);
+  }
+  EXPECT_EQ(ret, Z_STREAM_END);
+  inflateEnd(&stream);
+  return out;
+}
+#endif
+
+// Returns the for_testing payloads of the trace, decompressing the
+// compressed_packets.
+std::vector<std::string> GetPayloads(const std::string& raw_trace,
+                                     size_t* num_compressed_packets = nullptr) {
+  protos::gen::Trace trace;
+  EXPECT_TRUE(trace.ParseFromString(raw_trace));
+  std::vector<std::string> payloads;
+  for (const auto& packet : trace.packet()) {
+    if (packet.has_compressed_packets()) {
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+      EXPECT_LE(packet.compressed_packets().size(), 500 * 1024u);
+      for (std::string& payload :
+           GetPayloads(Inflate(packet.compressed_packets()))) {
+        payloads.emplace_back(std::move(payload));
+      }
+      if (num_compressed_packets)
+        (*num_compressed_packets)++;
+#else
+      ADD_FAILURE() << "Unexpected compressed packets";
+#endif
+      continue;
+    }
+    payloads.push_back(packet.for_testing().str());
+  }
+  return payloads;
+}
+
+TEST(TraceFileWriterTest, WritesPackets) {
+  base::TempFile tmp_file = base::TempFile::Create();
+  std::vector<std::string> payloads;
+  {
+    TraceFileWriter writer(base::ScopedFile(dup(tmp_file.fd())),
+                           /*compress_deflate=*/false);
+    for (int batch = 0; batch < 10; batch++) {
+      for (int i = 0; i < 100; i++) {
+        payloads.push_back(std::to_string(batch) + "-" + std::to_string(i));
+        AppendPacket(&writer, SerializePacket(payloads.back()));
+      }
+      writer.Commit();
+    }
+    // Committing with nothing appended is a no-op.
+    writer.Commit();
+    ASSERT_TRUE(writer.Flush());
+
+    TraceFileWriter::Stats stats = writer.GetStats();
+    EXPECT_EQ(stats.batches, 10u);
+    EXPECT_EQ(stats.input_bytes, stats.output_bytes);
+    EXPECT_EQ(stats.errors, 0u);
+    EXPECT_LE(stats.stalls, stats.batches);
+  }
+
+  std::string raw_trace;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path(), &raw_trace));
+  EXPECT_THAT(GetPayloads(raw_trace), ElementsAreArray(payloads));
+}
+
+TEST(TraceFileWriterTest, DestructorFlushes) {
+  base::TempFile tmp_file = base::TempFile::Create();
+  {
+    TraceFileWriter writer(base::ScopedFile(dup(tmp_file.fd())),
+                           /*compress_deflate=*/false);
+    AppendPacket(&writer, SerializePacket("payload"));
+    writer.Commit();
+    AppendPacket(&writer, SerializePacket("last"));
+  }
+  // The destructor doesn't wait for the last writes.
+  TraceFileWriter::WaitForIoThreadForTesting();
+  std::string raw_trace;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path(), &raw_trace));
+  EXPECT_THAT(GetPayloads(raw_trace), ElementsAreArray({"payload", "last"}));
+}
+
+TEST(TraceFileWriterTest, WriteError) {
+  base::TempFile tmp_file = base::TempFile::Create();
+  // Writes into a read-only fd fail.
+  TraceFileWriter writer(base::OpenFile(tmp_file.path(), O_RDONLY),
+                         /*compress_deflate=*/false);
+  AppendPacket(&writer, SerializePacket("payload"));
+  EXPECT_FALSE(writer.Flush());
+  EXPECT_TRUE(writer.has_error());
+
+  // Nothing is written after the first failure.
+  AppendPacket(&writer, SerializePacket("payload"));
+  EXPECT_FALSE(writer.Flush());
+  TraceFileWriter::Stats stats = writer.GetStats();
+  EXPECT_EQ(stats.batches, 2u);
+  EXPECT_EQ(stats.output_bytes, 0u);
+  EXPECT_EQ(stats.errors, 1u);
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+TEST(TraceFileWriterTest, DeflateTracePackets) {
+  std::vector<std::string> payloads;
+  std::string trace;
+  for (int i = 0; i < 10000; i++) {
+    payloads.push_back("payload " + std::to_string(i % 100));
+    // Packets too big to be compressed are written as they are.
+    if (i == 5000)
+      payloads.back().append(600 * 1024, 'x');
+    TracePacket packet;
+    std::string raw_packet = SerializePacket(payloads.back());
+    packet.AddSlice(raw_packet.data(), raw_packet.size());
+    char* preamble;
+    size_t preamble_size;
+    std::tie(preamble, preamble_size) = packet.GetProtoPreamble();
+    trace.append(preamble, preamble_size);
+    trace.append(raw_packet);
+  }
+
+  std::string compressed;
+  DeflateTracePackets(trace, &compressed);
+  size_t num_compressed_packets = 0;
+  EXPECT_THAT(GetPayloads(compressed, &num_compressed_packets),
+              ElementsAreArray(payloads));
+  // The big packet splits the trace in two compressed packets.
+  EXPECT_EQ(num_compressed_packets, 2u);
+}
+
+TEST(TraceFileWriterTest, WritesCompressedPackets) {
+  base::TempFile tmp_file = base::TempFile::Create();
+  std::vector<std::string> payloads;
+  {
+    TraceFileWriter writer(base::ScopedFile(dup(tmp_file.fd())),
+                           /*compress_deflate=*/true);
+    for (int batch = 0; batch < 10; batch++) {
+      for (int i = 0; i < 1000; i++) {
+        payloads.push_back("payload " + std::to_string(i));
+        AppendPacket(&writer, SerializePacket(payloads.back()));
+      }
+      writer.Commit();
+    }
+    ASSERT_TRUE(writer.Flush());
+
+    TraceFileWriter::Stats stats = writer.GetStats();
+    EXPECT_EQ(stats.batches, 10u);
+    EXPECT_LT(stats.output_bytes, stats.input_bytes / 2);
+  }
+
+  std::string raw_trace;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path(), &raw_trace));
+  size_t num_compressed_packets = 0;
+  EXPECT_THAT(GetPayloads(raw_trace, &num_compressed_packets),
+              ElementsAreArray(payloads));
+  // Each batch is compressed on its own, so the file is complete after every
+  // write.
+  EXPECT_EQ(num_compressed_packets, 10u);
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
+}  // namespace
+}  // namespace perfetto
@@ -23,13 +23,14 @@
 #include <limits.h>
 #include <string.h>
 
+#include <atomic>
 #include <cinttypes>
 #include <regex>
+#include <thread>
 #include <unordered_set>
 
 #if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && \
     !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
-#include <sys/uio.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 #endif
@@ -79,6 +80,7 @@
 #include "src/tracing/core/packet_stream_validator.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 #include "src/tracing/core/trace_buffer.h"
+#include "src/tracing/core/trace_file_writer.h"
 
 #include "protos/perfetto/common/builtin_clock.gen.h"
 #include "protos/perfetto/common/builtin_clock.pbzero.h"
@@ -120,6 +122,13 @@ constexpr int kMaxConcurrentTracingSessionsPerUid = 5;
 constexpr int kMaxConcurrentTracingSessionsForStatsdUid = 10;
 constexpr int64_t kMinSecondsBetweenTracesGuardrail = 5 * 60;
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+// Max number of worker threads used by ReadBuffers(), on top of the service
+// thread. Keeps traced from hogging all the CPUs when the tracing session is
+// stopped, which is often when the device is busiest.
+constexpr uint32_t kMaxReadBuffersThreads = 3;
+#endif
+
 constexpr uint32_t kMillisPerHour = 3600000;
 constexpr uint32_t kMillisPerDay = kMillisPerHour * 24;
 constexpr uint32_t kMaxTracingDurationMillis = 7 * 24 * kMillisPerHour;
@@ -128,31 +137,6 @@ constexpr uint32_t kMaxTracingDurationMillis = 7 * 24 * kMillisPerHour;
 constexpr uint32_t kGuardrailsMaxTracingBufferSizeKb = 128 * 1024;
 constexpr uint32_t kGuardrailsMaxTracingDurationMillis = 24 * kMillisPerHour;
 
-#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) || PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
-struct iovec {
-  void* iov_base;  // Address
-  size_t iov_len;  // Block size
-};
-
-// Simple implementation of writev. Note that this does not give the atomicity
-// guarantees of a real writev, but we don't depend on these (we aren't writing
-// to the same file from another thread).
-ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
-  ssize_t total_size = 0;
-  for (int i = 0; i < iovcnt; ++i) {
-    ssize_t current_size = base::WriteAll(fd, iov[i].iov_base, iov[i].iov_len);
-    if (current_size != static_cast<ssize_t>(iov[i].iov_len))
-      return -1;
-    total_size += current_size;
-  }
-  return total_size;
-}
-
-#define IOV_MAX 1024  // Linux compatible limit.
-
-#endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) ||
-        // PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
-
 // Partially encodes a CommitDataRequest in an int32 for the purposes of
 // metatracing. Note that it encodes only the bottom 10 bits of the producer id
 // (which is technically 16 bits wide).
@@ -275,6 +259,14 @@ std::string GetBugreportTmpPath() {
   return GetBugreportPath() + ".tmp";
 }
 
+std::unique_ptr<TraceFileWriter> CreateTraceFileWriter(base::ScopedFile fd,
+                                                       const TraceConfig& cfg) {
+  bool compress_deflate =
+      cfg.compression_type() == TraceConfig::COMPRESSION_TYPE_DEFLATE;
+  return std::unique_ptr<TraceFileWriter>(
+      new TraceFileWriter(std::move(fd), compress_deflate));
+}
+
 bool ShouldLogEvent(const TraceConfig& cfg) {
   switch (cfg.statsd_logging()) {
     case TraceConfig::STATSD_LOGGING_ENABLED:
@@ -311,6 +303,133 @@ void AppendOwnedSlicesToPacket(std::unique_ptr<uint8_t[]> data,
   }
 }
 
+// Counters reported in TraceStats.FilterStats.
+struct FilterStats {
+  uint64_t input_packets = 0;
+  uint64_t input_bytes = 0;
+  uint64_t output_bytes = 0;
+  uint64_t errors = 0;
+};
+
+// Runs `*packets` in [`begin`, `end`) through `*filter` and replaces them with
+// the filter results. Keeps the cardinality of the input packets: even if an
+// entire packet is filtered out, a zero-sized TracePacket is left in its place.
+// That makes debugging and reasoning about the trace stats easier.
+void FilterPackets(protozero::MessageFilter* filter,
+                   std::vector<TracePacket>* packets,
+                   size_t begin,
+                   size_t end,
+                   FilterStats* stats) {
+  // The filter root shoud be reset from protos.Trace to protos.TracePacket
+  // by the earlier call to SetFilterRoot() in EnableTracing().
+  PERFETTO_DCHECK(filter->root_msg_index() != 0);
+  std::vector<protozero::MessageFilter::InputSlice> filter_input;
+  for (size_t pkt_idx = begin; pkt_idx < end; pkt_idx++) {
+    TracePacket& packet = (*packets)[pkt_idx];
+    const auto& packet_slices = packet.slices();
+    filter_input.clear();
+    filter_input.resize(packet_slices.size());
+    ++stats->input_packets;
+    stats->input_bytes += packet.size();
+    for (size_t i = 0; i < packet_slices.size(); ++i)
+      filter_input[i] = {packet_slices[i].start, packet_slices[i].size};
+    auto filtered_packet =
+        filter->FilterMessageFragments(&filter_input[0], filter_input.size());
+
+    // Replace the packet in-place with the filtered one (unless failed).
+    packet = TracePacket();
+    if (filtered_packet.error) {
+      ++stats->errors;
+      PERFETTO_DLOG("Trace packet filtering failed @ packet %" PRIu64,
+                    stats->input_packets);
+      continue;
+    }
+    stats->output_bytes += filtered_packet.size;
+    AppendOwnedSlicesToPacket(std::move(filtered_packet.data),
+                              filtered_packet.size,
+                              TracingServiceImpl::kMaxTracePacketSliceSize,
+                              &packet);
+  }
+}
+
+// The packets read by ReadBuffers() from one of the buffers of a tracing
+// session.
+struct BufferReadout {
+  std::vector<TracePacket> packets;
+
+  // The properties of the sequence of each of the |packets|.
+  std::vector<TraceBuffer::PacketSequenceProperties> sequence_properties;
+  std::vector<bool> previous_packet_dropped;
+
+  uint64_t invalid_packets = 0;
+  bool did_hit_threshold = false;
+  FilterStats filter_stats;
+};
+
+// The number of bytes that a ReadBuffers() pass can still read. It's shared by
+// the readers of all the buffers of the session, which can run concurrently.
+class ReadBudget {
+ public:
+  explicit ReadBudget(size_t bytes) : bytes_left_(bytes) {}
+
+  bool exhausted() const {
+    return bytes_left_.load(std::memory_order_relaxed) == 0;
+  }
+
+  // Charges `size` bytes to the budget. Returns true if it's now exhausted.
+  bool Consume(size_t size) {
+    size_t left = bytes_left_.load(std::memory_order_relaxed);
+    size_t new_left;
+    do {
+      new_left = left > size ? left - size : 0;
+    } while (!bytes_left_.compare_exchange_weak(left, new_left,
+                                                std::memory_order_relaxed));
+    return new_left == 0;
+  }
+
+ private:
+  std::atomic<size_t> bytes_left_;
+};
+
+// Reads and validates the packets of `*tbuf` until `*budget` is exhausted,
+// either by this or by the readers of the other buffers. The packet that
+// exhausts the budget is kept, so each reader can go over it by at most one
+// packet. Doesn't access the state of the service, so it can run on a worker
+// thread, as long as nothing else accesses `*tbuf` meanwhile.
+void ReadBuffer(TraceBuffer* tbuf, ReadBudget* budget, BufferReadout* readout) {
+  tbuf->BeginRead();
+  while (!readout->did_hit_threshold) {
+    if (budget->exhausted()) {
+      readout->did_hit_threshold = true;
+      break;
+    }
+    TracePacket packet;
+    TraceBuffer::PacketSequenceProperties sequence_properties{};
+    bool previous_packet_dropped;
+    if (!tbuf->ReadNextTracePacket(&packet, &sequence_properties,
+                                   &previous_packet_dropped)) {
+      break;
+    }
+    PERFETTO_DCHECK(sequence_properties.producer_id_trusted != 0);
+    PERFETTO_DCHECK(sequence_properties.writer_id != 0);
+    PERFETTO_DCHECK(sequence_properties.producer_uid_trusted != kInvalidUid);
+    // Not checking sequence_properties.producer_pid_trusted: it is
+    // base::kInvalidPid if the platform doesn't support it.
+
+    PERFETTO_DCHECK(packet.size() > 0);
+    if (!PacketStreamValidator::Validate(packet.slices())) {
+      readout->invalid_packets++;
+      PERFETTO_DLOG("Dropping invalid packet");
+      continue;
+    }
+
+    readout->did_hit_threshold = budget->Consume(packet.size());
+    readout->packets.emplace_back(std::move(packet));
+    readout->sequence_properties.push_back(sequence_properties);
+    readout->previous_packet_dropped.push_back(previous_packet_dropped);
+  }
+}
+
 }  // namespace
 
 #if !PERFETTO_IS_AT_LEAST_CPP17()
@@ -849,7 +968,8 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
                                 cfg.output_path().c_str());
       }
     }
-    tracing_session->write_into_file = std::move(fd);
+    tracing_session->write_into_file =
+        CreateTraceFileWriter(std::move(fd), cfg);
     uint32_t write_period_ms = cfg.file_write_period_ms();
     if (write_period_ms == 0)
       write_period_ms = kDefaultWriteIntoFilePeriodMs;
@@ -2092,7 +2212,9 @@ bool TracingServiceImpl::ReadBuffersIntoFile(TracingSessionID tsid) {
 
   // ReadBuffers() can allocate memory internally, for filtering. By limiting
   // the data that ReadBuffers() reads to kWriteIntoChunksSize per iteration,
-  // we limit the amount of memory used on each iteration.
+  // we limit the amount of memory used on each iteration. This also bounds the
+  // size of the batches handed to the file writer, so that the I/O thread
+  // writes a chunk while the next one is being read.
   //
   // It would be tempting to split this into multiple tasks like in
   // ReadBuffersIntoConsumer, but that's not currently possible.
@@ -2108,8 +2230,12 @@ bool TracingServiceImpl::ReadBuffersIntoFile(TracingSessionID tsid) {
   } while (has_more && !stop_writing_into_file);
 
   if (stop_writing_into_file || tracing_session->write_period_ms == 0) {
-    // Ensure all data was written to the file before we close it.
-    base::FlushFile(tracing_session->write_into_file.get());
+    // Ensure all data was written to the file before the consumer is told
+    // that tracing is disabled. Syncing and closing the file happen on the
+    // I/O thread once the writer is destroyed.
+    tracing_session->write_into_file->Flush();
+    tracing_session->write_into_file_stats =
+        tracing_session->write_into_file->GetStats();
     tracing_session->write_into_file.reset();
     tracing_session->write_period_ms = 0;
     if (tracing_session->state == TracingSession::STARTED)
@@ -2189,43 +2315,75 @@ std::vector<TracePacket> TracingServiceImpl::ReadBuffers(
   for (const TracePacket& packet : packets) {
     packets_bytes += packet.size();
   }
+  MaybeFilterPackets(tracing_session, &packets, 0, packets.size());
 
-  bool did_hit_threshold = false;
-
-  for (size_t buf_idx = 0;
-       buf_idx < tracing_session->num_buffers() && !did_hit_threshold;
-       buf_idx++) {
+  const size_t num_buffers = tracing_session->num_buffers();
+  std::vector<TraceBuffer*> tbufs(num_buffers);
+  for (size_t buf_idx = 0; buf_idx < num_buffers; buf_idx++) {
     auto tbuf_iter = buffers_.find(tracing_session->buffers_index[buf_idx]);
     if (tbuf_iter == buffers_.end()) {
       PERFETTO_DFATAL("Buffer not found.");
       continue;
     }
-    TraceBuffer& tbuf = *tbuf_iter->second;
-    tbuf.BeginRead();
-    while (!did_hit_threshold) {
-      TracePacket packet;
-      TraceBuffer::PacketSequenceProperties sequence_properties{};
-      bool previous_packet_dropped;
-      if (!tbuf.ReadNextTracePacket(&packet, &sequence_properties,
-                                    &previous_packet_dropped)) {
-        break;
-      }
-      PERFETTO_DCHECK(sequence_properties.producer_id_trusted != 0);
-      PERFETTO_DCHECK(sequence_properties.writer_id != 0);
-      PERFETTO_DCHECK(sequence_properties.producer_uid_trusted != kInvalidUid);
-      // Not checking sequence_properties.producer_pid_trusted: it is
-      // base::kInvalidPid if the platform doesn't support it.
-
-      PERFETTO_DCHECK(packet.size() > 0);
-      if (!PacketStreamValidator::Validate(packet.slices())) {
-        tracing_session->invalid_packets++;
-        PERFETTO_DLOG("Dropping invalid packet");
-        continue;
-      }
+    tbufs[buf_idx] = tbuf_iter->second.get();
+  }
+
+  // With more than one buffer, the CPU-bound parts of the readout (walking the
+  // buffer, validating and filtering the packets) run in parallel, one buffer
+  // per task. Each task only touches its own buffer and BufferReadout. There
+  // are no threads on NaCl, where the buffers are always read one by one.
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  const bool parallel = false;
+#else
+  base::ThreadPool* pool = nullptr;
+  if (num_buffers > 1) {
+    if (!read_buffers_pool_) {
+      uint32_t num_cpus = std::thread::hardware_concurrency();
+      uint32_t num_threads =
+          std::min(num_cpus > 1 ? num_cpus - 1 : 0, kMaxReadBuffersThreads);
+      read_buffers_pool_.reset(
+          new base::ThreadPool(num_threads, "traced.read"));
+    }
+    pool = read_buffers_pool_.get();
+  }
+  const bool parallel = pool != nullptr;
+#endif
+  auto for_each_buffer = [&](const std::function<void(size_t)>& fn) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+    if (pool) {
+      pool->RunParallel(num_buffers, fn);
+      return;
+    }
+#endif
+    for (size_t buf_idx = 0; buf_idx < num_buffers; buf_idx++)
+      fn(buf_idx);
+  };
+
+  // All the buffers draw from the same budget, which the service packets above
+  // have already been charged to, so that a pass reads about `threshold` bytes
+  // in total regardless of the number of buffers.
+  ReadBudget budget(threshold > packets_bytes ? threshold - packets_bytes : 0);
+  std::vector<BufferReadout> readouts(num_buffers);
+  for_each_buffer([&tbufs, &readouts, &budget](size_t buf_idx) {
+    if (tbufs[buf_idx])
+      ReadBuffer(tbufs[buf_idx], &budget, &readouts[buf_idx]);
+  });
+
+  // The trusted fields are appended on this thread, in buffer order, because
+  // GetPacketSequenceID() assigns new IDs as sequences are first seen.
+  bool did_hit_threshold = false;
+  size_t num_packets = packets.size();
+  for (BufferReadout& readout : readouts) {
+    tracing_session->invalid_packets += readout.invalid_packets;
+    did_hit_threshold |= readout.did_hit_threshold;
+    num_packets += readout.packets.size();
+    for (size_t i = 0; i < readout.packets.size(); i++) {
+      const TraceBuffer::PacketSequenceProperties& sequence_properties =
+          readout.sequence_properties[i];
 
       // Append a slice with the trusted field data. This can't be spoofed
-      // because above we validated that the existing slices don't contain any
-      // trusted fields. For added safety we append instead of prepending
+      // because ReadBuffer() validated that the existing slices don't contain
+      // any trusted fields. For added safety we append instead of prepending
       // because according to protobuf semantics, if the same field is
       // encountered multiple times the last instance takes priority. Note that
       // truncated packets are also rejected, so the producer can't give us a
@@ -2245,17 +2403,43 @@ std::vector<TracePacket> TracingServiceImpl::ReadBuffers(
         trusted_packet->set_trusted_pid(
             static_cast<int32_t>(sequence_properties.producer_pid_trusted));
       }
-      if (previous_packet_dropped)
-        trusted_packet->set_previous_packet_dropped(previous_packet_dropped);
+      if (readout.previous_packet_dropped[i])
+        trusted_packet->set_previous_packet_dropped(true);
       slice.size = trusted_packet.Finalize();
-      packet.AddSlice(std::move(slice));
+      readout.packets[i].AddSlice(std::move(slice));
+    }
+  }
 
-      // Append the packet (inclusive of the trusted uid) to |packets|.
-      packets_bytes += packet.size();
-      did_hit_threshold = packets_bytes >= threshold;
+  if (tracing_session->trace_filter) {
+    // A MessageFilter can't be shared across threads: with more than one
+    // buffer, each buffer is filtered by its own copy of the session filter.
+    std::vector<protozero::MessageFilter*> filters(num_buffers);
+    for (size_t buf_idx = 0; buf_idx < num_buffers; buf_idx++) {
+      filters[buf_idx] = parallel ? GetBufferFilter(tracing_session, buf_idx)
+                              : tracing_session->trace_filter.get();
+    }
+    for_each_buffer([&filters, &readouts](size_t buf_idx) {
+      BufferReadout& readout = readouts[buf_idx];
+      FilterPackets(filters[buf_idx], &readout.packets, 0,
+                    readout.packets.size(), &readout.filter_stats);
+    });
+    for (const BufferReadout& readout : readouts) {
+      tracing_session->filter_input_packets +=
+          readout.filter_stats.input_packets;
+      tracing_session->filter_input_bytes += readout.filter_stats.input_bytes;
+      tracing_session->filter_output_bytes += readout.filter_stats.output_bytes;
+      tracing_session->filter_errors += readout.filter_stats.errors;
+    }
+  }
+
+  // Append the packets of each buffer, keeping the order in which they were
+  // read.
+  packets.reserve(num_packets);
+  for (BufferReadout& readout : readouts) {
+    for (TracePacket& packet : readout.packets)
       packets.emplace_back(std::move(packet));
-    }  // for(packets...)
-  }    // for(buffers...)
+  }
+  const size_t num_buffer_packets_end = packets.size();
 
   *has_more = did_hit_threshold;
 
@@ -2285,7 +2469,8 @@ std::vector<TracePacket> TracingServiceImpl::ReadBuffers(
     tracing_session->should_emit_stats = false;
   }
 
-  MaybeFilterPackets(tracing_session, &packets);
+  MaybeFilterPackets(tracing_session, &packets, num_buffer_packets_end,
+                     packets.size());
 
   if (!*has_more) {
     // We've observed some extremely high memory usage by scudo after
@@ -2298,115 +2483,80 @@ std::vector<TracePacket> TracingServiceImpl::ReadBuffers(
 }
 
 void TracingServiceImpl::MaybeFilterPackets(TracingSession* tracing_session,
-                                            std::vector<TracePacket>* packets) {
-  // If the tracing session specified a filter, run all packets through the
-  // filter and replace them with the filter results.
-  // The process below mantains the cardinality of input packets. Even if an
-  // entire packet is filtered out, we emit a zero-sized TracePacket proto. That
-  // makes debugging and reasoning about the trace stats easier.
-  // This place swaps the contents of each |packets| entry in place.
-  if (!tracing_session->trace_filter) {
+                                            std::vector<TracePacket>* packets,
+                                            size_t begin,
+                                            size_t end) {
+  if (!tracing_session->trace_filter || begin == end)
     return;
-  }
-  protozero::MessageFilter& trace_filter = *tracing_session->trace_filter;
-  // The filter root shoud be reset from protos.Trace to protos.TracePacket
-  // by the earlier call to SetFilterRoot() in EnableTracing().
-  PERFETTO_DCHECK(trace_filter.root_msg_index() != 0);
-  std::vector<protozero::MessageFilter::InputSlice> filter_input;
-  for (TracePacket& packet : *packets) {
-    const auto& packet_slices = packet.slices();
-    filter_input.clear();
-    filter_input.resize(packet_slices.size());
-    ++tracing_session->filter_input_packets;
-    tracing_session->filter_input_bytes += packet.size();
-    for (size_t i = 0; i < packet_slices.size(); ++i)
-      filter_input[i] = {packet_slices[i].start, packet_slices[i].size};
-    auto filtered_packet = trace_filter.FilterMessageFragments(
-        &filter_input[0], filter_input.size());
+  FilterStats stats;
+  FilterPackets(tracing_session->trace_filter.get(), packets, begin, end,
+                &stats);
+  tracing_session->filter_input_packets += stats.input_packets;
+  tracing_session->filter_input_bytes += stats.input_bytes;
+  tracing_session->filter_output_bytes += stats.output_bytes;
+  tracing_session->filter_errors += stats.errors;
+}
 
-    // Replace the packet in-place with the filtered one (unless failed).
-    packet = TracePacket();
-    if (filtered_packet.error) {
-      ++tracing_session->filter_errors;
-      PERFETTO_DLOG("Trace packet filtering failed @ packet %" PRIu64,
-                    tracing_session->filter_input_packets);
-      continue;
-    }
-    tracing_session->filter_output_bytes += filtered_packet.size;
-    AppendOwnedSlicesToPacket(std::move(filtered_packet.data),
-                              filtered_packet.size, kMaxTracePacketSliceSize,
-                              &packet);
+protozero::MessageFilter* TracingServiceImpl::GetBufferFilter(
+    TracingSession* tracing_session,
+    size_t buf_idx) {
+  auto& buffer_filters = tracing_session->buffer_filters;
+  if (buffer_filters.size() <= buf_idx)
+    buffer_filters.resize(tracing_session->num_buffers());
+  std::unique_ptr<protozero::MessageFilter>& filter = buffer_filters[buf_idx];
+  if (!filter) {
+    // The bytecode and the root have already been validated by EnableTracing()
+    // when creating |trace_filter|.
+    const std::string& bytecode =
+        tracing_session->config.trace_filter().bytecode();
+    uint32_t packet_field_id = TracePacket::kPacketFieldNumber;
+    filter.reset(new protozero::MessageFilter());
+    PERFETTO_CHECK(
+        filter->LoadFilterBytecode(bytecode.data(), bytecode.size()) &&
+        filter->SetFilterRoot(&packet_field_id, 1));
   }
+  return filter.get();
 }
 
 bool TracingServiceImpl::WriteIntoFile(TracingSession* tracing_session,
                                        std::vector<TracePacket> packets) {
-  if (!tracing_session->write_into_file) {
+  TraceFileWriter* file_writer = tracing_session->write_into_file.get();
+  if (!file_writer) {
     return false;
   }
   const uint64_t max_size = tracing_session->max_file_size_bytes
                                 ? tracing_session->max_file_size_bytes
                                 : std::numeric_limits<size_t>::max();
 
-  size_t total_slices = 0;
-  for (const TracePacket& packet : packets) {
-    total_slices += packet.slices().size();
-  }
-  // When writing into a file, the file should look like a root trace.proto
-  // message. Each packet should be prepended with a proto preamble stating
-  // its field id (within trace.proto) and size. Hence the addition below.
-  const size_t max_iovecs = total_slices + packets.size();
-
-  size_t num_iovecs = 0;
-  bool stop_writing_into_file = false;
-  std::unique_ptr<struct iovec[]> iovecs(new struct iovec[max_iovecs]);
-  size_t num_iovecs_at_last_packet = 0;
-  uint64_t bytes_about_to_be_written = 0;
+  // The file writer only copies the packets here, the actual write (and
+  // compression) happens on its I/O thread, in parallel with the next
+  // ReadBuffers(). A write error is only noticed on the following call.
+  bool stop_writing_into_file = file_writer->has_error();
+  uint64_t bytes_appended = 0;
   for (TracePacket& packet : packets) {
-    std::tie(iovecs[num_iovecs].iov_base, iovecs[num_iovecs].iov_len) =
-        packet.GetProtoPreamble();
-    bytes_about_to_be_written += iovecs[num_iovecs].iov_len;
-    num_iovecs++;
-    for (const Slice& slice : packet.slices()) {
-      // writev() doesn't change the passed pointer. However, struct iovec
-      // take a non-const ptr because it's the same struct used by readv().
-      // Hence the const_cast here.
-      char* start = static_cast<char*>(const_cast<void*>(slice.start));
-      bytes_about_to_be_written += slice.size;
-      iovecs[num_iovecs++] = {start, slice.size};
-    }
-
-    if (tracing_session->bytes_written_into_file + bytes_about_to_be_written >=
-        max_size) {
-      stop_writing_into_file = true;
-      num_iovecs = num_iovecs_at_last_packet;
+    if (stop_writing_into_file)
       break;
-    }
-
-    num_iovecs_at_last_packet = num_iovecs;
-  }
-  PERFETTO_DCHECK(num_iovecs <= max_iovecs);
-  int fd = *tracing_session->write_into_file;
-
-  uint64_t total_wr_size = 0;
-
-  // writev() can take at most IOV_MAX entries per call. Batch them.
-  constexpr size_t kIOVMax = IOV_MAX;
-  for (size_t i = 0; i < num_iovecs; i += kIOVMax) {
-    int iov_batch_size = static_cast<int>(std::min(num_iovecs - i, kIOVMax));
-    ssize_t wr_size = PERFETTO_EINTR(writev(fd, &iovecs[i], iov_batch_size));
-    if (wr_size <= 0) {
-      PERFETTO_PLOG("writev() failed");
+    // When writing into a file, the file should look like a root trace.proto
+    // message. Each packet is prepended with a proto preamble stating its
+    // field id (within trace.proto) and size. Hence the addition below.
+    // Note that, when the trace is compressed, |max_size| still applies to the
+    // uncompressed size, which overestimates the size of the file.
+    const uint64_t packet_size =
+        std::get<1>(packet.GetProtoPreamble()) + packet.size();
+    if (tracing_session->bytes_written_into_file + bytes_appended +
+            packet_size >=
+        max_size) {
       stop_writing_into_file = true;
       break;
     }
-    total_wr_size += static_cast<size_t>(wr_size);
+    file_writer->AppendPacket(&packet);
+    bytes_appended += packet_size;
   }
-
-  tracing_session->bytes_written_into_file += total_wr_size;
+  file_writer->Commit();
+  tracing_session->bytes_written_into_file += bytes_appended;
 
   PERFETTO_DLOG("Draining into file, written: %" PRIu64 " KB, stop: %d",
-                (total_wr_size + 1023) / 1024, stop_writing_into_file);
+                (bytes_appended + 1023) / 1024, stop_writing_into_file);
   return stop_writing_into_file;
 }
 
@@ -3229,6 +3379,23 @@ TraceStats TracingServiceImpl::GetTraceStats(TracingSession* tracing_session) {
     filt_stats->set_errors(tracing_session->filter_errors);
   }
 
+  if (tracing_session->config.write_into_file()) {
+    // Once the file is closed, report the stats of the writer at that point.
+    const TraceFileWriter::Stats file_stats =
+        tracing_session->write_into_file
+            ? tracing_session->write_into_file->GetStats()
+            : tracing_session->write_into_file_stats;
+    auto* wf_stats = trace_stats.mutable_write_into_file_stats();
+    wf_stats->set_input_bytes(file_stats.input_bytes);
+    wf_stats->set_output_bytes(file_stats.output_bytes);
+    wf_stats->set_batches(file_stats.batches);
+    wf_stats->set_stalls(file_stats.stalls);
+    wf_stats->set_stall_duration_ns(file_stats.stall_duration_ns);
+    wf_stats->set_write_duration_ns(file_stats.write_duration_ns);
+    wf_stats->set_max_write_lag_ns(file_stats.max_write_lag_ns);
+    wf_stats->set_errors(file_stats.errors);
+  }
+
   for (BufferID buf_id : tracing_session->buffers_index) {
     TraceBuffer* buf = GetBufferByID(buf_id);
     if (!buf) {
@@ -3428,26 +3595,21 @@ bool TracingServiceImpl::MaybeSaveTraceForBugreport(
     return false;
 
   if (max_session->write_into_file) {
-    auto fd = *max_session->write_into_file;
     // If we are stealing a write_into_file session, add a marker that explains
     // why the trace has been stolen rather than creating an empty file. This is
     // only for write_into_file traces. A similar code path deals with the case
     // of reading-back a seized trace from IPC in ReadBuffersIntoConsumer().
+    // The marker is written, without waiting for it, when the old file writer
+    // is destroyed below.
     if (!max_session->config.builtin_data_sources().disable_service_events()) {
       std::vector<TracePacket> packets;
       EmitSeizedForBugreportLifecycleEvent(&packets);
-      for (auto& packet : packets) {
-        char* preamble;
-        size_t preamble_size = 0;
-        std::tie(preamble, preamble_size) = packet.GetProtoPreamble();
-        base::WriteAll(fd, preamble, preamble_size);
-        for (const Slice& slice : packet.slices()) {
-          base::WriteAll(fd, slice.start, slice.size);
-        }
-      }  // for (packets)
-    }    // if (!disable_service_events())
-  }      // if (max_session->write_into_file)
-  max_session->write_into_file = std::move(br_fd);
+      for (auto& packet : packets)
+        max_session->write_into_file->AppendPacket(&packet);
+    }
+  }
+  max_session->write_into_file =
+      CreateTraceFileWriter(std::move(br_fd), max_session->config);
   max_session->on_disable_callback_for_bugreport = std::move(callback);
   max_session->seized_for_bugreport = true;
 
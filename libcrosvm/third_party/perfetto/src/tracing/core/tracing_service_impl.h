@@ -27,6 +27,7 @@
 #include <utility>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/base/time.h"
@@ -47,6 +48,11 @@
 #include "perfetto/tracing/core/trace_config.h"
 #include "src/android_stats/perfetto_atoms.h"
 #include "src/tracing/core/id_allocator.h"
+#include "src/tracing/core/trace_file_writer.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+#include "perfetto/ext/base/thread_pool.h"
+#endif
 
 namespace protozero {
 class MessageFilter;
@@ -617,14 +623,17 @@ class TracingServiceImpl : public TracingService {
     std::string detach_key;
 
     // This is set when the Consumer calls sets |write_into_file| == true in the
-    // TraceConfig. In this case this represents the file we should stream the
+    // TraceConfig. In this case this writes into the file we should stream the
     // trace packets into, rather than returning it to the consumer via
     // OnTraceData().
-    base::ScopedFile write_into_file;
+    std::unique_ptr<TraceFileWriter> write_into_file;
     uint32_t write_period_ms = 0;
     uint64_t max_file_size_bytes = 0;
     uint64_t bytes_written_into_file = 0;
 
+    // The stats of |write_into_file| when the file was closed.
+    TraceFileWriter::Stats write_into_file_stats;
+
     // Set when using SaveTraceForBugreport(). This callback will be called
     // when the tracing session ends and the data has been saved into the file.
     std::function<void()> on_disable_callback_for_bugreport;
@@ -641,6 +650,12 @@ class TracingServiceImpl : public TracingService {
     uint64_t filter_output_bytes = 0;
     uint64_t filter_errors = 0;
 
+    // One filter per buffer, used when the buffers are filtered in parallel by
+    // ReadBuffers(). MessageFilter keeps state while filtering, so a filter
+    // can't be shared across threads. Created lazily from the same bytecode as
+    // |trace_filter|.
+    std::vector<std::unique_ptr<protozero::MessageFilter>> buffer_filters;
+
     // A randomly generated trace identifier. Note that this does NOT always
     // match the requested TraceConfig.trace_uuid_msb/lsb. Spcifically, it does
     // until a gap-less snapshot is requested. Each snapshot re-generates the
@@ -715,17 +730,32 @@ class TracingServiceImpl : public TracingService {
   // Reads the buffers from `*tracing_session` and returns them (along with some
   // metadata packets).
   //
-  // The function stops when the cumulative size of the return packets exceeds
-  // `threshold` (so it's not a strict upper bound) and sets `*has_more` to
-  // true, or when there are no more packets (and sets `*has_more` to false).
+  // When the session has more than one buffer, the buffers are read, validated
+  // and filtered in parallel on `read_buffers_pool_` (except on NaCl). The
+  // packets of each buffer are then appended in buffer order, so the order of
+  // the packets within a buffer is the same as if the buffers were read
+  // sequentially.
+  //
+  // Reading stops when the cumulative size of the packets read from all the
+  // buffers exceeds `threshold`. It's not a strict upper bound: the reader of
+  // each buffer can go over it by one packet. `*has_more` is set to true if
+  // that happened, or to false when there are no more packets.
   std::vector<TracePacket> ReadBuffers(TracingSession* tracing_session,
                                        size_t threshold,
                                        bool* has_more);
 
-  // If `*tracing_session` has a filter, applies it to `*packets`. Doesn't
-  // change the number of `*packets`, only their content.
+  // If `*tracing_session` has a filter, applies it to the packets in
+  // [`begin`, `end`) of `*packets`. Doesn't change the number of `*packets`,
+  // only their content.
   void MaybeFilterPackets(TracingSession* tracing_session,
-                          std::vector<TracePacket>* packets);
+                          std::vector<TracePacket>* packets,
+                          size_t begin,
+                          size_t end);
+
+  // Returns the filter used for the `buf_idx`-th buffer of `*tracing_session`
+  // when the buffers are filtered in parallel.
+  protozero::MessageFilter* GetBufferFilter(TracingSession* tracing_session,
+                                            size_t buf_idx);
 
   // If `*tracing_session` is configured to write into a file, writes `packets`
   // into the file.
@@ -764,6 +794,12 @@ class TracingServiceImpl : public TracingService {
   std::map<BufferID, std::unique_ptr<TraceBuffer>> buffers_;
   std::map<std::string, int64_t> session_to_last_trace_s_;
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  // Worker threads used by ReadBuffers() for sessions with several buffers.
+  // Lazily created.
+  std::unique_ptr<base::ThreadPool> read_buffers_pool_;
+#endif
+
   // Contains timestamps of triggers.
   // The queue is sorted by timestamp and invocations older than
   // |trigger_window_ns_| are purged when a trigger happens.
@@ -18,6 +18,7 @@
 
 #include <string.h>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/temp_file.h"
@@ -49,6 +50,10 @@
 #include "protos/perfetto/trace/trace_uuid.gen.h"
 #include "protos/perfetto/trace/trigger.gen.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include <zlib.h>
+#endif
+
 using ::testing::_;
 using ::testing::AssertionFailure;
 using ::testing::AssertionResult;
@@ -1801,8 +1806,170 @@ TEST_F(TracingServiceImplTest, WriteIntoFileFilterMultipleChunks) {
   }
   EXPECT_EQ(total_size, stats.filter_stats().output_bytes());
   EXPECT_GT(total_size, kNumTestPackets * kPayloadSize);
+
+  // The stats of the file writer are kept after the file has been closed.
+  EXPECT_EQ(stats.write_into_file_stats().output_bytes(), trace_raw.size());
+  EXPECT_GE(stats.write_into_file_stats().batches(), 2u);
+  EXPECT_EQ(stats.write_into_file_stats().errors(), 0u);
+}
+
+// With several buffers, the buffers are read and filtered in parallel. The
+// packets of each buffer must still come out in order and filtered.
+TEST_F(TracingServiceImplTest, ReadBuffersFilterMultipleBuffers) {
+  static const size_t kNumBuffers = 4;
+  static const size_t kNumTestPackets = 100;
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+
+  TraceConfig trace_config;
+  for (size_t i = 0; i < kNumBuffers; i++) {
+    std::string ds_name = "data_source" + std::to_string(i);
+    producer->RegisterDataSource(ds_name);
+    trace_config.add_buffers()->set_size_kb(128);
+    auto* ds_config = trace_config.add_data_sources()->mutable_config();
+    ds_config->set_name(ds_name);
+    ds_config->set_target_buffer(static_cast<uint32_t>(i));
+  }
+
+  protozero::FilterBytecodeGenerator filt;
+  // Message 0: root Trace proto.
+  filt.AddNestedField(1 /* root trace.packet*/, 1);
+  filt.EndMessage();
+  // Message 1: TracePacket proto. Allow only the for_testing field, so the
+  // trusted fields appended by the service are filtered out.
+  filt.AddSimpleField(protos::pbzero::TracePacket::kForTestingFieldNumber);
+  filt.EndMessage();
+  trace_config.mutable_trace_filter()->set_bytecode(filt.Serialize());
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  std::vector<std::unique_ptr<TraceWriter>> writers;
+  for (size_t i = 0; i < kNumBuffers; i++) {
+    std::string ds_name = "data_source" + std::to_string(i);
+    producer->WaitForDataSourceSetup(ds_name);
+    producer->WaitForDataSourceStart(ds_name);
+    writers.emplace_back(producer->CreateTraceWriter(ds_name));
+  }
+
+  // Interleave the writes across the buffers.
+  std::vector<std::vector<std::string>> expected_payloads(kNumBuffers);
+  for (size_t i = 0; i < kNumTestPackets; i++) {
+    for (size_t buf_idx = 0; buf_idx < kNumBuffers; buf_idx++) {
+      std::string payload = std::to_string(buf_idx) + "-" + std::to_string(i);
+      auto tp = writers[buf_idx]->NewTracePacket();
+      tp->set_for_testing()->set_str(payload.c_str(), payload.size());
+      expected_payloads[buf_idx].push_back(std::move(payload));
+    }
+  }
+  for (auto& writer : writers) {
+    writer->Flush();
+    writer.reset();
+  }
+
+  consumer->DisableTracing();
+  for (size_t i = 0; i < kNumBuffers; i++)
+    producer->WaitForDataSourceStop("data_source" + std::to_string(i));
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  std::vector<std::string> payloads;
+  for (const auto& packet : packets) {
+    EXPECT_FALSE(packet.has_trusted_uid());
+    EXPECT_FALSE(packet.has_trusted_packet_sequence_id());
+    if (packet.has_for_testing())
+      payloads.push_back(packet.for_testing().str());
+  }
+
+  // The buffers are emitted one after the other, in the order of the config.
+  std::vector<std::string> expected;
+  for (const auto& buffer_payloads : expected_payloads)
+    expected.insert(expected.end(), buffer_payloads.begin(),
+                    buffer_payloads.end());
+  EXPECT_THAT(payloads, ElementsAreArray(expected));
+
+  consumer->GetTraceStats();
+  TraceStats stats = consumer->WaitForTraceStats(true);
+  EXPECT_EQ(stats.filter_stats().input_packets(), packets.size());
+  EXPECT_EQ(stats.filter_stats().errors(), 0u);
 }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+TEST_F(TracingServiceImplTest, WriteIntoFileCompressed) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_compression_type(TraceConfig::COMPRESSION_TYPE_DEFLATE);
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  static const size_t kNumTestPackets = 1000;
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (size_t i = 0; i < kNumTestPackets; i++) {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload");
+  }
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  consumer->GetTraceStats();
+  TraceStats stats = consumer->WaitForTraceStats(true);
+
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  EXPECT_EQ(stats.write_into_file_stats().output_bytes(), trace_raw.size());
+  EXPECT_LT(stats.write_into_file_stats().output_bytes(),
+            stats.write_into_file_stats().input_bytes());
+
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+  size_t num_test_packets = 0;
+  for (const protos::gen::TracePacket& packet : trace.packet()) {
+    ASSERT_TRUE(packet.has_compressed_packets());
+    z_stream stream{};
+    ASSERT_EQ(inflateInit(&stream), Z_OK);
+    const std::string& compressed = packet.compressed_packets();
+    stream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+    stream.avail_in = static_cast<uInt>(compressed.size());
+    std::string decompressed(kNumTestPackets * 1024, '\0');
+    stream.next_out = reinterpret_cast<Bytef*>(&decompressed[0]);
+    stream.avail_out = static_cast<uInt>(decompressed.size());
+    ASSERT_EQ(inflate(&stream, Z_FINISH), Z_STREAM_END);
+    decompressed.resize(stream.total_out);
+    inflateEnd(&stream);
+
+    protos::gen::Trace inner_trace;
+    ASSERT_TRUE(inner_trace.ParseFromString(decompressed));
+    for (const protos::gen::TracePacket& inner_packet : inner_trace.packet())
+      num_test_packets += inner_packet.for_testing().str() == "payload";
+  }
+  EXPECT_EQ(num_test_packets, kNumTestPackets);
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
 // Test the logic that allows the trace config to set the shm total size and
 // page size from the trace config. Also check that, if the config doesn't
 // specify a value we fall back on the hint provided by the producer.
@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+# Copyright (C) 2022 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Replays query logs against a trace_processor_shell --httpd server.
+
+Each query log is a text file containing SQL statements, each terminated by a
+';' at the end of a line. The queries are issued on --concurrency connections
+in parallel, spread across the sessions passed with --sessions, and the latency
+distribution of the queries is printed at the end.
+
+Example:
+  trace_processor_shell --httpd &
+  tools/tp_httpd_load_test.py --trace trace.pftrace --sessions a,b,c \\
+      --concurrency 8 --repeat 10 queries.sql
+"""
+
+import argparse
+import http.client
+import re
+import sys
+import threading
+import time
+
+SESSION_HEADER = 'x-tp-session-id'
+PARSE_CHUNK_SIZE = 32 * 1024 * 1024
+
+# Field numbers from protos/perfetto/trace_processor/trace_processor.proto.
+QUERY_ARGS_SQL_QUERY = 1
+QUERY_RESULT_ERROR = 2
+
+
+def encode_varint(value):
+  out = bytearray()
+  while True:
+    byte = value & 0x7f
+    value >>= 7
+    if value:
+      out.append(byte | 0x80)
+    else:
+      out.append(byte)
+      return bytes(out)
+
+
+def decode_varint(buf, pos):
+  value = 0
+  shift = 0
+  while True:
+    byte = buf[pos]
+    pos += 1
+    value |= (byte & 0x7f) << shift
+    shift += 7
+    if not byte & 0x80:
+      return value, pos
+
+
+def encode_query_args(sql):
+  sql_bytes = sql.encode('utf-8')
+  return (encode_varint(QUERY_ARGS_SQL_QUERY << 3 | 2) +
+          encode_varint(len(sql_bytes)) + sql_bytes)
+
+
+def find_query_error(result):
+  """Returns the error of a serialized (sequence of) QueryResult, if any."""
+  pos = 0
+  while pos < len(result):
+    tag, pos = decode_varint(result, pos)
+    field, wire_type = tag >> 3, tag & 7
+    if wire_type == 0:
+      _, pos = decode_varint(result, pos)
+    elif wire_type == 1:
+      pos += 8
+    elif wire_type == 5:
+      pos += 4
+    elif wire_type == 2:
+      size, pos = decode_varint(result, pos)
+      if field == QUERY_RESULT_ERROR:
+        return result[pos:pos + size].decode('utf-8', 'replace')
+      pos += size
+    else:
+      return 'Malformed QueryResult'
+  return None
+
+
+def read_query_logs(paths):
+  queries = []
+  for path in paths:
+    with open(path) as f:
+      for query in re.split(r';\s*$', f.read(), flags=re.MULTILINE):
+        query = query.strip()
+        if query:
+          queries.append(query)
+  return queries
+
+
+def post(conn, endpoint, session, body=b''):
+  headers = {SESSION_HEADER: session} if session else {}
+  conn.request('POST', endpoint, body=body, headers=headers)
+  response = conn.getresponse()
+  data = response.read()
+  if response.status != 200:
+    raise Exception('%s failed: HTTP %d' % (endpoint, response.status))
+  return data
+
+
+def load_trace(host, port, session, trace_path):
+  conn = http.client.HTTPConnection(host, port)
+  with open(trace_path, 'rb') as f:
+    while True:
+      chunk = f.read(PARSE_CHUNK_SIZE)
+      if not chunk:
+        break
+      post(conn, '/parse', session, chunk)
+  post(conn, '/notify_eof', session)
+  conn.close()
+
+
+def percentile(sorted_values, pct):
+  if not sorted_values:
+    return 0
+  idx = min(len(sorted_values) - 1, int(len(sorted_values) * pct / 100))
+  return sorted_values[idx]
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument('--addr', default='localhost:9001')
+  parser.add_argument(
+      '--sessions',
+      default='',
+      help='Comma separated list of sessions the queries are spread across. '
+      'By default the queries go to the default session.')
+  parser.add_argument(
+      '--trace', help='Trace loaded in each of the sessions before starting.')
+  parser.add_argument('--concurrency', type=int, default=4)
+  parser.add_argument(
+      '--repeat', type=int, default=1, help='Times to replay the query logs.')
+  parser.add_argument('query_logs', nargs='+')
+  args = parser.parse_args()
+
+  host, port = args.addr.rsplit(':', 1)
+  sessions = args.sessions.split(',')
+  queries = read_query_logs(args.query_logs) * args.repeat
+  if not queries:
+    print('No queries found')
+    return 1
+
+  if args.trace:
+    for session in sessions:
+      print('Loading %s in session "%s"' % (args.trace, session))
+      load_trace(host, port, session, args.trace)
+
+  lock = threading.Lock()
+  next_query = [0]
+  latencies = []
+  errors = []
+
+  def worker():
+    conn = http.client.HTTPConnection(host, port)
+    while True:
+      with lock:
+        idx = next_query[0]
+        next_query[0] += 1
+      if idx >= len(queries):
+        break
+      session = sessions[idx % len(sessions)]
+      start = time.monotonic()
+      result = post(conn, '/query', session, encode_query_args(queries[idx]))
+      latency = time.monotonic() - start
+      error = find_query_error(result)
+      with lock:
+        latencies.append(latency)
+        if error:
+          errors.append((queries[idx], error))
+    conn.close()
+
+  print('Replaying %d queries on %d connections across %d session(s)' %
+        (len(queries), args.concurrency, len(sessions)))
+  start = time.monotonic()
+  threads = [threading.Thread(target=worker) for _ in range(args.concurrency)]
+  for thread in threads:
+    thread.start()
+  for thread in threads:
+    thread.join()
+  wall_time = time.monotonic() - start
+
+  latencies.sort()
+  print('Completed %d queries in %.2f s (%.1f queries/s), %d errors' %
+        (len(latencies), wall_time, len(latencies) / wall_time, len(errors)))
+  for label, pct in (('p50', 50), ('p90', 90), ('p99', 99), ('max', 100)):
+    print('  %s: %8.1f ms' % (label, percentile(latencies, pct) * 1000))
+  for query, error in errors[:10]:
+    print('Error: %s\n  in: %s' % (error.strip(), query[:200]))
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())